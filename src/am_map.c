@@ -39,6 +39,8 @@
 // State.
 #include "doomstat.h"
 #include "r_state.h"
+#include "r_draw.h"
+#include "doomgeneric.h"
 
 // Data.
 #include "dstrings.h"
@@ -209,6 +211,12 @@ static int	f_y;
 static int 	f_w;
 static int	f_h;
 
+// where the window's pixels are drawn: every amstep'th byte
+//  of amfb, rows ampitch apart
+static byte*	amfb;
+static int	ampitch;
+static int	amstep = 1;
+
 static int 	lightlev; 		// used for funky strobing effect
 static byte*	fb; 			// pseudo-frame buffer
 static int 	amclock;
@@ -267,6 +275,16 @@ cheatseq_t cheat_amap = CHEAT("iddt", 0);
 
 static bool stopped = true;
 
+// the walls clipped to the window, drawn from until the
+//  window pans or zooms, or the level changes
+static fline_t*	wallflines;
+static byte*	wallvisible;
+static int	wallcapacity;
+static line_t*	walllines;
+static fixed_t	wallm_x, wallm_y;
+static fixed_t	wallscale;
+static int	wallf_h;
+
 // Calculates the slope and slope according to the x-axis of a line
 // segment in map coordinates (with the upright y-axis n' all) so
 // that it can be used with the brain-dead drawing stuff.
@@ -418,6 +436,67 @@ void AM_changeWindowLoc(void)
 }
 
 
+//
+// AM_frameSize
+// The window is drawn on every renderscale'th screen pixel, those
+//  the terminal samples, so that its pixels are the terminal's
+//  cells. With -braillemap it is drawn on the backend's dots.
+//
+void AM_frameSize(int *w, int *h)
+{
+    int scale;
+
+    if (DG_Dots)
+    {
+	scale = SCREENWIDTH / DOOMGENERIC_RESX;
+	*w = DG_DotsWidth * finit_width / SCREENWIDTH;
+	*h = (finit_height + scale - 1) / scale * (DG_DotsHeight / DOOMGENERIC_RESY);
+    }
+    else
+    {
+	*w = finit_width / renderscale;
+	*h = finit_height / renderscale;
+    }
+}
+
+
+//
+// AM_setFrame
+// Follows the frame size, keeping the same part of the map
+//  in the window.
+//
+void AM_setFrame(void)
+{
+    int w, h;
+
+    AM_frameSize(&w, &h);
+
+    if (w != f_w || h != f_h)
+    {
+	scale_mtof = (int64_t) scale_mtof * w / f_w;
+	scale_ftom = FixedDiv(FRACUNIT, scale_mtof);
+	f_w = w;
+	f_h = h;
+
+	AM_findMinMaxBoundaries();
+	AM_activateNewScale();
+    }
+
+    if (DG_Dots)
+    {
+	amfb = DG_Dots;
+	ampitch = DG_DotsWidth;
+	amstep = 1;
+    }
+    else
+    {
+	amfb = fb;
+	ampitch = SCREENWIDTH * renderscale;
+	amstep = renderscale;
+    }
+}
+
+
 //
 //
 //
@@ -520,8 +599,7 @@ void AM_LevelInit(void)
     leveljuststarted = 0;
 
     f_x = f_y = 0;
-    f_w = finit_width;
-    f_h = finit_height;
+    AM_frameSize(&f_w, &f_h);
 
     AM_clearMarks();
 
@@ -563,6 +641,7 @@ void AM_Start (void)
 	lastlevel = gamemap;
 	lastepisode = gameepisode;
     }
+    AM_setFrame();
     AM_initVariables();
     AM_loadPics();
 }
@@ -619,22 +698,22 @@ AM_Responder
 
         if (key == key_map_east)          // pan right
         {
-            if (!followplayer) m_paninc.x = FTOM(F_PANINC);
+            if (!followplayer) m_paninc.x = FTOM(F_PANINC*f_w)/finit_width;
             else rc = false;
         }
         else if (key == key_map_west)     // pan left
         {
-            if (!followplayer) m_paninc.x = -FTOM(F_PANINC);
+            if (!followplayer) m_paninc.x = -FTOM(F_PANINC*f_w)/finit_width;
             else rc = false;
         }
         else if (key == key_map_north)    // pan up
         {
-            if (!followplayer) m_paninc.y = FTOM(F_PANINC);
+            if (!followplayer) m_paninc.y = FTOM(F_PANINC*f_w)/finit_width;
             else rc = false;
         }
         else if (key == key_map_south)    // pan down
         {
-            if (!followplayer) m_paninc.y = -FTOM(F_PANINC);
+            if (!followplayer) m_paninc.y = -FTOM(F_PANINC*f_w)/finit_width;
             else rc = false;
         }
         else if (key == key_map_zoomout)  // zoom out
@@ -833,7 +912,17 @@ void AM_Ticker (void)
 //
 void AM_clearFB(int color)
 {
-    memset(fb, color, f_w*f_h);
+    int y;
+
+    // only the rows the terminal samples, under the dots too
+    if (renderscale == 1)
+	memset(fb, color, finit_width*finit_height);
+    else
+	for (y=0;y<finit_height;y+=renderscale)
+	    memset(fb + y*SCREENWIDTH, color, SCREENWIDTH);
+
+    if (DG_Dots)
+	memset(DG_Dots, 0, f_h*DG_DotsWidth);
 }
 
 
@@ -1007,7 +1096,7 @@ AM_drawFline
 	return;
     }
 
-#define PUTDOT(xx,yy,cc) fb[(yy)*f_w+(xx)]=(cc)
+#define PUTDOT(xx,yy,cc) amfb[(yy)*ampitch+(xx)*amstep]=(cc)
 
     dx = fl->b.x - fl->a.x;
     ax = 2 * (dx<0 ? -dx : dx);
@@ -1117,13 +1206,30 @@ void AM_drawGrid(int color)
 }
 
 //
-// Determines visible lines, draws them.
-// This is LineDef based, not LineSeg based.
+// AM_clipWalls
+// Clips every wall to the window, once for each place the window
+//  is in, whether it is to be drawn or not.
 //
-void AM_drawWalls(void)
+void AM_clipWalls(void)
 {
     int i;
-    static mline_t l;
+    mline_t l;
+
+    if (walllines == lines && wallm_x == m_x && wallm_y == m_y
+     && wallscale == scale_mtof && wallf_h == f_h)
+	return;
+
+    if (numlines > wallcapacity)
+    {
+	if (wallflines)
+	{
+	    Z_Free(wallflines);
+	    Z_Free(wallvisible);
+	}
+	wallcapacity = numlines;
+	wallflines = Z_Malloc(wallcapacity * sizeof(*wallflines), PU_STATIC, 0);
+	wallvisible = Z_Malloc(wallcapacity, PU_STATIC, 0);
+    }
 
     for (i=0;i<numlines;i++)
     {
@@ -1131,42 +1237,72 @@ void AM_drawWalls(void)
 	l.a.y = lines[i].v1->y;
 	l.b.x = lines[i].v2->x;
 	l.b.y = lines[i].v2->y;
+	wallvisible[i] = AM_clipMline(&l, &wallflines[i]);
+    }
+
+    walllines = lines;
+    wallm_x = m_x;
+    wallm_y = m_y;
+    wallscale = scale_mtof;
+    wallf_h = f_h;
+}
+
+//
+// Determines visible lines, draws them.
+// This is LineDef based, not LineSeg based.
+//
+void AM_drawWalls(void)
+{
+    int i;
+    int color;
+
+    AM_clipWalls();
+
+    for (i=0;i<numlines;i++)
+    {
+	if (!wallvisible[i])
+	    continue;
+
+	color = -1;
 	if (cheating || (lines[i].flags & ML_MAPPED))
 	{
 	    if ((lines[i].flags & LINE_NEVERSEE) && !cheating)
 		continue;
 	    if (!lines[i].backsector)
 	    {
-		AM_drawMline(&l, WALLCOLORS+lightlev);
+		color = WALLCOLORS+lightlev;
 	    }
 	    else
 	    {
 		if (lines[i].special == 39)
 		{ // teleporters
-		    AM_drawMline(&l, WALLCOLORS+WALLRANGE/2);
+		    color = WALLCOLORS+WALLRANGE/2;
 		}
 		else if (lines[i].flags & ML_SECRET) // secret door
 		{
-		    if (cheating) AM_drawMline(&l, SECRETWALLCOLORS + lightlev);
-		    else AM_drawMline(&l, WALLCOLORS+lightlev);
+		    if (cheating) color = SECRETWALLCOLORS + lightlev;
+		    else color = WALLCOLORS+lightlev;
 		}
 		else if (lines[i].backsector->floorheight
 			   != lines[i].frontsector->floorheight) {
-		    AM_drawMline(&l, FDWALLCOLORS + lightlev); // floor level change
+		    color = FDWALLCOLORS + lightlev; // floor level change
 		}
 		else if (lines[i].backsector->ceilingheight
 			   != lines[i].frontsector->ceilingheight) {
-		    AM_drawMline(&l, CDWALLCOLORS+lightlev); // ceiling level change
+		    color = CDWALLCOLORS+lightlev; // ceiling level change
 		}
 		else if (cheating) {
-		    AM_drawMline(&l, TSWALLCOLORS+lightlev);
+		    color = TSWALLCOLORS+lightlev;
 		}
 	    }
 	}
 	else if (plr->powers[pw_allmap])
 	{
-	    if (!(lines[i].flags & LINE_NEVERSEE)) AM_drawMline(&l, GRAYS+3);
+	    if (!(lines[i].flags & LINE_NEVERSEE)) color = GRAYS+3;
 	}
+
+	if (color != -1)
+	    AM_drawFline(&wallflines[i], color);
     }
 }
 
@@ -1320,9 +1456,9 @@ void AM_drawMarks(void)
 	    //      h = SHORT(marknums[i]->height);
 	    w = 5; // because something's wrong with the wad, i guess
 	    h = 6; // because something's wrong with the wad, i guess
-	    fx = CXMTOF(markpoints[i].x);
-	    fy = CYMTOF(markpoints[i].y);
-	    if (fx >= f_x && fx <= f_w - w && fy >= f_y && fy <= f_h - h)
+	    fx = CXMTOF(markpoints[i].x) * finit_width / f_w;
+	    fy = CYMTOF(markpoints[i].y) * finit_height / f_h;
+	    if (fx >= f_x && fx <= finit_width - w && fy >= f_y && fy <= finit_height - h)
 		V_DrawPatch(fx, fy, marknums[i]);
 	}
     }
@@ -1331,7 +1467,7 @@ void AM_drawMarks(void)
 
 void AM_drawCrosshair(int color)
 {
-    fb[(f_w*(f_h+1))/2] = color; // single point for now
+    PUTDOT(f_w/2, f_h/2, color); // single point for now
 
 }
 
@@ -1339,6 +1475,8 @@ void AM_Drawer (void)
 {
     if (!automapactive) return;
 
+    AM_setFrame();
+
     AM_clearFB(BACKGROUND);
     if (grid)
 	AM_drawGrid(GRIDCOLORS);
@@ -1350,6 +1488,9 @@ void AM_Drawer (void)
 
     AM_drawMarks();
 
-    V_MarkRect(f_x, f_y, f_w, f_h);
+    V_MarkRect(f_x, f_y, finit_width, finit_height);
+
+    if (DG_Dots)
+	DG_DotsShown = 1;
 
 }
@@ -0,0 +1,269 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     benchmark comparison, built with "make bench"
+//
+// Runs two commands, such as two builds or one build with two sets of
+// options, in turn a number of times, reads the figures the engine and
+// encoder_bench print, and reports how each changed from the first to the
+// second, with a 95% confidence interval. It exits with 1 where a figure
+// got worse by more than the threshold, beyond the interval's doubt.
+//
+//     bench_compare [-runs n] [-threshold percent] <command a> <command b> [corpus ...]
+//
+// The commands go to the shell. With a corpus, each file of it in turn
+// takes the place of {} in them, and each figure is reported for each file.
+//
+// Figures read:
+//     tics/sec   of a -timedemo with -nodraw (G_CheckDemoStatus)
+//     fps        of a -timedemo ("timed ... fps")
+//     stage us   median and p99 of each stage of a -timedemo (M_PrintStageTimes)
+//     us/tic     of -benchplaysim (P_BenchPlaysim)
+//     ns/frame and bytes/frame of encoder_bench, for each scaling and mode
+//
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_RUNS 64
+#define MAX_METRICS 256
+#define NAME_LEN 96
+#define COMMAND_LEN 4096
+
+struct metric_t {
+	char name[NAME_LEN];
+	bool higher_better;
+	double a[MAX_RUNS];
+	double b[MAX_RUNS];
+	int runs_a;
+	int runs_b;
+};
+
+struct metric_t metrics[MAX_METRICS];
+int num_metrics;
+
+/* Two-sided 95% quantiles of Student's t, by degrees of freedom */
+const double t_table[] = {
+	0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+double tQuantile(int df)
+{
+	if (df < (int)(sizeof(t_table) / sizeof(*t_table)))
+		return t_table[df];
+	return 1.960;
+}
+
+/* Adds a run's value of a figure, for command a or b */
+void addValue(const char *name, bool higher_better, bool second, double value)
+{
+	struct metric_t *m;
+	int i;
+
+	for (i = 0; i < num_metrics; i++)
+		if (!strcmp(metrics[i].name, name))
+			break;
+	if (i == num_metrics) {
+		if (num_metrics == MAX_METRICS)
+			return;
+		m = &metrics[num_metrics++];
+		snprintf(m->name, sizeof(m->name), "%s", name);
+		m->higher_better = higher_better;
+	}
+	m = &metrics[i];
+
+	if (second) {
+		if (m->runs_b < MAX_RUNS)
+			m->b[m->runs_b++] = value;
+	} else {
+		if (m->runs_a < MAX_RUNS)
+			m->a[m->runs_a++] = value;
+	}
+}
+
+/* Reads the figures from a line of output, the names after prefix */
+void parseLine(const char *line, const char *prefix, bool second)
+{
+	char name[NAME_LEN], stage[32], colors[16], map[16];
+	double value, median, p99;
+	unsigned scaling;
+	unsigned long long ns, bytes, escapes;
+	int samples, tics, ms;
+	const char *s;
+
+	if (sscanf(line, "G_CheckDemoStatus: %d gametics in %d ms (%lf tics/sec)", &tics, &ms, &value) == 3) {
+		snprintf(name, sizeof(name), "%stics/sec", prefix);
+		addValue(name, true, second, value);
+	} else if ((s = strstr(line, "timed ")) && sscanf(s, "timed %d gametics in %d realtics (%lf fps)", &tics, &ms, &value) == 3) {
+		snprintf(name, sizeof(name), "%sfps", prefix);
+		addValue(name, true, second, value);
+	} else if (sscanf(line, "M_PrintStageTimes: %31s %d %lf %lf %lf", stage, &samples, &value, &median, &p99) == 5) {
+		if (!strcmp(stage, "bytes")) {
+			snprintf(name, sizeof(name), "%sbytes/frame median", prefix);
+			addValue(name, false, second, median);
+			return;
+		}
+		snprintf(name, sizeof(name), "%s%s median us", prefix, stage);
+		addValue(name, false, second, median);
+		snprintf(name, sizeof(name), "%s%s p99 us", prefix, stage);
+		addValue(name, false, second, p99);
+	} else if (sscanf(line, "P_BenchPlaysim: %15[^,]", map) == 1 && (s = strstr(line, " ms, ")) && sscanf(s, " ms, %lf us a tic", &value) == 1) {
+		snprintf(name, sizeof(name), "%splaysim %s us/tic", prefix, map);
+		addValue(name, false, second, value);
+	} else if (sscanf(line, "%u %15s %llu %llu %llu", &scaling, colors, &ns, &bytes, &escapes) == 5) {
+		snprintf(name, sizeof(name), "%sencode %u %s ns/frame", prefix, scaling, colors);
+		addValue(name, false, second, ns);
+		snprintf(name, sizeof(name), "%sencode %u %s bytes/frame", prefix, scaling, colors);
+		addValue(name, false, second, bytes);
+	}
+}
+
+/* Puts corpus in place of each {} of command */
+void expandCommand(char *out, const char *command, const char *corpus)
+{
+	const size_t corpus_len = corpus ? strlen(corpus) : 0;
+	char *end = out + COMMAND_LEN - 16;
+
+	while (*command && out < end) {
+		if (corpus && command[0] == '{' && command[1] == '}' && out + corpus_len < end) {
+			memcpy(out, corpus, corpus_len);
+			out += corpus_len;
+			command += 2;
+		} else {
+			*out++ = *command++;
+		}
+	}
+	/* the engine's figures go to both */
+	strcpy(out, " 2>&1");
+}
+
+void runCommand(const char *command, const char *corpus, bool second)
+{
+	char expanded[COMMAND_LEN];
+	char prefix[NAME_LEN];
+	char line[1024];
+	FILE *f;
+
+	expandCommand(expanded, command, corpus);
+	prefix[0] = '\0';
+	if (corpus) {
+		const char *base = strrchr(corpus, '/');
+		snprintf(prefix, sizeof(prefix), "%s: ", base ? base + 1 : corpus);
+	}
+
+	f = popen(expanded, "r");
+	if (!f) {
+		fprintf(stderr, "bench_compare: couldn't run %s\n", expanded);
+		exit(2);
+	}
+	/* a timedemo ends through I_Error, so the status isn't looked at */
+	while (fgets(line, sizeof(line), f))
+		parseLine(line, prefix, second);
+	pclose(f);
+}
+
+/* The mean and the half width of its 95% confidence interval */
+void meanInterval(const double *values, int n, double *mean, double *half)
+{
+	double sum = 0, squares = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		sum += values[i];
+	*mean = sum / n;
+	for (i = 0; i < n; i++)
+		squares += (values[i] - *mean) * (values[i] - *mean);
+	*half = n > 1 ? tQuantile(n - 1) * sqrt(squares / (n - 1) / n) : 0;
+}
+
+int main(int argc, char **argv)
+{
+	int runs = 5;
+	double threshold = 2.0;
+	const char *commands[2];
+	char **corpus = NULL;
+	int num_commands = 0, num_corpus = 0;
+	int regressions = 0;
+	int i, j, run;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-runs") && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-threshold") && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else if (num_commands < 2) {
+			commands[num_commands++] = argv[i];
+		} else {
+			corpus = argv + i;
+			num_corpus = argc - i;
+			break;
+		}
+	}
+	if (num_commands < 2 || runs < 2 || runs > MAX_RUNS || threshold < 0) {
+		fprintf(stderr, "usage: %s [-runs 2-%d] [-threshold percent] <command a> <command b> [corpus ...]\n",
+			argv[0], MAX_RUNS);
+		return 2;
+	}
+
+	/* a then b, then b then a, so that a machine warming up or slowing
+	 * down weighs on both alike */
+	for (run = 0; run < runs; run++) {
+		for (j = 0; j < (num_corpus ? num_corpus : 1); j++) {
+			const char *file = num_corpus ? corpus[j] : NULL;
+
+			fprintf(stderr, "bench_compare: run %d of %d%s%s\n", run + 1, runs, file ? ", " : "", file ? file : "");
+			runCommand(commands[run & 1], file, run & 1);
+			runCommand(commands[!(run & 1)], file, !(run & 1));
+		}
+	}
+
+	if (!num_metrics) {
+		fprintf(stderr, "bench_compare: no figures in the output of the commands\n");
+		return 2;
+	}
+
+	printf("%-40s %12s %12s %9s %9s\n", "figure", "a", "b", "change", "95% ci");
+	for (i = 0; i < num_metrics; i++) {
+		const struct metric_t *m = &metrics[i];
+		double mean_a, mean_b, half_a, half_b;
+
+		if (m->runs_a < 2 || m->runs_b < 2) {
+			printf("%-40s %s\n", m->name, "not in every run");
+			continue;
+		}
+		meanInterval(m->a, m->runs_a, &mean_a, &half_a);
+		meanInterval(m->b, m->runs_b, &mean_b, &half_b);
+		if (mean_a == 0) {
+			printf("%-40s %12.1f %12.1f\n", m->name, mean_a, mean_b);
+			continue;
+		}
+
+		/* of the difference of the means, relative to a */
+		const double change = (mean_b - mean_a) / mean_a * 100.0;
+		const double interval = sqrt(half_a * half_a + half_b * half_b) / mean_a * 100.0;
+		const double worse = m->higher_better ? -change : change;
+		const bool regressed = worse > threshold && worse > interval;
+
+		regressions += regressed;
+		printf("%-40s %12.1f %12.1f %+8.1f%% %8.1f%%%s\n", m->name, mean_a, mean_b, change, interval,
+			regressed ? "  regressed" : "");
+	}
+
+	if (regressions)
+		printf("bench_compare: %d of %d figures worse by more than %.1f%%\n", regressions, num_metrics, threshold);
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,307 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     terminal encoder benchmark, built with "make bench"
+//
+// Feeds the frames of a capture to DG_DrawFrame at each scaling and color
+// mode, with the rest of the engine left out, and reports the time taken
+// without the writes, the bytes and the escape sequences of a frame.
+//
+//     encoder_bench <capture> [-scalings 1,2,4] [-frames n] [options]
+//
+// Other options, such as -delta or -halfblock, are passed to DG_Init.
+//
+
+#include "d_sched.h"
+#include "doomgeneric.h"
+#include "doomtype.h"
+#include "i_capture.h"
+#include "i_simd.h"
+#include "i_system.h"
+#include "i_video.h"
+#include "m_argv.h"
+#include "m_timing.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ARGS 64
+
+/* Backend state the benchmark reads and redirects */
+extern int output_fd;
+extern char *output_buffer;
+
+/* What doomgeneric.c and the engine would provide */
+unsigned DOOMGENERIC_RESX;
+unsigned DOOMGENERIC_RESY;
+pixel_t *DG_ScreenBuffer;
+const pixel_t *DG_SourcePixels;
+unsigned DG_SourceStep;
+unsigned DG_SourcePitch;
+dg_rect_t DG_DirtyRects[DG_MAXDIRTYRECTS];
+int DG_NumDirtyRects;
+int DG_NativeRender;
+int DG_AspectCorrect;
+int myargc;
+char **myargv;
+
+const char *const mode_names[] = { "16", "256", "truecolor" };
+
+uint64_t write_ns; /* time spent in writes during the frame */
+uint64_t write_start_ns;
+int frame_size;
+
+uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void I_Error(char *error, ...)
+{
+	va_list args;
+
+	va_start(args, error);
+	vfprintf(stderr, error, args);
+	va_end(args);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+void I_AtExit(atexit_func_t func, bool run_if_error)
+{
+	(void)func;
+	(void)run_if_error;
+}
+
+int M_CheckParmWithArgs(char *check, int num_args)
+{
+	int i;
+
+	for (i = 1; i < myargc - num_args; i++) {
+		if (!strcasecmp(check, myargv[i]))
+			return i;
+	}
+	return 0;
+}
+
+int M_CheckParm(char *check)
+{
+	return M_CheckParmWithArgs(check, 0);
+}
+
+cpukind_t D_CpuPhase(cpukind_t kind)
+{
+	return kind;
+}
+
+void D_SessionCount(sessionstat_t stat, uint64_t count)
+{
+}
+
+void M_StartStage(stage_t stage)
+{
+	if (stage == STAGE_WRITE)
+		write_start_ns = nowNs();
+}
+
+void M_EndStage(stage_t stage)
+{
+	if (stage == STAGE_WRITE)
+		write_ns += nowNs() - write_start_ns;
+}
+
+void M_StageBytes(int bytes)
+{
+	frame_size = bytes;
+}
+
+void M_FrameDropped(void)
+{
+}
+
+void M_InputRead(void)
+{
+}
+
+void M_FrameEncoded(void)
+{
+}
+
+void M_FrameWritten(void)
+{
+}
+
+/* As I_ConvertScreen without -boxfilter: one pixel of each block */
+void sampleFrame(const byte *screen, int width, unsigned scaling)
+{
+	pixel_t *out = DG_ScreenBuffer;
+	unsigned x, y;
+
+	for (y = 0; y < DOOMGENERIC_RESY; y++) {
+		const byte *line = screen + y * scaling * width;
+		for (x = 0; x < DOOMGENERIC_RESX; x++) {
+#ifdef CMAP256
+			*out++ = line[x * scaling];
+#else
+			/* cmap_to_fb's layout; the color bits aren't read */
+			*out++ = (uint32_t)line[x * scaling] << 24;
+#endif
+		}
+	}
+}
+
+unsigned DG_FrameHeight(unsigned scaling)
+{
+	return SCREENHEIGHT / scaling;
+}
+
+void setPalette(const byte *palette)
+{
+	uint32_t colors[256];
+	unsigned i;
+
+	for (i = 0; i < 256u; i++, palette += 3)
+		colors[i] = palette[0] << 16 | palette[1] << 8 | palette[2];
+	DG_SetPalette(colors);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned scalings[16] = { 1, 2, 3, 4 };
+	unsigned num_scalings = 4;
+	int max_frames = 0;
+	char *args[MAX_ARGS];
+	int num_args = 3;
+	int width, height;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <capture> [-scalings 1,2,4] [-frames n] [options]\n", argv[0]);
+		return 1;
+	}
+
+	args[0] = argv[0];
+	args[1] = "-colors";
+	args[2] = (char *)mode_names[0];
+	for (i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "-scalings") && i + 1 < argc) {
+			char *s = argv[++i];
+			for (num_scalings = 0; *s && num_scalings < 16u; num_scalings++) {
+				scalings[num_scalings] = strtoul(s, &s, 10);
+				if (scalings[num_scalings] < 1 || scalings[num_scalings] > SCREENWIDTH / 8u)
+					I_Error("encoder_bench: invalid -scalings '%s'", argv[i]);
+				if (*s == ',')
+					s++;
+			}
+		} else if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+			max_frames = atoi(argv[++i]);
+		} else if (num_args < MAX_ARGS) {
+			args[num_args++] = argv[i];
+		}
+	}
+	myargv = args;
+	myargc = num_args;
+	I_InitKernels();
+
+	/* every frame is read first, so that only the encoder is timed */
+	I_OpenCapture(argv[1], &width, &height);
+	if (width != SCREENWIDTH || height != SCREENHEIGHT)
+		I_Error("encoder_bench: %s is %ix%i, expected %ix%i", argv[1], width, height, SCREENWIDTH, SCREENHEIGHT);
+
+	byte *screens = NULL;
+	byte *palettes = NULL;
+	int *frame_palette = NULL;
+	int num_frames = 0, num_palettes = 0;
+	byte palette[768];
+	bool new_palette;
+
+	for (;;) {
+		if (max_frames && num_frames == max_frames)
+			break;
+		screens = realloc(screens, (size_t)(num_frames + 1) * width * height);
+		frame_palette = realloc(frame_palette, (num_frames + 1) * sizeof(*frame_palette));
+		if (!I_ReadCapture(screens + (size_t)num_frames * width * height, palette, &new_palette))
+			break;
+		if (new_palette) {
+			palettes = realloc(palettes, (num_palettes + 1) * sizeof(palette));
+			memcpy(palettes + num_palettes++ * sizeof(palette), palette, sizeof(palette));
+		} else if (!num_palettes) {
+			I_Error("encoder_bench: %s has no palette", argv[1]);
+		}
+		frame_palette[num_frames++] = num_palettes - 1;
+	}
+	I_CloseCapture();
+	if (!num_frames)
+		I_Error("encoder_bench: %s has no frames", argv[1]);
+
+	/* the backend's own reads and writes are left to /dev/null */
+	const int null_fd = open("/dev/null", O_RDWR);
+	if (null_fd < 0)
+		I_Error("encoder_bench: couldn't open /dev/null");
+	dup2(null_fd, STDIN_FILENO);
+	output_fd = null_fd;
+
+	printf("encoder_bench: %i frames", num_frames);
+	for (i = 3; i < num_args; i++)
+		printf(" %s", args[i]);
+	printf("\n%-8s %-10s %12s %12s %14s\n", "scaling", "colors", "ns/frame", "bytes/frame", "escapes/frame");
+
+	unsigned s, mode;
+	for (s = 0; s < num_scalings; s++) {
+		DOOMGENERIC_RESX = SCREENWIDTH / scalings[s];
+		DOOMGENERIC_RESY = SCREENHEIGHT / scalings[s];
+		DG_ScreenBuffer = realloc(DG_ScreenBuffer, DOOMGENERIC_RESX * DOOMGENERIC_RESY * sizeof(pixel_t));
+
+		for (mode = 0; mode < sizeof(mode_names) / sizeof(*mode_names); mode++) {
+			uint64_t total_ns = 0, total_bytes = 0, total_escapes = 0;
+			int palette_index = -1;
+
+			args[2] = (char *)mode_names[mode];
+			DG_Init();
+
+			for (i = 0; i < num_frames; i++) {
+				if (frame_palette[i] != palette_index) {
+					palette_index = frame_palette[i];
+					setPalette(palettes + palette_index * sizeof(palette));
+				}
+				sampleFrame(screens + (size_t)i * width * height, width, scalings[s]);
+				DG_NumDirtyRects = -1; /* as the whole frame is sampled */
+
+				write_ns = 0;
+				const uint64_t start = nowNs();
+				DG_DrawFrame();
+				total_ns += nowNs() - start - write_ns;
+
+				const char *c;
+				for (c = output_buffer; c < output_buffer + frame_size; c++)
+					total_escapes += *c == '\033';
+				total_bytes += frame_size;
+			}
+
+			printf("%-8u %-10s %12llu %12llu %14llu\n", scalings[s], mode_names[mode],
+				(unsigned long long)(total_ns / num_frames), (unsigned long long)(total_bytes / num_frames),
+				(unsigned long long)(total_escapes / num_frames));
+		}
+	}
+
+	return 0;
+}
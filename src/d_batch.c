@@ -0,0 +1,399 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Demo batches.
+//	With -demobatch, each demo of a list is played back by
+//	a -nodraw -timedemo run of this program, as many at a
+//	time as there are cores. Every run writes its result
+//	down a pipe, and the results are printed as one report
+//	in the order of the list.
+//	With -transcode <dir> as well, the runs draw the demos
+//	instead, each to a file of its own in dir.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#include "doomtype.h"
+
+#include "i_system.h"
+#include "m_argv.h"
+#include "m_misc.h"
+
+#include "d_main.h"
+
+
+#define MAXBATCHARGS	64
+
+typedef struct
+{
+    char*	line;		// as given, for the report
+    char*	args[MAXBATCHARGS];	// the demo, then its pwads
+    int		numargs;
+
+    int		pid;
+    int		fd;
+    int		starttime;
+    int		walltime;
+    int		status;
+    char	result[128];
+} batchjob_t;
+
+static batchjob_t*	jobs;
+static int		numjobs;
+
+static char*		transcodedir;	// -transcode, or NULL
+
+
+//
+// D_ReadDemoList
+// One demo a line, followed by the pwads it needs.
+// Blank lines and lines starting with # are skipped.
+//
+static void D_ReadDemoList (char* filename)
+{
+    FILE*	f;
+    char	buf[1024];
+    char*	p;
+    char*	token;
+    batchjob_t*	job;
+    int		maxjobs;
+
+    f = fopen (filename, "r");
+    if (f == NULL)
+	I_Error ("D_ReadDemoList: couldn't open %s", filename);
+
+    maxjobs = 0;
+
+    while (fgets (buf, sizeof(buf), f) != NULL)
+    {
+	buf[strcspn (buf, "\r\n")] = '\0';
+
+	for (p = buf ; *p == ' ' || *p == '\t' ; p++)
+	    ;
+	if (*p == '\0' || *p == '#')
+	    continue;
+
+	if (numjobs == maxjobs)
+	{
+	    maxjobs = maxjobs ? maxjobs * 2 : 64;
+	    jobs = realloc (jobs, maxjobs * sizeof(*jobs));
+	    if (jobs == NULL)
+		I_Error ("D_ReadDemoList: out of memory for %i demos", maxjobs);
+	}
+
+	job = &jobs[numjobs++];
+	memset (job, 0, sizeof(*job));
+	job->line = M_StringDuplicate (p);
+
+	for (token = strtok (p, " \t") ; token ; token = strtok (NULL, " \t"))
+	{
+	    if (job->numargs == MAXBATCHARGS)
+		I_Error ("D_ReadDemoList: too many pwads for %s", job->args[0]);
+	    job->args[job->numargs++] = M_StringDuplicate (token);
+	}
+    }
+
+    fclose (f);
+}
+
+
+#ifndef _WIN32
+
+//
+// D_TranscodePath
+// The demo's name without its directory or extension, in
+// transcodedir: .ans for text frames, .cells with -cellgrid.
+//
+static void D_TranscodePath (char* path, size_t size, char* demo)
+{
+    char*	name;
+    char*	ext;
+    char	base[256];
+
+    name = strrchr (demo, DIR_SEPARATOR);
+    name = name ? name + 1 : demo;
+
+    M_StringCopy (base, name, sizeof(base));
+    ext = strrchr (base, '.');
+    if (ext != NULL && ext != base)
+	*ext = '\0';
+
+    M_snprintf (path, size, "%s%s%s%s", transcodedir, DIR_SEPARATOR_S,
+		base, M_CheckParm ("-cellgrid") ? ".cells" : ".ans");
+}
+
+
+static int D_BatchTime (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+//
+// D_StartJob
+// The run gets the arguments of this one, less the
+//  ones of the batch, so they apply to every demo.
+//
+static void D_StartJob (batchjob_t* job)
+{
+    char*	argv[MAXBATCHARGS * 2 + 128];
+    char	resultpath[32];
+    char	transcodepath[512];
+    int		fds[2];
+    int		argc;
+    int		null;
+    int		i;
+
+    if (pipe (fds) < 0)
+	I_Error ("D_StartJob: couldn't make a pipe for %s", job->args[0]);
+
+    // the other runs don't get this one's end
+    fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+
+    M_snprintf (resultpath, sizeof(resultpath), "/dev/fd/%i", fds[1]);
+
+    argc = 0;
+    argv[argc++] = myargv[0];
+
+    for (i = 1 ; i < myargc ; i++)
+    {
+	if (!strcasecmp (myargv[i], "-demobatch")
+	    || !strcasecmp (myargv[i], "-jobs")
+	    || !strcasecmp (myargv[i], "-transcode"))
+	{
+	    i++;
+	    continue;
+	}
+	if (argc < MAXBATCHARGS + 64)
+	    argv[argc++] = myargv[i];
+    }
+
+    if (job->numargs > 1)
+    {
+	argv[argc++] = "-file";
+	for (i = 1 ; i < job->numargs ; i++)
+	    argv[argc++] = job->args[i];
+    }
+
+    argv[argc++] = "-timedemo";
+    argv[argc++] = job->args[0];
+
+    if (transcodedir != NULL)
+    {
+	D_TranscodePath (transcodepath, sizeof(transcodepath), job->args[0]);
+	argv[argc++] = "-transcode";
+	argv[argc++] = transcodepath;
+    }
+    else
+    {
+	argv[argc++] = "-nodraw";
+    }
+    argv[argc++] = "-demoresult";
+    argv[argc++] = resultpath;
+    argv[argc] = NULL;
+
+    fflush (stdout);
+    fflush (stderr);
+
+    job->starttime = D_BatchTime ();
+    job->pid = fork ();
+
+    if (job->pid < 0)
+	I_Error ("D_StartJob: couldn't start a run for %s", job->args[0]);
+
+    if (job->pid == 0)
+    {
+	// only the result is wanted from the run
+	null = open ("/dev/null", O_RDWR);
+	if (null >= 0)
+	{
+	    dup2 (null, STDIN_FILENO);
+	    dup2 (null, STDOUT_FILENO);
+	    dup2 (null, STDERR_FILENO);
+	}
+
+	execvp (argv[0], argv);
+	_exit (127);
+    }
+
+    close (fds[1]);
+    job->fd = fds[0];
+}
+
+
+static void D_FinishJob (batchjob_t* job, int status)
+{
+    int		len;
+    int		n;
+
+    job->walltime = D_BatchTime () - job->starttime;
+    job->status = status;
+
+    // the run is over, so the pipe holds all it wrote
+    len = 0;
+    while (len < (int) sizeof(job->result) - 1
+	   && (n = read (job->fd, job->result + len,
+			 sizeof(job->result) - 1 - len)) > 0)
+    {
+	len += n;
+    }
+    job->result[len] = '\0';
+    job->result[strcspn (job->result, "\r\n")] = '\0';
+
+    close (job->fd);
+}
+
+
+static void D_RunJobs (int maxrunning)
+{
+    int		next;
+    int		running;
+    int		status;
+    int		pid;
+    int		i;
+
+    next = 0;
+    running = 0;
+
+    while (next < numjobs || running > 0)
+    {
+	while (running < maxrunning && next < numjobs)
+	{
+	    D_StartJob (&jobs[next++]);
+	    running++;
+	}
+
+	pid = waitpid (-1, &status, 0);
+	if (pid < 0)
+	    I_Error ("D_RunJobs: lost track of the runs");
+
+	for (i = 0 ; i < next ; i++)
+	{
+	    if (jobs[i].pid == pid)
+	    {
+		D_FinishJob (&jobs[i], status);
+		jobs[i].pid = 0;
+		running--;
+		break;
+	    }
+	}
+    }
+}
+
+#endif
+
+
+//
+// D_DemoBatch
+// Only returns when there is no -demobatch.
+//
+void D_DemoBatch (void)
+{
+    int		i;
+    int		maxrunning;
+    int		failed;
+    int		tics;
+    int		ms;
+    char	level[16];
+    unsigned	hash;
+    batchjob_t*	job;
+
+    //!
+    // @arg <file>
+    //
+    // Play back every demo listed in file, one a line followed
+    // by the pwads it needs, with -nodraw -timedemo runs of this
+    // program. The rest of the command line is passed to every
+    // run. The tics, time, last level and state hash of each
+    // demo are printed as a report. With -transcode <dir>, the
+    // runs draw each demo's frames to a file in dir instead.
+    //
+
+    i = M_CheckParmWithArgs ("-demobatch", 1);
+    if (i <= 0)
+	return;
+
+    D_ReadDemoList (myargv[i + 1]);
+
+    // With -demobatch, -transcode names the directory that
+    // the runs write their demos' frames to
+    i = M_CheckParmWithArgs ("-transcode", 1);
+    if (i > 0)
+	transcodedir = myargv[i + 1];
+
+#ifdef _WIN32
+    I_Error ("D_DemoBatch: -demobatch is not supported on Windows");
+#else
+
+    //!
+    // @arg <n>
+    //
+    // Run n demos of -demobatch at a time, instead of one
+    // for every core.
+    //
+
+    maxrunning = sysconf (_SC_NPROCESSORS_ONLN);
+
+    i = M_CheckParmWithArgs ("-jobs", 1);
+    if (i > 0)
+	maxrunning = atoi (myargv[i + 1]);
+
+    if (maxrunning < 1)
+	maxrunning = 1;
+
+    D_RunJobs (maxrunning);
+
+    printf ("demo\tresult\ttics\tms\tlevel\thash\twallms\n");
+
+    failed = 0;
+
+    for (i = 0 ; i < numjobs ; i++)
+    {
+	job = &jobs[i];
+
+	if (sscanf (job->result, "%i %i %15s %x",
+		    &tics, &ms, level, &hash) == 4)
+	{
+	    printf ("%s\tok\t%i\t%i\t%s\t%08x\t%i\n",
+		    job->line, tics, ms, level, hash, job->walltime);
+	    continue;
+	}
+
+	failed++;
+
+	if (WIFSIGNALED (job->status))
+	    printf ("%s\tsignal %i\t-\t-\t-\t-\t%i\n",
+		    job->line, WTERMSIG (job->status), job->walltime);
+	else
+	    printf ("%s\texit %i\t-\t-\t-\t-\t%i\n",
+		    job->line, WEXITSTATUS (job->status), job->walltime);
+    }
+
+    printf ("%i demos, %i failed\n", numjobs, failed);
+
+    exit (failed ? 1 : 0);
+#endif
+}
@@ -0,0 +1,158 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Shared co-op.
+//	With -coop <port>, players join from other terminals and
+//	play in the local game: there is one playsim, which runs
+//	their ticcmds along with the local player's. Each frame,
+//	every player's view is rendered and sent to their terminal.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "doomgeneric.h"
+
+#include "d_loop.h"
+#include "g_game.h"
+#include "hu_stuff.h"
+#include "i_video.h"
+#include "m_argv.h"
+#include "m_misc.h"
+#include "r_main.h"
+
+#include "d_main.h"
+
+
+static int	numviewports;
+
+// The last message of each player, shown until HU_MSGTIMEOUT
+static char*	coopmessage[MAXPLAYERS];
+static int	coopmessagetic[MAXPLAYERS];
+
+
+//
+// D_CoopTiccmds
+// Players on the viewports are numbered after the local one.
+//
+static void D_CoopTiccmds (ticcmd_t *cmds, bool *ingame, int maketic)
+{
+    byte	keydown[256];
+    int		i;
+    int		player;
+
+    for (i = 0; i < numviewports; i++)
+    {
+	player = i + 1;
+
+	if (!DG_ViewportKeys (i, keydown))
+	{
+	    ingame[player] = false;
+	    continue;
+	}
+
+	G_BuildPlayerTiccmd (&cmds[player], player, keydown, maketic);
+	ingame[player] = true;
+    }
+}
+
+
+//
+// D_StartCoop
+// Waits for the players of -coop to join.
+// Returns false if there is no -coop.
+//
+bool D_StartCoop (void)
+{
+    int		wanted;
+    int		p;
+
+    if (!M_CheckParm ("-coop"))
+	return false;
+
+    wanted = 2;
+
+    p = M_CheckParmWithArgs ("-players", 1);
+    if (p)
+	wanted = atoi (myargv[p+1]);
+
+    if (wanted < 2)
+	wanted = 2;
+    if (wanted > MAXPLAYERS)
+	wanted = MAXPLAYERS;
+
+    printf ("D_StartCoop: waiting for %i more players\n", wanted - 1);
+
+    while (numviewports < wanted - 1)
+    {
+	if (DG_AcceptViewport (1000) < 0)
+	    continue;
+
+	numviewports++;
+	printf ("D_StartCoop: player %i joined\n", numviewports + 1);
+    }
+
+    D_SetLocalPlayers (1 + numviewports, D_CoopTiccmds);
+
+    return true;
+}
+
+
+//
+// D_DrawCoopViews
+// Called after the local frame is out, as this draws over it.
+//
+void D_DrawCoopViews (void)
+{
+    char	status[80];
+    player_t*	player;
+    int		i;
+    int		p;
+
+    for (i = 0; i < numviewports; i++)
+    {
+	p = i + 1;
+	player = &players[p];
+
+	if (!playeringame[p] || !DG_ViewportReady (i))
+	    continue;
+
+	if (gamestate == GS_LEVEL && gametic)
+	    R_RenderPlayerView (player);
+
+	if (player->message)
+	{
+	    coopmessage[p] = player->message;
+	    coopmessagetic[p] = gametic;
+	    player->message = NULL;
+	}
+
+	if (coopmessage[p] && gametic - coopmessagetic[p] < HU_MSGTIMEOUT)
+	{
+	    M_StringCopy (status, coopmessage[p], sizeof(status));
+	}
+	else
+	{
+	    coopmessage[p] = NULL;
+	    M_snprintf (status, sizeof(status),
+			"Health %i%%  Armor %i%%  Ammo %i",
+			player->health, player->armorpoints,
+			weaponinfo[player->readyweapon].ammo == am_noammo ? 0
+			: player->ammo[weaponinfo[player->readyweapon].ammo]);
+	}
+
+	I_FinishViewport (i, status);
+    }
+}
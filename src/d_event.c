@@ -21,12 +21,14 @@
 
 #include <stdlib.h>
 #include "d_event.h"
+#include "i_timer.h"
 
 #define MAXEVENTS 64
 
 static event_t events[MAXEVENTS];
 static int eventhead;
 static int eventtail;
+static int lastinputtime;
 
 //
 // D_PostEvent
@@ -34,6 +36,11 @@ static int eventtail;
 //
 void D_PostEvent (event_t* ev)
 {
+    if (ev->type == ev_keydown)
+    {
+        lastinputtime = I_GetTimeMS();
+    }
+
     events[eventhead] = *ev;
     eventhead = (eventhead + 1) % MAXEVENTS;
 }
@@ -60,4 +67,9 @@ event_t *D_PopEvent(void)
     return result;
 }
 
+int D_LastInputTime(void)
+{
+    return lastinputtime;
+}
+
 
@@ -132,6 +132,10 @@ void D_PostEvent (event_t *ev);
 
 event_t *D_PopEvent(void);
 
+// I_GetTimeMS of the last key pressed, 0 if none has been.
+
+int D_LastInputTime(void);
+
 
 #endif
 
@@ -0,0 +1,145 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Idle sessions.
+//	With -idle <seconds>, nothing is drawn once no key has
+//	come for that long, or for a second while paused or in
+//	the menu, until one does. The game itself keeps running.
+//	Netgames are left alone, as others may be watching.
+//	With -suspend <seconds>, a game left alone that long is
+//	archived as a savegame would be, its level and cached
+//	lumps are freed with their memory handed back to the
+//	system, and the session sleeps until a key comes. The
+//	game is then loaded back from the archive.
+//
+
+
+#include <stdlib.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "doomgeneric.h"
+
+#include "d_event.h"
+#include "d_loop.h"
+#include "g_game.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+#include "s_sound.h"
+#include "z_zone.h"
+
+#include "d_main.h"
+
+
+// Paused or in the menu, the screen only changes for keys
+#define IDLE_MENU_MS	1000
+
+static int	idlems;		// 0 without -idle
+static int	suspendms;	// 0 without -suspend
+static int	resumetime;
+
+
+//
+// D_InitIdle
+//
+void D_InitIdle (void)
+{
+    int		p;
+
+    //!
+    // @arg <seconds>
+    //
+    // Stop drawing once no key has been pressed for this long, or
+    // for a second while paused or in the menu, until one is.
+    // Ignored in netgames.
+    //
+
+    p = M_CheckParmWithArgs ("-idle", 1);
+
+    if (p)
+	idlems = atoi (myargv[p+1]) * 1000;
+
+    //!
+    // @arg <seconds>
+    //
+    // Once no key has been pressed for this long, free the memory
+    // of the level and sleep until one is. Ignored while recording
+    // or playing back demos and in netgames.
+    //
+
+    p = M_CheckParmWithArgs ("-suspend", 1);
+
+    if (p)
+	suspendms = atoi (myargv[p+1]) * 1000;
+}
+
+
+//
+// D_Suspend
+// Sleeps until a key comes, without the level in memory.
+//
+static void D_Suspend (void)
+{
+    byte	*buffer;
+    int		length;
+
+    // nothing else archives a game while this one sleeps,
+    //  so the buffer is kept as it is
+    buffer = G_ArchiveState ("", &length);
+
+    // as P_SetupLevel does before freeing the level
+    S_Start ();
+
+    Z_FreeTags (PU_LEVEL, PU_CACHE);
+    Z_ReleaseFree ();
+
+    if (!DG_WaitForInput ())
+	I_Quit ();
+
+    G_UnArchiveState (buffer, length);
+
+    // the tics slept through aren't caught up on
+    D_StartGameLoop ();
+    resumetime = I_GetTimeMS ();
+}
+
+
+//
+// D_IdleTicker
+//
+bool D_IdleTicker (void)
+{
+    int		lastinput;
+    int		idle;
+
+    if ((!idlems && !suspendms) || netgame)
+	return false;
+
+    lastinput = D_LastInputTime ();
+
+    if (resumetime - lastinput > 0)
+	lastinput = resumetime;
+
+    idle = I_GetTimeMS () - lastinput;
+
+    if (suspendms && idle >= suspendms
+     && gamestate == GS_LEVEL && gameaction == ga_nothing
+     && !demorecording && !demoplayback)
+    {
+	D_Suspend ();
+	return false;
+    }
+
+    return idlems
+	&& (idle >= idlems || ((paused || menuactive) && idle >= IDLE_MENU_MS));
+}
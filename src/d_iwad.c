@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "deh_str.h"
@@ -699,6 +700,132 @@ char *D_TryFindWADByName(char *filename)
 // should be executed (notably loading PWADs).
 //
 
+// The IWAD the last search found is kept in the config directory,
+// with its size and modification time, and used again if a single
+// stat still matches, as the search tries every IWAD name in every
+// directory. It is searched for again if DOOMWADDIR or DOOMWADPATH
+// change.
+
+static char *IWADCacheFile(void)
+{
+    if (configdir == NULL || !strcmp(configdir, ""))
+    {
+        return NULL;
+    }
+
+    return M_StringJoin(configdir, "iwad.cache", NULL);
+}
+
+static char *GetEnvString(char *name)
+{
+    char *value;
+
+    value = getenv(name);
+
+    return value != NULL ? value : "";
+}
+
+// Reads a line of the cache, without its newline.
+
+static bool ReadCacheLine(FILE *file, char *buf, size_t buf_len)
+{
+    size_t len;
+
+    if (fgets(buf, buf_len, file) == NULL)
+    {
+        return false;
+    }
+
+    len = strlen(buf);
+
+    if (len > 0 && buf[len - 1] == '\n')
+    {
+        buf[len - 1] = '\0';
+    }
+
+    return true;
+}
+
+static char *ReadIWADCache(int mask, GameMission_t *mission)
+{
+    char *filename;
+    FILE *file;
+    char line[1024];
+    char path[1024];
+    int cached_mask;
+    int cached_mission;
+    long long size;
+    long long mtime;
+    struct stat st;
+    bool valid;
+
+    filename = IWADCacheFile();
+
+    if (filename == NULL)
+    {
+        return NULL;
+    }
+
+    file = fopen(filename, "r");
+    free(filename);
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    valid = ReadCacheLine(file, line, sizeof(line))
+         && sscanf(line, "%i %i %lld %lld", &cached_mask, &cached_mission,
+                   &size, &mtime) == 4
+         && cached_mask == mask
+         && ReadCacheLine(file, path, sizeof(path))
+         && ReadCacheLine(file, line, sizeof(line))
+         && !strcmp(line, GetEnvString("DOOMWADDIR"))
+         && ReadCacheLine(file, line, sizeof(line))
+         && !strcmp(line, GetEnvString("DOOMWADPATH"))
+         && stat(path, &st) == 0
+         && (long long) st.st_size == size
+         && (long long) st.st_mtime == mtime;
+
+    fclose(file);
+
+    if (!valid)
+    {
+        return NULL;
+    }
+
+    *mission = cached_mission;
+
+    return M_StringDuplicate(path);
+}
+
+static void WriteIWADCache(char *path, int mask, GameMission_t mission)
+{
+    char *filename;
+    FILE *file;
+    struct stat st;
+
+    filename = IWADCacheFile();
+
+    if (filename == NULL || stat(path, &st) != 0)
+    {
+        free(filename);
+        return;
+    }
+
+    file = fopen(filename, "w");
+
+    if (file != NULL)
+    {
+        fprintf(file, "%i %i %lld %lld\n%s\n%s\n%s\n", mask, mission,
+                (long long) st.st_size, (long long) st.st_mtime, path,
+                GetEnvString("DOOMWADDIR"), GetEnvString("DOOMWADPATH"));
+        fclose(file);
+    }
+
+    free(filename);
+}
+
 char *D_FindIWAD(int mask, GameMission_t *mission)
 {
     char *result;
@@ -735,9 +862,14 @@ char *D_FindIWAD(int mask, GameMission_t *mission)
     {
         // Search through the list and look for an IWAD
 
-        printf("-iwad not specified, trying a few iwad names\n");
+        result = ReadIWADCache(mask, mission);
 
-        result = NULL;
+        if (result != NULL)
+        {
+            return result;
+        }
+
+        printf("-iwad not specified, trying a few iwad names\n");
 
         BuildIWADDirList();
     
@@ -745,6 +877,11 @@ char *D_FindIWAD(int mask, GameMission_t *mission)
         {
             result = SearchDirectoryForIWAD(iwad_dirs[i], mask, mission);
         }
+
+        if (result != NULL)
+        {
+            WriteIWADCache(result, mask, *mission);
+        }
     }
 
     return result;
@@ -23,6 +23,7 @@
 
 #include "d_event.h"
 #include "d_loop.h"
+#include "d_sched.h"
 #include "d_ticcmd.h"
 
 #include "i_system.h"
@@ -33,11 +34,9 @@
 #include "m_fixed.h"
 
 #include "net_client.h"
-#include "net_gui.h"
 #include "net_io.h"
-#include "net_query.h"
 #include "net_server.h"
-#include "net_sdl.h"
+#include "net_udp.h"
 #include "net_loop.h"
 
 // The complete set of data for a particular tic.
@@ -76,6 +75,21 @@ int gametic;
 
 bool singletics = false;
 
+// When set to true, TryRunTics returns instead of waiting for the
+// next tic, for frames to be drawn in between.  Set by -uncapped.
+
+bool uncapped = false;
+
+// With -catchup, the most tics run in one go, and in a local game
+//  the most that are let pile up, 0 for the original three.
+
+int catchup = 0;
+
+// Set by TryRunTics when tics are still waiting after it, for the
+//  frame to be skipped and the next call to run them.
+
+bool catchingup = false;
+
 // Index of the local player.
 
 static int localplayer;
@@ -113,6 +127,12 @@ static bool local_playeringame[NET_MAXPLAYERS];
 
 static int player_class;
 
+// Players on other terminals sharing this game (D_SetLocalPlayers),
+// whose ticcmds are built along with the local player's.
+
+static int local_players = 1;
+static local_ticcmds_t build_local_ticcmds;
+
 
 // 35 fps clock adjusted by offsetms milliseconds
 
@@ -159,7 +179,8 @@ static bool BuildNewTic(void)
        // If playing single player, do not allow tics to buffer
        // up very far
 
-       if (!net_client_connected && maketic - gameticdiv > 2)
+       if (!net_client_connected
+        && maketic - gameticdiv >= (catchup ? catchup : 3))
            return false;
 
        // Never go more than ~200ms ahead
@@ -188,6 +209,12 @@ static bool BuildNewTic(void)
     ticdata[maketic % BACKUPTICS].cmds[localplayer] = cmd;
     ticdata[maketic % BACKUPTICS].ingame[localplayer] = true;
 
+    if (local_players > 1)
+    {
+        build_local_ticcmds(ticdata[maketic % BACKUPTICS].cmds,
+                            ticdata[maketic % BACKUPTICS].ingame, maketic);
+    }
+
     ++maketic;
 
     return true;
@@ -244,6 +271,9 @@ void NetUpdate (void)
     {
         if (!BuildNewTic())
         {
+            // too far behind, the game slows down instead
+            if (!net_client_connected)
+                D_SessionCount (STAT_SKIPPEDTICS, newtics - i);
             break;
         }
     }
@@ -307,7 +337,7 @@ void D_StartGameLoop(void)
     lasttime = GetAdjustedTime() / ticdup;
 }
 
-#if ORIGCODE
+#ifdef FEATURE_MULTIPLAYER
 //
 // Block until the game start message is received from the server.
 //
@@ -340,7 +370,6 @@ static void BlockUntilStart(net_gamesettings_t *settings,
 void D_StartNetGame(net_gamesettings_t *settings,
                     netgame_startup_callback_t callback)
 {
-#if ORIGCODE
     int i;
 
     offsetms = 0;
@@ -399,6 +428,7 @@ void D_StartNetGame(net_gamesettings_t *settings,
     else
         settings->ticdup = 1;
 
+#ifdef FEATURE_MULTIPLAYER
     if (net_client_connected)
     {
         // Send our game settings and block until game start is received
@@ -411,6 +441,12 @@ void D_StartNetGame(net_gamesettings_t *settings,
 
         NET_CL_GetSettings(settings);
     }
+    else
+#endif
+    if (local_players > 1)
+    {
+        settings->num_players = local_players;
+    }
 
     if (drone)
     {
@@ -436,17 +472,6 @@ void D_StartNetGame(net_gamesettings_t *settings,
     //{
     //    printf("Syncing netgames like Vanilla Doom.\n");
     //}
-#else
-    settings->consoleplayer = 0;
-	settings->num_players = 1;
-	settings->player_classes[0] = player_class;
-	settings->new_sync = 0;
-	settings->extratics = 1;
-	settings->ticdup = 1;
-
-	ticdup = settings->ticdup;
-	new_sync = settings->new_sync;
-#endif
 }
 
 bool D_InitNetGame(net_connect_data_t *connect_data)
@@ -468,55 +493,41 @@ bool D_InitNetGame(net_connect_data_t *connect_data)
     //!
     // @category net
     //
-    // Start a multiplayer server, listening for connections.
+    // Start a multiplayer server, listening for connections on the
+    // UDP port, and play in it.  With -server, the session server
+    // runs it instead, and every session joins it.
     //
 
-    if (M_CheckParm("-server") > 0
-     || M_CheckParm("-privateserver") > 0)
+    if (M_CheckParm("-netserver") > 0 && M_CheckParm("-server") > 0)
+    {
+        net_udp_module.InitClient();
+        addr = net_udp_module.ResolveAddress("127.0.0.1");
+    }
+    else if (M_CheckParm("-netserver") > 0)
     {
         NET_SV_Init();
         NET_SV_AddModule(&net_loop_server_module);
-        NET_SV_AddModule(&net_sdl_module);
-        NET_SV_RegisterWithMaster();
+        NET_SV_AddModule(&net_udp_module);
 
         net_loop_client_module.InitClient();
         addr = net_loop_client_module.ResolveAddress(NULL);
     }
     else
     {
-        //!
-        // @category net
-        //
-        // Automatically search the local LAN for a multiplayer
-        // server and join it.
-        //
-
-        i = M_CheckParm("-autojoin");
-
-        if (i > 0)
-        {
-            addr = NET_FindLANServer();
-
-            if (addr == NULL)
-            {
-                I_Error("No server found on local LAN");
-            }
-        }
-
         //!
         // @arg <address>
         // @category net
         //
         // Connect to a multiplayer server running on the given
-        // address.
+        // address, as host or host:port.
         //
 
         i = M_CheckParmWithArgs("-connect", 1);
 
         if (i > 0)
         {
-            net_sdl_module.InitClient();
-            addr = net_sdl_module.ResolveAddress(myargv[i+1]);
+            net_udp_module.InitClient();
+            addr = net_udp_module.ResolveAddress(myargv[i+1]);
 
             if (addr == NULL)
             {
@@ -527,11 +538,6 @@ bool D_InitNetGame(net_connect_data_t *connect_data)
 
     if (addr != NULL)
     {
-        if (M_CheckParm("-drone") > 0)
-        {
-            connect_data->drone = true;
-        }
-
         if (!NET_CL_Connect(addr, connect_data))
         {
             I_Error("D_InitNetGame: Failed to connect to %s\n",
@@ -540,10 +546,6 @@ bool D_InitNetGame(net_connect_data_t *connect_data)
 
         printf("D_InitNetGame: Connected to %s\n", NET_AddrToString(addr));
 
-        // Wait for launch message received from server.
-
-        NET_WaitForLaunch();
-
         result = true;
     }
 #endif
@@ -552,6 +554,17 @@ bool D_InitNetGame(net_connect_data_t *connect_data)
 }
 
 
+//
+// Have the game played by more players than the local one, all in
+// this process.  Called before D_StartNetGame.
+//
+
+void D_SetLocalPlayers(int num_players, local_ticcmds_t build)
+{
+    local_players = num_players;
+    build_local_ticcmds = build;
+}
+
 //
 // D_QuitNetGame
 // Called before quitting to leave a net game
@@ -712,6 +725,11 @@ void TryRunTics (void)
     int realtics;
     int	availabletics;
     int	counts;
+    bool skipped;
+
+    // a frame skipped last time is drawn this time
+    skipped = catchingup;
+    catchingup = false;
 
     // get real tics
     entertic = I_GetTime() / ticdup;
@@ -762,6 +780,9 @@ void TryRunTics (void)
     if (counts < 1)
 	counts = 1;
 
+    if (catchup && counts > catchup)
+        counts = catchup;
+
     // wait for new tics if needed
 
     while (!PlayersInGame() || lowtic < gametic/ticdup + counts)
@@ -781,9 +802,23 @@ void TryRunTics (void)
 	    return;
 	}
 
-        I_Sleep(1);
+        // Nor wait at all, uncapped: a frame can be drawn
+        // part way to the next tic instead.
+        if (uncapped && !net_client_connected)
+            return;
+
+        // Without a server to hear from, nothing can
+        // happen until the next tic starts.
+        if (net_client_connected)
+            I_Sleep(1);
+        else
+            I_SleepUntilTime((entertic + 1) * ticdup);
     }
 
+    // all but the first were due by the last frame
+    if (counts > 1)
+        D_SessionCount (STAT_LATETICS, counts - 1);
+
     // run the count * ticdup dics
     while (counts--)
     {
@@ -796,7 +831,7 @@ void TryRunTics (void)
 
         set = &ticdata[(gametic / ticdup) % BACKUPTICS];
 
-        if (!net_client_connected)
+        if (!net_client_connected && local_players == 1)
         {
             SinglePlayerClear(set);
         }
@@ -810,6 +845,7 @@ void TryRunTics (void)
 
             loop_interface->RunTic(set->cmds, set->ingame);
 	    gametic++;
+	    D_SessionCount (STAT_TICS, 1);
 
 	    // modify command for duplicated tics
 
@@ -818,6 +854,12 @@ void TryRunTics (void)
 
 	NetUpdate ();	// check for new console commands
     }
+
+    // Tics that came due while these ran are run before the
+    //  next frame, which would show them late, but never two
+    //  frames are skipped in a row.
+    if (catchup && !skipped && GetLowTic() > gametic/ticdup)
+        catchingup = true;
 }
 
 void D_RegisterLoopCallbacks(loop_interface_t *i)
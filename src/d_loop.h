@@ -28,6 +28,11 @@
 typedef bool (*netgame_startup_callback_t)(int ready_players,
                                               int num_players);
 
+// Builds the ticcmds of the players added by D_SetLocalPlayers,
+// clearing ingame[] for any that have left.
+
+typedef void (*local_ticcmds_t)(ticcmd_t *cmds, bool *ingame, int maketic);
+
 typedef struct
 {
     // Read events from the event queue, and process them.
@@ -74,7 +79,15 @@ bool D_InitNetGame(net_connect_data_t *connect_data);
 void D_StartNetGame(net_gamesettings_t *settings,
                     netgame_startup_callback_t callback);
 
+// Have players on other terminals share the local game, which then
+// has num_players players.
+
+void D_SetLocalPlayers(int num_players, local_ticcmds_t build);
+
 extern bool singletics;
+extern bool uncapped;
+extern int catchup;
+extern bool catchingup;
 extern int gametic, ticdup;
 
 #endif
@@ -35,8 +35,10 @@
 #include "sounds.h"
 
 #include "d_iwad.h"
+#include "d_sched.h"
 
 #include "z_zone.h"
+#include "z_stats.h"
 #include "w_main.h"
 #include "w_wad.h"
 #include "s_sound.h"
@@ -50,10 +52,13 @@
 #include "m_controls.h"
 #include "m_misc.h"
 #include "m_menu.h"
+#include "m_timing.h"
+#include "m_trace.h"
 #include "p_saveg.h"
 
 #include "i_endoom.h"
 #include "i_joystick.h"
+#include "i_simd.h"
 #include "i_system.h"
 #include "i_timer.h"
 #include "i_video.h"
@@ -65,12 +70,13 @@
 #include "st_stuff.h"
 #include "am_map.h"
 #include "net_client.h"
-#include "net_dedicated.h"
-#include "net_query.h"
 
+#include "p_bench.h"
 #include "p_setup.h"
 #include "r_local.h"
+#include "r_bench.h"
 #include "statdump.h"
+#include "perfdump.h"
 
 #include "d_main.h"
 
@@ -127,6 +133,14 @@ char		mapdir[1024];           // directory of development maps
 
 int             show_endoom = 1;
 
+// 1 to melt from one screen to the next, 0 to cut straight to it
+int             screen_wipe = 1;
+
+// With -renderfps, frames drawn a second, 0 for every tic,
+// and the number of the frame last drawn
+static int      renderfps;
+static int      renderframe = -1;
+
 
 void D_ConnectNetGame(void);
 void D_CheckNetGame(void);
@@ -155,6 +169,19 @@ void D_ProcessEvents (void)
 
 
 
+//
+// D_RenderDue
+// With -renderfps, a frame is due on the first tic of each
+// of renderfps even slices of a second, until one is drawn,
+// so the rate holds exactly while the tics stay at 35Hz.
+//
+static bool D_RenderDue (void)
+{
+    return !renderfps
+        || (int64_t) gametic * renderfps / TICRATE != renderframe;
+}
+
+
 //
 // D_Display
 //  draw current display, possibly wiping it from the previous
@@ -170,17 +197,21 @@ void D_Display (void)
 {
     static  bool		viewactivestate = false;
     static  bool		menuactivestate = false;
+    static  bool		pausedstate = false;
     static  bool		inhelpscreensstate = false;
     static  bool		fullscreen = false;
     static  gamestate_t		oldgamestate = -1;
-    static  int			borderdrawcount;
+    static  dirtyrect_t		menurects[MAXDIRTYRECTS];
+    static  int			nummenurects;
     int				nowtime;
     int				tics;
     int				wipestart;
     int				y;
+    int				i;
     bool			done;
     bool			wipe;
     bool			redrawsbar;
+    bool			redrawback;
 
     if (nodrawers)
     	return;                    // for comparative timing / profiling
@@ -192,14 +223,18 @@ void D_Display (void)
     {
 		R_ExecuteSetViewSize ();
 		oldgamestate = -1;                      // force background redraw
-		borderdrawcount = 3;
+		borderdrawn = false;
     }
 
     // save the current screen if about to wipe
     if (gamestate != wipegamestate)
 		{
 		wipe = true;
-		wipe_StartScreen(0, 0, SCREENWIDTH, SCREENHEIGHT);
+		if (screen_wipe)
+		{
+		    R_ExpandView ();
+		    wipe_StartScreen(0, 0, SCREENWIDTH, SCREENHEIGHT);
+		}
     }
     else
     	wipe = false;
@@ -207,6 +242,11 @@ void D_Display (void)
     if (gamestate == GS_LEVEL && gametic)
     	HU_Erase();
 
+    // the intermission and finale only redraw what changed, unless
+    //  the menu or pause pic was over them
+    redrawback = wipe || menuactive || menuactivestate
+	      || paused || pausedstate;
+
     // do buffered drawing
     switch (gamestate)
     {
@@ -215,20 +255,22 @@ void D_Display (void)
 			break;
 		if (automapactive)
 			AM_Drawer ();
-		if (wipe || (viewheight != 200 && fullscreen) )
+		if (wipe || (scaledviewheight != 200 && fullscreen) )
 			redrawsbar = true;
 		if (inhelpscreensstate && !inhelpscreens)
 			redrawsbar = true;              // just put away the help screen
-		ST_Drawer (viewheight == 200, redrawsbar );
-		fullscreen = viewheight == 200;
+		M_StartStage (STAGE_HUD);
+		ST_Drawer (scaledviewheight == 200, redrawsbar );
+		M_EndStage (STAGE_HUD);
+		fullscreen = scaledviewheight == 200;
 		break;
 
       case GS_INTERMISSION:
-		WI_Drawer ();
+		WI_Drawer (redrawback);
 		break;
 
       case GS_FINALE:
-		F_Drawer ();
+		F_Drawer (redrawback);
 		break;
 
       case GS_DEMOSCREEN:
@@ -241,10 +283,19 @@ void D_Display (void)
 
     // draw the view directly
     if (gamestate == GS_LEVEL && !automapactive && gametic)
+    {
     	R_RenderPlayerView (&players[displayplayer]);
 
+	// drawn straight to the screen, not through v_video
+	V_MarkRect (viewwindowx, viewwindowy, scaledviewwidth, scaledviewheight);
+    }
+
     if (gamestate == GS_LEVEL && gametic)
-    	HU_Drawer ();
+    {
+	M_StartStage (STAGE_HUD);
+	HU_Drawer ();
+	M_EndStage (STAGE_HUD);
+    }
 
     // clean up border stuff
     if (gamestate != oldgamestate && gamestate != GS_LEVEL)
@@ -257,15 +308,19 @@ void D_Display (void)
 		R_FillBackScreen ();    // draw the pattern into the back screen
     }
 
-    // see if the border needs to be updated to the screen
+    // see if the border needs to be updated to the screen; once it
+    //  is there, only what the menu drew over it is put back
     if (gamestate == GS_LEVEL && !automapactive && scaledviewwidth != 320)
     {
-		if (menuactive || menuactivestate || !viewactivestate)
-			borderdrawcount = 3;
-		if (borderdrawcount)
+		if (!viewactivestate || wipe)
+			borderdrawn = false;
+		if (!borderdrawn)
+			R_DrawViewBorder ();
+		else
 		{
-			R_DrawViewBorder ();    // erase old menu stuff
-			borderdrawcount--;
+			for (i = 0; i < nummenurects; i++)
+				R_EraseViewBorder (menurects[i].x1, menurects[i].y1,
+						   menurects[i].x2, menurects[i].y2);
 		}
     }
 
@@ -277,6 +332,7 @@ void D_Display (void)
     }
 
     menuactivestate = menuactive;
+    pausedstate = paused;
     viewactivestate = viewactive;
     inhelpscreensstate = inhelpscreens;
     oldgamestate = wipegamestate = gamestate;
@@ -294,18 +350,22 @@ void D_Display (void)
 
 
     // menus go directly to the screen
+    V_BeginMarks ();
     M_Drawer ();          // menu is drawn even on top of everything
+    nummenurects = V_EndMarks (menurects);
     NetUpdate ();         // send out any new accumulation
 
 
-    // normal update
-    if (!wipe)
+    // normal update, or a cut to the new screen
+    if (!wipe || !screen_wipe)
     {
 	I_FinishUpdate ();              // page flip or blit buffer
+	D_DrawCoopViews ();
 	return;
     }
 
     // wipe update
+    R_ExpandView ();
     wipe_EndScreen(0, 0, SCREENWIDTH, SCREENHEIGHT);
 
     wipestart = I_GetTime () - 1;
@@ -316,7 +376,8 @@ void D_Display (void)
 	{
 	    nowtime = I_GetTime ();
 	    tics = nowtime - wipestart;
-            I_Sleep(1);
+	    if (tics <= 0)
+		I_SleepUntilTime (wipestart + 1);
 	} while (tics <= 0);
 
 	wipestart = nowtime;
@@ -367,6 +428,7 @@ void D_BindVariables(void)
     M_BindVariable("vanilla_savegame_limit", &vanilla_savegame_limit);
     M_BindVariable("vanilla_demo_limit",     &vanilla_demo_limit);
     M_BindVariable("show_endoom",            &show_endoom);
+    M_BindVariable("screen_wipe",            &screen_wipe);
 
     // Multiplayer chat macros
 
@@ -423,6 +485,7 @@ void D_DoomLoop (void)
 
     TryRunTics();
 
+    M_StartupStep ("I_InitGraphics");
     I_SetWindowTitle(gamedescription);
     I_GraphicsCheckCommandLine();
     I_SetGrabMouseCallback(D_GrabMouseCallback);
@@ -431,8 +494,10 @@ void D_DoomLoop (void)
 
     V_RestoreBuffer();
     R_ExecuteSetViewSize();
+    Z_StartupStats();
 
     D_StartGameLoop();
+    M_StartupStep ("D_DoomLoop");
 
     if (testcontrols)
     {
@@ -444,15 +509,42 @@ void D_DoomLoop (void)
 		// frame syncronous IO operations
 		I_StartFrame ();
 
+		D_CpuPhase (CPU_TICS);
+		TRACE_BEGIN ("TryRunTics");
 		TryRunTics (); // will run at least one tic
+		TRACE_END ("TryRunTics");
+		D_CpuPhase (CPU_OTHER);
+
+		Z_StatsTicker ();
+		PerfDumpTicker ();
+		D_SessionTicker ();
+		D_MigrateTicker ();
 
 		S_UpdateSounds (players[consoleplayer].mo);// move positional sounds
 
 		// Update display, next frame, with current state.
-		if (screenvisible)
+		// Frames the backend would drop, or the session
+		// server holds back, aren't rendered at all, nor
+		// are any while the player is idle.
+		if (!D_IdleTicker () && !catchingup
+		 && screenvisible && !nodrawers && D_RenderDue ()
+		 && I_ReadyForFrame () && D_FrameDue ())
 		{
+			if (renderfps)
+			    renderframe = (int64_t) gametic * renderfps / TICRATE;
+			D_CpuPhase (CPU_RENDER);
 			D_Display ();
+			D_CpuPhase (CPU_OTHER);
+			M_FinishStartup ();
+		}
+		else if (uncapped && !catchingup)
+		{
+			// TryRunTics no longer waits for the next tic
+			I_Sleep (1);
 		}
+
+		M_FinishStageFrame ();
+		M_TraceTicker ();
     }
 }
 
@@ -1163,6 +1255,7 @@ void D_DoomMain (void)
     int p;
     char file[256];
     char demolumpname[9];
+    bool resumed;
 #if ORIGCODE
     int numiwadlumps;
 #endif
@@ -1173,67 +1266,24 @@ void D_DoomMain (void)
 
     I_PrintBanner(PACKAGE_STRING);
 
+    M_StartupStep ("Z_Init");
     DEH_printf("Z_Init: Init zone memory allocation daemon. \n");
     Z_Init ();
-
-#ifdef FEATURE_MULTIPLAYER
-    //!
-    // @category net
-    //
-    // Start a dedicated server, routing packets but not participating
-    // in the game itself.
-    //
-
-    if (M_CheckParm("-dedicated") > 0)
-    {
-        printf("Dedicated server mode.\n");
-        NET_DedicatedServer();
-
-        // Never returns
-    }
+    Z_InitStats ();
+    M_InitTrace ();
+    I_InitKernels ();
 
     //!
-    // @category net
-    //
-    // Query the Internet master server for a global list of active
-    // servers.
-    //
-
-    if (M_CheckParm("-search"))
-    {
-        NET_MasterQuery();
-        exit(0);
-    }
-
-    //!
-    // @arg <address>
-    // @category net
+    // @arg <file>
     //
-    // Query the status of the server running on the given IP
-    // address.
+    // Send the frames of a -capframes capture to the terminal without
+    // running the game, time each stage of it and quit.
     //
 
-    p = M_CheckParmWithArgs("-query", 1);
+    p = M_CheckParmWithArgs ("-replayframes", 1);
 
     if (p)
-    {
-        NET_QueryAddress(myargv[p+1]);
-        exit(0);
-    }
-
-    //!
-    // @category net
-    //
-    // Search the local LAN for running servers.
-    //
-
-    if (M_CheckParm("-localsearch"))
-    {
-        NET_LANQuery();
-        exit(0);
-    }
-
-#endif
+	I_ReplayCapture (myargv[p+1]);
 
     //!
     // @vanilla
@@ -1270,6 +1320,15 @@ void D_DoomMain (void)
 
     I_DisplayFPSDots(devparm);
 
+    //!
+    // Show the frame rate, the time each stage of a frame takes,
+    // the frame size and the renderer's counts over the top of
+    // the screen. The key_perfhud key turns it on and off.
+    //
+
+    if (M_CheckParm ("-perfhud"))
+	HU_SetPerfHud (true);
+
     //!
     // @category net
     // @vanilla
@@ -1348,10 +1407,12 @@ void D_DoomMain (void)
     }
 
     // init subsystems
+    M_StartupStep ("V_Init");
     DEH_printf("V_Init: allocate screens.\n");
     V_Init ();
 
     // Load configuration files before initialising other subsystems.
+    M_StartupStep ("M_LoadDefaults");
     DEH_printf("M_LoadDefaults: Load system defaults.\n");
     M_SetConfigFilenames("default.cfg", PROGRAM_PREFIX "doom.cfg");
     D_BindVariables();
@@ -1360,6 +1421,82 @@ void D_DoomMain (void)
     // Save configuration at exit.
     I_AtExit(M_SaveDefaults, false);
 
+    //!
+    // @arg <style>
+    //
+    // How the screen changes at the start of a level and between
+    // screens: "melt", as in Vanilla Doom, or "cut" straight to the
+    // new screen, which saves sending the largest frames of all.
+    // Kept in the configuration file as screen_wipe.
+    //
+
+    p = M_CheckParmWithArgs("-wipe", 1);
+
+    if (p)
+    {
+        if (!strcasecmp(myargv[p+1], "melt"))
+            screen_wipe = 1;
+        else if (!strcasecmp(myargv[p+1], "cut"))
+            screen_wipe = 0;
+        else
+            I_Error("Unknown -wipe style '%s'", myargv[p+1]);
+    }
+
+    //!
+    // @arg <n>
+    //
+    // Draw n frames a second, from 1 to 35, on tics spread evenly
+    // over each second. The game itself still runs at 35 tics a
+    // second, so demos and play are the same, but the rendering
+    // and the output cost what the frames do.
+    //
+
+    p = M_CheckParmWithArgs("-renderfps", 1);
+
+    if (p)
+    {
+        renderfps = atoi(myargv[p+1]);
+
+        if (renderfps < 1 || renderfps > TICRATE)
+            I_Error("Invalid -renderfps '%s', expected 1 to %d",
+                    myargv[p+1], TICRATE);
+    }
+
+    //!
+    // Draw frames between tics as fast as the terminal takes
+    // them, with the view and things part way along their moves,
+    // for smoother motion on a local terminal. The game still
+    // runs at 35 tics a second. Not with -renderfps.
+    //
+
+    if (M_CheckParm("-uncapped"))
+    {
+        if (renderfps)
+            I_Error("-uncapped draws every frame it can, not -renderfps");
+
+        uncapped = true;
+    }
+
+    //!
+    // @arg <n>
+    //
+    // Run at most n tics, from 1 to 8, before each frame, and in
+    // a local game let at most n pile up, three otherwise. Tics
+    // that come due while others run are run before the frame is
+    // drawn, skipping it, but never two frames in a row.
+    //
+
+    p = M_CheckParmWithArgs("-catchup", 1);
+
+    if (p)
+    {
+        catchup = atoi(myargv[p+1]);
+
+        if (catchup < 1 || catchup > 8)
+            I_Error("Invalid -catchup '%s', expected 1 to 8",
+                    myargv[p+1]);
+    }
+
     // Find main IWAD file and load it.
     iwadfile = D_FindIWAD(IWAD_MASK_DOOM, &gamemission);
 
@@ -1373,6 +1510,7 @@ void D_DoomMain (void)
 
     modifiedgame = false;
 
+    M_StartupStep ("W_Init");
     DEH_printf("W_Init: Init WADfiles.\n");
     D_AddFile(iwadfile);
 #if ORIGCODE
@@ -1511,6 +1649,7 @@ void D_DoomMain (void)
     I_AtExit((atexit_func_t) G_CheckDemoStatus, true);
 
     // Generate the WAD hash table.  Speed things up a bit.
+    M_StartupStep ("W_GenerateHashTable");
     W_GenerateHashTable();
 
     // Load DEHACKED lumps from WAD files - but only if we give the right
@@ -1605,6 +1744,7 @@ void D_DoomMain (void)
         I_PrintDivider();
     }
 
+    M_StartupStep ("I_Init");
     DEH_printf("I_Init: Setting up machine state.\n");
     I_CheckIsScreensaver();
     I_InitTimer();
@@ -1617,9 +1757,6 @@ void D_DoomMain (void)
     NET_Init ();
 #endif
 
-    // Initial netgame startup. Connect to server etc.
-    D_ConnectNetGame();
-
     // get skill / episode / map from parms
     startskill = sk_medium;
     startepisode = 1;
@@ -1755,26 +1892,36 @@ void D_DoomMain (void)
         startloadgame = -1;
     }
 
+    M_StartupStep ("M_Init");
     DEH_printf("M_Init: Init miscellaneous info.\n");
     M_Init ();
 
     DEH_printf("R_Init: Init DOOM refresh daemon - ");
     R_Init ();
 
+    //!
+    // Time each column and span drawer on the IWAD's textures and
+    // flats, print the pixels drawn per nanosecond and quit.
+    //
+
+    if (M_CheckParm ("-benchdraw"))
+	R_BenchDraw ();
+
+    M_StartupStep ("P_Init");
     DEH_printf("\nP_Init: Init Playloop state.\n");
     P_Init ();
 
+    M_StartupStep ("S_Init");
     DEH_printf("S_Init: Setting up sound.\n");
     S_Init (sfxVolume * 8, musicVolume * 8);
 
-    DEH_printf("D_CheckNetGame: Checking network game status.\n");
-    D_CheckNetGame ();
-
     PrintGameVersion();
 
+    M_StartupStep ("HU_Init");
     DEH_printf("HU_Init: Setting up heads up display.\n");
     HU_Init ();
 
+    M_StartupStep ("ST_Init");
     DEH_printf("ST_Init: Init status bar.\n");
     ST_Init ();
 
@@ -1785,12 +1932,30 @@ void D_DoomMain (void)
     if (gamemode == commercial && W_CheckNumForName("map01") < 0)
         storedemo = true;
 
+    // Everything from here on is done by each session, which
+    //  shares what was loaded so far with the others.
+    if (M_CheckParmWithArgs ("-server", 1))
+	P_InitLevelData ();
+
+    M_StartupStep ("D_ServeSessions");
+    D_InitMigrate ();
+    D_ServeSessions ();
+    M_StartupStep ("D_CheckNetGame");
+
+    // Initial netgame startup. Connect to server etc.
+    D_ConnectNetGame();
+
+    DEH_printf("D_CheckNetGame: Checking network game status.\n");
+    D_CheckNetGame ();
+
     if (M_CheckParmWithArgs("-statdump", 1))
     {
         I_AtExit(StatDump, true);
         DEH_printf("External statistics registered.\n");
     }
 
+    PerfDumpInit ();
+
     //!
     // @arg <x>
     // @category demo
@@ -1799,6 +1964,11 @@ void D_DoomMain (void)
     // Record a demo named x.lmp.
     //
 
+    G_InitStateHashes ();
+    G_InitRewind ();
+    G_InitSeek ();
+    D_InitIdle ();
+
     p = M_CheckParmWithArgs("-record", 1);
 
     if (p)
@@ -1822,13 +1992,29 @@ void D_DoomMain (void)
 		D_DoomLoop ();  // never returns
     }
 
+    //!
+    // @arg <tics>
+    //
+    // Run only the playsim on the -warp level for this many tics,
+    // with nothing drawn, print the time each kind of thinker and
+    // the hot helpers took and quit.
+    //
+
+    p = M_CheckParmWithArgs("-benchplaysim", 1);
+    if (p)
+    {
+		P_BenchPlaysim (atoi(myargv[p+1]));
+    }
+
     if (startloadgame >= 0)
     {
         M_StringCopy(file, P_SaveGameFile(startloadgame), sizeof(file));
         G_LoadGame(file);
     }
 
-    if (gameaction != ga_loadgame )
+    resumed = D_ResumeMigration ();
+
+    if (gameaction != ga_loadgame && !resumed)
     {
 		if (autostart || netgame)
 			G_InitNew (startskill, startepisode, startmap);
@@ -28,6 +28,46 @@
 // Read events from all input devices
 
 void D_ProcessEvents (void); 
+
+// Plays back the demos of -demobatch, then exits.
+void D_DemoBatch (void);
+
+// With -server, forks a session for each connection
+//  and returns in the session.
+void D_ServeSessions (void);
+
+// With -coop, waits for the other players to join.
+//  Returns false without -coop.
+bool D_StartCoop (void);
+
+// Sends the other -coop players their views.
+void D_DrawCoopViews (void);
+
+// Reads -idle and -suspend.
+void D_InitIdle (void);
+
+// Called once a loop, between tics. Returns true while
+//  the player is idle and nothing need be drawn, and with
+//  -suspend, sleeps through a long enough idle.
+bool D_IdleTicker (void);
+
+// Reads -migrate, before the server forks any session.
+void D_InitMigrate (void);
+
+// With -migrate, whether a drain was asked for.
+bool D_MigrationRequested (void);
+
+// Takes the name of a migrated game off a new connection,
+//  and returns whether there was one.
+bool D_AcceptMigration (int fd);
+
+// Loads the game taken over, if any. Returns false if there
+//  is none to carry on with.
+bool D_ResumeMigration (void);
+
+// Called once a loop: once asked to, saves the game for
+//  another server and quits.
+void D_MigrateTicker (void);
 	
 
 //
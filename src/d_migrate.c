@@ -0,0 +1,391 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Session migration.
+//	With -migrate <dir>, a SIGUSR1 to a -server drains it: it
+//	stops taking connections and passes the signal on to its
+//	sessions. Each one archives its game, as a savegame would,
+//	with the random number indices and the pause, to a file in
+//	dir, tells its client the file's name and quits. A proxy
+//	in front then connects the client to another server with
+//	the same dir, and sends the name ahead of the client's
+//	keys; that session loads the file and carries on with the
+//	game where it was.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#include "doomdef.h"
+#include "doomstat.h"
+
+#include "g_game.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+#include "m_misc.h"
+#include "z_zone.h"
+
+#include "d_main.h"
+
+
+// Sent to the client before the session quits, and by the
+//  proxy to the new server: an OSC that terminals ignore,
+//  with the file's name ended by BEL
+#define MIGRATE_PREFIX		"\033]migrate;"
+#define MIGRATE_PREFIX_LEN	10
+#define MIGRATE_NAME_MAX	96
+
+// How long a new connection has to send the name
+#define MIGRATE_WAIT_MS		250
+
+#define MIGRATE_MAGIC		"DMIG"
+#define MIGRATE_VERSION		1
+#define MIGRATE_HEADER		(4 + 1 + 4 * 4)
+
+extern int	rndindex;
+extern int	prndindex;
+
+static char*	migratedir;
+
+#ifndef _WIN32
+static volatile sig_atomic_t	migraterequested;
+#endif
+
+// The game taken over from another server, if any
+static byte*	resumebuffer;
+
+
+#ifndef _WIN32
+static void D_MigrateSignal (int sig)
+{
+    (void) sig;
+    migraterequested = 1;
+}
+#endif
+
+
+//
+// D_InitMigrate
+// The sessions forked later inherit the signal handler.
+//
+void D_InitMigrate (void)
+{
+    int		p;
+
+    //!
+    // @arg <dir>
+    //
+    // With -server, drain on SIGUSR1: take no more connections, and
+    // have each session save its game to dir and quit, telling its
+    // client where to find it, for a proxy to resume it on another
+    // server with the same dir. Not with -websocket, -cellgrid or
+    // -compress.
+    //
+
+    p = M_CheckParmWithArgs ("-migrate", 1);
+
+    if (!p)
+	return;
+
+#ifdef _WIN32
+    I_Error ("D_InitMigrate: -migrate isn't available on Windows");
+#else
+    if (M_CheckParm ("-websocket") || M_CheckParm ("-cellgrid")
+     || M_CheckParm ("-compress"))
+	I_Error ("D_InitMigrate: -migrate hands over terminal sessions, "
+		 "not -websocket, -cellgrid or -compress ones");
+
+    migratedir = myargv[p+1];
+    signal (SIGUSR1, D_MigrateSignal);
+#endif
+}
+
+
+//
+// D_MigrationRequested
+//
+bool D_MigrationRequested (void)
+{
+#ifdef _WIN32
+    return false;
+#else
+    return migratedir != NULL && migraterequested;
+#endif
+}
+
+
+static void D_WriteLong (byte *p, int value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static int D_ReadLong (const byte *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned) p[3] << 24);
+}
+
+
+#ifndef _WIN32
+
+//
+// D_Migrate
+// Saves the game for another server to resume, and quits.
+//  Outside a level, such as on the title screen, there is
+//  no game to save, and the new session starts afresh.
+//
+static void D_Migrate (void)
+{
+    char	host[64];
+    char	name[MIGRATE_NAME_MAX];
+    char*	path;
+    char*	temp;
+    byte	header[MIGRATE_HEADER];
+    byte*	archive;
+    int		length;
+    FILE*	f;
+    bool	ok;
+
+    if (gethostname (host, sizeof(host)) != 0)
+	M_StringCopy (host, "localhost", sizeof(host));
+    host[sizeof(host) - 1] = '\0';
+    M_snprintf (name, sizeof(name), "%s-%d-%d",
+		host, (int) getpid (), I_GetTimeMS ());
+
+    archive = NULL;
+    length = 0;
+
+    if (gamestate == GS_LEVEL && !demorecording && !demoplayback && !netgame)
+	archive = G_ArchiveState ("", &length);
+
+    memcpy (header, MIGRATE_MAGIC, 4);
+    header[4] = MIGRATE_VERSION;
+    D_WriteLong (header + 5, rndindex);
+    D_WriteLong (header + 9, prndindex);
+    D_WriteLong (header + 13, paused);
+    D_WriteLong (header + 17, length);
+
+    // renamed into place once whole, as savegames are
+    path = M_StringJoin (migratedir, DIR_SEPARATOR_S, name, ".mig", NULL);
+    temp = M_StringJoin (path, ".tmp", NULL);
+
+    f = fopen (temp, "wb");
+    ok = f != NULL
+      && fwrite (header, 1, sizeof(header), f) == sizeof(header)
+      && fwrite (archive, 1, length, f) == (size_t) length;
+    if (f != NULL && fclose (f) != 0)
+	ok = false;
+    if (ok && rename (temp, path) != 0)
+	ok = false;
+
+    // the game goes on here, and the drain waits for it to end
+    if (!ok)
+    {
+	remove (temp);
+	fprintf (stderr, "D_Migrate: couldn't write %s\n", path);
+	free (temp);
+	free (path);
+	migraterequested = 0;
+	return;
+    }
+
+    fprintf (stderr, "D_Migrate: saved to %s\n", path);
+
+    // the last frame goes out first
+    I_Shutdown ();
+
+    printf (MIGRATE_PREFIX "%s\a", name);
+    fflush (stdout);
+    exit (0);
+}
+
+#endif
+
+
+//
+// D_MigrateTicker
+//
+void D_MigrateTicker (void)
+{
+#ifndef _WIN32
+    // not while a level is being loaded or left
+    if (D_MigrationRequested () && gameaction == ga_nothing)
+	D_Migrate ();
+#endif
+}
+
+
+#ifndef _WIN32
+
+//
+// D_LoadMigration
+// Reads the file of the name, and deletes it, so that the game
+//  is only ever resumed once.
+//
+static void D_LoadMigration (char *name)
+{
+    char*	path;
+    FILE*	f;
+    long	size;
+
+    // only a name, not a path out of the dir
+    if (name[0] == '\0' || name[0] == '.' || strchr (name, '/') != NULL
+     || strchr (name, '\\') != NULL)
+    {
+	fprintf (stderr, "D_LoadMigration: bad name %s\n", name);
+	return;
+    }
+
+    path = M_StringJoin (migratedir, DIR_SEPARATOR_S, name, ".mig", NULL);
+    f = fopen (path, "rb");
+
+    if (f == NULL)
+    {
+	fprintf (stderr, "D_LoadMigration: couldn't read %s\n", path);
+	free (path);
+	return;
+    }
+
+    size = M_FileLength (f);
+    resumebuffer = malloc (size);
+
+    if (resumebuffer == NULL || size < MIGRATE_HEADER
+     || fread (resumebuffer, 1, size, f) != (size_t) size
+     || memcmp (resumebuffer, MIGRATE_MAGIC, 4) != 0
+     || resumebuffer[4] != MIGRATE_VERSION
+     || D_ReadLong (resumebuffer + 17) != size - MIGRATE_HEADER)
+    {
+	fprintf (stderr, "D_LoadMigration: %s isn't a migrated game\n", path);
+	free (resumebuffer);
+	resumebuffer = NULL;
+    }
+    else
+    {
+	remove (path);
+    }
+
+    fclose (f);
+    free (path);
+}
+
+#endif
+
+
+//
+// D_AcceptMigration
+// Looks for the name of a migrated game ahead of anything else
+//  on a new connection, and takes it off if it is there.
+//
+bool D_AcceptMigration (int fd)
+{
+#ifndef _WIN32
+    char	buffer[MIGRATE_PREFIX_LEN + MIGRATE_NAME_MAX + 1];
+    struct pollfd pfd;
+    char*	end;
+    int		start;
+    int		left;
+    int		len;
+
+    if (migratedir == NULL)
+	return false;
+
+    start = I_GetTimeMS ();
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (1)
+    {
+	left = MIGRATE_WAIT_MS - (I_GetTimeMS () - start);
+
+	if (left <= 0 || poll (&pfd, 1, left) <= 0)
+	    return false;
+
+	len = recv (fd, buffer, sizeof(buffer) - 1, MSG_PEEK);
+
+	if (len <= 0)
+	    return false;
+
+	// a client's own keys
+	if (memcmp (buffer, MIGRATE_PREFIX,
+		    len < MIGRATE_PREFIX_LEN ? len : MIGRATE_PREFIX_LEN) != 0)
+	    return false;
+
+	end = len > MIGRATE_PREFIX_LEN
+	    ? memchr (buffer + MIGRATE_PREFIX_LEN, '\a', len - MIGRATE_PREFIX_LEN)
+	    : NULL;
+
+	if (end != NULL)
+	    break;
+
+	if (len == sizeof(buffer) - 1)
+	    return false;
+
+	// the rest is on its way
+	I_Sleep (5);
+    }
+
+    // take it off, the keys after it are the game's
+    if (recv (fd, buffer, end - buffer + 1, 0) != end - buffer + 1)
+	return false;
+    *end = '\0';
+
+    D_LoadMigration (buffer + MIGRATE_PREFIX_LEN);
+    return true;
+#else
+    (void) fd;
+    return false;
+#endif
+}
+
+
+//
+// D_ResumeMigration
+//
+bool D_ResumeMigration (void)
+{
+    int		length;
+
+    if (resumebuffer == NULL)
+	return false;
+
+    length = D_ReadLong (resumebuffer + 17);
+
+    // not in a level when it left, so start afresh
+    if (length == 0 || !G_UnArchiveState (resumebuffer + MIGRATE_HEADER, length))
+    {
+	free (resumebuffer);
+	resumebuffer = NULL;
+	return false;
+    }
+
+    // after the level was set up, as it clears them
+    rndindex = D_ReadLong (resumebuffer + 5);
+    prndindex = D_ReadLong (resumebuffer + 9);
+    paused = D_ReadLong (resumebuffer + 13) != 0;
+
+    free (resumebuffer);
+    resumebuffer = NULL;
+
+    return true;
+}
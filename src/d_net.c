@@ -25,6 +25,7 @@
 #include "m_argv.h"
 #include "m_menu.h"
 #include "m_misc.h"
+#include "m_timing.h"
 #include "i_system.h"
 #include "i_timer.h"
 #include "i_video.h"
@@ -91,7 +92,9 @@ static void RunTic(ticcmd_t *cmds, bool *ingame)
     if (advancedemo)
         D_DoAdvanceDemo ();
 
+    M_StartStage (STAGE_TICKER);
     G_Ticker ();
+    M_EndStage (STAGE_TICKER);
 }
 
 static loop_interface_t doom_loop_interface = {
@@ -219,6 +222,11 @@ void D_ConnectNetGame(void)
     InitConnectData(&connect_data);
     netgame = D_InitNetGame(&connect_data);
 
+    if (!netgame)
+    {
+        netgame = D_StartCoop();
+    }
+
     //!
     // @category net
     //
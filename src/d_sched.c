@@ -0,0 +1,737 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Session CPU accounting and scheduling.
+//	With -server, each session charges the CPU time it uses to
+//	what it was doing: running tics, rendering, encoding or
+//	terminal I/O. The counts live in memory shared with the
+//	server, which reads them once a second. When the sessions
+//	together use more than the CPUs have, those using more
+//	than their share get their frame rate stepped down, and
+//	back up after a few seconds within it. Tics always run.
+//	With -sessionstats <file>, a line of JSON with each
+//	session's use is added to the file every second.
+//	Sessions also count their tics, frames, bytes written
+//	and zone and WAD use in the same memory, for -metrics.
+//	With -pincpus, each session is pinned to the CPU with the
+//	least load when it starts, and a session is moved off a
+//	CPU that can't keep up onto the one with the most to spare.
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "doomtype.h"
+
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+#include "z_zone.h"
+
+#include "d_sched.h"
+
+
+#define MAXSLOTS		256
+#define MAXPINCPUS		256
+
+// The sessions are overloading the CPUs above this
+#define SCHED_LOAD_PERCENT	90
+
+// Seconds within its share before a session steps back up
+#define SCHED_CALM_SECONDS	5
+
+typedef struct
+{
+    // 0 when free, -1 while forking
+    int			pid;
+
+    // written by the session
+    volatile uint64_t	cpu[NUMCPUKINDS];	// microseconds
+    volatile unsigned	frames;
+    volatile uint64_t	stats[NUMSESSIONSTATS];
+
+    // written by the server: ms between frames, 0 for any
+    volatile int	interval;
+
+    // the server's own
+    uint64_t		lastcpu[NUMCPUKINDS];
+    unsigned		lastframes;
+    int			level;
+    int			calm;
+    int			pincpu;		// index in pincpus, with -pincpus
+    uint64_t		lastused;	// microseconds, the last second
+} sessionslot_t;
+
+// Frame rate of each level, 0 for the tic rate
+static const int	schedfps[] = { 0, 17, 8, 4 };
+
+#define NUMSCHEDLEVELS	(sizeof(schedfps) / sizeof(*schedfps))
+
+static const char *cpukindnames[NUMCPUKINDS] =
+{
+    "other", "tics", "render", "encode", "io"
+};
+
+typedef enum
+{
+    METRIC_FRAMES,
+    METRIC_CPU,
+    METRIC_STAT,
+    METRIC_STATSECONDS	// a stat in microseconds
+} metricsource_t;
+
+typedef struct
+{
+    char*		name;
+    char*		help;
+    bool		gauge;
+    metricsource_t	source;
+    int			index;		// of the CPU kind or stat
+} metric_t;
+
+static const metric_t	metrics[] =
+{
+    { "frames_total", "Frames rendered.",
+      false, METRIC_FRAMES },
+    { "frames_dropped_total", "Frames dropped by the backend.",
+      false, METRIC_STAT, STAT_DROPPED },
+    { "tics_total", "Tics run.",
+      false, METRIC_STAT, STAT_TICS },
+    { "bytes_sent_total", "Bytes written to the terminal.",
+      false, METRIC_STAT, STAT_BYTES },
+    { "tic_seconds_total", "CPU seconds running tics.",
+      false, METRIC_CPU, CPU_TICS },
+    { "render_seconds_total", "CPU seconds rendering.",
+      false, METRIC_CPU, CPU_RENDER },
+    { "encode_seconds_total", "CPU seconds encoding frames.",
+      false, METRIC_CPU, CPU_ENCODE },
+    { "io_seconds_total", "CPU seconds on terminal I/O.",
+      false, METRIC_CPU, CPU_IO },
+    { "zone_purges_total", "Zone blocks purged.",
+      false, METRIC_STAT, STAT_PURGES },
+    { "lump_misses_total", "Lumps read in from the WADs.",
+      false, METRIC_STAT, STAT_LUMPMISSES },
+    { "zone_used_bytes", "Zone memory in use.",
+      true, METRIC_STAT, STAT_ZONEUSED },
+    { "inputs_total", "Key presses timed to the first frame showing them.",
+      false, METRIC_STAT, STAT_INPUTS },
+    { "input_latency_seconds_total", "Seconds from those key presses to the frames written.",
+      false, METRIC_STATSECONDS, STAT_LATENCY },
+    { "late_tics_total", "Tics run after another in the same frame, behind the clock.",
+      false, METRIC_STAT, STAT_LATETICS },
+    { "skipped_tics_total", "Tics of time let go, with the game too far behind.",
+      false, METRIC_STAT, STAT_SKIPPEDTICS },
+};
+
+#define NUMMETRICS	(sizeof(metrics) / sizeof(*metrics))
+
+static sessionslot_t*	slots;
+
+// server side
+static int		numcpus;
+static int		lastschedtime;
+static FILE*		statsfile;
+
+// with -pincpus, the CPUs sessions are pinned to and the
+// microseconds their sessions used the last second
+static int		pincpus[MAXPINCPUS];
+static uint64_t		pinload[MAXPINCPUS];
+static int		numpincpus;
+
+// counts of the sessions that have ended, for -metrics
+static sessionslot_t	ended;
+static unsigned		startedsessions;
+
+// session side
+static sessionslot_t*	myslot;
+static cpukind_t	cpukind;
+static uint64_t		cpulast;
+static int		lastframetime;
+static int		lastzonetime;
+
+
+static uint64_t D_CpuTime (void)
+{
+#ifndef _WIN32
+    struct timespec	ts;
+
+    // CPU time, so that sleeping between tics isn't counted
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+#else
+    return 0;
+#endif
+}
+
+
+static void D_InitPinning (void)
+{
+#ifdef __linux__
+    cpu_set_t	set;
+    int		i;
+
+    if (sched_getaffinity (0, sizeof(set), &set) < 0)
+	I_Error ("D_InitSched: couldn't get the CPUs to pin sessions to");
+
+    for (i=0 ; i<CPU_SETSIZE && numpincpus<MAXPINCPUS ; i++)
+	if (CPU_ISSET (i, &set) && numpincpus < numcpus)
+	    pincpus[numpincpus++] = i;
+
+    printf ("D_InitSched: pinning sessions to %i CPUs\n", numpincpus);
+#else
+    I_Error ("D_InitSched: -pincpus is only available on Linux");
+#endif
+}
+
+
+//
+// D_PinSession
+// Pins the session in the slot to the CPU, and counts
+// its load there.
+//
+static void D_PinSession (sessionslot_t* slot, int pincpu)
+{
+#ifdef __linux__
+    cpu_set_t	set;
+
+    CPU_ZERO (&set);
+    CPU_SET (pincpus[pincpu], &set);
+
+    // it may have ended already, which is fine
+    sched_setaffinity (slot->pid, sizeof(set), &set);
+
+    slot->pincpu = pincpu;
+    pinload[pincpu] += slot->lastused;
+#endif
+}
+
+
+//
+// D_InitSched
+//
+void D_InitSched (void)
+{
+#ifndef _WIN32
+    int		p;
+
+    slots = mmap (NULL, MAXSLOTS * sizeof(*slots), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (slots == MAP_FAILED)
+	I_Error ("D_InitSched: couldn't map the session slots");
+
+    //!
+    // @arg <n>
+    //
+    // With -server, the number of CPUs the sessions share. Sessions
+    // using more than their share of them get fewer frames per second.
+    // Defaults to every CPU.
+    //
+
+    p = M_CheckParmWithArgs ("-cpus", 1);
+    numcpus = p ? atoi (myargv[p+1]) : sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (numcpus < 1)
+	numcpus = 1;
+
+    //!
+    // @arg <file>
+    //
+    // With -server, add a line of JSON to file once a second, with
+    // the CPU time each session spent running tics, rendering,
+    // encoding and on terminal I/O, and its frame rate.
+    //
+
+    p = M_CheckParmWithArgs ("-sessionstats", 1);
+
+    if (p)
+    {
+	statsfile = fopen (myargv[p+1], "w");
+
+	if (statsfile == NULL)
+	    I_Error ("D_InitSched: couldn't open %s", myargv[p+1]);
+    }
+
+    //!
+    // With -server, pin each session to one CPU, the one with the
+    // least load when the session starts. A session is moved when
+    // its CPU can't keep up and another has time to spare. Linux
+    // only. With -cpus <n>, only the first n CPUs are used.
+    //
+
+    if (M_CheckParm ("-pincpus"))
+	D_InitPinning ();
+
+    lastschedtime = I_GetTimeMS ();
+#endif
+}
+
+
+//
+// D_SchedSlot
+//
+int D_SchedSlot (void)
+{
+    int		i;
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+    {
+	if (slots[i].pid == 0)
+	{
+	    memset (&slots[i], 0, sizeof(slots[i]));
+	    slots[i].pid = -1;
+	    return i;
+	}
+    }
+
+    return -1;
+}
+
+
+//
+// D_SchedStart
+//
+void D_SchedStart (int slot, int pid)
+{
+    int		best;
+    int		live;
+    int		i;
+
+    if (slot >= 0)
+	slots[slot].pid = pid > 0 ? pid : 0;
+
+    if (pid > 0)
+	startedsessions++;
+
+    if (slot < 0 || pid <= 0 || !numpincpus)
+	return;
+
+    // until it has been measured, count it as using as much
+    // as the others do on average, so that sessions starting
+    // together aren't all put on the same CPU
+    live = 0;
+
+    for (i=0 ; i<numpincpus ; i++)
+	slots[slot].lastused += pinload[i];
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+	if (slots[i].pid > 0)
+	    live++;
+
+    slots[slot].lastused /= live;
+
+    best = 0;
+
+    for (i=1 ; i<numpincpus ; i++)
+	if (pinload[i] < pinload[best])
+	    best = i;
+
+    D_PinSession (&slots[slot], best);
+}
+
+
+//
+// D_SchedEnd
+//
+void D_SchedEnd (int pid)
+{
+    sessionslot_t*	slot;
+    int			i;
+    int			j;
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+    {
+	slot = &slots[i];
+
+	if (slot->pid != pid)
+	    continue;
+
+	printf ("D_ServeSessions: session %i ended, CPU ms: tics %llu,"
+		" render %llu, encode %llu, io %llu, other %llu\n", pid,
+		(unsigned long long) slot->cpu[CPU_TICS] / 1000,
+		(unsigned long long) slot->cpu[CPU_RENDER] / 1000,
+		(unsigned long long) slot->cpu[CPU_ENCODE] / 1000,
+		(unsigned long long) slot->cpu[CPU_IO] / 1000,
+		(unsigned long long) slot->cpu[CPU_OTHER] / 1000);
+	fflush (stdout);
+
+	for (j=0 ; j<NUMCPUKINDS ; j++)
+	    ended.cpu[j] += slot->cpu[j];
+
+	// the zone in use only counts while running
+	for (j=0 ; j<NUMSESSIONSTATS ; j++)
+	    if (j != STAT_ZONEUSED)
+		ended.stats[j] += slot->stats[j];
+
+	ended.frames += slot->frames;
+
+	slot->pid = 0;
+	return;
+    }
+}
+
+
+static void D_WriteSchedStats (int now, int load)
+{
+    sessionslot_t*	slot;
+    char*		sep;
+    int			i;
+    int			j;
+
+    fprintf (statsfile, "{\"time\":%i,\"load\":%i,\"sessions\":[", now, load);
+
+    sep = "";
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+    {
+	slot = &slots[i];
+
+	if (slot->pid <= 0)
+	    continue;
+
+	fprintf (statsfile, "%s{\"pid\":%i", sep, slot->pid);
+
+	for (j=0 ; j<NUMCPUKINDS ; j++)
+	{
+	    fprintf (statsfile, ",\"%s\":%llu", cpukindnames[j],
+		     (unsigned long long) (slot->cpu[j] - slot->lastcpu[j]) / 1000);
+	}
+
+	fprintf (statsfile, ",\"frames\":%u,\"maxfps\":%i}",
+		 slot->frames - slot->lastframes, schedfps[slot->level]);
+	sep = ",";
+    }
+
+    fprintf (statsfile, "]}\n");
+    fflush (statsfile);
+}
+
+
+//
+// D_BalancePinned
+// Counts the load on each CPU sessions are pinned to, and
+// moves one session from the busiest, if it can't keep up,
+// to the one with the most time to spare.
+//
+static void D_BalancePinned (uint64_t capacity)
+{
+    sessionslot_t*	slot;
+    sessionslot_t*	move;
+    int			busiest;
+    int			idlest;
+    int			i;
+
+    memset (pinload, 0, sizeof(pinload));
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+	if (slots[i].pid > 0)
+	    pinload[slots[i].pincpu] += slots[i].lastused;
+
+    busiest = idlest = 0;
+
+    for (i=1 ; i<numpincpus ; i++)
+    {
+	if (pinload[i] > pinload[busiest])
+	    busiest = i;
+	if (pinload[i] < pinload[idlest])
+	    idlest = i;
+    }
+
+    if (pinload[busiest] * 100 <= capacity * SCHED_LOAD_PERCENT)
+	return;
+
+    // the busiest session that leaves the two better off than
+    // they were, so the same one isn't moved back next time
+    move = NULL;
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+    {
+	slot = &slots[i];
+
+	if (slot->pid <= 0 || slot->pincpu != busiest)
+	    continue;
+
+	if (pinload[idlest] + slot->lastused >= pinload[busiest])
+	    continue;
+
+	if (move == NULL || slot->lastused > move->lastused)
+	    move = slot;
+    }
+
+    if (move == NULL)
+	return;
+
+    pinload[busiest] -= move->lastused;
+    D_PinSession (move, idlest);
+}
+
+
+//
+// D_Schedule
+//
+void D_Schedule (void)
+{
+    sessionslot_t*	slot;
+    uint64_t		used[MAXSLOTS];
+    uint64_t		total;
+    uint64_t		capacity;
+    uint64_t		share;
+    bool		overloaded;
+    int			live;
+    int			now;
+    int			i;
+    int			j;
+
+    now = I_GetTimeMS ();
+
+    if (now - lastschedtime < 1000)
+	return;
+
+    // CPU time each session used since the last time
+    total = 0;
+    live = 0;
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+    {
+	slot = &slots[i];
+	used[i] = 0;
+
+	if (slot->pid <= 0)
+	    continue;
+
+	for (j=0 ; j<NUMCPUKINDS ; j++)
+	    used[i] += slot->cpu[j] - slot->lastcpu[j];
+
+	total += used[i];
+	live++;
+    }
+
+    capacity = (uint64_t) numcpus * (now - lastschedtime) * 1000;
+    share = live ? capacity / live : capacity;
+    overloaded = total * 100 > capacity * SCHED_LOAD_PERCENT;
+
+    if (statsfile != NULL)
+	D_WriteSchedStats (now, (int) (total * 100 / capacity));
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+    {
+	slot = &slots[i];
+
+	if (slot->pid <= 0)
+	    continue;
+
+	if (overloaded && used[i] > share)
+	{
+	    slot->calm = 0;
+	    if (slot->level + 1 < NUMSCHEDLEVELS)
+		slot->level++;
+	}
+	else if (slot->level > 0 && ++slot->calm >= SCHED_CALM_SECONDS)
+	{
+	    slot->calm = 0;
+	    slot->level--;
+	}
+
+	slot->interval = schedfps[slot->level] ? 1000 / schedfps[slot->level] : 0;
+	slot->lastused = used[i];
+
+	for (j=0 ; j<NUMCPUKINDS ; j++)
+	    slot->lastcpu[j] = slot->cpu[j];
+	slot->lastframes = slot->frames;
+    }
+
+    if (numpincpus)
+	D_BalancePinned ((uint64_t) (now - lastschedtime) * 1000);
+
+    lastschedtime = now;
+}
+
+
+//
+// D_SchedJoin
+//
+void D_SchedJoin (int slot)
+{
+    if (slot < 0)
+	return;
+
+    myslot = &slots[slot];
+    cpukind = CPU_OTHER;
+    cpulast = D_CpuTime ();
+}
+
+
+//
+// D_CpuPhase
+//
+cpukind_t D_CpuPhase (cpukind_t kind)
+{
+    cpukind_t	old;
+    uint64_t	now;
+
+    old = cpukind;
+
+    if (myslot == NULL)
+	return old;
+
+    now = D_CpuTime ();
+    myslot->cpu[cpukind] += now - cpulast;
+    cpulast = now;
+    cpukind = kind;
+
+    return old;
+}
+
+
+//
+// D_FrameDue
+//
+bool D_FrameDue (void)
+{
+    int		interval;
+    int		now;
+
+    if (myslot == NULL)
+	return true;
+
+    interval = myslot->interval;
+    now = I_GetTimeMS ();
+
+    if (interval && now - lastframetime < interval)
+	return false;
+
+    lastframetime = now;
+    myslot->frames++;
+    return true;
+}
+
+
+//
+// D_SessionCount
+//
+void D_SessionCount (sessionstat_t stat, uint64_t count)
+{
+    if (myslot != NULL)
+	myslot->stats[stat] += count;
+}
+
+
+//
+// D_SessionTicker
+//
+void D_SessionTicker (void)
+{
+    int		now;
+
+    if (myslot == NULL)
+	return;
+
+    now = I_GetTimeMS ();
+
+    if (now - lastzonetime < 1000)
+	return;
+
+    lastzonetime = now;
+
+    // purgable blocks count as free
+    myslot->stats[STAT_ZONEUSED] = Z_ZoneSize () - Z_FreeMemory ();
+}
+
+
+static double D_MetricValue (const metric_t *metric, sessionslot_t *slot)
+{
+    switch (metric->source)
+    {
+      case METRIC_FRAMES:
+	return slot->frames;
+
+      case METRIC_CPU:
+	return slot->cpu[metric->index] / 1000000.0;
+
+      case METRIC_STATSECONDS:
+	return slot->stats[metric->index] / 1000000.0;
+
+      default:
+	return slot->stats[metric->index];
+    }
+}
+
+
+//
+// D_WriteMetrics
+// Each metric is given as doom_<name>, over every session
+//  so far, and as doom_session_<name> for each one running.
+//
+void D_WriteMetrics (FILE* f)
+{
+    const metric_t*	metric;
+    sessionslot_t*	slot;
+    double		total;
+    int			live;
+    int			i;
+    int			j;
+
+    live = 0;
+
+    for (i=0 ; i<MAXSLOTS ; i++)
+	if (slots[i].pid > 0)
+	    live++;
+
+    fprintf (f, "# HELP doom_sessions Sessions running.\n"
+	     "# TYPE doom_sessions gauge\n"
+	     "doom_sessions %i\n", live);
+    fprintf (f, "# HELP doom_sessions_total Sessions started.\n"
+	     "# TYPE doom_sessions_total counter\n"
+	     "doom_sessions_total %u\n", startedsessions);
+
+    for (i=0 ; i<NUMMETRICS ; i++)
+    {
+	metric = &metrics[i];
+	total = D_MetricValue (metric, &ended);
+
+	for (j=0 ; j<MAXSLOTS ; j++)
+	    if (slots[j].pid > 0)
+		total += D_MetricValue (metric, &slots[j]);
+
+	fprintf (f, "# HELP doom_%s %s\n# TYPE doom_%s %s\ndoom_%s %.15g\n",
+		 metric->name, metric->help, metric->name,
+		 metric->gauge ? "gauge" : "counter", metric->name, total);
+
+	fprintf (f, "# HELP doom_session_%s %s\n# TYPE doom_session_%s %s\n",
+		 metric->name, metric->help, metric->name,
+		 metric->gauge ? "gauge" : "counter");
+
+	for (j=0 ; j<MAXSLOTS ; j++)
+	{
+	    slot = &slots[j];
+
+	    if (slot->pid > 0)
+		fprintf (f, "doom_session_%s{pid=\"%i\"} %.15g\n", metric->name,
+			 slot->pid, D_MetricValue (metric, slot));
+	}
+    }
+}
@@ -0,0 +1,90 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Session CPU accounting and scheduling.
+//
+
+
+#ifndef __D_SCHED__
+#define __D_SCHED__
+
+#include <stdio.h>
+
+#include "doomtype.h"
+
+// What a session spends its CPU time on.
+typedef enum
+{
+    CPU_OTHER,
+    CPU_TICS,		// TryRunTics
+    CPU_RENDER,		// D_Display, up to the backend
+    CPU_ENCODE,		// the backend encoding the frame
+    CPU_IO,		// the backend reading and writing the terminal
+    NUMCPUKINDS
+} cpukind_t;
+
+// What a session counts, for -metrics.
+typedef enum
+{
+    STAT_TICS,		// tics run
+    STAT_DROPPED,	// frames the backend dropped
+    STAT_BYTES,		// bytes written to the terminal
+    STAT_PURGES,	// zone blocks purged
+    STAT_LUMPMISSES,	// lumps read in from the WADs
+    STAT_ZONEUSED,	// zone bytes in use, as of the last second
+    STAT_INPUTS,	// key presses followed to the screen
+    STAT_LATENCY,	// microseconds they took, in all
+    STAT_LATETICS,	// tics run after another, behind the clock
+    STAT_SKIPPEDTICS,	// tics of time let go, too far behind
+    NUMSESSIONSTATS
+} sessionstat_t;
+
+// Called by the session server before it forks any session.
+void	D_InitSched (void);
+
+// Called by the session server around each fork: a slot for
+//  the session, or -1 if none is free, then its pid, or -1
+//  if the fork failed.
+int	D_SchedSlot (void);
+void	D_SchedStart (int slot, int pid);
+
+// Called by the session server once a session has ended.
+void	D_SchedEnd (int pid);
+
+// Called by the session server whenever it wakes, steps the
+//  sessions' frame rates once a second.
+void	D_Schedule (void);
+
+// Called in the forked session with its slot.
+void	D_SchedJoin (int slot);
+
+// Charges the CPU time since the last call to the kind
+//  then current, and returns it, for the caller to go
+//  back to. Does nothing outside a hosted session.
+cpukind_t D_CpuPhase (cpukind_t kind);
+
+// Whether the session server lets a frame be drawn now.
+bool	D_FrameDue (void);
+
+// Adds to a count of the session. Does nothing outside
+//  a hosted session.
+void	D_SessionCount (sessionstat_t stat, uint64_t count);
+
+// Called once a loop in the session, updates the zone use
+//  once a second.
+void	D_SessionTicker (void);
+
+// Writes the sessions' counts, and the totals of every
+//  session so far, in the Prometheus text format.
+void	D_WriteMetrics (FILE* f);
+
+#endif
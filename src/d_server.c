@@ -0,0 +1,566 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Session server.
+//	With -server <port>, startup runs once, up to the point
+//	where a game would begin. The process then listens on the
+//	port and forks a session for each connection, with the
+//	socket as its terminal. Sessions share the WADs, textures
+//	and tables loaded by then until they write to them.
+//	With -maxsessions <n>, connections wait in the queue
+//	while n sessions are running.
+//	With -netserver, the server also runs a multiplayer
+//	server, which every session joins.
+//	The sessions' CPU time is watched and shared out by
+//	d_sched.c.
+//	With -metrics <port>, the server answers HTTP requests on
+//	that port with the sessions' counts, for Prometheus.
+//	With -attract <file>, each session plays an asciicast of
+//	the title screen and demos to its connection until the
+//	first key, and only then starts the game.
+//	With -migrate <dir>, SIGUSR1 drains the server, and each
+//	session hands its game over to another server through
+//	dir; see d_migrate.c.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#include "doomtype.h"
+#include "doomgeneric.h"
+
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+
+#include "net_defs.h"
+#include "net_server.h"
+#include "net_udp.h"
+
+#include "d_main.h"
+#include "d_sched.h"
+
+
+#ifndef _WIN32
+
+static int	numsessions;
+
+
+//
+// ATTRACT LOOP
+// Most connections sit on the title screen and demos for a
+//  while, which are the same for every session. With -attract,
+//  they are an asciicast recorded once with -asciicast, loaded
+//  by the server, and played to each connection by its session
+//  without the engine running until the first key comes in.
+//
+typedef struct
+{
+    int		ms;		// from the start of the recording
+    int		offset;		// of the output in attracttext
+    int		length;
+} attractevent_t;
+
+static attractevent_t*	attractevents;
+static int		numattractevents;
+static char*		attracttext;
+static int		attracttextlen;
+
+
+//
+// D_UnescapeCast
+// The JSON string at p, up to its closing quote, into out.
+// Returns its length.
+//
+static int D_UnescapeCast (const char* p, char* out)
+{
+    char*	start;
+    unsigned	code;
+
+    start = out;
+
+    for ( ; *p && *p != '"' ; p++)
+    {
+	if (*p != '\\')
+	{
+	    *out++ = *p;
+	    continue;
+	}
+
+	switch (*++p)
+	{
+	  case 'n':	*out++ = '\n'; break;
+	  case 'r':	*out++ = '\r'; break;
+	  case 't':	*out++ = '\t'; break;
+	  case 'b':	*out++ = '\b'; break;
+	  case 'f':	*out++ = '\f'; break;
+
+	  case 'u':
+	    if (sscanf (p + 1, "%4x", &code) != 1)
+		return out - start;
+	    p += 4;
+
+	    // in UTF-8, as the terminal takes it
+	    if (code < 0x80)
+		*out++ = code;
+	    else if (code < 0x800)
+	    {
+		*out++ = 0xc0 | code >> 6;
+		*out++ = 0x80 | (code & 0x3f);
+	    }
+	    else
+	    {
+		*out++ = 0xe0 | code >> 12;
+		*out++ = 0x80 | (code >> 6 & 0x3f);
+		*out++ = 0x80 | (code & 0x3f);
+	    }
+	    break;
+
+	  case '\0':
+	    return out - start;
+
+	  default:
+	    *out++ = *p;
+	    break;
+	}
+    }
+
+    return out - start;
+}
+
+
+//
+// D_LoadAttract
+// The output events of an asciicast v2 file.
+//
+static void D_LoadAttract (char* path)
+{
+    FILE*	f;
+    char*	line;
+    size_t	linesize;
+    ssize_t	len;
+    double	at;
+    char*	p;
+
+    f = fopen (path, "r");
+
+    if (f == NULL)
+	I_Error ("D_LoadAttract: couldn't open %s", path);
+
+    line = NULL;
+    linesize = 0;
+
+    while ((len = getline (&line, &linesize, f)) > 0)
+    {
+	// [time, "o", "text"]; the header and resizes are skipped
+	if (line[0] != '[' || sscanf (line + 1, "%lf", &at) != 1)
+	    continue;
+
+	p = strchr (line, ',');
+	if (p == NULL || strncmp (p, ", \"o\", \"", 8))
+	    continue;
+
+	attractevents = realloc (attractevents,
+				 (numattractevents + 1) * sizeof(*attractevents));
+	attracttext = realloc (attracttext, attracttextlen + len);
+
+	if (attractevents == NULL || attracttext == NULL)
+	    I_Error ("D_LoadAttract: out of memory for %s", path);
+
+	attractevents[numattractevents].ms = at * 1000;
+	attractevents[numattractevents].offset = attracttextlen;
+	attractevents[numattractevents].length =
+	    D_UnescapeCast (p + 8, attracttext + attracttextlen);
+	attracttextlen += attractevents[numattractevents].length;
+	numattractevents++;
+    }
+
+    free (line);
+    fclose (f);
+
+    // played in a loop, which would spin on one without timing
+    if (numattractevents == 0
+     || attractevents[numattractevents-1].ms <= 0)
+	I_Error ("D_LoadAttract: %s has no timed output", path);
+
+    printf ("D_LoadAttract: %i frames, %i bytes, %i seconds\n",
+	    numattractevents, attracttextlen,
+	    attractevents[numattractevents-1].ms / 1000);
+}
+
+
+//
+// D_PlayAttract
+// Plays the recording to the connection, over and over, until
+//  something comes from it, which is left for the engine to
+//  read. Ends the session if the connection closes first.
+//
+static void D_PlayAttract (int fd)
+{
+    struct pollfd	pfd;
+    attractevent_t*	event;
+    char		c;
+    int			start;
+    int			wait;
+    int			sent;
+    int			n;
+    int			i;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (1)
+    {
+	start = I_GetTimeMS ();
+
+	for (i=0 ; i<numattractevents ; i++)
+	{
+	    event = &attractevents[i];
+	    wait = event->ms - (I_GetTimeMS () - start);
+
+	    if (poll (&pfd, 1, wait > 0 ? wait : 0) > 0)
+	    {
+		if (recv (fd, &c, 1, MSG_PEEK) <= 0)
+		    _exit (0);
+		return;
+	    }
+
+	    for (sent = 0 ; sent < event->length ; sent += n)
+	    {
+		n = send (fd, attracttext + event->offset + sent,
+			  event->length - sent, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+		    n = 0;
+		else if (n < 0)
+		    _exit (0);
+	    }
+	}
+    }
+}
+
+
+//
+// D_ReapSessions
+// Counts off the sessions that have ended.
+//
+static void D_ReapSessions (void)
+{
+    int		pid;
+
+    while (numsessions > 0)
+    {
+	pid = waitpid (-1, NULL, WNOHANG);
+
+	if (pid < 0 && errno == EINTR)
+	    continue;
+
+	if (pid <= 0)
+	    break;
+
+	D_SchedEnd (pid);
+	numsessions--;
+    }
+}
+
+
+//
+// D_Listen
+// A socket listening on the port, on every address.
+//
+static int D_Listen (char* port)
+{
+    struct addrinfo	hints;
+    struct addrinfo*	addrs;
+    struct addrinfo*	addr;
+    int			listener;
+    int			on;
+
+    memset (&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (getaddrinfo (NULL, port, &hints, &addrs) != 0)
+	I_Error ("D_Listen: bad port %s", port);
+
+    listener = -1;
+
+    // the first address that can be listened on
+    for (addr = addrs ; addr != NULL ; addr = addr->ai_next)
+    {
+	if (listener >= 0)
+	    close (listener);
+
+	listener = socket (addr->ai_family, addr->ai_socktype,
+			   addr->ai_protocol);
+	if (listener < 0)
+	    continue;
+
+	on = 1;
+	setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if (bind (listener, addr->ai_addr, addr->ai_addrlen) == 0
+	 && listen (listener, SOMAXCONN) == 0)
+	    break;
+
+	close (listener);
+	listener = -1;
+    }
+
+    freeaddrinfo (addrs);
+
+    if (listener < 0)
+	I_Error ("D_Listen: couldn't listen on port %s", port);
+
+    return listener;
+}
+
+
+
+//
+// D_ServeMetrics
+// Answers whatever was asked with the metrics.
+//
+static void D_ServeMetrics (int listener)
+{
+    struct pollfd	pfd;
+    char		request[1024];
+    FILE*		f;
+    int			fd;
+
+    fd = accept (listener, NULL, NULL);
+
+    if (fd < 0)
+	return;
+
+    // closing with the request unread would reset the connection
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    if (poll (&pfd, 1, 1000) > 0)
+	recv (fd, request, sizeof(request), 0);
+
+    f = fdopen (fd, "w");
+
+    if (f == NULL)
+    {
+	close (fd);
+	return;
+    }
+
+    fprintf (f, "HTTP/1.0 200 OK\r\n"
+	     "Content-Type: text/plain; version=0.0.4\r\n"
+	     "Connection: close\r\n\r\n");
+    D_WriteMetrics (f);
+    fclose (f);
+}
+
+#endif
+
+
+//
+// D_ServeSessions
+// Returns in each session, the server itself never does.
+//
+void D_ServeSessions (void)
+{
+#ifndef _WIN32
+    struct pollfd	pfds[2];
+    int		listener;
+    int		metrics;
+    int		maxsessions;
+    int		netserver;
+    int		fd;
+    int		pid;
+    int		slot;
+#endif
+    int		p;
+
+    //!
+    // @arg <port>
+    //
+    // Start up once, then listen on the TCP port and run a game for
+    // each connection, in a process forked from this one, with the
+    // connection as its terminal.
+    //
+
+    p = M_CheckParmWithArgs ("-server", 1);
+
+    if (!p)
+	return;
+
+#ifdef _WIN32
+    I_Error ("D_ServeSessions: -server isn't available on Windows");
+#else
+    // each session would want the port for itself
+    if (M_CheckParm ("-udp"))
+	I_Error ("D_ServeSessions: -udp takes a single client, not -server");
+
+    listener = D_Listen (myargv[p+1]);
+
+    printf ("D_ServeSessions: listening on port %s\n", myargv[p+1]);
+
+    //!
+    // @arg <n>
+    //
+    // With -server, run at most n sessions at a time. Further
+    // connections wait until one ends.
+    //
+
+    p = M_CheckParmWithArgs ("-maxsessions", 1);
+    maxsessions = p ? atoi (myargv[p+1]) : 0;
+
+    //!
+    // @arg <file>
+    //
+    // With -server, play the asciicast file, recorded with -asciicast
+    // from the title screen and demos with the same options, to each
+    // new connection until it sends a key, and only then start the
+    // game. Not with -websocket or -cellgrid.
+    //
+
+    p = M_CheckParmWithArgs ("-attract", 1);
+
+    if (p)
+    {
+	if (M_CheckParm ("-websocket") || M_CheckParm ("-cellgrid"))
+	    I_Error ("D_ServeSessions: -attract plays text frames, "
+		     "not -websocket or -cellgrid");
+
+	D_LoadAttract (myargv[p+1]);
+    }
+
+    // relay the sessions' ticcmds from here
+    netserver = M_CheckParm ("-netserver") > 0;
+
+    if (netserver)
+    {
+	NET_SV_Init ();
+	NET_SV_AddModule (&net_udp_module);
+    }
+
+    //!
+    // @arg <port>
+    //
+    // With -server, answer HTTP requests on the TCP port with the
+    // frames, tics, bytes, CPU time and zone and WAD use of each
+    // session and of all of them, in the Prometheus text format.
+    //
+
+    p = M_CheckParmWithArgs ("-metrics", 1);
+    metrics = p ? D_Listen (myargv[p+1]) : -1;
+
+    D_InitSched ();
+
+    while (1)
+    {
+	NET_SV_Run ();
+
+	D_ReapSessions ();
+	D_Schedule ();
+
+	// draining for -migrate: the sessions are sent on, and
+	// the server goes once they have
+	if (D_MigrationRequested () && listener >= 0)
+	{
+	    close (listener);
+	    listener = -1;
+	    printf ("D_ServeSessions: draining %i sessions\n", numsessions);
+	    fflush (stdout);
+	    kill (0, SIGUSR1);
+	}
+
+	if (listener < 0 && numsessions == 0)
+	    exit (0);
+
+	// wake now and then to count off ended sessions,
+	// and often enough to keep the net server moving;
+	// the running sessions are still scheduled while full
+	pfds[0].fd = maxsessions > 0 && numsessions >= maxsessions ? -1 : listener;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	pfds[1].fd = metrics;
+	pfds[1].events = POLLIN;
+	pfds[1].revents = 0;
+
+	if (poll (pfds, 2, netserver ? 5 : pfds[0].fd < 0 ? 100 : 1000) <= 0)
+	    continue;
+
+	if (pfds[1].revents & POLLIN)
+	    D_ServeMetrics (metrics);
+
+	if (!(pfds[0].revents & POLLIN))
+	    continue;
+
+	fd = accept (listener, NULL, NULL);
+
+	if (fd < 0)
+	{
+	    if (errno == EINTR || errno == ECONNABORTED)
+		continue;
+	    I_Error ("D_ServeSessions: accept failed (%s)", strerror (errno));
+	}
+
+	fflush (stdout);
+	fflush (stderr);
+
+	slot = D_SchedSlot ();
+	pid = fork ();
+
+	if (pid == 0)
+	{
+	    close (listener);
+	    if (metrics >= 0)
+		close (metrics);
+	    NET_SV_Detach ();
+	    D_SchedJoin (slot);
+
+	    // stderr stays the server's log
+	    dup2 (fd, STDIN_FILENO);
+	    dup2 (fd, STDOUT_FILENO);
+	    close (fd);
+
+	    // a migrated game goes on where it was
+	    if (!D_AcceptMigration (STDIN_FILENO) && numattractevents > 0)
+		D_PlayAttract (STDOUT_FILENO);
+
+	    DG_Init ();
+	    I_InitTimer ();
+	    return;
+	}
+
+	D_SchedStart (slot, pid);
+
+	if (pid < 0)
+	    fprintf (stderr, "D_ServeSessions: couldn't fork (%s)\n",
+		     strerror (errno));
+	else
+	    numsessions++;
+
+	close (fd);
+    }
+#endif
+}
@@ -60,6 +60,20 @@ typedef struct thinker_s
     struct thinker_s*	prev;
     struct thinker_s*	next;
     think_t		function;
+
+    // The thinkers P_RunThinkers visits, a subset of
+    //  the list above in the same order. runprev is
+    //  NULL while the thinker is parked.
+    struct thinker_s*	runprev;
+    struct thinker_s*	runnext;
+
+    // Set by P_SleepThinker to the leveltime it is woken
+    //  at, and kept after an earlier wake for the thinker
+    //  to tell what it missed. wakenext is NULL unless it
+    //  is asleep in a slot of the wheel.
+    int			waketic;
+    struct thinker_s*	wakeprev;
+    struct thinker_s*	wakenext;
     
 } thinker_t;
 
@@ -66,7 +66,9 @@ typedef enum
     ga_completed,
     ga_victory,
     ga_worlddone,
-    ga_screenshot
+    ga_screenshot,
+    ga_rewind,
+    ga_seek
 } gameaction_t;
 
 //
@@ -21,7 +21,7 @@
 
 // Enables wad merging (the '-merge' command line parameter)
 
-#undef FEATURE_WAD_MERGE
+#define FEATURE_WAD_MERGE
 
 // Enables dehacked support ('-deh')
 
@@ -29,7 +29,7 @@
 
 // Enables multiplayer support (network games)
 
-#undef FEATURE_MULTIPLAYER
+#define FEATURE_MULTIPLAYER
 
 // Enables sound output
 
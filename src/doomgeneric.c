@@ -22,20 +22,47 @@
 unsigned DOOMGENERIC_RESX = 80;
 unsigned DOOMGENERIC_RESY = 50;
 
-uint32_t* DG_ScreenBuffer = 0;
+pixel_t* DG_ScreenBuffer = 0;
 
+const pixel_t* DG_SourcePixels = 0;
+unsigned DG_SourceStep = 1;
+unsigned DG_SourcePitch = 0;
+
+dg_rect_t DG_DirtyRects[DG_MAXDIRTYRECTS];
+int DG_NumDirtyRects = -1;
+
+int DG_NativeRender = 0;
+
+int DG_AspectCorrect = 0;
+
+unsigned DG_FrameHeight(unsigned scaling)
+{
+	const unsigned height = SCREENHEIGHT / scaling;
+
+	return DG_AspectCorrect ? height * 6 / 5 : height;
+}
 
 void dg_Create()
 {
 	int i;
+
+	//!
+	// Stretch the frame from 5 rows to 6, blending the rows in
+	// between, so that it has the proportions of the original 4:3
+	// display instead of looking squat.
+	//
+	DG_AspectCorrect = M_CheckParm("-aspect") > 0;
+
 	i = M_CheckParmWithArgs("-scaling", 1);
     if (i > 0) {
 		i = atoi(myargv[i + 1]);
 		DOOMGENERIC_RESX = SCREENWIDTH / i;
-		DOOMGENERIC_RESY = SCREENHEIGHT / i;
 	}
+	DOOMGENERIC_RESY = DG_FrameHeight(SCREENWIDTH / DOOMGENERIC_RESX);
 
-	DG_ScreenBuffer = malloc(DOOMGENERIC_RESX * DOOMGENERIC_RESY * 4);
+	DG_ScreenBuffer = malloc(DOOMGENERIC_RESX * DOOMGENERIC_RESY * sizeof(pixel_t));
 
-	DG_Init();
+	// a session server sets up each session's terminal
+	if (!M_CheckParm("-server"))
+		DG_Init();
 }
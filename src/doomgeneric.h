@@ -8,15 +8,102 @@ extern unsigned DOOMGENERIC_RESX;
 extern unsigned DOOMGENERIC_RESY;
 
 
-extern uint32_t* DG_ScreenBuffer;
+#ifdef CMAP256
+// Palette indices, downsampled straight from I_VideoBuffer
+typedef uint8_t pixel_t;
+#else
+// XRGB8888 as laid out by cmap_to_fb
+typedef uint32_t pixel_t;
+#endif
+
+extern pixel_t* DG_ScreenBuffer;
+
+// Where DG_DrawFrame reads the frame's pixels if not NULL, instead of
+// DG_ScreenBuffer: DOOMGENERIC_RESX x DOOMGENERIC_RESY of them,
+// DG_SourceStep apart across and DG_SourcePitch apart down. The engine
+// points it at its own screen to have the sampled pixels classified where
+// they were drawn, without copying them into DG_ScreenBuffer first.
+extern const pixel_t* DG_SourcePixels;
+extern unsigned DG_SourceStep;
+extern unsigned DG_SourcePitch;
+
+// The parts of DG_ScreenBuffer changed since the last DG_DrawFrame, in its
+// pixels from x1,y1 up to x2,y2. DG_DrawFrame only looks at these, and
+// takes them, leaving none. -1 for all of it.
+#define DG_MAXDIRTYRECTS 16
+
+typedef struct
+{
+	unsigned x1, y1;
+	unsigned x2, y2;
+} dg_rect_t;
+
+extern dg_rect_t DG_DirtyRects[DG_MAXDIRTYRECTS];
+extern int DG_NumDirtyRects;
+
+// Dots for the automap to draw its lines with, if the backend can show them,
+// otherwise NULL. DG_DotsWidth x DG_DotsHeight of them spread evenly over
+// DG_ScreenBuffer, each a palette index or 0 for none. They are shown where
+// the frame is blank, in the next frame only, once DG_DotsShown is set.
+extern uint8_t *DG_Dots;
+extern unsigned DG_DotsWidth;
+extern unsigned DG_DotsHeight;
+extern int DG_DotsShown;
+
+// Text the menus and messages are drawn in, if the backend can show it,
+// otherwise NULL. DG_TextWidth x DG_TextHeight characters over
+// DG_ScreenBuffer, 0 for none, shown over the next frame and then cleared.
+extern char *DG_Text;
+extern unsigned DG_TextWidth;
+extern unsigned DG_TextHeight;
+
+// Set by DG_Init to have the 3D view rendered at DOOMGENERIC_RESX x
+// DOOMGENERIC_RESY instead of sampled from the full 320x200 frame
+extern int DG_NativeRender;
+
+// Set with -aspect, for frames stretched from 5 rows to 6 to have the
+// proportions of the original 4:3 display
+extern int DG_AspectCorrect;
+
+// The frame's height at a scaling: SCREENHEIGHT / scaling, 6/5 of that
+// with DG_AspectCorrect
+unsigned DG_FrameHeight(unsigned scaling);
 
 
 void DG_Init();
 void DG_DrawFrame();
+// Nonzero if the next DG_DrawFrame would be sent, otherwise the frame is
+// dropped and needn't be rendered at all
+int DG_ReadyForFrame(void);
+void DG_SetPalette(const uint32_t *palette);
 void DG_SleepMs(uint32_t ms);
+// Sleeps until DG_GetTicksUs reaches us
+void DG_SleepUntilUs(uint64_t us);
 uint32_t DG_GetTicksMs();
+uint64_t DG_GetTicksUs(void);
 int DG_GetKey(int* pressed, unsigned char* key);
 void DG_SetWindowTitle(const char * title);
+// A line of text shown below the screen, empty for none
+void DG_SetStatusText(const char *text);
 void DG_ReadInput(void);
+// Blocks until the terminal has input. Returns 0 once it has closed.
+int DG_WaitForInput(void);
+// Called once DOOMGENERIC_RESX and DOOMGENERIC_RESY have changed
+void DG_Resize(void);
+// The scaling the frame should have now, for the window size or the
+// output budget. 0 to keep the current one.
+int DG_FitScaling(void);
+
+// -coop: players joining from other terminals, numbered from 0 in the
+// order they joined. Returns the new one's number, or -1 if none came
+// within timeout_ms.
+int DG_AcceptViewport(int timeout_ms);
+// Fills keydown[256] with the doom keys held on the player's terminal.
+// Returns 0 once the player has gone.
+int DG_ViewportKeys(int viewport, unsigned char *keydown);
+// Nonzero if the player's terminal would take a frame now
+int DG_ViewportReady(int viewport);
+// Sends DG_ScreenBuffer to the player, with status below it
+void DG_DrawViewport(int viewport, const char *status);
 
 #endif //DOOM_GENERIC
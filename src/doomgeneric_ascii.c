@@ -15,9 +15,15 @@
 //     terminal-specific code
 //
 
+#include "d_sched.h"
 #include "doomgeneric.h"
 #include "doomkeys.h"
+#include "doomstat.h"
 #include "i_system.h"
+#include "i_video.h"
+#include "m_argv.h"
+#include "m_timing.h"
+#include "sha1.h"
 
 #include <ctype.h>
 #include <errno.h>
@@ -25,17 +31,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include "i_simd.h"
+#ifdef HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
 
 #if defined(_WIN32) || defined(WIN32)
 #define OS_WINDOWS
 #include <windows.h>
 #else
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <strings.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <termios.h>
-#include <time.h>
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifdef OS_WINDOWS
 #define CLK 0
 
@@ -60,245 +82,5054 @@ void winError(char *format)
 	I_Error(format, lpMsgBuf);
 }
 
-/* Modified from https://stackoverflow.com/a/31335254 */
 struct timespec {
 	long tv_sec;
 	long tv_nsec;
 };
+/* The performance counter, which like CLOCK_MONOTONIC isn't set by the user or NTP */
 int clock_gettime(int p, struct timespec *spec)
 {
 	(void)p;
-	__int64 wintime;
-	GetSystemTimeAsFileTime((FILETIME *)&wintime);
-	wintime -= 116444736000000000ll;
-	spec->tv_sec = wintime / 10000000ll;
-	spec->tv_nsec = wintime % 10000000ll * 100;
+	LARGE_INTEGER count, freq;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	spec->tv_sec = count.QuadPart / freq.QuadPart;
+	spec->tv_nsec = count.QuadPart % freq.QuadPart * 1000000000ll / freq.QuadPart;
 	return 0;
 }
 
 #else
-#define CLK CLOCK_REALTIME
+/* Never steps when the wall clock is set, unlike CLOCK_REALTIME */
+#define CLK CLOCK_MONOTONIC
+#endif
+
+#define UNLIKELY(x_) __builtin_expect((x_), 0)
+#define CALL(stmt_, format_)                     \
+	do {                                     \
+		if (UNLIKELY(stmt_))             \
+			I_Error(format_, errno); \
+	} while (0)
+
+#define BYTE_TO_TEXT(buf_, byte_)                      \
+	do {                                           \
+		*(buf_)++ = '0' + (byte_) / 100u;      \
+		*(buf_)++ = '0' + (byte_) / 10u % 10u; \
+		*(buf_)++ = '0' + (byte_) % 10u;       \
+	} while (0)
+
+/* The last glyph is doubled so that pure white, the only value that reaches
+ * index GRAD_LEN - 1, doesn't read the terminating NUL */
+const char grad[] = " .-+1x@@";
+#define GRAD_LEN 8u
+/* -mono's ramp, by how much of the cell each glyph inks, with none of the
+ * colors to tell shades apart */
+const char mono_grad[] = " .,:-~=+*ixXO#%@";
+#define MONO_GRAD_LEN 16u
+#define INPUT_BUFFER_LEN 256u
+#define KEY_QUEUE_LEN 256u
+
+struct color_t {
+	uint32_t b : 8;
+	uint32_t g : 8;
+	uint32_t r : 8;
+	uint32_t a : 8;
+};
+
+/* Delta frames are abandoned for a full repaint once more than
+ * DELTA_FULL_PERCENT of the cells changed */
+#define DELTA_FULL_PERCENT 60u
+
+/* A frame the same as the last one sent is only sent again after this long,
+ * to keep the connection alive and repaint what the terminal may have lost */
+#define IDLE_REFRESH_MS 1000u
+
+/* Longest SGR parameters: 38;2;RRR;GGG;BBB, zero-padded components */
+#define SGR_PARAM_MAX_LEN 16u
+
+enum color_mode_t {
+	COLORS_16,
+	COLORS_256,
+	COLORS_TRUECOLOR,
+};
+
+const char *const color_mode_names[] = { "16", "256", "truecolor" };
+enum color_mode_t color_mode = COLORS_16;
+
+struct sgr_t {
+	char params[SGR_PARAM_MAX_LEN];
+	uint8_t len;
+};
+
+/* A cell is its color class and glyph, as last emitted to the terminal. In
+ * half-block mode it is instead the classes of the top (high half) and bottom
+ * (low half) pixels, drawn as foreground and background of U+2580. */
+typedef uint64_t cell_t;
+
+#define CELL(cls_, glyph_) ((cell_t)(cls_) << 8 | (uint8_t)(glyph_))
+#define CELL_CLASS(cell_) ((uint32_t)((cell_) >> 8))
+#define CELL_GLYPH(cell_) ((char)((cell_) & 0xFF))
+#define HALF_BLOCK_CELL(top_, bottom_) ((cell_t)CELL_CLASS(top_) << 32 | CELL_CLASS(bottom_))
+#define HALF_BLOCK_TOP(cell_) ((uint32_t)((cell_) >> 32))
+#define HALF_BLOCK_BOTTOM(cell_) ((uint32_t)(cell_))
+
+/* A braille cell, in either mode, is drawn in one color class on the blank
+ * background: two patterns of 2x4 dots, the first in the low byte, or one in
+ * half-block mode. The flag is above any class, so other cells never have it. */
+#define BRAILLE_FLAG ((cell_t)1 << 63)
+#define BRAILLE_CELL(cls_, dots_) (BRAILLE_FLAG | (cell_t)(cls_) << 16 | (dots_))
+#define IS_BRAILLE(cell_) (((cell_) & BRAILLE_FLAG) != 0)
+#define BRAILLE_CLASS(cell_) ((uint32_t)((cell_) >> 16) & 0xFFFFFFu)
+#define BRAILLE_DOTS(cell_) ((unsigned)((cell_) & 0xFFFFu))
+
+/* A text cell is -textoverlay characters in one color class on the blank
+ * background, its class where a braille cell's is: two characters, the first
+ * in the low byte, or one in half-block mode. */
+#define TEXT_FLAG ((cell_t)1 << 62)
+#define TEXT_CELL(cls_, first_, second_) (TEXT_FLAG | (cell_t)(cls_) << 16 | (cell_t)(uint8_t)(second_) << 8 | (uint8_t)(first_))
+#define IS_TEXT(cell_) (((cell_) & TEXT_FLAG) != 0)
+#define TEXT_CLASS(cell_) BRAILLE_CLASS(cell_)
+#define TEXT_FIRST(cell_) ((char)((cell_) & 0xFF))
+#define TEXT_SECOND(cell_) ((char)((cell_) >> 8 & 0xFF))
+
+/* The palette index text is drawn in, the red of the game's fonts */
+#define TEXT_COLOR 176
+
+/* The cells of each palette seen, as the damage and pickup flashes keep
+ * switching between the PLAYPAL palettes: going back to one is a pointer
+ * swap. Dropped when the color mode changes. */
+#define PALETTE_SLOTS 32
+
+struct palette_slot_t {
+	uint32_t colors[256];
+	cell_t cells[256];
+	uint8_t levels[256]; /* luma, 16 to each step of mono_grad */
+	bool valid;
+};
+
+struct palette_slot_t palette_slots[PALETTE_SLOTS];
+unsigned palette_next;
+
+/* The pixels and dots of the frame being built: the engine's own, or with
+ * -pipeline copies of them. The pixels are frame_step apart across and
+ * frame_pitch down, as DG_SourcePixels may be the engine's full screen. */
+const pixel_t *frame_pixels;
+unsigned frame_step, frame_pitch;
+const uint8_t *frame_dots;
+
+/* Cell for each palette index, set by DG_SetPalette. This is the whole of
+ * classification: the kernels below only look pixels up in it. */
+cell_t *palette_cells = palette_slots[0].cells;
+uint8_t *palette_levels = palette_slots[0].levels;
+
+/* A color class is the terminal color itself, so it is stable across palette
+ * changes: bold << 3 | ANSI color in 16-color mode, the xterm color number in
+ * 256-color mode, and 0xRRGGBB in truecolor mode. The SGR parameters of the
+ * first two are prebaked, truecolor ones are written out as needed. */
+struct sgr_t class_fg[256];
+struct sgr_t class_bg[256];
+
+/* Colors currently selected on the terminal, -1 when unknown */
+struct sgr_state_t {
+	int64_t fg;
+	int64_t bg;
+};
+
+/* Where a delta frame has left the cursor, 0-based, if known */
+struct cursor_t {
+	unsigned row;
+	unsigned col;
+	bool known;
+};
+
+uint64_t frame_count;
+uint64_t frame_bytes;
+uint64_t frames_dropped;
+uint64_t frames_starved; /* dropped for the budget or a full terminal */
+uint64_t frames_unchanged; /* not sent, being the same as the last */
+uint64_t sent_hash; /* of the cells of the last frame sent, without -delta */
+uint32_t last_sent_ms;
+
+/* Frames are written without blocking the game loop. Whatever the terminal
+ * didn't accept stays pending, and new frames are dropped until it drains;
+ * with -delta the next frame sent carries every change since the last one. */
+const char *output_pending;
+size_t output_pending_len;
+uint32_t frame_interval_ms;
+uint32_t last_frame_ms;
+/* With -transcode <file>, the frames go to file instead, as from a
+ * -timedemo, which doesn't wait for the time of each tic. A file always
+ * takes the whole frame, so none are dropped, and the terminal is left
+ * alone: it isn't put in raw mode, read or asked its size. */
+bool transcoding;
+#ifndef OS_WINDOWS
+int output_flags;
+int output_fd = STDOUT_FILENO;
+/* A socket, as for sessions of -server, takes MSG_DONTWAIT on each send
+ * instead of O_NONBLOCK being set and cleared around the writes, which is
+ * one system call a frame instead of three */
+bool output_socket;
+#endif
+
+/* With -budget <bytes/s>, at most that many bytes are written a second,
+ * give or take a second's worth of burst. Once a second the quality is
+ * stepped down a level when the output falls behind, and back up after a
+ * few seconds with room to spare: colors first, then frame rate, then
+ * scaling. */
+#define ADAPT_LATENCY_MS 250u
+#define ADAPT_CALM_SECONDS 5u
+
+struct adapt_level_t {
+	enum color_mode_t max_colors;
+	unsigned max_fps; /* 0 for the tic rate */
+	unsigned extra_scaling;
+};
+
+const struct adapt_level_t adapt_levels[] = {
+	{ COLORS_TRUECOLOR, 0, 0 },
+	{ COLORS_256, 0, 0 },
+	{ COLORS_256, 17, 0 },
+	{ COLORS_16, 17, 0 },
+	{ COLORS_16, 17, 1 },
+	{ COLORS_16, 17, 2 },
+	{ COLORS_16, 8, 2 },
+	{ COLORS_16, 8, 4 },
+};
+#define ADAPT_LEVELS (sizeof(adapt_levels) / sizeof(*adapt_levels))
+
+uint64_t budget; /* 0 without -budget */
+int64_t budget_tokens;
+uint32_t budget_refill_ms;
+unsigned adapt_level;
+unsigned adapt_calm; /* seconds with room to spare */
+uint32_t adapt_last_ms;
+uint64_t adapt_sent; /* bytes written since adapt_last_ms */
+uint64_t adapt_frames, adapt_starved; /* counts at adapt_last_ms */
+
+/* Settings as asked for, and what the level takes off them */
+enum color_mode_t base_color_mode;
+unsigned base_scaling;
+uint32_t adapt_interval_ms;
+unsigned extra_scaling;
+uint32_t current_palette[256];
+
+bool half_block;
+/* -mono: glyphs only, without an SGR code, all cells of the one class 0.
+ * -dither spreads the levels between two glyphs over a 4x4 Bayer matrix. */
+bool mono;
+bool dither;
+
+/* -braille: the view is drawn in braille dots, a pixel to a dot, each cell
+ * being 4x4 pixels as the two patterns of a braille cell. The dots lit are
+ * those above BRAILLE_DARK and, where the cell has contrast, above the
+ * middle of its levels, in the class most of them have. */
+#define BRAILLE_DARK 16u
+#define BRAILLE_CONTRAST 32u
+bool braille_view;
+
+/* -rep: a run of the same cell is its first character then REP, CSI n b,
+ * for the terminal to repeat it n times, where that is shorter */
+#define REP_PAYS(bytes_, n_) ((bytes_) * (n_) > 3u + ((n_) >= 100u ? 3u : (n_) >= 10u ? 2u : 1u))
+bool rep_enabled;
+
+/* -graphics: frames go out as images, in the kitty graphics protocol or as
+ * sixels, instead of as cells; the grid is then the frame's pixels */
+enum graphics_t {
+	GRAPHICS_NONE,
+	GRAPHICS_KITTY,
+	GRAPHICS_SIXEL,
+};
+enum graphics_t graphics;
+/* whether the terminal holds the kitty image, for -delta to edit */
+bool graphics_shown;
+/* a frame's pixels in RGB for kitty, or a band's sixels for each color */
+unsigned char *graphics_pixels;
+size_t graphics_pixels_size;
+unsigned char *graphics_packed;
+size_t graphics_packed_size;
+unsigned grid_width;
+unsigned grid_height;
+unsigned cell_columns;
+
+bool clear_screen = true;
+bool delta_enabled;
+bool prev_cells_valid;
+cell_t *cells;
+cell_t *prev_cells;
+cell_t *row_cells;
+/* The cells of each row that may have changed since the last frame, from
+ * dirty_start up to dirty_end, gathered from DG_DirtyRects. The rest still
+ * hold what was sent. */
+unsigned *dirty_start;
+unsigned *dirty_end;
+/* The runs of cells of a row that differ from prev_cells, as the column
+ * each starts at followed by the one after it ends, from DG_DiffRow */
+unsigned *diff_bounds;
+
+/* -hysteresis: with -delta, a small change of a cell, to the next glyph of
+ * grad or a close color, is held back until it has lasted two frames, as
+ * shimmer near a threshold would otherwise flip it every frame. held marks
+ * the cells held back by the last frame, and held_cells lists them, to be
+ * looked at again by the next. */
+#define HYSTERESIS_MARGIN 24
+bool hysteresis;
+uint8_t *held;
+unsigned *held_cells;
+unsigned num_held;
+
+/* -scroll: with -delta, a band of rows that moved up or down as a block
+ * since the last frame is moved on the terminal too, by deleting or
+ * inserting lines in a scroll region from scroll_top to scroll_bottom,
+ * before the cells are diffed against it in its new place. Rows it brings
+ * in are blank on the terminal, which no cell is equal to. */
+#define BLANK_CELL (~(cell_t)0)
+bool scroll_enabled;
+uint64_t *row_hashes; /* of the rows of the cells, then of prev_cells */
+unsigned scroll_top;
+unsigned scroll_bottom;
+int scroll_by; /* rows up, or down when negative, 0 for none */
+
+/* -braillemap: the automap draws its lines as dots, 4x4 to a cell, or 2x4 in
+ * half-block mode, and they are sent as braille patterns */
+bool braille_map;
+bool dots_shown;
+uint8_t *DG_Dots;
+unsigned DG_DotsWidth;
+unsigned DG_DotsHeight;
+int DG_DotsShown;
+
+/* -textoverlay: menus and messages as terminal text, one character for each
+ * column of the grid, shown in the next frame over what is drawn there */
+bool text_overlay;
+bool text_on; /* the cells being built get the text */
+char *DG_Text;
+unsigned DG_TextWidth;
+unsigned DG_TextHeight;
+char *text_shown; /* DG_Text as of the last frame */
+
+/* With -cellgrid, the output is a stream of records for clients that draw
+ * the cells themselves, instead of ANSI text. A record is a type byte and
+ * its length as 32 bits little-endian, then that many bytes:
+ *
+ * 'T' is text the engine printed.
+ * 'F' is a frame: a flags byte (bit 0 delta, bit 1 half-block, bits 2-3
+ * the color mode: 0 for 16, 1 for 256, 2 for truecolor), the width and
+ * height in cells as 16 bits little-endian, the cells, then the status line
+ * as a length byte and its text.
+ *
+ * The cells are row by row, as runs of one op byte: its top two bits are
+ * GRID_SKIP, GRID_REPEAT or GRID_LITERAL, the rest one less than the number
+ * of cells. Skipped cells are unchanged since the last frame, and only come
+ * in delta frames. A repeat is followed by one cell value for the whole
+ * run, a literal by a value for each of its cells. A value is the color class and
+ * the glyph, an index into " .-+1x@", or in half-block mode the classes of
+ * the top and bottom pixels: one byte of two nibbles in 16-color mode, a
+ * byte each in 256-color mode, and 0xRRGGBB then the glyph or 0xRRGGBB in
+ * truecolor mode. */
+#define GRID_RECORD_HEADER 5u
+#define GRID_SKIP 0x00u
+#define GRID_REPEAT 0x40u
+#define GRID_LITERAL 0x80u
+#define GRID_RUN_MAX 64u
+
+bool cell_grid;
+uint8_t grid_glyphs[256]; /* glyph index of each character of grad */
+
+#ifdef CMAP256
+#define PIXEL_INDEX(pixel_) (pixel_)
+#else
+/* cmap_to_fb stores the palette index in the alpha channel */
+#define PIXEL_INDEX(pixel_) ((pixel_) >> 24)
+#endif
+
+/* Shown on the line below the frame when not empty */
+#define STATUS_TEXT_LEN 128
+char status_text[STATUS_TEXT_LEN];
+bool status_changed; /* since it was last written */
+
+/* Frames are encoded into a buffer that starts at OUTPUT_BUFFER_START and
+ * grows as a row might not fit, rather than one sized for every pixel
+ * taking the longest SGR code, so that it stays as small as the frames
+ * actually are and the encoder writes to memory that is already cached */
+#define OUTPUT_BUFFER_START 16384u
+char *output_buffer;
+size_t output_buffer_size;
+/* What the frame being encoded is written to, output_buffer or a viewport's */
+char **encode_buffer = &output_buffer;
+size_t *encode_buffer_size = &output_buffer_size;
+size_t row_bytes; /* the most a row of cells can take */
+/* With -hugepages, as the zone is, the buffers written every frame are
+ * faulted in when they are allocated rather than during the first frames */
+bool prefault_buffers;
+/* With -lowmem, the buffers are sized for the color mode rather than for
+ * truecolor, and what they take is printed */
+bool low_mem;
+struct timespec ts_init;
+#ifdef OS_WINDOWS
+HANDLE output_handle;
+/* -consolecells: frames go to the console as a CHAR_INFO for each character,
+ * its glyph and attributes, through WriteConsoleOutputW, instead of as escape
+ * sequences for the console to parse. console_chars mirrors the console from
+ * console_origin, the grid then the status line, so that the dirty cells are
+ * written as one rectangle. */
+bool console_cells;
+CHAR_INFO *console_chars;
+COORD console_origin;
+#endif
+
+/* Key events in the order they happened, 0x100 | key for presses */
+uint16_t key_queue[KEY_QUEUE_LEN];
+unsigned key_queue_head, key_queue_tail;
+
+/* Terminals only send keys as they are pressed and repeated, so a key is
+ * taken as released once it hasn't come for key_delay_us after it was
+ * pressed, or key_repeat_us once it has started repeating */
+struct key_state_t {
+	uint64_t last_seen[256];
+	unsigned char held[256];
+	unsigned char repeating[256];
+};
+
+struct key_state_t terminal_keys;
+uint64_t key_delay_us = 300000;
+uint64_t key_repeat_us = 100000;
+
+/* Cleared once stdin is closed, so it isn't read or polled again */
+int input_open;
+int input_fd = STDIN_FILENO;
+#ifdef OS_WINDOWS
+DWORD saved_input_mode;
+#else
+struct termios saved_termios;
+#endif
+
+#ifndef OS_WINDOWS
+/* With -spectate <port>, every frame sent to the terminal is also sent to
+ * whoever connects to the port. A frame is copied once into a ring that an
+ * I/O thread sends from, so encoding costs the same for any number of
+ * spectators. Every keyframe_interval frames a full frame is sent, which is
+ * where spectators that join late or fall behind the ring pick up. */
+#define SPECTATE_FRAMES 64u
+#define SPECTATE_MAX 256u
+
+struct spectate_frame_t {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+struct spectator_t {
+	int fd;
+	uint64_t seq; /* frame being sent */
+	size_t offset; /* bytes of it sent */
+	bool synced; /* has been sent a keyframe */
+	bool caster; /* connected from this host, may start replays */
+};
+
+/* With -replay <seconds>, the frames sent to spectators in the last seconds
+ * are kept as they were encoded. A caster, a spectator connected from this
+ * host, types r to send them to every spectator again at the pace they were
+ * sent, or s at half of it, then the game carries on from a keyframe. Nothing
+ * is drawn or encoded again for it. */
+#define REPLAY_FPS 70u
+#define REPLAY_MAX_SECONDS 600
+
+struct replay_frame_t {
+	char *data;
+	size_t len;
+	size_t size;
+	uint32_t ms; /* when it was sent */
+	bool keyframe;
+};
+
+enum replay_request_t { REPLAY_NONE, REPLAY_NORMAL, REPLAY_SLOW };
+
+/* Owned by the thread that encodes the frames */
+unsigned replay_seconds;
+struct replay_frame_t *replay_frames;
+unsigned replay_capacity;
+uint64_t replay_head; /* frames kept */
+uint64_t replay_tail; /* the first one a replay may start from */
+bool replaying;
+uint64_t replay_next; /* frame to send next, while replaying */
+uint64_t replay_end;
+uint32_t replay_start_ms;
+uint32_t replay_first_ms;
+unsigned replay_slowdown;
+bool replay_need_key; /* the game carries on from a keyframe */
+
+bool spectate_enabled;
+unsigned keyframe_interval = 35;
+uint64_t last_keyframe;
+
+/* Shared with the I/O thread under spectate_lock */
+pthread_mutex_t spectate_lock = PTHREAD_MUTEX_INITIALIZER;
+struct spectate_frame_t spectate_frames[SPECTATE_FRAMES];
+uint64_t spectate_head; /* frames put in the ring */
+uint64_t spectate_keyframe; /* latest keyframe, if spectate_have_key */
+bool spectate_have_key;
+uint64_t spectate_restart; /* first frame after a replay started or ended */
+enum replay_request_t replay_request;
+
+/* Owned by the I/O thread */
+int spectate_listener;
+int spectate_wake[2];
+struct spectator_t spectators[SPECTATE_MAX];
+unsigned num_spectators;
+
+int listenOn(const char *port, const char *option);
+void initSpectate(const char *port);
+void spectateFrame(const char *buf, size_t len, bool keyframe);
+
+/* With -coop <port>, players on other terminals join the game from the
+ * port. The engine runs the game once and draws each of their views in
+ * turn after its own frame; these are encoded like the terminal's, delta
+ * and all, and dropped while a player's connection is still taking the
+ * last one. Their keys are read as the terminal's are. */
+#define VIEWPORT_MAX 3u
+
+struct viewport_t {
+	int fd;
+	char *buffer;
+	size_t buffer_size;
+	const char *pending;
+	size_t pending_len;
+	cell_t *prev_cells;
+	bool prev_cells_valid;
+	bool clear_screen;
+	uint32_t last_frame_ms;
+	struct key_state_t keys;
+};
+
+int viewport_listener = -1;
+struct viewport_t viewports[VIEWPORT_MAX];
+unsigned num_viewports;
+
+/* With -udp <port>, the -cellgrid records go to a single client over UDP,
+ * where a lost datagram costs its own frame rather than holding up every
+ * frame after it. The session waits for the client's first datagram and
+ * only talks to where that came from. A frame is sent in datagrams of up
+ * to UDP_PAYLOAD bytes of its 'F' record, each after a UDP_HEADER of
+ * fields 32 or 16 bits little-endian:
+ *
+ * the frame's number, the number of the frame it is a delta against or
+ * UDP_NO_FRAME for a keyframe, the bytes of input received so far, the
+ * index of the part and the number of parts.
+ *
+ * A delta is against the newest frame the client has acknowledged, which
+ * it keeps until it acknowledges a newer one. The last UDP_HISTORY frames
+ * sent are kept here to be that base; before the first ack, or once it is
+ * older than those, frames are keyframes. The client's datagrams are the
+ * number of the newest frame it drew in whole or UDP_NO_FRAME, the offset
+ * in its input of the bytes that follow, then every byte it typed that the
+ * frames don't yet count as received, so that keys outlive lost datagrams.
+ * A client that hasn't been heard from for UDP_TIMEOUT_MS is gone. */
+#define UDP_PAYLOAD 1200u
+#define UDP_HEADER 16u
+#define UDP_HISTORY 32u
+#define UDP_NO_FRAME 0xFFFFFFFFu
+#define UDP_TIMEOUT_MS 30000u
+
+bool udp_enabled;
+int udp_fd = -1;
+uint32_t udp_frame; /* the number of the next frame */
+uint32_t udp_acked = UDP_NO_FRAME;
+uint32_t udp_input; /* bytes of input received */
+uint32_t udp_heard_ms;
+/* UDP_HISTORY grids, frame n in slot n % UDP_HISTORY */
+cell_t *udp_history;
+uint32_t udp_history_frame[UDP_HISTORY];
+
+void initUdp(const char *port);
+void allocUdpHistory(void);
+void readUdp(void);
+const cell_t *udpBase(void);
+void sendUdpFrame(const char *record, size_t len, const cell_t *base);
+#endif
+
+#ifndef OS_WINDOWS
+/* With -pipeline, each frame is encoded and written on a thread of its own
+ * while the engine runs the next tics and renders the next frame. The
+ * pixels, dots and palette of the frame are taken at the hand-over, and
+ * the game thread waits for the frame to be done before touching anything
+ * else the encoder uses, so only one frame is ever in flight. */
+bool pipeline_enabled;
+pthread_t pipeline_thread;
+
+/* Shared with the encoder thread under pipeline_lock */
+pthread_mutex_t pipeline_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pipeline_cond = PTHREAD_COND_INITIALIZER;
+bool pipeline_busy; /* a frame was handed over and isn't done */
+
+/* Copies of the engine's buffers for the frame in flight */
+pixel_t *pipeline_screen;
+size_t pipeline_screen_size;
+uint8_t *pipeline_dots;
+size_t pipeline_dots_size;
+
+/* The palette set since the hand-over, for the next frame */
+uint32_t pipeline_palette[256];
+bool pipeline_palette_set;
+
+/* The engine's counters aren't thread safe, so the encoder thread's are
+ * kept here and passed on once the game thread has waited for it */
+uint64_t pipeline_bytes;
+int pipeline_frame_bytes;
+bool pipeline_encoded;
+bool pipeline_written;
+
+void pipelineWait(void);
+
+/* With -outputthread, the writes are left to a thread of their own, so that
+ * a client that stops reading never holds up the game. What is to be
+ * written is copied into a queue of chunks, in order. At most one frame
+ * waits behind the one being written: a full frame replaces it, and with
+ * -delta or compression, where frames build on the last, new frames are
+ * dropped before they are encoded until it has gone, as they would be for
+ * a full terminal. The engine's messages are captured and queued before
+ * each frame. */
+struct out_chunk_t {
+	struct out_chunk_t *next;
+	size_t len;
+	bool frame;
+	bool standalone; /* a frame that doesn't build on the last */
+	size_t cast_len; /* -asciicast text after the data */
+	unsigned cast_cols, cast_rows;
+	char data[];
+};
+
+bool writer_enabled;
+
+/* Shared with the writer thread under writer_lock */
+pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+struct out_chunk_t *writer_head, *writer_tail;
+unsigned writer_frames_waiting;
+bool writer_busy; /* a chunk is being written */
+uint64_t writer_queued; /* bytes not yet written */
+uint64_t writer_written; /* since the game thread last took the counts */
+unsigned writer_frames_written;
+
+bool frame_standalone; /* of the frame being written */
+
+void writerQueue(const char *buf, size_t len, bool frame);
+bool writerReady(void);
+void writerDrain(void);
+#endif
+
+/* With -asciicast <file>, the frames are recorded to file as they go out,
+ * as an asciicast v2 recording: an output event for each frame, timed from
+ * the start, and a resize event when the frame changes size. It is the
+ * frames' own text, before any compression or WebSocket framing, so it
+ * costs no more than escaping it for JSON into a buffered file. With
+ * -outputthread, the text goes with the frame's chunk and is recorded by
+ * the writer thread once the frame has been written, so that a frame
+ * replaced in the queue is left out as it was never seen. */
+FILE *cast_file;
+uint64_t cast_start_us;
+unsigned cast_cols, cast_rows; /* 0 until the header is written */
+char *cast_buffer;
+size_t cast_buffer_size;
+#ifndef OS_WINDOWS
+const char *cast_text; /* of the frame being queued */
+size_t cast_len;
+#endif
+
+void initCast(const char *path);
+void castFrame(const char *buf, size_t len);
+void writeCast(const char *buf, size_t len, unsigned cols, unsigned rows);
+
+#ifndef OS_WINDOWS
+/* Telnet commands are stripped from the input once we have sent one */
+#define TELNET_SE 240u
+#define TELNET_SB 250u
+#define TELNET_WILL 251u
+#define TELNET_DO 253u
+#define TELNET_IAC 255u
+#define TELNET_NAWS 31u
+#define TELNET_COMPRESS2 86u
+#define TELNET_SUBNEG_LEN 16u
+
+enum telnet_state_t {
+	TELNET_DATA,
+	TELNET_COMMAND, /* after IAC */
+	TELNET_OPTION, /* after IAC WILL, WONT, DO or DONT */
+	TELNET_SUBNEG, /* between IAC SB and IAC SE */
+	TELNET_SUBNEG_IAC,
+};
+
+bool telnet_enabled;
+
+/* Telnet commands may be split across reads */
+enum telnet_state_t telnet_state;
+unsigned char telnet_command;
+unsigned char telnet_subneg[TELNET_SUBNEG_LEN];
+unsigned telnet_subneg_len;
+
+size_t readTelnet(char *buf, size_t len);
+
+/* With -websocket, the terminal is a WebSocket connection, as from a
+ * browser through -server. After the HTTP handshake, each frame goes out
+ * as one binary message and the engine's messages as text messages. Keys
+ * come in messages of either kind, as a terminal would send them. */
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_HEADER_MAX 10u
+#define WS_HANDSHAKE_LEN 4096u
+#define WS_TEXT 0x1u
+#define WS_BINARY 0x2u
+#define WS_CLOSE 0x8u
+
+bool websocket_enabled;
+
+/* Messages may be split across reads */
+unsigned char ws_input[2u * INPUT_BUFFER_LEN];
+size_t ws_input_len;
+
+void acceptWebSocket(void);
+void readWebSocket(const char *buf, size_t len);
+char *frameWebSocket(char *payload, size_t len, unsigned opcode);
+void sendEngineOutput(void);
+
+/* Once captured, the engine's stdout is a pipe read before each frame, and
+ * frames go to output_fd */
+int engine_output = -1;
+
+void captureEngineOutput(void);
+
+/* With -autoscale, the window size from the terminal or telnet's NAWS,
+ * 0 while unknown. SIGWINCH has it read again. */
+bool fit_window;
+unsigned window_cols, window_rows;
+volatile sig_atomic_t window_changed;
+#endif
+
+#ifdef HAVE_ZLIB
+/* With -compress <level>, output is deflated once the client agrees to
+ * telnet's MCCP2, and flushed at the end of each frame so that it is shown
+ * at once. The engine's stdout is then a pipe that is deflated into the
+ * stream before each frame, as its messages can't be written raw anymore. */
+int compress_level; /* 0 without -compress */
+bool compress_active;
+z_stream compress_stream;
+unsigned char *compress_buffer;
+size_t compress_buffer_size;
+
+void startCompression(void);
+void compressOutput(const char *buf, size_t len, int flush);
+void compressEngineOutput(void);
+#endif
+
+void initClassSgr(void);
+bool onEncoder(void);
+void applyPalette(const uint32_t *palette);
+void markAllDirty(void);
+void allocDots(void);
+void allocText(void);
+void printMemory(void);
+void writeOutput(const char *buf, size_t len, bool blocking);
+void writeFrame(const char *buf, size_t len);
+void finishOutput(void);
+void flushOutput(void);
+#ifndef OS_WINDOWS
+void initPipeline(void);
+void initWriter(void);
+#endif
+
+/* The terminal is put in raw mode once, and back as it was on exit */
+void restoreTerminal(void)
+{
+#ifdef OS_WINDOWS
+	SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), saved_input_mode);
+#else
+	tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+#endif
+}
+
+char convertToDoomKey(char **buf);
+
+void queueKey(uint16_t event)
+{
+	/* a full queue drops the newest, which only happens if nothing is read */
+	if (key_queue_head - key_queue_tail < KEY_QUEUE_LEN)
+		key_queue[key_queue_head++ % KEY_QUEUE_LEN] = event;
+	if (event & 0x0100)
+		M_InputRead();
+}
+
+/* Returns whether the key was let go */
+bool releaseKey(struct key_state_t *keys, unsigned char key, uint64_t now)
+{
+	if (keys->held[key] && now - keys->last_seen[key] > (keys->repeating[key] ? key_repeat_us : key_delay_us)) {
+		keys->held[key] = 0;
+		return true;
+	}
+	return false;
+}
+
+/* Marks each key in buf as held. The terminal's presses are also queued,
+ * as SDL does for key repeat. */
+void pressKeys(struct key_state_t *keys, char *buf, uint64_t now)
+{
+	const bool queue = keys == &terminal_keys;
+
+	while (*buf) {
+		const unsigned char key = convertToDoomKey(&buf);
+
+		/* came back after being let go */
+		if (releaseKey(keys, key, now) && queue)
+			queueKey(key);
+
+		keys->repeating[key] = keys->held[key];
+		keys->held[key] = 1;
+		keys->last_seen[key] = now;
+		if (queue)
+			queueKey(0x0100 | key);
+	}
+}
+
+#ifndef OS_WINDOWS
+void windowChanged(int sig)
+{
+	(void)sig;
+	window_changed = 1;
+}
+
+void readWindowSize(void)
+{
+	struct winsize ws;
+
+	window_changed = 0;
+	if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)) {
+		window_cols = ws.ws_col;
+		window_rows = ws.ws_row;
+	}
+}
+
+/* Handles IAC SB ... IAC SE */
+void endSubnegotiation(void)
+{
+	/* NAWS: width and height, 16 bits each */
+	if (telnet_subneg_len == 5u && telnet_subneg[0] == TELNET_NAWS && fit_window) {
+		window_cols = telnet_subneg[1] << 8 | telnet_subneg[2];
+		window_rows = telnet_subneg[3] << 8 | telnet_subneg[4];
+	}
+}
+
+/* Strips telnet commands from the input, acting on the options we asked
+ * for. Returns the length left. */
+size_t readTelnet(char *buf, size_t len)
+{
+	size_t i, kept = 0;
+
+	for (i = 0; i < len; i++) {
+		const unsigned char c = buf[i];
+
+		switch (telnet_state) {
+		case TELNET_DATA:
+			if (c == TELNET_IAC)
+				telnet_state = TELNET_COMMAND;
+			else if (c)
+				buf[kept++] = c;
+			break;
+		case TELNET_COMMAND:
+			if (c == TELNET_SB) {
+				telnet_subneg_len = 0;
+				telnet_state = TELNET_SUBNEG;
+			} else if (c >= TELNET_WILL && c != TELNET_IAC) {
+				telnet_command = c;
+				telnet_state = TELNET_OPTION;
+			} else {
+				telnet_state = TELNET_DATA;
+			}
+			break;
+		case TELNET_OPTION:
+#ifdef HAVE_ZLIB
+			if (telnet_command == TELNET_DO && c == TELNET_COMPRESS2 && compress_level && !compress_active)
+				startCompression();
+#endif
+			telnet_state = TELNET_DATA;
+			break;
+		case TELNET_SUBNEG:
+			if (c == TELNET_IAC)
+				telnet_state = TELNET_SUBNEG_IAC;
+			else if (telnet_subneg_len < TELNET_SUBNEG_LEN)
+				telnet_subneg[telnet_subneg_len++] = c;
+			break;
+		case TELNET_SUBNEG_IAC:
+			if (c == TELNET_SE) {
+				endSubnegotiation();
+				telnet_state = TELNET_DATA;
+			} else {
+				/* IAC IAC is a 255 in the data */
+				if (c == TELNET_IAC && telnet_subneg_len < TELNET_SUBNEG_LEN)
+					telnet_subneg[telnet_subneg_len++] = c;
+				telnet_state = TELNET_SUBNEG;
+			}
+			break;
+		}
+	}
+	return kept;
+}
+
+#endif
+
+void readInput(void)
+{
+#ifndef OS_WINDOWS
+	if (udp_enabled) {
+		readUdp();
+		return;
+	}
+	char raw_input[INPUT_BUFFER_LEN];
+	const cpukind_t kind = D_CpuPhase(CPU_IO);
+	const ssize_t count = read(STDIN_FILENO, raw_input, INPUT_BUFFER_LEN - 1u);
+	D_CpuPhase(kind);
+	if (count > 0 && websocket_enabled) {
+		readWebSocket(raw_input, count);
+	} else if (count > 0) {
+		raw_input[telnet_enabled ? readTelnet(raw_input, count) : (size_t)count] = '\0';
+		pressKeys(&terminal_keys, raw_input, DG_GetTicksUs());
+	} else if (count == 0 || (errno != EAGAIN && errno != EINTR)) {
+		input_open = 0;
+	}
+#endif
+}
+
+/* Touches each page of a buffer, so that it is mapped before the first frame */
+void prefault(void *buf, size_t size)
+{
+	volatile char *p = buf;
+	size_t i;
+
+	for (i = 0; i < size; i += 4096)
+		p[i] = p[i];
+}
+
+/* After the rows: the status line, \033[0m\033[RRRRR;1H + text + \033[K
+ * (length 18 + text), the SGR clear codes, and the SGR_PARAM_MAX_LEN bytes
+ * the last SGR parameters are copied with */
+#define FRAME_TAIL_LEN (STATUS_TEXT_LEN + 18u + 8u + SGR_PARAM_MAX_LEN)
+/* Before the rows: the WebSocket message header (length 10), screen clear
+ * and cursor home and bold, \033[1;1H\033[2J\033[;H\033[1m (length 18) */
+#define FRAME_HEAD_LEN (10u + 18u)
+
+/* Makes room for bytes more at buf in encode_buffer, and returns where buf
+ * is after the buffer moved */
+char *growOutput(char *buf, size_t bytes)
+{
+	const size_t used = buf - *encode_buffer;
+	size_t size = *encode_buffer_size * 2u;
+
+	if (size < used + bytes)
+		size = used + bytes;
+	*encode_buffer = realloc(*encode_buffer, size);
+	CALL(!*encode_buffer, "DG_DrawFrame: realloc error %d");
+	*encode_buffer_size = size;
+	return *encode_buffer + used;
+}
+
+/* Called before each row or run is encoded, with room for the frame's end */
+char *reserveOutput(char *buf, size_t bytes)
+{
+	if ((size_t)(buf - *encode_buffer) + bytes + FRAME_TAIL_LEN <= *encode_buffer_size)
+		return buf;
+	return growOutput(buf, bytes + FRAME_TAIL_LEN);
+}
+
+/* The most a pixel can take in the output, -lowmem's bound being the
+ * SGR code of base_color_mode, which -budget only lowers, and 6 bytes of
+ * glyphs */
+unsigned pixelBytes(void)
+{
+	if (mono)
+		return 6u;
+	if (!low_mem || base_color_mode == COLORS_TRUECOLOR)
+		return 25u;
+	/* 38;5;RRR or 1;37, with \033[ and m */
+	return (base_color_mode == COLORS_256 ? 8u : 4u) + 3u + 6u;
+}
+
+/* Sizes everything after the frame, DOOMGENERIC_RESX x DOOMGENERIC_RESY */
+void allocGrid(void)
+{
+	grid_width = braille_view ? (DOOMGENERIC_RESX + 3u) / 4u : DOOMGENERIC_RESX;
+	grid_height = braille_view ? (DOOMGENERIC_RESY + 3u) / 4u
+		: half_block ? (DOOMGENERIC_RESY + 1u) / 2u : DOOMGENERIC_RESY;
+
+	/* Longest SGR code: \033[38;2;RRR;GGG;BBBm (length 19)
+	 * Maximum 25 bytes per pixel: SGR + 2 x 3 byte braille char
+	 * (half-block: \033[38;2;RRR;GGG;BBB;48;2;RRR;GGG;BBBm + 3 byte char per 2 pixels)
+	 * With -delta, a cursor position \033[RRRRR;CCCCCH (length 14) for the
+	 * first run, and for the others a move no longer than the cells skipped
+	 * 1 Newline character per line
+	 */
+	row_bytes = pixelBytes() * (half_block ? 2u : 1u) * grid_width + 14u + 1u;
+	/* a frame record of -cellgrid is written a run at a time */
+	if (row_bytes < GRID_RUN_MAX * 7u + 1u)
+		row_bytes = GRID_RUN_MAX * 7u + 1u;
+	/* the pending output, if any, went out with DG_Resize */
+	output_buffer_size = FRAME_HEAD_LEN + row_bytes + FRAME_TAIL_LEN;
+	if (output_buffer_size < OUTPUT_BUFFER_START)
+		output_buffer_size = OUTPUT_BUFFER_START;
+	output_buffer = realloc(output_buffer, output_buffer_size);
+	if (prefault_buffers)
+		prefault(output_buffer, output_buffer_size);
+	free(cells);
+	cells = calloc(grid_width * grid_height, sizeof(*cells));
+	if (half_block)
+		row_cells = realloc(row_cells, grid_width * sizeof(*row_cells));
+	dirty_start = realloc(dirty_start, grid_height * sizeof(*dirty_start));
+	dirty_end = realloc(dirty_end, grid_height * sizeof(*dirty_end));
+	if (prefault_buffers)
+		prefault(cells, grid_width * grid_height * sizeof(*cells));
+	markAllDirty();
+	if (braille_map)
+		allocDots();
+	if (text_overlay)
+		allocText();
+	if (delta_enabled) {
+		free(prev_cells);
+		prev_cells = calloc(grid_width * grid_height, sizeof(*cells));
+		prev_cells_valid = false;
+		if (prefault_buffers)
+			prefault(prev_cells, grid_width * grid_height * sizeof(*cells));
+		/* cells changing every other one leave a run per two */
+		diff_bounds = realloc(diff_bounds, (grid_width + 2u) * sizeof(*diff_bounds));
+	}
+#ifdef OS_WINDOWS
+	if (console_cells)
+		console_chars = realloc(console_chars, grid_width * cell_columns * (grid_height + 1u) * sizeof(*console_chars));
+#endif
+	if (hysteresis) {
+		free(held);
+		held = calloc(grid_width * grid_height, sizeof(*held));
+		held_cells = realloc(held_cells, grid_width * grid_height * sizeof(*held_cells));
+		num_held = 0;
+	}
+	if (scroll_enabled)
+		row_hashes = realloc(row_hashes, 2u * grid_height * sizeof(*row_hashes));
+#ifndef OS_WINDOWS
+	if (udp_enabled)
+		allocUdpHistory();
+#endif
+
+#ifndef OS_WINDOWS
+	/* a frame cut short is painted over by the next one */
+	unsigned i;
+	for (i = 0; i < num_viewports; i++) {
+		struct viewport_t *viewport = &viewports[i];
+
+		viewport->buffer = realloc(viewport->buffer, output_buffer_size);
+		viewport->buffer_size = output_buffer_size;
+		viewport->pending_len = 0;
+		viewport->clear_screen = true;
+		if (delta_enabled) {
+			free(viewport->prev_cells);
+			viewport->prev_cells = calloc(grid_width * grid_height, sizeof(*cells));
+			viewport->prev_cells_valid = false;
+		}
+	}
+#endif
+}
+
+/* -lowmem's breakdown of the buffers a session starts with */
+void printMemory(void)
+{
+	const size_t count = grid_width * grid_height;
+	size_t cell_bytes = count * sizeof(*cells);
+
+	if (delta_enabled)
+		cell_bytes += count * sizeof(*prev_cells);
+	if (hysteresis)
+		cell_bytes += count * (sizeof(*held) + sizeof(*held_cells));
+
+	fprintf(stderr, "DG_Init: memory: frame %u KiB, output %u KiB, cells %u KiB\n",
+		(unsigned)(DOOMGENERIC_RESX * DOOMGENERIC_RESY * sizeof(pixel_t) / 1024u),
+		(unsigned)(output_buffer_size / 1024u), (unsigned)(cell_bytes / 1024u));
+}
+
+void DG_Resize(void)
+{
+#ifndef OS_WINDOWS
+	pipelineWait();
+#endif
+	/* the pending output may be in the old buffer */
+	writeOutput(output_pending, output_pending_len, true);
+	allocGrid();
+	clear_screen = true;
+}
+
+int DG_FitScaling(void)
+{
+	unsigned scaling = base_scaling;
+
+#ifndef OS_WINDOWS
+	if (window_changed)
+		readWindowSize();
+	if (fit_window && window_cols && window_rows) {
+		/* every row ends in a newline, so one more must fit below the frame */
+		for (scaling = 1; scaling < SCREENWIDTH / 8u; scaling++) {
+			const unsigned width = SCREENWIDTH / scaling;
+			const unsigned height = DG_FrameHeight(scaling);
+			if (braille_view ? (width + 3u) / 4u * cell_columns <= window_cols && (height + 3u) / 4u < window_rows
+					 : width * cell_columns <= window_cols && (half_block ? (height + 1u) / 2u : height) < window_rows)
+				break;
+		}
+	}
+#endif
+
+	scaling += extra_scaling;
+	return scaling < SCREENWIDTH / 8u ? scaling : SCREENWIDTH / 8u;
+}
+
+void DG_Init()
+{
+#ifdef OS_WINDOWS
+	if (M_CheckParm("-transcode"))
+		I_Error("DG_Init: -transcode isn't available on Windows");
+
+	const HANDLE hOutputHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+	WINDOWS_CALL(hOutputHandle == INVALID_HANDLE_VALUE, "DG_Init: %s");
+	DWORD mode;
+	WINDOWS_CALL(!GetConsoleMode(hOutputHandle, &mode), "DG_Init: %s");
+	mode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+	WINDOWS_CALL(!SetConsoleMode(hOutputHandle, mode), "DG_Init: %s");
+	output_handle = hOutputHandle;
+
+	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
+	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, "DG_Init: %s");
+	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &saved_input_mode), "DG_Init: %s");
+	mode = saved_input_mode;
+	mode &= ~(ENABLE_MOUSE_INPUT | ENABLE_WINDOW_INPUT | ENABLE_QUICK_EDIT_MODE);
+	/* Disable canonical mode, unless -nodraw leaves the console alone */
+	mode &= ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT);
+	if (!nodrawers) {
+		WINDOWS_CALL(!SetConsoleMode(hInputHandle, mode), "DG_Init: %s");
+		I_AtExit(restoreTerminal, true);
+	}
+#else
+	//!
+	// @arg <file>
+	//
+	// Write the frames to file instead of the terminal, as fast as they
+	// are drawn, with none dropped. For -timedemo, to render a demo
+	// without a terminal.
+	//
+	const int transcode_arg = M_CheckParmWithArgs("-transcode", 1);
+	if (transcode_arg > 0) {
+		CALL((output_fd = open(myargv[transcode_arg + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0,
+			"DG_Init: -transcode: open error %d");
+		transcoding = true;
+	}
+
+	/* Disable canonical mode and echo, and don't wait in read. -nodraw
+	 * leaves the terminal alone. */
+	if (!transcoding && !nodrawers && !tcgetattr(STDIN_FILENO, &saved_termios)) {
+		struct termios raw = saved_termios;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		CALL(tcsetattr(STDIN_FILENO, TCSANOW, &raw), "DG_Init: tcsetattr error %d");
+		I_AtExit(restoreTerminal, true);
+	}
+#endif
+	input_open = !transcoding && !nodrawers;
+
+	const int colors_arg = M_CheckParmWithArgs("-colors", 1);
+	if (colors_arg > 0) {
+		unsigned i;
+		for (i = 0; i < sizeof(color_mode_names) / sizeof(*color_mode_names); i++) {
+			if (!strcmp(myargv[colors_arg + 1], color_mode_names[i]))
+				break;
+		}
+		if (i == sizeof(color_mode_names) / sizeof(*color_mode_names))
+			I_Error("DG_Init: unknown color mode '%s', expected 16, 256 or truecolor", myargv[colors_arg + 1]);
+		color_mode = i;
+	}
+
+	/* render only what is shown, unless asked for the full 320x200 */
+	DG_NativeRender = !M_CheckParm("-fullrender");
+
+	//!
+	// Write frames to the console as cells, each a character and its
+	// colors, instead of as escape sequences, which is much faster on
+	// the Windows console. Frames are drawn in 16 colors.
+	//
+	if (M_CheckParm("-consolecells")) {
+#ifdef OS_WINDOWS
+		console_cells = true;
+		color_mode = COLORS_16;
+#else
+		I_Error("DG_Init: -consolecells is only available on Windows");
+#endif
+	}
+
+	half_block = M_CheckParm("-halfblock") > 0;
+	cell_columns = half_block ? 1u : 2u;
+	delta_enabled = M_CheckParm("-delta") > 0;
+
+	//!
+	// With -delta, move rows that moved up or down as a block on the
+	// terminal, with a scroll region, rather than sending them again.
+	//
+	scroll_enabled = delta_enabled && M_CheckParm("-scroll") > 0;
+
+	//!
+	// Draw in glyphs only, without colors, for monochrome terminals
+	// and the fewest bytes: the shade of each pixel picks one of
+	// sixteen characters. Not with -halfblock or -cellgrid.
+	//
+	mono = M_CheckParm("-mono") > 0;
+	if (mono && half_block)
+		I_Error("DG_Init: -mono draws glyphs, not -halfblock");
+#ifdef OS_WINDOWS
+	if (mono && console_cells)
+		I_Error("DG_Init: -consolecells draws colors, not -mono");
+#endif
+
+	//!
+	// With -mono, dither the shades between two characters of the
+	// gradient in an ordered pattern.
+	//
+	dither = mono && M_CheckParm("-dither") > 0;
+
+	//!
+	// Draw the view in braille dots, a pixel to each of the 2x4 dots
+	// of a character, in one color a character. Not with -halfblock
+	// or -cellgrid.
+	//
+	braille_view = M_CheckParm("-braille") > 0;
+	if (braille_view && half_block)
+		I_Error("DG_Init: -braille draws dots, not -halfblock");
+
+	//!
+	// Send runs of the same character as one and the ECMA-48 REP
+	// sequence, for terminals that support it, such as xterm, VTE
+	// and kitty.
+	//
+	rep_enabled = M_CheckParm("-rep") > 0;
+
+	//!
+	// With -delta, hold back a small change of a cell, to the next
+	// character of the gradient or a close color, until it has lasted
+	// two frames.
+	//
+	hysteresis = delta_enabled && M_CheckParm("-hysteresis") > 0;
+	if (hysteresis) {
+		unsigned i;
+
+		if (mono) {
+			for (i = 0; i < MONO_GRAD_LEN; i++)
+				grid_glyphs[(uint8_t)mono_grad[i]] = i;
+		} else {
+			for (i = GRAD_LEN; i--;)
+				grid_glyphs[(uint8_t)grad[i]] = i;
+		}
+	}
+	prefault_buffers = M_CheckParm("-hugepages") > 0;
+	low_mem = M_CheckParm("-lowmem") > 0;
+	base_color_mode = color_mode;
+	allocGrid();
+	if (low_mem)
+		printMemory();
+
+	initClassSgr();
+	if (!nodrawers)
+		I_AtExit(finishOutput, true);
+
+	//!
+	// @arg <n>
+	//
+	// Send at most n frames per second to the terminal, independent of
+	// the game's tic rate.
+	//
+	const int maxfps_arg = M_CheckParmWithArgs("-maxfps", 1);
+	if (maxfps_arg > 0) {
+		const int maxfps = atoi(myargv[maxfps_arg + 1]);
+		if (maxfps <= 0)
+			I_Error("DG_Init: invalid -maxfps '%s'", myargv[maxfps_arg + 1]);
+		frame_interval_ms = 1000u / (unsigned)maxfps;
+	}
+
+	//!
+	// @arg <bytes>
+	//
+	// Write at most this many bytes per second, lowering the colors,
+	// frame rate and resolution as needed to keep up.
+	//
+	const int budget_arg = M_CheckParmWithArgs("-budget", 1);
+	if (budget_arg > 0) {
+		const long long bytes = atoll(myargv[budget_arg + 1]);
+		if (bytes < 1000)
+			I_Error("DG_Init: invalid -budget '%s', expected at least 1000 bytes", myargv[budget_arg + 1]);
+		budget = bytes;
+		budget_tokens = budget;
+	}
+	base_scaling = SCREENWIDTH / DOOMGENERIC_RESX;
+
+#ifndef OS_WINDOWS
+	CALL((output_flags = fcntl(output_fd, F_GETFL)) < 0, "DG_Init: fcntl error %d");
+	int socket_type;
+	socklen_t socket_type_len = sizeof(socket_type);
+	output_socket = !getsockopt(output_fd, SOL_SOCKET, SO_TYPE, &socket_type, &socket_type_len)
+		&& socket_type == SOCK_STREAM;
+#endif
+
+	//!
+	// Take the terminal to be a WebSocket connection, as from a browser
+	// through -server, and send each frame as one binary message.
+	//
+	if (M_CheckParm("-websocket")) {
+#ifdef OS_WINDOWS
+		I_Error("DG_Init: -websocket isn't available on Windows");
+#else
+		if (transcoding)
+			I_Error("DG_Init: -transcode writes a file, not a -websocket connection");
+		websocket_enabled = true;
+		acceptWebSocket();
+		captureEngineOutput();
+#endif
+	}
+
+	//!
+	// Send frames as compact binary records of the cell grid instead of
+	// ANSI text, for clients that draw the cells themselves.
+	//
+	if (M_CheckParm("-cellgrid")) {
+#ifdef OS_WINDOWS
+		I_Error("DG_Init: -cellgrid isn't available on Windows");
+#else
+		unsigned i;
+
+		if (mono)
+			I_Error("DG_Init: -cellgrid sends colors, not -mono");
+		if (braille_view)
+			I_Error("DG_Init: -cellgrid sends cells, not -braille dots");
+		for (i = GRAD_LEN; i--;)
+			grid_glyphs[(uint8_t)grad[i]] = i;
+		cell_grid = true;
+#endif
+	}
+
+	//!
+	// @arg <port>
+	//
+	// With -cellgrid, wait for a client on the UDP port and send it the
+	// frames as datagrams, each a keyframe or a delta against the last
+	// frame it acknowledged, so that a lost one delays nothing after it.
+	// Keys come in the client's datagrams. Not with -server, -websocket,
+	// -transcode, -outputthread or -pipeline.
+	//
+	const int udp_arg = M_CheckParmWithArgs("-udp", 1);
+	if (udp_arg > 0) {
+#ifdef OS_WINDOWS
+		I_Error("DG_Init: -udp isn't available on Windows");
+#else
+		if (!cell_grid)
+			I_Error("DG_Init: -udp sends -cellgrid records");
+		if (websocket_enabled || transcoding)
+			I_Error("DG_Init: -udp has its own client, not a -websocket or -transcode one");
+		if (M_CheckParm("-outputthread") || M_CheckParm("-pipeline"))
+			I_Error("DG_Init: -udp sends each frame as it is encoded, not with -outputthread or -pipeline");
+		initUdp(myargv[udp_arg + 1]);
+#endif
+	}
+#ifndef OS_WINDOWS
+	/* the engine's messages would land in the middle of records */
+	if (cell_grid && !websocket_enabled && !transcoding && !udp_enabled)
+		captureEngineOutput();
+#endif
+
+	//!
+	// Draw the automap's lines as braille dots, four across and four
+	// down for each cell, or two across in -halfblock mode. Not
+	// with -cellgrid or -braille.
+	//
+	if (M_CheckParm("-braillemap") && !cell_grid && !braille_view) {
+		braille_map = true;
+		allocDots();
+	}
+
+	//!
+	// Send the menus and the messages at the top of the screen as
+	// text, instead of drawing them in the game's fonts. Not with
+	// -cellgrid.
+	//
+	if (M_CheckParm("-textoverlay") && !cell_grid) {
+		text_overlay = true;
+		allocText();
+	}
+
+	//!
+	// @arg <protocol>
+	//
+	// Send frames as images instead of cells, for terminals that draw
+	// them: kitty, in the kitty graphics protocol (kitty, WezTerm,
+	// Ghostty), zlib compressed and with -delta only the box that
+	// changed, or sixel (foot, mlterm, xterm -ti vt340), a whole frame
+	// each time in the palette's colors. Not with -cellgrid, -mono,
+	// -halfblock, -braille, -braillemap or -textoverlay.
+	//
+	const int graphics_arg = M_CheckParmWithArgs("-graphics", 1);
+	if (graphics_arg > 0) {
+#ifdef OS_WINDOWS
+		I_Error("DG_Init: -graphics isn't available on Windows");
+#else
+		if (!strcmp(myargv[graphics_arg + 1], "kitty"))
+			graphics = GRAPHICS_KITTY;
+		else if (!strcmp(myargv[graphics_arg + 1], "sixel"))
+			graphics = GRAPHICS_SIXEL;
+		else
+			I_Error("DG_Init: unknown -graphics '%s', expected kitty or sixel", myargv[graphics_arg + 1]);
+#ifndef CMAP256
+		if (graphics == GRAPHICS_SIXEL)
+			I_Error("DG_Init: -graphics sixel draws palette indices, which need CMAP256");
+#endif
+		if (cell_grid || mono || half_block || braille_view || braille_map || text_overlay)
+			I_Error("DG_Init: -graphics draws the pixels, not -cellgrid, -mono, -halfblock, -braille, -braillemap or -textoverlay");
+#endif
+	}
+
+#ifdef HAVE_ZLIB
+	//!
+	// @arg <level>
+	//
+	// Offer telnet clients to compress the output (MCCP2), at the zlib
+	// level from 1 (fastest) to 9 (smallest).
+	//
+	const int compress_arg = M_CheckParmWithArgs("-compress", 1);
+	if (compress_arg > 0) {
+		static const unsigned char will_compress[] = { TELNET_IAC, TELNET_WILL, TELNET_COMPRESS2 };
+
+		compress_level = atoi(myargv[compress_arg + 1]);
+		if (compress_level < 1 || compress_level > 9)
+			I_Error("DG_Init: invalid -compress '%s'", myargv[compress_arg + 1]);
+		if (websocket_enabled || cell_grid || transcoding)
+			I_Error("DG_Init: -compress is for telnet clients, not -websocket, -cellgrid or -transcode");
+		writeOutput((const char *)will_compress, sizeof(will_compress), true);
+		telnet_enabled = true;
+	}
+#endif
+
+#ifndef OS_WINDOWS
+	/* the engine fits the frame to the window size, from the terminal or
+	 * else asked from the telnet client */
+	fit_window = M_CheckParm("-autoscale") > 0;
+	if (fit_window && (transcoding || udp_enabled))
+		I_Error("DG_Init: -autoscale fits the terminal, not a -transcode file or -udp client");
+	if (fit_window) {
+		static const unsigned char do_naws[] = { TELNET_IAC, TELNET_DO, TELNET_NAWS };
+
+		if (isatty(STDOUT_FILENO)) {
+			readWindowSize();
+			signal(SIGWINCH, windowChanged);
+		} else if (!websocket_enabled && !cell_grid) {
+			writeOutput((const char *)do_naws, sizeof(do_naws), true);
+			telnet_enabled = true;
+		}
+	}
+#endif
+
+	clock_gettime(CLK, &ts_init);
+#ifndef OS_WINDOWS
+	/* the client's first datagram came before the clock started */
+	udp_heard_ms = DG_GetTicksMs();
+#endif
+
+#ifndef OS_WINDOWS
+	//!
+	// @arg <port>
+	//
+	// Also send every frame to whoever connects to the TCP port, to
+	// watch the game.
+	//
+	const int spectate_arg = M_CheckParmWithArgs("-spectate", 1);
+	if (spectate_arg > 0) {
+		//!
+		// @arg <n>
+		//
+		// With -spectate, send a full frame at least every n frames,
+		// for spectators to start from (default 35).
+		//
+		const int keyframes_arg = M_CheckParmWithArgs("-keyframes", 1);
+		if (keyframes_arg > 0 && atoi(myargv[keyframes_arg + 1]) > 0)
+			keyframe_interval = atoi(myargv[keyframes_arg + 1]);
+		/* a late joiner's keyframe must still be in the ring */
+		if (keyframe_interval > SPECTATE_FRAMES / 2u)
+			keyframe_interval = SPECTATE_FRAMES / 2u;
+
+		//!
+		// @arg <seconds>
+		//
+		// With -spectate, keep the last seconds sent to spectators, for
+		// a spectator connected from this host to replay to all of them
+		// by typing r, or s for half speed.
+		//
+		const int replay_arg = M_CheckParmWithArgs("-replay", 1);
+		if (replay_arg > 0) {
+			const int seconds = atoi(myargv[replay_arg + 1]);
+			if (seconds < 1 || seconds > REPLAY_MAX_SECONDS)
+				I_Error("DG_Init: -replay takes 1 to %d seconds", REPLAY_MAX_SECONDS);
+			replay_seconds = seconds;
+			/* past the frame rate, the oldest are let go */
+			replay_capacity = replay_seconds * REPLAY_FPS;
+			replay_frames = calloc(replay_capacity, sizeof(*replay_frames));
+			CALL(!replay_frames, "DG_Init: calloc error %d");
+		}
+		initSpectate(myargv[spectate_arg + 1]);
+	}
+#endif
+
+	//!
+	// @arg <port>
+	//
+	// Let players on other terminals join this game from the TCP
+	// port, each seeing their own player's view. The game waits
+	// for -players to have joined.
+	//
+	const int coop_arg = M_CheckParmWithArgs("-coop", 1);
+	if (coop_arg > 0) {
+#ifdef OS_WINDOWS
+		I_Error("DG_Init: -coop isn't available on Windows");
+#else
+		viewport_listener = listenOn(myargv[coop_arg + 1], "-coop");
+#endif
+	}
+
+	//!
+	// @arg <ms>
+	//
+	// How long a key counts as held after it is pressed, if the
+	// terminal doesn't repeat it. Set it just above the keyboard's
+	// repeat delay.
+	//
+	const int keydelay_arg = M_CheckParmWithArgs("-keydelay", 1);
+	if (keydelay_arg > 0)
+		key_delay_us = atoi(myargv[keydelay_arg + 1]) * 1000ull;
+
+	//!
+	// @arg <ms>
+	//
+	// How long a repeating key counts as held after each repeat. Set
+	// it above the keyboard's repeat interval.
+	//
+	const int keyrepeat_arg = M_CheckParmWithArgs("-keyrepeat", 1);
+	if (keyrepeat_arg > 0)
+		key_repeat_us = atoi(myargv[keyrepeat_arg + 1]) * 1000ull;
+
+	//!
+	// Write the output on a thread of its own, so that a client that
+	// stops reading never holds up the game. Frames that can't be sent
+	// yet replace the one waiting, or are dropped with -delta.
+	//
+	if (M_CheckParm("-outputthread")) {
+#ifdef OS_WINDOWS
+		I_Error("DG_Init: -outputthread isn't available on Windows");
+#else
+		initWriter();
+#endif
+	}
+
+	//!
+	// Encode and write each frame on a thread of its own, while the
+	// game runs the next tics and renders the next frame.
+	//
+	if (M_CheckParm("-pipeline")) {
+#ifdef OS_WINDOWS
+		I_Error("DG_Init: -pipeline isn't available on Windows");
+#else
+		initPipeline();
+#endif
+	}
+
+	//!
+	// @arg <file>
+	//
+	// Record the frames, as they are sent, to file as an asciicast v2
+	// recording, to be played back with asciinema. Not with -cellgrid
+	// or -consolecells.
+	//
+	const int asciicast_arg = M_CheckParmWithArgs("-asciicast", 1);
+	if (asciicast_arg > 0) {
+		if (cell_grid)
+			I_Error("DG_Init: -asciicast records text frames, not -cellgrid");
+#ifdef OS_WINDOWS
+		if (console_cells)
+			I_Error("DG_Init: -asciicast records text frames, not -consolecells");
+#endif
+		initCast(myargv[asciicast_arg + 1]);
+	}
+}
+
+float getHue(int r, int g, int b)
+{
+	float hue;
+
+	// Convert RGB to normalized values
+	float R = (float)r / 255;
+	float G = (float)g / 255;
+	float B = (float)b / 255;
+
+	float max = R > G ? (R > B ? R : B) : (G > B ? G : B);
+	float min = R < G ? (R < B ? R : B) : (G < B ? G : B);
+
+	float delta = max - min;
+
+	// Calculate hue
+	if (delta == 0) {
+		hue = 0;
+	} else if (max == R) {
+		hue = 60 * ((G - B) / delta);
+	} else if (max == G) {
+		hue = 60 * ((B - R) / delta + 2);
+	} else {
+		hue = 60 * ((R - G) / delta + 4);
+	}
+
+	// Make sure hue is in the range [0, 360)
+	hue = hue < 0 ? hue + 360 : hue;
+
+	return hue;
+}
+
+float getBrightness(int r, int g, int b)
+{
+	// Convert RGB to normalized values
+	float R = (float)r / 255;
+	float G = (float)g / 255;
+	float B = (float)b / 255;
+
+	// Calculate maximum value among R, G, and B
+	float max = R > G ? (R > B ? R : B) : (G > B ? G : B);
+
+	return max;
+}
+
+float getSaturation(int r, int g, int b)
+{
+	// Convert RGB to normalized values
+	float R = (float)r / 255;
+	float G = (float)g / 255;
+	float B = (float)b / 255;
+
+	float max = R > G ? (R > B ? R : B) : (G > B ? G : B);
+	float min = R < G ? (R < B ? R : B) : (G < B ? G : B);
+
+	float delta = max - min;
+
+	// Calculate saturation
+	if (max == 0) {
+		return 0;
+	} else {
+		return delta / max;
+	}
+}
+
+char *rgb_to_color(float hue, float sat, float val)
+{
+	if (val > 0.3) {
+		if (sat < 0.5) {
+			return "1;37";
+		}
+		if (hue >= 330 || hue < 30) {
+			return "1;31"; // red
+		} else if (hue >= 30 && hue < 90) {
+			return "1;33"; //yellow
+		} else if (hue >= 90 && hue < 150) {
+			return "1;32"; //green
+		} else if (hue >= 150 && hue < 210) {
+			return "1;36"; //cyan
+		} else if (hue >= 210 && hue < 270) {
+			return "1;34"; //blue
+		} else if (hue >= 270 && hue < 330) {
+			return "1;35"; //magenta
+		}
+	} else {
+		if (sat < 0.5) {
+			return "0;37";
+		}
+		if (hue >= 330 || hue < 30) {
+			return "0;31"; // red
+		} else if (hue >= 30 && hue < 90) {
+			return "0;33"; //yellow
+		} else if (hue >= 90 && hue < 150) {
+			return "0;32"; //green
+		} else if (hue >= 150 && hue < 210) {
+			return "0;36"; //cyan
+		} else if (hue >= 210 && hue < 270) {
+			return "0;34"; //blue
+		} else if (hue >= 270 && hue < 330) {
+			return "0;35"; //magenta
+		}
+	}
+}
+
+/* Nearest entry of the xterm 6x6x6 color cube or grayscale ramp */
+unsigned rgb_to_xterm(int r, int g, int b)
+{
+	static const int cube_levels[6] = { 0, 95, 135, 175, 215, 255 };
+	int ri = r < 48 ? 0 : r < 115 ? 1 : (r - 35) / 40;
+	int gi = g < 48 ? 0 : g < 115 ? 1 : (g - 35) / 40;
+	int bi = b < 48 ? 0 : b < 115 ? 1 : (b - 35) / 40;
+	int cr = cube_levels[ri], cg = cube_levels[gi], cb = cube_levels[bi];
+	int cube_dist = (r - cr) * (r - cr) + (g - cg) * (g - cg) + (b - cb) * (b - cb);
+
+	int gray_index = ((r + g + b) / 3 - 3) / 10;
+	gray_index = gray_index < 0 ? 0 : gray_index > 23 ? 23 : gray_index;
+	int gray = 8 + 10 * gray_index;
+	int gray_dist = (r - gray) * (r - gray) + (g - gray) * (g - gray) + (b - gray) * (b - gray);
+
+	if (gray_dist < cube_dist)
+		return 232u + gray_index;
+	return 16u + 36u * ri + 6u * gi + bi;
+}
+
+void initClassSgr(void)
+{
+	unsigned i;
+
+	switch (color_mode) {
+	case COLORS_16:
+		for (i = 0; i < 16u; i++) {
+			/* bold stands in for bright, except where it would also brighten
+			 * the other half of a half-block */
+			if (half_block)
+				class_fg[i].len = sprintf(class_fg[i].params, "%u", (i >> 3 ? 90u : 30u) + (i & 7u));
+			else
+				class_fg[i].len = sprintf(class_fg[i].params, "%u;3%u", i >> 3, i & 7u);
+			class_bg[i].len = sprintf(class_bg[i].params, "%u", (i >> 3 ? 100u : 40u) + (i & 7u));
+		}
+		break;
+	case COLORS_256:
+		for (i = 0; i < 256u; i++) {
+			class_fg[i].len = sprintf(class_fg[i].params, "38;5;%u", i);
+			class_bg[i].len = sprintf(class_bg[i].params, "48;5;%u", i);
+		}
+		break;
+	case COLORS_TRUECOLOR:
+		break;
+	}
+}
+
+char *writeClassParams(char *buf, uint32_t cls, bool background)
+{
+	if (color_mode == COLORS_TRUECOLOR) {
+		memcpy(buf, background ? "48;2;" : "38;2;", 5);
+		buf += 5;
+		BYTE_TO_TEXT(buf, cls >> 16);
+		*buf++ = ';';
+		BYTE_TO_TEXT(buf, (cls >> 8) & 0xFF);
+		*buf++ = ';';
+		BYTE_TO_TEXT(buf, cls & 0xFF);
+		return buf;
+	}
+
+	const struct sgr_t *sgr = background ? &class_bg[cls] : &class_fg[cls];
+	memcpy(buf, sgr->params, sizeof(sgr->params));
+	return buf + sgr->len;
+}
+
+void DG_SetPalette(const uint32_t *palette)
+{
+#ifndef OS_WINDOWS
+	/* the frame in flight keeps its palette */
+	if (pipeline_enabled) {
+		memcpy(pipeline_palette, palette, sizeof(pipeline_palette));
+		pipeline_palette_set = true;
+		return;
+	}
+#endif
+	applyPalette(palette);
+}
+
+void applyPalette(const uint32_t *palette)
+{
+	const struct color_t *color = (const struct color_t *)palette;
+	struct palette_slot_t *slot;
+	unsigned i;
+
+	/* kept for when -budget changes the color mode */
+	if (palette != current_palette)
+		memcpy(current_palette, palette, sizeof(current_palette));
+
+	for (i = 0; i < PALETTE_SLOTS; i++) {
+		slot = &palette_slots[i];
+		if (slot->valid && !memcmp(slot->colors, palette, sizeof(slot->colors))) {
+			if (slot->cells != palette_cells) {
+				palette_cells = slot->cells;
+				palette_levels = slot->levels;
+				markAllDirty();
+			}
+			return;
+		}
+	}
+
+	slot = &palette_slots[palette_next];
+	palette_next = (palette_next + 1u) % PALETTE_SLOTS;
+	memcpy(slot->colors, palette, sizeof(slot->colors));
+	slot->valid = true;
+	palette_cells = slot->cells;
+	palette_levels = slot->levels;
+
+	for (i = 0; i < 256u; i++, color++) {
+		uint32_t cls = 0;
+		char *acc;
+
+		/* Rec. 601 luma, as the eye weighs the primaries */
+		const unsigned luma = (299u * color->r + 587u * color->g + 114u * color->b) / 1000u;
+
+		palette_levels[i] = luma * (MONO_GRAD_LEN - 1u) * 16u / 255u;
+		if (mono) {
+			palette_cells[i] = CELL(0, mono_grad[(palette_levels[i] + 8u) / 16u]);
+			continue;
+		}
+
+		switch (color_mode) {
+		case COLORS_16:
+			acc = rgb_to_color(getHue(color->r, color->g, color->b),
+				getSaturation(color->r, color->g, color->b),
+				getBrightness(color->r, color->g, color->b));
+			cls = (acc[0] - '0') << 3 | (acc[3] - '0');
+			break;
+		case COLORS_256:
+			cls = rgb_to_xterm(color->r, color->g, color->b);
+			break;
+		case COLORS_TRUECOLOR:
+			cls = color->r << 16 | color->g << 8 | color->b;
+			break;
+		}
+
+		palette_cells[i] = CELL(cls, grad[(color->r + color->g + color->b) * GRAD_LEN / 766u]);
+	}
+
+	markAllDirty();
+}
+
+#ifdef HAVE_AVX2_KERNELS
+/* The table lookups done as gathers, 16 cells per iteration. Returns the
+ * number of cells classified, leaving fewer than 16. */
+AVX2_KERNEL unsigned classifyAVX2(const pixel_t *pixels, cell_t *out, unsigned count)
+{
+	unsigned i = 0;
+
+	for (; i + 16u <= count; i += 16u) {
+		unsigned j;
+#ifdef CMAP256
+		const __m128i index8 = _mm_loadu_si128((const __m128i *)(pixels + i));
+		const __m256i index32[2] = {
+			_mm256_cvtepu8_epi32(index8),
+			_mm256_cvtepu8_epi32(_mm_srli_si128(index8, 8)),
+		};
+#else
+		const __m256i index32[2] = {
+			_mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(pixels + i)), 24),
+			_mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)(pixels + i + 8u)), 24),
+		};
+#endif
+		for (j = 0; j < 2u; j++) {
+			_mm256_storeu_si256((__m256i *)(out + i + 8u * j),
+				_mm256_i32gather_epi64((const long long *)palette_cells, _mm256_castsi256_si128(index32[j]), 8));
+			_mm256_storeu_si256((__m256i *)(out + i + 8u * j + 4u),
+				_mm256_i32gather_epi64((const long long *)palette_cells, _mm256_extracti128_si256(index32[j], 1), 8));
+		}
+	}
+
+	return i;
+}
+#endif
+
+/* Classification kernel: one cell per pixel, kept apart from the branchy
+ * emission pass so that it can be vectorized and timed on its own. Where the
+ * CPU has AVX2 it is done with gathers. SSE2 and NEON have no gather, and the
+ * scalar loop is already a single load per cell. */
+void DG_ClassifyRow(const pixel_t *pixels, cell_t *out, unsigned count)
+{
+	unsigned i = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+	if (simdkernel == KERNEL_AVX2)
+		i = classifyAVX2(pixels, out, count);
+#endif
+
+	for (; i < count; i++)
+		out[i] = palette_cells[PIXEL_INDEX(pixels[i])];
+}
+
+/* As DG_ClassifyRow, for pixels step apart */
+void classifyRowStep(const pixel_t *pixels, unsigned step, cell_t *out, unsigned count)
+{
+	unsigned i;
+
+	if (step == 1u) {
+		DG_ClassifyRow(pixels, out, count);
+		return;
+	}
+	for (i = 0; i < count; i++, pixels += step)
+		out[i] = palette_cells[PIXEL_INDEX(*pixels)];
+}
+
+/* -dither: as classifyRowStep, with each level raised by its cell's
+ * threshold in the Bayer matrix before it is cut to a step of mono_grad */
+void ditherRowStep(const pixel_t *pixels, unsigned step, cell_t *out, unsigned count, unsigned row, unsigned col)
+{
+	static const uint8_t bayer[4][4] = {
+		{ 0, 8, 2, 10 },
+		{ 12, 4, 14, 6 },
+		{ 3, 11, 1, 9 },
+		{ 15, 7, 13, 5 },
+	};
+	const uint8_t *threshold = bayer[row & 3u];
+	unsigned i;
+
+	for (i = 0; i < count; i++, col++, pixels += step)
+		out[i] = CELL(0, mono_grad[(palette_levels[PIXEL_INDEX(*pixels)] + threshold[col & 3u]) / 16u]);
+}
+
+char *writeUnsigned(char *buf, unsigned value)
+{
+	char digits[10];
+	unsigned len = 0;
+
+	do {
+		digits[len++] = '0' + value % 10u;
+		value /= 10u;
+	} while (value);
+
+	while (len)
+		*buf++ = digits[--len];
+	return buf;
+}
+
+/* For when every cell may have changed */
+void markAllDirty(void)
+{
+	unsigned row;
+
+	for (row = 0; row < grid_height; row++) {
+		dirty_start[row] = 0;
+		dirty_end[row] = grid_width;
+	}
+}
+
+/* Widens a row's dirty span to take in start to end */
+void markDirty(unsigned row, unsigned start, unsigned end)
+{
+	if (dirty_start[row] >= dirty_end[row]) {
+		dirty_start[row] = start;
+		dirty_end[row] = end;
+		return;
+	}
+	if (start < dirty_start[row])
+		dirty_start[row] = start;
+	if (end > dirty_end[row])
+		dirty_end[row] = end;
+}
+
+void clearDirty(void)
+{
+	unsigned i;
+
+	memset(dirty_start, 0, grid_height * sizeof(*dirty_start));
+	memset(dirty_end, 0, grid_height * sizeof(*dirty_end));
+
+	/* cells held back by -hysteresis are looked at again */
+	for (i = 0; i < num_held; i++)
+		markDirty(held_cells[i] / grid_width, held_cells[i] % grid_width, held_cells[i] % grid_width + 1u);
+	num_held = 0;
+}
+
+/* Takes DG_DirtyRects into the rows' dirty spans */
+void collectDirtyRects(void)
+{
+	unsigned row, first, last, start, end;
+	int i;
+
+	if (DG_NumDirtyRects < 0) {
+		markAllDirty();
+		DG_NumDirtyRects = 0;
+		return;
+	}
+
+	for (i = 0; i < DG_NumDirtyRects; i++) {
+		const dg_rect_t *rect = &DG_DirtyRects[i];
+
+		if (braille_view) {
+			first = rect->y1 / 4u;
+			last = (rect->y2 + 3u) / 4u;
+			start = rect->x1 / 4u;
+			end = (rect->x2 + 3u) / 4u;
+		} else {
+			first = half_block ? rect->y1 / 2u : rect->y1;
+			last = half_block ? (rect->y2 + 1u) / 2u : rect->y2;
+			start = rect->x1;
+			end = rect->x2;
+		}
+		if (end > grid_width)
+			end = grid_width;
+		if (last > grid_height)
+			last = grid_height;
+
+		for (row = first; row < last; row++)
+			markDirty(row, start, end);
+	}
+
+	DG_NumDirtyRects = 0;
+}
+
+void allocText(void)
+{
+	DG_TextWidth = grid_width * cell_columns;
+	DG_TextHeight = grid_height;
+	free(DG_Text);
+	free(text_shown);
+	DG_Text = calloc(DG_TextWidth * DG_TextHeight, 1);
+	text_shown = calloc(DG_TextWidth * DG_TextHeight, 1);
+}
+
+/* Marks where DG_Text differs from the last frame's, and takes it */
+void collectText(void)
+{
+	unsigned row, first, last;
+
+	for (row = 0; row < DG_TextHeight; row++) {
+		const char *text = DG_Text + row * DG_TextWidth;
+		const char *shown = text_shown + row * DG_TextWidth;
+
+		for (first = 0; first < DG_TextWidth && text[first] == shown[first]; first++)
+			;
+		if (first == DG_TextWidth)
+			continue;
+		for (last = DG_TextWidth; text[last - 1u] == shown[last - 1u]; last--)
+			;
+		markDirty(row, first / cell_columns, (last + cell_columns - 1u) / cell_columns);
+	}
+
+	memcpy(text_shown, DG_Text, DG_TextWidth * DG_TextHeight);
+	memset(DG_Text, 0, DG_TextWidth * DG_TextHeight);
+}
+
+void allocDots(void)
+{
+	DG_DotsWidth = grid_width * (half_block ? 2u : 4u);
+	DG_DotsHeight = grid_height * 4u;
+	free(DG_Dots);
+	DG_Dots = calloc(DG_DotsWidth * DG_DotsHeight, 1);
+}
+
+/* The braille pattern of a block of 2x4 dots, raising index to the highest
+ * palette index among them */
+unsigned brailleDots(const uint8_t *dots, unsigned *index)
+{
+	static const uint8_t bits[4][2] = { { 0x01, 0x08 }, { 0x02, 0x10 }, { 0x04, 0x20 }, { 0x40, 0x80 } };
+	unsigned x, y, pattern = 0;
+
+	for (y = 0; y < 4u; y++, dots += DG_DotsWidth) {
+		for (x = 0; x < 2u; x++) {
+			if (dots[x]) {
+				pattern |= bits[y][x];
+				if (dots[x] > *index)
+					*index = dots[x];
+			}
+		}
+	}
+
+	return pattern;
+}
+
+/* Turns the blank cells of a span with dots on them into braille */
+void buildBrailleCells(unsigned row, unsigned start, unsigned end)
+{
+	const uint8_t *dots = frame_dots + 4u * row * DG_DotsWidth;
+	const cell_t blank = half_block ? HALF_BLOCK_CELL(palette_cells[0], palette_cells[0]) : palette_cells[0];
+	cell_t *out = cells + row * grid_width;
+	unsigned col, index, pattern;
+
+	for (col = start; col < end; col++) {
+		/* what the engine drew over the map, such as messages, stays */
+		if (out[col] != blank)
+			continue;
+
+		index = 0;
+		if (half_block)
+			pattern = brailleDots(dots + 2u * col, &index);
+		else
+			pattern = brailleDots(dots + 4u * col, &index) | brailleDots(dots + 4u * col + 2u, &index) << 8;
+
+		if (pattern)
+			out[col] = BRAILLE_CELL(CELL_CLASS(palette_cells[index]), pattern);
+	}
+}
+
+/* Puts the text over the cells of a span */
+void buildTextCells(unsigned row, unsigned start, unsigned end)
+{
+	const char *text = text_shown + row * DG_TextWidth;
+	const uint32_t cls = CELL_CLASS(palette_cells[TEXT_COLOR]);
+	cell_t *out = cells + row * grid_width;
+	unsigned col;
+
+	for (col = start; col < end; col++) {
+		const char *c = text + col * cell_columns;
+
+		if (half_block ? c[0] : c[0] || c[1])
+			out[col] = TEXT_CELL(cls, c[0], half_block ? 0 : c[1]);
+	}
+}
+
+/* Classifies the dirty spans of frame_pixels into the terminal cell grid */
+/* -braille: the cells of a row from start to end, from 4x4 pixels each */
+void buildBrailleView(unsigned row, unsigned start, unsigned end)
+{
+	/* of a dot's pixel, the first pattern's in the low byte */
+	static const uint16_t bits[4][4] = {
+		{ 0x01, 0x08, 0x0100, 0x0800 },
+		{ 0x02, 0x10, 0x0200, 0x1000 },
+		{ 0x04, 0x20, 0x0400, 0x2000 },
+		{ 0x40, 0x80, 0x4000, 0x8000 },
+	};
+	const unsigned rows = DOOMGENERIC_RESY - 4u * row < 4u ? DOOMGENERIC_RESY - 4u * row : 4u;
+	const uint32_t blank = CELL_CLASS(palette_cells[0]);
+	cell_t *out = cells + row * grid_width;
+	uint32_t cls[16];
+	uint8_t level[16];
+	uint16_t bit[16];
+	unsigned col, x, y, i, j;
+
+	for (col = start; col < end; col++) {
+		const pixel_t *block = frame_pixels + 4u * row * frame_pitch + 4u * col * frame_step;
+		const unsigned cols = DOOMGENERIC_RESX - 4u * col < 4u ? DOOMGENERIC_RESX - 4u * col : 4u;
+		unsigned count = 0, low = 255, high = 0, threshold, dots = 0, best = 0, best_count = 0;
+
+		for (y = 0; y < rows; y++) {
+			for (x = 0; x < cols; x++) {
+				const unsigned index = PIXEL_INDEX(block[y * frame_pitch + x * frame_step]);
+
+				cls[count] = CELL_CLASS(palette_cells[index]);
+				level[count] = palette_levels[index];
+				bit[count] = bits[y][x];
+				if (level[count] < low)
+					low = level[count];
+				if (level[count] > high)
+					high = level[count];
+				count++;
+			}
+		}
+
+		threshold = high - low < BRAILLE_CONTRAST ? BRAILLE_DARK : (low + high) / 2u + 1u;
+		if (threshold < BRAILLE_DARK)
+			threshold = BRAILLE_DARK;
+		for (i = 0; i < count; i++) {
+			unsigned same = 0;
+
+			if (level[i] < threshold)
+				continue;
+			dots |= bit[i];
+			for (j = i; j < count; j++)
+				same += level[j] >= threshold && cls[j] == cls[i];
+			if (same > best_count) {
+				best_count = same;
+				best = cls[i];
+			}
+		}
+
+		out[col] = dots ? BRAILLE_CELL(best, dots) : BRAILLE_CELL(blank, 0);
+	}
+}
+
+void buildCells(void)
+{
+	unsigned row, col;
+
+	for (row = 0; row < grid_height; row++) {
+		const unsigned start = dirty_start[row];
+		const unsigned end = dirty_end[row];
+
+		if (start >= end)
+			continue;
+
+		if (braille_view) {
+			buildBrailleView(row, start, end);
+		} else if (dither) {
+			ditherRowStep(frame_pixels + row * frame_pitch + start * frame_step, frame_step,
+				cells + row * grid_width + start, end - start, row, start);
+		} else if (!half_block) {
+			classifyRowStep(frame_pixels + row * frame_pitch + start * frame_step, frame_step,
+				cells + row * grid_width + start, end - start);
+		} else {
+			const pixel_t *top = frame_pixels + 2u * row * frame_pitch + start * frame_step;
+			cell_t *out = cells + row * grid_width + start;
+
+			classifyRowStep(top, frame_step, out, end - start);
+			/* an odd last pixel row is doubled */
+			if (2u * row + 1u < DOOMGENERIC_RESY)
+				classifyRowStep(top + frame_pitch, frame_step, row_cells, end - start);
+			else
+				memcpy(row_cells, out, (end - start) * sizeof(*row_cells));
+
+			for (col = 0; col < end - start; col++)
+				out[col] = HALF_BLOCK_CELL(out[col], row_cells[col]);
+		}
+
+		if (dots_shown)
+			buildBrailleCells(row, start, end);
+		if (text_on)
+			buildTextCells(row, start, end);
+	}
+}
+
+/* Whether two classes are close enough for -hysteresis to hold back */
+bool closeClasses(uint32_t a, uint32_t b)
+{
+	unsigned shift;
+
+	if (a == b)
+		return true;
+	if (color_mode != COLORS_TRUECOLOR)
+		return false;
+	for (shift = 0; shift < 24u; shift += 8u) {
+		const int diff = (int)(a >> shift & 0xFF) - (int)(b >> shift & 0xFF);
+		if (diff > HYSTERESIS_MARGIN || diff < -HYSTERESIS_MARGIN)
+			return false;
+	}
+	return true;
+}
+
+/* Whether cur is no more than shimmer on prev */
+bool smallChange(cell_t cur, cell_t prev)
+{
+	if (IS_BRAILLE(cur | prev) || IS_TEXT(cur | prev))
+		return false;
+	if (half_block)
+		return closeClasses(HALF_BLOCK_TOP(cur), HALF_BLOCK_TOP(prev))
+			&& closeClasses(HALF_BLOCK_BOTTOM(cur), HALF_BLOCK_BOTTOM(prev));
+
+	const int step = grid_glyphs[(uint8_t)CELL_GLYPH(cur)] - grid_glyphs[(uint8_t)CELL_GLYPH(prev)];
+	return step >= -1 && step <= 1 && closeClasses(CELL_CLASS(cur), CELL_CLASS(prev));
+}
+
+/* -hysteresis: puts back the cells whose small change is new this frame */
+void holdCells(const cell_t *prev)
+{
+	unsigned row, i;
+
+	num_held = 0;
+	for (row = 0; row < grid_height; row++) {
+		const unsigned end = row * grid_width + dirty_end[row];
+
+		for (i = row * grid_width + dirty_start[row]; i < end; i++) {
+			if (cells[i] == prev[i] || held[i] || !smallChange(cells[i], prev[i])) {
+				held[i] = 0;
+				continue;
+			}
+			cells[i] = prev[i];
+			held[i] = 1;
+			held_cells[num_held++] = i;
+		}
+	}
+}
+
+/* Returns the number of cells that differ from the previous frame */
+/* Appends to bounds the columns where the cells from base on go from
+ * unchanged to changed or back, given a mask of count of them with a bit
+ * set for each that changed. in_run is whether the cell before base did. */
+unsigned appendEdges(unsigned *bounds, unsigned n, unsigned base, uint32_t mask, unsigned count, uint32_t *in_run)
+{
+	uint32_t edges = (mask ^ (mask << 1 | *in_run)) & (0xFFFFFFFFu >> (32u - count));
+
+	while (edges) {
+		bounds[n++] = base + __builtin_ctz(edges);
+		edges &= edges - 1u;
+	}
+	*in_run = mask >> (count - 1u) & 1u;
+	return n;
+}
+
+#ifdef HAVE_AVX2_KERNELS
+/* Compares 16 cells at a time, 4 to an instruction, and only looks for the
+ * edges in blocks where some changed. Returns the column reached, leaving
+ * fewer than 16. */
+AVX2_KERNEL unsigned diffRowAVX2(const cell_t *cur, const cell_t *prev, unsigned col, unsigned end,
+	unsigned *bounds, unsigned *n, uint32_t *in_run)
+{
+	for (; col + 16u <= end; col += 16u) {
+		uint32_t same = 0;
+		unsigned j;
+
+		for (j = 0; j < 4u; j++) {
+			const __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(cur + col + 4u * j)),
+				_mm256_loadu_si256((const __m256i *)(prev + col + 4u * j)));
+			same |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << 4u * j;
+		}
+		/* a block that matches throughout, the common case, only has an
+		 * edge if a run ended with the one before */
+		if (same == 0xFFFFu && !*in_run)
+			continue;
+		*n = appendEdges(bounds, *n, col, ~same & 0xFFFFu, 16u, in_run);
+	}
+
+	return col;
+}
+#endif
+
+/* Diff kernel: finds the runs of cells from start up to end of a row that
+ * differ from prev, and leaves their bounds in bounds, which has room for
+ * one more than the cells. Returns the number of bounds, twice the runs. */
+unsigned DG_DiffRow(const cell_t *cur, const cell_t *prev, unsigned start, unsigned end, unsigned *bounds)
+{
+	unsigned col = start, n = 0;
+	uint32_t in_run = 0;
+
+#ifdef HAVE_AVX2_KERNELS
+	if (simdkernel == KERNEL_AVX2)
+		col = diffRowAVX2(cur, prev, col, end, bounds, &n, &in_run);
+#endif
+
+	while (col < end) {
+		const unsigned count = end - col < 16u ? end - col : 16u;
+		uint32_t mask = 0;
+		unsigned j;
+
+		for (j = 0; j < count; j++)
+			mask |= (uint32_t)(cur[col + j] != prev[col + j]) << j;
+		if (mask || in_run)
+			n = appendEdges(bounds, n, col, mask, count, &in_run);
+		col += count;
+	}
+	if (in_run)
+		bounds[n++] = end;
+
+	return n;
+}
+
+/* The cells of the runs DG_DiffRow left in bounds */
+unsigned runCells(const unsigned *bounds, unsigned n)
+{
+	unsigned i, changed = 0;
+
+	for (i = 0; i < n; i += 2u)
+		changed += bounds[i + 1u] - bounds[i];
+	return changed;
+}
+
+unsigned countChangedCells(const cell_t *prev)
+{
+	unsigned row, changed = 0;
+
+	for (row = 0; row < grid_height; row++) {
+		const unsigned n = DG_DiffRow(cells + row * grid_width, prev + row * grid_width,
+			dirty_start[row], dirty_end[row], diff_bounds);
+
+		changed += runCells(diff_bounds, n);
+	}
+
+	return changed;
+}
+
+/* Hash of a row of cells, for -scroll to match rows up */
+uint64_t hashRow(const cell_t *cell)
+{
+	uint64_t hash = 14695981039346656037ull;
+	unsigned i;
+
+	for (i = 0; i < grid_width; i++)
+		hash = (hash ^ cell[i]) * 1099511628211ull;
+	return hash;
+}
+
+/* Cells of a row that differ from what the terminal shows there */
+unsigned rowChanges(const cell_t *cur, const cell_t *shown)
+{
+	return runCells(diff_bounds, DG_DiffRow(cur, shown, 0, grid_width, diff_bounds));
+}
+
+/* -scroll: finds the shift that lines up the most rows of prev with the
+ * cells, other than those already in place. If moving the band they span
+ * leaves at least a row's worth fewer of the changed cells to send, it is
+ * moved in prev as it will be on the terminal and the band marked dirty.
+ * Returns the cells that then changed. */
+unsigned findScroll(cell_t *prev, unsigned changed)
+{
+	const int height = grid_height;
+	uint64_t *const cur_hash = row_hashes;
+	uint64_t *const prev_hash = row_hashes + grid_height;
+	int row, by, best_by = 0, first = 0, last = 0;
+	unsigned best_rows = 0;
+
+	for (row = 0; row < height; row++) {
+		cur_hash[row] = hashRow(cells + row * grid_width);
+		prev_hash[row] = hashRow(prev + row * grid_width);
+	}
+
+	for (by = 1 - height; by < height; by++) {
+		unsigned rows = 0;
+		int from = by > 0 ? 0 : -by, to = by > 0 ? height - by : height;
+
+		if (!by)
+			continue;
+		for (row = from; row < to; row++)
+			rows += cur_hash[row] == prev_hash[row + by] && cur_hash[row] != prev_hash[row];
+		if (rows > best_rows) {
+			best_rows = rows;
+			best_by = by;
+		}
+	}
+	if (!best_by)
+		return changed;
+
+	/* the band runs from the first row lined up to the last, and the
+	 * region takes in the rows they come from */
+	for (first = best_by > 0 ? 0 : -best_by; cur_hash[first] != prev_hash[first + best_by] || cur_hash[first] == prev_hash[first]; first++)
+		;
+	for (last = best_by > 0 ? height - best_by : height; --last > first;) {
+		if (cur_hash[last] == prev_hash[last + best_by] && cur_hash[last] != prev_hash[last])
+			break;
+	}
+	const int top = best_by > 0 ? first : first + best_by;
+	const int bottom = best_by > 0 ? last + best_by : last;
+	unsigned before = 0, after = 0;
+
+	for (row = top; row <= bottom; row++) {
+		const int from = row + best_by;
+
+		before += rowChanges(cells + row * grid_width, prev + row * grid_width);
+		after += from >= top && from <= bottom ? rowChanges(cells + row * grid_width, prev + from * grid_width) : grid_width;
+	}
+	if (after + grid_width > before)
+		return changed;
+
+	if (best_by > 0) {
+		memmove(prev + top * grid_width, prev + (top + best_by) * grid_width,
+			(bottom - top + 1 - best_by) * grid_width * sizeof(*prev));
+		for (row = bottom - best_by + 1; row <= bottom; row++)
+			memset(prev + row * grid_width, 0xFF, grid_width * sizeof(*prev));
+	} else {
+		memmove(prev + (top - best_by) * grid_width, prev + top * grid_width,
+			(bottom - top + 1 + best_by) * grid_width * sizeof(*prev));
+		for (row = top; row < top - best_by; row++)
+			memset(prev + row * grid_width, 0xFF, grid_width * sizeof(*prev));
+	}
+	for (row = top; row <= bottom; row++)
+		markDirty(row, 0, grid_width);
+
+	scroll_top = top;
+	scroll_bottom = bottom;
+	scroll_by = best_by;
+	return changed - before + after;
+}
+
+/* Moves the band found by findScroll on the terminal: DECSTBM, the cursor
+ * to its top, DL or IL, and the whole screen back as the region */
+char *writeScroll(char *buf)
+{
+	*buf++ = '\033';
+	*buf++ = '[';
+	buf = writeUnsigned(buf, scroll_top + 1u);
+	*buf++ = ';';
+	buf = writeUnsigned(buf, scroll_bottom + 1u);
+	*buf++ = 'r';
+	*buf++ = '\033';
+	*buf++ = '[';
+	buf = writeUnsigned(buf, scroll_top + 1u);
+	memcpy(buf, ";1H\033[", 5);
+	buf += 5;
+	buf = writeUnsigned(buf, scroll_by > 0 ? scroll_by : -scroll_by);
+	*buf++ = scroll_by > 0 ? 'M' : 'L';
+	memcpy(buf, "\033[r", 3);
+	return buf + 3;
+}
+
+/* Hash of the whole grid, to tell an unchanged frame without -delta */
+uint64_t hashCells(void)
+{
+	const unsigned count = grid_width * grid_height;
+	uint64_t hash = 14695981039346656037ull;
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		hash = (hash ^ cells[i]) * 1099511628211ull;
+		hash ^= hash >> 29;
+	}
+
+	return hash;
+}
+
+/* Brings prev up to the cells, in the dirty spans */
+void copyDirtyCells(cell_t *prev)
+{
+	unsigned row;
+
+	for (row = 0; row < grid_height; row++) {
+		const unsigned start = dirty_start[row];
+
+		if (start < dirty_end[row])
+			memcpy(prev + row * grid_width + start, cells + row * grid_width + start,
+				(dirty_end[row] - start) * sizeof(*cells));
+	}
+}
+
+/* U+2800 plus the pattern, in UTF-8 */
+char *writeBraille(char *buf, unsigned dots)
+{
+	*buf++ = '\xE2';
+	*buf++ = (char)(0xA0u | dots >> 6);
+	*buf++ = (char)(0x80u | (dots & 0x3Fu));
+	return buf;
+}
+
+/* A text character as written, anything unprintable as a space */
+char textChar(char c)
+{
+	return c >= ' ' && c <= '~' ? c : ' ';
+}
+
+/* How many cells from cell are the same as it, up to count, or 1 without
+ * -rep */
+unsigned runLength(const cell_t *cell, unsigned count)
+{
+	unsigned run = 1;
+
+	if (rep_enabled) {
+		while (run < count && cell[run] == cell[0])
+			run++;
+	}
+	return run;
+}
+
+/* REP, for the character just written to be repeated n times more */
+char *writeRepeat(char *buf, unsigned n)
+{
+	*buf++ = '\033';
+	*buf++ = '[';
+	buf = writeUnsigned(buf, n);
+	*buf++ = 'b';
+	return buf;
+}
+
+char *writeGlyphCells(char *buf, const cell_t *cell, unsigned count, struct sgr_state_t *sgr)
+{
+	while (count--) {
+		const uint32_t cls = IS_BRAILLE(*cell) ? BRAILLE_CLASS(*cell) : IS_TEXT(*cell) ? TEXT_CLASS(*cell) : CELL_CLASS(*cell);
+
+		if (cls != sgr->fg) {
+			sgr->fg = cls;
+			*buf++ = '\033';
+			*buf++ = '[';
+			buf = writeClassParams(buf, sgr->fg, false);
+			*buf++ = 'm';
+		}
+		if (IS_BRAILLE(*cell)) {
+			buf = writeBraille(buf, BRAILLE_DOTS(*cell) & 0xFFu);
+			buf = writeBraille(buf, BRAILLE_DOTS(*cell) >> 8);
+		} else if (IS_TEXT(*cell)) {
+			*buf++ = textChar(TEXT_FIRST(*cell));
+			*buf++ = textChar(TEXT_SECOND(*cell));
+		} else {
+			const unsigned run = runLength(cell, count + 1u);
+
+			*buf++ = CELL_GLYPH(*cell);
+			if (REP_PAYS(1u, 2u * run - 1u)) {
+				buf = writeRepeat(buf, 2u * run - 1u);
+				cell += run - 1u;
+				count -= run - 1u;
+			} else {
+				*buf++ = CELL_GLYPH(*cell);
+			}
+		}
+		cell++;
+	}
+
+	return buf;
+}
+
+/* -mono: two of the glyph for a cell, and nothing to track between them */
+char *writeMonoCells(char *buf, const cell_t *cell, unsigned count)
+{
+	while (count--) {
+		const cell_t c = *cell++;
+
+		if (UNLIKELY(c & (BRAILLE_FLAG | TEXT_FLAG))) {
+			if (IS_BRAILLE(c)) {
+				buf = writeBraille(buf, BRAILLE_DOTS(c) & 0xFFu);
+				buf = writeBraille(buf, BRAILLE_DOTS(c) >> 8);
+			} else {
+				*buf++ = textChar(TEXT_FIRST(c));
+				*buf++ = textChar(TEXT_SECOND(c));
+			}
+			continue;
+		}
+		const unsigned run = runLength(cell - 1, count + 1u);
+
+		*buf++ = CELL_GLYPH(c);
+		if (REP_PAYS(1u, 2u * run - 1u)) {
+			buf = writeRepeat(buf, 2u * run - 1u);
+			cell += run - 1u;
+			count -= run - 1u;
+		} else {
+			*buf++ = CELL_GLYPH(c);
+		}
+	}
+
+	return buf;
+}
+
+char *writeHalfBlockCells(char *buf, const cell_t *cell, unsigned count, struct sgr_state_t *sgr)
+{
+	while (count--) {
+		const bool braille = IS_BRAILLE(*cell);
+		const bool text = IS_TEXT(*cell);
+		const uint32_t top = braille ? BRAILLE_CLASS(*cell) : text ? TEXT_CLASS(*cell) : HALF_BLOCK_TOP(*cell);
+		const uint32_t bottom = braille || text ? CELL_CLASS(palette_cells[0]) : HALF_BLOCK_BOTTOM(*cell);
+		/* a cell of one color is a space, which doesn't care about the foreground */
+		const bool fg_change = (braille || text || top != bottom) && top != sgr->fg;
+		const bool bg_change = bottom != sgr->bg;
+
+		if (fg_change || bg_change) {
+			*buf++ = '\033';
+			*buf++ = '[';
+			if (fg_change) {
+				buf = writeClassParams(buf, top, false);
+				sgr->fg = top;
+			}
+			if (fg_change && bg_change)
+				*buf++ = ';';
+			if (bg_change) {
+				buf = writeClassParams(buf, bottom, true);
+				sgr->bg = bottom;
+			}
+			*buf++ = 'm';
+		}
+
+		if (braille) {
+			buf = writeBraille(buf, BRAILLE_DOTS(*cell));
+		} else if (text) {
+			*buf++ = textChar(TEXT_FIRST(*cell));
+		} else {
+			const unsigned run = runLength(cell, count + 1u);
+
+			if (top == bottom) {
+				*buf++ = ' ';
+			} else {
+				/* U+2580 UPPER HALF BLOCK */
+				*buf++ = '\xE2';
+				*buf++ = '\x96';
+				*buf++ = '\x80';
+			}
+			if (REP_PAYS(top == bottom ? 1u : 3u, run - 1u)) {
+				buf = writeRepeat(buf, run - 1u);
+				cell += run - 1u;
+				count -= run - 1u;
+			}
+		}
+		cell++;
+	}
+
+	return buf;
+}
+
+char *writeCells(char *buf, const cell_t *cell, unsigned count, struct sgr_state_t *sgr)
+{
+	if (mono)
+		return writeMonoCells(buf, cell, count);
+	if (half_block)
+		return writeHalfBlockCells(buf, cell, count, sgr);
+	return writeGlyphCells(buf, cell, count, sgr);
+}
+
+char *encodeFull(char *buf)
+{
+	struct sgr_state_t sgr = { -1, -1 };
+	unsigned row;
+
+	/* move cursor to top left corner and set bold text */
+	memcpy(buf, half_block || mono ? "\033[;H" : "\033[;H\033[1m", 8);
+	buf += half_block || mono ? 4 : 8;
+
+	for (row = 0; row < grid_height; row++) {
+		buf = reserveOutput(buf, row_bytes);
+		buf = writeCells(buf, cells + row * grid_width, grid_width, &sgr);
+		*buf++ = '\n';
+	}
+
+	return buf;
+}
+
+unsigned digitCount(unsigned value)
+{
+	unsigned len = 1;
+
+	while (value >= 10u) {
+		value /= 10u;
+		len++;
+	}
+	return len;
+}
+
+/* A relative move of n, CUU, CUD, CUF, CUB or CNL, with the count left out
+ * when it is 1 */
+unsigned relativeMoveBytes(unsigned n)
+{
+	return n ? n > 1u ? 3u + digitCount(n) : 3u : 0u;
+}
+
+char *writeRelativeMove(char *buf, unsigned n, char final)
+{
+	if (!n)
+		return buf;
+	*buf++ = '\033';
+	*buf++ = '[';
+	if (n > 1u)
+		buf = writeUnsigned(buf, n);
+	*buf++ = final;
+	return buf;
+}
+
+/* CUP, with a 1 row or column left out */
+unsigned absoluteMoveBytes(unsigned row, unsigned col)
+{
+	return 3u + (row ? digitCount(row + 1u) : 0u) + (col ? 1u + digitCount(col + 1u) : 0u);
+}
+
+char *writeAbsoluteMove(char *buf, unsigned row, unsigned col)
+{
+	*buf++ = '\033';
+	*buf++ = '[';
+	if (row)
+		buf = writeUnsigned(buf, row + 1u);
+	if (col) {
+		*buf++ = ';';
+		buf = writeUnsigned(buf, col + 1u);
+	}
+	*buf++ = 'H';
+	return buf;
+}
+
+/* The ways of moving the cursor between cells: CUP, or from a known place,
+ * up or down with CUU or CUD, or to the start of a lower row with CNL,
+ * then along with CUF or CUB, or back to the start with CR */
+enum move_t {
+	MOVE_ABSOLUTE,
+	MOVE_VERTICAL,
+	MOVE_NEXT_LINE,
+	MOVE_RETURN,
+};
+
+/* The fewest bytes that take the cursor to row and column, and how */
+unsigned planMove(const struct cursor_t *cursor, unsigned row, unsigned col, enum move_t *how)
+{
+	unsigned best = absoluteMoveBytes(row, col), bytes;
+
+	*how = MOVE_ABSOLUTE;
+	if (!cursor->known)
+		return best;
+
+	const unsigned vertical = relativeMoveBytes(row > cursor->row ? row - cursor->row : cursor->row - row);
+
+	bytes = vertical + relativeMoveBytes(col > cursor->col ? col - cursor->col : cursor->col - col);
+	if (bytes < best) {
+		best = bytes;
+		*how = MOVE_VERTICAL;
+	}
+	bytes = vertical + 1u + relativeMoveBytes(col);
+	if (bytes < best) {
+		best = bytes;
+		*how = MOVE_RETURN;
+	}
+	if (row > cursor->row) {
+		bytes = relativeMoveBytes(row - cursor->row) + relativeMoveBytes(col);
+		if (bytes < best) {
+			best = bytes;
+			*how = MOVE_NEXT_LINE;
+		}
+	}
+	return best;
+}
+
+char *writeMove(char *buf, struct cursor_t *cursor, unsigned row, unsigned col)
+{
+	enum move_t how;
+
+	planMove(cursor, row, col, &how);
+	switch (how) {
+	case MOVE_ABSOLUTE:
+		buf = writeAbsoluteMove(buf, row, col);
+		break;
+	case MOVE_VERTICAL:
+	case MOVE_RETURN:
+		if (row > cursor->row)
+			buf = writeRelativeMove(buf, row - cursor->row, 'B');
+		else
+			buf = writeRelativeMove(buf, cursor->row - row, 'A');
+		if (how == MOVE_RETURN) {
+			*buf++ = '\r';
+			buf = writeRelativeMove(buf, col, 'C');
+		} else if (col > cursor->col) {
+			buf = writeRelativeMove(buf, col - cursor->col, 'C');
+		} else {
+			buf = writeRelativeMove(buf, cursor->col - col, 'D');
+		}
+		break;
+	case MOVE_NEXT_LINE:
+		buf = writeRelativeMove(buf, row - cursor->row, 'E');
+		buf = writeRelativeMove(buf, col, 'C');
+		break;
+	}
+	cursor->row = row;
+	cursor->col = col;
+	cursor->known = true;
+	return buf;
+}
+
+/* Emits only the runs of cells that changed since prev. The unchanged
+ * cells between two runs of a row are written again where that takes
+ * fewer bytes, in the colors then set, than moving the cursor over them. */
+char *encodeDelta(char *buf, const cell_t *prev_frame)
+{
+	struct sgr_state_t sgr = { -1, -1 };
+	/* scroll regions and the frame before leave it anywhere */
+	struct cursor_t cursor = { 0, 0, false };
+	unsigned row, run, start, end;
+	enum move_t how;
+
+	/* same base attributes as a full frame */
+	if (!half_block && !mono) {
+		memcpy(buf, "\033[1m", 4);
+		buf += 4;
+	}
+
+	for (row = 0; row < grid_height; row++) {
+		const cell_t *cur = cells + row * grid_width;
+		const cell_t *prev = prev_frame + row * grid_width;
+		const unsigned n = DG_DiffRow(cur, prev, dirty_start[row], dirty_end[row], diff_bounds);
+
+		buf = reserveOutput(buf, row_bytes);
+		for (run = 0; run < n; run += 2u) {
+			start = diff_bounds[run];
+			end = diff_bounds[run + 1u];
+
+			/* a cell takes a byte a column at the least, so only a gap
+			 * narrower than the move is worth writing out to compare */
+			if (run) {
+				const unsigned gap = start - cursor.col / cell_columns;
+				const unsigned move = planMove(&cursor, row, start * cell_columns, &how);
+
+				if (gap * cell_columns < move) {
+					char *const gap_start = buf;
+					const struct sgr_state_t gap_sgr = sgr;
+
+					buf = writeCells(buf, cur + start - gap, gap, &sgr);
+					if ((unsigned)(buf - gap_start) > move) {
+						buf = gap_start;
+						sgr = gap_sgr;
+					} else {
+						cursor.col = start * cell_columns;
+					}
+				}
+			}
+			if (!cursor.known || cursor.row != row || cursor.col != start * cell_columns)
+				buf = writeMove(buf, &cursor, row, start * cell_columns);
+
+			buf = writeCells(buf, cur + start, end - start, &sgr);
+			/* at the end of a row, the terminal may be waiting to wrap */
+			cursor.col = end * cell_columns;
+			cursor.known = end < grid_width;
+		}
+	}
+
+	return buf;
+}
+
+/* Writes the status line under the last row, in the default colors */
+char *writeStatus(char *buf, const char *text)
+{
+	const size_t len = strnlen(text, STATUS_TEXT_LEN - 1u);
+
+	if (!mono) {
+		memcpy(buf, "\033[0m", 4);
+		buf += 4;
+	}
+	*buf++ = '\033';
+	*buf++ = '[';
+	buf = writeUnsigned(buf, grid_height + 1u);
+	memcpy(buf, ";1H", 3);
+	buf += 3;
+	memcpy(buf, text, len);
+	buf += len;
+	memcpy(buf, "\033[K", 3);
+	return buf + 3;
+}
+
+char *writeGridHeader(char *buf, char type, size_t len)
+{
+	unsigned i;
+
+	*buf++ = type;
+	for (i = 0; i < 4u; i++)
+		*buf++ = (uint32_t)len >> 8u * i;
+	return buf;
+}
+
+char *writeGridValue(char *buf, cell_t cell)
+{
+	const uint32_t first = half_block ? HALF_BLOCK_TOP(cell) : CELL_CLASS(cell);
+	const uint32_t second = half_block ? HALF_BLOCK_BOTTOM(cell) : grid_glyphs[(uint8_t)CELL_GLYPH(cell)];
+
+	switch (color_mode) {
+	case COLORS_16:
+		*buf++ = first << 4 | second;
+		break;
+	case COLORS_256:
+		*buf++ = first;
+		*buf++ = second;
+		break;
+	case COLORS_TRUECOLOR:
+		*buf++ = first >> 16;
+		*buf++ = first >> 8;
+		*buf++ = first;
+		if (half_block) {
+			*buf++ = second >> 16;
+			*buf++ = second >> 8;
+		}
+		*buf++ = second;
+		break;
+	}
+
+	return buf;
+}
+
+/* Writes the cells as a frame record, skipping those that didn't change
+ * since prev unless it is NULL */
+char *encodeGrid(char *buf, const cell_t *prev)
+{
+	const unsigned count = grid_width * grid_height;
+	const size_t status_len = strnlen(status_text, STATUS_TEXT_LEN - 1u);
+	/* as an offset, the buffer may move */
+	const size_t record = buf - *encode_buffer;
+	unsigned i, j, run;
+
+	buf += GRID_RECORD_HEADER;
+	*buf++ = (prev ? 1u : 0u) | (half_block ? 2u : 0u) | color_mode << 2;
+	*buf++ = grid_width;
+	*buf++ = grid_width >> 8;
+	*buf++ = grid_height;
+	*buf++ = grid_height >> 8;
+
+	for (i = 0; i < count; i += run) {
+		buf = reserveOutput(buf, row_bytes);
+		run = 1;
+		if (prev && cells[i] == prev[i]) {
+			while (i + run < count && run < GRID_RUN_MAX && cells[i + run] == prev[i + run])
+				run++;
+			*buf++ = GRID_SKIP | (run - 1u);
+		} else if (i + 1u < count && cells[i + 1u] == cells[i]) {
+			while (i + run < count && run < GRID_RUN_MAX && cells[i + run] == cells[i])
+				run++;
+			*buf++ = GRID_REPEAT | (run - 1u);
+			buf = writeGridValue(buf, cells[i]);
+		} else {
+			/* up to where a skip or repeat would be shorter */
+			while (i + run < count && run < GRID_RUN_MAX && !(prev && cells[i + run] == prev[i + run])
+				&& !(i + run + 1u < count && cells[i + run + 1u] == cells[i + run]))
+				run++;
+			*buf++ = GRID_LITERAL | (run - 1u);
+			for (j = 0; j < run; j++)
+				buf = writeGridValue(buf, cells[i + j]);
+		}
+	}
+
+	*buf++ = status_len;
+	memcpy(buf, status_text, status_len);
+	buf += status_len;
+
+	writeGridHeader(*encode_buffer + record, 'F', buf - *encode_buffer - record - GRID_RECORD_HEADER);
+	return buf;
+}
+
+#ifdef OS_WINDOWS
+/* Console attributes of a 16-color class: the console has blue in the low
+ * bit where ANSI has red */
+WORD consoleAttributes(uint32_t cls)
+{
+	return (cls & 8u) | (cls & 2u) | (cls & 1u) << 2 | (cls & 4u) >> 2;
+}
+
+/* The console characters of a cell, cell_columns of them */
+void consoleCell(CHAR_INFO *out, cell_t cell)
+{
+	if (half_block) {
+		const bool braille = IS_BRAILLE(cell);
+		const bool text = IS_TEXT(cell);
+		const uint32_t top = braille ? BRAILLE_CLASS(cell) : text ? TEXT_CLASS(cell) : HALF_BLOCK_TOP(cell);
+		const uint32_t bottom = braille || text ? CELL_CLASS(palette_cells[0]) : HALF_BLOCK_BOTTOM(cell);
+
+		out->Attributes = consoleAttributes(top) | consoleAttributes(bottom) << 4;
+		if (braille)
+			out->Char.UnicodeChar = 0x2800 + BRAILLE_DOTS(cell);
+		else if (text)
+			out->Char.UnicodeChar = textChar(TEXT_FIRST(cell));
+		else
+			out->Char.UnicodeChar = top == bottom ? ' ' : 0x2580; /* UPPER HALF BLOCK */
+		return;
+	}
+
+	if (IS_BRAILLE(cell)) {
+		out[0].Attributes = out[1].Attributes = consoleAttributes(BRAILLE_CLASS(cell));
+		out[0].Char.UnicodeChar = 0x2800 + (BRAILLE_DOTS(cell) & 0xFFu);
+		out[1].Char.UnicodeChar = 0x2800 + (BRAILLE_DOTS(cell) >> 8);
+	} else if (IS_TEXT(cell)) {
+		out[0].Attributes = out[1].Attributes = consoleAttributes(TEXT_CLASS(cell));
+		out[0].Char.UnicodeChar = textChar(TEXT_FIRST(cell));
+		out[1].Char.UnicodeChar = textChar(TEXT_SECOND(cell));
+	} else {
+		out[0].Attributes = out[1].Attributes = consoleAttributes(CELL_CLASS(cell));
+		out[0].Char.UnicodeChar = out[1].Char.UnicodeChar = (uint8_t)CELL_GLYPH(cell);
+	}
+}
+
+/* -consolecells: brings console_chars up to the dirty cells, and the status
+ * line if it changed, and writes the rectangle around them in one call.
+ * Returns the bytes of CHAR_INFO written. */
+size_t writeConsoleCells(bool cleared)
+{
+	const unsigned width = grid_width * cell_columns;
+	SMALL_RECT rect = { (SHORT)width, (SHORT)(grid_height + 1u), -1, -1 };
+	unsigned row, col;
+
+	if (cleared) {
+		CONSOLE_SCREEN_BUFFER_INFO info;
+		DWORD written;
+
+		WINDOWS_CALL(!GetConsoleScreenBufferInfo(output_handle, &info), "DG_DrawFrame: %s");
+		console_origin.X = info.srWindow.Left;
+		console_origin.Y = info.srWindow.Top;
+		FillConsoleOutputCharacterW(output_handle, ' ', info.dwSize.X * (info.dwSize.Y - info.srWindow.Top),
+			console_origin, &written);
+		markAllDirty();
+		status_changed = true;
+	}
+
+	for (row = 0; row < grid_height; row++) {
+		const unsigned start = dirty_start[row];
+		const unsigned end = dirty_end[row];
+
+		if (start >= end)
+			continue;
+		for (col = start; col < end; col++)
+			consoleCell(console_chars + row * width + col * cell_columns, cells[row * grid_width + col]);
+		if (rect.Left > (SHORT)(start * cell_columns))
+			rect.Left = start * cell_columns;
+		if (rect.Right < (SHORT)(end * cell_columns - 1u))
+			rect.Right = end * cell_columns - 1u;
+		if (rect.Top > (SHORT)row)
+			rect.Top = row;
+		rect.Bottom = row;
+	}
+
+	if (status_changed) {
+		CHAR_INFO *out = console_chars + grid_height * width;
+		const size_t len = strnlen(status_text, STATUS_TEXT_LEN - 1u);
+
+		for (col = 0; col < width; col++) {
+			out[col].Char.UnicodeChar = col < len ? (uint8_t)status_text[col] : ' ';
+			out[col].Attributes = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+		}
+		rect.Left = 0;
+		rect.Right = width - 1u;
+		if (rect.Top > (SHORT)grid_height)
+			rect.Top = grid_height;
+		rect.Bottom = grid_height;
+		status_changed = false;
+	}
+
+	if (rect.Right < rect.Left)
+		return 0;
+
+	const COORD size = { (SHORT)width, (SHORT)(grid_height + 1u) };
+	const COORD from = { rect.Left, rect.Top };
+	const size_t bytes = (size_t)(rect.Right - rect.Left + 1) * (rect.Bottom - rect.Top + 1) * sizeof(*console_chars);
+	const cpukind_t kind = D_CpuPhase(CPU_IO);
+
+	M_StartStage(STAGE_WRITE);
+	rect.Left += console_origin.X;
+	rect.Right += console_origin.X;
+	rect.Top += console_origin.Y;
+	rect.Bottom += console_origin.Y;
+	WINDOWS_CALL(!WriteConsoleOutputW(output_handle, console_chars, size, from, &rect), "DG_DrawFrame: %s");
+	M_EndStage(STAGE_WRITE);
+	D_CpuPhase(kind);
+
+	budget_tokens -= bytes;
+	adapt_sent += bytes;
+	return bytes;
+}
+#endif
+
+/* Hands the whole frame to the OS at once, so slow terminals never see half
+ * of it. Unless blocking, returns once the terminal stops accepting data and
+ * leaves the rest in output_pending. */
+void writeOutput(const char *buf, size_t len, bool blocking)
+{
+#ifndef OS_WINDOWS
+	/* nothing is dropped from the queue, so it never needs to block */
+	if (writer_enabled) {
+		writerQueue(buf, len, false);
+		output_pending_len = 0;
+		return;
+	}
+#endif
+	const bool counted = !onEncoder();
+	const cpukind_t kind = counted ? D_CpuPhase(CPU_IO) : CPU_IO;
+	const char *const start = buf;
+
+	if (counted)
+		M_StartStage(STAGE_WRITE);
+#ifdef OS_WINDOWS
+	/* console writes can't be made non-blocking, so only -maxfps paces them */
+	(void)blocking;
+	while (len) {
+		DWORD written;
+		WINDOWS_CALL(!WriteConsoleA(output_handle, buf, len, &written, NULL), "DG_DrawFrame: %s");
+		buf += written;
+		len -= written;
+		budget_tokens -= written;
+		adapt_sent += written;
+	}
+#else
+	/* O_NONBLOCK is set only around our own writes, as the file description
+	 * is usually shared with stdin and the engine's stdio */
+	if (!blocking && !output_socket)
+		CALL(fcntl(output_fd, F_SETFL, output_flags | O_NONBLOCK) < 0, "DG_DrawFrame: fcntl error %d");
+	while (len) {
+		const ssize_t written = output_socket ? send(output_fd, buf, len, blocking ? 0 : MSG_DONTWAIT)
+			: write(output_fd, buf, len);
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			CALL(errno != EINTR, "DG_DrawFrame: write error %d");
+			continue;
+		}
+		buf += written;
+		len -= written;
+		budget_tokens -= written;
+		adapt_sent += written;
+	}
+	if (!blocking && !output_socket)
+		CALL(fcntl(output_fd, F_SETFL, output_flags) < 0, "DG_DrawFrame: fcntl error %d");
+#endif
+
+	output_pending = buf;
+	output_pending_len = len;
+	if (!counted) {
+#ifndef OS_WINDOWS
+		pipeline_bytes += buf - start;
+#endif
+		return;
+	}
+	D_SessionCount(STAT_BYTES, buf - start);
+	M_EndStage(STAGE_WRITE);
+	D_CpuPhase(kind);
+}
+
+/* Writes what's left of a frame, and notes when it has all gone out */
+void writeFrame(const char *buf, size_t len)
+{
+#ifndef OS_WINDOWS
+	if (writer_enabled) {
+		writerQueue(buf, len, true);
+		return;
+	}
+#endif
+	writeOutput(buf, len, false);
+	if (!output_pending_len) {
+#ifndef OS_WINDOWS
+		if (onEncoder()) {
+			pipeline_written = true;
+			return;
+		}
+#endif
+		M_FrameWritten();
+	}
+}
+
+/* Applies adapt_levels[level], returns whether that changed anything */
+bool setAdaptLevel(unsigned level)
+{
+	const struct adapt_level_t *settings = &adapt_levels[level];
+	const enum color_mode_t colors = base_color_mode < settings->max_colors ? base_color_mode : settings->max_colors;
+	const uint32_t interval_ms = settings->max_fps ? 1000u / settings->max_fps : 0;
+	bool changed = false;
+	unsigned i;
+
+	adapt_level = level;
+
+	if (colors != color_mode) {
+		color_mode = colors;
+		initClassSgr();
+		for (i = 0; i < PALETTE_SLOTS; i++)
+			palette_slots[i].valid = false;
+		applyPalette(current_palette);
+		/* cells of the old mode mean other colors */
+		prev_cells_valid = false;
+		changed = true;
+	}
+	if (interval_ms != adapt_interval_ms && (interval_ms > frame_interval_ms || adapt_interval_ms > frame_interval_ms))
+		changed = true;
+	adapt_interval_ms = interval_ms;
+	if (settings->extra_scaling != extra_scaling) {
+		/* picked up by the engine through DG_FitScaling */
+		extra_scaling = settings->extra_scaling;
+		changed = true;
+	}
+	return changed;
+}
+
+/* Steps the quality once a second by how the output kept up */
+void adaptQuality(uint32_t now)
+{
+	int queued = 0;
+#if !defined(OS_WINDOWS) && defined(TIOCOUTQ)
+	/* what the kernel still holds for the terminal or socket */
+	if (ioctl(output_fd, TIOCOUTQ, &queued) < 0)
+		queued = 0;
+#endif
+#ifndef OS_WINDOWS
+	if (writer_enabled) {
+		pthread_mutex_lock(&writer_lock);
+		queued += writer_queued;
+		pthread_mutex_unlock(&writer_lock);
+	}
+#endif
+	const uint64_t backlog = output_pending_len + (uint64_t)queued;
+	const uint64_t frames = frame_count - adapt_frames;
+	const uint64_t starved = frames_starved - adapt_starved;
+
+	if (backlog * 1000u > budget * ADAPT_LATENCY_MS || starved > frames) {
+		adapt_calm = 0;
+		while (adapt_level + 1u < ADAPT_LEVELS && !setAdaptLevel(adapt_level + 1u))
+			;
+	} else if (!starved && adapt_sent * 2u < budget) {
+		if (++adapt_calm >= ADAPT_CALM_SECONDS) {
+			adapt_calm = 0;
+			while (adapt_level && !setAdaptLevel(adapt_level - 1u))
+				;
+		}
+	} else {
+		adapt_calm = 0;
+	}
+
+	adapt_last_ms = now;
+	adapt_sent = 0;
+	adapt_frames = frame_count;
+	adapt_starved = frames_starved;
+}
+
+/* Whether the budget has bytes left, after a refill for the time since
+ * the last call of up to a second's worth */
+bool budgetReady(uint32_t now)
+{
+	budget_tokens += (int64_t)(budget * (now - budget_refill_ms) / 1000u);
+	budget_refill_ms = now;
+	if (budget_tokens > (int64_t)budget)
+		budget_tokens = budget;
+	return budget_tokens > 0;
+}
+
+/* Returns whether a new frame may be sent now */
+bool outputReady(void)
+{
+	const uint32_t now = DG_GetTicksMs();
+	const uint32_t interval_ms = frame_interval_ms > adapt_interval_ms ? frame_interval_ms : adapt_interval_ms;
+
+	if (budget && now - adapt_last_ms >= 1000u)
+		adaptQuality(now);
+
+	if (interval_ms && frame_count && now - last_frame_ms < interval_ms)
+		return false;
+
+	if (budget && !budgetReady(now)) {
+		frames_starved++;
+		return false;
+	}
+
+#ifndef OS_WINDOWS
+	if (writer_enabled)
+		return writerReady();
+#endif
+	if (output_pending_len) {
+#ifndef OS_WINDOWS
+		/* a send that can't go through costs no more than the poll */
+		struct pollfd pfd = { .fd = output_fd, .events = POLLOUT };
+		if (output_socket || poll(&pfd, 1, 0) > 0)
+#endif
+			writeFrame(output_pending, output_pending_len);
+	}
+	if (output_pending_len) {
+		frames_starved++;
+		return false;
+	}
+	return true;
+}
+
+int DG_ReadyForFrame(void)
+{
+#ifndef OS_WINDOWS
+	/* the frame in flight is waited for, rather than this one dropped */
+	pipelineWait();
+#endif
+	if (outputReady())
+		return 1;
+
+	frames_dropped++;
+	D_SessionCount(STAT_DROPPED, 1);
+	M_FrameDropped();
+	return 0;
+}
+
+/* Drains the last frame and reports how much output was produced */
+void finishOutput(void)
+{
+#ifndef OS_WINDOWS
+	pipelineWait();
+#endif
+	flushOutput();
+#ifndef OS_WINDOWS
+	writerDrain();
+#endif
+	if (cast_file)
+		fflush(cast_file);
+}
+
+void flushOutput(void)
+{
+	writeOutput(output_pending, output_pending_len, true);
+
+	if (frame_count)
+		printf("DG_DrawFrame: %s colors, %llu frames, %llu bytes/frame average, %llu dropped, %llu unchanged\n",
+			color_mode_names[color_mode], (unsigned long long)frame_count,
+			(unsigned long long)(frame_bytes / frame_count), (unsigned long long)frames_dropped,
+			(unsigned long long)frames_unchanged);
+#ifdef HAVE_ZLIB
+	if (compress_active) {
+		printf("DG_DrawFrame: compressed %lu bytes to %lu\n", compress_stream.total_in, compress_stream.total_out);
+		compressEngineOutput();
+		compressOutput(NULL, 0, Z_FINISH);
+		writeOutput(output_pending, output_pending_len, true);
+		return;
+	}
+#endif
+#ifndef OS_WINDOWS
+	if (websocket_enabled || cell_grid || writer_enabled) {
+		static const unsigned char close_message[] = { 0x80u | WS_CLOSE, 0 };
+
+		sendEngineOutput();
+		if (websocket_enabled)
+			writeOutput((const char *)close_message, sizeof(close_message), true);
+		return;
+	}
+#endif
+	fflush(stdout);
+}
+
+#ifdef HAVE_ZLIB
+/* Switches the output to a zlib stream, after telnet's start marker */
+void startCompression(void)
+{
+	static const unsigned char start[] = { TELNET_IAC, TELNET_SB, TELNET_COMPRESS2, TELNET_IAC, TELNET_SE };
+
+	pipelineWait();
+	if (deflateInit(&compress_stream, compress_level) != Z_OK)
+		I_Error("DG_ReadInput: deflateInit failed");
+
+	fflush(stdout);
+	writeOutput(output_pending, output_pending_len, true);
+	writeOutput((const char *)start, sizeof(start), true);
+	if (engine_output < 0)
+		captureEngineOutput();
+
+	compress_active = true;
+}
+
+/* Deflates buf after the output still pending, which it all becomes */
+void compressOutput(const char *buf, size_t len, int flush)
+{
+	size_t used = output_pending_len;
+
+	if (used)
+		memmove(compress_buffer, output_pending, used);
+
+	const size_t needed = used + deflateBound(&compress_stream, len) + 64u;
+	if (compress_buffer_size < needed) {
+		compress_buffer_size = needed;
+		compress_buffer = realloc(compress_buffer, compress_buffer_size);
+	}
+
+	compress_stream.next_in = (Bytef *)buf;
+	compress_stream.avail_in = len;
+	do {
+		if (compress_buffer_size - used < 64u) {
+			compress_buffer_size *= 2u;
+			compress_buffer = realloc(compress_buffer, compress_buffer_size);
+		}
+		compress_stream.next_out = compress_buffer + used;
+		compress_stream.avail_out = compress_buffer_size - used;
+		deflate(&compress_stream, flush);
+		used = compress_buffer_size - compress_stream.avail_out;
+	} while (!compress_stream.avail_out);
+
+	output_pending = (const char *)compress_buffer;
+	output_pending_len = used;
+}
+
+/* Deflates whatever the engine printed since the last frame */
+void compressEngineOutput(void)
+{
+	char text[4096];
+	ssize_t count;
+
+	fflush(stdout);
+	while ((count = read(engine_output, text, sizeof(text))) > 0)
+		compressOutput(text, count, Z_SYNC_FLUSH);
+}
+#endif
+
+#ifndef OS_WINDOWS
+/* Frames go to a copy of stdout, and the engine's messages to a pipe that
+ * never blocks it: a full pipe loses messages, not tics */
+void captureEngineOutput(void)
+{
+	int engine_pipe[2];
+
+	fflush(stdout);
+	CALL((output_fd = dup(STDOUT_FILENO)) < 0, "captureEngineOutput: dup error %d");
+	CALL(pipe(engine_pipe) < 0, "captureEngineOutput: pipe error %d");
+	CALL(dup2(engine_pipe[1], STDOUT_FILENO) < 0, "captureEngineOutput: dup2 error %d");
+	close(engine_pipe[1]);
+	engine_output = engine_pipe[0];
+	CALL(fcntl(engine_output, F_SETFL, O_NONBLOCK) < 0, "captureEngineOutput: fcntl error %d");
+	CALL(fcntl(STDOUT_FILENO, F_SETFL, O_NONBLOCK) < 0, "captureEngineOutput: fcntl error %d");
+}
+
+void base64(char *out, const unsigned char *in, size_t len)
+{
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+
+	for (i = 0; i < len; i += 3u) {
+		const uint32_t bits = (uint32_t)in[i] << 16 | (i + 1u < len ? in[i + 1u] << 8 : 0) | (i + 2u < len ? in[i + 2u] : 0);
+		*out++ = digits[bits >> 18 & 63u];
+		*out++ = digits[bits >> 12 & 63u];
+		*out++ = i + 1u < len ? digits[bits >> 6 & 63u] : '=';
+		*out++ = i + 2u < len ? digits[bits & 63u] : '=';
+	}
+	*out = '\0';
+}
+
+/* Answers the HTTP request that opens the connection */
+void acceptWebSocket(void)
+{
+	char request[WS_HANDSHAKE_LEN];
+	size_t len = 0;
+	const char *key = NULL;
+	char *line;
+
+	request[0] = '\0';
+	while (!strstr(request, "\r\n\r\n")) {
+		struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+
+		if (len == sizeof(request) - 1u || poll(&pfd, 1, 5000) <= 0)
+			I_Error("DG_Init: no WebSocket handshake");
+		const ssize_t count = read(STDIN_FILENO, request + len, sizeof(request) - 1u - len);
+		if (count < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (count <= 0)
+			I_Error("DG_Init: no WebSocket handshake");
+		len += count;
+		request[len] = '\0';
+	}
+
+	for (line = strstr(request, "\r\n"); line && !key; line = strstr(line + 2, "\r\n"))
+		if (!strncasecmp(line + 2, "Sec-WebSocket-Key:", 18))
+			key = line + 20;
+	if (!key)
+		I_Error("DG_Init: not a WebSocket request");
+	key += strspn(key, " \t");
+
+	sha1_context_t sha1;
+	sha1_digest_t digest;
+	char accept_key[29];
+	char response[160];
+
+	SHA1_Init(&sha1);
+	SHA1_Update(&sha1, (byte *)key, strcspn(key, " \t\r"));
+	SHA1_Update(&sha1, (byte *)WS_GUID, strlen(WS_GUID));
+	SHA1_Final(digest, &sha1);
+	base64(accept_key, digest, sizeof(digest));
+
+	len = snprintf(response, sizeof(response),
+		"HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: %s\r\n\r\n",
+		accept_key);
+	writeOutput(response, len, true);
+}
+
+/* Presses the keys in the client's messages. A close message, or one too
+ * long to be keys, closes the input. */
+void readWebSocket(const char *buf, size_t len)
+{
+	const uint64_t now = DG_GetTicksUs();
+	char keys[INPUT_BUFFER_LEN];
+	size_t pos = 0;
+
+	memcpy(ws_input + ws_input_len, buf, len);
+	ws_input_len += len;
+
+	/* client messages are masked, so their header is at least 6 bytes */
+	while (ws_input_len - pos >= 6u) {
+		const unsigned char *message = ws_input + pos;
+		const unsigned opcode = message[0] & 0x0Fu;
+		size_t header = 6u;
+		size_t payload_len = message[1] & 0x7Fu;
+
+		if (payload_len == 126u) {
+			header = 8u;
+			if (ws_input_len - pos < header)
+				break;
+			payload_len = message[2] << 8 | message[3];
+		}
+		if (!(message[1] & 0x80u) || payload_len == 127u || header + payload_len > INPUT_BUFFER_LEN || opcode == WS_CLOSE) {
+			input_open = 0;
+			return;
+		}
+		if (ws_input_len - pos < header + payload_len)
+			break;
+
+		/* continuation, text or binary; pings aren't answered, as that
+		 * would land in the middle of a pending frame */
+		if (opcode <= WS_BINARY) {
+			const unsigned char *mask = message + header - 4u;
+			size_t i, kept = 0;
+
+			for (i = 0; i < payload_len; i++) {
+				const char c = message[header + i] ^ mask[i % 4u];
+				if (c)
+					keys[kept++] = c;
+			}
+			keys[kept] = '\0';
+			pressKeys(&terminal_keys, keys, now);
+		}
+		pos += header + payload_len;
+	}
+
+	memmove(ws_input, ws_input + pos, ws_input_len - pos);
+	ws_input_len -= pos;
+}
+
+/* Puts a message header in front of payload, which has WS_HEADER_MAX bytes
+ * free before it. Returns where the message starts. */
+char *frameWebSocket(char *payload, size_t len, unsigned opcode)
+{
+	unsigned char *header;
+
+	if (len < 126u) {
+		header = (unsigned char *)payload - 2;
+		header[1] = len;
+	} else if (len < 65536u) {
+		header = (unsigned char *)payload - 4;
+		header[1] = 126u;
+		header[2] = len >> 8;
+		header[3] = len;
+	} else {
+		unsigned i;
+
+		header = (unsigned char *)payload - 10;
+		header[1] = 127u;
+		for (i = 0; i < 8u; i++)
+			header[2u + i] = (uint64_t)len >> (56u - 8u * i);
+	}
+	header[0] = 0x80u | opcode; /* FIN */
+	return (char *)header;
+}
+
+/* Sends whatever the engine printed since the last frame, as text messages
+ * over a WebSocket or else as text records of the cell grid. These are few,
+ * so they are written blocking. */
+void sendEngineOutput(void)
+{
+	char text[WS_HEADER_MAX + 4096];
+	ssize_t count;
+
+	fflush(stdout);
+	while ((count = read(engine_output, text + WS_HEADER_MAX, sizeof(text) - WS_HEADER_MAX)) > 0) {
+		char *message = text + WS_HEADER_MAX;
+
+		if (websocket_enabled) {
+			message = frameWebSocket(message, count, WS_TEXT);
+		} else if (cell_grid) {
+			message -= GRID_RECORD_HEADER;
+			writeGridHeader(message, 'T', count);
+		}
+		writeOutput(message, text + WS_HEADER_MAX + count - message, true);
+	}
+}
+
+/* A frame no longer in the ring, none yet, or one from before a replay
+ * started or ended: the spectator starts again from a keyframe. Called with
+ * spectate_lock held. */
+bool spectatorBehind(const struct spectator_t *spectator)
+{
+	return !spectator->synced || spectate_head - spectator->seq > SPECTATE_FRAMES
+		|| (spectator->seq < spectate_restart && !spectator->offset);
+}
+
+/* Whether the spectator has something to send. Called with spectate_lock held. */
+bool spectatorReady(const struct spectator_t *spectator)
+{
+	if (spectatorBehind(spectator))
+		return spectate_have_key && spectate_keyframe >= spectate_restart
+			&& spectate_head - spectate_keyframe <= SPECTATE_FRAMES;
+	return spectator->seq < spectate_head;
+}
+
+/* Sends as much as the socket takes, returns false once it is closed */
+bool sendSpectator(struct spectator_t *spectator)
+{
+	bool open = true;
+
+	pthread_mutex_lock(&spectate_lock);
+	while (spectatorReady(spectator)) {
+		if (spectatorBehind(spectator)) {
+			spectator->seq = spectate_keyframe;
+			spectator->offset = 0;
+			spectator->synced = true;
+		}
+
+		const struct spectate_frame_t *frame = &spectate_frames[spectator->seq % SPECTATE_FRAMES];
+		const ssize_t sent = send(spectator->fd, frame->data + spectator->offset,
+			frame->len - spectator->offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			open = errno == EAGAIN || errno == EWOULDBLOCK;
+			break;
+		}
+
+		spectator->offset += sent;
+		if (spectator->offset == frame->len) {
+			spectator->seq++;
+			spectator->offset = 0;
+		}
+	}
+	pthread_mutex_unlock(&spectate_lock);
+
+	return open;
+}
+
+/* Whether the address is this host's */
+bool loopbackAddress(const struct sockaddr_storage *addr)
+{
+	if (addr->ss_family == AF_INET)
+		return (ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr) >> 24) == 127u;
+	if (addr->ss_family == AF_INET6) {
+		const struct in6_addr *addr6 = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+		return IN6_IS_ADDR_LOOPBACK(addr6) || (IN6_IS_ADDR_V4MAPPED(addr6) && addr6->s6_addr[12] == 127u);
+	}
+	return false;
+}
+
+/* A caster's keys, r or s, start a replay */
+void casterKeys(const char *keys, ssize_t len)
+{
+	ssize_t i;
+
+	for (i = 0; i < len; i++) {
+		if (keys[i] != 'r' && keys[i] != 's')
+			continue;
+		pthread_mutex_lock(&spectate_lock);
+		replay_request = keys[i] == 's' ? REPLAY_SLOW : REPLAY_NORMAL;
+		pthread_mutex_unlock(&spectate_lock);
+	}
+}
+
+void acceptSpectator(void)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	const int fd = accept(spectate_listener, (struct sockaddr *)&addr, &addr_len);
+	if (fd < 0)
+		return;
+
+	if (num_spectators == SPECTATE_MAX || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		close(fd);
+		return;
+	}
+
+	/* the keyframe doesn't clear what was on the screen before */
+	send(fd, "\033[1;1H\033[2J", 10, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+	spectators[num_spectators++] = (struct spectator_t){
+		.fd = fd,
+		.caster = replay_seconds && loopbackAddress(&addr),
+	};
+}
+
+/* I/O thread: accepts spectators and sends them the frames of the ring */
+void *spectateThread(void *arg)
+{
+	struct pollfd pfds[SPECTATE_MAX + 2u];
+	char discard[256];
+	unsigned i, count;
+
+	(void)arg;
+
+	for (;;) {
+		pfds[0] = (struct pollfd){ .fd = spectate_wake[0], .events = POLLIN };
+		pfds[1] = (struct pollfd){ .fd = spectate_listener, .events = POLLIN };
+
+		count = num_spectators;
+		pthread_mutex_lock(&spectate_lock);
+		for (i = 0; i < count; i++)
+			pfds[i + 2u] = (struct pollfd){
+				.fd = spectators[i].fd,
+				.events = POLLIN | (spectatorReady(&spectators[i]) ? POLLOUT : 0),
+			};
+		pthread_mutex_unlock(&spectate_lock);
+
+		if (poll(pfds, count + 2u, -1) < 0)
+			continue;
+
+		if (pfds[0].revents & POLLIN)
+			while (read(spectate_wake[0], discard, sizeof(discard)) > 0)
+				;
+
+		for (i = 0; i < count; i++) {
+			struct spectator_t *spectator = &spectators[i];
+			bool open = true;
+
+			/* what spectators type is ignored but for a caster's keys,
+			 * and shows when they leave */
+			if (pfds[i + 2u].revents & (POLLIN | POLLHUP | POLLERR)) {
+				const ssize_t len = read(spectator->fd, discard, sizeof(discard));
+				open = len > 0 || (len < 0 && (errno == EAGAIN || errno == EINTR));
+				if (len > 0 && spectator->caster)
+					casterKeys(discard, len);
+			}
+			if (open)
+				open = sendSpectator(spectator);
+			if (!open) {
+				close(spectator->fd);
+				spectator->fd = -1;
+			}
+		}
+
+		/* drop the closed ones, keeping the order of the rest */
+		count = 0;
+		for (i = 0; i < num_spectators; i++)
+			if (spectators[i].fd >= 0)
+				spectators[count++] = spectators[i];
+		num_spectators = count;
+
+		if (pfds[1].revents & POLLIN)
+			acceptSpectator();
+	}
+
+	return NULL;
+}
+
+/* A non-blocking socket listening on the TCP port, for the option named */
+int listenOn(const char *port, const char *option)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+	struct addrinfo *addrs, *addr;
+	int listener = -1;
+	int on = 1;
+
+	if (getaddrinfo(NULL, port, &hints, &addrs) != 0)
+		I_Error("DG_Init: bad %s port %s", option, port);
+
+	for (addr = addrs; addr != NULL && listener < 0; addr = addr->ai_next) {
+		listener = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+		if (listener < 0)
+			continue;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(listener, addr->ai_addr, addr->ai_addrlen) != 0
+			|| listen(listener, SOMAXCONN) != 0) {
+			close(listener);
+			listener = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+
+	if (listener < 0)
+		I_Error("DG_Init: couldn't listen on %s port %s", option, port);
+	CALL(fcntl(listener, F_SETFL, O_NONBLOCK) < 0, "DG_Init: fcntl error %d");
+	return listener;
+}
+
+void initSpectate(const char *port)
+{
+	pthread_t thread;
+
+	spectate_listener = listenOn(port, "-spectate");
+
+	CALL(pipe(spectate_wake) < 0, "DG_Init: pipe error %d");
+	CALL(fcntl(spectate_wake[0], F_SETFL, O_NONBLOCK) < 0, "DG_Init: fcntl error %d");
+	CALL(fcntl(spectate_wake[1], F_SETFL, O_NONBLOCK) < 0, "DG_Init: fcntl error %d");
+
+	CALL((errno = pthread_create(&thread, NULL, spectateThread, NULL)) != 0, "DG_Init: pthread_create error %d");
+	pthread_detach(thread);
+
+	spectate_enabled = true;
+}
+
+/* Puts a frame in the ring for the I/O thread. Called with spectate_lock held. */
+void putSpectateFrame(const char *buf, size_t len, bool keyframe)
+{
+	struct spectate_frame_t *frame = &spectate_frames[spectate_head % SPECTATE_FRAMES];
+	if (frame->size < len) {
+		frame->data = realloc(frame->data, len);
+		CALL(!frame->data, "spectateFrame: realloc error %d");
+		frame->size = len;
+	}
+	memcpy(frame->data, buf, len);
+	frame->len = len;
+	if (keyframe) {
+		spectate_keyframe = spectate_head;
+		spectate_have_key = true;
+	}
+	spectate_head++;
+}
+
+/* Keeps a frame sent to spectators for replays */
+void keepReplayFrame(const char *buf, size_t len, bool keyframe, uint32_t now)
+{
+	struct replay_frame_t *frame = &replay_frames[replay_head % replay_capacity];
+	if (frame->size < len) {
+		frame->data = realloc(frame->data, len);
+		CALL(!frame->data, "keepReplayFrame: realloc error %d");
+		frame->size = len;
+	}
+	memcpy(frame->data, buf, len);
+	frame->len = len;
+	frame->ms = now;
+	frame->keyframe = keyframe;
+	replay_head++;
+}
+
+/* From the first keyframe kept of the last replay_seconds. Called with
+ * spectate_lock held. */
+void startReplay(bool slow, uint32_t now)
+{
+	uint64_t seq = replay_head > replay_capacity ? replay_head - replay_capacity : 0;
+
+	if (seq < replay_tail)
+		seq = replay_tail;
+	for (; seq < replay_head; seq++) {
+		const struct replay_frame_t *frame = &replay_frames[seq % replay_capacity];
+		if (frame->keyframe && now - frame->ms <= replay_seconds * 1000u)
+			break;
+	}
+	if (seq == replay_head)
+		return;
+
+	replaying = true;
+	replay_next = seq;
+	replay_end = replay_head;
+	replay_start_ms = now;
+	replay_first_ms = replay_frames[seq % replay_capacity].ms;
+	replay_slowdown = slow ? 2u : 1u;
+	spectate_restart = spectate_head;
+}
+
+/* Sends spectators the frames of the replay that are due. Called with
+ * spectate_lock held. */
+void continueReplay(uint32_t now)
+{
+	while (replay_next < replay_end) {
+		const struct replay_frame_t *frame = &replay_frames[replay_next % replay_capacity];
+		if ((frame->ms - replay_first_ms) * replay_slowdown > now - replay_start_ms)
+			return;
+		putSpectateFrame(frame->data, frame->len, frame->keyframe);
+		replay_next++;
+	}
+
+	/* the frames kept before it don't lead to the game's next ones */
+	replaying = false;
+	replay_tail = replay_head;
+	replay_need_key = true;
+	spectate_restart = spectate_head;
+}
+
+/* Puts a frame in the ring for the I/O thread, or the frames of a replay
+ * instead while there is one */
+void spectateFrame(const char *buf, size_t len, bool keyframe)
+{
+	const uint32_t now = DG_GetTicksMs();
+
+	if (keyframe)
+		replay_need_key = false;
+	if (replay_seconds && !replaying && !replay_need_key)
+		keepReplayFrame(buf, len, keyframe, now);
+
+	pthread_mutex_lock(&spectate_lock);
+	if (replay_request != REPLAY_NONE && !replaying)
+		startReplay(replay_request == REPLAY_SLOW, now);
+	replay_request = REPLAY_NONE;
+
+	if (replaying)
+		continueReplay(now);
+	else
+		putSpectateFrame(buf, len, keyframe);
+	pthread_mutex_unlock(&spectate_lock);
+
+	/* a full pipe already has the thread awake */
+	(void)!write(spectate_wake[1], "", 1);
+}
+
+void closeViewport(struct viewport_t *viewport)
+{
+	close(viewport->fd);
+	viewport->fd = -1;
+	viewport->pending_len = 0;
+}
+
+/* Sends what the player's connection takes of the pending frame */
+void flushViewport(struct viewport_t *viewport)
+{
+	while (viewport->pending_len) {
+		const ssize_t sent = send(viewport->fd, viewport->pending, viewport->pending_len,
+			MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				closeViewport(viewport);
+			return;
+		}
+		viewport->pending += sent;
+		viewport->pending_len -= sent;
+	}
+}
+
+/* Drops the telnet commands that telnet clients send unasked */
+size_t stripTelnet(char *buf, size_t len)
+{
+	size_t i, kept = 0;
+
+	for (i = 0; i < len; i++) {
+		const unsigned char c = buf[i];
+
+		if (c == TELNET_IAC && i + 1u < len)
+			/* IAC WILL, WONT, DO and DONT take an option */
+			i += (unsigned char)buf[i + 1u] >= TELNET_WILL ? 2u : 1u;
+		else if (c)
+			buf[kept++] = c;
+	}
+	return kept;
+}
+#endif
+
+char *writeLittleEndian(char *buf, uint32_t value, unsigned bytes)
+{
+	unsigned i;
+
+	for (i = 0; i < bytes; i++)
+		*buf++ = value >> 8u * i;
+	return buf;
+}
+
+uint32_t readLittleEndian(const unsigned char *buf, unsigned bytes)
+{
+	uint32_t value = 0;
+	unsigned i;
+
+	for (i = 0; i < bytes; i++)
+		value |= (uint32_t)buf[i] << 8u * i;
+	return value;
+}
+
+/* Takes the acknowledgement and the new keys of a client datagram */
+void udpDatagram(const unsigned char *datagram, size_t len)
+{
+	if (len < 8u)
+		return;
+	const uint32_t ack = readLittleEndian(datagram, 4u);
+	const uint32_t offset = readLittleEndian(datagram + 4u, 4u);
+	const size_t keys = len - 8u;
+
+	udp_heard_ms = DG_GetTicksMs();
+	/* datagrams may come out of order, and only frames sent count */
+	if (ack != UDP_NO_FRAME && (int32_t)(udp_frame - ack) > 0
+		&& (udp_acked == UDP_NO_FRAME || (int32_t)(ack - udp_acked) > 0))
+		udp_acked = ack;
+
+	if (offset <= udp_input && udp_input - offset < keys) {
+		char text[INPUT_BUFFER_LEN];
+		size_t count = keys - (udp_input - offset);
+
+		if (count > INPUT_BUFFER_LEN - 1u)
+			count = INPUT_BUFFER_LEN - 1u;
+		memcpy(text, datagram + 8u + (udp_input - offset), count);
+		text[count] = '\0';
+		udp_input += count;
+		pressKeys(&terminal_keys, text, DG_GetTicksUs());
+	}
+}
+
+void initUdp(const char *port)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM, .ai_flags = AI_PASSIVE };
+	struct addrinfo *addrs, *addr;
+	struct sockaddr_storage client;
+	socklen_t client_len = sizeof(client);
+	unsigned char datagram[UDP_PAYLOAD];
+	ssize_t len;
+
+	if (getaddrinfo(NULL, port, &hints, &addrs) != 0)
+		I_Error("DG_Init: bad -udp port %s", port);
+	for (addr = addrs; addr != NULL && udp_fd < 0; addr = addr->ai_next) {
+		udp_fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+		if (udp_fd >= 0 && bind(udp_fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+			close(udp_fd);
+			udp_fd = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+	if (udp_fd < 0)
+		I_Error("DG_Init: couldn't bind -udp port %s", port);
+
+	fprintf(stderr, "DG_Init: waiting for a client on UDP port %s\n", port);
+	while ((len = recvfrom(udp_fd, datagram, sizeof(datagram), 0, (struct sockaddr *)&client, &client_len)) < 0)
+		CALL(errno != EINTR, "DG_Init: recvfrom error %d");
+	/* from here on, the kernel drops anyone else's datagrams */
+	CALL(connect(udp_fd, (struct sockaddr *)&client, client_len) < 0, "DG_Init: connect error %d");
+	CALL(fcntl(udp_fd, F_SETFL, O_NONBLOCK) < 0, "DG_Init: fcntl error %d");
+
+	input_fd = udp_fd;
+	udp_enabled = true;
+	allocUdpHistory();
+	udpDatagram(datagram, len);
+}
+
+/* Sizes the frames kept to the grid; the client's are of the old size */
+void allocUdpHistory(void)
+{
+	free(udp_history);
+	udp_history = malloc(UDP_HISTORY * grid_width * grid_height * sizeof(*udp_history));
+	memset(udp_history_frame, 0xFF, sizeof(udp_history_frame));
+}
+
+void readUdp(void)
+{
+	unsigned char datagram[UDP_PAYLOAD];
+	const cpukind_t kind = D_CpuPhase(CPU_IO);
+	ssize_t len;
+
+	while ((len = recv(udp_fd, datagram, sizeof(datagram), 0)) >= 0 || errno == EINTR) {
+		if (len >= 0)
+			udpDatagram(datagram, len);
+	}
+	D_CpuPhase(kind);
+	if (DG_GetTicksMs() - udp_heard_ms > UDP_TIMEOUT_MS)
+		input_open = 0;
+}
+
+/* The acknowledged frame, if it is still kept and of the grid's size */
+const cell_t *udpBase(void)
+{
+	const unsigned slot = udp_acked % UDP_HISTORY;
+
+	if (udp_acked == UDP_NO_FRAME || udp_history_frame[slot] != udp_acked)
+		return NULL;
+	return udp_history + slot * grid_width * grid_height;
+}
+
+/* Sends the record in parts, and keeps its cells as a base for later
+ * frames. A datagram the kernel won't take is as good as lost. */
+void sendUdpFrame(const char *record, size_t len, const cell_t *base)
+{
+	const unsigned parts = (len + UDP_PAYLOAD - 1u) / UDP_PAYLOAD;
+	const unsigned slot = udp_frame % UDP_HISTORY;
+	char datagram[UDP_HEADER + UDP_PAYLOAD];
+	unsigned part;
+
+	M_StartStage(STAGE_WRITE);
+	for (part = 0; part < parts; part++) {
+		const size_t offset = (size_t)part * UDP_PAYLOAD;
+		const size_t bytes = len - offset < UDP_PAYLOAD ? len - offset : UDP_PAYLOAD;
+		char *p = writeLittleEndian(datagram, udp_frame, 4u);
+
+		p = writeLittleEndian(p, base ? udp_acked : UDP_NO_FRAME, 4u);
+		p = writeLittleEndian(p, udp_input, 4u);
+		p = writeLittleEndian(p, part, 2u);
+		p = writeLittleEndian(p, parts, 2u);
+		memcpy(p, record + offset, bytes);
+		send(udp_fd, datagram, UDP_HEADER + bytes, MSG_DONTWAIT);
+	}
+	D_SessionCount(STAT_BYTES, len + parts * UDP_HEADER);
+	M_EndStage(STAGE_WRITE);
+	M_FrameWritten();
+
+	memcpy(udp_history + slot * grid_width * grid_height, cells, grid_width * grid_height * sizeof(*cells));
+	udp_history_frame[slot] = udp_frame++;
+}
+
+int DG_AcceptViewport(int timeout_ms)
+{
+#ifndef OS_WINDOWS
+	struct pollfd pfd = { .fd = viewport_listener, .events = POLLIN };
+
+	if (viewport_listener < 0 || num_viewports == VIEWPORT_MAX || poll(&pfd, 1, timeout_ms) <= 0)
+		return -1;
+
+	const int fd = accept(viewport_listener, NULL, NULL);
+	if (fd < 0)
+		return -1;
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	struct viewport_t *viewport = &viewports[num_viewports];
+	*viewport = (struct viewport_t){ .fd = fd, .clear_screen = true };
+	viewport->buffer = malloc(output_buffer_size);
+	viewport->buffer_size = output_buffer_size;
+	if (delta_enabled)
+		viewport->prev_cells = calloc(grid_width * grid_height, sizeof(*cells));
+	return num_viewports++;
+#else
+	(void)timeout_ms;
+	return -1;
+#endif
+}
+
+int DG_ViewportKeys(int index, unsigned char *keydown)
+{
+#ifndef OS_WINDOWS
+	struct viewport_t *viewport = &viewports[index];
+	char raw_input[INPUT_BUFFER_LEN];
+	const uint64_t now = DG_GetTicksUs();
+	ssize_t count;
+	unsigned key;
+
+	if (viewport->fd < 0)
+		return 0;
+
+	while ((count = read(viewport->fd, raw_input, INPUT_BUFFER_LEN - 1u)) > 0) {
+		raw_input[stripTelnet(raw_input, count)] = '\0';
+		pressKeys(&viewport->keys, raw_input, now);
+	}
+	if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		closeViewport(viewport);
+		return 0;
+	}
+
+	for (key = 0; key < 256u; key++) {
+		releaseKey(&viewport->keys, key, now);
+		keydown[key] = viewport->keys.held[key];
+	}
+	return 1;
+#else
+	(void)index;
+	(void)keydown;
+	return 0;
+#endif
+}
+
+int DG_ViewportReady(int index)
+{
+#ifndef OS_WINDOWS
+	struct viewport_t *viewport = &viewports[index];
+
+	if (viewport->fd >= 0)
+		flushViewport(viewport);
+	return viewport->fd >= 0 && !viewport->pending_len
+		&& DG_GetTicksMs() - viewport->last_frame_ms >= frame_interval_ms;
+#else
+	(void)index;
+	return 0;
+#endif
+}
+
+void DG_DrawViewport(int index, const char *status)
+{
+#ifndef OS_WINDOWS
+	struct viewport_t *viewport = &viewports[index];
+	char *buf = viewport->buffer;
+
+	pipelineWait();
+	encode_buffer = &viewport->buffer;
+	encode_buffer_size = &viewport->buffer_size;
+	frame_pixels = DG_ScreenBuffer;
+	frame_step = 1;
+	frame_pitch = DOOMGENERIC_RESX;
+
+	if (viewport->clear_screen) {
+		viewport->clear_screen = false;
+		memcpy(buf, "\033[1;1H\033[2J", 10);
+		buf += 10;
+	}
+
+	/* the cells are the player's, and the next frame builds them all again */
+	markAllDirty();
+	dots_shown = false;
+	text_on = false;
+	buildCells();
+
+	if (delta_enabled && viewport->prev_cells_valid
+		&& countChangedCells(viewport->prev_cells) * 100u <= grid_width * grid_height * DELTA_FULL_PERCENT)
+		buf = encodeDelta(buf, viewport->prev_cells);
+	else
+		buf = encodeFull(buf);
+
+	if (delta_enabled) {
+		memcpy(viewport->prev_cells, cells, grid_width * grid_height * sizeof(*cells));
+		viewport->prev_cells_valid = true;
+	}
+
+	if (status[0])
+		buf = writeStatus(buf, status);
+
+	if (!mono) {
+		memcpy(buf, "\033[0m", 4);
+		buf += 4;
+	}
+
+	viewport->pending = viewport->buffer;
+	viewport->pending_len = buf - viewport->buffer;
+	viewport->last_frame_ms = DG_GetTicksMs();
+	flushViewport(viewport);
+#else
+	(void)index;
+	(void)status;
+#endif
+}
+
+/* Whether this is the encoder thread of -pipeline */
+bool onEncoder(void)
+{
+#ifndef OS_WINDOWS
+	return pipeline_enabled && pthread_equal(pthread_self(), pipeline_thread);
+#else
+	return false;
+#endif
+}
+
+#ifndef OS_WINDOWS
+void encodeFrame(void);
+
+void *pipelineThread(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&pipeline_lock);
+	for (;;) {
+		while (!pipeline_busy)
+			pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+		pthread_mutex_unlock(&pipeline_lock);
+
+		encodeFrame();
+
+		pthread_mutex_lock(&pipeline_lock);
+		pipeline_busy = false;
+		pthread_cond_broadcast(&pipeline_cond);
+	}
+	return NULL;
+}
+
+/* Hands the frame over to the encoder thread, with copies of what the engine
+ * draws the next frame into */
+void pipelineStart(void)
+{
+	const size_t screen_size = DOOMGENERIC_RESX * DOOMGENERIC_RESY * sizeof(pixel_t);
+
+	if (pipeline_screen_size != screen_size) {
+		pipeline_screen_size = screen_size;
+		pipeline_screen = realloc(pipeline_screen, screen_size);
+	}
+	if (frame_pixels == DG_ScreenBuffer) {
+		memcpy(pipeline_screen, DG_ScreenBuffer, screen_size);
+	} else {
+		/* only the sampled pixels of the engine's screen */
+		const pixel_t *in = frame_pixels;
+		pixel_t *out = pipeline_screen;
+		unsigned x, y;
+
+		for (y = 0; y < DOOMGENERIC_RESY; y++, in += frame_pitch) {
+			for (x = 0; x < DOOMGENERIC_RESX; x++)
+				*out++ = in[x * frame_step];
+		}
+	}
+	frame_pixels = pipeline_screen;
+	frame_step = 1;
+	frame_pitch = DOOMGENERIC_RESX;
+
+	if (dots_shown) {
+		const size_t dots_size = DG_DotsWidth * DG_DotsHeight;
+
+		if (pipeline_dots_size != dots_size) {
+			pipeline_dots_size = dots_size;
+			pipeline_dots = realloc(pipeline_dots, dots_size);
+		}
+		memcpy(pipeline_dots, DG_Dots, dots_size);
+		frame_dots = pipeline_dots;
+	}
+
+	pthread_mutex_lock(&pipeline_lock);
+	pipeline_busy = true;
+	pthread_cond_broadcast(&pipeline_cond);
+	pthread_mutex_unlock(&pipeline_lock);
+}
+
+/* Waits for the frame in flight, then passes on its counts and takes the
+ * palette set since */
+void pipelineWait(void)
+{
+	if (!pipeline_enabled)
+		return;
+
+	pthread_mutex_lock(&pipeline_lock);
+	while (pipeline_busy)
+		pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+	pthread_mutex_unlock(&pipeline_lock);
+
+	if (pipeline_bytes) {
+		D_SessionCount(STAT_BYTES, pipeline_bytes);
+		pipeline_bytes = 0;
+	}
+	if (pipeline_encoded) {
+		M_StageBytes(pipeline_frame_bytes);
+		M_FrameEncoded();
+		pipeline_encoded = false;
+	}
+	if (pipeline_written) {
+		M_FrameWritten();
+		pipeline_written = false;
+	}
+	if (pipeline_palette_set) {
+		applyPalette(pipeline_palette);
+		pipeline_palette_set = false;
+	}
+}
+
+void initPipeline(void)
+{
+	/* the engine's messages only go out with the frames, in between them */
+	fflush(stdout);
+	setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+
+	pipeline_enabled = true;
+	CALL((errno = pthread_create(&pipeline_thread, NULL, pipelineThread, NULL)) != 0, "DG_Init: pthread_create error %d");
+	pthread_detach(pipeline_thread);
+}
+
+void *writerThread(void *arg)
+{
+	struct out_chunk_t *chunk;
+
+	(void)arg;
+	pthread_mutex_lock(&writer_lock);
+	for (;;) {
+		while (!writer_head)
+			pthread_cond_wait(&writer_cond, &writer_lock);
+		chunk = writer_head;
+		writer_head = chunk->next;
+		if (!writer_head)
+			writer_tail = NULL;
+		if (chunk->frame)
+			writer_frames_waiting--;
+		writer_busy = true;
+		pthread_mutex_unlock(&writer_lock);
+
+		const char *buf = chunk->data;
+		size_t len = chunk->len;
+		while (len) {
+			const ssize_t written = write(output_fd, buf, len);
+			if (written < 0) {
+				/* the file description may be non-blocking, as shared */
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					struct pollfd pfd = { .fd = output_fd, .events = POLLOUT };
+					poll(&pfd, 1, -1);
+					continue;
+				}
+				CALL(errno != EINTR, "writerThread: write error %d");
+				continue;
+			}
+			buf += written;
+			len -= written;
+		}
+		if (chunk->cast_len)
+			writeCast(chunk->data + chunk->len, chunk->cast_len, chunk->cast_cols, chunk->cast_rows);
+
+		pthread_mutex_lock(&writer_lock);
+		writer_queued -= chunk->len;
+		writer_written += chunk->len;
+		if (chunk->frame)
+			writer_frames_written++;
+		writer_busy = false;
+		free(chunk);
+		pthread_cond_broadcast(&writer_cond);
+	}
+	return NULL;
+}
+
+/* Copies buf into the queue, in place of the frame waiting if this one is
+ * a frame that stands alone */
+void writerQueue(const char *buf, size_t len, bool frame)
+{
+	struct out_chunk_t *chunk, **link;
+
+	if (!len)
+		return;
+
+	const size_t extra = frame ? cast_len : 0u;
+	chunk = malloc(sizeof(*chunk) + len + extra);
+	CALL(!chunk, "writerQueue: malloc error %d");
+	chunk->next = NULL;
+	chunk->len = len;
+	chunk->frame = frame;
+	chunk->standalone = frame && frame_standalone;
+#ifdef HAVE_ZLIB
+	if (compress_active)
+		chunk->standalone = false;
+#endif
+	memcpy(chunk->data, buf, len);
+	chunk->cast_len = extra;
+	if (extra) {
+		memcpy(chunk->data + len, cast_text, extra);
+		chunk->cast_cols = grid_width * cell_columns;
+		chunk->cast_rows = grid_height + 1u;
+		cast_len = 0;
+	}
+
+	pthread_mutex_lock(&writer_lock);
+	if (chunk->standalone) {
+		for (link = &writer_head; *link; link = &(*link)->next) {
+			struct out_chunk_t *waiting = *link;
+
+			if (!waiting->frame)
+				continue;
+			chunk->next = waiting->next;
+			*link = chunk;
+			if (writer_tail == waiting)
+				writer_tail = chunk;
+			writer_queued -= waiting->len;
+			writer_frames_waiting--;
+			free(waiting);
+			break;
+		}
+	}
+	if (!chunk->next && writer_tail != chunk) {
+		if (writer_tail)
+			writer_tail->next = chunk;
+		else
+			writer_head = chunk;
+		writer_tail = chunk;
+	}
+	writer_queued += len;
+	if (frame)
+		writer_frames_waiting++;
+	pthread_cond_broadcast(&writer_cond);
+	pthread_mutex_unlock(&writer_lock);
+}
+
+/* Takes the writer thread's counts, and returns whether a frame may be
+ * queued now */
+bool writerReady(void)
+{
+	pthread_mutex_lock(&writer_lock);
+	const uint64_t written = writer_written;
+	const unsigned frames_written = writer_frames_written;
+	const bool waiting = writer_frames_waiting > 0;
+	writer_written = 0;
+	writer_frames_written = 0;
+	pthread_mutex_unlock(&writer_lock);
+
+	if (written) {
+		budget_tokens -= written;
+		adapt_sent += written;
+		D_SessionCount(STAT_BYTES, written);
+	}
+	if (frames_written)
+		M_FrameWritten();
+
+	/* a frame that builds on the waiting one can't replace it */
+	bool builds_on = delta_enabled;
+#ifdef HAVE_ZLIB
+	builds_on = builds_on || compress_active;
+#endif
+	if (waiting && builds_on) {
+		frames_starved++;
+		return false;
+	}
+	return true;
+}
+
+/* Waits for everything queued to be written */
+void writerDrain(void)
+{
+	if (!writer_enabled)
+		return;
+
+	pthread_mutex_lock(&writer_lock);
+	while (writer_head || writer_busy)
+		pthread_cond_wait(&writer_cond, &writer_lock);
+	pthread_mutex_unlock(&writer_lock);
+}
+
+void initWriter(void)
+{
+	pthread_t thread;
+
+	/* the engine's messages would land in the middle of frames */
+	if (engine_output < 0)
+		captureEngineOutput();
+
+	writer_enabled = true;
+	CALL((errno = pthread_create(&thread, NULL, writerThread, NULL)) != 0, "DG_Init: pthread_create error %d");
+	pthread_detach(thread);
+}
+#endif
+
+void initCast(const char *path)
+{
+	/* events are written whole, and the buffer flushed at exit */
+	CALL(!(cast_file = fopen(path, "w")), "DG_Init: -asciicast: fopen error %d");
+	setvbuf(cast_file, NULL, _IOFBF, 1u << 20);
+	cast_start_us = DG_GetTicksUs();
+}
+
+#ifndef OS_WINDOWS
+/* Bytes of the image in a chunk of the kitty protocol: 3072, 4096 once in base64 */
+#define KITTY_CHUNK 3072u
+
+/* Returns a buffer of at least size bytes, kept for the next frame */
+unsigned char *graphicsBuffer(unsigned char **buffer, size_t *buffer_size, size_t size)
+{
+	if (*buffer_size < size) {
+		*buffer = realloc(*buffer, size);
+		CALL(!*buffer, "DG_DrawFrame: realloc error %d");
+		*buffer_size = size;
+	}
+	return *buffer;
+}
+
+/* The color of a pixel, in XRGB */
+uint32_t graphicsColor(pixel_t pixel)
+{
+#ifdef CMAP256
+	return current_palette[pixel];
+#else
+	return pixel;
 #endif
+}
 
-#define UNLIKELY(x_) __builtin_expect((x_), 0)
-#define CALL(stmt_, format_)                     \
-	do {                                     \
-		if (UNLIKELY(stmt_))             \
-			I_Error(format_, errno); \
-	} while (0)
-#define CALL_STDOUT(stmt_, format_) CALL((stmt_) == EOF, format_)
+/* Whether any row has a dirty span */
+bool framePixelsDirty(void)
+{
+	unsigned row;
 
-#define BYTE_TO_TEXT(buf_, byte_)                      \
-	do {                                           \
-		*(buf_)++ = '0' + (byte_) / 100u;      \
-		*(buf_)++ = '0' + (byte_) / 10u % 10u; \
-		*(buf_)++ = '0' + (byte_) % 10u;       \
-	} while (0)
+	for (row = 0; row < grid_height; row++)
+		if (dirty_start[row] < dirty_end[row])
+			return true;
+	return false;
+}
 
-const char grad[] = " .-+1x@";
-#define GRAD_LEN 8u
-#define INPUT_BUFFER_LEN 16u
-#define EVENT_BUFFER_LEN (INPUT_BUFFER_LEN * 2u - 1u)
+/* Sends the frame as the kitty image in the top left corner, over the rows
+ * of the window but the status line when its size is known, or between
+ * keyframes only the box around the dirty spans as an edit of the image */
+char *encodeKitty(char *buf, bool keyframe)
+{
+	unsigned left = 0, right = DOOMGENERIC_RESX, top = 0, bottom = DOOMGENERIC_RESY;
+	unsigned x, y;
+	bool packed = false;
 
-struct color_t {
-	uint32_t b : 8;
-	uint32_t g : 8;
-	uint32_t r : 8;
-	uint32_t a : 8;
-};
+	if (!keyframe) {
+		left = right;
+		right = 0;
+		top = bottom;
+		bottom = 0;
+		for (y = 0; y < grid_height; y++) {
+			if (dirty_start[y] >= dirty_end[y])
+				continue;
+			if (y < top)
+				top = y;
+			bottom = y + 1u;
+			if (dirty_start[y] < left)
+				left = dirty_start[y];
+			if (dirty_end[y] > right)
+				right = dirty_end[y];
+		}
+		if (top >= bottom)
+			return buf;
+	}
 
-char *output_buffer;
-size_t output_buffer_size;
-struct timespec ts_init;
+	const unsigned width = right - left, height = bottom - top;
+	size_t len = (size_t)width * height * 3u;
+	unsigned char *rgb = graphicsBuffer(&graphics_pixels, &graphics_pixels_size, len);
+	const unsigned char *payload = rgb;
 
-char input_buffer[INPUT_BUFFER_LEN];
-uint16_t event_buffer[EVENT_BUFFER_LEN];
-uint16_t *event_buf_loc;
+	for (y = top; y < bottom; y++) {
+		const pixel_t *in = frame_pixels + y * frame_pitch + left * frame_step;
 
-void DG_Init()
-{
-#ifdef OS_WINDOWS
-	const HANDLE hOutputHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-	WINDOWS_CALL(hOutputHandle == INVALID_HANDLE_VALUE, "DG_Init: %s");
-	DWORD mode;
-	WINDOWS_CALL(!GetConsoleMode(hOutputHandle, &mode), "DG_Init: %s");
-	mode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
-	WINDOWS_CALL(!SetConsoleMode(hOutputHandle, mode), "DG_Init: %s");
+		for (x = 0; x < width; x++, in += frame_step) {
+			const uint32_t color = graphicsColor(*in);
 
-	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
-	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, "DG_Init: %s");
-	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &mode), "DG_Init: %s");
-	mode &= ~(ENABLE_MOUSE_INPUT | ENABLE_WINDOW_INPUT | ENABLE_QUICK_EDIT_MODE);
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, mode), "DG_Init: %s");
+			*rgb++ = color >> 16;
+			*rgb++ = color >> 8;
+			*rgb++ = color;
+		}
+	}
+
+#ifdef HAVE_ZLIB
+	uLongf packed_len = compressBound(len);
+	unsigned char *out = graphicsBuffer(&graphics_packed, &graphics_packed_size, packed_len);
+	if (compress2(out, &packed_len, graphics_pixels, len, Z_BEST_SPEED) == Z_OK && packed_len < len) {
+		payload = out;
+		len = packed_len;
+		packed = true;
+	}
 #endif
-	/* Longest SGR code: \033[38;2;RRR;GGG;BBBm (length 19)
-	 * Maximum 21 bytes per pixel: SGR + 2 x char
-	 * 1 Newline character per line
-	 * SGR clear code: \033[0m (length 4)
-	 */
-	output_buffer_size = 21u * DOOMGENERIC_RESX * DOOMGENERIC_RESY + DOOMGENERIC_RESY + 4u;
-	output_buffer = malloc(output_buffer_size);
 
-	clock_gettime(CLK, &ts_init);
+	/* the longest control data is under 100 bytes */
+	buf = reserveOutput(buf, 100u);
+	if (keyframe) {
+		/* C=1 leaves the cursor where it was, for the status line */
+		memcpy(buf, "\033[1;1H\033_Ga=T,i=1,p=1,q=2,C=1", 28);
+		buf += 28;
+		if (window_rows > 1u) {
+			memcpy(buf, ",r=", 3);
+			buf = writeUnsigned(buf + 3, window_rows - 1u);
+		}
+	} else {
+		memcpy(buf, "\033_Ga=f,i=1,r=1,q=2,x=", 21);
+		buf = writeUnsigned(buf + 21, left);
+		memcpy(buf, ",y=", 3);
+		buf = writeUnsigned(buf + 3, top);
+	}
+	memcpy(buf, ",f=24,s=", 8);
+	buf = writeUnsigned(buf + 8, width);
+	memcpy(buf, ",v=", 3);
+	buf = writeUnsigned(buf + 3, height);
+	if (packed) {
+		memcpy(buf, ",o=z", 4);
+		buf += 4;
+	}
+	*buf++ = ',';
+
+	size_t offset = 0;
+	do {
+		const size_t n = len - offset < KITTY_CHUNK ? len - offset : KITTY_CHUNK;
 
-	memset(input_buffer, '\0', INPUT_BUFFER_LEN);
+		buf = reserveOutput(buf, 4u * KITTY_CHUNK / 3u + 16u);
+		if (offset) {
+			memcpy(buf, "\033_G", 3);
+			buf += 3;
+		}
+		*buf++ = 'm';
+		*buf++ = '=';
+		*buf++ = offset + n < len ? '1' : '0';
+		*buf++ = ';';
+		base64(buf, payload + offset, n);
+		buf += (n + 2u) / 3u * 4u;
+		*buf++ = '\033';
+		*buf++ = '\\';
+		offset += n;
+	} while (offset < len);
+
+	return buf;
 }
 
-float getHue(int r, int g, int b)
+/* Writes n sixels of the same bits, repeated with ! where that is shorter */
+char *writeSixels(char *buf, char sixel, unsigned n)
 {
-	float hue;
+	if (n > 3u) {
+		*buf++ = '!';
+		buf = writeUnsigned(buf, n);
+		*buf++ = sixel;
+		return buf;
+	}
+	while (n--)
+		*buf++ = sixel;
+	return buf;
+}
 
-	// Convert RGB to normalized values
-	float R = (float)r / 255;
-	float G = (float)g / 255;
-	float B = (float)b / 255;
+/* Sends the frame as sixels in the top left corner, a band of six rows at
+ * a time and in it one pass a color, between the first and the last pixel
+ * of the color; each color register is the palette index, set as it is
+ * first used. Always the whole frame, as where the terminal puts a sixel
+ * row in a cell isn't known. */
+char *encodeSixel(char *buf)
+{
+	const unsigned width = DOOMGENERIC_RESX, height = DOOMGENERIC_RESY;
+	unsigned char *bits = graphicsBuffer(&graphics_pixels, &graphics_pixels_size, 256u * width);
+	unsigned first[256], last[256];
+	uint8_t used[256];
+	bool defined[256];
+	unsigned band, i, x, y;
 
-	float max = R > G ? (R > B ? R : B) : (G > B ? G : B);
-	float min = R < G ? (R < B ? R : B) : (G < B ? G : B);
+	for (i = 0; i < 256u; i++) {
+		first[i] = width;
+		last[i] = 0;
+		defined[i] = false;
+	}
 
-	float delta = max - min;
+	/* P2=1: the pixels of no color keep theirs */
+	buf = reserveOutput(buf, 40u);
+	memcpy(buf, "\033[1;1H\033P0;1q\"1;1;", 17);
+	buf = writeUnsigned(buf + 17, width);
+	*buf++ = ';';
+	buf = writeUnsigned(buf, height);
 
-	// Calculate hue
-	if (delta == 0) {
-		hue = 0;
-	} else if (max == R) {
-		hue = 60 * ((G - B) / delta);
-	} else if (max == G) {
-		hue = 60 * ((B - R) / delta + 2);
-	} else {
-		hue = 60 * ((R - G) / delta + 4);
+	for (band = 0; band < height; band += 6u) {
+		const unsigned rows = height - band < 6u ? height - band : 6u;
+		unsigned n = 0;
+
+		for (y = 0; y < rows; y++) {
+			const pixel_t *in = frame_pixels + (band + y) * frame_pitch;
+
+			for (x = 0; x < width; x++, in += frame_step) {
+				const uint8_t c = *in;
+
+				if (first[c] > last[c]) {
+					memset(bits + c * width, 0, width);
+					used[n++] = c;
+					first[c] = last[c] = x;
+				} else if (x < first[c]) {
+					first[c] = x;
+				} else if (x > last[c]) {
+					last[c] = x;
+				}
+				bits[c * width + x] |= 1u << y;
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			const uint8_t c = used[i];
+			const unsigned char *row = bits + c * width;
+
+			/* #255;2;100;100;100, the bits and ! before a run */
+			buf = reserveOutput(buf, 24u + 2u * width);
+			*buf++ = '#';
+			buf = writeUnsigned(buf, c);
+			if (!defined[c]) {
+				const uint32_t color = graphicsColor(c);
+
+				memcpy(buf, ";2;", 3);
+				buf = writeUnsigned(buf + 3, ((color >> 16 & 255u) * 100u + 127u) / 255u);
+				*buf++ = ';';
+				buf = writeUnsigned(buf, ((color >> 8 & 255u) * 100u + 127u) / 255u);
+				*buf++ = ';';
+				buf = writeUnsigned(buf, ((color & 255u) * 100u + 127u) / 255u);
+				defined[c] = true;
+			}
+			buf = writeSixels(buf, '?', first[c]);
+			for (x = first[c]; x <= last[c];) {
+				const unsigned char b = row[x];
+				unsigned run = 1;
+
+				while (x + run <= last[c] && row[x + run] == b)
+					run++;
+				buf = writeSixels(buf, '?' + b, run);
+				x += run;
+			}
+			/* back to the start of the band for the next color, or on to
+			 * the next band */
+			*buf++ = i + 1u < n ? '$' : '-';
+			first[c] = width;
+			last[c] = 0;
+		}
 	}
 
-	// Make sure hue is in the range [0, 360)
-	hue = hue < 0 ? hue + 360 : hue;
+	memcpy(buf, "\033\\", 2);
+	return buf + 2;
+}
+#endif
 
-	return hue;
+/* Records the frame now, or hands it to the writer thread with its chunk */
+void castFrame(const char *buf, size_t len)
+{
+#ifndef OS_WINDOWS
+	if (writer_enabled) {
+		cast_text = buf;
+		cast_len = len;
+		return;
+	}
+#endif
+	writeCast(buf, len, grid_width * cell_columns, grid_height + 1u);
 }
 
-float getBrightness(int r, int g, int b)
+/* Writes an output event for the frame, after the header or a resize event
+ * if it comes first or changes size */
+void writeCast(const char *buf, size_t len, unsigned cols, unsigned rows)
 {
-	// Convert RGB to normalized values
-	float R = (float)r / 255;
-	float G = (float)g / 255;
-	float B = (float)b / 255;
+	static const char hex[] = "0123456789abcdef";
+	const double at = (DG_GetTicksUs() - cast_start_us) / 1e6;
+	size_t i;
 
-	// Calculate maximum value among R, G, and B
-	float max = R > G ? (R > B ? R : B) : (G > B ? G : B);
+	if (!cast_cols)
+		fprintf(cast_file, "{\"version\": 2, \"width\": %u, \"height\": %u, \"timestamp\": %lld, \"env\": {\"TERM\": \"xterm-256color\"}}\n",
+			cols, rows, (long long)time(NULL));
+	else if (cols != cast_cols || rows != cast_rows)
+		fprintf(cast_file, "[%.6f, \"r\", \"%ux%u\"]\n", at, cols, rows);
+	cast_cols = cols;
+	cast_rows = rows;
 
-	return max;
+	/* each byte takes up to 6 escaped */
+	if (cast_buffer_size < 6u * len) {
+		cast_buffer_size = 6u * len;
+		cast_buffer = realloc(cast_buffer, cast_buffer_size);
+		CALL(!cast_buffer, "writeCast: realloc error %d");
+	}
+
+	char *out = cast_buffer;
+	for (i = 0; i < len; i++) {
+		const unsigned char c = buf[i];
+
+		if (c == '"' || c == '\\') {
+			*out++ = '\\';
+			*out++ = c;
+		} else if (c < 0x20u) {
+			memcpy(out, "\\u00", 4);
+			out[4] = hex[c >> 4];
+			out[5] = hex[c & 0xfu];
+			out += 6;
+		} else {
+			*out++ = c;
+		}
+	}
+
+	fprintf(cast_file, "[%.6f, \"o\", \"", at);
+	fwrite(cast_buffer, 1, out - cast_buffer, cast_file);
+	fputs("\"]\n", cast_file);
 }
 
-float getSaturation(int r, int g, int b)
+/* Builds, encodes and writes the frame, on the encoder thread with -pipeline */
+void encodeFrame(void)
 {
-	// Convert RGB to normalized values
-	float R = (float)r / 255;
-	float G = (float)g / 255;
-	float B = (float)b / 255;
+	/* fill output buffer, after room for a message header */
+#ifndef OS_WINDOWS
+	const size_t header = websocket_enabled ? WS_HEADER_MAX : 0u;
+#else
+	const size_t header = 0;
+#endif
+	encode_buffer = &output_buffer;
+	encode_buffer_size = &output_buffer_size;
+	char *buf = output_buffer + header;
+	const bool cleared = clear_screen;
+	const uint32_t now = DG_GetTicksMs();
 
-	float max = R > G ? (R > B ? R : B) : (G > B ? G : B);
-	float min = R < G ? (R < B ? R : B) : (G < B ? G : B);
+	/* Clear screen if first frame, or the frame changed size; grid frames
+	 * carry their size instead */
+	if (clear_screen && !cell_grid) {
+		memcpy(buf, "\033[1;1H\033[2J", 10);
+		buf += 10;
+	}
+	clear_screen = false;
 
-	float delta = max - min;
+	/* images are made from the pixels as they are encoded */
+	if (!graphics)
+		buildCells();
 
-	// Calculate saturation
-	if (max == 0) {
-		return 0;
+#ifdef OS_WINDOWS
+	if (console_cells) {
+		const size_t bytes = writeConsoleCells(cleared);
+
+		clearDirty();
+		frame_count++;
+		frame_bytes += bytes;
+		M_StageBytes(bytes);
+		M_FrameEncoded();
+		M_FrameWritten();
+		last_frame_ms = now;
+		return;
+	}
+#endif
+
+	bool keyframe = true;
+#ifndef OS_WINDOWS
+	const bool keyframe_due = spectate_enabled && (frame_count - last_keyframe >= keyframe_interval || replay_need_key);
+#else
+	const bool keyframe_due = false;
+#endif
+
+	bool unchanged;
+	if (graphics) {
+		keyframe = keyframe_due || cleared || !graphics_shown || !delta_enabled || graphics == GRAPHICS_SIXEL;
+		unchanged = !framePixelsDirty();
+	} else if (delta_enabled) {
+		if (hysteresis && prev_cells_valid)
+			holdCells(prev_cells);
+
+		unsigned changed = countChangedCells(prev_cells);
+		scroll_by = 0;
+		if (scroll_enabled && prev_cells_valid && !keyframe_due && changed >= grid_width)
+			changed = findScroll(prev_cells, changed);
+		keyframe = keyframe_due || !prev_cells_valid || changed * 100u > grid_width * grid_height * DELTA_FULL_PERCENT;
+		unchanged = prev_cells_valid && !changed && !scroll_by;
 	} else {
-		return delta / max;
+		const uint64_t hash = hashCells();
+		unchanged = hash == sent_hash;
+		sent_hash = hash;
 	}
-}
 
-char *rgb_to_color(float hue, float sat, float val)
-{
-	if (val > 0.3) {
-		if (sat < 0.5) {
-			return "1;37";
-		}
-		if (hue >= 330 || hue < 30) {
-			return "1;31"; // red
-		} else if (hue >= 30 && hue < 90) {
-			return "1;33"; //yellow
-		} else if (hue >= 90 && hue < 150) {
-			return "1;32"; //green
-		} else if (hue >= 150 && hue < 210) {
-			return "1;36"; //cyan
-		} else if (hue >= 210 && hue < 270) {
-			return "1;34"; //blue
-		} else if (hue >= 270 && hue < 330) {
-			return "1;35"; //magenta
+#ifndef OS_WINDOWS
+	/* until the client has the last frame, it is sent again */
+	if (udp_enabled && udp_acked != udp_frame - 1u)
+		unchanged = false;
+#endif
+
+	/* nothing to send while paused, in a still menu or a still room */
+	if (unchanged && !cleared && !keyframe_due && !status_changed && frame_count
+		&& now - last_sent_ms < IDLE_REFRESH_MS) {
+		clearDirty();
+		frames_unchanged++;
+		last_frame_ms = now;
+		return;
+	}
+	last_sent_ms = now;
+
+	const cell_t *base = keyframe ? NULL : prev_cells;
+#ifndef OS_WINDOWS
+	if (udp_enabled)
+		base = udpBase();
+#endif
+	if (cell_grid) {
+		buf = encodeGrid(buf, base);
+		status_changed = false;
+#ifndef OS_WINDOWS
+	} else if (graphics) {
+		buf = graphics == GRAPHICS_KITTY ? encodeKitty(buf, keyframe) : encodeSixel(buf);
+		graphics_shown = true;
+
+		/* the row below the last is the window's last */
+		if (status_changed || (keyframe && status_text[0])) {
+			buf = writeStatus(buf, status_text);
+			buf = reserveOutput(buf, 4u);
+			memcpy(buf, "\033[0m", 4);
+			buf += 4;
+			status_changed = false;
 		}
+#endif
 	} else {
-		if (sat < 0.5) {
-			return "0;37";
+		if (keyframe) {
+			buf = encodeFull(buf);
+		} else {
+			/* the sequence is at most 35 bytes */
+			if (scroll_by)
+				buf = writeScroll(reserveOutput(buf, 40u));
+			buf = encodeDelta(buf, prev_cells);
 		}
-		if (hue >= 330 || hue < 30) {
-			return "0;31"; // red
-		} else if (hue >= 30 && hue < 90) {
-			return "0;33"; //yellow
-		} else if (hue >= 90 && hue < 150) {
-			return "0;32"; //green
-		} else if (hue >= 150 && hue < 210) {
-			return "0;36"; //cyan
-		} else if (hue >= 210 && hue < 270) {
-			return "0;34"; //blue
-		} else if (hue >= 270 && hue < 330) {
-			return "0;35"; //magenta
+
+		/* between keyframes, only when it has changed */
+		if (status_changed || (keyframe && status_text[0])) {
+			buf = writeStatus(buf, status_text);
+			status_changed = false;
+		}
+
+		if (!mono) {
+			*buf++ = '\033';
+			*buf++ = '[';
+			*buf++ = '0';
+			*buf++ = 'm';
 		}
 	}
-}
+	/* where the rows left the buffer */
+	char *const frame = output_buffer + header;
 
-void DG_DrawFrame()
-{
-	/* Clear screen if first frame */
-	static bool first_frame = true;
-	if (first_frame) {
-		first_frame = false;
-		fputs("\033[1;1H\033[2J", stdout);
+	if (delta_enabled && !graphics) {
+		copyDirtyCells(prev_cells);
+		prev_cells_valid = true;
 	}
+	clearDirty();
 
-	/* fill output buffer */
-	uint32_t color = 0xFFFFFF00;
-	unsigned row, col;
-	struct color_t *pixel = (struct color_t *)DG_ScreenBuffer;
-	char *buf = output_buffer;
-	char buff[3];
-
-	for (row = 0; row < DOOMGENERIC_RESY; row++) {
-		for (col = 0; col < DOOMGENERIC_RESX; col++) {
-			if ((color ^ *(uint32_t *)pixel) & 0x00FFFFFF) {
-				*buf++ = '\033';
-				*buf++ = '[';
-				float hue = getHue(pixel->r, pixel->g, pixel->b);
-				float sat = getSaturation(pixel->r, pixel->g, pixel->b);
-				float val = getBrightness(pixel->r, pixel->g, pixel->b);
-				char *acc = rgb_to_color(hue, sat, val);
-				*buf++ = acc[0];
-				*buf++ = acc[1];
-				*buf++ = acc[2];
-				*buf++ = acc[3];
-				*buf++ = 'm';
-				color = *(uint32_t *)pixel;
-			}
-			char v_char = grad[(pixel->r + pixel->g + pixel->b) * GRAD_LEN / 766u];
-			*buf++ = v_char;
-			*buf++ = v_char;
-			pixel++;
-		}
-		*buf++ = '\n';
+#ifndef OS_WINDOWS
+	if (spectate_enabled) {
+		if (keyframe)
+			last_keyframe = frame_count;
+		spectateFrame(frame, buf - frame, keyframe);
 	}
-	*buf++ = '\033';
-	*buf++ = '[';
-	*buf++ = '0';
-	*buf = 'm';
+#endif
+	if (cast_file)
+		castFrame(frame, buf - frame);
+
+	frame_count++;
+	frame_bytes += buf - frame;
+#ifndef OS_WINDOWS
+	frame_standalone = keyframe;
+	if (onEncoder()) {
+		pipeline_frame_bytes = buf - frame;
+		pipeline_encoded = true;
+	} else
+#endif
+	{
+		M_StageBytes(buf - frame);
+		M_FrameEncoded();
+	}
+	last_frame_ms = now;
+
+#ifndef OS_WINDOWS
+	if (udp_enabled) {
+		sendUdpFrame(frame, buf - frame, base);
+		return;
+	}
+#endif
+	/* anything the engine printed must come out before the frame */
+#ifdef HAVE_ZLIB
+	if (compress_active) {
+		compressEngineOutput();
+		compressOutput(frame, buf - frame, Z_SYNC_FLUSH);
+		writeFrame(output_pending, output_pending_len);
+		return;
+	}
+#endif
+#ifndef OS_WINDOWS
+	if (websocket_enabled || cell_grid || writer_enabled) {
+		sendEngineOutput();
+		const char *message = websocket_enabled ? frameWebSocket(frame, buf - frame, WS_BINARY) : frame;
+		writeFrame(message, buf - message);
+		return;
+	}
+#endif
+	fflush(stdout);
+	writeFrame(frame, buf - frame);
+}
 
-	/* move cursor to top left corner and set bold text*/
-	fputs("\033[;H\033[1m", stdout);
+void DG_DrawFrame()
+{
+#ifndef OS_WINDOWS
+	pipelineWait();
+#endif
+	/* a dropped frame's changes are built with the next one */
+	collectDirtyRects();
+	dots_shown = DG_DotsShown;
+	DG_DotsShown = 0;
+	text_on = text_overlay;
+	if (text_on)
+		collectText();
 
-	/* flush output buffer */
-	CALL_STDOUT(fputs(output_buffer, stdout), "DG_DrawFrame: fputs error %d");
+	if (!outputReady()) {
+		frames_dropped++;
+		D_SessionCount(STAT_DROPPED, 1);
+		M_FrameDropped();
+		return;
+	}
 
-	/* clear output buffer */
-	memset(output_buffer, '\0', buf - output_buffer + 1u);
+	if (DG_SourcePixels) {
+		frame_pixels = DG_SourcePixels;
+		frame_step = DG_SourceStep;
+		frame_pitch = DG_SourcePitch;
+	} else {
+		frame_pixels = DG_ScreenBuffer;
+		frame_step = 1;
+		frame_pitch = DOOMGENERIC_RESX;
+	}
+	frame_dots = DG_Dots;
+#ifndef OS_WINDOWS
+	if (pipeline_enabled) {
+		pipelineStart();
+		return;
+	}
+#endif
+	encodeFrame();
 }
 
 void DG_SleepMs(uint32_t ms)
@@ -314,12 +5145,48 @@ void DG_SleepMs(uint32_t ms)
 #endif
 }
 
-uint32_t DG_GetTicksMs()
+void DG_SleepUntilUs(uint64_t us)
+{
+#ifndef OS_WINDOWS
+	/* keys are read as soon as they come, then it's back to sleep */
+	while (input_open) {
+		const uint64_t now = DG_GetTicksUs();
+		/* the last part of a ms is slept below */
+		const int timeout = now < us ? (us - now) / 1000 : 0;
+		struct pollfd pfd = { .fd = input_fd, .events = POLLIN };
+
+		if (timeout <= 0 || poll(&pfd, 1, timeout) <= 0)
+			break;
+		readInput();
+	}
+#endif
+#if !defined(OS_WINDOWS) && defined(TIMER_ABSTIME)
+	/* an absolute deadline doesn't drift by the time taken to get here */
+	const uint64_t ns = ts_init.tv_nsec + (us % 1000000u) * 1000u;
+	const struct timespec ts = (struct timespec){
+		.tv_sec = ts_init.tv_sec + us / 1000000u + ns / 1000000000u,
+		.tv_nsec = ns % 1000000000u,
+	};
+	while (clock_nanosleep(CLK, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+#else
+	const uint64_t now = DG_GetTicksUs();
+	if (us > now)
+		DG_SleepMs((us - now + 999) / 1000);
+#endif
+}
+
+uint64_t DG_GetTicksUs(void)
 {
 	struct timespec ts;
 	clock_gettime(CLK, &ts);
 
-	return (ts.tv_sec - ts_init.tv_sec) * 1000 + (ts.tv_nsec - ts_init.tv_nsec) / 1000000;
+	return (uint64_t)(ts.tv_sec - ts_init.tv_sec) * 1000000 + (ts.tv_nsec - ts_init.tv_nsec) / 1000;
+}
+
+uint32_t DG_GetTicksMs()
+{
+	return DG_GetTicksUs() / 1000;
 }
 
 char convertToDoomKey(char **buf)
@@ -358,44 +5225,37 @@ char convertToDoomKey(char **buf)
 	}
 }
 
-void DG_ReadInput(void)
+int DG_WaitForInput(void)
 {
-	static char prev_input_buffer[INPUT_BUFFER_LEN];
-	static char raw_input_buffer[INPUT_BUFFER_LEN];
-
-	memcpy(prev_input_buffer, input_buffer, INPUT_BUFFER_LEN);
-	memset(raw_input_buffer, '\0', INPUT_BUFFER_LEN);
-	memset(input_buffer, '\0', INPUT_BUFFER_LEN);
-	memset(event_buffer, '\0', 2u * EVENT_BUFFER_LEN);
-	event_buf_loc = event_buffer;
-#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
-	struct termios oldt, newt;
-
-	/* Disable canonical mode */
-	CALL(tcgetattr(STDIN_FILENO, &oldt), "DG_DrawFrame: tcgetattr error %d");
-	newt = oldt;
-	newt.c_lflag &= ~(ICANON);
-	newt.c_cc[VMIN] = 0;
-	newt.c_cc[VTIME] = 0;
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &newt), "DG_DrawFrame: tcsetattr error %d");
-
-	CALL(read(2, raw_input_buffer, INPUT_BUFFER_LEN - 1u) < 0, "DG_DrawFrame: read error %d");
+#ifdef OS_WINDOWS
+	return WaitForSingleObject(GetStdHandle(STD_INPUT_HANDLE), INFINITE) == WAIT_OBJECT_0;
+#else
+	struct pollfd pfd = { .fd = input_fd, .events = POLLIN };
 
-	CALL(tcsetattr(STDIN_FILENO, TCSANOW, &oldt), "DG_DrawFrame: tcsetattr error %d");
+	while (input_open) {
+		if (poll(&pfd, 1, -1) < 0) {
+			CALL(errno != EINTR, "DG_WaitForInput: poll error %d");
+			continue;
+		}
+		/* a hangup may still leave keys to read */
+		return !(pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) || (pfd.revents & POLLIN);
+	}
+	return 0;
+#endif
+}
 
-	/* Flush input buffer to prevent read of previous unread input */
-	CALL(tcflush(STDIN_FILENO, TCIFLUSH), "DG_DrawFrame: tcflush error %d");
+void DG_ReadInput(void)
+{
+	unsigned key;
+#ifndef OS_WINDOWS
+	/* The terminal is already in raw mode, so this is one read */
+	if (input_open)
+		readInput();
 #else /* defined(OS_WINDOWS) */
+	char raw_input[INPUT_BUFFER_LEN];
 	const HANDLE hInputHandle = GetStdHandle(STD_INPUT_HANDLE);
 	WINDOWS_CALL(hInputHandle == INVALID_HANDLE_VALUE, "DG_ReadInput: %s");
 
-	/* Disable canonical mode */
-	DWORD old_mode, new_mode;
-	WINDOWS_CALL(!GetConsoleMode(hInputHandle, &old_mode), "DG_ReadInput: %s");
-	new_mode = old_mode;
-	new_mode &= ~(ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT);
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, new_mode), "DG_ReadInput: %s");
-
 	DWORD event_cnt;
 	WINDOWS_CALL(!GetNumberOfConsoleInputEvents(hInputHandle, &event_cnt), "DG_ReadInput: %s");
 
@@ -407,63 +5267,27 @@ void DG_ReadInput(void)
 
 		DWORD i;
 		for (i = 0; i < event_cnt; i++) {
-			if (input_records[i].Event.KeyEvent.bKeyDown && input_records[i].EventType == KEY_EVENT) {
-				raw_input_buffer[input_count++] = input_records[i].Event.KeyEvent.uChar.AsciiChar;
-				if (input_count == INPUT_BUFFER_LEN - 1u)
-					break;
-			}
+			if (input_records[i].Event.KeyEvent.bKeyDown && input_records[i].EventType == KEY_EVENT)
+				raw_input[input_count++] = input_records[i].Event.KeyEvent.uChar.AsciiChar;
 		}
 	}
-
-	WINDOWS_CALL(!SetConsoleMode(hInputHandle, old_mode), "DG_ReadInput: %s");
+	raw_input[input_count] = '\0';
+	pressKeys(&terminal_keys, raw_input, DG_GetTicksUs());
 #endif
-	/* create input buffer */
-	char *raw_input_buf_loc = raw_input_buffer;
-	char *input_buf_loc = input_buffer;
-	while (*raw_input_buf_loc)
-		*input_buf_loc++ = convertToDoomKey(&raw_input_buf_loc);
-
-	/* construct event array */
-	int i, j;
-	for (i = 0; input_buffer[i]; i++) {
-		/* skip duplicates */
-		for (j = i + 1; input_buffer[j]; j++) {
-			if (input_buffer[i] == input_buffer[j])
-				goto LBL_CONTINUE_1;
-		}
-
-		/* pressed events */
-		for (j = 0; prev_input_buffer[j]; j++) {
-			if (input_buffer[i] == prev_input_buffer[j])
-				goto LBL_CONTINUE_1;
-		}
-		*event_buf_loc++ = 0x0100 | input_buffer[i];
-
-	LBL_CONTINUE_1:;
-	}
-
-	/* depressed events */
-	for (i = 0; prev_input_buffer[i]; i++) {
-		for (j = 0; input_buffer[j]; j++) {
-			if (prev_input_buffer[i] == input_buffer[j])
-				goto LBL_CONTINUE_2;
-		}
-		*event_buf_loc++ = 0xFF & prev_input_buffer[i];
-
-	LBL_CONTINUE_2:;
-	}
-
-	event_buf_loc = event_buffer;
+	const uint64_t now = DG_GetTicksUs();
+	for (key = 0; key < 256u; key++)
+		if (releaseKey(&terminal_keys, key, now))
+			queueKey(key);
 }
 
 int DG_GetKey(int *pressed, unsigned char *doomKey)
 {
-	if (!*event_buf_loc)
+	if (key_queue_tail == key_queue_head)
 		return 0;
 
-	*pressed = *event_buf_loc >> 8;
-	*doomKey = *event_buf_loc & 0xFF;
-	event_buf_loc++;
+	const uint16_t event = key_queue[key_queue_tail++ % KEY_QUEUE_LEN];
+	*pressed = event >> 8;
+	*doomKey = event & 0xFF;
 	return 1;
 }
 
@@ -471,3 +5295,14 @@ void DG_SetWindowTitle(const char *title)
 {
 	(void)title;
 }
+
+void DG_SetStatusText(const char *text)
+{
+	if (strncmp(status_text, text, sizeof(status_text) - 1u)) {
+#ifndef OS_WINDOWS
+		pipelineWait();
+#endif
+		snprintf(status_text, sizeof(status_text), "%s", text);
+		status_changed = true;
+	}
+}
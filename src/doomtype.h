@@ -55,6 +55,15 @@
 #define PACKEDATTR
 #endif
 
+// Starts loading the memory at p into the cache,
+// for when it is known to be needed soon.
+
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p)
+#endif
+
 // C99 integer types; with gcc we just use this.  Other compilers
 // should add conditional statements that define the C99 types.
 
@@ -24,10 +24,6 @@
  *  public data                                                        *
  *---------------------------------------------------------------------*/
 
-bool net_client_connected = false;
-
-bool drone = false;
-
 /*---------------------------------------------------------------------*
  *  private data                                                       *
  *---------------------------------------------------------------------*/
@@ -97,6 +97,11 @@ static textscreen_t textscreens[] =
 char*	finaletext;
 char*	finaleflat;
 
+// The stage's background drawn out, for F_DrawBackground,
+//  and the stage it is of, -1 for none
+static byte*	backgroundscreen = NULL;
+static int	backgroundstage = -1;
+
 void	F_StartCast (void);
 void	F_CastTicker (void);
 bool F_CastResponder (event_t *ev);
@@ -152,6 +157,7 @@ void F_StartFinale (void)
     
     finalestage = F_STAGE_TEXT;
     finalecount = 0;
+    backgroundstage = -1;
 	
 }
 
@@ -226,36 +232,13 @@ extern	patch_t *hu_font[HU_FONTSIZE];
 
 void F_TextWrite (void)
 {
-    byte*	src;
-    byte*	dest;
-    
-    int		x,y,w;
+    int		w;
     signed int	count;
     char*	ch;
     int		c;
     int		cx;
     int		cy;
     
-    // erase the entire screen to a tiled background
-    src = W_CacheLumpName ( finaleflat , PU_CACHE);
-    dest = I_VideoBuffer;
-	
-    for (y=0 ; y<SCREENHEIGHT ; y++)
-    {
-	for (x=0 ; x<SCREENWIDTH/64 ; x++)
-	{
-	    memcpy (dest, src+((y&63)<<6), 64);
-	    dest += 64;
-	}
-	if (SCREENWIDTH&63)
-	{
-	    memcpy (dest, src+((y&63)<<6), SCREENWIDTH&63);
-	    dest += (SCREENWIDTH&63);
-	}
-    }
-
-    V_MarkRect (0, 0, SCREENWIDTH, SCREENHEIGHT);
-    
     // draw some of the text onto the screen
     cx = 10;
     cy = 10;
@@ -546,9 +529,6 @@ void F_CastDrawer (void)
     bool		flip;
     patch_t*		patch;
     
-    // erase the entire screen to a background
-    V_DrawPatch (0, 0, W_CacheLumpName (DEH_String("BOSSBACK"), PU_CACHE));
-
     F_CastPrint (DEH_String(castorder[castnum].name));
     
     // draw the current frame in the middle of the screen
@@ -696,18 +676,72 @@ static void F_ArtScreenDrawer(void)
     }
 }
 
+//
+// F_DrawBackground
+// Erases the screen to the tiled flat or the cast's background,
+//  which is drawn out once for each stage.
+//
+static void F_DrawBackground (bool refresh)
+{
+    byte*	src;
+    byte*	dest;
+    int		x;
+    int		y;
+
+    if (backgroundstage != finalestage)
+    {
+	if (backgroundscreen == NULL)
+	    backgroundscreen = Z_Malloc(SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);
+
+	if (finalestage == F_STAGE_TEXT)
+	{
+	    src = W_CacheLumpName ( finaleflat , PU_CACHE);
+	    dest = backgroundscreen;
+
+	    for (y=0 ; y<SCREENHEIGHT ; y++)
+	    {
+		for (x=0 ; x<SCREENWIDTH/64 ; x++)
+		{
+		    memcpy (dest, src+((y&63)<<6), 64);
+		    dest += 64;
+		}
+		if (SCREENWIDTH&63)
+		{
+		    memcpy (dest, src+((y&63)<<6), SCREENWIDTH&63);
+		    dest += (SCREENWIDTH&63);
+		}
+	    }
+	}
+	else
+	{
+	    V_UseBuffer (backgroundscreen);
+	    V_DrawPatch (0, 0, W_CacheLumpName (DEH_String("BOSSBACK"), PU_CACHE));
+	    V_RestoreBuffer ();
+	}
+
+	backgroundstage = finalestage;
+	refresh = true;
+    }
+
+    V_DrawBackground (backgroundscreen, refresh);
+}
+
 //
 // F_Drawer
 //
-void F_Drawer (void)
+void F_Drawer (bool refresh)
 {
     switch (finalestage)
     {
         case F_STAGE_CAST:
+            F_DrawBackground(refresh);
             F_CastDrawer();
+            V_EndBackground();
             break;
         case F_STAGE_TEXT:
+            F_DrawBackground(refresh);
             F_TextWrite();
+            V_EndBackground();
             break;
         case F_STAGE_ARTSCREEN:
             F_ArtScreenDrawer();
@@ -33,8 +33,9 @@ bool F_Responder (event_t* ev);
 // Called by main loop.
 void F_Ticker (void);
 
-// Called by main loop.
-void F_Drawer (void);
+// Called by main loop. The text and cast screens are
+// only drawn again where they changed, unless refresh is set.
+void F_Drawer (bool refresh);
 
 
 void F_StartFinale (void);
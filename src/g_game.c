@@ -21,6 +21,13 @@
 #include <stdlib.h>
 #include <math.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "doomdef.h" 
 #include "doomkeys.h"
 #include "doomstat.h"
@@ -35,6 +42,7 @@
 #include "m_misc.h"
 #include "m_menu.h"
 #include "m_random.h"
+#include "m_timing.h"
 #include "i_system.h"
 #include "i_timer.h"
 #include "i_video.h"
@@ -50,6 +58,7 @@
 #include "st_stuff.h"
 #include "am_map.h"
 #include "statdump.h"
+#include "perfdump.h"
 
 // Needs access to LFB.
 #include "v_video.h"
@@ -88,6 +97,9 @@ void	G_DoCompleted (void);
 void	G_DoVictory (void); 
 void	G_DoWorldDone (void); 
 void	G_DoSaveGame (void); 
+static void G_DoRewind (void);
+static void G_TakeSnapshot (void);
+static void G_CheckSaveWrite (bool wait);
  
 // Gamestate the last time G_Ticker was called.
 
@@ -112,6 +124,11 @@ bool         usergame;               // ok to save / end game
 bool         timingdemo;             // if true, exit with report on completion 
 bool         nodrawers;              // for comparative timing purposes 
 int             starttime;          	// for comparative timing purposes  	 
+static int      starttimems;
+static char     *demoresult;            // where -demobatch wants the result
+static FILE     *hashwrite;             // -writehashes: a state hash per tic
+static FILE     *hashcheck;             // -checkhashes: the hashes to match
+static bool     rewinding;              // -rewind: keep snapshots
  
 bool         viewactive; 
  
@@ -128,6 +145,7 @@ int             levelstarttic;          // gametic at level start
 int             totalkills, totalitems, totalsecret;    // for intermission 
  
 char           *demoname;
+char           *defdemoname;            // the lump being played back
 bool         demorecording; 
 bool         longtics;               // cph's doom 1.91 longtics hack
 bool         lowres_turn;            // low resolution turning for longtics
@@ -222,8 +240,6 @@ static bool *joybuttons = &joyarray[1];		// allow [-1]
 static int      savegameslot; 
 static char     savedescription[32]; 
  
-#define	BODYQUESIZE	32
-
 mobj_t*		bodyque[BODYQUESIZE]; 
 int		bodyqueslot; 
  
@@ -330,6 +346,7 @@ void G_BuildTiccmd (ticcmd_t* cmd, int maketic)
     int		side;
 
     memset(cmd, 0, sizeof(ticcmd_t));
+    M_InputTic (maketic);
 
     cmd->consistancy = 
 	consistancy[consoleplayer][maketic%BACKUPTICS]; 
@@ -597,6 +614,94 @@ void G_BuildTiccmd (ticcmd_t* cmd, int maketic)
 } 
  
 
+//
+// G_BuildPlayerTiccmd
+// Builds the ticcmd of another player sharing this game (-coop),
+// from the keys held on their terminal.
+// Only the keyboard controls are read.
+//
+void G_BuildPlayerTiccmd (ticcmd_t* cmd, int player, const byte* keydown, int maketic)
+{
+    static int	playerturnheld[MAXPLAYERS];
+    int		i;
+    int		speed;
+    int		tspeed;
+    int		forward;
+    int		side;
+
+    memset(cmd, 0, sizeof(ticcmd_t));
+
+    cmd->consistancy =
+	consistancy[player][maketic%BACKUPTICS];
+
+    speed = key_speed >= NUMKEYS || keydown[key_speed];
+
+    forward = side = 0;
+
+    // two stage accelerative turning, as for the console player
+    if (keydown[key_right] || keydown[key_left])
+	playerturnheld[player] += ticdup;
+    else
+	playerturnheld[player] = 0;
+
+    if (playerturnheld[player] < SLOWTURNTICS)
+	tspeed = 2;
+    else
+	tspeed = speed;
+
+    if (keydown[key_strafe])
+    {
+	if (keydown[key_right])
+	    side += sidemove[speed];
+	if (keydown[key_left])
+	    side -= sidemove[speed];
+    }
+    else
+    {
+	if (keydown[key_right])
+	    cmd->angleturn -= angleturn[tspeed];
+	if (keydown[key_left])
+	    cmd->angleturn += angleturn[tspeed];
+    }
+
+    if (keydown[key_up])
+	forward += forwardmove[speed];
+    if (keydown[key_down])
+	forward -= forwardmove[speed];
+    if (keydown[key_strafeleft])
+	side -= sidemove[speed];
+    if (keydown[key_straferight])
+	side += sidemove[speed];
+
+    if (keydown[key_fire])
+	cmd->buttons |= BT_ATTACK;
+    if (keydown[key_use])
+	cmd->buttons |= BT_USE;
+
+    for (i=0; i<arrlen(weapon_keys); ++i)
+    {
+	if (keydown[*weapon_keys[i]])
+	{
+	    cmd->buttons |= BT_CHANGE;
+	    cmd->buttons |= i<<BT_WEAPONSHIFT;
+	    break;
+	}
+    }
+
+    if (forward > MAXPLMOVE)
+	forward = MAXPLMOVE;
+    else if (forward < -MAXPLMOVE)
+	forward = -MAXPLMOVE;
+    if (side > MAXPLMOVE)
+	side = MAXPLMOVE;
+    else if (side < -MAXPLMOVE)
+	side = -MAXPLMOVE;
+
+    cmd->forwardmove += forward;
+    cmd->sidemove += side;
+}
+ 
+
 //
 // G_DoLoadLevel 
 //
@@ -653,6 +758,7 @@ void G_DoLoadLevel (void)
     } 
 		 
     P_SetupLevel (gameepisode, gamemap, 0, gameskill);    
+    PerfLevelStart ();
     displayplayer = consoleplayer;		// view the guy you are playing    
     gameaction = ga_nothing; 
     Z_CheckHeap ();
@@ -746,6 +852,17 @@ bool G_Responder (event_t* ev)
 	return true; 
     }
     
+    if (rewinding && gamestate == GS_LEVEL && gameaction == ga_nothing
+     && !demoplayback && !demorecording && !netgame
+     && ev->type == ev_keydown && ev->data1 == key_rewind)
+    {
+	gameaction = ga_rewind;
+	return true;
+    }
+
+    if (G_SeekResponder (ev))
+	return true;
+
     // any other key pops up menu if in demos
     if (gameaction == ga_nothing && !singledemo && 
 	(demoplayback || gamestate == GS_DEMOSCREEN) 
@@ -847,6 +964,84 @@ bool G_Responder (event_t* ev)
  
  
  
+//
+// G_InitStateHashes
+// Opens the files of -writehashes and -checkhashes.
+//
+void G_InitStateHashes (void)
+{
+    int i;
+
+    //!
+    // @arg <file>
+    // @category demo
+    //
+    // Write a hash of the game state to file after every tic
+    // of a level, to check another run against.
+    //
+
+    i = M_CheckParmWithArgs ("-writehashes", 1);
+    if (i > 0)
+    {
+        hashwrite = fopen (myargv[i + 1], "w");
+        if (hashwrite == NULL)
+            I_Error ("G_InitStateHashes: couldn't write %s", myargv[i + 1]);
+    }
+
+    //!
+    // @arg <file>
+    // @category demo
+    //
+    // Compare the game state after every tic of a level with the
+    // hashes written by -writehashes, and stop at the first tic
+    // that differs.
+    //
+
+    i = M_CheckParmWithArgs ("-checkhashes", 1);
+    if (i > 0)
+    {
+        hashcheck = fopen (myargv[i + 1], "r");
+        if (hashcheck == NULL)
+            I_Error ("G_InitStateHashes: couldn't read %s", myargv[i + 1]);
+    }
+}
+
+//
+// G_HashTic
+// Writes or checks the state hash of the tic just run.
+//
+static void G_HashTic (void)
+{
+    unsigned int hash;
+    unsigned int want;
+    int tic;
+
+    hash = P_HashState ();
+
+    if (hashwrite != NULL)
+        fprintf (hashwrite, "%i %08x\n", gametic, hash);
+
+    if (hashcheck != NULL)
+    {
+        if (fscanf (hashcheck, "%i %x", &tic, &want) != 2)
+        {
+            printf ("G_HashTic: no more hashes to check after tic %i\n",
+                    gametic);
+            fclose (hashcheck);
+            hashcheck = NULL;
+            return;
+        }
+
+        if (tic != gametic || want != hash)
+        {
+            I_Error ("G_HashTic: game state differs at tic %i "
+                     "(episode %i map %i, leveltime %i): %08x should be %08x",
+                     gametic, gameepisode, gamemap, leveltime,
+                     hash, want);
+        }
+    }
+}
+
 //
 // G_Ticker
 // Make ticcmd_ts for the players.
@@ -862,6 +1057,9 @@ void G_Ticker (void)
 	if (playeringame[i] && players[i].playerstate == PST_REBORN) 
 	    G_DoReborn (i);
     
+    // tell of a save once it's written
+    G_CheckSaveWrite (false);
+
     // do things to change the game state
     while (gameaction != ga_nothing) 
     { 
@@ -896,6 +1094,12 @@ void G_Ticker (void)
             players[consoleplayer].message = DEH_String("screen shot");
 	    gameaction = ga_nothing; 
 	    break; 
+	  case ga_rewind: 
+	    G_DoRewind (); 
+	    break; 
+	  case ga_seek: 
+	    G_DoSeek (); 
+	    break; 
 	  case ga_nothing: 
 	    break; 
 	} 
@@ -1009,6 +1213,11 @@ void G_Ticker (void)
 	ST_Ticker (); 
 	AM_Ticker (); 
 	HU_Ticker ();            
+	if (hashwrite != NULL || hashcheck != NULL)
+	    G_HashTic ();
+	if (rewinding && !paused && leveltime % TICRATE == 0
+	 && !demoplayback && !demorecording && !netgame)
+	    G_TakeSnapshot ();
 	break; 
 	 
       case GS_INTERMISSION: 
@@ -1023,6 +1232,8 @@ void G_Ticker (void)
 	D_PageTicker (); 
 	break;
     }        
+
+    G_SeekTicker ();
 } 
  
  
@@ -1483,6 +1694,10 @@ void G_DoCompleted (void)
     automapactive = false; 
 
     StatCopy(&wminfo);
+    PerfLevelEnd ();
+
+    // read the next level in while the stats are up
+    P_PrefetchLevel (gameepisode, wminfo.next + 1);
  
     WI_Start (&wminfo); 
 } 
@@ -1545,26 +1760,19 @@ void G_LoadGame (char* name)
 #define VERSIONSIZE		16 
 
 
-void G_DoLoadGame (void) 
+//
+// G_UnArchiveState
+// Loads a game archived in length bytes at buffer,
+//  from a file or a snapshot.
+//
+bool G_UnArchiveState (byte *buffer, int length)
 {
     int savedleveltime;
-	 
-    gameaction = ga_nothing; 
-	 
-    save_stream = fopen(savename, "rb");
-
-    if (save_stream == NULL)
-    {
-    	return;
-    }
 
-    savegame_error = false;
+    P_ReadSaveBuffer (buffer, length);
 
     if (!P_ReadSaveGameHeader())
-    {
-        fclose(save_stream);
-        return;
-    }
+        return false;
 
     savedleveltime = leveltime;
     
@@ -1582,16 +1790,62 @@ void G_DoLoadGame (void)
     if (!P_ReadSaveGameEOF())
 	I_Error ("Bad savegame");
 
-    fclose(save_stream);
-    
     if (setsizeneeded)
     	R_ExecuteSetViewSize ();
     
     // draw the pattern into the back screen
     R_FillBackScreen (); 
+
+    return true;
+}
+
+void G_DoLoadGame (void) 
+{
+    byte *buffer;
+    int length;
+	 
+    gameaction = ga_nothing; 
+
+    // the save may still be being written
+    G_CheckSaveWrite (true);
+	 
+    if (!M_FileExists(savename))
+    {
+    	return;
+    }
+
+    length = M_ReadFile(savename, &buffer);
+
+    G_UnArchiveState(buffer, length);
+
+    Z_Free(buffer);
 } 
  
 
+//
+// G_ArchiveState
+// Archives the game into memory, as it would be saved. The
+//  buffer returned is reused by the next save or snapshot.
+//
+byte *G_ArchiveState (char *description, int *length)
+{
+    P_StartSaveBuffer();
+
+    P_WriteSaveGameHeader(description);
+ 
+    P_ArchivePlayers (); 
+    P_ArchiveWorld (); 
+    P_ArchiveThinkers (); 
+    P_ArchiveSpecials (); 
+	 
+    P_WriteSaveGameEOF();
+
+    *length = save_p - save_buffer;
+
+    return save_buffer;
+}
+
+
 //
 // G_SaveGame
 // Called by the menu task.
@@ -1607,84 +1861,286 @@ G_SaveGame
     sendsave = true;
 }
 
+//
+// Savegame writer
+// The game is archived into memory at once, and the files are
+//  written by a thread while the game goes on. One save is
+//  written at a time.
+//
+typedef enum
+{
+    sw_idle,
+    sw_writing,
+    sw_written,		// to the slot's file
+    sw_recovered,	// only to the recovery file
+    sw_failed
+} savewrite_t;
+
+static savewrite_t	savewritestate;
+static byte		*savewritebuf;
+static int		savewritesize;
+static int		savewritelength;
+static char		*savewritefile;
+static char		*savewritetemp;
+static char		*savewriterecovery;
+static int		savewriteslot;
+static char		savewritedesc[SAVESTRINGSIZE];
+
+#ifndef _WIN32
+static bool		savewritejoin;		// the thread is yet to be joined
+static pthread_t	savewritethread;
+static pthread_mutex_t	savewritelock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// Writes the archived game out. Runs in the writer thread,
+//  so it mustn't touch the zone or anything the game does.
+
+static void G_WriteSaveFile (void)
+{
+    savewrite_t result;
+
+    // We write to a temporary file and then rename it if it was
+    // successfully written. This prevents an existing savegame
+    // from being overwritten by a corrupted one, and rename
+    // replaces the old savegame in one step.
+
+    if (M_WriteFile (savewritetemp, savewritebuf, savewritelength))
+    {
+#ifdef _WIN32
+        remove (savewritefile);
+#endif
+        rename (savewritetemp, savewritefile);
+        result = sw_written;
+    }
+    // Failed to save the game, so we're going to have to abort. But
+    // to be nice, save to somewhere else first.
+    else if (M_WriteFile (savewriterecovery, savewritebuf, savewritelength))
+        result = sw_recovered;
+    else
+        result = sw_failed;
+
+#ifndef _WIN32
+    pthread_mutex_lock (&savewritelock);
+#endif
+    savewritestate = result;
+#ifndef _WIN32
+    pthread_mutex_unlock (&savewritelock);
+#endif
+}
+
+#ifndef _WIN32
+static void *G_SaveWriteThread (void *arg)
+{
+    G_WriteSaveFile ();
+    return NULL;
+}
+#endif
+
+//
+// G_CheckSaveWrite
+// Reports on the save being written once it's done. If wait
+//  is set, waits for it first.
+//
+static void G_CheckSaveWrite (bool wait)
+{
+    savewrite_t state;
+
+#ifndef _WIN32
+    if (savewritejoin)
+    {
+	if (!wait)
+	{
+	    pthread_mutex_lock (&savewritelock);
+	    state = savewritestate;
+	    pthread_mutex_unlock (&savewritelock);
+
+	    if (state == sw_writing)
+		return;
+	}
+
+	pthread_join (savewritethread, NULL);
+	savewritejoin = false;
+    }
+#endif
+
+    state = savewritestate;
+    if (state == sw_idle)
+	return;
+
+    savewritestate = sw_idle;
+
+    if (state == sw_failed)
+    {
+        I_Error ("Failed to open either '%s' or '%s' to write savegame.",
+                 savewritetemp, savewriterecovery);
+    }
+
+    if (state == sw_recovered)
+    {
+        // We failed to save to the normal location, but we wrote a
+        // recovery file to the temp directory. Now we can bomb out
+        // with an error.
+        I_Error ("Failed to open savegame file '%s' for writing.\n"
+                 "But your game has been saved to '%s' for recovery.",
+                 savewritetemp, savewriterecovery);
+    }
+
+    M_SaveGameWritten (savewriteslot, savewritedesc);
+
+    players[consoleplayer].message = DEH_String(GGSAVED);
+}
+
+// Saves are finished before quitting.
+
+static void G_FinishSaveWrite (void)
+{
+    G_CheckSaveWrite (true);
+}
+
 void G_DoSaveGame (void) 
 { 
-    char *savegame_file;
-    char *temp_savegame_file;
-    char *recovery_savegame_file;
-
-    recovery_savegame_file = NULL;
-    temp_savegame_file = P_TempSaveGameFile();
-    savegame_file = P_SaveGameFile(savegameslot);
-
-    // Open the savegame file for writing.  We write to a temporary file
-    // and then rename it at the end if it was successfully written.
-    // This prevents an existing savegame from being overwritten by 
-    // a corrupted one, or if a savegame buffer overrun occurs.
-    save_stream = fopen(temp_savegame_file, "wb");
-
-    if (save_stream == NULL)
-    {
-        // Failed to save the game, so we're going to have to abort. But
-        // to be nice, save to somewhere else before we call I_Error().
-        recovery_savegame_file = M_TempFile("recovery.dsg");
-        save_stream = fopen(recovery_savegame_file, "wb");
-        if (save_stream == NULL)
-        {
-            I_Error("Failed to open either '%s' or '%s' to write savegame.",
-                    temp_savegame_file, recovery_savegame_file);
-        }
-    }
+    static bool exithooked;
+    byte *buffer;
+    int length;
 
-    savegame_error = false;
+    // one save at a time
+    G_CheckSaveWrite (true);
 
-    P_WriteSaveGameHeader(savedescription);
- 
-    P_ArchivePlayers (); 
-    P_ArchiveWorld (); 
-    P_ArchiveThinkers (); 
-    P_ArchiveSpecials (); 
-	 
-    P_WriteSaveGameEOF();
+    buffer = G_ArchiveState(savedescription, &length);
 	 
     // Enforce the same savegame size limit as in Vanilla Doom, 
     // except if the vanilla_savegame_limit setting is turned off.
 
-    if (vanilla_savegame_limit && ftell(save_stream) > SAVEGAMESIZE)
+    if (vanilla_savegame_limit && length > SAVEGAMESIZE)
     {
         I_Error ("Savegame buffer overrun");
     }
-    
-    // Finish up, close the savegame file.
 
-    fclose(save_stream);
+    // The archive buffer is reused by -rewind, so the
+    // writer gets a copy.
 
-    if (recovery_savegame_file != NULL)
+    if (savewritesize < length)
     {
-        // We failed to save to the normal location, but we wrote a
-        // recovery file to the temp directory. Now we can bomb out
-        // with an error.
-        I_Error("Failed to open savegame file '%s' for writing.\n"
-                "But your game has been saved to '%s' for recovery.",
-                temp_savegame_file, recovery_savegame_file);
+        savewritesize = length + length / 4;
+        savewritebuf = realloc (savewritebuf, savewritesize);
+        if (savewritebuf == NULL)
+            I_Error ("G_DoSaveGame: out of memory");
     }
 
-    // Now rename the temporary savegame file to the actual savegame
-    // file, overwriting the old savegame if there was one there.
+    memcpy (savewritebuf, buffer, length);
+    savewritelength = length;
 
-    remove(savegame_file);
-    rename(temp_savegame_file, savegame_file);
+    free (savewritefile);
+    savewritefile = M_StringDuplicate (P_SaveGameFile(savegameslot));
+    savewritetemp = P_TempSaveGameFile();
+    savewriteslot = savegameslot;
+    M_StringCopy (savewritedesc, savedescription, sizeof(savewritedesc));
+    if (savewriterecovery == NULL)
+        savewriterecovery = M_TempFile("recovery.dsg");
+
+    if (!exithooked)
+    {
+        I_AtExit (G_FinishSaveWrite, false);
+        exithooked = true;
+    }
+
+    savewritestate = sw_writing;
+
+#ifndef _WIN32
+    savewritejoin = !pthread_create (&savewritethread, NULL,
+                                     G_SaveWriteThread, NULL);
+    if (!savewritejoin)
+#endif
+    {
+        // no thread, so write it now
+        G_WriteSaveFile ();
+        G_CheckSaveWrite (true);
+    }
     
     gameaction = ga_nothing;
     M_StringCopy(savedescription, "", sizeof(savedescription));
 
-    players[consoleplayer].message = DEH_String(GGSAVED);
-
     // draw the pattern into the back screen
     R_FillBackScreen ();	
 } 
  
 
+//
+// G_TakeSnapshot
+// Keeps the game of every second in a ring for -rewind.
+//
+#define NUMSNAPSHOTS	10
+
+typedef struct
+{
+    byte	*data;
+    int		length;
+    int		size;
+} snapshot_t;
+
+static snapshot_t	snapshots[NUMSNAPSHOTS];
+static int		snapshothead;		// where the next one goes
+static int		numsnapshots;
+
+//
+// G_InitRewind
+//
+void G_InitRewind (void)
+{
+    //!
+    // Keep the game of each of the last ten seconds in memory, and
+    // go back a second each time the rewind key is pressed.
+    // Ignored while recording or playing back demos and in netgames.
+    //
+
+    rewinding = M_CheckParm ("-rewind") > 0;
+}
+
+static void G_TakeSnapshot (void)
+{
+    snapshot_t	*snap;
+    byte	*buffer;
+    int		length;
+
+    buffer = G_ArchiveState ("", &length);
+
+    snap = &snapshots[snapshothead];
+    if (snap->size < length)
+    {
+	snap->size = length + length / 4;
+	snap->data = realloc (snap->data, snap->size);
+	if (snap->data == NULL)
+	    I_Error ("G_TakeSnapshot: out of memory");
+    }
+
+    memcpy (snap->data, buffer, length);
+    snap->length = length;
+
+    snapshothead = (snapshothead + 1) % NUMSNAPSHOTS;
+    if (numsnapshots < NUMSNAPSHOTS)
+	numsnapshots++;
+}
+
+//
+// G_DoRewind
+// Goes back to the latest snapshot, and forgets it,
+//  so each rewind goes a second further back.
+//
+static void G_DoRewind (void)
+{
+    gameaction = ga_nothing;
+
+    if (numsnapshots == 0)
+	return;
+
+    snapshothead = (snapshothead + NUMSNAPSHOTS - 1) % NUMSNAPSHOTS;
+    numsnapshots--;
+
+    G_UnArchiveState (snapshots[snapshothead].data,
+		      snapshots[snapshothead].length);
+}
+
+
 //
 // G_InitNew
 // Can be called by the startup code or the menu task,
@@ -1893,11 +2349,152 @@ G_InitNew
 // DEMO RECORDING 
 // 
 #define DEMOMARKER		0x80
+#define DEMOCHUNKSIZE		0x1000
+
+//
+// Demo files
+// A demo played from a file of its own is mapped instead of
+//  loaded into the zone, so it starts at once and only the
+//  pages being played need to be in memory. Windows reads it
+//  a chunk at a time instead.
+//
+#ifndef _WIN32
+static byte		*demomap;
+static size_t		demomaplength;
+#else
+static FILE		*demoreadfile;
+
+// Keeps the unread part of the demo in the buffer and
+//  reads more after it.
+
+static void G_RefillDemo (void)
+{
+    int		left;
+
+    left = demoend - demo_p;
+    memmove (demobuffer, demo_p, left);
+    demo_p = demobuffer;
+    demoend = demobuffer + left;
+    demoend += fread (demoend, 1, DEMOCHUNKSIZE - left, demoreadfile);
+}
+#endif
+
+static void G_OpenDemo (void)
+{
+    lumpinfo_t	*lump;
+
+    lump = &lumpinfo[W_GetNumForName (defdemoname)];
+
+    // the whole file is the lump
+    if (lump->position == 0 && lump->size > 0
+     && lump->size == lump->wad_file->length)
+    {
+#ifndef _WIN32
+	int	fd;
+
+	fd = open (lump->wad_file->path, O_RDONLY);
+	if (fd >= 0)
+	{
+	    demomap = mmap (NULL, lump->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    close (fd);
+
+	    if (demomap != MAP_FAILED)
+	    {
+		madvise (demomap, lump->size, MADV_SEQUENTIAL);
+		demomaplength = lump->size;
+		demobuffer = demo_p = demomap;
+		demoend = demobuffer + demomaplength;
+		return;
+	    }
+
+	    demomap = NULL;
+	}
+#else
+	demoreadfile = fopen (lump->wad_file->path, "rb");
+	if (demoreadfile != NULL)
+	{
+	    demobuffer = demo_p = demoend
+		= Z_Malloc (DEMOCHUNKSIZE, PU_STATIC, NULL);
+	    G_RefillDemo ();
+	    return;
+	}
+#endif
+    }
+
+    demobuffer = demo_p = W_CacheLumpName (defdemoname, PU_STATIC); 
+    demoend = demobuffer + W_LumpLength (lump - lumpinfo);
+}
+
+static void G_CloseDemo (void)
+{
+#ifndef _WIN32
+    if (demomap != NULL)
+    {
+	munmap (demomap, demomaplength);
+	demomap = NULL;
+	return;
+    }
+#else
+    if (demoreadfile != NULL)
+    {
+	fclose (demoreadfile);
+	demoreadfile = NULL;
+	Z_Free (demobuffer);
+	return;
+    }
+#endif
+
+    W_ReleaseLumpName (defdemoname);
+}
+
+//
+// G_DemoPosition
+// Where the next ticcmd is, from the start of the demo.
+//
+long G_DemoPosition (void)
+{
+#ifdef _WIN32
+    if (demoreadfile != NULL)
+	return ftell (demoreadfile) - (demoend - demo_p);
+#endif
+
+    return demo_p - demobuffer;
+}
+
+//
+// G_SetDemoPosition
+//
+bool G_SetDemoPosition (long position)
+{
+#ifdef _WIN32
+    if (demoreadfile != NULL)
+    {
+	if (fseek (demoreadfile, position, SEEK_SET) != 0)
+	    return false;
+
+	demo_p = demoend = demobuffer;
+	G_RefillDemo ();
+	return true;
+    }
+#endif
+
+    if (position < 0 || position > demoend - demobuffer)
+	return false;
+
+    demo_p = demobuffer + position;
+    return true;
+}
 
 
 void G_ReadDemoTiccmd (ticcmd_t* cmd) 
 { 
-    if (*demo_p == DEMOMARKER) 
+#ifdef _WIN32
+    if (demoreadfile != NULL && demoend - demo_p < 8)
+	G_RefillDemo ();
+#endif
+
+    // a demo cut short ends where its data does
+    if (demo_p >= demoend || *demo_p == DEMOMARKER) 
     {
 	// end of demo data stream 
 	G_CheckDemoStatus (); 
@@ -1953,6 +2550,148 @@ static void IncreaseDemoBuffer(void)
     demoend = demobuffer + new_length;
 }
 
+//
+// Demo streaming
+// With -streamdemo, the tics are written out every second by
+//  a thread, from two small buffers taking turns, so a demo
+//  can be as long as it likes without growing, and only the
+//  last second is lost if the game dies.
+//
+static FILE		*demostream;
+static byte		*demochunks[2];
+static int		demochunk;		// the one being filled
+static int		demostreamtics;		// tics in it
+static bool		demostreamfailed;
+
+#ifndef _WIN32
+static bool		demowritethreaded;
+static pthread_t	demowritethread;
+static pthread_mutex_t	demowritelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	demowritecond = PTHREAD_COND_INITIALIZER;
+static byte		*demowritebuf;		// the chunk to write, if any
+static int		demowritelength;
+static bool		demowriteend;
+#endif
+
+// Appends a chunk to the file. The end marker is taken off
+//  and put back after the new tics, so the file always
+//  holds a whole demo.
+
+static void G_WriteDemoChunk (byte *buf, int length)
+{
+    if (ftell (demostream) > 0)
+	fseek (demostream, -1, SEEK_END);
+
+    if (fwrite (buf, 1, length, demostream) < length
+     || fputc (DEMOMARKER, demostream) == EOF
+     || fflush (demostream) != 0)
+	demostreamfailed = true;
+}
+
+#ifndef _WIN32
+static void *G_DemoWriteThread (void *arg)
+{
+    pthread_mutex_lock (&demowritelock);
+
+    for (;;)
+    {
+	while (demowritebuf == NULL && !demowriteend)
+	    pthread_cond_wait (&demowritecond, &demowritelock);
+
+	if (demowritebuf == NULL)
+	    break;
+
+	pthread_mutex_unlock (&demowritelock);
+	G_WriteDemoChunk (demowritebuf, demowritelength);
+	pthread_mutex_lock (&demowritelock);
+
+	demowritebuf = NULL;
+	pthread_cond_broadcast (&demowritecond);
+    }
+
+    pthread_mutex_unlock (&demowritelock);
+
+    return NULL;
+}
+#endif
+
+//
+// G_FlushDemoStream
+// Hands the tics so far to the writer, and goes on
+//  in the other buffer.
+//
+static void G_FlushDemoStream (void)
+{
+#ifndef _WIN32
+    if (demowritethreaded)
+    {
+	pthread_mutex_lock (&demowritelock);
+	while (demowritebuf != NULL)
+	    pthread_cond_wait (&demowritecond, &demowritelock);
+	demowritebuf = demobuffer;
+	demowritelength = demo_p - demobuffer;
+	pthread_cond_broadcast (&demowritecond);
+	pthread_mutex_unlock (&demowritelock);
+    }
+    else
+#endif
+	G_WriteDemoChunk (demobuffer, demo_p - demobuffer);
+
+    demochunk ^= 1;
+    demobuffer = demo_p = demochunks[demochunk];
+    demoend = demobuffer + DEMOCHUNKSIZE;
+    demostreamtics = 0;
+}
+
+//
+// G_EndDemoStream
+// Writes the rest of the demo and closes it. Also run on
+//  I_Error, so a demo that ends that way is kept.
+//
+static void G_EndDemoStream (void)
+{
+    if (demostream == NULL)
+	return;
+
+    G_FlushDemoStream ();
+
+#ifndef _WIN32
+    if (demowritethreaded)
+    {
+	pthread_mutex_lock (&demowritelock);
+	demowriteend = true;
+	pthread_cond_broadcast (&demowritecond);
+	pthread_mutex_unlock (&demowritelock);
+	pthread_join (demowritethread, NULL);
+	demowritethreaded = false;
+    }
+#endif
+
+    fclose (demostream);
+    demostream = NULL;
+}
+
+static void G_StartDemoStream (void)
+{
+    demostream = fopen (demoname, "wb");
+    if (demostream == NULL)
+	I_Error ("G_StartDemoStream: couldn't write %s", demoname);
+
+    demochunks[0] = Z_Malloc (DEMOCHUNKSIZE, PU_STATIC, NULL);
+    demochunks[1] = Z_Malloc (DEMOCHUNKSIZE, PU_STATIC, NULL);
+    demochunk = 0;
+    demobuffer = demochunks[0];
+    demoend = demobuffer + DEMOCHUNKSIZE;
+
+#ifndef _WIN32
+    // without a thread, the chunks are written as they fill
+    demowritethreaded = !pthread_create (&demowritethread, NULL,
+					 G_DemoWriteThread, NULL);
+#endif
+
+    I_AtExit (G_EndDemoStream, true);
+}
+
 void G_WriteDemoTiccmd (ticcmd_t* cmd) 
 { 
     byte *demo_start;
@@ -1960,6 +2699,14 @@ void G_WriteDemoTiccmd (ticcmd_t* cmd)
     if (gamekeydown[key_demo_quit])           // press q to end demo recording 
 	G_CheckDemoStatus (); 
 
+    if (demostream != NULL
+     && (demostreamtics == TICRATE || demo_p > demoend - 16))
+    {
+	G_FlushDemoStream ();
+	if (demostreamfailed)
+	    I_Error ("G_WriteDemoTiccmd: error writing %s", demoname);
+    }
+
     demo_start = demo_p;
 
     *demo_p++ = cmd->forwardmove; 
@@ -1982,7 +2729,12 @@ void G_WriteDemoTiccmd (ticcmd_t* cmd)
     // reset demo pointer back
     demo_p = demo_start;
 
-    if (demo_p > demoend - 16)
+    if (demostream != NULL)
+    {
+        // always room, as it was flushed above
+        demostreamtics++;
+    }
+    else if (demo_p > demoend - 16)
     {
         if (vanilla_demo_limit)
         {
@@ -2030,8 +2782,24 @@ void G_RecordDemo (char *name)
     i = M_CheckParmWithArgs("-maxdemo", 1);
     if (i)
 	maxsize = atoi(myargv[i+1])*1024;
-    demobuffer = Z_Malloc (maxsize,PU_STATIC,NULL); 
-    demoend = demobuffer + maxsize;
+
+    //!
+    // @category demo
+    //
+    // Write the demo to its file every second as it is recorded,
+    // instead of keeping it all in memory until the end. There
+    // is no limit to its length.
+    //
+
+    if (M_CheckParm ("-streamdemo"))
+    {
+	G_StartDemoStream ();
+    }
+    else
+    {
+	demobuffer = Z_Malloc (maxsize,PU_STATIC,NULL); 
+	demoend = demobuffer + maxsize;
+    }
 	
     demorecording = true; 
 } 
@@ -2102,8 +2870,6 @@ void G_BeginRecording (void)
 // G_PlayDemo 
 //
 
-char*	defdemoname; 
- 
 void G_DeferedPlayDemo (char* name) 
 { 
     defdemoname = name; 
@@ -2156,7 +2922,7 @@ void G_DoPlayDemo (void)
     int demoversion;
 	 
     gameaction = ga_nothing; 
-    demobuffer = demo_p = W_CacheLumpName (defdemoname, PU_STATIC); 
+    G_OpenDemo ();
 
     demoversion = *demo_p++;
 
@@ -2209,9 +2975,15 @@ void G_DoPlayDemo (void)
     G_InitNew (skill, episode, map); 
     precache = true; 
     starttime = I_GetTime (); 
+    starttimems = I_GetTimeMS ();
+
+    if (timingdemo)
+        M_StartStageTiming ();
 
     usergame = false; 
     demoplayback = true; 
+
+    G_StartSeek ();
 } 
 
 //
@@ -2219,14 +2991,25 @@ void G_DoPlayDemo (void)
 //
 void G_TimeDemo (char* name) 
 {
+    int i;
+
     //!
     // @vanilla 
     //
-    // Disable rendering the screen entirely.
+    // Disable rendering the screen entirely. The terminal
+    // isn't read or written either, so the demo only runs
+    // the playsim, and the exact tics per second are
+    // printed at the end.
     //
 
     nodrawers = M_CheckParm ("-nodraw"); 
 
+    // Written for the runs of -demobatch: the tics, time,
+    // level and state hash at the end of the demo.
+    i = M_CheckParmWithArgs ("-demoresult", 1);
+    if (i > 0)
+        demoresult = myargv[i + 1];
+
     timingdemo = true; 
     singletics = true; 
 
@@ -2253,6 +3036,7 @@ bool G_CheckDemoStatus (void)
     { 
         float fps;
         int realtics;
+        int ms;
 
 	endtime = I_GetTime (); 
         realtics = endtime - starttime;
@@ -2262,13 +3046,42 @@ bool G_CheckDemoStatus (void)
         timingdemo = false;
         demoplayback = false;
 
+        ms = I_GetTimeMS () - starttimems;
+
+        // the tics are too short to time one by one
+        //  without anything drawn
+        if (nodrawers)
+        {
+            printf ("G_CheckDemoStatus: %i gametics in %i ms (%f tics/sec)\n",
+                    gametic, ms, ms > 0 ? gametic * 1000.0 / ms : 0.0);
+        }
+
+        M_PrintStageTimes ();
+
+        if (demoresult != NULL)
+        {
+            FILE *f = fopen (demoresult, "w");
+
+            if (f != NULL)
+            {
+                if (gamemode == commercial)
+                    fprintf (f, "%i %i MAP%02i %08x\n", gametic, ms,
+                             gamemap, P_HashState ());
+                else
+                    fprintf (f, "%i %i E%iM%i %08x\n", gametic, ms,
+                             gameepisode, gamemap, P_HashState ());
+                fclose (f);
+            }
+        }
+
 	I_Error ("timed %i gametics in %i realtics (%f fps)",
                  gametic, realtics, fps);
     } 
 	 
     if (demoplayback) 
     { 
-        W_ReleaseLumpName(defdemoname);
+        G_CloseDemo ();
+        G_EndSeek ();
 	demoplayback = false; 
 	netdemo = false;
 	netgame = false;
@@ -2289,9 +3102,18 @@ bool G_CheckDemoStatus (void)
  
     if (demorecording) 
     { 
-	*demo_p++ = DEMOMARKER; 
-	M_WriteFile (demoname, demobuffer, demo_p - demobuffer); 
-	Z_Free (demobuffer); 
+	if (demostream != NULL)
+	{
+	    G_EndDemoStream ();
+	    if (demostreamfailed)
+		I_Error ("G_CheckDemoStatus: error writing %s", demoname);
+	}
+	else
+	{
+	    *demo_p++ = DEMOMARKER; 
+	    M_WriteFile (demoname, demobuffer, demo_p - demobuffer); 
+	    Z_Free (demobuffer); 
+	}
 	demorecording = false; 
 	I_Error ("Demo %s recorded",demoname); 
     } 
@@ -45,6 +45,11 @@ void G_LoadGame (char* name);
 
 void G_DoLoadGame (void);
 
+// Archives the game into memory, or loads one archived there,
+// as the savegame code would. Used by -rewind, and for checkpoints.
+byte *G_ArchiveState (char *description, int *length);
+bool G_UnArchiveState (byte *buffer, int length);
+
 // Called by M_Responder.
 void G_SaveGame (int slot, char* description);
 
@@ -57,6 +62,24 @@ void G_PlayDemo (char* name);
 void G_TimeDemo (char* name);
 bool G_CheckDemoStatus (void);
 
+// Opens the per tic state hashes of -writehashes and -checkhashes.
+void G_InitStateHashes (void);
+
+// Starts the snapshots of -rewind.
+void G_InitRewind (void);
+
+// Where a demo being played is, and going somewhere else in it.
+long G_DemoPosition (void);
+bool G_SetDemoPosition (long position);
+
+// The keyframes of -seekindex, and seeking in demos with them.
+void G_InitSeek (void);
+void G_StartSeek (void);
+void G_EndSeek (void);
+void G_SeekTicker (void);
+bool G_SeekResponder (event_t* ev);
+void G_DoSeek (void);
+
 void G_ExitLevel (void);
 void G_SecretExitLevel (void);
 
@@ -66,6 +89,11 @@ void G_WorldDone (void);
 
 void G_BuildTiccmd (ticcmd_t *cmd, int maketic); 
 
+// Build the movement command of a player on another terminal (-coop),
+// from the keys held there.
+
+void G_BuildPlayerTiccmd (ticcmd_t *cmd, int player, const byte *keydown, int maketic);
+
 void G_Ticker (void);
 bool G_Responder (event_t*	ev);
 
@@ -0,0 +1,490 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Seeking in demos.
+//	With -seekindex n, the game is archived every n seconds
+//	of a demo, with what a savegame leaves out that the demo
+//	needs to play on the same, to an index beside the demo.
+//	With the index there, -demoseek and the seek keys load
+//	the last of these keyframes before the tic wanted, and
+//	play the rest of the way to it without drawing.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+
+#include "d_event.h"
+#include "d_loop.h"
+#include "d_main.h"
+#include "g_game.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "m_controls.h"
+#include "m_misc.h"
+#include "p_saveg.h"
+#include "p_tick.h"
+#include "w_wad.h"
+
+
+#define SEEK_MAGIC		"DSIX"
+#define SEEK_VERSION		1
+#define SEEK_HEADER		(4 + 1 + 4 + 4)
+#define SEEK_RECORD		(5 * 4)
+
+// How far a seek key goes
+#define SEEK_STEP		(10 * TICRATE)
+
+typedef struct
+{
+    int		tic;		// of the demo, once it has run
+    long	position;	// of the next ticcmd in the demo
+    unsigned	hash;		// P_HashState then
+    bool	paused;
+    long	offset;		// of the archive in the index
+    int		length;
+} keyframe_t;
+
+extern char*	defdemoname;
+
+static int		seekinterval;		// -seekindex, in tics
+static int		demoseek = -1;		// -demoseek
+
+static FILE*		seekfile;
+static char*		seekpath;
+static bool		seekwriting;
+
+static keyframe_t*	keyframes;
+static int		numkeyframes;
+static int		maxkeyframes;
+
+static int		demotic;		// tics of the demo run
+static int		seektarget;
+static int		nextkeyframe;		// the tic to write one at
+static int		nextcheck;		// to check the game against
+static bool		seekdesynced;
+
+static byte*		seekbuffer;
+static int		seeksize;
+
+static char		seekmessage[40];
+
+
+static void G_WriteLong (byte *p, int value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static int G_ReadLong (const byte *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned) p[3] << 24);
+}
+
+
+//
+// G_InitSeek
+//
+void G_InitSeek (void)
+{
+    int		p;
+
+    //!
+    // @arg <n>
+    // @category demo
+    //
+    // While a demo plays, archive the game every n seconds to an
+    // index beside it, name.lmp.dsi, for -demoseek and the seek keys
+    // to start from. Demos in a WAD have theirs in the savegame
+    // directory. An index of the same demo already there is added to.
+    //
+
+    p = M_CheckParmWithArgs ("-seekindex", 1);
+
+    if (p)
+    {
+	seekinterval = atoi (myargv[p+1]) * TICRATE;
+
+	if (seekinterval <= 0)
+	    I_Error ("G_InitSeek: -seekindex takes a number of seconds");
+    }
+
+    //!
+    // @arg <tic>
+    // @category demo
+    //
+    // Start the demo played at tic, from the last keyframe of its
+    // -seekindex before it, or from the start without one.
+    //
+
+    p = M_CheckParmWithArgs ("-demoseek", 1);
+
+    if (p)
+	demoseek = atoi (myargv[p+1]);
+}
+
+
+static keyframe_t *G_AddKeyframe (void)
+{
+    if (numkeyframes == maxkeyframes)
+    {
+	maxkeyframes = maxkeyframes ? maxkeyframes * 2 : 64;
+	keyframes = realloc (keyframes, maxkeyframes * sizeof(*keyframes));
+	if (keyframes == NULL)
+	    I_Error ("G_AddKeyframe: out of memory");
+    }
+
+    return &keyframes[numkeyframes++];
+}
+
+
+//
+// G_ReadSeekIndex
+// An index cut short is only read up to where it was whole,
+//  and is written again from the start.
+//
+static bool G_ReadSeekIndex (int demolength)
+{
+    byte	header[SEEK_HEADER];
+    byte	record[SEEK_RECORD];
+    keyframe_t*	key;
+    long	length;
+    long	offset;
+
+    length = M_FileLength (seekfile);
+
+    if (fread (header, 1, SEEK_HEADER, seekfile) != SEEK_HEADER
+     || memcmp (header, SEEK_MAGIC, 4) != 0
+     || header[4] != SEEK_VERSION
+     || (seekwriting && G_ReadLong (header + 5) != seekinterval)
+     || G_ReadLong (header + 9) != demolength)
+	return false;
+
+    offset = SEEK_HEADER;
+
+    while (offset < length)
+    {
+	if (fread (record, 1, SEEK_RECORD, seekfile) != SEEK_RECORD)
+	    return !seekwriting;
+
+	key = G_AddKeyframe ();
+	key->tic = G_ReadLong (record);
+	key->position = G_ReadLong (record + 4);
+	key->hash = G_ReadLong (record + 8);
+	key->paused = G_ReadLong (record + 12) != 0;
+	key->length = G_ReadLong (record + 16);
+	key->offset = offset + SEEK_RECORD;
+
+	offset = key->offset + key->length;
+
+	if (key->length <= 0 || offset > length
+	 || (numkeyframes > 1 && key->tic <= key[-1].tic)
+	 || fseek (seekfile, offset, SEEK_SET) != 0)
+	{
+	    numkeyframes--;
+	    return !seekwriting;
+	}
+    }
+
+    return true;
+}
+
+
+//
+// G_StartSeek
+// Called as each demo starts playing.
+//
+void G_StartSeek (void)
+{
+    lumpinfo_t*	lump;
+    byte	header[SEEK_HEADER];
+    int		demolength;
+
+    G_EndSeek ();
+
+    demotic = 0;
+    nextkeyframe = 0;
+    nextcheck = 0;
+    seekdesynced = false;
+
+    lump = &lumpinfo[W_GetNumForName (defdemoname)];
+    demolength = lump->size;
+
+    // beside the demo when it is a file of its own
+    if (lump->position == 0 && lump->size > 0
+     && lump->size == lump->wad_file->length)
+	seekpath = M_StringJoin (lump->wad_file->path, ".dsi", NULL);
+    else
+	seekpath = M_StringJoin (savegamedir, defdemoname, ".dsi", NULL);
+
+    seekwriting = seekinterval > 0;
+    seekfile = fopen (seekpath, seekwriting ? "r+b" : "rb");
+
+    if (seekfile != NULL && !G_ReadSeekIndex (demolength))
+    {
+	fclose (seekfile);
+	seekfile = NULL;
+	numkeyframes = 0;
+    }
+
+    if (seekfile == NULL && seekwriting)
+    {
+	memcpy (header, SEEK_MAGIC, 4);
+	header[4] = SEEK_VERSION;
+	G_WriteLong (header + 5, seekinterval);
+	G_WriteLong (header + 9, demolength);
+
+	seekfile = fopen (seekpath, "w+b");
+
+	if (seekfile == NULL
+	 || fwrite (header, 1, SEEK_HEADER, seekfile) != SEEK_HEADER)
+	{
+	    fprintf (stderr, "G_StartSeek: couldn't write %s\n", seekpath);
+	    G_EndSeek ();
+	}
+    }
+
+    if (numkeyframes > 0)
+	nextkeyframe = keyframes[numkeyframes - 1].tic + seekinterval;
+
+    // only the demo played first
+    if (demoseek >= 0)
+    {
+	seektarget = demoseek;
+	demoseek = -1;
+	gameaction = ga_seek;
+    }
+}
+
+
+//
+// G_EndSeek
+//
+void G_EndSeek (void)
+{
+    if (seekfile != NULL)
+    {
+	fclose (seekfile);
+	seekfile = NULL;
+    }
+
+    free (seekpath);
+    seekpath = NULL;
+    seekwriting = false;
+    numkeyframes = 0;
+}
+
+
+//
+// G_WriteKeyframe
+// A keyframe that can't be written stops the index where it is.
+//
+static void G_WriteKeyframe (void)
+{
+    byte	record[SEEK_RECORD];
+    keyframe_t*	key;
+    int		length;
+
+    G_ArchiveState ("", &length);
+    P_ArchiveSync ();
+    length = save_p - save_buffer;
+
+    key = G_AddKeyframe ();
+    key->tic = demotic;
+    key->position = G_DemoPosition ();
+    key->hash = P_HashState ();
+    key->paused = paused;
+    key->length = length;
+
+    G_WriteLong (record, key->tic);
+    G_WriteLong (record + 4, key->position);
+    G_WriteLong (record + 8, key->hash);
+    G_WriteLong (record + 12, key->paused);
+    G_WriteLong (record + 16, key->length);
+
+    key->offset = fseek (seekfile, 0, SEEK_END) == 0 ? ftell (seekfile) : -1;
+
+    if (key->offset < 0
+     || fwrite (record, 1, SEEK_RECORD, seekfile) != SEEK_RECORD
+     || fwrite (save_buffer, 1, length, seekfile) != (size_t) length
+     || fflush (seekfile) != 0)
+    {
+	fprintf (stderr, "G_WriteKeyframe: couldn't write %s\n", seekpath);
+	numkeyframes--;
+	seekwriting = false;
+	return;
+    }
+
+    key->offset += SEEK_RECORD;
+}
+
+
+//
+// G_LoadKeyframe
+//
+static bool G_LoadKeyframe (keyframe_t *key)
+{
+    bool	ok;
+
+    if (key->length > seeksize)
+    {
+	seeksize = key->length;
+	seekbuffer = realloc (seekbuffer, seeksize);
+	if (seekbuffer == NULL)
+	    I_Error ("G_LoadKeyframe: out of memory");
+    }
+
+    if (fseek (seekfile, key->offset, SEEK_SET) != 0
+     || fread (seekbuffer, 1, key->length, seekfile) != (size_t) key->length)
+	return false;
+
+    // nothing is drawn until the seek is done
+    precache = false;
+    ok = G_UnArchiveState (seekbuffer, key->length);
+    precache = true;
+
+    if (!ok)
+	return false;
+
+    P_UnArchiveSync ();
+
+    if (!G_SetDemoPosition (key->position))
+	I_Error ("G_LoadKeyframe: %s is of another demo", seekpath);
+
+    // G_InitNew started a game of its own
+    demoplayback = true;
+    usergame = false;
+    paused = key->paused;
+    demotic = key->tic;
+
+    return true;
+}
+
+
+//
+// G_SeekTicker
+// Called at the end of each tic. A game played on from a
+//  keyframe should come to each one after it as it was
+//  written, or the index no longer fits the demo.
+//
+void G_SeekTicker (void)
+{
+    keyframe_t*	key;
+
+    if (!demoplayback)
+	return;
+
+    demotic++;
+
+    if (seekfile == NULL || gamestate != GS_LEVEL || gameaction != ga_nothing)
+	return;
+
+    while (nextcheck < numkeyframes && keyframes[nextcheck].tic <= demotic)
+    {
+	key = &keyframes[nextcheck++];
+
+	if (!seekdesynced
+	 && (key->tic != demotic || key->hash != P_HashState ()))
+	{
+	    seekdesynced = true;
+	    fprintf (stderr, "G_SeekTicker: the demo is out of sync with "
+			     "%s at tic %i\n", seekpath, key->tic);
+	    players[consoleplayer].message = "demo out of sync with its index";
+	}
+    }
+
+    if (seekwriting && demotic >= nextkeyframe)
+    {
+	G_WriteKeyframe ();
+	nextkeyframe = demotic + seekinterval;
+	nextcheck = numkeyframes;
+    }
+}
+
+
+//
+// G_SeekResponder
+//
+bool G_SeekResponder (event_t* ev)
+{
+    if (!demoplayback || seekfile == NULL || gameaction != ga_nothing
+     || ev->type != ev_keydown)
+	return false;
+
+    if (ev->data1 == key_demo_back)
+	seektarget = demotic > SEEK_STEP ? demotic - SEEK_STEP : 0;
+    else if (ev->data1 == key_demo_forward)
+	seektarget = demotic + SEEK_STEP;
+    else
+	return false;
+
+    gameaction = ga_seek;
+    return true;
+}
+
+
+//
+// G_DoSeek
+// Goes to the last keyframe before the tic, or the first
+//  when there is none, unless the demo is nearer already,
+//  then runs the tics from there.
+//
+void G_DoSeek (void)
+{
+    keyframe_t*	key;
+    int		i;
+
+    gameaction = ga_nothing;
+
+    if (!demoplayback)
+	return;
+
+    key = NULL;
+    for (i = 0; i < numkeyframes; i++)
+    {
+	if (key != NULL && keyframes[i].tic > seektarget)
+	    break;
+	key = &keyframes[i];
+    }
+
+    if (key != NULL && (seektarget < demotic || key->tic > demotic))
+    {
+	if (!G_LoadKeyframe (key))
+	{
+	    fprintf (stderr, "G_DoSeek: couldn't read %s\n", seekpath);
+	    return;
+	}
+
+	nextcheck = key - keyframes + 1;
+	seekdesynced = false;
+    }
+
+    // G_Ticker does each gameaction the tics set
+    while (demoplayback && demotic < seektarget)
+	G_Ticker ();
+
+    if (!demoplayback)
+	return;
+
+    M_snprintf (seekmessage, sizeof(seekmessage), "%d:%02d",
+		demotic / TICRATE / 60, demotic / TICRATE % 60);
+    players[consoleplayer].message = seekmessage;
+
+    // the time it took isn't made up for with more tics
+    D_StartGameLoop ();
+}
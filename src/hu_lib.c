@@ -23,6 +23,8 @@
 
 #include "v_video.h"
 #include "i_swap.h"
+#include "i_video.h"
+#include "m_misc.h"
 
 #include "hu_lib.h"
 #include "r_local.h"
@@ -100,6 +102,17 @@ HUlib_drawTextLine
     int			w;
     int			x;
     unsigned char	c;
+    char		text[HU_MAXLINELENGTH+2];
+
+    // with -textoverlay, sent as text
+    if (I_TextOverlay())
+    {
+	M_StringCopy(text, l->l, sizeof(text));
+	if (drawcursor)
+	    M_StringConcat(text, "_", sizeof(text));
+	I_DrawText(l->x, l->y, text);
+	return;
+    }
 
     // draw the new stuff
     x = l->x;
@@ -150,12 +163,12 @@ void HUlib_eraseTextLine(hu_textline_t* l)
 	lh = SHORT(l->f[0]->height) + 1;
 	for (y=l->y,yoffset=y*SCREENWIDTH ; y<l->y+lh ; y++,yoffset+=SCREENWIDTH)
 	{
-	    if (y < viewwindowy || y >= viewwindowy + viewheight)
+	    if (y < viewwindowy || y >= viewwindowy + scaledviewheight)
 		R_VideoErase(yoffset, SCREENWIDTH); // erase entire line
 	    else
 	    {
 		R_VideoErase(yoffset, viewwindowx); // erase left border
-		R_VideoErase(yoffset + viewwindowx + viewwidth, viewwindowx);
+		R_VideoErase(yoffset + viewwindowx + scaledviewwidth, viewwindowx);
 		// erase right border
 	    }
 	}
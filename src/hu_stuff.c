@@ -31,11 +31,14 @@
 #include "hu_lib.h"
 #include "m_controls.h"
 #include "m_misc.h"
+#include "m_timing.h"
 #include "w_wad.h"
 
 #include "s_sound.h"
 
 #include "doomstat.h"
+#include "p_local.h"
+#include "r_local.h"
 
 // Data.
 #include "dstrings.h"
@@ -59,6 +62,10 @@
 #define HU_INPUTWIDTH	64
 #define HU_INPUTHEIGHT	1
 
+#define HU_PERFX	0
+#define HU_PERFY	(HU_INPUTY + SHORT(hu_font[0]->height) + 1)
+#define HU_PERFHEIGHT	4
+
 
 
 char *chat_macros[10] =
@@ -104,6 +111,10 @@ extern int		showMessages;
 
 static bool		headsupactive = false;
 
+bool			perfhud;
+static hu_textline_t	w_perf[HU_PERFHEIGHT];
+static unsigned		perfgeneration;
+
 //
 // Builtin map names.
 // The actual names can be found in DStrings.h.
@@ -376,26 +387,109 @@ void HU_Start(void)
     for (i=0 ; i<MAXPLAYERS ; i++)
 	HUlib_initIText(&w_inputbuffer[i], 0, 0, 0, 0, &always_off);
 
+    // create the performance widgets, filled in once a second
+    for (i=0 ; i<HU_PERFHEIGHT ; i++)
+	HUlib_initTextLine(&w_perf[i],
+			   HU_PERFX, HU_PERFY + i*(SHORT(hu_font[0]->height)+1),
+			   hu_font,
+			   HU_FONTSTART);
+    perfgeneration = stageaverages.generation - 1;
+
     headsupactive = true;
 
 }
 
+//
+// HU_UpdatePerf
+// Fills in the performance widgets with the last
+//  second's averages and the last frame's counts.
+//
+static void HU_UpdatePerf(void)
+{
+    char	lines[HU_PERFHEIGHT][HU_MAXLINELENGTH+1];
+    float*	t;
+    thinker_t*	th;
+    char*	s;
+    int		thinkers;
+    int		i;
+
+    if (perfgeneration == stageaverages.generation)
+	return;
+
+    perfgeneration = stageaverages.generation;
+    t = stageaverages.stagetime;
+
+    thinkers = 0;
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+	thinkers++;
+
+    M_snprintf(lines[0], sizeof(lines[0]), "FPS %.1f  INPUT %.0f MS  %i BYTES",
+	       stageaverages.fps, stageaverages.latency, stageaverages.bytes);
+    M_snprintf(lines[1], sizeof(lines[1]), "TIC %.2f  VIEW %.2f  HUD %.2f MS",
+	       t[STAGE_TICKER] / 1000,
+	       (t[STAGE_BSP] + t[STAGE_PLANES] + t[STAGE_MASKED]
+		+ t[STAGE_QUEUE]) / 1000,
+	       t[STAGE_HUD] / 1000);
+    M_snprintf(lines[2], sizeof(lines[2]), "PIXELS %.2f  ENCODE %.2f  WRITE %.2f MS",
+	       t[STAGE_DOWNSAMPLE] / 1000, t[STAGE_ENCODE] / 1000,
+	       t[STAGE_WRITE] / 1000);
+    M_snprintf(lines[3], sizeof(lines[3]), "PLANES %i  SEGS %i  SPRITES %i  THINKERS %i",
+	       numvisplanes, (int) (ds_p - drawsegs),
+	       (int) (vissprite_p - vissprites), thinkers);
+
+    for (i=0 ; i<HU_PERFHEIGHT ; i++)
+    {
+	HUlib_clearTextLine(&w_perf[i]);
+	for (s = lines[i] ; *s ; s++)
+	    HUlib_addCharToTextLine(&w_perf[i], *s);
+    }
+}
+
+//
+// HU_SetPerfHud
+//
+void HU_SetPerfHud(bool on)
+{
+    int		i;
+
+    perfhud = on;
+    M_AverageStages(on);
+
+    // erased from the border on the next frames
+    if (!on)
+	for (i=0 ; i<HU_PERFHEIGHT ; i++)
+	    HUlib_clearTextLine(&w_perf[i]);
+}
+
 void HU_Drawer(void)
 {
 
+    int		i;
+
     HUlib_drawSText(&w_message);
     HUlib_drawIText(&w_chat);
     if (automapactive)
 	HUlib_drawTextLine(&w_title, false);
 
+    if (perfhud)
+    {
+	HU_UpdatePerf();
+	for (i=0 ; i<HU_PERFHEIGHT ; i++)
+	    HUlib_drawTextLine(&w_perf[i], false);
+    }
+
 }
 
 void HU_Erase(void)
 {
 
+    int		i;
+
     HUlib_eraseSText(&w_message);
     HUlib_eraseIText(&w_chat);
     HUlib_eraseTextLine(&w_title);
+    for (i=0 ; i<HU_PERFHEIGHT ; i++)
+	HUlib_eraseTextLine(&w_perf[i]);
 
 }
 
@@ -547,6 +641,11 @@ bool HU_Responder(event_t *ev)
 	    message_counter = HU_MSGTIMEOUT;
 	    eatkey = true;
 	}
+	else if (key_perfhud && ev->data1 == key_perfhud)
+	{
+	    HU_SetPerfHud(!perfhud);
+	    eatkey = true;
+	}
 	else if (netgame && ev->data2 == key_multi_msg)
 	{
 	    eatkey = chat_on = true;
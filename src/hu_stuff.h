@@ -55,5 +55,13 @@ void HU_Erase(void);
 
 extern char *chat_macros[10];
 
+// Set while the performance overlay is shown.
+extern bool perfhud;
+
+// Shows or hides the performance overlay: the frame rate,
+// the time of each stage, the frame size and the renderer's
+// counts, over the top of the screen.
+void HU_SetPerfHud(bool on);
+
 #endif
 
@@ -0,0 +1,180 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Frame captures.
+//	With -capframes <file>, the 8-bit screen of each frame
+//	drawn is written to file, with the palette whenever it
+//	changes, for the backend to be timed on real frames
+//	without the game running.
+//	It starts with CAPTURE_MAGIC and the width and height as
+//	16 bits little-endian. Each frame is a flags byte, then
+//	the 768 bytes of the palette if bit 0 is set, then the
+//	screen. With zlib the file is written compressed, and
+//	read through gzread, which takes it compressed or not.
+//
+
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "doomtype.h"
+
+#include "i_system.h"
+
+#include "i_capture.h"
+
+
+#define CAPTURE_MAGIC		"DCAP"
+#define CAPTURE_HEADER		8
+
+#define CAPTURE_PALETTE		1
+
+#ifdef HAVE_ZLIB
+static gzFile	capfile;
+#else
+static FILE*	capfile;
+#endif
+
+static int	capsize;
+
+
+static void I_WriteCaptureBytes (void *buf, int len)
+{
+#ifdef HAVE_ZLIB
+    if (gzwrite (capfile, buf, len) != len)
+#else
+    if (fwrite (buf, 1, len, capfile) != len)
+#endif
+	I_Error ("I_WriteCapture: couldn't write the capture");
+}
+
+
+static bool I_ReadCaptureBytes (void *buf, int len)
+{
+#ifdef HAVE_ZLIB
+    return gzread (capfile, buf, len) == len;
+#else
+    return fread (buf, 1, len, capfile) == len;
+#endif
+}
+
+
+//
+// I_StartCapture
+//
+void I_StartCapture (char *filename, int width, int height)
+{
+    byte	header[CAPTURE_HEADER];
+
+#ifdef HAVE_ZLIB
+    // fast, as it is written while the frames are drawn
+    capfile = gzopen (filename, "wb1");
+#else
+    capfile = fopen (filename, "wb");
+#endif
+
+    if (capfile == NULL)
+	I_Error ("I_StartCapture: couldn't open %s", filename);
+
+    memcpy (header, CAPTURE_MAGIC, 4);
+    header[4] = width & 0xff;
+    header[5] = width >> 8;
+    header[6] = height & 0xff;
+    header[7] = height >> 8;
+    I_WriteCaptureBytes (header, CAPTURE_HEADER);
+
+    capsize = width * height;
+}
+
+
+//
+// I_WriteCapture
+//
+void I_WriteCapture (byte *screen, byte *palette)
+{
+    byte	flags;
+
+    flags = palette != NULL ? CAPTURE_PALETTE : 0;
+    I_WriteCaptureBytes (&flags, 1);
+
+    if (palette != NULL)
+	I_WriteCaptureBytes (palette, 768);
+
+    I_WriteCaptureBytes (screen, capsize);
+}
+
+
+//
+// I_OpenCapture
+//
+void I_OpenCapture (char *filename, int *width, int *height)
+{
+    byte	header[CAPTURE_HEADER];
+
+#ifdef HAVE_ZLIB
+    capfile = gzopen (filename, "rb");
+#else
+    capfile = fopen (filename, "rb");
+#endif
+
+    if (capfile == NULL)
+	I_Error ("I_OpenCapture: couldn't open %s", filename);
+
+    if (!I_ReadCaptureBytes (header, CAPTURE_HEADER)
+     || memcmp (header, CAPTURE_MAGIC, 4))
+	I_Error ("I_OpenCapture: %s isn't a capture", filename);
+
+    *width = header[4] | header[5] << 8;
+    *height = header[6] | header[7] << 8;
+    capsize = *width * *height;
+}
+
+
+//
+// I_ReadCapture
+//
+bool I_ReadCapture (byte *screen, byte *palette, bool *newpalette)
+{
+    byte	flags;
+
+    if (!I_ReadCaptureBytes (&flags, 1))
+	return false;
+
+    *newpalette = (flags & CAPTURE_PALETTE) != 0;
+
+    if (*newpalette && !I_ReadCaptureBytes (palette, 768))
+	return false;
+
+    // a frame cut short ends the capture
+    return I_ReadCaptureBytes (screen, capsize);
+}
+
+
+//
+// I_CloseCapture
+//
+void I_CloseCapture (void)
+{
+    if (capfile == NULL)
+	return;
+
+#ifdef HAVE_ZLIB
+    gzclose (capfile);
+#else
+    fclose (capfile);
+#endif
+    capfile = NULL;
+}
@@ -0,0 +1,39 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Frame captures.
+//
+
+
+#ifndef __I_CAPTURE__
+#define __I_CAPTURE__
+
+#include "doomtype.h"
+
+// Starts writing a capture of frames of width x height.
+void	I_StartCapture (char *filename, int width, int height);
+
+// Adds a frame, with the palette if it changed since the
+//  last one, otherwise NULL.
+void	I_WriteCapture (byte *screen, byte *palette);
+
+// Opens a capture to read, and returns the size of its frames.
+void	I_OpenCapture (char *filename, int *width, int *height);
+
+// Reads the next frame into screen, and its palette into
+//  palette when it has changed. Returns false at the end.
+bool	I_ReadCapture (byte *screen, byte *palette, bool *newpalette);
+
+// Finishes the capture written or read.
+void	I_CloseCapture (void);
+
+#endif
@@ -35,6 +35,7 @@ void D_DoomMain (void);
 void M_FindResponseFile(void);
 
 void dg_Create();
+void D_DemoBatch (void);
 
 
 int main(int argc, char **argv)
@@ -46,6 +47,9 @@ int main(int argc, char **argv)
 
     M_FindResponseFile();
 
+    // a batch only starts more runs of this program
+    D_DemoBatch ();
+
     // start doom
     printf("Starting D_DoomMain\r\n");
     
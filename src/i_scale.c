@@ -382,6 +382,13 @@ static void I_InitStretchTables(byte *palette)
     puts("");
 }
 
+byte **I_StretchTables(byte *palette)
+{
+    I_InitStretchTables(palette);
+
+    return stretch_tables;
+}
+
 // Create 50%/50% table for 800x600 squash mode
 
 static void I_InitSquashTable(byte *palette)
@@ -25,6 +25,10 @@
 void I_InitScale(byte *_src_buffer, byte *_dest_buffer, int _dest_pitch);
 void I_ResetScaleTables(byte *palette);
 
+// The 20% and 40% blend tables of the stretched modes, generated
+// from the palette the first time.
+byte **I_StretchTables(byte *palette);
+
 // Scaled modes (direct multiples of 320x200)
 
 extern screen_mode_t mode_scale_1x;
@@ -0,0 +1,105 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	SIMD kernels picked at startup.
+//	The release binaries are built for any CPU of their
+//	architecture. The loops with an AVX2 version, flat spans
+//	and the classification of pixels into cells, check
+//	simdkernel and take it when the CPU has it. SSE2 and
+//	NEON, which every x86-64 and ARM64 CPU has, can't do the
+//	gathers those loops are made of, so there is nothing for
+//	them to pick.
+//
+
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "doomtype.h"
+
+#include "i_system.h"
+#include "m_argv.h"
+
+#include "i_simd.h"
+
+
+kernel_t	simdkernel = KERNEL_SCALAR;
+
+static char*	kernelnames[NUMKERNELS] = { "scalar", "avx2" };
+
+
+static bool I_KernelSupported (kernel_t kernel)
+{
+    switch (kernel)
+    {
+      case KERNEL_SCALAR:
+	return true;
+
+      case KERNEL_AVX2:
+#ifdef HAVE_AVX2_KERNELS
+	__builtin_cpu_init ();
+	return __builtin_cpu_supports ("avx2");
+#else
+	return false;
+#endif
+
+      default:
+	return false;
+    }
+}
+
+
+//
+// I_InitKernels
+//
+void I_InitKernels (void)
+{
+    int		p;
+    int		i;
+
+    //!
+    // @arg <kernel>
+    //
+    // Use the scalar or avx2 versions of the loops that have
+    // them, instead of the best the CPU runs, to compare them.
+    //
+
+    p = M_CheckParmWithArgs ("-forcekernel", 1);
+
+    if (p)
+    {
+	for (i=0 ; i<NUMKERNELS ; i++)
+	    if (!strcasecmp (myargv[p+1], kernelnames[i]))
+		break;
+
+	if (i == NUMKERNELS)
+	    I_Error ("I_InitKernels: unknown kernel '%s', expected scalar or avx2",
+		     myargv[p+1]);
+
+	if (!I_KernelSupported (i))
+	    I_Error ("I_InitKernels: this CPU can't run the %s kernels",
+		     kernelnames[i]);
+
+	simdkernel = i;
+    }
+    else
+    {
+	for (i=NUMKERNELS-1 ; i>0 ; i--)
+	    if (I_KernelSupported (i))
+		break;
+
+	simdkernel = i;
+    }
+
+    printf ("I_InitKernels: %s kernels\n", kernelnames[simdkernel]);
+}
@@ -0,0 +1,42 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	SIMD kernels picked at startup.
+//
+
+
+#ifndef __I_SIMD__
+#define __I_SIMD__
+
+#include "doomtype.h"
+
+typedef enum
+{
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    NUMKERNELS
+} kernel_t;
+
+// On x86, the AVX2 kernels are built into every binary, each
+//  function for itself, and only run where the CPU has AVX2.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2_KERNELS
+#define AVX2_KERNEL	__attribute__((target("avx2")))
+#endif
+
+// The kernels the hot loops use.
+extern kernel_t		simdkernel;
+
+// Picks the best kernels the CPU runs, or those of -forcekernel.
+void	I_InitKernels (void);
+
+#endif
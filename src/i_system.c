@@ -27,6 +27,7 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #else
+#include <sys/mman.h>
 #include <unistd.h>
 #endif
 
@@ -57,6 +58,24 @@
 
 #define DEFAULT_RAM 6 /* MiB */
 #define MIN_RAM     6  /* MiB */
+#define MAX_RAM     64 /* MiB */
+#define CHUNK_RAM   4  /* MiB */
+
+// With -lowmem
+#define LOWMEM_RAM       3  /* MiB */
+#define LOWMEM_MAX_RAM   16 /* MiB */
+#define LOWMEM_CHUNK_RAM 1  /* MiB */
+
+// Bytes the zone may still grow by.
+static int zone_left;
+
+// MiB the zone grows by at a time.
+static int chunk_ram = CHUNK_RAM;
+
+// Set by -hugepages.
+static bool hugepages;
+
+#define HUGEPAGESIZE (2 * 1024 * 1024)
 
 
 typedef struct atexit_listentry_s atexit_listentry_t;
@@ -88,6 +107,67 @@ void I_Tactile(int on, int off, int total)
 {
 }
 
+// With -hugepages, zone memory is mapped in huge pages where the system
+// has them and faulted in up front, so that the renderer takes fewer TLB
+// misses and the first level no page faults. Explicit huge pages are
+// used if some have been reserved, otherwise transparent ones are asked
+// for.
+
+static byte *MapZoneMemory(int size)
+{
+#ifdef _WIN32
+    return NULL;
+#else
+    const long page = sysconf(_SC_PAGESIZE);
+    volatile byte *touch;
+    void *mem;
+    int i;
+
+#ifdef MAP_HUGETLB
+    if (size % HUGEPAGESIZE == 0)
+    {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                   -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            return mem;
+        }
+    }
+#endif
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    madvise(mem, size, MADV_HUGEPAGE);
+#endif
+
+    // After the advice, or MAP_POPULATE would fault in small pages
+    touch = mem;
+    for (i = 0; i < size; i += page)
+    {
+        touch[i] = 0;
+    }
+
+    return mem;
+#endif
+}
+
+static byte *AllocZoneMemory(int size)
+{
+    if (hugepages)
+    {
+        return MapZoneMemory(size);
+    }
+
+    return malloc(size);
+}
+
 // Zone memory auto-allocation function that allocates the zone size
 // by trying progressively smaller zone sizes until one is found that
 // works.
@@ -116,7 +196,7 @@ static byte *AutoAllocMemory(int *size, int default_ram, int min_ram)
 
         *size = default_ram * 1024 * 1024;
 
-        zonemem = malloc(*size);
+        zonemem = AllocZoneMemory(*size);
 
         // Failed to allocate?  Reduce zone size until we reach a size
         // that is acceptable.
@@ -133,13 +213,42 @@ static byte *AutoAllocMemory(int *size, int default_ram, int min_ram)
 byte *I_ZoneBase (int *size)
 {
     byte *zonemem;
-    int min_ram, default_ram;
+    int min_ram, default_ram, max_ram;
+    bool lowmem;
     int p;
 
+    //!
+    // Start the heap at 3 MiB and let it grow 1 MiB at a time up
+    // to 16 MiB, unless -mb or -maxmb say otherwise, size the
+    // terminal output for the colors drawn in, and print what the
+    // heap and the buffers hold once started.
+    //
+
+    lowmem = M_CheckParm("-lowmem") > 0;
+
+    default_ram = lowmem ? LOWMEM_RAM : DEFAULT_RAM;
+    max_ram = lowmem ? LOWMEM_MAX_RAM : MAX_RAM;
+    chunk_ram = lowmem ? LOWMEM_CHUNK_RAM : CHUNK_RAM;
+
+    //!
+    // Map the heap in huge pages, and fault every page of it in
+    // at startup and as it grows.
+    //
+
+    hugepages = M_CheckParm("-hugepages") > 0;
+
+#ifdef _WIN32
+    if (hugepages)
+    {
+        I_Error("I_ZoneBase: -hugepages is not supported on Windows");
+    }
+#endif
+
     //!
     // @arg <mb>
     //
-    // Specify the heap size, in MiB (default 16).
+    // Specify the heap size to start with, in MiB (default 6, or
+    // 3 with -lowmem).
     //
 
     p = M_CheckParmWithArgs("-mb", 1);
@@ -151,8 +260,7 @@ byte *I_ZoneBase (int *size)
     }
     else
     {
-        default_ram = DEFAULT_RAM;
-        min_ram = MIN_RAM;
+        min_ram = default_ram < MIN_RAM ? default_ram : MIN_RAM;
     }
 
     zonemem = AutoAllocMemory(size, default_ram, min_ram);
@@ -160,6 +268,75 @@ byte *I_ZoneBase (int *size)
     printf("zone memory: %p, %x allocated for zone\n", 
            zonemem, *size);
 
+    //!
+    // @arg <mb>
+    //
+    // Let the heap grow to this size, in MiB (default 64, or 16
+    // with -lowmem), before
+    // cached graphics are thrown out to make room. Pass the same
+    // size as -mb for a heap that never grows.
+    //
+
+    p = M_CheckParmWithArgs("-maxmb", 1);
+
+    if (p > 0)
+    {
+        zone_left = atoi(myargv[p+1]);
+    }
+    else
+    {
+        zone_left = max_ram;
+    }
+
+    if (zone_left > 2047)
+    {
+        zone_left = 2047;
+    }
+
+    zone_left = zone_left * 1024 * 1024 - *size;
+
+    if (zone_left < 0)
+    {
+        zone_left = 0;
+    }
+
+    return zonemem;
+}
+
+//
+// I_ZoneGrow
+// Another chunk for the zone, of at least min bytes,
+// or NULL when the zone can't grow any more.
+//
+
+byte *I_ZoneGrow (int min, int *size)
+{
+    byte *zonemem;
+
+    *size = chunk_ram * 1024 * 1024;
+
+    if (*size < min)
+    {
+        *size = min;
+    }
+
+    if (*size > zone_left)
+    {
+        *size = zone_left;
+    }
+
+    if (*size < min)
+    {
+        return NULL;
+    }
+
+    zonemem = AllocZoneMemory(*size);
+
+    if (zonemem != NULL)
+    {
+        zone_left -= *size;
+    }
+
     return zonemem;
 }
 
@@ -264,6 +441,25 @@ void I_Quit (void)
 #endif
 }
 
+//
+// I_Shutdown
+// Runs only the exit functions I_Error would, for a game that
+// goes on elsewhere: no ENDOOM, and the config is left alone.
+//
+
+void I_Shutdown (void)
+{
+    atexit_listentry_t *entry;
+
+    for (entry = exit_funcs; entry != NULL; entry = entry->next)
+    {
+        if (entry->run_on_error)
+        {
+            entry->func();
+        }
+    }
+}
+
 #if !defined(_WIN32) && !defined(__MACOSX__)
 #define ZENITY_BINARY "/usr/bin/zenity"
 
@@ -457,13 +653,10 @@ void I_Error (char *error, ...)
     // abort();
 #if ORIGCODE
     SDL_Quit();
+#endif
 
+    // a run of -demobatch that can't go on has to end
     exit(-1);
-#else
-    while (true)
-    {
-    }
-#endif
 }
 
 //
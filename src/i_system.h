@@ -34,6 +34,9 @@ void I_Init (void);
 // for the zone management.
 byte*	I_ZoneBase (int *size);
 
+// Called by Z_Malloc when the zone is full.
+byte*	I_ZoneGrow (int min, int *size);
+
 bool I_ConsoleStdout(void);
 
 
@@ -52,6 +55,9 @@ ticcmd_t* I_BaseTiccmd (void);
 // Clean exit, displays sell blurb.
 void I_Quit (void);
 
+// Puts things back as I_Error would, without quitting.
+void I_Shutdown (void);
+
 void I_Error (char *error, ...);
 
 void I_Tactile (int on, int off, int total);
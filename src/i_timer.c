@@ -31,8 +31,25 @@
 // returns time in 1/35th second tics
 //
 
-static uint32_t basetime = 0;
+static uint64_t basetime = 0;
+static bool basetimeset;
 
+// Microseconds since the first call
+
+static uint64_t I_GetTimeUS(void)
+{
+    uint64_t ticks;
+
+    ticks = DG_GetTicksUs();
+
+    if (!basetimeset)
+    {
+        basetime = ticks;
+        basetimeset = true;
+    }
+
+    return ticks - basetime;
+}
 
 int I_GetTicks(void)
 {
@@ -41,16 +58,7 @@ int I_GetTicks(void)
 
 int  I_GetTime (void)
 {
-    uint32_t ticks;
-
-    ticks = I_GetTicks();
-
-    if (basetime == 0)
-        basetime = ticks;
-
-    ticks -= basetime;
-
-    return (ticks * TICRATE) / 1000;    
+    return (I_GetTimeUS() * TICRATE) / 1000000;
 }
 
 
@@ -60,14 +68,34 @@ int  I_GetTime (void)
 
 int I_GetTimeMS(void)
 {
-    uint32_t ticks;
+    return I_GetTimeUS() / 1000;
+}
 
-    ticks = I_GetTicks();
+//
+// Sleep until I_GetTime returns tic. The deadline is
+// worked out from the tic, so waiting for one tic after
+// another doesn't drift.
+//
 
-    if (basetime == 0)
-        basetime = ticks;
+void I_SleepUntilTime(int tic)
+{
+    uint64_t deadline;
 
-    return ticks - basetime;
+    // round up, so the tic has started when we wake
+    deadline = ((uint64_t) tic * 1000000 + TICRATE - 1) / TICRATE;
+
+    I_GetTimeUS();
+    DG_SleepUntilUs(basetime + deadline);
+}
+
+//
+// Part of a tic passed since I_GetTime last stepped, in
+// 1/65536ths of a tic
+//
+
+int I_GetFracTime(void)
+{
+    return (I_GetTimeUS() * TICRATE % 1000000) * 65536 / 1000000;
 }
 
 // Sleep for a specified number of ms
@@ -91,5 +119,8 @@ void I_InitTimer(void)
     // initialize timer
 
     //SDL_Init(SDL_INIT_TIMER);
+
+    // count from the next call, which a forked session needs
+    basetimeset = false;
 }
 
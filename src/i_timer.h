@@ -29,9 +29,15 @@ int I_GetTime (void);
 // returns current time in ms
 int I_GetTimeMS (void);
 
+// How far into the current tic the time is, from 0 to FRACUNIT
+int I_GetFracTime (void);
+
 // Pause for a specified number of ms
 void I_Sleep(int ms);
 
+// Pause until the given tic starts
+void I_SleepUntilTime(int tic);
+
 // Initialize timer
 void I_InitTimer(void);
 
@@ -31,8 +31,17 @@ rcsid[] = "$Id: i_x.c,v 1.6 1997/02/03 22:45:10 b1 Exp $";
 #include "m_argv.h"
 #include "d_event.h"
 #include "d_main.h"
+#include "d_sched.h"
+#include "i_capture.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_timing.h"
+#include "doomstat.h"
 #include "i_video.h"
+#include "i_scale.h"
+#include "m_menu.h"
 #include "z_zone.h"
+#include "r_local.h"
 
 #include "tables.h"
 #include "doomkeys.h"
@@ -40,6 +49,7 @@ rcsid[] = "$Id: i_x.c,v 1.6 1997/02/03 22:45:10 b1 Exp $";
 #include "doomgeneric.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <fcntl.h>
 
@@ -47,8 +57,6 @@ rcsid[] = "$Id: i_x.c,v 1.6 1997/02/03 22:45:10 b1 Exp $";
 
 #include <sys/types.h>
 
-//#define CMAP256
-
 struct FB_BitField
 {
 	uint32_t offset;			/* beginning of bitfield	*/
@@ -84,6 +92,58 @@ struct color {
 
 static struct color colors[256];
 
+// Area-averaged downsampling (-boxfilter). Each block of fb_scaling x
+// fb_scaling pixels is averaged in RGB and mapped back to the nearest
+// palette index through a table indexed by RGB444. The tables are kept
+// per palette, as the damage and pickup flashes keep switching between
+// the PLAYPAL palettes.
+
+#define BOX_FILTER_SLOTS 16
+
+struct box_filter_lut {
+    struct color colors[256];
+    byte index[4096];
+    bool valid;
+};
+
+static bool box_filter;
+static bool box_filter_wanted;
+static struct box_filter_lut box_filter_luts[BOX_FILTER_SLOTS];
+static struct box_filter_lut *box_filter_lut;
+static int box_filter_next;
+
+// Set by -autoscale to follow the size of the backend's window
+static bool autoscale;
+
+// -capframes: the palette is written with the next frame when changed
+static bool capturing;
+static byte capture_palette[768];
+static bool capture_palette_changed;
+
+// DG_ScreenBuffer is to be converted whole, not just
+//  where the screen has been drawn since the last frame
+static bool convertall = true;
+
+// The backend read the last frame from I_VideoBuffer, so
+//  DG_ScreenBuffer doesn't hold it
+static bool screenstale;
+
+// With DG_AspectCorrect, i_scale.c's blend tables, made from the
+//  first palette set: 20% of the first color and 80% of the
+//  second, and 40% and 60%.
+static byte **aspect_tables;
+
+// Which of the 5 sampled rows each of the 6 frame rows is made
+//  of, as I_Stretch1x lays them out, and the table they are
+//  blended with, -1 for a row taken as it is.
+static const struct
+{
+    int first, second, table;
+} aspect_rows[6] =
+{
+    { 0, 0, -1 }, { 0, 1, 0 }, { 1, 2, 1 }, { 3, 2, 1 }, { 4, 3, 0 }, { 4, 4, -1 },
+};
+
 void I_GetEvent(void);
 
 // The screen buffer; this is modified to draw things to the screen
@@ -126,22 +186,50 @@ typedef struct
 
 static uint16_t rgb565_palette[256];
 
-void cmap_to_fb(uint8_t * out, uint8_t * in, int in_pixels)
+// Palette in the framebuffer's pixel format, rebuilt by I_SetPalette
+
+static uint32_t fb_palette[256];
+
+static void fb_palette_update(void)
 {
-    int i, j;
+    int i;
     struct color c;
     uint32_t pix;
     uint16_t r, g, b;
 
-    for (i = 0; i < in_pixels; i += fb_scaling, in += fb_scaling)
+    for (i = 0; i < 256; i++)
     {
-        c = colors[*in];  /* R:8 G:8 B:8 format! */
+        c = colors[i];  /* R:8 G:8 B:8 format! */
         r = (uint16_t)(c.r >> (8 - s_Fb.red.length));
         g = (uint16_t)(c.g >> (8 - s_Fb.green.length));
         b = (uint16_t)(c.b >> (8 - s_Fb.blue.length));
         pix = r << s_Fb.red.offset;
         pix |= g << s_Fb.green.offset;
         pix |= b << s_Fb.blue.offset;
+        pix |= (uint32_t)i << s_Fb.transp.offset;  /* palette index, see DG_SetPalette */
+        fb_palette[i] = pix;
+    }
+}
+
+void cmap_to_fb(uint8_t * out, uint8_t * in, int in_pixels)
+{
+    int i, j;
+    uint32_t pix;
+
+    /* 32bpp, as set up by I_InitGraphics: one table load per pixel */
+    if (s_Fb.bits_per_pixel == 32)
+    {
+        uint32_t *out32 = (uint32_t *) out;
+        const int out_pixels = in_pixels / fb_scaling;
+
+        for (i = 0; i < out_pixels; i++)
+            out32[i] = fb_palette[in[i * fb_scaling]];
+        return;
+    }
+
+    for (i = 0; i < in_pixels; i += fb_scaling, in += fb_scaling)
+    {
+        pix = fb_palette[*in];
 
 		for (j = 0; j < s_Fb.bits_per_pixel/8; j++) {
 			*out = (pix >> (j*8));
@@ -152,12 +240,14 @@ void cmap_to_fb(uint8_t * out, uint8_t * in, int in_pixels)
 
 void I_InitGraphics (void)
 {
+	int i;
+
 	memset(&s_Fb, 0, sizeof(struct FB_ScreenInfo));
 	s_Fb.xres = DOOMGENERIC_RESX;
 	s_Fb.yres = DOOMGENERIC_RESY;
 	s_Fb.xres_virtual = s_Fb.xres;
 	s_Fb.yres_virtual = s_Fb.yres;
-	s_Fb.bits_per_pixel = 32;
+	s_Fb.bits_per_pixel = 8 * sizeof(pixel_t);
 
 	s_Fb.blue.length = 8;
 	s_Fb.green.length = 8;
@@ -171,6 +261,41 @@ void I_InitGraphics (void)
 
 	fb_scaling = SCREENWIDTH / s_Fb.xres;
 
+	//!
+	// Average each block of pixels instead of sampling one, which
+	// flickers less. Renders the full 320x200 frame.
+	//
+	box_filter_wanted = M_CheckParm("-boxfilter") > 0;
+	box_filter = box_filter_wanted && fb_scaling > 1;
+
+	//!
+	// @arg <file>
+	//
+	// Write the full 8-bit screen and palette of every frame drawn to
+	// file, as from a -timedemo, for -replayframes and encoder_bench.
+	//
+	i = M_CheckParmWithArgs("-capframes", 1);
+	if (i > 0)
+	{
+		I_StartCapture(myargv[i + 1], SCREENWIDTH, SCREENHEIGHT);
+		I_AtExit(I_CloseCapture, true);
+		capturing = true;
+	}
+
+	/* Render the view straight onto the pixels sampled by I_FinishUpdate,
+	 * unless the whole frame is captured */
+	if (DG_NativeRender && !box_filter && !capturing)
+		renderscale = fb_scaling;
+
+	//!
+	// Pick the scaling that fits the terminal or telnet window, and
+	// follow it as the window is resized.
+	//
+	autoscale = M_CheckParm("-autoscale") > 0;
+
+	/* the view buffers must hold the finest scaling we may switch to */
+	minrenderscale = autoscale ? 1 : renderscale;
+
 	printf("I_InitGraphics: framebuffer: x_res: %d, y_res: %d, x_virtual: %d, y_virtual: %d, bpp: %d\n",
             s_Fb.xres, s_Fb.yres, s_Fb.xres_virtual, s_Fb.yres_virtual, s_Fb.bits_per_pixel);
 
@@ -200,38 +325,421 @@ void I_StartFrame (void)
 
 }
 
+//
+// I_SetScaling
+// Switches to a frame of SCREENWIDTH/scaling x
+//  SCREENHEIGHT/scaling on the fly.
+//
+
+static void I_SetScaling (int scaling)
+{
+	fb_scaling = scaling;
+	DOOMGENERIC_RESX = SCREENWIDTH / scaling;
+	DOOMGENERIC_RESY = DG_FrameHeight(scaling);
+	DG_ScreenBuffer = realloc(DG_ScreenBuffer, DOOMGENERIC_RESX * DOOMGENERIC_RESY * sizeof(pixel_t));
+
+	s_Fb.xres = s_Fb.xres_virtual = DOOMGENERIC_RESX;
+	s_Fb.yres = s_Fb.yres_virtual = DOOMGENERIC_RESY;
+
+	box_filter = box_filter_wanted && fb_scaling > 1;
+	renderscale = DG_NativeRender && !box_filter && !capturing ? fb_scaling : 1;
+
+	DG_Resize();
+	convertall = true;
+
+	// The view is laid out again before the next frame
+	R_SetViewSize (screenblocks, detailLevel);
+}
+
 void I_StartTic (void)
 {
+	int scaling;
+
+	/* -nodraw leaves the terminal alone, even its input */
+	if (nodrawers)
+		return;
+
 	I_GetEvent();
+
+	scaling = DG_FitScaling();
+	if (scaling && scaling != fb_scaling)
+		I_SetScaling(scaling);
 }
 
 void I_UpdateNoBlit (void)
 {
 }
 
+bool I_ReadyForFrame (void)
+{
+    return DG_ReadyForFrame() != 0;
+}
+
 //
-// I_FinishUpdate
+// I_BoxFilter
+// Downsamples I_VideoBuffer into DG_ScreenBuffer by averaging blocks.
 //
 
-void I_FinishUpdate (void)
+//
+// I_BoxAverage
+// The average color of the block of frame pixel x,y,
+//  and the palette index nearest it.
+//
+
+static byte I_BoxAverage (int x, int y, unsigned *r, unsigned *g, unsigned *b)
+{
+    const unsigned n = fb_scaling * fb_scaling;
+    byte *block;
+    int i, j;
+
+    block = I_VideoBuffer + (y * SCREENWIDTH + x) * fb_scaling;
+    *r = *g = *b = 0;
+
+    for (j = 0; j < fb_scaling; j++, block += SCREENWIDTH)
+    {
+        for (i = 0; i < fb_scaling; i++)
+        {
+            *r += colors[block[i]].r;
+            *g += colors[block[i]].g;
+            *b += colors[block[i]].b;
+        }
+    }
+
+    *r = (*r + n / 2) / n;
+    *g = (*g + n / 2) / n;
+    *b = (*b + n / 2) / n;
+
+    return box_filter_lut->index[(*r + 8) / 17 << 8 | (*g + 8) / 17 << 4 | (*b + 8) / 17];
+}
+
+static void I_BoxFilter (int x1, int y1, int x2, int y2)
+{
+    unsigned r, g, b;
+    int x, y;
+    byte index;
+    pixel_t *out;
+
+    for (y = y1; y < y2; y++)
+    {
+        out = DG_ScreenBuffer + y * s_Fb.xres + x1;
+
+        for (x = x1; x < x2; x++)
+        {
+            index = I_BoxAverage(x, y, &r, &g, &b);
+
+#ifdef CMAP256
+            *out++ = index;
+#else
+            *out++ = r << s_Fb.red.offset | g << s_Fb.green.offset | b << s_Fb.blue.offset
+                   | (uint32_t)index << s_Fb.transp.offset;
+#endif
+        }
+    }
+}
+
+//
+// I_AspectRect
+// Stretches the rows sampled from I_VideoBuffer 5 to 6 into
+//  DG_ScreenBuffer as it samples them, blending the two rows
+//  each one in between falls on, as I_Stretch1x does.
+//
+
+static void I_AspectRect (int x1, int y1, int x2, int y2)
+{
+    const int rows = SCREENHEIGHT / fb_scaling;
+    const byte *table;
+    const byte *first, *second;
+    unsigned r, g, b;
+    int x, y, row1, row2, phase;
+    byte index;
+    pixel_t *out;
+
+    for (y = y1; y < y2; y++)
+    {
+        phase = y % 6;
+        row1 = y / 6 * 5 + aspect_rows[phase].first;
+        row2 = y / 6 * 5 + aspect_rows[phase].second;
+        if (row1 >= rows)
+            row1 = rows - 1;
+        if (row2 >= rows)
+            row2 = rows - 1;
+        table = aspect_rows[phase].table >= 0 && aspect_tables
+              ? aspect_tables[aspect_rows[phase].table] : NULL;
+
+        first = I_VideoBuffer + row1 * fb_scaling * SCREENWIDTH;
+        second = I_VideoBuffer + row2 * fb_scaling * SCREENWIDTH;
+        out = DG_ScreenBuffer + y * s_Fb.xres;
+
+        for (x = x1; x < x2; x++)
+        {
+            if (box_filter)
+            {
+                index = I_BoxAverage(x, row1, &r, &g, &b);
+                if (table)
+                    index = table[index << 8 | I_BoxAverage(x, row2, &r, &g, &b)];
+            }
+            else
+            {
+                index = first[x * fb_scaling];
+                if (table)
+                    index = table[index << 8 | second[x * fb_scaling]];
+            }
+#ifdef CMAP256
+            out[x] = index;
+#else
+            out[x] = fb_palette[index];
+#endif
+        }
+    }
+}
+
+//
+// I_ConvertRect
+// Converts part of I_VideoBuffer into DG_ScreenBuffer for the backend,
+//  in the pixels of DG_ScreenBuffer.
+//
+
+static void I_ConvertRect (int x1, int y1, int x2, int y2)
 {
     int y;
+
+    if (DG_AspectCorrect)
+    {
+        I_AspectRect(x1, y1, x2, y2);
+        return;
+    }
+    if (box_filter)
+    {
+        I_BoxFilter(x1, y1, x2, y2);
+        return;
+    }
+#ifdef CMAP256
+    int x;
+    byte *line_in;
+    pixel_t *out;
+
+    /* DRAW SCREEN: point-sample the indexed buffer, no palette expansion */
+    for (y = y1; y < y2; y++)
+    {
+        line_in = I_VideoBuffer + y * fb_scaling * SCREENWIDTH;
+        out = DG_ScreenBuffer + y * s_Fb.xres;
+
+        for (x = x1; x < x2; x++)
+        {
+            out[x] = line_in[x * fb_scaling];
+        }
+    }
+#else
     unsigned char *line_in, *line_out;
 
     /* DRAW SCREEN */
-    line_in  = (unsigned char *) I_VideoBuffer;
-    line_out = (unsigned char *) DG_ScreenBuffer;
+    for (y = y1; y < y2; y++)
+    {
+        line_in  = (unsigned char *) (I_VideoBuffer + y * fb_scaling * SCREENWIDTH + x1 * fb_scaling);
+        line_out = (unsigned char *) (DG_ScreenBuffer + y * s_Fb.xres + x1);
+
+		cmap_to_fb((void*)line_out, (void*)line_in, (x2 - x1) * fb_scaling);
+    }
+#endif
+}
+
+//
+// I_ConvertScreen
+// Converts what was drawn since the last frame, and tells
+//  the backend where it is. If direct, the backend reads
+//  the pixels from I_VideoBuffer itself, so only the rects
+//  are worked out.
+//
+
+static void I_ConvertScreen (bool direct)
+{
+    dirtyrect_t *r;
+    dg_rect_t *out;
+    int x1, y1, x2, y2;
+    int i;
+
+    // DG_ScreenBuffer wasn't kept up to date meanwhile
+    if (!direct && screenstale)
+        convertall = true;
+    screenstale = direct;
+
+    if (convertall)
+    {
+        if (!direct)
+            I_ConvertRect(0, 0, s_Fb.xres, s_Fb.yres);
+        DG_NumDirtyRects = -1;
+        V_ClearDirtyRects();
+        convertall = false;
+        return;
+    }
+
+    for (i = 0; i < numdirtyrects; i++)
+    {
+        r = &dirtyrects[i];
+
+        // every frame pixel sampling a drawn one
+        x1 = r->x1 / fb_scaling;
+        y1 = r->y1 / fb_scaling;
+        x2 = (r->x2 + fb_scaling - 1) / fb_scaling;
+        y2 = (r->y2 + fb_scaling - 1) / fb_scaling;
+
+        // and the stretched rows blended from those rows
+        if (DG_AspectCorrect)
+        {
+            y1 = y1 * 6 / 5 - 1;
+            y2 = y2 * 6 / 5 + 2;
+            if (y1 < 0)
+                y1 = 0;
+        }
+        if (x2 > (int) s_Fb.xres)
+            x2 = s_Fb.xres;
+        if (y2 > (int) s_Fb.yres)
+            y2 = s_Fb.yres;
+        if (x1 >= x2 || y1 >= y2)
+            continue;
+
+        if (!direct)
+            I_ConvertRect(x1, y1, x2, y2);
+
+        if (DG_NumDirtyRects < 0)
+            continue;
+        if (DG_NumDirtyRects == DG_MAXDIRTYRECTS)
+        {
+            DG_NumDirtyRects = -1;
+            continue;
+        }
+
+        out = &DG_DirtyRects[DG_NumDirtyRects++];
+        out->x1 = x1;
+        out->y1 = y1;
+        out->x2 = x2;
+        out->y2 = y2;
+    }
+
+    V_ClearDirtyRects();
+}
+
+//
+// I_FinishUpdate
+//
+
+void I_FinishUpdate (void)
+{
+    cpukind_t kind;
+    bool direct;
+
+    if (!DG_ReadyForFrame())
+    {
+        // the next frame draws its text again
+        if (DG_Text)
+            memset(DG_Text, 0, DG_TextWidth * DG_TextHeight);
+        return;
+    }
 
-    y = s_Fb.yres;
+    if (capturing)
+    {
+        I_WriteCapture(I_VideoBuffer, capture_palette_changed ? capture_palette : NULL);
+        capture_palette_changed = false;
+    }
 
-    while (y--)
+    // Palette indices are what the backend classifies, so
+    // unless they're averaged it looks each sampled one up
+    // where it was drawn, instead of after a copy.
+#ifdef CMAP256
+    direct = !box_filter && !DG_AspectCorrect;
+#else
+    direct = false;
+#endif
+
+    M_StartStage(STAGE_DOWNSAMPLE);
+    I_ConvertScreen(direct);
+    M_EndStage(STAGE_DOWNSAMPLE);
+
+#ifdef CMAP256
+    if (direct)
     {
-		cmap_to_fb((void*)line_out, (void*)line_in, SCREENWIDTH);
-		line_out += (SCREENWIDTH / fb_scaling * (s_Fb.bits_per_pixel/8));
-        line_in += SCREENWIDTH * fb_scaling;
+        DG_SourcePixels = I_VideoBuffer;
+        DG_SourceStep = fb_scaling;
+        DG_SourcePitch = SCREENWIDTH * fb_scaling;
     }
+#endif
 
+    kind = D_CpuPhase(CPU_ENCODE);
+    M_StartStage(STAGE_ENCODE);
 	DG_DrawFrame();
+    M_EndStage(STAGE_ENCODE);
+    D_CpuPhase(kind);
+
+    DG_SourcePixels = NULL;
+}
+
+//
+// I_FinishViewport
+// Sends the screen to a -coop player instead of the terminal.
+//
+
+void I_FinishViewport (int viewport, const char *status)
+{
+    cpukind_t kind;
+
+    convertall = true;
+    I_ConvertScreen(false);
+    kind = D_CpuPhase(CPU_ENCODE);
+    DG_DrawViewport(viewport, status);
+    D_CpuPhase(kind);
+
+    // the next frame is converted over this player's
+    convertall = true;
+}
+
+//
+// I_ReplayCapture
+// Sends the frames of a -capframes capture through the backend,
+//  as fast as it takes them, prints the stage times and quits.
+//
+
+void I_ReplayCapture (char *filename)
+{
+    byte palette[768];
+    bool newpalette;
+    int width, height;
+    int frames = 0;
+    int start;
+
+    I_OpenCapture(filename, &width, &height);
+
+    if (width != SCREENWIDTH || height != SCREENHEIGHT)
+        I_Error("I_ReplayCapture: %s is %ix%i, expected %ix%i",
+                filename, width, height, SCREENWIDTH, SCREENHEIGHT);
+
+    I_InitGraphics();
+    M_StartStageTiming();
+    start = I_GetTimeMS();
+
+    while (I_ReadCapture(I_VideoBuffer, palette, &newpalette))
+    {
+        if (newpalette)
+            I_SetPalette(palette);
+
+        // every frame is sent, none dropped
+        while (!I_ReadyForFrame())
+            DG_SleepMs(1);
+
+        convertall = true;
+
+        I_FinishUpdate();
+        M_FinishStageFrame();
+        frames++;
+    }
+
+    I_CloseCapture();
+
+    printf("I_ReplayCapture: %i frames in %i ms\n", frames, I_GetTimeMS() - start);
+    M_PrintStageTimes();
+
+    // I_Quit only exits through ENDOOM, once the game has started
+    I_Quit();
+    exit(0);
 }
 
 //
@@ -242,6 +750,57 @@ void I_ReadScreen (byte* scr)
     memcpy (scr, I_VideoBuffer, SCREENWIDTH * SCREENHEIGHT);
 }
 
+//
+// I_UpdateBoxFilter
+// Selects, or builds, the nearest color table for the current palette.
+//
+
+static void I_UpdateBoxFilter (void)
+{
+    int i, j, best, best_diff, diff, dr, dg, db;
+    struct box_filter_lut *lut;
+
+    for (i = 0; i < BOX_FILTER_SLOTS; i++)
+    {
+        lut = &box_filter_luts[i];
+        if (lut->valid && !memcmp(lut->colors, colors, sizeof(colors)))
+        {
+            box_filter_lut = lut;
+            return;
+        }
+    }
+
+    lut = &box_filter_luts[box_filter_next];
+    box_filter_next = (box_filter_next + 1) % BOX_FILTER_SLOTS;
+
+    memcpy(lut->colors, colors, sizeof(colors));
+    lut->valid = true;
+
+    for (i = 0; i < 4096; i++)
+    {
+        best = 0;
+        best_diff = INT_MAX;
+
+        for (j = 0; j < 256 && best_diff; j++)
+        {
+            dr = (i >> 8) * 17 - colors[j].r;
+            dg = (i >> 4 & 15) * 17 - colors[j].g;
+            db = (i & 15) * 17 - colors[j].b;
+            diff = dr * dr + dg * dg + db * db;
+
+            if (diff < best_diff)
+            {
+                best = j;
+                best_diff = diff;
+            }
+        }
+
+        lut->index[i] = best;
+    }
+
+    box_filter_lut = lut;
+}
+
 //
 // I_SetPalette
 //
@@ -267,6 +826,20 @@ void I_SetPalette (byte* palette)
 	//}
 
 
+    if (capturing)
+    {
+        memcpy(capture_palette, palette, sizeof(capture_palette));
+        capture_palette_changed = true;
+    }
+
+    // the blends are of palette indices, so they hold for the
+    //  palette flashes and gamma levels too
+    if (DG_AspectCorrect && aspect_tables == NULL)
+    {
+        aspect_tables = I_StretchTables(palette);
+        convertall = true;
+    }
+
     /* performance boost:
      * map to the right pixel format over here! */
 
@@ -276,6 +849,19 @@ void I_SetPalette (byte* palette)
         colors[i].g = gammatable[usegamma][*palette++];
         colors[i].b = gammatable[usegamma][*palette++];
     }
+
+    fb_palette_update();
+
+    // The backend only reads the palette index of a pixel, so
+    //  a palette flash needs no conversion; box filtered pixels
+    //  are mixed colors, and do.
+    if (box_filter)
+    {
+        convertall = true;
+        I_UpdateBoxFilter();
+    }
+
+    DG_SetPalette((uint32_t *)colors);
 }
 
 // Given an RGB value, find the closest matching palette index.
@@ -329,6 +915,46 @@ void I_SetWindowTitle (char *title)
 	DG_SetWindowTitle(title);
 }
 
+void I_SetStatusText (char *text)
+{
+	DG_SetStatusText(text);
+}
+
+bool I_TextOverlay (void)
+{
+    return DG_Text != NULL;
+}
+
+//
+// I_DrawText
+// Each character takes a column of the backend's text, which is
+//  DG_TextWidth across the screen.
+//
+
+void I_DrawText (int x, int y, char *text)
+{
+    char*	out;
+    int		col;
+    int		row;
+
+    col = x * (int)DG_TextWidth / (fb_scaling * (int)DOOMGENERIC_RESX);
+    row = y * (int)DG_TextHeight / (fb_scaling * (int)DOOMGENERIC_RESY);
+    if (row < 0 || row >= (int)DG_TextHeight)
+	return;
+
+    out = DG_Text + row * DG_TextWidth;
+    for ( ; *text && col < (int)DG_TextWidth; text++, col++)
+    {
+	if (col >= 0)
+	    out[col] = *text;
+    }
+}
+
+int I_TextWidth (char *text)
+{
+    return strlen(text) * fb_scaling * DOOMGENERIC_RESX / DG_TextWidth;
+}
+
 void I_GraphicsCheckCommandLine (void)
 {
 }
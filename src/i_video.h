@@ -107,12 +107,38 @@ int I_GetPaletteIndex(int r, int g, int b);
 void I_UpdateNoBlit (void);
 void I_FinishUpdate (void);
 
+// Sends the screen to a player sharing the game from another terminal
+// (-coop), with a line of status text below it.
+
+void I_FinishViewport (int viewport, const char *status);
+
+// False when the next frame would be dropped by the backend, so the
+// renderer can skip drawing it.
+
+bool I_ReadyForFrame (void);
+
+// Sends the frames of a -capframes capture to the backend, without
+// running the game, and quits.
+
+void I_ReplayCapture (char *filename);
+
 void I_ReadScreen (byte* scr);
 
 void I_BeginRead (void);
 
 void I_SetWindowTitle(char *title);
 
+// Shown below the screen, an empty string removes it.
+void I_SetStatusText(char *text);
+
+// With -textoverlay, text goes over the next frame as terminal
+// text, at screen coordinates, instead of in the game's fonts.
+bool I_TextOverlay(void);
+void I_DrawText(int x, int y, char *text);
+
+// The width of a line of overlay text, in screen pixels.
+int I_TextWidth(char *text);
+
 void I_CheckIsScreensaver(void);
 void I_SetGrabMouseCallback(grabmouse_callback_t func);
 
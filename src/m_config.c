@@ -91,6 +91,11 @@ typedef struct
     default_t *defaults;
     int numdefaults;
     char *filename;
+
+    // Open addressed index of the defaults by name, built on
+    // the first search: -1 for an empty slot.
+    int *hashtable;
+    unsigned int hashmask;
 } default_collection_t;
 
 #define CONFIG_VARIABLE_GENERIC(name, type) \
@@ -828,6 +833,15 @@ static default_t extra_defaults_list[] =
 
     CONFIG_VARIABLE_INT(show_endoom),
 
+    //!
+    // @game doom
+    //
+    // If non-zero, the screen melts into the next, at the start of a
+    // level and between screens. If zero, it cuts straight to it.
+    //
+
+    CONFIG_VARIABLE_INT(screen_wipe),
+
     //!
     // If non-zero, save screenshots in PNG format.
     //
@@ -1489,6 +1503,30 @@ static default_t extra_defaults_list[] =
 
     CONFIG_VARIABLE_KEY(key_demo_quit),
 
+    //!
+    // Key to go back a second with -rewind.
+    //
+
+    CONFIG_VARIABLE_KEY(key_rewind),
+
+    //!
+    // Key to go back ten seconds in a demo with a -seekindex.
+    //
+
+    CONFIG_VARIABLE_KEY(key_demo_back),
+
+    //!
+    // Key to go forward ten seconds in a demo with a -seekindex.
+    //
+
+    CONFIG_VARIABLE_KEY(key_demo_forward),
+
+    //!
+    // Key to show or hide the performance overlay.
+    //
+
+    CONFIG_VARIABLE_KEY(key_perfhud),
+
     //!
     // Key to send a message during multiplayer games.
     //
@@ -1559,13 +1597,76 @@ static default_collection_t extra_defaults =
     NULL,
 };
 
+static unsigned int DefaultNameHash(char *name)
+{
+    unsigned int hash;
+
+    // FNV-1a
+
+    for (hash = 2166136261u; *name != '\0'; ++name)
+    {
+        hash = (hash ^ (unsigned char) *name) * 16777619u;
+    }
+
+    return hash;
+}
+
+// Build the hash table of a collection. Names are added in order,
+// so that the first of two with the same name is found, as before.
+
+static void BuildCollectionHash(default_collection_t *collection)
+{
+    unsigned int size;
+    unsigned int slot;
+    int i;
+
+    for (size = 16; size < collection->numdefaults * 2u; size <<= 1);
+
+    collection->hashtable = malloc(size * sizeof(*collection->hashtable));
+
+    if (collection->hashtable == NULL)
+    {
+        I_Error("BuildCollectionHash: out of memory");
+    }
+
+    collection->hashmask = size - 1;
+
+    for (slot = 0; slot < size; ++slot)
+    {
+        collection->hashtable[slot] = -1;
+    }
+
+    for (i=0; i<collection->numdefaults; ++i)
+    {
+        slot = DefaultNameHash(collection->defaults[i].name)
+             & collection->hashmask;
+
+        while (collection->hashtable[slot] != -1)
+        {
+            slot = (slot + 1) & collection->hashmask;
+        }
+
+        collection->hashtable[slot] = i;
+    }
+}
+
 // Search a collection for a variable
 
 static default_t *SearchCollection(default_collection_t *collection, char *name)
 {
+    unsigned int slot;
     int i;
 
-    for (i=0; i<collection->numdefaults; ++i)
+    if (collection->hashtable == NULL)
+    {
+        BuildCollectionHash(collection);
+    }
+
+    slot = DefaultNameHash(name) & collection->hashmask;
+
+    for (i = collection->hashtable[slot]; i != -1;
+         slot = (slot + 1) & collection->hashmask,
+         i = collection->hashtable[slot])
     {
         if (!strcmp(name, collection->defaults[i].name))
         {
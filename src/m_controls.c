@@ -111,6 +111,10 @@ int key_message_refresh = KEY_ENTER;
 int key_pause = KEY_PAUSE;
 int key_demo_quit = 'q';
 int key_spy = KEY_F12;
+int key_rewind = 'r';
+int key_demo_back = '[';
+int key_demo_forward = ']';
+int key_perfhud = '`';
 
 // Multiplayer chat keys:
 
@@ -370,6 +374,10 @@ void M_BindMenuControls(void)
     M_BindVariable("key_menu_screenshot",&key_menu_screenshot);
     M_BindVariable("key_demo_quit",      &key_demo_quit);
     M_BindVariable("key_spy",            &key_spy);
+    M_BindVariable("key_rewind",         &key_rewind);
+    M_BindVariable("key_demo_back",      &key_demo_back);
+    M_BindVariable("key_demo_forward",   &key_demo_forward);
+    M_BindVariable("key_perfhud",        &key_perfhud);
 }
 
 void M_BindChatControls(unsigned int num_players)
@@ -0,0 +1,139 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Fast 64 bit hash, for the keys of the caches on disk.
+//	The XXH64 algorithm: four lanes of 8 bytes, each a
+//	multiply and a rotate a step, so it runs at the speed
+//	of memory rather than SHA-1's few hundred MB/s.
+//
+
+
+#include <string.h>
+
+#include "m_hash.h"
+
+
+#define PRIME1	0x9e3779b185ebca87ull
+#define PRIME2	0xc2b2ae3d27d4eb4full
+#define PRIME3	0x165667b19e3779f9ull
+#define PRIME4	0x85ebca77c2b2ca63ull
+#define PRIME5	0x27d4eb2f165667c5ull
+
+#define ROTL(x, r)	((x) << (r) | (x) >> (64 - (r)))
+
+
+static inline uint64_t M_Read64 (const byte* p)
+{
+    uint64_t	value;
+
+    memcpy (&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t M_Read32 (const byte* p)
+{
+    uint32_t	value;
+
+    memcpy (&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t M_HashRound (uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = ROTL (acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t M_HashMerge (uint64_t hash, uint64_t lane)
+{
+    hash ^= M_HashRound (0, lane);
+    return hash * PRIME1 + PRIME4;
+}
+
+
+//
+// M_Hash64
+//
+uint64_t M_Hash64 (const void* data, size_t length, uint64_t seed)
+{
+    const byte*	p = data;
+    const byte*	end = p + length;
+    uint64_t	v1, v2, v3, v4;
+    uint64_t	hash;
+
+    if (length >= 32)
+    {
+	v1 = seed + PRIME1 + PRIME2;
+	v2 = seed + PRIME2;
+	v3 = seed;
+	v4 = seed - PRIME1;
+
+	do
+	{
+	    v1 = M_HashRound (v1, M_Read64 (p));
+	    v2 = M_HashRound (v2, M_Read64 (p + 8));
+	    v3 = M_HashRound (v3, M_Read64 (p + 16));
+	    v4 = M_HashRound (v4, M_Read64 (p + 24));
+	    p += 32;
+	} while (p <= end - 32);
+
+	hash = ROTL (v1, 1) + ROTL (v2, 7) + ROTL (v3, 12) + ROTL (v4, 18);
+	hash = M_HashMerge (hash, v1);
+	hash = M_HashMerge (hash, v2);
+	hash = M_HashMerge (hash, v3);
+	hash = M_HashMerge (hash, v4);
+    }
+    else
+    {
+	hash = seed + PRIME5;
+    }
+
+    hash += length;
+
+    for ( ; p + 8 <= end ; p += 8)
+    {
+	hash ^= M_HashRound (0, M_Read64 (p));
+	hash = ROTL (hash, 27) * PRIME1 + PRIME4;
+    }
+
+    if (p + 4 <= end)
+    {
+	hash ^= M_Read32 (p) * PRIME1;
+	hash = ROTL (hash, 23) * PRIME2 + PRIME3;
+	p += 4;
+    }
+
+    for ( ; p < end ; p++)
+    {
+	hash ^= *p * PRIME5;
+	hash = ROTL (hash, 11) * PRIME1;
+    }
+
+    // every bit of the input reaches every bit of the hash
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+
+//
+// M_HashInt
+//
+uint64_t M_HashInt (uint64_t hash, uint64_t value)
+{
+    return M_Hash64 (&value, sizeof(value), hash);
+}
@@ -0,0 +1,33 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Fast 64 bit hash, for the keys of the caches on disk.
+//
+
+
+#ifndef __M_HASH__
+#define __M_HASH__
+
+#include <stddef.h>
+
+#include "doomtype.h"
+
+// Hashes length bytes of data, going on from seed: the hash of
+//  one buffer is the seed of the next, to hash several in turn.
+// Not for checksums that other builds or machines must agree on,
+//  as the bytes are read in the machine's order.
+uint64_t M_Hash64 (const void* data, size_t length, uint64_t seed);
+
+// Folds a value into a hash.
+uint64_t M_HashInt (uint64_t hash, uint64_t value);
+
+#endif
@@ -20,6 +20,7 @@
 
 #include <stdlib.h>
 #include <ctype.h>
+#include <sys/stat.h>
 
 
 #include "doomdef.h"
@@ -215,6 +216,7 @@ void M_SetupNextMenu(menu_t *menudef);
 void M_DrawThermo(int x,int y,int thermWidth,int thermDot);
 void M_DrawEmptyCell(menu_t *menu,int item);
 void M_DrawSelCell(menu_t *menu,int item);
+static void M_DrawMenuPatch(int x, int y, char *name);
 void M_WriteText(int x, int y, char *string);
 int  M_StringWidth(char *string);
 int  M_StringHeight(char *string);
@@ -500,29 +502,97 @@ menu_t  SaveDef =
 // M_ReadSaveStrings
 //  read the strings from the savegame files
 //
+//  The description of each slot is kept with the size and time
+//  of its file, so a slot is only read again once its file has
+//  changed: opening the menus then takes a stat of each file,
+//  not an open and read, which is slow on a network drive.
+//
+typedef struct
+{
+    bool	valid;
+    time_t	mtime;
+    off_t	size;
+    char	description[SAVESTRINGSIZE];
+} saveslot_t;
+
+static saveslot_t	saveslots[10];
+
+static bool M_SaveSlotChanged(saveslot_t *slot, struct stat *st)
+{
+    return !slot->valid
+	|| slot->mtime != st->st_mtime
+	|| slot->size != st->st_size;
+}
+
 void M_ReadSaveStrings(void)
 {
     FILE   *handle;
     int     i;
     char    name[256];
+    struct stat	st;
+    saveslot_t	*slot;
 
     for (i = 0;i < load_end;i++)
     {
         M_StringCopy(name, P_SaveGameFile(i), sizeof(name));
+	slot = &saveslots[i];
 
-	handle = fopen(name, "rb");
-        if (handle == NULL)
+        if (stat(name, &st) != 0)
         {
+            slot->valid = false;
             M_StringCopy(savegamestrings[i], EMPTYSTRING, SAVESTRINGSIZE);
             LoadMenu[i].status = 0;
             continue;
         }
-	fread(&savegamestrings[i], 1, SAVESTRINGSIZE, handle);
-	fclose(handle);
+
+	if (M_SaveSlotChanged(slot, &st))
+	{
+	    handle = fopen(name, "rb");
+	    if (handle == NULL)
+	    {
+		slot->valid = false;
+		M_StringCopy(savegamestrings[i], EMPTYSTRING, SAVESTRINGSIZE);
+		LoadMenu[i].status = 0;
+		continue;
+	    }
+	    memset(slot->description, 0, SAVESTRINGSIZE);
+	    fread(slot->description, 1, SAVESTRINGSIZE, handle);
+	    fclose(handle);
+
+	    slot->valid = true;
+	    slot->mtime = st.st_mtime;
+	    slot->size = st.st_size;
+	}
+
+	memcpy(savegamestrings[i], slot->description, SAVESTRINGSIZE);
 	LoadMenu[i].status = 1;
     }
 }
 
+//
+// M_SaveGameWritten
+//  Keeps the description of a save just written, with its file
+//  as it is now, so the menus don't read it back.
+//
+void M_SaveGameWritten(int slotnum, char *description)
+{
+    struct stat	st;
+    saveslot_t	*slot;
+
+    if (slotnum < 0 || slotnum >= load_end)
+	return;
+
+    slot = &saveslots[slotnum];
+    slot->valid = stat(P_SaveGameFile(slotnum), &st) == 0;
+    if (!slot->valid)
+	return;
+
+    memset(slot->description, 0, SAVESTRINGSIZE);
+    M_StringCopy(slot->description, description, SAVESTRINGSIZE);
+    slot->mtime = st.st_mtime;
+    slot->size = st.st_size;
+}
+
 
 //
 // M_LoadGame & Cie.
@@ -531,8 +601,7 @@ void M_DrawLoad(void)
 {
     int             i;
 	
-    V_DrawPatchDirect(72, 28, 
-                      W_CacheLumpName(DEH_String("M_LOADG"), PU_CACHE));
+    M_DrawMenuPatch(72, 28, DEH_String("M_LOADG"));
 
     for (i = 0;i < load_end; i++)
     {
@@ -550,18 +619,15 @@ void M_DrawSaveLoadBorder(int x,int y)
 {
     int             i;
 	
-    V_DrawPatchDirect(x - 8, y + 7,
-                      W_CacheLumpName(DEH_String("M_LSLEFT"), PU_CACHE));
+    M_DrawMenuPatch(x - 8, y + 7, DEH_String("M_LSLEFT"));
 	
     for (i = 0;i < 24;i++)
     {
-	V_DrawPatchDirect(x, y + 7,
-                          W_CacheLumpName(DEH_String("M_LSCNTR"), PU_CACHE));
+	M_DrawMenuPatch(x, y + 7, DEH_String("M_LSCNTR"));
 	x += 8;
     }
 
-    V_DrawPatchDirect(x, y + 7, 
-                      W_CacheLumpName(DEH_String("M_LSRGHT"), PU_CACHE));
+    M_DrawMenuPatch(x, y + 7, DEH_String("M_LSRGHT"));
 }
 
 
@@ -602,7 +668,7 @@ void M_DrawSave(void)
 {
     int             i;
 	
-    V_DrawPatchDirect(72, 28, W_CacheLumpName(DEH_String("M_SAVEG"), PU_CACHE));
+    M_DrawMenuPatch(72, 28, DEH_String("M_SAVEG"));
     for (i = 0;i < load_end; i++)
     {
 	M_DrawSaveLoadBorder(LoadDef.x,LoadDef.y+LINEHEIGHT*i);
@@ -833,7 +899,7 @@ void M_DrawReadThis2(void)
 //
 void M_DrawSound(void)
 {
-    V_DrawPatchDirect (60, 38, W_CacheLumpName(DEH_String("M_SVOL"), PU_CACHE));
+    M_DrawMenuPatch(60, 38, DEH_String("M_SVOL"));
 
     M_DrawThermo(SoundDef.x,SoundDef.y+LINEHEIGHT*(sfx_vol+1),
 		 16,sfxVolume);
@@ -889,8 +955,7 @@ void M_MusicVol(int choice)
 //
 void M_DrawMainMenu(void)
 {
-    V_DrawPatchDirect(94, 2,
-                      W_CacheLumpName(DEH_String("M_DOOM"), PU_CACHE));
+    M_DrawMenuPatch(94, 2, DEH_String("M_DOOM"));
 }
 
 
@@ -901,8 +966,8 @@ void M_DrawMainMenu(void)
 //
 void M_DrawNewGame(void)
 {
-    V_DrawPatchDirect(96, 14, W_CacheLumpName(DEH_String("M_NEWG"), PU_CACHE));
-    V_DrawPatchDirect(54, 38, W_CacheLumpName(DEH_String("M_SKILL"), PU_CACHE));
+    M_DrawMenuPatch(96, 14, DEH_String("M_NEWG"));
+    M_DrawMenuPatch(54, 38, DEH_String("M_SKILL"));
 }
 
 void M_NewGame(int choice)
@@ -929,7 +994,7 @@ int     epi;
 
 void M_DrawEpisode(void)
 {
-    V_DrawPatchDirect(54, 38, W_CacheLumpName(DEH_String("M_EPISOD"), PU_CACHE));
+    M_DrawMenuPatch(54, 38, DEH_String("M_EPISOD"));
 }
 
 void M_VerifyNightmare(int key)
@@ -986,16 +1051,13 @@ static char *msgNames[2] = {"M_MSGOFF","M_MSGON"};
 
 void M_DrawOptions(void)
 {
-    V_DrawPatchDirect(108, 15, W_CacheLumpName(DEH_String("M_OPTTTL"),
-                                               PU_CACHE));
+    M_DrawMenuPatch(108, 15, DEH_String("M_OPTTTL"));
 	
-    V_DrawPatchDirect(OptionsDef.x + 175, OptionsDef.y + LINEHEIGHT * detail,
-		      W_CacheLumpName(DEH_String(detailNames[detailLevel]),
-			              PU_CACHE));
+    M_DrawMenuPatch(OptionsDef.x + 175, OptionsDef.y + LINEHEIGHT * detail,
+		    DEH_String(detailNames[detailLevel]));
 
-    V_DrawPatchDirect(OptionsDef.x + 120, OptionsDef.y + LINEHEIGHT * messages,
-                      W_CacheLumpName(DEH_String(msgNames[showMessages]),
-                                      PU_CACHE));
+    M_DrawMenuPatch(OptionsDef.x + 120, OptionsDef.y + LINEHEIGHT * messages,
+		    DEH_String(msgNames[showMessages]));
 
     M_DrawThermo(OptionsDef.x, OptionsDef.y + LINEHEIGHT * (mousesens + 1),
 		 10, mouseSensitivity);
@@ -1251,17 +1313,16 @@ M_DrawThermo
     int		i;
 
     xx = x;
-    V_DrawPatchDirect(xx, y, W_CacheLumpName(DEH_String("M_THERML"), PU_CACHE));
+    M_DrawMenuPatch(xx, y, DEH_String("M_THERML"));
     xx += 8;
     for (i=0;i<thermWidth;i++)
     {
-	V_DrawPatchDirect(xx, y, W_CacheLumpName(DEH_String("M_THERMM"), PU_CACHE));
+	M_DrawMenuPatch(xx, y, DEH_String("M_THERMM"));
 	xx += 8;
     }
-    V_DrawPatchDirect(xx, y, W_CacheLumpName(DEH_String("M_THERMR"), PU_CACHE));
+    M_DrawMenuPatch(xx, y, DEH_String("M_THERMR"));
 
-    V_DrawPatchDirect((x + 8) + thermDot * 8, y,
-		      W_CacheLumpName(DEH_String("M_THERMO"), PU_CACHE));
+    M_DrawMenuPatch((x + 8) + thermDot * 8, y, DEH_String("M_THERMO"));
 }
 
 
@@ -1309,6 +1370,77 @@ void M_StopMessage(void)
 
 
 
+//
+// M_DrawMenuPatch
+// Draws a menu graphic, or with -textoverlay, the words on it.
+//
+static struct
+{
+    char *name;
+    char *text;
+} menutext[] = {
+    { "M_DOOM",   "DOOM" },
+    { "M_NGAME",  "New Game" },
+    { "M_OPTION", "Options" },
+    { "M_LOADG",  "Load Game" },
+    { "M_SAVEG",  "Save Game" },
+    { "M_RDTHIS", "Read This!" },
+    { "M_QUITG",  "Quit Game" },
+    { "M_NEWG",   "NEW GAME" },
+    { "M_SKILL",  "Choose Skill Level:" },
+    { "M_JKILL",  "I'm too young to die." },
+    { "M_ROUGH",  "Hey, not too rough." },
+    { "M_HURT",   "Hurt me plenty." },
+    { "M_ULTRA",  "Ultra-Violence." },
+    { "M_NMARE",  "Nightmare!" },
+    { "M_EPISOD", "Which Episode?" },
+    { "M_EPI1",   "Knee-Deep in the Dead" },
+    { "M_EPI2",   "The Shores of Hell" },
+    { "M_EPI3",   "Inferno" },
+    { "M_EPI4",   "Thy Flesh Consumed" },
+    { "M_OPTTTL", "OPTIONS" },
+    { "M_ENDGAM", "End Game" },
+    { "M_MESSG",  "Messages:" },
+    { "M_DETAIL", "Graphic Detail:" },
+    { "M_GDHIGH", "high" },
+    { "M_GDLOW",  "low" },
+    { "M_MSGON",  "on" },
+    { "M_MSGOFF", "off" },
+    { "M_SCRNSZ", "Screen Size" },
+    { "M_MSENS",  "Mouse Sensitivity" },
+    { "M_SVOL",   "Sound Volume" },
+    { "M_SFXVOL", "Sfx Volume" },
+    { "M_MUSVOL", "Music Volume" },
+    { "M_THERML", "[" },
+    { "M_THERMM", "-" },
+    { "M_THERMR", "]" },
+    { "M_THERMO", "o" },
+    // the save slots' borders are left out
+    { "M_LSLEFT", "" },
+    { "M_LSCNTR", "" },
+    { "M_LSRGHT", "" },
+};
+
+static void M_DrawMenuPatch(int x, int y, char *name)
+{
+    size_t	i;
+
+    if (I_TextOverlay())
+    {
+	for (i = 0; i < arrlen(menutext); i++)
+	{
+	    if (!strcasecmp(name, menutext[i].name))
+	    {
+		I_DrawText(x, y, menutext[i].text);
+		return;
+	    }
+	}
+    }
+
+    V_DrawPatchDirect(x, y, W_CacheLumpName(name, PU_CACHE));
+}
+
+
 //
 // Find string width from hu_font chars
 //
@@ -1317,6 +1449,9 @@ int M_StringWidth(char* string)
     size_t             i;
     int             w = 0;
     int             c;
+
+    if (I_TextOverlay())
+	return I_TextWidth(string);
 	
     for (i = 0;i < strlen(string);i++)
     {
@@ -1366,9 +1501,29 @@ M_WriteText
     int		cy;
 		
 
+    char	line[80];
+    int		len;
+
     ch = string;
     cx = x;
     cy = y;
+
+    // as text, a line at a time
+    if (I_TextOverlay())
+    {
+	while (*ch)
+	{
+	    for (len = 0; ch[len] && ch[len] != '\n'; len++)
+		;
+	    M_StringCopy(line, ch, len + 1 < sizeof(line) ? len + 1 : sizeof(line));
+	    I_DrawText(x, cy, line);
+	    cy += 12;
+	    ch += len;
+	    if (*ch)
+		ch++;
+	}
+	return;
+    }
 	
     while(1)
     {
@@ -2022,13 +2177,19 @@ void M_Drawer (void)
 
 	if (name[0])
 	{
-	    V_DrawPatchDirect (x, y, W_CacheLumpName(name, PU_CACHE));
+	    M_DrawMenuPatch(x, y, name);
 	}
 	y += LINEHEIGHT;
     }
 
     
     // DRAW SKULL
+    if (I_TextOverlay())
+    {
+	// on the item's line, as the skull is taller than the items
+	I_DrawText(x + SKULLXOFF, currentMenu->y + itemOn*LINEHEIGHT, ">");
+	return;
+    }
     V_DrawPatchDirect(x + SKULLXOFF, currentMenu->y - 5 + itemOn*LINEHEIGHT,
 		      W_CacheLumpName(DEH_String(skullName[whichSkull]),
 				      PU_CACHE));
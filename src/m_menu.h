@@ -51,6 +51,10 @@ void M_Init (void);
 // does nothing if menu is already up.
 void M_StartControlPanel (void);
 
+// Called once a save is written,
+// so the load and save menus don't read the slot again.
+void M_SaveGameWritten (int slot, char *description);
+
 
 
 extern int detailLevel;
@@ -0,0 +1,569 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Stage timings of -timedemo.
+//	While a timedemo plays, the time spent in each stage of
+//	a frame is added up to the nanosecond, from running the
+//	tic to writing the frame, and kept as one sample a frame
+//	along with the frame's size. The spread of each is
+//	printed when the demo ends.
+//	For -perfhud, the stages are timed the same way and
+//	averaged over each second instead, and for -perfdump
+//	kept a level at a time.
+//	The latency from a key press to the frame showing it is
+//	measured all the time, for the above and for -metrics.
+//
+
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#include "doomtype.h"
+#include "doomgeneric.h"
+#include "doomstat.h"
+
+#include "d_sched.h"
+#include "i_system.h"
+
+#include "m_argv.h"
+#include "m_timing.h"
+#include "m_trace.h"
+
+
+#define MAXNESTING	8
+#define MAXSTARTUPSTEPS	32
+
+typedef struct
+{
+    unsigned int*	samples;
+    int			numsamples;
+    int			maxsamples;
+} samples_t;
+
+static const char *stagenames[NUMSTAGES] =
+{
+    "ticker", "bsp", "planes", "masked", "queue",
+    "hud", "downsample", "encode", "write"
+};
+
+bool			stagetiming;
+stageaverages_t		stageaverages;
+
+static bool		stageaveraging;
+static bool		stageleveling;
+
+#define STAGESKEPT	(stagetiming || stageaveraging || stageleveling)
+
+static samples_t	stagesamples[NUMSTAGES];
+static samples_t	bytesamples;
+static samples_t	latencysamples;
+
+// this loop's
+static uint64_t		stagetime[NUMSTAGES];
+static bool		stageran[NUMSTAGES];
+static int		framebytes;
+
+// the stages running, innermost last
+static stage_t		running[MAXNESTING];
+static int		numrunning;
+static uint64_t		resumetime;
+
+// this second's, for the averages
+static uint64_t		secondstart;
+static uint64_t		secondtime[NUMSTAGES];
+static int		secondruns[NUMSTAGES];
+static uint64_t		secondbytes;
+static int		secondframes;
+static uint64_t		secondlatency;
+static int		secondinputs;
+
+// this level's, for -perfdump
+static samples_t	levelsamples[NUMSTAGES];
+static int		levelframes;
+static int		leveldropped;
+static uint64_t		levelbytes;
+
+// the key press being followed through
+typedef enum
+{
+    INPUT_NONE,
+    INPUT_READ,		// waiting for a ticcmd
+    INPUT_BUILT,	// waiting for a frame of a later gametic
+    INPUT_SHOWN		// waiting for the frame to be written
+} inputstate_t;
+
+static inputstate_t	inputstate;
+static uint64_t		inputtime;
+static int		inputtic;
+
+// the startup profile, the first frame's time last
+static char*		startupnames[MAXSTARTUPSTEPS];
+static uint64_t		startuptimes[MAXSTARTUPSTEPS + 1];
+static int		numstartupsteps;
+static bool		startupdone;
+
+
+static uint64_t M_StageClock (void)
+{
+#ifdef _WIN32
+    return DG_GetTicksUs () * 1000;
+#else
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+
+static void M_AddSample (samples_t *s, unsigned int value)
+{
+    if (s->numsamples == s->maxsamples)
+    {
+	// room for half an hour at the tic rate from the start,
+	//  so that -checkallocs rarely sees it grow
+	s->maxsamples = s->maxsamples ? s->maxsamples * 2 : 65536;
+	s->samples = realloc (s->samples, s->maxsamples * sizeof(*s->samples));
+	if (s->samples == NULL)
+	    I_Error ("M_AddSample: out of memory");
+    }
+
+    s->samples[s->numsamples++] = value;
+}
+
+
+//
+// M_StartStageTiming
+//
+void M_StartStageTiming (void)
+{
+    if (!stageaveraging && !stageleveling)
+	numrunning = 0;
+
+    stagetiming = true;
+}
+
+
+//
+// M_AverageStages
+//
+void M_AverageStages (bool on)
+{
+    int		i;
+
+    if (on && !stageaveraging)
+    {
+	if (!stagetiming && !stageleveling)
+	    numrunning = 0;
+
+	for (i=0 ; i<NUMSTAGES ; i++)
+	{
+	    secondtime[i] = 0;
+	    secondruns[i] = 0;
+	}
+
+	secondbytes = 0;
+	secondframes = 0;
+	secondlatency = 0;
+	secondinputs = 0;
+	secondstart = M_StageClock ();
+    }
+
+    stageaveraging = on;
+}
+
+
+//
+// M_FinishSecond
+// Once a second has gone by, turns its sums into averages.
+//
+static void M_FinishSecond (void)
+{
+    uint64_t	now;
+    int		i;
+
+    now = M_StageClock ();
+
+    if (now - secondstart < 1000000000ull)
+	return;
+
+    for (i=0 ; i<NUMSTAGES ; i++)
+    {
+	stageaverages.stagetime[i] =
+	    secondruns[i] ? secondtime[i] / 1000.0 / secondruns[i] : 0;
+	secondtime[i] = 0;
+	secondruns[i] = 0;
+    }
+
+    stageaverages.fps = secondframes * 1000000000.0 / (now - secondstart);
+    stageaverages.bytes = secondframes ? secondbytes / secondframes : 0;
+    stageaverages.generation++;
+
+    if (secondinputs)
+	stageaverages.latency = secondlatency / 1000000.0 / secondinputs;
+
+    secondbytes = 0;
+    secondframes = 0;
+    secondlatency = 0;
+    secondinputs = 0;
+    secondstart = now;
+}
+
+
+//
+// M_StartStage
+//
+void M_StartStage (stage_t stage)
+{
+    uint64_t	now;
+
+    TRACE_BEGIN (stagenames[stage]);
+
+    if (!STAGESKEPT || numrunning == MAXNESTING)
+	return;
+
+    now = M_StageClock ();
+
+    if (numrunning > 0)
+	stagetime[running[numrunning-1]] += now - resumetime;
+
+    running[numrunning++] = stage;
+    stageran[stage] = true;
+    resumetime = now;
+}
+
+
+//
+// M_EndStage
+// Timing may have started within the stage,
+//  which then isn't counted.
+//
+void M_EndStage (stage_t stage)
+{
+    uint64_t	now;
+
+    TRACE_END (stagenames[stage]);
+
+    if (!STAGESKEPT || numrunning == 0 || running[numrunning-1] != stage)
+	return;
+
+    now = M_StageClock ();
+    stagetime[stage] += now - resumetime;
+    numrunning--;
+    resumetime = now;
+}
+
+
+//
+// M_StageBytes
+//
+void M_StageBytes (int bytes)
+{
+    if (STAGESKEPT)
+	framebytes += bytes;
+}
+
+
+//
+// M_FrameDropped
+//
+void M_FrameDropped (void)
+{
+    leveldropped++;
+}
+
+
+//
+// M_FinishStageFrame
+//
+void M_FinishStageFrame (void)
+{
+    int		i;
+
+    if (!STAGESKEPT)
+	return;
+
+    // a frame was drawn if it was turned into pixels
+    if (stageran[STAGE_DOWNSAMPLE])
+    {
+	secondframes++;
+	levelframes++;
+    }
+
+    for (i=0 ; i<NUMSTAGES ; i++)
+    {
+	if (stageran[i])
+	{
+	    if (stagetiming)
+		M_AddSample (&stagesamples[i], stagetime[i]);
+	    if (stageleveling)
+		M_AddSample (&levelsamples[i], stagetime[i]);
+
+	    secondtime[i] += stagetime[i];
+	    secondruns[i]++;
+	}
+
+	stagetime[i] = 0;
+	stageran[i] = false;
+    }
+
+    if (framebytes > 0 && stagetiming)
+	M_AddSample (&bytesamples, framebytes);
+
+    secondbytes += framebytes;
+    levelbytes += framebytes;
+    framebytes = 0;
+
+    if (stageaveraging)
+	M_FinishSecond ();
+}
+
+
+static int M_CompareSamples (const void *a, const void *b)
+{
+    unsigned int	x = *(const unsigned int *) a;
+    unsigned int	y = *(const unsigned int *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+// Sorts the samples, returns the minimum, median and 99th percentile.
+static void M_Spread (samples_t *s, unsigned int spread[3])
+{
+    qsort (s->samples, s->numsamples, sizeof(*s->samples), M_CompareSamples);
+
+    spread[0] = s->samples[0];
+    spread[1] = s->samples[s->numsamples / 2];
+    spread[2] = s->samples[(s->numsamples - 1) * 99 / 100];
+}
+
+
+//
+// M_KeepLevelStages
+//
+void M_KeepLevelStages (void)
+{
+    if (!stagetiming && !stageaveraging)
+	numrunning = 0;
+
+    stageleveling = true;
+}
+
+
+//
+// M_FinishLevelStages
+//
+void M_FinishLevelStages (levelstages_t *level)
+{
+    unsigned int	spread[3];
+    uint64_t		sum;
+    samples_t*		s;
+    int			i;
+    int			j;
+
+    for (i=0 ; i<NUMSTAGES ; i++)
+    {
+	s = &levelsamples[i];
+	level->mean[i] = 0;
+	level->p99[i] = 0;
+
+	if (s->numsamples == 0)
+	    continue;
+
+	sum = 0;
+	for (j=0 ; j<s->numsamples ; j++)
+	    sum += s->samples[j];
+
+	M_Spread (s, spread);
+	level->mean[i] = sum / 1000.0 / s->numsamples;
+	level->p99[i] = spread[2] / 1000.0;
+	s->numsamples = 0;
+    }
+
+    level->frames = levelframes;
+    level->dropped = leveldropped;
+    level->bytes = levelbytes;
+
+    levelframes = 0;
+    leveldropped = 0;
+    levelbytes = 0;
+}
+
+
+const char* M_StageName (stage_t stage)
+{
+    return stagenames[stage];
+}
+
+
+//
+// M_PrintStageTimes
+//
+void M_PrintStageTimes (void)
+{
+    unsigned int	spread[3];
+    int			i;
+
+    if (!stagetiming)
+	return;
+
+    stagetiming = false;
+
+    printf ("M_PrintStageTimes: %-10s %8s %10s %10s %10s\n",
+	    "stage", "samples", "min us", "median us", "p99 us");
+
+    for (i=0 ; i<NUMSTAGES ; i++)
+    {
+	if (stagesamples[i].numsamples == 0)
+	    continue;
+
+	M_Spread (&stagesamples[i], spread);
+	printf ("M_PrintStageTimes: %-10s %8i %10.1f %10.1f %10.1f\n",
+		stagenames[i], stagesamples[i].numsamples,
+		spread[0] / 1000.0, spread[1] / 1000.0, spread[2] / 1000.0);
+    }
+
+    if (latencysamples.numsamples > 0)
+    {
+	M_Spread (&latencysamples, spread);
+	printf ("M_PrintStageTimes: %-10s %8i %10.1f %10.1f %10.1f\n",
+		"input", latencysamples.numsamples,
+		spread[0] / 1000.0, spread[1] / 1000.0, spread[2] / 1000.0);
+    }
+
+    if (bytesamples.numsamples == 0)
+	return;
+
+    M_Spread (&bytesamples, spread);
+    printf ("M_PrintStageTimes: %-10s %8i %10u %10u %10u\n",
+	    "bytes", bytesamples.numsamples, spread[0], spread[1], spread[2]);
+}
+
+
+//
+// M_InputRead
+//
+void M_InputRead (void)
+{
+    if (inputstate != INPUT_NONE)
+	return;
+
+    inputstate = INPUT_READ;
+    inputtime = M_StageClock ();
+}
+
+
+//
+// M_InputTic
+//
+void M_InputTic (int tic)
+{
+    if (inputstate != INPUT_READ)
+	return;
+
+    inputstate = INPUT_BUILT;
+    inputtic = tic;
+}
+
+
+//
+// M_FrameEncoded
+//
+void M_FrameEncoded (void)
+{
+    if (inputstate == INPUT_BUILT && gametic > inputtic)
+	inputstate = INPUT_SHOWN;
+}
+
+
+//
+// M_FrameWritten
+//
+void M_FrameWritten (void)
+{
+    uint64_t	latency;
+
+    if (inputstate != INPUT_SHOWN)
+	return;
+
+    inputstate = INPUT_NONE;
+    latency = M_StageClock () - inputtime;
+
+    if (stagetiming)
+	M_AddSample (&latencysamples, latency < UINT_MAX ? latency : UINT_MAX);
+
+    if (stageaveraging)
+    {
+	secondlatency += latency;
+	secondinputs++;
+    }
+
+    D_SessionCount (STAT_LATENCY, latency / 1000);
+    D_SessionCount (STAT_INPUTS, 1);
+}
+
+
+//
+// M_StartupStep
+//
+void M_StartupStep (char* name)
+{
+    if (startupdone || numstartupsteps == MAXSTARTUPSTEPS)
+	return;
+
+    startupnames[numstartupsteps] = name;
+    startuptimes[numstartupsteps] = M_StageClock ();
+    numstartupsteps++;
+}
+
+
+//
+// M_PrintStartupTimes
+//
+static void M_PrintStartupTimes (void)
+{
+    int		i;
+
+    for (i=0 ; i<numstartupsteps ; i++)
+	printf ("M_PrintStartupTimes: %-24s %10.1f ms\n", startupnames[i],
+		(startuptimes[i + 1] - startuptimes[i]) / 1000000.0);
+
+    printf ("M_PrintStartupTimes: %-24s %10.1f ms\n", "first frame",
+	    (startuptimes[numstartupsteps] - startuptimes[0]) / 1000000.0);
+}
+
+
+//
+// M_FinishStartup
+//
+void M_FinishStartup (void)
+{
+    if (startupdone)
+	return;
+
+    startupdone = true;
+    startuptimes[numstartupsteps] = M_StageClock ();
+
+    //!
+    // Time each step of the startup up to the first frame
+    // drawn, and print them at exit.
+    //
+
+    if (numstartupsteps > 0 && M_CheckParm ("-startuptime"))
+	I_AtExit (M_PrintStartupTimes, true);
+}
@@ -0,0 +1,122 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Stage timings of -timedemo.
+//
+
+
+#ifndef __M_TIMING__
+#define __M_TIMING__
+
+#include "doomtype.h"
+
+// The parts of a frame that are timed.
+typedef enum
+{
+    STAGE_TICKER,	// G_Ticker
+    STAGE_BSP,		// R_RenderBSPNode
+    STAGE_PLANES,	// R_DrawPlanes
+    STAGE_MASKED,	// R_DrawMasked
+    STAGE_QUEUE,	// -drawqueue and -transposeview finishing the view
+    STAGE_HUD,		// ST_Drawer and HU_Drawer
+    STAGE_DOWNSAMPLE,	// I_FinishUpdate turning the screen into pixels
+    STAGE_ENCODE,	// DG_DrawFrame, without its writes
+    STAGE_WRITE,	// the backend writing to the terminal
+    NUMSTAGES
+} stage_t;
+
+// Set while a timedemo is being timed.
+extern bool	stagetiming;
+
+// Each stage's average time over the last second, in
+//  microseconds a loop it ran in, with the frames drawn
+//  then and their average size. Kept while averaging.
+typedef struct
+{
+    float	stagetime[NUMSTAGES];
+    float	fps;
+    float	latency;	// ms, kept from earlier without input
+    int		bytes;
+    unsigned	generation;	// bumped every second
+} stageaverages_t;
+
+extern stageaverages_t	stageaverages;
+
+// Starts or stops keeping the averages, for -perfhud.
+void	M_AverageStages (bool on);
+
+// A level's frames, for -perfdump: each stage's mean and
+//  99th percentile in microseconds, 0 where it didn't run,
+//  with the frames drawn and dropped and the bytes sent.
+typedef struct
+{
+    float	mean[NUMSTAGES];
+    float	p99[NUMSTAGES];
+    int		frames;
+    int		dropped;
+    uint64_t	bytes;
+} levelstages_t;
+
+// Starts keeping the samples of each level.
+void	M_KeepLevelStages (void);
+
+// Fills in the level's so far, and starts the next one's.
+void	M_FinishLevelStages (levelstages_t *level);
+
+const char* M_StageName (stage_t stage);
+
+// Called once a timedemo starts playing.
+void	M_StartStageTiming (void);
+
+// Time a stage. A stage started within another is
+//  taken out of the other's time.
+void	M_StartStage (stage_t stage);
+void	M_EndStage (stage_t stage);
+
+// Called by the backend with the size of each frame.
+void	M_StageBytes (int bytes);
+
+// Called by the backend for each frame it drops.
+void	M_FrameDropped (void);
+
+// Called once a loop, keeps the time of each stage that
+//  ran in it as one sample.
+void	M_FinishStageFrame (void);
+
+// Prints the minimum, median and 99th percentile of each
+//  stage, of the frame sizes and of the input latency.
+void	M_PrintStageTimes (void);
+
+// Input latency is measured from a key press being read
+//  to the first frame showing a tic built after it being
+//  all written out, for one press at a time.
+
+// Called by the backend as it reads a key press.
+void	M_InputRead (void);
+
+// Called by G_BuildTiccmd with the tic being built.
+void	M_InputTic (int tic);
+
+// Called by the backend as it encodes a frame of gametic,
+//  and once a frame is all written.
+void	M_FrameEncoded (void);
+void	M_FrameWritten (void);
+
+// Startup profile, for -startuptime: a step runs from its
+//  call to the next one, the last up to the first frame.
+void	M_StartupStep (char* name);
+
+// Called after each frame is drawn. Ends the last step the
+//  first time, the profile being printed at exit.
+void	M_FinishStartup (void);
+
+#endif
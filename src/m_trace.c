@@ -0,0 +1,246 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Event tracing, built with TRACE=1.
+//	With -trace <file>, the hot paths mark where they begin
+//	and end, in a ring per thread holding its most recent
+//	events. They are written to file as a Chrome trace, to
+//	open in Perfetto or chrome://tracing, when the game
+//	exits and, on POSIX, whenever it gets SIGUSR1. Without
+//	TRACE=1 the marks compile to nothing.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "doomtype.h"
+#include "doomgeneric.h"
+
+#include "i_system.h"
+#include "m_argv.h"
+
+#include "m_trace.h"
+
+
+#ifdef TRACE
+
+// Events kept per thread
+#define TRACE_EVENTS	(1 << 16)
+
+#ifdef _WIN32
+#define TRACELOCAL
+#else
+#define TRACELOCAL	__thread
+#endif
+
+typedef struct
+{
+    uint64_t		time;		// ns
+    const char*		name;
+    char		phase;
+} traceevent_t;
+
+typedef struct tracering_s
+{
+    traceevent_t	events[TRACE_EVENTS];
+    unsigned		count;		// ever added
+    int			tid;
+    struct tracering_s*	next;
+} tracering_t;
+
+bool			tracing;
+
+static char*		tracefile;
+static uint64_t		tracestart;
+static tracering_t*	rings;
+static int		numrings;
+static TRACELOCAL tracering_t* myring;
+
+#ifndef _WIN32
+static pthread_mutex_t	ringslock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t tracerequested;
+#endif
+
+
+static uint64_t M_TraceClock (void)
+{
+#ifdef _WIN32
+    return DG_GetTicksUs () * 1000;
+#else
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+
+//
+// M_TraceEvent
+//
+void M_TraceEvent (const char *name, char phase)
+{
+    traceevent_t*	event;
+
+    if (myring == NULL)
+    {
+	myring = calloc (1, sizeof(*myring));
+
+	if (myring == NULL)
+	{
+	    tracing = false;
+	    return;
+	}
+
+#ifndef _WIN32
+	pthread_mutex_lock (&ringslock);
+#endif
+	myring->tid = ++numrings;
+	myring->next = rings;
+	rings = myring;
+#ifndef _WIN32
+	pthread_mutex_unlock (&ringslock);
+#endif
+    }
+
+    event = &myring->events[myring->count++ % TRACE_EVENTS];
+    event->time = M_TraceClock ();
+    event->name = name;
+    event->phase = phase;
+}
+
+
+//
+// M_WriteTrace
+// Other threads may be adding events meanwhile,
+//  the few at the ends of their rings may be torn.
+//
+static void M_WriteTrace (void)
+{
+    traceevent_t*	event;
+    tracering_t*	ring;
+    FILE*		f;
+    char*		sep;
+    unsigned		first;
+    unsigned		i;
+    int			pid;
+
+    f = fopen (tracefile, "w");
+
+    if (f == NULL)
+    {
+	printf ("M_WriteTrace: couldn't write %s\n", tracefile);
+	return;
+    }
+
+#ifndef _WIN32
+    pid = getpid ();
+    pthread_mutex_lock (&ringslock);
+#else
+    pid = 1;
+#endif
+
+    fprintf (f, "{\"traceEvents\":[\n");
+    sep = "";
+
+    for (ring = rings ; ring != NULL ; ring = ring->next)
+    {
+	first = ring->count > TRACE_EVENTS ? ring->count - TRACE_EVENTS : 0;
+
+	for (i=first ; i != ring->count ; i++)
+	{
+	    event = &ring->events[i % TRACE_EVENTS];
+
+	    fprintf (f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+		     "\"pid\":%i,\"tid\":%i%s}", sep, event->name,
+		     event->phase, (event->time - tracestart) / 1000.0,
+		     pid, ring->tid, event->phase == 'i' ? ",\"s\":\"t\"" : "");
+	    sep = ",\n";
+	}
+    }
+
+    fprintf (f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+#ifndef _WIN32
+    pthread_mutex_unlock (&ringslock);
+#endif
+
+    fclose (f);
+}
+
+
+#ifndef _WIN32
+static void M_TraceSignal (int sig)
+{
+    tracerequested = 1;
+}
+#endif
+
+#endif
+
+
+//
+// M_InitTrace
+//
+void M_InitTrace (void)
+{
+    int		p;
+
+    //!
+    // @arg <file>
+    //
+    // Write a trace of the hot paths to file when the game exits,
+    // or on SIGUSR1, to open in Perfetto. Needs a build made with
+    // TRACE=1.
+    //
+
+    p = M_CheckParmWithArgs ("-trace", 1);
+
+    if (!p)
+	return;
+
+#ifdef TRACE
+    tracefile = myargv[p+1];
+    tracestart = M_TraceClock ();
+    tracing = true;
+
+    I_AtExit (M_WriteTrace, true);
+#ifndef _WIN32
+    signal (SIGUSR1, M_TraceSignal);
+#endif
+#else
+    printf ("M_InitTrace: -trace needs a build made with TRACE=1\n");
+#endif
+}
+
+
+//
+// M_TraceTicker
+//
+void M_TraceTicker (void)
+{
+#if defined(TRACE) && !defined(_WIN32)
+    if (tracerequested)
+    {
+	tracerequested = 0;
+	M_WriteTrace ();
+    }
+#endif
+}
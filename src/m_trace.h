@@ -0,0 +1,49 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Event tracing, built with TRACE=1.
+//
+
+
+#ifndef __M_TRACE__
+#define __M_TRACE__
+
+#include "doomtype.h"
+
+#ifdef TRACE
+
+// Set by -trace.
+extern bool	tracing;
+
+// Adds an event to the calling thread's ring: 'B' to begin
+//  a span, 'E' to end it, or 'i' for an instant.
+void	M_TraceEvent (const char *name, char phase);
+
+#define TRACE_BEGIN(name)	do { if (tracing) M_TraceEvent (name, 'B'); } while (0)
+#define TRACE_END(name)		do { if (tracing) M_TraceEvent (name, 'E'); } while (0)
+#define TRACE_INSTANT(name)	do { if (tracing) M_TraceEvent (name, 'i'); } while (0)
+
+#else
+
+#define TRACE_BEGIN(name)	do { } while (0)
+#define TRACE_END(name)		do { } while (0)
+#define TRACE_INSTANT(name)	do { } while (0)
+
+#endif
+
+// Called at startup, reads -trace.
+void	M_InitTrace (void);
+
+// Called once a loop, writes the trace if a signal asked for it.
+void	M_TraceTicker (void);
+
+#endif
@@ -0,0 +1,562 @@
+//
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Network client code.  The client sends its ticcmds to the
+//     server, and receives back the complete set of ticcmds for
+//     every tic.  Lost packets are made up for by resending every
+//     tic that the other end has not acknowledged yet.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "doomtype.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+#include "m_config.h"
+#include "m_misc.h"
+#include "net_client.h"
+#include "net_defs.h"
+#include "net_io.h"
+#include "net_packet.h"
+#include "net_server.h"
+#include "net_structrw.h"
+#include "z_zone.h"
+
+// Most tics sent in one packet
+
+#define MAX_PACKET_TICS 16
+
+// Times in ms
+
+#define CONNECT_TIMEOUT 10000
+#define SERVER_TIMEOUT 10000
+#define RESEND_TIME 500
+
+typedef enum
+{
+    CLIENT_STATE_CONNECTING,
+    CLIENT_STATE_WAITING_START,
+    CLIENT_STATE_IN_GAME,
+    CLIENT_STATE_DISCONNECTED,
+} net_clientstate_t;
+
+static net_clientstate_t client_state = CLIENT_STATE_DISCONNECTED;
+static net_context_t *client_context;
+static net_addr_t *server_addr;
+
+// Time a packet was last received from the server, and when we
+// last sent one of our own
+
+static int last_recv_time;
+static int last_send_time;
+
+// Settings sent with the game start request, and those that
+// the server sent back
+
+static net_gamesettings_t start_settings;
+static net_gamesettings_t settings;
+static bool start_requested;
+static bool received_settings;
+
+// Reason given by the server for rejecting us
+
+static char reject_reason[128];
+
+// Our ticcmds: send_maketic is the number built, send_acked the
+// number that the server has confirmed receiving
+
+static ticcmd_t send_cmds[BACKUPTICS];
+static int send_maketic;
+static int send_acked;
+
+// Complete tics received from the server so far
+
+static int recvtic;
+
+bool net_client_connected;
+bool net_client_received_wait_data;
+net_waitdata_t net_client_wait_data;
+bool net_waiting_for_launch = false;
+char *net_player_name = NULL;
+
+sha1_digest_t net_server_wad_sha1sum;
+sha1_digest_t net_server_deh_sha1sum;
+unsigned int net_server_is_freedoom;
+sha1_digest_t net_local_wad_sha1sum;
+sha1_digest_t net_local_deh_sha1sum;
+unsigned int net_local_is_freedoom;
+
+bool drone = false;
+
+// Called by the client when a complete set of ticcmds arrives
+
+extern void D_ReceiveTic(ticcmd_t *ticcmds, bool *playeringame);
+
+static void NET_CL_Shutdown(void)
+{
+    net_client_connected = false;
+    client_state = CLIENT_STATE_DISCONNECTED;
+}
+
+static void NET_CL_SendPacket(net_packet_t *packet)
+{
+    NET_SendPacket(server_addr, packet);
+    last_send_time = I_GetTimeMS();
+}
+
+static void NET_CL_SendSYN(net_connect_data_t *data)
+{
+    net_packet_t *packet;
+
+    packet = NET_NewPacket(64);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_SYN);
+    NET_WriteInt32(packet, NET_MAGIC_NUMBER);
+    NET_WriteString(packet, PACKAGE_STRING);
+    NET_WriteConnectData(packet, data);
+    NET_WriteString(packet, net_player_name);
+    NET_CL_SendPacket(packet);
+    NET_FreePacket(packet);
+}
+
+static void NET_CL_SendGameStart(void)
+{
+    net_packet_t *packet;
+
+    packet = NET_NewPacket(32);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_GAMESTART);
+    NET_WriteSettings(packet, &start_settings);
+    NET_CL_SendPacket(packet);
+    NET_FreePacket(packet);
+}
+
+// Sends the tics the server hasn't acknowledged, oldest first
+
+static void NET_CL_SendTics(void)
+{
+    net_packet_t *packet;
+    int start, count;
+    int i;
+
+    start = send_acked;
+    count = send_maketic - start;
+
+    if (count > MAX_PACKET_TICS)
+    {
+        count = MAX_PACKET_TICS;
+    }
+
+    packet = NET_NewPacket(64);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_GAMEDATA);
+    NET_WriteInt32(packet, recvtic);
+    NET_WriteInt32(packet, start);
+    NET_WriteInt8(packet, count);
+
+    for (i = start; i < start + count; ++i)
+    {
+        NET_WriteTiccmd(packet, &send_cmds[i % BACKUPTICS]);
+    }
+
+    NET_CL_SendPacket(packet);
+    NET_FreePacket(packet);
+}
+
+static void NET_CL_ParseACK(net_packet_t *packet)
+{
+    unsigned int player;
+
+    if (client_state != CLIENT_STATE_CONNECTING
+     || !NET_ReadInt8(packet, &player))
+    {
+        return;
+    }
+
+    client_state = CLIENT_STATE_WAITING_START;
+    net_client_connected = true;
+}
+
+static void NET_CL_ParseRejected(net_packet_t *packet)
+{
+    char *reason;
+
+    if (client_state != CLIENT_STATE_CONNECTING)
+    {
+        return;
+    }
+
+    reason = NET_ReadString(packet);
+
+    M_StringCopy(reject_reason, reason != NULL ? reason : "(unknown)",
+                 sizeof(reject_reason));
+    client_state = CLIENT_STATE_DISCONNECTED;
+}
+
+static void NET_CL_ParseWaitingData(net_packet_t *packet)
+{
+    unsigned int num_players, max_players;
+
+    if (!NET_ReadInt8(packet, &num_players)
+     || !NET_ReadInt8(packet, &max_players))
+    {
+        return;
+    }
+
+    if (!net_client_received_wait_data
+     || net_client_wait_data.num_players != (int) num_players)
+    {
+        printf("NET_CL: Waiting for players (%i of %i)\n",
+               num_players, max_players);
+    }
+
+    net_client_wait_data.num_players = num_players;
+    net_client_wait_data.max_players = max_players;
+    net_client_received_wait_data = true;
+}
+
+static void NET_CL_ParseGameStart(net_packet_t *packet)
+{
+    net_gamesettings_t new_settings;
+
+    if (client_state != CLIENT_STATE_WAITING_START
+     || !NET_ReadSettings(packet, &new_settings))
+    {
+        return;
+    }
+
+    if (new_settings.num_players < 1
+     || new_settings.consoleplayer >= new_settings.num_players)
+    {
+        return;
+    }
+
+    settings = new_settings;
+    received_settings = true;
+    client_state = CLIENT_STATE_IN_GAME;
+}
+
+// The server's packet acknowledges our tics and carries the
+// complete tics, each with the mask of players in the game and
+// their ticcmds
+
+static void NET_CL_ParseGameData(net_packet_t *packet)
+{
+    ticcmd_t cmds[NET_MAXPLAYERS];
+    bool ingame[NET_MAXPLAYERS];
+    unsigned int ack, start, count, mask;
+    unsigned int seq;
+    int i;
+
+    if (client_state != CLIENT_STATE_IN_GAME
+     || !NET_ReadInt32(packet, &ack)
+     || !NET_ReadInt32(packet, &start)
+     || !NET_ReadInt8(packet, &count))
+    {
+        return;
+    }
+
+    if ((int) ack > send_acked && (int) ack <= send_maketic)
+    {
+        send_acked = ack;
+    }
+
+    for (seq = start; seq < start + count; ++seq)
+    {
+        if (!NET_ReadInt8(packet, &mask))
+        {
+            return;
+        }
+
+        memset(cmds, 0, sizeof(cmds));
+
+        for (i = 0; i < NET_MAXPLAYERS; ++i)
+        {
+            ingame[i] = (mask & (1 << i)) != 0;
+
+            if (ingame[i] && !NET_ReadTiccmd(packet, &cmds[i]))
+            {
+                return;
+            }
+        }
+
+        // Tics arrive in order, older ones are resends
+
+        if ((int) seq == recvtic)
+        {
+            D_ReceiveTic(cmds, ingame);
+            ++recvtic;
+        }
+    }
+}
+
+static void NET_CL_ParsePacket(net_packet_t *packet)
+{
+    unsigned int packet_type;
+
+    if (!NET_ReadInt16(packet, &packet_type))
+    {
+        return;
+    }
+
+    last_recv_time = I_GetTimeMS();
+
+    switch (packet_type)
+    {
+        case NET_PACKET_TYPE_ACK:
+            NET_CL_ParseACK(packet);
+            break;
+
+        case NET_PACKET_TYPE_REJECTED:
+            NET_CL_ParseRejected(packet);
+            break;
+
+        case NET_PACKET_TYPE_WAITING_DATA:
+            NET_CL_ParseWaitingData(packet);
+            break;
+
+        case NET_PACKET_TYPE_GAMESTART:
+            NET_CL_ParseGameStart(packet);
+            break;
+
+        case NET_PACKET_TYPE_GAMEDATA:
+            NET_CL_ParseGameData(packet);
+            break;
+
+        case NET_PACKET_TYPE_DISCONNECT:
+            NET_CL_Shutdown();
+            D_ReceiveTic(NULL, NULL);
+            break;
+
+        default:
+            break;
+    }
+}
+
+//
+// Receive packets from the server, and resend what it is missing
+//
+
+void NET_CL_Run(void)
+{
+    net_addr_t *addr;
+    net_packet_t *packet;
+    int nowtime;
+
+    if (client_state == CLIENT_STATE_DISCONNECTED)
+    {
+        return;
+    }
+
+    while (client_state != CLIENT_STATE_DISCONNECTED
+        && NET_RecvPacket(client_context, &addr, &packet))
+    {
+        if (addr == server_addr)
+        {
+            NET_CL_ParsePacket(packet);
+        }
+
+        NET_FreePacket(packet);
+    }
+
+    if (!net_client_connected)
+    {
+        return;
+    }
+
+    nowtime = I_GetTimeMS();
+
+    if (nowtime - last_recv_time > SERVER_TIMEOUT)
+    {
+        fprintf(stderr, "NET_CL_Run: Timed out waiting for the server\n");
+        NET_CL_Shutdown();
+        D_ReceiveTic(NULL, NULL);
+        return;
+    }
+
+    if (nowtime - last_send_time < RESEND_TIME)
+    {
+        return;
+    }
+
+    // Nothing sent for a while: repeat the game start request, or
+    // the tics not acknowledged yet, which also keeps the server
+    // from timing us out
+
+    if (client_state == CLIENT_STATE_WAITING_START && start_requested)
+    {
+        NET_CL_SendGameStart();
+    }
+    else if (client_state == CLIENT_STATE_IN_GAME)
+    {
+        NET_CL_SendTics();
+    }
+}
+
+//
+// Connect to a server, blocking until accepted or rejected
+//
+
+bool NET_CL_Connect(net_addr_t *addr, net_connect_data_t *data)
+{
+    int start_time;
+    int last_syn_time;
+    int nowtime;
+
+    server_addr = addr;
+
+    memcpy(net_local_wad_sha1sum, data->wad_sha1sum, sizeof(sha1_digest_t));
+    memcpy(net_local_deh_sha1sum, data->deh_sha1sum, sizeof(sha1_digest_t));
+    net_local_is_freedoom = data->is_freedoom;
+
+    drone = data->drone;
+
+    client_context = NET_NewContext();
+    NET_AddModule(client_context, addr->module);
+
+    client_state = CLIENT_STATE_CONNECTING;
+    net_client_connected = false;
+    net_client_received_wait_data = false;
+    start_requested = false;
+    received_settings = false;
+    send_maketic = send_acked = recvtic = 0;
+    reject_reason[0] = '\0';
+
+    start_time = I_GetTimeMS();
+    last_syn_time = start_time - 1000;
+
+    while (client_state == CLIENT_STATE_CONNECTING)
+    {
+        nowtime = I_GetTimeMS();
+
+        if (nowtime - start_time > CONNECT_TIMEOUT)
+        {
+            client_state = CLIENT_STATE_DISCONNECTED;
+            M_StringCopy(reject_reason, "no response",
+                         sizeof(reject_reason));
+            break;
+        }
+
+        if (nowtime - last_syn_time >= 1000)
+        {
+            NET_CL_SendSYN(data);
+            last_syn_time = nowtime;
+        }
+
+        NET_CL_Run();
+        NET_SV_Run();
+
+        I_Sleep(1);
+    }
+
+    if (client_state == CLIENT_STATE_DISCONNECTED)
+    {
+        fprintf(stderr, "NET_CL_Connect: %s\n", reject_reason);
+        return false;
+    }
+
+    last_recv_time = I_GetTimeMS();
+
+    return true;
+}
+
+//
+// Ask the server to start the game with the given settings.  The
+// first player's settings are the ones used.
+//
+
+void NET_CL_StartGame(net_gamesettings_t *new_settings)
+{
+    start_settings = *new_settings;
+    start_requested = true;
+
+    NET_CL_SendGameStart();
+}
+
+bool NET_CL_GetSettings(net_gamesettings_t *_settings)
+{
+    if (!received_settings)
+    {
+        return false;
+    }
+
+    *_settings = settings;
+
+    return true;
+}
+
+void NET_CL_SendTiccmd(ticcmd_t *ticcmd, int maketic)
+{
+    if (client_state != CLIENT_STATE_IN_GAME || maketic != send_maketic)
+    {
+        return;
+    }
+
+    send_cmds[maketic % BACKUPTICS] = *ticcmd;
+    ++send_maketic;
+
+    NET_CL_SendTics();
+}
+
+//
+// Leave the game, telling the server
+//
+
+void NET_CL_Disconnect(void)
+{
+    net_packet_t *packet;
+    int i;
+
+    if (!net_client_connected)
+    {
+        return;
+    }
+
+    // Nothing acknowledges this, so send it a few times over
+
+    packet = NET_NewPacket(8);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_DISCONNECT);
+
+    for (i = 0; i < 3; ++i)
+    {
+        NET_CL_SendPacket(packet);
+    }
+
+    NET_FreePacket(packet);
+
+    NET_CL_Shutdown();
+}
+
+void NET_CL_Init(void)
+{
+    // Try to set from the USER and USERNAME environment variables
+
+    if (net_player_name == NULL)
+        net_player_name = getenv("USER");
+    if (net_player_name == NULL)
+        net_player_name = getenv("USERNAME");
+    if (net_player_name == NULL)
+        net_player_name = "Player";
+}
+
+void NET_Init(void)
+{
+    NET_CL_Init();
+}
+
+void NET_BindVariables(void)
+{
+    M_BindVariable("player_name", &net_player_name);
+}
@@ -0,0 +1,733 @@
+//
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Network server code.  The server relays ticcmds: a tic is
+//     complete once every player in the game has sent theirs, and
+//     complete tics are sent to every player.  The game itself is
+//     run by each player, in lockstep.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "doomtype.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+#include "m_misc.h"
+#include "net_defs.h"
+#include "net_io.h"
+#include "net_packet.h"
+#include "net_server.h"
+#include "net_structrw.h"
+#include "z_zone.h"
+
+// Most tics sent in one packet
+
+#define MAX_PACKET_TICS 16
+
+// Times in ms
+
+#define CLIENT_TIMEOUT 10000
+#define RESEND_TIME 200
+
+typedef enum
+{
+    // waiting for players to join
+
+    SERVER_WAITING_START,
+
+    // in a game
+
+    SERVER_IN_GAME,
+} net_server_state_t;
+
+typedef struct
+{
+    bool active;
+    net_addr_t *addr;
+    net_connect_data_t connect_data;
+    char name[MAXPLAYERNAME];
+
+    // Time a packet was last received from, and sent to, the client
+
+    int last_recv_time;
+    int last_send_time;
+
+    // Game start settings requested by the client
+
+    bool have_settings;
+    net_gamesettings_t settings;
+
+    // Number of the client's tics received, and the number of
+    // complete tics it has acknowledged
+
+    int recvtic;
+    int acked;
+
+    // Set once the client leaves the game: its tics end here
+
+    bool left;
+    int lefttic;
+} net_client_t;
+
+typedef struct
+{
+    ticcmd_t cmds[NET_MAXPLAYERS];
+    bool ingame[NET_MAXPLAYERS];
+} net_full_tic_t;
+
+static bool server_initialized = false;
+static net_server_state_t server_state;
+static net_context_t *server_context;
+
+static net_client_t clients[NET_MAXPLAYERS];
+static int num_wanted;
+
+// Settings the game was started with
+
+static net_gamesettings_t sv_settings;
+
+// Ticcmds received from each client, and the number of
+// complete tics
+
+static net_full_tic_t tics[BACKUPTICS];
+static int completetic;
+
+static int NET_SV_NumClients(void)
+{
+    int count;
+    int i;
+
+    count = 0;
+
+    for (i = 0; i < NET_MAXPLAYERS; ++i)
+    {
+        if (clients[i].active)
+        {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+static int NET_SV_FindClient(net_addr_t *addr)
+{
+    int i;
+
+    for (i = 0; i < NET_MAXPLAYERS; ++i)
+    {
+        if (clients[i].active && clients[i].addr == addr)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void NET_SV_SendPacket(net_client_t *client, net_packet_t *packet)
+{
+    NET_SendPacket(client->addr, packet);
+    client->last_send_time = I_GetTimeMS();
+}
+
+static void NET_SV_SendReject(net_addr_t *addr, char *reason)
+{
+    net_packet_t *packet;
+
+    packet = NET_NewPacket(32);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_REJECTED);
+    NET_WriteString(packet, reason);
+    NET_SendPacket(addr, packet);
+    NET_FreePacket(packet);
+}
+
+static void NET_SV_SendWaitingData(void)
+{
+    net_packet_t *packet;
+    int i;
+
+    packet = NET_NewPacket(8);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_WAITING_DATA);
+    NET_WriteInt8(packet, NET_SV_NumClients());
+    NET_WriteInt8(packet, num_wanted);
+
+    for (i = 0; i < NET_MAXPLAYERS; ++i)
+    {
+        if (clients[i].active)
+        {
+            NET_SV_SendPacket(&clients[i], packet);
+        }
+    }
+
+    NET_FreePacket(packet);
+}
+
+static void NET_SV_SendGameStart(int player)
+{
+    net_packet_t *packet;
+    net_gamesettings_t settings;
+
+    settings = sv_settings;
+    settings.consoleplayer = player;
+
+    packet = NET_NewPacket(32);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_GAMESTART);
+    NET_WriteSettings(packet, &settings);
+    NET_SV_SendPacket(&clients[player], packet);
+    NET_FreePacket(packet);
+}
+
+// Sends the complete tics that the client hasn't acknowledged,
+// together with the acknowledgement of its own tics
+
+static void NET_SV_SendTics(int player)
+{
+    net_client_t *client;
+    net_full_tic_t *tic;
+    net_packet_t *packet;
+    unsigned int mask;
+    int start, count;
+    int seq;
+    int i;
+
+    client = &clients[player];
+    start = client->acked;
+    count = completetic - start;
+
+    if (count > MAX_PACKET_TICS)
+    {
+        count = MAX_PACKET_TICS;
+    }
+
+    packet = NET_NewPacket(256);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_GAMEDATA);
+    NET_WriteInt32(packet, client->recvtic);
+    NET_WriteInt32(packet, start);
+    NET_WriteInt8(packet, count);
+
+    for (seq = start; seq < start + count; ++seq)
+    {
+        tic = &tics[seq % BACKUPTICS];
+        mask = 0;
+
+        for (i = 0; i < NET_MAXPLAYERS; ++i)
+        {
+            if (tic->ingame[i])
+            {
+                mask |= 1 << i;
+            }
+        }
+
+        NET_WriteInt8(packet, mask);
+
+        for (i = 0; i < NET_MAXPLAYERS; ++i)
+        {
+            if (tic->ingame[i])
+            {
+                NET_WriteTiccmd(packet, &tic->cmds[i]);
+            }
+        }
+    }
+
+    NET_SV_SendPacket(client, packet);
+    NET_FreePacket(packet);
+}
+
+// Back to waiting for players, once the last one has gone
+
+static void NET_SV_Reset(void)
+{
+    memset(clients, 0, sizeof(clients));
+    server_state = SERVER_WAITING_START;
+    completetic = 0;
+}
+
+static void NET_SV_DropClient(int player, char *reason)
+{
+    net_client_t *client;
+
+    client = &clients[player];
+
+    fprintf(stderr, "NET_SV: Player %i (%s) left: %s\n",
+            player + 1, client->name, reason);
+
+    if (server_state == SERVER_WAITING_START)
+    {
+        // Keep the players numbered in the order they joined
+
+        memmove(client, client + 1,
+                (NET_MAXPLAYERS - 1 - player) * sizeof(*client));
+        clients[NET_MAXPLAYERS - 1].active = false;
+        NET_SV_SendWaitingData();
+    }
+    else
+    {
+        client->left = true;
+        client->lefttic = client->recvtic;
+    }
+}
+
+// Tics are complete once every player still in the game has sent
+// them.  Tics from before a player left still carry their ticcmds.
+
+static bool NET_SV_TicComplete(int seq)
+{
+    bool playing;
+    int i;
+
+    playing = false;
+
+    for (i = 0; i < NET_MAXPLAYERS; ++i)
+    {
+        if (clients[i].active && !clients[i].left)
+        {
+            if (clients[i].recvtic <= seq)
+            {
+                return false;
+            }
+
+            playing = true;
+        }
+    }
+
+    return playing;
+}
+
+// Returns true if tics were completed, and sent to the players
+
+static bool NET_SV_CheckComplete(void)
+{
+    net_full_tic_t *tic;
+    bool advanced;
+    int i;
+
+    if (server_state != SERVER_IN_GAME)
+    {
+        return false;
+    }
+
+    advanced = false;
+
+    while (NET_SV_TicComplete(completetic))
+    {
+        tic = &tics[completetic % BACKUPTICS];
+
+        for (i = 0; i < NET_MAXPLAYERS; ++i)
+        {
+            tic->ingame[i] = clients[i].active
+                          && (!clients[i].left
+                           || completetic < clients[i].lefttic);
+        }
+
+        ++completetic;
+        advanced = true;
+    }
+
+    if (advanced)
+    {
+        for (i = 0; i < NET_MAXPLAYERS; ++i)
+        {
+            if (clients[i].active && !clients[i].left)
+            {
+                NET_SV_SendTics(i);
+            }
+        }
+    }
+
+    return advanced;
+}
+
+// Start the game, with the settings the first player asked for
+
+static void NET_SV_StartGame(void)
+{
+    int num_players;
+    int i;
+
+    num_players = NET_SV_NumClients();
+
+    sv_settings = clients[0].settings;
+    sv_settings.num_players = num_players;
+
+    for (i = 0; i < num_players; ++i)
+    {
+        sv_settings.player_classes[i] = clients[i].connect_data.player_class;
+    }
+
+    memset(tics, 0, sizeof(tics));
+    completetic = 0;
+    server_state = SERVER_IN_GAME;
+
+    printf("NET_SV: Starting a game for %i players\n", num_players);
+
+    for (i = 0; i < num_players; ++i)
+    {
+        NET_SV_SendGameStart(i);
+    }
+}
+
+static void NET_SV_ParseSYN(net_packet_t *packet, net_addr_t *addr)
+{
+    net_connect_data_t data;
+    net_client_t *client;
+    net_packet_t *reply;
+    unsigned int magic;
+    char *version;
+    char *name;
+    int player;
+
+    if (!NET_ReadInt32(packet, &magic) || magic != NET_MAGIC_NUMBER)
+    {
+        return;
+    }
+
+    version = NET_ReadString(packet);
+
+    if (version == NULL
+     || !NET_ReadConnectData(packet, &data)
+     || (name = NET_ReadString(packet)) == NULL)
+    {
+        return;
+    }
+
+    player = NET_SV_FindClient(addr);
+
+    if (player < 0)
+    {
+        if (strcmp(version, PACKAGE_STRING) != 0)
+        {
+            NET_SV_SendReject(addr, "Different versions cannot play a "
+                                    "network game!");
+            return;
+        }
+
+        if (data.drone)
+        {
+            NET_SV_SendReject(addr, "Drones aren't supported.");
+            return;
+        }
+
+        if (server_state != SERVER_WAITING_START)
+        {
+            NET_SV_SendReject(addr, "A game is in progress.");
+            return;
+        }
+
+        if (NET_SV_NumClients() >= num_wanted)
+        {
+            NET_SV_SendReject(addr, "The server is full!");
+            return;
+        }
+
+        // Everyone must be playing the same game
+
+        if (clients[0].active
+         && (data.gamemode != clients[0].connect_data.gamemode
+          || data.gamemission != clients[0].connect_data.gamemission
+          || memcmp(data.wad_sha1sum, clients[0].connect_data.wad_sha1sum,
+                    sizeof(sha1_digest_t)) != 0))
+        {
+            NET_SV_SendReject(addr, "You are not playing the same WAD "
+                                    "as the server.");
+            return;
+        }
+
+        // Players are numbered in the order that they joined
+
+        player = NET_SV_NumClients();
+        client = &clients[player];
+
+        memset(client, 0, sizeof(*client));
+        client->active = true;
+        client->addr = addr;
+        client->connect_data = data;
+        M_StringCopy(client->name, name, sizeof(client->name));
+
+        printf("NET_SV: Player %i (%s) joined from %s\n",
+               player + 1, client->name, NET_AddrToString(addr));
+    }
+
+    client = &clients[player];
+    client->last_recv_time = I_GetTimeMS();
+
+    reply = NET_NewPacket(8);
+    NET_WriteInt16(reply, NET_PACKET_TYPE_ACK);
+    NET_WriteInt8(reply, player);
+    NET_SV_SendPacket(client, reply);
+    NET_FreePacket(reply);
+
+    NET_SV_SendWaitingData();
+}
+
+static void NET_SV_ParseGameStart(net_packet_t *packet, int player)
+{
+    net_client_t *client;
+
+    client = &clients[player];
+
+    if (server_state == SERVER_IN_GAME)
+    {
+        // The game start was lost, send it again
+
+        NET_SV_SendGameStart(player);
+        return;
+    }
+
+    if (!NET_ReadSettings(packet, &client->settings))
+    {
+        return;
+    }
+
+    client->have_settings = true;
+
+    if (NET_SV_NumClients() >= num_wanted && clients[0].have_settings)
+    {
+        NET_SV_StartGame();
+    }
+    else
+    {
+        NET_SV_SendWaitingData();
+    }
+}
+
+static void NET_SV_ParseGameData(net_packet_t *packet, int player)
+{
+    net_client_t *client;
+    ticcmd_t cmd;
+    unsigned int ack, start, count;
+    unsigned int seq;
+
+    client = &clients[player];
+
+    if (server_state != SERVER_IN_GAME || client->left
+     || !NET_ReadInt32(packet, &ack)
+     || !NET_ReadInt32(packet, &start)
+     || !NET_ReadInt8(packet, &count))
+    {
+        return;
+    }
+
+    if ((int) ack > client->acked && (int) ack <= completetic)
+    {
+        client->acked = ack;
+    }
+
+    for (seq = start; seq < start + count; ++seq)
+    {
+        if (!NET_ReadTiccmd(packet, &cmd))
+        {
+            break;
+        }
+
+        // Take the tics in order, and no further ahead than
+        // the buffer holds
+
+        if ((int) seq == client->recvtic
+         && (int) seq < completetic + BACKUPTICS)
+        {
+            tics[seq % BACKUPTICS].cmds[player] = cmd;
+            ++client->recvtic;
+        }
+    }
+
+    // Acknowledge what we received, if completing tics didn't
+
+    if (!NET_SV_CheckComplete())
+    {
+        NET_SV_SendTics(player);
+    }
+}
+
+static void NET_SV_ParsePacket(net_packet_t *packet, net_addr_t *addr)
+{
+    unsigned int packet_type;
+    int player;
+
+    if (!NET_ReadInt16(packet, &packet_type))
+    {
+        return;
+    }
+
+    if (packet_type == NET_PACKET_TYPE_SYN)
+    {
+        NET_SV_ParseSYN(packet, addr);
+        return;
+    }
+
+    player = NET_SV_FindClient(addr);
+
+    if (player < 0 || clients[player].left)
+    {
+        return;
+    }
+
+    clients[player].last_recv_time = I_GetTimeMS();
+
+    switch (packet_type)
+    {
+        case NET_PACKET_TYPE_GAMESTART:
+            NET_SV_ParseGameStart(packet, player);
+            break;
+
+        case NET_PACKET_TYPE_GAMEDATA:
+            NET_SV_ParseGameData(packet, player);
+            break;
+
+        case NET_PACKET_TYPE_DISCONNECT:
+            NET_SV_DropClient(player, "disconnected");
+            NET_SV_CheckComplete();
+            break;
+
+        default:
+            break;
+    }
+}
+
+//
+// Receive packets, time out players that have gone quiet and
+// resend what has not been acknowledged
+//
+
+void NET_SV_Run(void)
+{
+    net_addr_t *addr;
+    net_packet_t *packet;
+    int nowtime;
+    int remaining;
+    int i;
+
+    if (!server_initialized)
+    {
+        return;
+    }
+
+    while (NET_RecvPacket(server_context, &addr, &packet))
+    {
+        NET_SV_ParsePacket(packet, addr);
+        NET_FreePacket(packet);
+    }
+
+    nowtime = I_GetTimeMS();
+    remaining = 0;
+
+    for (i = 0; i < NET_MAXPLAYERS; ++i)
+    {
+        if (!clients[i].active || clients[i].left)
+        {
+            continue;
+        }
+
+        if (nowtime - clients[i].last_recv_time > CLIENT_TIMEOUT)
+        {
+            NET_SV_DropClient(i, "timed out");
+            NET_SV_CheckComplete();
+            continue;
+        }
+
+        ++remaining;
+
+        if (server_state == SERVER_IN_GAME
+         && nowtime - clients[i].last_send_time > RESEND_TIME)
+        {
+            NET_SV_SendTics(i);
+        }
+    }
+
+    if (server_state == SERVER_IN_GAME && remaining == 0)
+    {
+        printf("NET_SV: The game has ended\n");
+        NET_SV_Reset();
+    }
+}
+
+//
+// Start the server, taking -players as the number to wait for
+//
+
+void NET_SV_Init(void)
+{
+    int p;
+
+    //!
+    // @arg <n>
+    // @category net
+    //
+    // With -netserver, start the game once n players have joined
+    // (default 2).
+    //
+
+    p = M_CheckParmWithArgs("-players", 1);
+
+    num_wanted = p > 0 ? atoi(myargv[p+1]) : 2;
+
+    if (num_wanted < 1 || num_wanted > NET_MAXPLAYERS)
+    {
+        I_Error("NET_SV_Init: -players must be between 1 and %i",
+                NET_MAXPLAYERS);
+    }
+
+    server_context = NET_NewContext();
+    NET_SV_Reset();
+    server_initialized = true;
+}
+
+void NET_SV_AddModule(net_module_t *module)
+{
+    module->InitServer();
+    NET_AddModule(server_context, module);
+}
+
+//
+// Tell the players that the server is going away
+//
+
+void NET_SV_Shutdown(void)
+{
+    net_packet_t *packet;
+    int i;
+
+    if (!server_initialized)
+    {
+        return;
+    }
+
+    packet = NET_NewPacket(8);
+    NET_WriteInt16(packet, NET_PACKET_TYPE_DISCONNECT);
+
+    for (i = 0; i < NET_MAXPLAYERS; ++i)
+    {
+        if (clients[i].active && !clients[i].left)
+        {
+            NET_SV_SendPacket(&clients[i], packet);
+        }
+    }
+
+    NET_FreePacket(packet);
+
+    server_initialized = false;
+}
+
+//
+// A forked session leaves the server to its parent
+//
+
+void NET_SV_Detach(void)
+{
+    server_initialized = false;
+}
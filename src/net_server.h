@@ -25,8 +25,7 @@ void NET_SV_Init(void);
 
 void NET_SV_Run(void);
 
-// Shut down the server
-// Blocks until all clients disconnect, or until a 5 second timeout
+// Shut down the server, telling the clients
 
 void NET_SV_Shutdown(void);
 
@@ -34,9 +33,9 @@ void NET_SV_Shutdown(void);
 
 void NET_SV_AddModule(net_module_t *module);
 
-// Register server with master server.
+// Leave the server to the process that started it, after a fork
 
-void NET_SV_RegisterWithMaster(void);
+void NET_SV_Detach(void);
 
 #endif /* #ifndef NET_SERVER_H */
 
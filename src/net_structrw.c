@@ -0,0 +1,185 @@
+//
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Reading and writing various structures into packets
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomtype.h"
+#include "net_packet.h"
+#include "net_structrw.h"
+
+void NET_WriteConnectData(net_packet_t *packet, net_connect_data_t *data)
+{
+    NET_WriteInt8(packet, data->gamemode);
+    NET_WriteInt8(packet, data->gamemission);
+    NET_WriteInt8(packet, data->lowres_turn);
+    NET_WriteInt8(packet, data->drone);
+    NET_WriteInt8(packet, data->max_players);
+    NET_WriteInt8(packet, data->is_freedoom);
+    NET_WriteSHA1Sum(packet, data->wad_sha1sum);
+    NET_WriteSHA1Sum(packet, data->deh_sha1sum);
+    NET_WriteInt8(packet, data->player_class);
+}
+
+bool NET_ReadConnectData(net_packet_t *packet, net_connect_data_t *data)
+{
+    return NET_ReadInt8(packet, (unsigned int *) &data->gamemode)
+        && NET_ReadInt8(packet, (unsigned int *) &data->gamemission)
+        && NET_ReadInt8(packet, (unsigned int *) &data->lowres_turn)
+        && NET_ReadInt8(packet, (unsigned int *) &data->drone)
+        && NET_ReadInt8(packet, (unsigned int *) &data->max_players)
+        && NET_ReadInt8(packet, (unsigned int *) &data->is_freedoom)
+        && NET_ReadSHA1Sum(packet, data->wad_sha1sum)
+        && NET_ReadSHA1Sum(packet, data->deh_sha1sum)
+        && NET_ReadInt8(packet, (unsigned int *) &data->player_class);
+}
+
+void NET_WriteSettings(net_packet_t *packet, net_gamesettings_t *settings)
+{
+    int i;
+
+    NET_WriteInt8(packet, settings->ticdup);
+    NET_WriteInt8(packet, settings->extratics);
+    NET_WriteInt8(packet, settings->deathmatch);
+    NET_WriteInt8(packet, settings->nomonsters);
+    NET_WriteInt8(packet, settings->fast_monsters);
+    NET_WriteInt8(packet, settings->respawn_monsters);
+    NET_WriteInt8(packet, settings->episode);
+    NET_WriteInt8(packet, settings->map);
+    NET_WriteInt8(packet, settings->skill);
+    NET_WriteInt8(packet, settings->gameversion);
+    NET_WriteInt8(packet, settings->lowres_turn);
+    NET_WriteInt8(packet, settings->new_sync);
+    NET_WriteInt32(packet, settings->timelimit);
+    NET_WriteInt8(packet, settings->loadgame);
+    NET_WriteInt8(packet, settings->random);
+    NET_WriteInt8(packet, settings->num_players);
+    NET_WriteInt8(packet, settings->consoleplayer);
+
+    for (i = 0; i < settings->num_players; ++i)
+    {
+        NET_WriteInt8(packet, settings->player_classes[i]);
+    }
+}
+
+bool NET_ReadSettings(net_packet_t *packet, net_gamesettings_t *settings)
+{
+    bool success;
+    int i;
+
+    success = NET_ReadInt8(packet, (unsigned int *) &settings->ticdup)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->extratics)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->deathmatch)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->nomonsters)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->fast_monsters)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->respawn_monsters)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->episode)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->map)
+           && NET_ReadSInt8(packet, &settings->skill)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->gameversion)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->lowres_turn)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->new_sync)
+           && NET_ReadInt32(packet, (unsigned int *) &settings->timelimit)
+           && NET_ReadSInt8(packet, (signed int *) &settings->loadgame)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->random)
+           && NET_ReadInt8(packet, (unsigned int *) &settings->num_players)
+           && NET_ReadSInt8(packet, (signed int *) &settings->consoleplayer);
+
+    if (!success || settings->num_players > NET_MAXPLAYERS)
+    {
+        return false;
+    }
+
+    for (i = 0; i < settings->num_players; ++i)
+    {
+        if (!NET_ReadInt8(packet,
+                          (unsigned int *) &settings->player_classes[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Ticcmds are sent whole: there is no diff against the previous
+// one to lose with a dropped packet
+
+void NET_WriteTiccmd(net_packet_t *packet, ticcmd_t *cmd)
+{
+    NET_WriteInt8(packet, (byte) cmd->forwardmove);
+    NET_WriteInt8(packet, (byte) cmd->sidemove);
+    NET_WriteInt16(packet, (unsigned short) cmd->angleturn);
+    NET_WriteInt8(packet, cmd->chatchar);
+    NET_WriteInt8(packet, cmd->buttons);
+    NET_WriteInt8(packet, cmd->consistancy);
+}
+
+bool NET_ReadTiccmd(net_packet_t *packet, ticcmd_t *cmd)
+{
+    unsigned int forwardmove, sidemove, angleturn;
+    unsigned int chatchar, buttons, consistancy;
+
+    if (!NET_ReadInt8(packet, &forwardmove)
+     || !NET_ReadInt8(packet, &sidemove)
+     || !NET_ReadInt16(packet, &angleturn)
+     || !NET_ReadInt8(packet, &chatchar)
+     || !NET_ReadInt8(packet, &buttons)
+     || !NET_ReadInt8(packet, &consistancy))
+    {
+        return false;
+    }
+
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->forwardmove = (signed char) forwardmove;
+    cmd->sidemove = (signed char) sidemove;
+    cmd->angleturn = (short) angleturn;
+    cmd->chatchar = chatchar;
+    cmd->buttons = buttons;
+    cmd->consistancy = consistancy;
+
+    return true;
+}
+
+bool NET_ReadSHA1Sum(net_packet_t *packet, sha1_digest_t digest)
+{
+    unsigned int b;
+    int i;
+
+    for (i=0; i<sizeof(sha1_digest_t); ++i)
+    {
+        if (!NET_ReadInt8(packet, &b))
+        {
+            return false;
+        }
+
+        digest[i] = b;
+    }
+
+    return true;
+}
+
+void NET_WriteSHA1Sum(net_packet_t *packet, sha1_digest_t digest)
+{
+    int i;
+
+    for (i=0; i<sizeof(sha1_digest_t); ++i)
+    {
+        NET_WriteInt8(packet, digest[i]);
+    }
+}
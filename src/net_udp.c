@@ -0,0 +1,379 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//     Networking module over plain UDP sockets, in place of SDL_net.
+//     A process is either a server or a client, so one socket
+//     serves both ends. Addresses are kept in a table, so that
+//     the same host and port is always the same net_addr_t.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "doomtype.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "m_misc.h"
+#include "net_defs.h"
+#include "net_io.h"
+#include "net_packet.h"
+#include "net_udp.h"
+#include "z_zone.h"
+
+#ifndef _WIN32
+
+// Largest packet we can receive
+
+#define MAX_PACKET_LEN 1500
+
+typedef struct
+{
+    net_addr_t net_addr;
+    struct sockaddr_in sin;
+} addrpair_t;
+
+static int udpsocket = -1;
+static int port = DEFAULT_PORT;
+static addrpair_t **addr_table;
+static int addr_table_size = -1;
+
+// Initializes the address table
+
+static void NET_UDP_InitAddrTable(void)
+{
+    addr_table_size = 16;
+
+    addr_table = Z_Malloc(sizeof(addrpair_t *) * addr_table_size,
+                          PU_STATIC, 0);
+    memset(addr_table, 0, sizeof(addrpair_t *) * addr_table_size);
+}
+
+static bool AddressesEqual(struct sockaddr_in *a, struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr
+        && a->sin_port == b->sin_port;
+}
+
+// Finds an address by searching the table.  If the address is not found,
+// it is added to the table.
+
+static net_addr_t *NET_UDP_FindAddress(struct sockaddr_in *addr)
+{
+    addrpair_t *new_entry;
+    int empty_entry = -1;
+    int i;
+
+    if (addr_table_size < 0)
+    {
+        NET_UDP_InitAddrTable();
+    }
+
+    for (i=0; i<addr_table_size; ++i)
+    {
+        if (addr_table[i] != NULL
+         && AddressesEqual(addr, &addr_table[i]->sin))
+        {
+            return &addr_table[i]->net_addr;
+        }
+
+        if (empty_entry < 0 && addr_table[i] == NULL)
+            empty_entry = i;
+    }
+
+    // Was not found in list.  We need to add it.
+
+    // Is there any space in the table? If not, increase the table size
+
+    if (empty_entry < 0)
+    {
+        addrpair_t **new_addr_table;
+        int new_addr_table_size;
+
+        // after reallocing, we will add this in as the first entry
+        // in the new block of memory
+
+        empty_entry = addr_table_size;
+
+        // allocate a new array twice the size, init to 0 and copy
+        // the existing table in.  replace the old table.
+
+        new_addr_table_size = addr_table_size * 2;
+        new_addr_table = Z_Malloc(sizeof(addrpair_t *) * new_addr_table_size,
+                                  PU_STATIC, 0);
+        memset(new_addr_table, 0, sizeof(addrpair_t *) * new_addr_table_size);
+        memcpy(new_addr_table, addr_table,
+               sizeof(addrpair_t *) * addr_table_size);
+        Z_Free(addr_table);
+        addr_table = new_addr_table;
+        addr_table_size = new_addr_table_size;
+    }
+
+    // Add a new entry
+
+    new_entry = Z_Malloc(sizeof(addrpair_t), PU_STATIC, 0);
+
+    new_entry->sin = *addr;
+    new_entry->net_addr.handle = &new_entry->sin;
+    new_entry->net_addr.module = &net_udp_module;
+
+    addr_table[empty_entry] = new_entry;
+
+    return &new_entry->net_addr;
+}
+
+static void NET_UDP_FreeAddress(net_addr_t *addr)
+{
+    int i;
+
+    for (i=0; i<addr_table_size; ++i)
+    {
+        if (addr == &addr_table[i]->net_addr)
+        {
+            Z_Free(addr_table[i]);
+            addr_table[i] = NULL;
+            return;
+        }
+    }
+
+    I_Error("NET_UDP_FreeAddress: Attempted to remove an unused address!");
+}
+
+// Opens the socket, bound to the port for a server.  A client
+// gets a port of its own, and drops any socket it was forked with.
+
+static bool NET_UDP_Open(int bind_port)
+{
+    struct sockaddr_in sin;
+
+    if (udpsocket >= 0)
+    {
+        close(udpsocket);
+    }
+
+    udpsocket = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (udpsocket < 0)
+    {
+        I_Error("NET_UDP_Open: Unable to open a socket (%s)", strerror(errno));
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    sin.sin_port = htons(bind_port);
+
+    if (bind(udpsocket, (struct sockaddr *) &sin, sizeof(sin)) < 0)
+    {
+        I_Error("NET_UDP_Open: Unable to bind to port %i (%s)",
+                bind_port, strerror(errno));
+    }
+
+    fcntl(udpsocket, F_SETFL, O_NONBLOCK);
+
+    if (addr_table_size < 0)
+        NET_UDP_InitAddrTable();
+
+    return true;
+}
+
+static bool NET_UDP_InitClient(void)
+{
+    int p;
+
+    //!
+    // @category net
+    // @arg <n>
+    //
+    // Use the specified UDP port for communications, instead of
+    // the default (2342).
+    //
+
+    p = M_CheckParmWithArgs("-port", 1);
+    if (p > 0)
+        port = atoi(myargv[p+1]);
+
+    return NET_UDP_Open(0);
+}
+
+static bool NET_UDP_InitServer(void)
+{
+    int p;
+
+    p = M_CheckParmWithArgs("-port", 1);
+    if (p > 0)
+        port = atoi(myargv[p+1]);
+
+    return NET_UDP_Open(port);
+}
+
+static void NET_UDP_SendPacket(net_addr_t *addr, net_packet_t *packet)
+{
+    struct sockaddr_in *sin;
+
+    // no broadcasts: servers are found by address
+
+    if (addr == &net_broadcast_addr || udpsocket < 0)
+    {
+        return;
+    }
+
+    sin = addr->handle;
+
+    // A lost packet is resent by the protocol, so errors are ignored
+
+    sendto(udpsocket, packet->data, packet->len, 0,
+           (struct sockaddr *) sin, sizeof(*sin));
+}
+
+static bool NET_UDP_RecvPacket(net_addr_t **addr, net_packet_t **packet)
+{
+    struct sockaddr_in sin;
+    socklen_t sinlen;
+    byte buf[MAX_PACKET_LEN];
+    ssize_t result;
+
+    if (udpsocket < 0)
+    {
+        return false;
+    }
+
+    sinlen = sizeof(sin);
+    result = recvfrom(udpsocket, buf, sizeof(buf), 0,
+                      (struct sockaddr *) &sin, &sinlen);
+
+    if (result <= 0)
+    {
+        return false;
+    }
+
+    *packet = NET_NewPacket(result);
+    memcpy((*packet)->data, buf, result);
+    (*packet)->len = result;
+
+    *addr = NET_UDP_FindAddress(&sin);
+
+    return true;
+}
+
+static void NET_UDP_AddrToString(net_addr_t *addr, char *buffer, int buffer_len)
+{
+    struct sockaddr_in *sin;
+
+    sin = addr->handle;
+    M_snprintf(buffer, buffer_len, "%s:%i",
+               inet_ntoa(sin->sin_addr), ntohs(sin->sin_port));
+}
+
+// Accepts host or host:port
+
+static net_addr_t *NET_UDP_ResolveAddress(char *address)
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    struct sockaddr_in sin;
+    char *addr_hostname;
+    char *colon;
+    int addr_port;
+    int error;
+
+    colon = strchr(address, ':');
+
+    addr_hostname = M_StringDuplicate(address);
+    if (colon != NULL)
+    {
+        addr_hostname[colon - address] = '\0';
+        addr_port = atoi(colon + 1);
+    }
+    else
+    {
+        addr_port = port;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    error = getaddrinfo(addr_hostname, NULL, &hints, &result);
+    free(addr_hostname);
+
+    if (error != 0)
+    {
+        return NULL;
+    }
+
+    sin = *(struct sockaddr_in *) result->ai_addr;
+    sin.sin_port = htons(addr_port);
+    freeaddrinfo(result);
+
+    return NET_UDP_FindAddress(&sin);
+}
+
+#else
+
+static bool NET_UDP_InitClient(void)
+{
+    I_Error("NET_UDP_InitClient: networking isn't available on Windows");
+    return false;
+}
+
+static bool NET_UDP_InitServer(void)
+{
+    I_Error("NET_UDP_InitServer: networking isn't available on Windows");
+    return false;
+}
+
+static void NET_UDP_SendPacket(net_addr_t *addr, net_packet_t *packet)
+{
+}
+
+static bool NET_UDP_RecvPacket(net_addr_t **addr, net_packet_t **packet)
+{
+    return false;
+}
+
+static void NET_UDP_AddrToString(net_addr_t *addr, char *buffer, int buffer_len)
+{
+    buffer[0] = '\0';
+}
+
+static void NET_UDP_FreeAddress(net_addr_t *addr)
+{
+}
+
+static net_addr_t *NET_UDP_ResolveAddress(char *address)
+{
+    return NULL;
+}
+
+#endif
+
+net_module_t net_udp_module =
+{
+    NET_UDP_InitClient,
+    NET_UDP_InitServer,
+    NET_UDP_SendPacket,
+    NET_UDP_RecvPacket,
+    NET_UDP_AddrToString,
+    NET_UDP_FreeAddress,
+    NET_UDP_ResolveAddress,
+};
@@ -0,0 +1,377 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Playsim benchmark.
+//	With -benchplaysim <tics>, the -warp level is loaded and
+//	the playsim alone is run for that many tics, with nothing
+//	drawn. -benchmonsters <n> adds n more of the level's own
+//	monsters, awake and after the player, who can't die, and
+//	-benchmissiles <n> keeps n imp fireballs flying at the
+//	player. The time of each kind of thinker and of the hot
+//	helpers is printed when done.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "doomgeneric.h"
+
+#include "g_game.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "m_random.h"
+
+#include "p_local.h"
+#include "p_spec.h"
+#include "p_tick.h"
+#include "r_state.h"
+
+#include "p_bench.h"
+
+
+typedef struct
+{
+    char*	name;
+    actionf_p1	func;		// NULL for any other
+    uint64_t	time;
+    unsigned	calls;
+} benchkind_t;
+
+static benchkind_t thinkerkinds[] =
+{
+    { "P_MobjThinker",	(actionf_p1) P_MobjThinker },
+    { "T_MoveCeiling",	(actionf_p1) T_MoveCeiling },
+    { "T_MoveFloor",	(actionf_p1) T_MoveFloor },
+    { "T_VerticalDoor",	(actionf_p1) T_VerticalDoor },
+    { "T_PlatRaise",	(actionf_p1) T_PlatRaise },
+    { "T_RunLights",	(actionf_p1) T_RunLights },
+    { "other thinkers",	NULL },
+};
+
+static benchkind_t helpers[NUMHELPERS] =
+{
+    { "P_CheckSight" },
+    { "P_TryMove" },
+    { "P_PathTraverse" },
+};
+
+bool			playsimbench;
+
+static int		helperdepth[NUMHELPERS];
+static uint64_t		helperstart[NUMHELPERS];
+
+
+static uint64_t P_BenchClock (void)
+{
+#ifdef _WIN32
+    return DG_GetTicksUs () * 1000;
+#else
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+
+//
+// P_StartHelper
+//
+void P_StartHelper (helper_t helper)
+{
+    if (helperdepth[helper]++ == 0)
+	helperstart[helper] = P_BenchClock ();
+}
+
+
+//
+// P_EndHelper
+//
+void P_EndHelper (helper_t helper)
+{
+    if (--helperdepth[helper] == 0)
+    {
+	helpers[helper].time += P_BenchClock () - helperstart[helper];
+	helpers[helper].calls++;
+    }
+}
+
+
+//
+// P_BenchThinker
+//
+void P_BenchThinker (thinker_t* thinker)
+{
+    benchkind_t*	kind;
+    actionf_p1		func;
+    uint64_t		start;
+
+    // the thinker may be removed by its function
+    func = thinker->function.acp1;
+
+    start = P_BenchClock ();
+    func (thinker);
+    start = P_BenchClock () - start;
+
+    for (kind = thinkerkinds ; kind->func && kind->func != func ; kind++)
+	;
+
+    kind->time += start;
+    kind->calls++;
+}
+
+
+//
+// P_BenchSpawn
+// Spawns a thing at the middle of a random subsector
+//  it fits in, or returns NULL if none was found.
+//
+static mobj_t* P_BenchSpawn (mobjtype_t type)
+{
+    subsector_t*	sub;
+    seg_t*		seg;
+    mobj_t*		mo;
+    fixed_t		x;
+    fixed_t		y;
+    int			tries;
+    int			i;
+
+    for (tries=0 ; tries<1000 ; tries++)
+    {
+	sub = &subsectors[((M_Random () << 8) | M_Random ()) % numsubsectors];
+
+	// subsectors are convex, so the
+	//  average of the corners is inside
+	x = y = 0;
+	for (i=0 ; i<sub->numlines ; i++)
+	{
+	    seg = &segs[sub->firstline + i];
+	    x += seg->v1->x / sub->numlines;
+	    y += seg->v1->y / sub->numlines;
+	}
+
+	mo = P_SpawnMobj (x, y, ONFLOORZ, type);
+
+	if (P_CheckPosition (mo, x, y) && tmceilingz - tmfloorz >= mo->height)
+	    return mo;
+
+	P_RemoveMobj (mo);
+    }
+
+    return NULL;
+}
+
+
+//
+// P_BenchMonsters
+// Adds monsters of the kinds already on the level,
+//  each one awake and after the player.
+//
+static void P_BenchMonsters (int count)
+{
+    mobjtype_t	types[NUMMOBJTYPES];
+    int		numtypes;
+    thinker_t*	th;
+    mobj_t*	mo;
+    int		i;
+
+    numtypes = 0;
+
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	if (th->function.acp1 != (actionf_p1) P_MobjThinker)
+	    continue;
+
+	mo = (mobj_t *) th;
+
+	if (!(mo->flags & MF_COUNTKILL))
+	    continue;
+
+	for (i=0 ; i<numtypes && types[i] != mo->type ; i++)
+	    ;
+
+	if (i == numtypes)
+	    types[numtypes++] = mo->type;
+    }
+
+    if (numtypes == 0)
+	types[numtypes++] = MT_POSSESSED;
+
+    for (i=0 ; i<count ; i++)
+    {
+	mo = P_BenchSpawn (types[i % numtypes]);
+
+	if (mo == NULL)
+	    I_Error ("P_BenchPlaysim: no room for monster %i", i);
+
+	mo->target = players[consoleplayer].mo;
+	P_SetMobjState (mo, mo->info->seestate);
+    }
+}
+
+
+//
+// P_BenchMissiles
+// Fires fireballs at the player from random monsters,
+//  until count are flying.
+//
+static void P_BenchMissiles (int count)
+{
+    thinker_t*	th;
+    mobj_t*	mo;
+    mobj_t*	source;
+    int		flying;
+    int		monsters;
+    int		pick;
+
+    flying = 0;
+    monsters = 0;
+
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	if (th->function.acp1 != (actionf_p1) P_MobjThinker)
+	    continue;
+
+	mo = (mobj_t *) th;
+
+	if (mo->flags & MF_MISSILE)
+	    flying++;
+	else if (mo->flags & MF_COUNTKILL && mo->health > 0)
+	    monsters++;
+    }
+
+    while (flying < count && monsters > 0)
+    {
+	pick = ((M_Random () << 8) | M_Random ()) % monsters;
+	source = NULL;
+
+	for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+	{
+	    if (th->function.acp1 != (actionf_p1) P_MobjThinker)
+		continue;
+
+	    mo = (mobj_t *) th;
+
+	    if (mo->flags & MF_COUNTKILL && mo->health > 0 && pick-- == 0)
+	    {
+		source = mo;
+		break;
+	    }
+	}
+
+	P_SpawnMissile (source, players[consoleplayer].mo, MT_TROOPSHOT);
+	flying++;
+    }
+}
+
+
+static void P_PrintBenchKind (benchkind_t *kind, uint64_t tictime)
+{
+    if (kind->calls == 0)
+	return;
+
+    printf ("P_BenchPlaysim: %-16s %10u %10.1f %10.1f %6.1f%%\n",
+	    kind->name, kind->calls, kind->time / 1000000.0,
+	    (double) kind->time / kind->calls, kind->time * 100.0 / tictime);
+}
+
+
+//
+// P_BenchPlaysim
+//
+void P_BenchPlaysim (int tics)
+{
+    uint64_t	tictime;
+    uint64_t	start;
+    thinker_t*	th;
+    int		monsters;
+    int		missiles;
+    int		count;
+    int		p;
+    int		i;
+
+    if (tics <= 0)
+	I_Error ("P_BenchPlaysim: invalid number of tics");
+
+    //!
+    // @arg <n>
+    //
+    // With -benchplaysim, add n monsters of the kinds on the level,
+    // all awake.
+    //
+
+    p = M_CheckParmWithArgs ("-benchmonsters", 1);
+    monsters = p ? atoi (myargv[p+1]) : 0;
+
+    //!
+    // @arg <n>
+    //
+    // With -benchplaysim, keep n fireballs flying at the player.
+    //
+
+    p = M_CheckParmWithArgs ("-benchmissiles", 1);
+    missiles = p ? atoi (myargv[p+1]) : 0;
+
+    G_InitNew (startskill, startepisode, startmap);
+
+    // the monsters have something to chase until the end
+    players[consoleplayer].cheats |= CF_GODMODE;
+
+    P_BenchMonsters (monsters);
+
+    tictime = 0;
+
+    for (i=0 ; i<tics ; i++)
+    {
+	// spawned outside the tics, as they'd cost nothing in a game
+	P_BenchMissiles (missiles);
+
+	playsimbench = true;
+	start = P_BenchClock ();
+	P_Ticker ();
+	tictime += P_BenchClock () - start;
+	playsimbench = false;
+    }
+
+    count = 0;
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+	count++;
+
+    if (gamemode == commercial)
+	printf ("P_BenchPlaysim: MAP%02i", gamemap);
+    else
+	printf ("P_BenchPlaysim: E%iM%i", gameepisode, gamemap);
+
+    printf (", %i tics in %.1f ms, %.1f us a tic, %i thinkers,"
+	    " state hash %08x\n", tics, tictime / 1000000.0,
+	    tictime / 1000.0 / tics, count, P_HashState ());
+
+    printf ("P_BenchPlaysim: %-16s %10s %10s %10s %7s\n",
+	    "function", "calls", "ms", "ns/call", "tics");
+
+    for (i=0 ; i<sizeof(thinkerkinds)/sizeof(*thinkerkinds) ; i++)
+	P_PrintBenchKind (&thinkerkinds[i], tictime);
+
+    for (i=0 ; i<NUMHELPERS ; i++)
+	P_PrintBenchKind (&helpers[i], tictime);
+
+    // I_Quit only exits through ENDOOM, once the game has started
+    I_Quit ();
+    exit (0);
+}
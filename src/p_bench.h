@@ -0,0 +1,48 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Playsim benchmark.
+//
+
+
+#ifndef __P_BENCH__
+#define __P_BENCH__
+
+#include "doomtype.h"
+#include "d_think.h"
+
+// The helpers timed on their own, wherever they are called from.
+typedef enum
+{
+    HELPER_SIGHT,		// P_CheckSight
+    HELPER_TRYMOVE,		// P_TryMove
+    HELPER_PATHTRAVERSE,	// P_PathTraverse
+    NUMHELPERS
+} helper_t;
+
+// Set while -benchplaysim runs the tics.
+extern bool	playsimbench;
+
+// Time a helper, calls within itself aren't counted again.
+void	P_StartHelper (helper_t helper);
+void	P_EndHelper (helper_t helper);
+
+// Called by P_RunThinkers instead of the thinker's function,
+//  to run and time it.
+void	P_BenchThinker (thinker_t* thinker);
+
+// Called once the game is set up, with -benchplaysim. Runs
+//  the tics on the -warp level, prints what they spent their
+//  time on and quits.
+void	P_BenchPlaysim (int tics);
+
+#endif
@@ -35,7 +35,7 @@
 //
 
 
-ceiling_t*	activeceilings[MAXCEILINGS];
+ceiling_t*	activeceilings[TAGHASHSIZE];
 
 
 //
@@ -189,7 +189,7 @@ EV_DoCeiling
 	
 	// new door thinker
 	rtn = 1;
-	ceiling = Z_Malloc (sizeof(*ceiling), PU_LEVSPEC, 0);
+	ceiling = Z_PoolMalloc (sizeof(*ceiling));
 	P_AddThinker (&ceiling->thinker);
 	sec->specialdata = ceiling;
 	ceiling->thinker.function.acp1 = (actionf_p1)T_MoveCeiling;
@@ -239,16 +239,14 @@ EV_DoCeiling
 //
 void P_AddActiveCeiling(ceiling_t* c)
 {
-    int		i;
-    
-    for (i = 0; i < MAXCEILINGS;i++)
-    {
-	if (activeceilings[i] == NULL)
-	{
-	    activeceilings[i] = c;
-	    return;
-	}
-    }
+    ceiling_t**	head;
+
+    head = &activeceilings[c->tag & (TAGHASHSIZE-1)];
+    c->tagnext = *head;
+    c->tagprev = head;
+    if (*head)
+	(*head)->tagprev = &c->tagnext;
+    *head = c;
 }
 
 
@@ -258,18 +256,36 @@ void P_AddActiveCeiling(ceiling_t* c)
 //
 void P_RemoveActiveCeiling(ceiling_t* c)
 {
+    if (!c->tagprev)
+	return;
+
+    *c->tagprev = c->tagnext;
+    if (c->tagnext)
+	c->tagnext->tagprev = c->tagprev;
+    c->tagprev = NULL;
+
+    c->sector->specialdata = NULL;
+    P_RemoveThinker (&c->thinker);
+}
+
+
+
+//
+// P_IsActiveCeiling
+// For the savegame, which only has the thinker
+//  of a ceiling in stasis to go on.
+//
+bool P_IsActiveCeiling(thinker_t* th)
+{
+    ceiling_t*	c;
     int		i;
-	
-    for (i = 0;i < MAXCEILINGS;i++)
-    {
-	if (activeceilings[i] == c)
-	{
-	    activeceilings[i]->sector->specialdata = NULL;
-	    P_RemoveThinker (&activeceilings[i]->thinker);
-	    activeceilings[i] = NULL;
-	    break;
-	}
-    }
+
+    for (i = 0;i < TAGHASHSIZE;i++)
+	for (c = activeceilings[i];c;c = c->tagnext)
+	    if (&c->thinker == th)
+		return true;
+
+    return false;
 }
 
 
@@ -279,16 +295,15 @@ void P_RemoveActiveCeiling(ceiling_t* c)
 //
 void P_ActivateInStasisCeiling(line_t* line)
 {
-    int		i;
+    ceiling_t*	c;
 	
-    for (i = 0;i < MAXCEILINGS;i++)
+    for (c = activeceilings[line->tag & (TAGHASHSIZE-1)];c;c = c->tagnext)
     {
-	if (activeceilings[i]
-	    && (activeceilings[i]->tag == line->tag)
-	    && (activeceilings[i]->direction == 0))
+	if (c->tag == line->tag
+	    && c->direction == 0)
 	{
-	    activeceilings[i]->direction = activeceilings[i]->olddirection;
-	    activeceilings[i]->thinker.function.acp1
+	    c->direction = c->olddirection;
+	    c->thinker.function.acp1
 	      = (actionf_p1)T_MoveCeiling;
 	}
     }
@@ -302,19 +317,18 @@ void P_ActivateInStasisCeiling(line_t* line)
 //
 int	EV_CeilingCrushStop(line_t	*line)
 {
-    int		i;
+    ceiling_t*	c;
     int		rtn;
 	
     rtn = 0;
-    for (i = 0;i < MAXCEILINGS;i++)
+    for (c = activeceilings[line->tag & (TAGHASHSIZE-1)];c;c = c->tagnext)
     {
-	if (activeceilings[i]
-	    && (activeceilings[i]->tag == line->tag)
-	    && (activeceilings[i]->direction != 0))
+	if (c->tag == line->tag
+	    && c->direction != 0)
 	{
-	    activeceilings[i]->olddirection = activeceilings[i]->direction;
-	    activeceilings[i]->thinker.function.acv = (actionf_v)NULL;
-	    activeceilings[i]->direction = 0;		// in-stasis
+	    c->olddirection = c->direction;
+	    c->thinker.function.acv = (actionf_v)NULL;
+	    c->direction = 0;		// in-stasis
 	    rtn = 1;
 	}
     }
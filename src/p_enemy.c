@@ -23,6 +23,7 @@
 
 #include "m_random.h"
 #include "i_system.h"
+#include "z_zone.h"
 
 #include "doomdef.h"
 #include "p_local.h"
@@ -88,56 +89,140 @@ void A_Fall (mobj_t *actor);
 
 
 //
-// Called by P_NoiseAlert.
-// Recursively traverse adjacent sectors,
-// sound blocking lines cut off traversal.
+// Sound propagation graph, built by P_InitSoundGraph.
+// The two-sided lines of each sector, as the sector on the
+//  other side and whether the line blocks sound, from
+//  soundedges[soundedgestart[i]] to soundedgestart[i+1].
 //
+typedef struct
+{
+    sector_t*	other;
+    bool	block;
+} soundedge_t;
 
-mobj_t*		soundtarget;
+static soundedge_t*	soundedges;
+static int*		soundedgestart;
 
-void
-P_RecursiveSound
-( sector_t*	sec,
-  int		soundblocks )
+// Sectors left to flood from, and those found past
+//  a sound blocking line, to flood from after.
+static sector_t**	soundstack;
+static sector_t**	soundblocked;
+static int		numsoundblocked;
+
+
+//
+// P_InitSoundGraph
+// Called by P_SetupLevel, once the sectors have their lines.
+//
+void P_InitSoundGraph (void)
 {
-    int		i;
+    sector_t*	sec;
     line_t*	check;
-    sector_t*	other;
-	
-    // wake up all monsters in this sector
-    if (sec->validcount == validcount
-	&& sec->soundtraversed <= soundblocks+1)
+    int		numedges;
+    int		i;
+    int		j;
+
+    numedges = 0;
+
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+	for (j=0 ; j<sec->linecount ; j++)
+	    if ((sec->lines[j]->flags & ML_TWOSIDED) && sec->lines[j]->sidenum[1] != -1)
+		numedges++;
+
+    soundedges = Z_LevelMalloc (numedges * sizeof(*soundedges));
+    soundedgestart = Z_LevelMalloc ((numsectors+1) * sizeof(*soundedgestart));
+    soundstack = Z_LevelMalloc (numsectors * sizeof(*soundstack));
+    soundblocked = Z_LevelMalloc (numedges * sizeof(*soundblocked));
+
+    numedges = 0;
+
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
     {
-	return;		// already flooded
+	soundedgestart[i] = numedges;
+
+	for (j=0 ; j<sec->linecount ; j++)
+	{
+	    check = sec->lines[j];
+
+	    // a line without a back side is never open
+	    if (!(check->flags & ML_TWOSIDED) || check->sidenum[1] == -1)
+		continue;
+
+	    if ( sides[ check->sidenum[0] ].sector == sec)
+		soundedges[numedges].other = sides[ check->sidenum[1] ] .sector;
+	    else
+		soundedges[numedges].other = sides[ check->sidenum[0] ].sector;
+
+	    soundedges[numedges].block = (check->flags & ML_SOUNDBLOCK) != 0;
+	    numedges++;
+	}
     }
-    
-    sec->validcount = validcount;
-    sec->soundtraversed = soundblocks+1;
-    sec->soundtarget = soundtarget;
-	
-    for (i=0 ;i<sec->linecount ; i++)
+
+    soundedgestart[numsectors] = numedges;
+}
+
+
+//
+// P_FloodSound
+// Floods from start through the open lines that don't
+//  block sound. With traversed 1, the sectors past lines
+//  that do are kept in soundblocked.
+//
+mobj_t*		soundtarget;
+
+static void
+P_FloodSound
+( sector_t*	start,
+  int		traversed )
+{
+    soundedge_t*	edge;
+    soundedge_t*	end;
+    sector_t*		sec;
+    sector_t*		other;
+    int			numstack;
+
+    if (start->validcount == validcount)
+	return;		// already flooded
+
+    start->validcount = validcount;
+    start->soundtraversed = traversed;
+    start->soundtarget = soundtarget;
+
+    soundstack[0] = start;
+    numstack = 1;
+
+    while (numstack)
     {
-	check = sec->lines[i];
-	if (! (check->flags & ML_TWOSIDED) )
-	    continue;
-	
-	P_LineOpening (check);
+	sec = soundstack[--numstack];
+	edge = soundedges + soundedgestart[sec - sectors];
+	end = soundedges + soundedgestart[sec - sectors + 1];
 
-	if (openrange <= 0)
-	    continue;	// closed door
-	
-	if ( sides[ check->sidenum[0] ].sector == sec)
-	    other = sides[ check->sidenum[1] ] .sector;
-	else
-	    other = sides[ check->sidenum[0] ].sector;
-	
-	if (check->flags & ML_SOUNDBLOCK)
+	for ( ; edge < end ; edge++)
 	{
-	    if (!soundblocks)
-		P_RecursiveSound (other, 1);
+	    other = edge->other;
+
+	    if (other->validcount == validcount)
+		continue;
+
+	    // closed door, as P_LineOpening would find it
+	    if ((sec->ceilingheight < other->ceilingheight
+		 ? sec->ceilingheight : other->ceilingheight)
+		<= (sec->floorheight > other->floorheight
+		    ? sec->floorheight : other->floorheight))
+		continue;
+
+	    if (edge->block)
+	    {
+		if (traversed == 1)
+		    soundblocked[numsoundblocked++] = other;
+		continue;
+	    }
+
+	    other->validcount = validcount;
+	    other->soundtraversed = traversed;
+	    other->soundtarget = soundtarget;
+	    soundstack[numstack++] = other;
 	}
-	else
-	    P_RecursiveSound (other, soundblocks);
     }
 }
 
@@ -147,15 +232,26 @@ P_RecursiveSound
 // P_NoiseAlert
 // If a monster yells at a player,
 // it will alert other monsters to the player.
+// Every sector sound reaches without crossing a sound
+//  blocking line gets soundtraversed 1, then those it
+//  reaches crossing one get 2, as the recursive flood of
+//  the original left them.
 //
 void
 P_NoiseAlert
 ( mobj_t*	target,
   mobj_t*	emmiter )
 {
+    int		i;
+
     soundtarget = target;
     validcount++;
-    P_RecursiveSound (emmiter->subsector->sector, 0);
+    numsoundblocked = 0;
+
+    P_FloodSound (emmiter->subsector->sector, 1);
+
+    for (i=0 ; i<numsoundblocked ; i++)
+	P_FloodSound (soundblocked[i], 2);
 }
 
 
@@ -1311,6 +1407,9 @@ void A_VileAttack (mobj_t* actor)
     S_StartSound (actor, sfx_barexp);
     P_DamageMobj (actor->target, actor, actor, 20);
     actor->target->momz = 1000*FRACUNIT/actor->target->info->mass;
+
+    // the target may be a corpse
+    P_WakeThinker (&actor->target->thinker);
 	
     an = actor->angle >> ANGLETOFINESHIFT;
 
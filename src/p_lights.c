@@ -18,6 +18,7 @@
 //
 
 
+#include <string.h>
 
 #include "z_zone.h"
 #include "m_random.h"
@@ -29,6 +30,78 @@
 // State.
 #include "r_state.h"
 
+//
+// LIGHT BATCHES
+//
+
+//
+// T_RunLights
+// The lights of a batch in the order they were
+//  spawned, as their thinkers would have run, so
+//  they call P_Random in the same order.
+//
+void T_RunLights (lightbatch_t* batch)
+{
+    thinker_t*	light;
+    int		i;
+
+    for (i = 0 ; i < batch->numlights ; i++)
+    {
+	light = batch->lights[i];
+
+	if (light->function.acp1 == (actionf_p1) T_LightFlash)
+	    T_LightFlash ((lightflash_t *) light);
+	else if (light->function.acp1 == (actionf_p1) T_StrobeFlash)
+	    T_StrobeFlash ((strobe_t *) light);
+	else if (light->function.acp1 == (actionf_p1) T_Glow)
+	    T_Glow ((glow_t *) light);
+	else
+	    T_FireFlicker ((fireflicker_t *) light);
+    }
+}
+
+
+//
+// P_AddLight
+// Adds a light to the batch at the end of the thinker
+//  list, or to a new batch when another thinker was
+//  added since. Lights are never removed.
+//
+void P_AddLight (thinker_t* light)
+{
+    lightbatch_t*	batch;
+    thinker_t**		lights;
+
+    if (thinkercap.prev->function.acp1 == (actionf_p1) T_RunLights)
+    {
+	batch = (lightbatch_t *) thinkercap.prev;
+    }
+    else
+    {
+	batch = Z_PoolMalloc (sizeof(*batch));
+	P_AddThinker (&batch->thinker);
+	batch->thinker.function.acp1 = (actionf_p1) T_RunLights;
+	batch->lights = NULL;
+	batch->numlights = 0;
+	batch->maxlights = 0;
+    }
+
+    if (batch->numlights == batch->maxlights)
+    {
+	batch->maxlights = batch->maxlights ? batch->maxlights * 2 : 16;
+	lights = Z_Malloc (batch->maxlights * sizeof(*lights), PU_LEVEL, 0);
+	if (batch->lights)
+	{
+	    memcpy (lights, batch->lights, batch->numlights * sizeof(*lights));
+	    Z_Free (batch->lights);
+	}
+	batch->lights = lights;
+    }
+
+    batch->lights[batch->numlights++] = light;
+}
+
+
 //
 // FIRELIGHT FLICKER
 //
@@ -66,9 +139,9 @@ void P_SpawnFireFlicker (sector_t*	sector)
     // Nothing special about it during gameplay.
     sector->special = 0; 
 	
-    flick = Z_Malloc ( sizeof(*flick), PU_LEVSPEC, 0);
+    flick = Z_PoolMalloc (sizeof(*flick));
 
-    P_AddThinker (&flick->thinker);
+    P_AddLight (&flick->thinker);
 
     flick->thinker.function.acp1 = (actionf_p1) T_FireFlicker;
     flick->sector = sector;
@@ -121,9 +194,9 @@ void P_SpawnLightFlash (sector_t*	sector)
     // nothing special about it during gameplay
     sector->special = 0;	
 	
-    flash = Z_Malloc ( sizeof(*flash), PU_LEVSPEC, 0);
+    flash = Z_PoolMalloc (sizeof(*flash));
 
-    P_AddThinker (&flash->thinker);
+    P_AddLight (&flash->thinker);
 
     flash->thinker.function.acp1 = (actionf_p1) T_LightFlash;
     flash->sector = sector;
@@ -178,9 +251,9 @@ P_SpawnStrobeFlash
 {
     strobe_t*	flash;
 	
-    flash = Z_Malloc ( sizeof(*flash), PU_LEVSPEC, 0);
+    flash = Z_PoolMalloc (sizeof(*flash));
 
-    P_AddThinker (&flash->thinker);
+    P_AddLight (&flash->thinker);
 
     flash->sector = sector;
     flash->darktime = fastOrSlow;
@@ -233,26 +306,19 @@ void EV_TurnTagLightsOff(line_t* line)
     int			min;
     sector_t*		sector;
     sector_t*		tsec;
-    line_t*		templine;
 	
-    sector = sectors;
-    
-    for (j = 0;j < numsectors; j++, sector++)
+    j = -1;
+    while ((j = P_FindSectorFromLineTag(line,j)) >= 0)
     {
-	if (sector->tag == line->tag)
+	sector = &sectors[j];
+	min = sector->lightlevel;
+	for (i = 0;i < sector->neighborcount; i++)
 	{
-	    min = sector->lightlevel;
-	    for (i = 0;i < sector->linecount; i++)
-	    {
-		templine = sector->lines[i];
-		tsec = getNextSector(templine,sector);
-		if (!tsec)
-		    continue;
-		if (tsec->lightlevel < min)
-		    min = tsec->lightlevel;
-	    }
-	    sector->lightlevel = min;
+	    tsec = sector->neighbors[i];
+	    if (tsec->lightlevel < min)
+		min = tsec->lightlevel;
 	}
+	sector->lightlevel = min;
     }
 }
 
@@ -269,33 +335,26 @@ EV_LightTurnOn
     int		j;
     sector_t*	sector;
     sector_t*	temp;
-    line_t*	templine;
-	
-    sector = sectors;
 	
-    for (i=0;i<numsectors;i++, sector++)
+    i = -1;
+    while ((i = P_FindSectorFromLineTag(line,i)) >= 0)
     {
-	if (sector->tag == line->tag)
+	sector = &sectors[i];
+
+	// bright = 0 means to search
+	// for highest light level
+	// surrounding sector
+	if (!bright)
 	{
-	    // bright = 0 means to search
-	    // for highest light level
-	    // surrounding sector
-	    if (!bright)
+	    for (j = 0;j < sector->neighborcount; j++)
 	    {
-		for (j = 0;j < sector->linecount; j++)
-		{
-		    templine = sector->lines[j];
-		    temp = getNextSector(templine,sector);
-
-		    if (!temp)
-			continue;
+		temp = sector->neighbors[j];
 
-		    if (temp->lightlevel > bright)
-			bright = temp->lightlevel;
-		}
+		if (temp->lightlevel > bright)
+		    bright = temp->lightlevel;
 	    }
-	    sector-> lightlevel = bright;
 	}
+	sector-> lightlevel = bright;
     }
 }
 
@@ -335,9 +394,9 @@ void P_SpawnGlowingLight(sector_t*	sector)
 {
     glow_t*	g;
 	
-    g = Z_Malloc( sizeof(*g), PU_LEVSPEC, 0);
+    g = Z_PoolMalloc (sizeof(*g));
 
-    P_AddThinker(&g->thinker);
+    P_AddLight (&g->thinker);
 
     g->sector = sector;
     g->minlight = P_FindMinSurroundingLight(sector,sector->lightlevel);
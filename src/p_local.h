@@ -70,6 +70,9 @@ extern	thinker_t	thinkercap;
 void P_InitThinkers (void);
 void P_AddThinker (thinker_t* thinker);
 void P_RemoveThinker (thinker_t* thinker);
+void P_ParkThinker (thinker_t* thinker);
+void P_SleepThinker (thinker_t* thinker, int waketic);
+void P_WakeThinker (thinker_t* thinker);
 
 
 //
@@ -114,6 +117,25 @@ void 	P_RemoveMobj (mobj_t* th);
 mobj_t* P_SubstNullMobj (mobj_t* th);
 bool	P_SetMobjState (mobj_t* mobj, statenum_t state);
 void 	P_MobjThinker (mobj_t* mobj);
+int	P_MobjTics (mobj_t* mobj);
+void	P_ResetOldPosition (mobj_t* mobj);
+
+// The fields of states[] read on every state change, packed
+//  into 16 bytes a state instead of 40.
+typedef struct
+{
+    actionf_t		action;
+    short		tics;
+    short		nextstate;
+    unsigned short	frame;
+    byte		sprite;
+    byte		coords;		// misc1 is set, for psprites
+} statehot_t;
+
+extern statehot_t	stateshot[NUMSTATES];
+
+// Builds stateshot from states, again after any change to them.
+void	P_InitStateTable (void);
 
 void	P_SpawnPuff (fixed_t x, fixed_t y, fixed_t z);
 void 	P_SpawnBlood (fixed_t x, fixed_t y, fixed_t z, int damage);
@@ -125,6 +147,12 @@ void	P_SpawnPlayerMissile (mobj_t* source, mobjtype_t type);
 // P_ENEMY
 //
 void P_NoiseAlert (mobj_t* target, mobj_t* emmiter);
+void P_InitSoundGraph (void);
+
+// The spots the boss brain spits cubes at
+extern mobj_t*		braintargets[32];
+extern int		numbraintargets;
+extern int		braintargeton;
 
 
 //
@@ -149,12 +177,13 @@ typedef struct
     }			d;
 } intercept_t;
 
-// Extended MAXINTERCEPTS, to allow for intercepts overrun emulation.
+// Past this, the intercepts still grow, but overrun emulation
+//  writes what vanilla's fixed array would have overwritten.
 
 #define MAXINTERCEPTS_ORIGINAL 128
 #define MAXINTERCEPTS          (MAXINTERCEPTS_ORIGINAL + 61)
 
-extern intercept_t	intercepts[MAXINTERCEPTS];
+extern intercept_t*	intercepts;
 extern intercept_t*	intercept_p;
 
 typedef bool (*traverser_t) (intercept_t *in);
@@ -174,7 +203,18 @@ extern fixed_t		lowfloor;
 void 	P_LineOpening (line_t* linedef);
 
 bool P_BlockLinesIterator (int x, int y, bool(*func)(line_t*) );
+bool P_BlockLinesIteratorBox (int x, int y, fixed_t* box,
+			      bool(*func)(line_t*) );
+void P_InitLineBoxes (int count);
 bool P_BlockThingsIterator (int x, int y, bool(*func)(mobj_t*) );
+bool P_BlockThingsIteratorBox (int x, int y, fixed_t* box,
+			       bool(*func)(mobj_t*) );
+
+// Each mapblock is split into BLOCKCELLS x BLOCKCELLS cells
+//  of things, followed by a list per block of the things
+//  bigger than MAXRADIUS.
+#define BLOCKCELLS	4
+#define CELLSHIFT	(MAPBLOCKSHIFT-2)
 
 #define PT_ADDLINES		1
 #define PT_ADDTHINGS	2
@@ -194,6 +234,21 @@ P_PathTraverse
 void P_UnsetThingPosition (mobj_t* thing);
 void P_SetThingPosition (mobj_t* thing);
 
+// Links a thing to a sector its box touches,
+//  kept for P_ChangeSector with -fastsectors.
+typedef struct touchnode_s
+{
+    sector_t*		sector;
+    mobj_t*		thing;
+    struct touchnode_s*	tnext;	// next sector of the thing
+    struct touchnode_s*	snext;	// next thing of the sector
+    struct touchnode_s**	sprev;
+} touchnode_t;
+
+// Set by -fastsectors, outside of demos and netgames.
+extern bool		fastsectors;
+extern bool		touchlists;	// for the current level
+
 
 //
 // P_MAP
@@ -227,6 +282,9 @@ bool P_TryMove (mobj_t* thing, fixed_t x, fixed_t y);
 bool P_TeleportMove (mobj_t* thing, fixed_t x, fixed_t y);
 void	P_SlideMove (mobj_t* mo);
 bool P_CheckSight (mobj_t* t1, mobj_t* t2);
+void P_FlushSightCache (void);
+void P_InitSight (void);
+void P_PredictSight (void);
 void 	P_UseLines (player_t* player);
 
 bool P_ChangeSector (sector_t* sector, bool crunch);
@@ -259,13 +317,23 @@ P_RadiusAttack
 // P_SETUP
 //
 extern byte*		rejectmatrix;	// for fast sight rejection
-extern short*		blockmaplump;	// offsets in blockmap are from here
-extern short*		blockmap;
+extern int32_t*		blockmaplump;	// offsets in blockmap are from here
+extern int32_t*		blockmap;
 extern int		bmapwidth;
 extern int		bmapheight;	// in mapblocks
 extern fixed_t		bmaporgx;
 extern fixed_t		bmaporgy;	// origin of block map
 extern mobj_t**		blocklinks;	// for thing chains
+extern mobj_t**		thingcells;	// finer thing chains
+
+
+//
+// P_PVS
+//
+extern bool		sightpvs;
+
+void	P_InitPVS (void);
+void	P_LoadPVS (int lumpnum);
 
 
 
@@ -30,6 +30,7 @@
 #include "m_argv.h"
 #include "m_misc.h"
 #include "p_local.h"
+#include "p_bench.h"
 
 #include "s_sound.h"
 
@@ -449,9 +450,11 @@ P_CheckPosition
     yl = (tmbbox[BOXBOTTOM] - bmaporgy - MAXRADIUS)>>MAPBLOCKSHIFT;
     yh = (tmbbox[BOXTOP] - bmaporgy + MAXRADIUS)>>MAPBLOCKSHIFT;
 
+    // Only the things that can reach tmbbox make it past
+    // the distance checks of PIT_CheckThing.
     for (bx=xl ; bx<=xh ; bx++)
 	for (by=yl ; by<=yh ; by++)
-	    if (!P_BlockThingsIterator(bx,by,PIT_CheckThing))
+	    if (!P_BlockThingsIteratorBox(bx,by,tmbbox,PIT_CheckThing))
 		return false;
     
     // check lines
@@ -462,7 +465,7 @@ P_CheckPosition
 
     for (bx=xl ; bx<=xh ; bx++)
 	for (by=yl ; by<=yh ; by++)
-	    if (!P_BlockLinesIterator (bx,by,PIT_CheckLine))
+	    if (!P_BlockLinesIteratorBox (bx,by,tmbbox,PIT_CheckLine))
 		return false;
 
     return true;
@@ -474,8 +477,8 @@ P_CheckPosition
 // Attempt to move to a new position,
 // crossing special lines unless MF_TELEPORT is set.
 //
-bool
-P_TryMove
+static bool
+P_DoTryMove
 ( mobj_t*	thing,
   fixed_t	x,
   fixed_t	y )
@@ -544,6 +547,28 @@ P_TryMove
 }
 
 
+//
+// P_TryMove
+// P_DoTryMove, timed under -benchplaysim.
+//
+bool
+P_TryMove
+( mobj_t*	thing,
+  fixed_t	x,
+  fixed_t	y )
+{
+    bool	result;
+
+    if (!playsimbench)
+	return P_DoTryMove (thing, x, y);
+
+    P_StartHelper (HELPER_TRYMOVE);
+    result = P_DoTryMove (thing, x, y);
+    P_EndHelper (HELPER_TRYMOVE);
+    return result;
+}
+
+
 //
 // P_ThingHeightClip
 // Takes a valid thing and adjusts the thing->floorz,
@@ -831,8 +856,8 @@ fixed_t		attackrange;
 fixed_t		aimslope;
 
 // slopes to top and bottom of target
-extern fixed_t	topslope;
-extern fixed_t	bottomslope;	
+fixed_t		topslope;
+fixed_t		bottomslope;	
 
 
 //
@@ -1371,9 +1396,28 @@ P_ChangeSector
 {
     int		x;
     int		y;
+    touchnode_t*	node;
+    touchnode_t*	next;
 	
     nofit = false;
     crushchange = crunch;
+
+    // the sector has moved, what could be seen may have changed
+    P_FlushSightCache ();
+
+    if (touchlists)
+    {
+	// a thing removed as it is checked takes its node
+	//  with it, and things spawned go in at the head,
+	//  where the walk has been, as in blocklinks
+	for (node = sector->touchlist ; node ; node = next)
+	{
+	    next = node->snext;
+	    PIT_ChangeSector (node->thing);
+	}
+
+	return nofit;
+    }
 	
     // re-check heights for all things near the moving sector
     for (x=sector->blockbox[BOXLEFT] ; x<= sector->blockbox[BOXRIGHT] ; x++)
@@ -23,18 +23,28 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 
 
 #include "m_bbox.h"
 
 #include "doomdef.h"
 #include "doomstat.h"
+#include "i_system.h"
 #include "p_local.h"
+#include "p_bench.h"
+#include "z_zone.h"
 
 
 // State.
 #include "r_state.h"
 
+#include "i_simd.h"
+
+#ifdef HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
 //
 // P_AproxDistance
 // Gives an estimation of distance (not exact)
@@ -332,6 +342,214 @@ void P_LineOpening (line_t* linedef)
 //
 
 
+//
+// TOUCH LISTS
+// Vanilla P_ChangeSector checks every thing near the
+//  sector's box. With -fastsectors, each sector keeps
+//  the things whose box touches it instead. That skips
+//  things vanilla would have checked, so it is off in
+//  demos and netgames.
+//
+bool		fastsectors;
+bool		touchlists;
+
+
+static void P_AddTouchNode (mobj_t* thing, sector_t* sec)
+{
+    touchnode_t*	node;
+
+    for (node = thing->touching ; node ; node = node->tnext)
+    {
+	if (node->sector == sec)
+	    return;
+    }
+
+    node = Z_PoolMalloc (sizeof(*node));
+    node->sector = sec;
+    node->thing = thing;
+
+    node->tnext = thing->touching;
+    thing->touching = node;
+
+    node->sprev = &sec->touchlist;
+    node->snext = sec->touchlist;
+    if (sec->touchlist)
+	sec->touchlist->sprev = &node->snext;
+    sec->touchlist = node;
+}
+
+
+//
+// P_LinkTouching
+// Like P_CheckPosition, the sectors are those of the
+//  lines the box crosses, and the one under the thing.
+//
+static void P_LinkTouching (mobj_t* thing)
+{
+    fixed_t	bbox[4];
+    int		xl;
+    int		xh;
+    int		yl;
+    int		yh;
+    int		bx;
+    int		by;
+    int32_t*	list;
+    line_t*	ld;
+
+    bbox[BOXTOP] = thing->y + thing->radius;
+    bbox[BOXBOTTOM] = thing->y - thing->radius;
+    bbox[BOXRIGHT] = thing->x + thing->radius;
+    bbox[BOXLEFT] = thing->x - thing->radius;
+
+    xl = (bbox[BOXLEFT] - bmaporgx)>>MAPBLOCKSHIFT;
+    xh = (bbox[BOXRIGHT] - bmaporgx)>>MAPBLOCKSHIFT;
+    yl = (bbox[BOXBOTTOM] - bmaporgy)>>MAPBLOCKSHIFT;
+    yh = (bbox[BOXTOP] - bmaporgy)>>MAPBLOCKSHIFT;
+
+    if (xl < 0)
+	xl = 0;
+    if (yl < 0)
+	yl = 0;
+    if (xh >= bmapwidth)
+	xh = bmapwidth - 1;
+    if (yh >= bmapheight)
+	yh = bmapheight - 1;
+
+    for (bx = xl ; bx <= xh ; bx++)
+    {
+	for (by = yl ; by <= yh ; by++)
+	{
+	    list = blockmaplump + blockmap[by*bmapwidth+bx];
+
+	    // lines in several blocks are only added once
+	    //  by P_AddTouchNode
+	    for ( ; *list != -1 ; list++)
+	    {
+		ld = &lines[*list];
+
+		if (bbox[BOXRIGHT] <= ld->bbox[BOXLEFT]
+		    || bbox[BOXLEFT] >= ld->bbox[BOXRIGHT]
+		    || bbox[BOXTOP] <= ld->bbox[BOXBOTTOM]
+		    || bbox[BOXBOTTOM] >= ld->bbox[BOXTOP])
+		    continue;
+
+		if (P_BoxOnLineSide (bbox, ld) != -1)
+		    continue;
+
+		P_AddTouchNode (thing, ld->frontsector);
+		if (ld->backsector)
+		    P_AddTouchNode (thing, ld->backsector);
+	    }
+	}
+    }
+
+    P_AddTouchNode (thing, thing->subsector->sector);
+}
+
+
+static void P_UnlinkTouching (mobj_t* thing)
+{
+    touchnode_t*	node;
+    touchnode_t*	next;
+
+    for (node = thing->touching ; node ; node = next)
+    {
+	next = node->tnext;
+
+	*node->sprev = node->snext;
+	if (node->snext)
+	    node->snext->sprev = node->sprev;
+
+	Z_PoolFree (node);
+    }
+
+    thing->touching = NULL;
+}
+
+
+//
+// THING CELLS
+// Every thing in blocklinks is also in a list of the cell
+//  its center is in, or of its block when it is too big
+//  for the cells to tell whether it can reach a box.
+// The newest link is first, like in blocklinks, so the
+//  lists can be merged back into the order of the block.
+//
+typedef struct cellwalk_s
+{
+    mobj_t*		heads[BLOCKCELLS*BLOCKCELLS+1];
+    int			numheads;
+    struct cellwalk_s*	prev;
+} cellwalk_t;
+
+static unsigned		linkcount;
+
+// The walks of P_BlockThingsIteratorBox that are running.
+static cellwalk_t*	cellwalks;
+
+
+static int P_ThingCell (mobj_t* thing, int blockx, int blocky)
+{
+    int		cx;
+    int		cy;
+
+    if (thing->radius > MAXRADIUS)
+	return (blocky*bmapwidth+blockx) * (BLOCKCELLS*BLOCKCELLS+1)
+	     + BLOCKCELLS*BLOCKCELLS;
+
+    cx = ((thing->x - bmaporgx)>>CELLSHIFT) & (BLOCKCELLS-1);
+    cy = ((thing->y - bmaporgy)>>CELLSHIFT) & (BLOCKCELLS-1);
+
+    return (blocky*bmapwidth+blockx) * (BLOCKCELLS*BLOCKCELLS+1)
+	 + cy*BLOCKCELLS + cx;
+}
+
+
+static void P_LinkThingCell (mobj_t* thing, int blockx, int blocky)
+{
+    mobj_t**	link;
+
+    thing->thingcell = P_ThingCell (thing, blockx, blocky);
+    thing->linkstamp = ++linkcount;
+
+    link = &thingcells[thing->thingcell];
+    thing->cprev = NULL;
+    thing->cnext = *link;
+    if (*link)
+	(*link)->cprev = thing;
+
+    *link = thing;
+}
+
+
+static void P_UnlinkThingCell (mobj_t* thing)
+{
+    cellwalk_t*	walk;
+    int		i;
+
+    // things removed by the function of a walk
+    //  aren't visited by it, as in blocklinks
+    for (walk = cellwalks ; walk ; walk = walk->prev)
+    {
+	for (i = 0 ; i < walk->numheads ; i++)
+	{
+	    if (walk->heads[i] == thing)
+		walk->heads[i] = thing->cnext;
+	}
+    }
+
+    if (thing->cnext)
+	thing->cnext->cprev = thing->cprev;
+
+    if (thing->cprev)
+	thing->cprev->cnext = thing->cnext;
+    else
+	thingcells[thing->thingcell] = thing->cnext;
+
+    thing->thingcell = -1;
+}
+
+
 //
 // P_UnsetThingPosition
 // Unlinks a thing from block map and sectors.
@@ -344,6 +562,9 @@ void P_UnsetThingPosition (mobj_t* thing)
     int		blockx;
     int		blocky;
 
+    if (thing->touching)
+	P_UnlinkTouching (thing);
+
     if ( ! (thing->flags & MF_NOSECTOR) )
     {
 	// inert things don't need to be in blockmap?
@@ -361,6 +582,9 @@ void P_UnsetThingPosition (mobj_t* thing)
     {
 	// inert things don't need to be in blockmap
 	// unlink from block map
+	if (thing->thingcell >= 0)
+	    P_UnlinkThingCell (thing);
+
 	if (thing->bnext)
 	    thing->bnext->bprev = thing->bprev;
 	
@@ -435,11 +659,19 @@ P_SetThingPosition (mobj_t* thing)
 		(*link)->bprev = thing;
 
 	    *link = thing;
+
+	    P_LinkThingCell (thing, blockx, blocky);
+
+	    // only things in the blockmap are ever
+	    //  checked by P_ChangeSector
+	    if (touchlists)
+		P_LinkTouching (thing);
 	}
 	else
 	{
 	    // thing is off the map
 	    thing->bnext = thing->bprev = NULL;
+	    thing->thingcell = -1;
 	}
     }
 }
@@ -470,7 +702,7 @@ P_BlockLinesIterator
   bool(*func)(line_t*) )
 {
     int			offset;
-    short*		list;
+    int32_t*	list;
     line_t*		ld;
 	
     if (x<0
@@ -501,6 +733,285 @@ P_BlockLinesIterator
 }
 
 
+//
+// The geometry of the lines in the blockmap lists, kept
+//  beside blockmaplump, an entry for each one, so that
+//  the lines of a block are checked against a box from
+//  a few arrays read in order. The ends of the lists,
+//  and the padding after the last, never touch a box.
+//
+typedef struct
+{
+    fixed_t*	left;
+    fixed_t*	right;
+    fixed_t*	bottom;
+    fixed_t*	top;
+    fixed_t*	x;		// of v1
+    fixed_t*	y;
+    fixed_t*	dx;		// whole units, as P_PointOnLineSide
+    fixed_t*	dy;		//  multiplies by them
+    int*	slopetype;
+} lineboxes_t;
+
+static lineboxes_t	lineboxes;
+
+#define LINEBOXPAD	8
+
+
+//
+// P_InitLineBoxes
+// Called when the blockmap and the lines are loaded.
+//
+void P_InitLineBoxes (int count)
+{
+    fixed_t*	data;
+    line_t*	ld;
+    int		i;
+
+    data = Z_LevelMalloc ((count + LINEBOXPAD) * 9 * sizeof(fixed_t));
+
+    lineboxes.left = data;
+    lineboxes.right = lineboxes.left + count + LINEBOXPAD;
+    lineboxes.bottom = lineboxes.right + count + LINEBOXPAD;
+    lineboxes.top = lineboxes.bottom + count + LINEBOXPAD;
+    lineboxes.x = lineboxes.top + count + LINEBOXPAD;
+    lineboxes.y = lineboxes.x + count + LINEBOXPAD;
+    lineboxes.dx = lineboxes.y + count + LINEBOXPAD;
+    lineboxes.dy = lineboxes.dx + count + LINEBOXPAD;
+    lineboxes.slopetype = (int *) (lineboxes.dy + count + LINEBOXPAD);
+
+    for (i = 0 ; i < count + LINEBOXPAD ; i++)
+    {
+	if (i < 4 || i >= count || blockmaplump[i] < 0
+	    || blockmaplump[i] >= numlines)
+	{
+	    lineboxes.left[i] = INT_MAX;
+	    lineboxes.right[i] = INT_MIN;
+	    lineboxes.bottom[i] = INT_MAX;
+	    lineboxes.top[i] = INT_MIN;
+	    lineboxes.x[i] = lineboxes.y[i] = 0;
+	    lineboxes.dx[i] = lineboxes.dy[i] = 0;
+	    lineboxes.slopetype[i] = ST_HORIZONTAL;
+	    continue;
+	}
+
+	ld = &lines[blockmaplump[i]];
+	lineboxes.left[i] = ld->bbox[BOXLEFT];
+	lineboxes.right[i] = ld->bbox[BOXRIGHT];
+	lineboxes.bottom[i] = ld->bbox[BOXBOTTOM];
+	lineboxes.top[i] = ld->bbox[BOXTOP];
+	lineboxes.x[i] = ld->v1->x;
+	lineboxes.y[i] = ld->v1->y;
+	lineboxes.dx[i] = ld->dx >> FRACBITS;
+	lineboxes.dy[i] = ld->dy >> FRACBITS;
+	lineboxes.slopetype[i] = ld->slopetype;
+    }
+}
+
+
+//
+// P_LineBoxCrosses
+// The bbox test of PIT_CheckLine and P_BoxOnLineSide
+//  at once, for entry i of the blockmap lists.
+//
+static inline bool P_LineBoxCrosses (fixed_t* box, int i)
+{
+    fixed_t	x1;
+    fixed_t	x2;
+    int		p1;
+    int		p2;
+
+    if (box[BOXRIGHT] <= lineboxes.left[i]
+	|| box[BOXLEFT] >= lineboxes.right[i]
+	|| box[BOXTOP] <= lineboxes.bottom[i]
+	|| box[BOXBOTTOM] >= lineboxes.top[i])
+	return false;
+
+    switch (lineboxes.slopetype[i])
+    {
+      case ST_HORIZONTAL:
+	return (box[BOXTOP] > lineboxes.y[i]) != (box[BOXBOTTOM] > lineboxes.y[i]);
+
+      case ST_VERTICAL:
+	return (box[BOXRIGHT] < lineboxes.x[i]) != (box[BOXLEFT] < lineboxes.x[i]);
+
+      case ST_POSITIVE:
+	x1 = box[BOXLEFT];
+	x2 = box[BOXRIGHT];
+	break;
+
+      default:
+	x1 = box[BOXRIGHT];
+	x2 = box[BOXLEFT];
+	break;
+    }
+
+    p1 = FixedMul (box[BOXTOP] - lineboxes.y[i], lineboxes.dx[i])
+	< FixedMul (lineboxes.dy[i], x1 - lineboxes.x[i]);
+    p2 = FixedMul (box[BOXBOTTOM] - lineboxes.y[i], lineboxes.dx[i])
+	< FixedMul (lineboxes.dy[i], x2 - lineboxes.x[i]);
+
+    return p1 != p2;
+}
+
+
+#ifdef HAVE_AVX2_KERNELS
+//
+// P_FixedMulAVX2
+// FixedMul in each lane. Only the low 32 bits of the shifted
+//  products are kept, and those are the same whichever way
+//  they are shifted, so the logical 64-bit shifts do.
+//
+static AVX2_KERNEL inline __m256i P_FixedMulAVX2 (__m256i a, __m256i b)
+{
+    __m256i	even = _mm256_mul_epi32 (a, b);
+    __m256i	odd = _mm256_mul_epi32 (_mm256_srli_epi64 (a, 32),
+					_mm256_srli_epi64 (b, 32));
+
+    return _mm256_blend_epi32 (_mm256_srli_epi64 (even, FRACBITS),
+			       _mm256_slli_epi64 (odd, 32 - FRACBITS), 0xaa);
+}
+
+
+//
+// P_LineBoxesAVX2
+// P_LineBoxCrosses for entries i to i+7, a bit each.
+//
+static AVX2_KERNEL unsigned P_LineBoxesAVX2 (fixed_t* box, int i)
+{
+    __m256i	left = _mm256_set1_epi32 (box[BOXLEFT]);
+    __m256i	right = _mm256_set1_epi32 (box[BOXRIGHT]);
+    __m256i	bottom = _mm256_set1_epi32 (box[BOXBOTTOM]);
+    __m256i	top = _mm256_set1_epi32 (box[BOXTOP]);
+    __m256i	lx = _mm256_loadu_si256 ((__m256i *) &lineboxes.x[i]);
+    __m256i	ly = _mm256_loadu_si256 ((__m256i *) &lineboxes.y[i]);
+    __m256i	ldx = _mm256_loadu_si256 ((__m256i *) &lineboxes.dx[i]);
+    __m256i	ldy = _mm256_loadu_si256 ((__m256i *) &lineboxes.dy[i]);
+    __m256i	type = _mm256_loadu_si256 ((__m256i *) &lineboxes.slopetype[i]);
+    __m256i	outside;
+    __m256i	positive;
+    __m256i	x1;
+    __m256i	x2;
+    __m256i	p1;
+    __m256i	p2;
+    __m256i	cross;
+
+    // right <= bbox left, and so on
+    outside = _mm256_or_si256 (
+	_mm256_or_si256 (
+	    _mm256_cmpgt_epi32 (_mm256_loadu_si256 ((__m256i *) &lineboxes.left[i]), right),
+	    _mm256_cmpeq_epi32 (_mm256_loadu_si256 ((__m256i *) &lineboxes.left[i]), right)),
+	_mm256_or_si256 (
+	    _mm256_cmpgt_epi32 (left, _mm256_loadu_si256 ((__m256i *) &lineboxes.right[i])),
+	    _mm256_cmpeq_epi32 (left, _mm256_loadu_si256 ((__m256i *) &lineboxes.right[i]))));
+    outside = _mm256_or_si256 (outside, _mm256_or_si256 (
+	_mm256_or_si256 (
+	    _mm256_cmpgt_epi32 (_mm256_loadu_si256 ((__m256i *) &lineboxes.bottom[i]), top),
+	    _mm256_cmpeq_epi32 (_mm256_loadu_si256 ((__m256i *) &lineboxes.bottom[i]), top)),
+	_mm256_or_si256 (
+	    _mm256_cmpgt_epi32 (bottom, _mm256_loadu_si256 ((__m256i *) &lineboxes.top[i])),
+	    _mm256_cmpeq_epi32 (bottom, _mm256_loadu_si256 ((__m256i *) &lineboxes.top[i])))));
+
+    // sloped lines, through the corners P_BoxOnLineSide uses
+    positive = _mm256_cmpeq_epi32 (type, _mm256_set1_epi32 (ST_POSITIVE));
+    x1 = _mm256_blendv_epi8 (right, left, positive);
+    x2 = _mm256_blendv_epi8 (left, right, positive);
+
+    p1 = _mm256_cmpgt_epi32 (
+	P_FixedMulAVX2 (ldy, _mm256_sub_epi32 (x1, lx)),
+	P_FixedMulAVX2 (_mm256_sub_epi32 (top, ly), ldx));
+    p2 = _mm256_cmpgt_epi32 (
+	P_FixedMulAVX2 (ldy, _mm256_sub_epi32 (x2, lx)),
+	P_FixedMulAVX2 (_mm256_sub_epi32 (bottom, ly), ldx));
+    cross = _mm256_xor_si256 (p1, p2);
+
+    // level lines, by which side of v1 the edges are
+    cross = _mm256_blendv_epi8 (cross,
+	_mm256_xor_si256 (_mm256_cmpgt_epi32 (top, ly),
+			  _mm256_cmpgt_epi32 (bottom, ly)),
+	_mm256_cmpeq_epi32 (type, _mm256_set1_epi32 (ST_HORIZONTAL)));
+    cross = _mm256_blendv_epi8 (cross,
+	_mm256_xor_si256 (_mm256_cmpgt_epi32 (lx, right),
+			  _mm256_cmpgt_epi32 (lx, left)),
+	_mm256_cmpeq_epi32 (type, _mm256_set1_epi32 (ST_VERTICAL)));
+
+    return _mm256_movemask_ps (_mm256_castsi256_ps (
+	_mm256_andnot_si256 (outside, cross)));
+}
+#endif
+
+
+//
+// P_BlockLinesIteratorBox
+// Like P_BlockLinesIterator, in the same order, but only
+//  calls func for the lines that box crosses, which are
+//  the only ones PIT_CheckLine does anything with. The
+//  others would never be crossed in the next block either,
+//  so are left unmarked. box mustn't change in func.
+//
+bool
+P_BlockLinesIteratorBox
+( int			x,
+  int			y,
+  fixed_t*		box,
+  bool(*func)(line_t*) )
+{
+    int		offset;
+    int		end;
+    unsigned	mask;
+    line_t*	ld;
+	
+    if (x<0
+	|| y<0
+	|| x>=bmapwidth
+	|| y>=bmapheight)
+    {
+	return true;
+    }
+    
+    offset = *(blockmap + y*bmapwidth+x);
+
+    for (end = offset ; blockmaplump[end] != -1 ; end++)
+	;
+
+    for ( ; offset < end ; offset += 8)
+    {
+#ifdef HAVE_AVX2_KERNELS
+	if (simdkernel == KERNEL_AVX2)
+	{
+	    mask = P_LineBoxesAVX2 (box, offset);
+	}
+	else
+#endif
+	{
+	    int		i;
+
+	    mask = 0;
+	    for (i = 0 ; i < 8 ; i++)
+		mask |= P_LineBoxCrosses (box, offset + i) << i;
+	}
+
+	if (end - offset < 8)
+	    mask &= (1 << (end - offset)) - 1;
+
+	while (mask)
+	{
+	    ld = &lines[blockmaplump[offset + __builtin_ctz (mask)]];
+	    mask &= mask - 1;
+
+	    if (ld->validcount == validcount)
+		continue; 	// line has already been checked
+
+	    ld->validcount = validcount;
+		
+	    if ( !func(ld) )
+		return false;
+	}
+    }
+    return true;	// everything was checked
+}
+
+
 //
 // P_BlockThingsIterator
 //
@@ -532,19 +1043,169 @@ P_BlockThingsIterator
 }
 
 
+//
+// P_BlockThingsIteratorBox
+// Like P_BlockThingsIterator, in the same order, but
+//  leaves out the things that are too far from box
+//  to touch it.
+// If box changes in a call to func, the rest of
+//  the block is checked in full.
+//
+bool
+P_BlockThingsIteratorBox
+( int			x,
+  int			y,
+  fixed_t*		box,
+  bool(*func)(mobj_t*) )
+{
+    cellwalk_t	walk;
+    fixed_t	start[4];
+    mobj_t*	mobj;
+    int		base;
+    int		cxl;
+    int		cxh;
+    int		cyl;
+    int		cyh;
+    int		cx;
+    int		cy;
+    int		best;
+    int		i;
+    bool	ok;
+
+    if ( x<0
+	 || y<0
+	 || x>=bmapwidth
+	 || y>=bmapheight)
+    {
+	return true;
+    }
+
+    // the cells of the block the centers of things
+    //  that reach the box can be in
+    cxl = (box[BOXLEFT] - MAXRADIUS - bmaporgx)>>CELLSHIFT;
+    cxh = (box[BOXRIGHT] + MAXRADIUS - bmaporgx)>>CELLSHIFT;
+    cyl = (box[BOXBOTTOM] - MAXRADIUS - bmaporgy)>>CELLSHIFT;
+    cyh = (box[BOXTOP] + MAXRADIUS - bmaporgy)>>CELLSHIFT;
+
+    cxl = cxl < x*BLOCKCELLS ? 0 : cxl - x*BLOCKCELLS;
+    cyl = cyl < y*BLOCKCELLS ? 0 : cyl - y*BLOCKCELLS;
+    cxh = cxh - x*BLOCKCELLS;
+    cyh = cyh - y*BLOCKCELLS;
+    if (cxh >= BLOCKCELLS)
+	cxh = BLOCKCELLS-1;
+    if (cyh >= BLOCKCELLS)
+	cyh = BLOCKCELLS-1;
+
+    base = (y*bmapwidth+x) * (BLOCKCELLS*BLOCKCELLS+1);
+
+    walk.numheads = 0;
+    walk.heads[walk.numheads++] = thingcells[base + BLOCKCELLS*BLOCKCELLS];
+
+    for (cy = cyl ; cy <= cyh ; cy++)
+    {
+	for (cx = cxl ; cx <= cxh ; cx++)
+	{
+	    if (thingcells[base + cy*BLOCKCELLS + cx])
+		walk.heads[walk.numheads++] = thingcells[base + cy*BLOCKCELLS + cx];
+	}
+    }
+
+    memcpy (start, box, sizeof(start));
+
+    walk.prev = cellwalks;
+    cellwalks = &walk;
+    ok = true;
+
+    for (;;)
+    {
+	// the newest link of all the lists is next
+	best = -1;
+	for (i = 0 ; i < walk.numheads ; i++)
+	{
+	    if (walk.heads[i]
+		&& (best < 0
+		    || (int) (walk.heads[i]->linkstamp
+			      - walk.heads[best]->linkstamp) > 0))
+	    {
+		best = i;
+	    }
+	}
+
+	if (best < 0)
+	    break;
+
+	mobj = walk.heads[best];
+	walk.heads[best] = mobj->cnext;
+
+	if (!func (mobj))
+	{
+	    ok = false;
+	    break;
+	}
+
+	if (memcmp (start, box, sizeof(start)))
+	{
+	    cellwalks = walk.prev;
+
+	    for (mobj = mobj->bnext ; mobj ; mobj = mobj->bnext)
+	    {
+		if (!func (mobj))
+		    return false;
+	    }
+	    return true;
+	}
+    }
+
+    cellwalks = walk.prev;
+    return ok;
+}
+
+
 
 //
 // INTERCEPT ROUTINES
 //
-intercept_t	intercepts[MAXINTERCEPTS];
+intercept_t*	intercepts;
 intercept_t*	intercept_p;
 
+static int	maxintercepts;
+
+// Indexes of the intercepts left to traverse,
+//  as a heap on frac.
+static int*	interceptheap;
+
 divline_t 	trace;
 bool 	earlyout;
 int		ptflags;
 
 static void InterceptsOverrun(int num_intercepts, intercept_t *intercept);
 
+//
+// P_NewIntercept
+// Grows the intercepts as needed, so that long
+//  traces across open maps can't overflow them.
+//
+static intercept_t* P_NewIntercept (void)
+{
+    int		count;
+
+    count = intercept_p - intercepts;
+
+    if (count == maxintercepts)
+    {
+	maxintercepts = maxintercepts ? maxintercepts * 2 : MAXINTERCEPTS;
+	intercepts = realloc (intercepts, maxintercepts * sizeof(*intercepts));
+	interceptheap = realloc (interceptheap,
+				 maxintercepts * sizeof(*interceptheap));
+	if (intercepts == NULL || interceptheap == NULL)
+	    I_Error ("P_NewIntercept: out of memory for %i intercepts",
+		     maxintercepts);
+	intercept_p = intercepts + count;
+    }
+
+    return intercept_p;
+}
+
 //
 // PIT_AddLineIntercepts.
 // Looks for lines in the given block
@@ -597,6 +1258,7 @@ PIT_AddLineIntercepts (line_t* ld)
     }
     
 	
+    P_NewIntercept ();
     intercept_p->frac = frac;
     intercept_p->isaline = true;
     intercept_p->d.line = ld;
@@ -663,6 +1325,7 @@ bool PIT_AddThingIntercepts (mobj_t* thing)
     if (frac < 0)
 	return true;		// behind source
 
+    P_NewIntercept ();
     intercept_p->frac = frac;
     intercept_p->isaline = false;
     intercept_p->d.thing = thing;
@@ -673,10 +1336,49 @@ bool PIT_AddThingIntercepts (mobj_t* thing)
 }
 
 
+//
+// P_InterceptBefore
+// Ties go to the one added first,
+//  as the original scan picked them.
+//
+static inline bool P_InterceptBefore (int a, int b)
+{
+    if (intercepts[a].frac != intercepts[b].frac)
+	return intercepts[a].frac < intercepts[b].frac;
+
+    return a < b;
+}
+
+static void P_SiftIntercept (int i, int count)
+{
+    int		child;
+    int		swap;
+
+    for (;;)
+    {
+	child = 2 * i + 1;
+	if (child >= count)
+	    break;
+	if (child + 1 < count
+	    && P_InterceptBefore (interceptheap[child + 1], interceptheap[child]))
+	    child++;
+	if (!P_InterceptBefore (interceptheap[child], interceptheap[i]))
+	    break;
+
+	swap = interceptheap[i];
+	interceptheap[i] = interceptheap[child];
+	interceptheap[child] = swap;
+	i = child;
+    }
+}
+
+
 //
 // P_TraverseIntercepts
 // Returns true if the traverser function returns true
 // for all lines.
+// The intercepts are heaped rather than scanned for
+//  the closest each time, most traces stop early.
 // 
 bool
 P_TraverseIntercepts
@@ -684,45 +1386,28 @@ P_TraverseIntercepts
   fixed_t	maxfrac )
 {
     int			count;
-    fixed_t		dist;
-    intercept_t*	scan;
+    int			i;
     intercept_t*	in;
 	
     count = intercept_p - intercepts;
-    
-    in = 0;			// shut up compiler warning
+
+    for (i = 0 ; i < count ; i++)
+	interceptheap[i] = i;
+    for (i = count / 2 - 1 ; i >= 0 ; i--)
+	P_SiftIntercept (i, count);
 	
-    while (count--)
+    while (count)
     {
-	dist = INT_MAX;
-	for (scan = intercepts ; scan<intercept_p ; scan++)
-	{
-	    if (scan->frac < dist)
-	    {
-		dist = scan->frac;
-		in = scan;
-	    }
-	}
-	
-	if (dist > maxfrac)
-	    return true;	// checked everything in range		
+	in = &intercepts[interceptheap[0]];
 
-#if 0  // UNUSED
-    {
-	// don't check these yet, there may be others inserted
-	in = scan = intercepts;
-	for ( scan = intercepts ; scan<intercept_p ; scan++)
-	    if (scan->frac > maxfrac)
-		*in++ = *scan;
-	intercept_p = in;
-	return false;
-    }
-#endif
+	if (in->frac > maxfrac)
+	    return true;	// checked everything in range		
 
         if ( !func (in) )
 	    return false;	// don't bother going farther
 
-	in->frac = INT_MAX;
+	interceptheap[0] = interceptheap[--count];
+	P_SiftIntercept (0, count);
     }
 	
     return true;		// everything was traversed
@@ -857,8 +1542,8 @@ static void InterceptsOverrun(int num_intercepts, intercept_t *intercept)
 // Returns true if the traverser function returns true
 // for all lines.
 //
-bool
-P_PathTraverse
+static bool
+P_DoPathTraverse
 ( fixed_t		x1,
   fixed_t		y1,
   fixed_t		x2,
@@ -998,4 +1683,29 @@ P_PathTraverse
 }
 
 
+//
+// P_PathTraverse
+// P_DoPathTraverse, timed under -benchplaysim.
+//
+bool
+P_PathTraverse
+( fixed_t		x1,
+  fixed_t		y1,
+  fixed_t		x2,
+  fixed_t		y2,
+  int			flags,
+  bool (*trav) (intercept_t *))
+{
+    bool	result;
+
+    if (!playsimbench)
+	return P_DoPathTraverse (x1, y1, x2, y2, flags, trav);
+
+    P_StartHelper (HELPER_PATHTRAVERSE);
+    result = P_DoPathTraverse (x1, y1, x2, y2, flags, trav);
+    P_EndHelper (HELPER_PATHTRAVERSE);
+    return result;
+}
+
+
 
@@ -38,6 +38,39 @@ void G_PlayerReborn (int player);
 void P_SpawnMapThing (mapthing_t*	mthing);
 
 
+statehot_t	stateshot[NUMSTATES];
+
+//
+// P_InitStateTable
+//
+void P_InitStateTable (void)
+{
+    state_t*	st;
+    statehot_t*	hot;
+    int		i;
+
+    for (i = 0; i < NUMSTATES; i++)
+    {
+	st = &states[i];
+	hot = &stateshot[i];
+
+	if (st->tics != (short) st->tics
+	    || (unsigned) st->nextstate >= NUMSTATES
+	    || (unsigned) st->frame > 0xffff
+	    || (unsigned) st->sprite > 0xff)
+	{
+	    I_Error ("P_InitStateTable: state %i doesn't fit", i);
+	}
+
+	hot->action = st->action;
+	hot->tics = st->tics;
+	hot->nextstate = st->nextstate;
+	hot->frame = st->frame;
+	hot->sprite = st->sprite;
+	hot->coords = st->misc1 != 0;
+    }
+}
+
 //
 // P_SetMobjState
 // Returns true if the mobj is still present.
@@ -49,7 +82,12 @@ P_SetMobjState
 ( mobj_t*	mobj,
   statenum_t	state )
 {
-    state_t*	st;
+    statehot_t*	st;
+
+    P_WakeThinker (&mobj->thinker);
+
+    // the tics it slept through are of no account now
+    mobj->thinker.waketic = 0;
 
     do
     {
@@ -60,8 +98,8 @@ P_SetMobjState
 	    return false;
 	}
 
-	st = &states[state];
-	mobj->state = st;
+	st = &stateshot[state];
+	mobj->state = &states[state];
 	mobj->tics = st->tics;
 	mobj->sprite = st->sprite;
 	mobj->frame = st->frame;
@@ -440,6 +478,13 @@ P_NightmareRespawn (mobj_t* mobj)
 //
 void P_MobjThinker (mobj_t* mobj)
 {
+    // the tics counted down while it slept
+    if (mobj->thinker.waketic)
+    {
+	mobj->tics = P_MobjTics (mobj);
+	mobj->thinker.waketic = 0;
+    }
+
     // momentum movement
     if (mobj->momx
 	|| mobj->momy
@@ -470,17 +515,40 @@ void P_MobjThinker (mobj_t* mobj)
 		
 	// you can cycle through multiple states in a tic
 	if (!mobj->tics)
+	{
 	    if (!P_SetMobjState (mobj, mobj->state->nextstate) )
 		return;		// freed itself
+	}
+	// At rest, as a decoration, a corpse or an item, only
+	//  the count goes on until the state ends, unless
+	//  something changes it first, which wakes it. The
+	//  same as for parking below.
+	else if (mobj->tics > 1
+		 && !mobj->momx && !mobj->momy && !mobj->momz
+		 && !(mobj->flags & (MF_SKULLFLY|MF_SHOOTABLE))
+		 && mobj->z == mobj->floorz)
+	{
+	    P_SleepThinker (&mobj->thinker, leveltime + mobj->tics);
+	}
     }
     else
     {
 	// check for nightmare respawn
-	if (! (mobj->flags & MF_COUNTKILL) )
-	    return;
-
-	if (!respawnmonsters)
+	if (! (mobj->flags & MF_COUNTKILL)
+	    || !respawnmonsters)
+	{
+	    // Nothing happens to it from here on, unless
+	    //  it is moved or its state is changed. It
+	    //  can't be hit, so only P_SetMobjState and
+	    //  A_VileAttack do anything to it.
+	    if (!mobj->momx && !mobj->momy && !mobj->momz
+		&& !(mobj->flags & (MF_SKULLFLY|MF_SHOOTABLE))
+		&& mobj->z == mobj->floorz)
+	    {
+		P_ParkThinker (&mobj->thinker);
+	    }
 	    return;
+	}
 
 	mobj->movecount++;
 
@@ -499,6 +567,21 @@ void P_MobjThinker (mobj_t* mobj)
 }
 
 
+//
+// P_MobjTics
+// The tics left of the state, as P_MobjThinker would
+//  have counted them down had the mobj not slept: one
+//  on the tic it wakes at, before it runs.
+//
+int P_MobjTics (mobj_t* mobj)
+{
+    if (!mobj->thinker.waketic)
+	return mobj->tics;
+
+    return mobj->thinker.waketic - leveltime + 1;
+}
+
+
 //
 // P_SpawnMobj
 //
@@ -513,7 +596,7 @@ P_SpawnMobj
     state_t*	st;
     mobjinfo_t*	info;
 	
-    mobj = Z_Malloc (sizeof(*mobj), PU_LEVEL, NULL);
+    mobj = Z_PoolMalloc (sizeof(*mobj));
     memset (mobj, 0, sizeof (*mobj));
     info = &mobjinfo[type];
 	
@@ -555,11 +638,29 @@ P_SpawnMobj
     mobj->thinker.function.acp1 = (actionf_p1)P_MobjThinker;
 	
     P_AddThinker (&mobj->thinker);
+    P_ResetOldPosition (mobj);
 
     return mobj;
 }
 
 
+//
+// P_ResetOldPosition
+// For a mobj that appeared or jumped where it is, to be
+//  drawn there instead of on its way from where it was.
+//
+void P_ResetOldPosition (mobj_t* mobj)
+{
+    mobj->oldx = mobj->x;
+    mobj->oldy = mobj->y;
+    mobj->oldz = mobj->z;
+    mobj->oldangle = mobj->angle;
+
+    if (mobj->player)
+	mobj->player->oldviewz = mobj->player->viewz;
+}
+
+
 //
 // P_RemoveMobj
 //
@@ -200,6 +200,11 @@ typedef enum
 // Map Object definition.
 typedef struct mobj_s
 {
+    // The fields the movement and collision code reads come
+    //  first, in the first two cache lines of the mobj, and
+    //  the fields are ordered so that there is no padding,
+    //  keeping the mobj in the last class of Z_PoolMalloc.
+
     // List: thinker links.
     thinker_t		thinker;
 
@@ -208,25 +213,7 @@ typedef struct mobj_s
     fixed_t		y;
     fixed_t		z;
 
-    // More list: links in sector (if needed)
-    struct mobj_s*	snext;
-    struct mobj_s*	sprev;
-
-    //More drawing info: to determine current sprite.
-    angle_t		angle;	// orientation
-    spritenum_t		sprite;	// used to find patch_t and flip value
-    int			frame;	// might be ORed with FF_FULLBRIGHT
-
-    // Interaction info, by BLOCKMAP.
-    // Links in blocks (if needed).
-    struct mobj_s*	bnext;
-    struct mobj_s*	bprev;
-    
-    struct subsector_s*	subsector;
-
-    // The closest interval over all contacted Sectors.
-    fixed_t		floorz;
-    fixed_t		ceilingz;
+    int			flags;
 
     // For movement checking.
     fixed_t		radius;
@@ -237,25 +224,68 @@ typedef struct mobj_s
     fixed_t		momy;
     fixed_t		momz;
 
+    // The closest interval over all contacted Sectors.
+    fixed_t		floorz;
+    fixed_t		ceilingz;
+
     // If == validcount, already checked.
     int			validcount;
 
+    // Interaction info, by BLOCKMAP.
+    // Links in blocks (if needed).
+    struct mobj_s*	bnext;
+    struct mobj_s*	bprev;
+
+    struct subsector_s*	subsector;
+
     mobjtype_t		type;
-    mobjinfo_t*		info;	// &mobjinfo[mobj->type]
-    
     int			tics;	// state tic counter
     state_t*		state;
-    int			flags;
-    int			health;
 
-    // Movement direction, movement generation (zig-zagging).
-    int			movedir;	// 0-7
-    int			movecount;	// when 0, select a new dir
+    // Links in the finer cells of P_BlockThingsIteratorBox,
+    //  and when the mobj was last linked, for their order.
+    struct mobj_s*	cnext;
+    struct mobj_s*	cprev;
+    int			thingcell;
+    unsigned		linkstamp;
+
+    // More list: links in sector (if needed)
+    struct mobj_s*	snext;
+    struct mobj_s*	sprev;
+
+    // Sectors the box touches, with -fastsectors.
+    struct touchnode_s*	touching;
+
+    //More drawing info: to determine current sprite.
+    angle_t		angle;	// orientation
+
+    // Where it was at the start of the tic, with -uncapped,
+    //  for frames drawn between tics.
+    fixed_t		oldx;
+    fixed_t		oldy;
+    fixed_t		oldz;
+    angle_t		oldangle;
+    spritenum_t		sprite;	// used to find patch_t and flip value
+    int			frame;	// might be ORed with FF_FULLBRIGHT
+
+    int			health;
+    mobjinfo_t*		info;	// &mobjinfo[mobj->type]
 
     // Thing being chased/attacked (or NULL),
     // also the originator for missiles.
     struct mobj_s*	target;
 
+    // Additional info record for player avatars only.
+    // Only valid if type == MT_PLAYER
+    struct player_s*	player;
+
+    // Thing being chased/attacked for tracers.
+    struct mobj_s*	tracer;	
+
+    // Movement direction, movement generation (zig-zagging).
+    int			movedir;	// 0-7
+    int			movecount;	// when 0, select a new dir
+
     // Reaction time: if non 0, don't attack yet.
     // Used by player to freeze a bit after teleporting.
     int			reactiontime;   
@@ -264,19 +294,12 @@ typedef struct mobj_s
     // no matter what (even if shot)
     int			threshold;
 
-    // Additional info record for player avatars only.
-    // Only valid if type == MT_PLAYER
-    struct player_s*	player;
-
     // Player number last looked for.
     int			lastlook;	
 
     // For nightmare respawn.
     mapthing_t		spawnpoint;	
 
-    // Thing being chased/attacked for tracers.
-    struct mobj_s*	tracer;	
-    
 } mobj_t;
 
 
@@ -35,7 +35,7 @@
 #include "sounds.h"
 
 
-plat_t*		activeplats[MAXPLATS];
+plat_t*		activeplats[TAGHASHSIZE];
 
 
 
@@ -160,7 +160,7 @@ EV_DoPlat
 	
 	// Find lowest & highest floors around sector
 	rtn = 1;
-	plat = Z_Malloc( sizeof(*plat), PU_LEVSPEC, 0);
+	plat = Z_PoolMalloc (sizeof(*plat));
 	P_AddThinker(&plat->thinker);
 		
 	plat->type = type;
@@ -247,58 +247,54 @@ EV_DoPlat
 
 void P_ActivateInStasis(int tag)
 {
-    int		i;
+    plat_t*	plat;
 	
-    for (i = 0;i < MAXPLATS;i++)
-	if (activeplats[i]
-	    && (activeplats[i])->tag == tag
-	    && (activeplats[i])->status == in_stasis)
+    for (plat = activeplats[tag & (TAGHASHSIZE-1)];plat;plat = plat->tagnext)
+	if (plat->tag == tag
+	    && plat->status == in_stasis)
 	{
-	    (activeplats[i])->status = (activeplats[i])->oldstatus;
-	    (activeplats[i])->thinker.function.acp1
+	    plat->status = plat->oldstatus;
+	    plat->thinker.function.acp1
 	      = (actionf_p1) T_PlatRaise;
 	}
 }
 
 void EV_StopPlat(line_t* line)
 {
-    int		j;
+    plat_t*	plat;
 	
-    for (j = 0;j < MAXPLATS;j++)
-	if (activeplats[j]
-	    && ((activeplats[j])->status != in_stasis)
-	    && ((activeplats[j])->tag == line->tag))
+    for (plat = activeplats[line->tag & (TAGHASHSIZE-1)];plat;plat = plat->tagnext)
+	if (plat->status != in_stasis
+	    && plat->tag == line->tag)
 	{
-	    (activeplats[j])->oldstatus = (activeplats[j])->status;
-	    (activeplats[j])->status = in_stasis;
-	    (activeplats[j])->thinker.function.acv = (actionf_v)NULL;
+	    plat->oldstatus = plat->status;
+	    plat->status = in_stasis;
+	    plat->thinker.function.acv = (actionf_v)NULL;
 	}
 }
 
 void P_AddActivePlat(plat_t* plat)
 {
-    int		i;
-    
-    for (i = 0;i < MAXPLATS;i++)
-	if (activeplats[i] == NULL)
-	{
-	    activeplats[i] = plat;
-	    return;
-	}
-    I_Error ("P_AddActivePlat: no more plats!");
+    plat_t**	head;
+
+    head = &activeplats[plat->tag & (TAGHASHSIZE-1)];
+    plat->tagnext = *head;
+    plat->tagprev = head;
+    if (*head)
+	(*head)->tagprev = &plat->tagnext;
+    *head = plat;
 }
 
 void P_RemoveActivePlat(plat_t* plat)
 {
-    int		i;
-    for (i = 0;i < MAXPLATS;i++)
-	if (plat == activeplats[i])
-	{
-	    (activeplats[i])->sector->specialdata = NULL;
-	    P_RemoveThinker(&(activeplats[i])->thinker);
-	    activeplats[i] = NULL;
-	    
-	    return;
-	}
-    I_Error ("P_RemoveActivePlat: can't find plat!");
+    if (!plat->tagprev)
+	I_Error ("P_RemoveActivePlat: can't find plat!");
+
+    *plat->tagprev = plat->tagnext;
+    if (plat->tagnext)
+	plat->tagnext->tagprev = plat->tagprev;
+    plat->tagprev = NULL;
+
+    plat->sector->specialdata = NULL;
+    P_RemoveThinker(&plat->thinker);
 }
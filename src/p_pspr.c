@@ -53,7 +53,7 @@ P_SetPsprite
   statenum_t	stnum ) 
 {
     pspdef_t*	psp;
-    state_t*	state;
+    statehot_t*	state;
 	
     psp = &player->psprites[position];
 	
@@ -66,15 +66,15 @@ P_SetPsprite
 	    break;	
 	}
 	
-	state = &states[stnum];
-	psp->state = state;
+	state = &stateshot[stnum];
+	psp->state = &states[stnum];
 	psp->tics = state->tics;	// could be 0
 
-	if (state->misc1)
+	if (state->coords)
 	{
 	    // coordinate set
-	    psp->sx = state->misc1 << FRACBITS;
-	    psp->sy = state->misc2 << FRACBITS;
+	    psp->sx = states[stnum].misc1 << FRACBITS;
+	    psp->sy = states[stnum].misc2 << FRACBITS;
 	}
 	
 	// Call action routine.
@@ -0,0 +1,827 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Potentially visible sets, for fast sight rejection.
+//	With -sightpvs, every sector is flooded through the
+//	two sided lines at level load, clipping each line to
+//	what can be seen through the ones before it. Sector
+//	pairs that can't see each other from any point are
+//	added to the REJECT matrix, which many maps ship empty.
+//	Heights are ignored, so the sets stay valid whatever
+//	the doors and lifts do.
+//
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomdef.h"
+
+#include "i_system.h"
+#include "m_argv.h"
+#include "m_misc.h"
+#include "w_checksum.h"
+#include "w_wad.h"
+#include "z_zone.h"
+
+#include "p_local.h"
+
+// State.
+#include "doomstat.h"
+#include "r_state.h"
+
+
+#define PVSMAGIC	"DOOMPVS2"
+
+// How far a point may be on the wrong side of a line
+//  and still count, in map units.
+#define PVSEPSILON	0.5
+
+// Steps one sector may take before it falls back
+//  to everything its lines lead to.
+#define MAXPVSWORK	(1 << 16)
+
+// Past this, a level only gets the fallback.
+#define MAXPORTALS	16384
+
+typedef struct
+{
+    char		magic[8];
+    uint64_t		mapkey;
+    unsigned int	numsectors;
+
+    // followed by the visibility matrix,
+    //  laid out like the REJECT lump
+} pvsheader_t;
+
+typedef struct
+{
+    double	x1;
+    double	y1;
+    double	x2;
+    double	y2;
+} pvswinding_t;
+
+// A two sided line, seen from one of its sectors.
+typedef struct
+{
+    int		line;
+    int		sector;		// the one beyond
+
+    // distance beyond the line is
+    //  nx*x + ny*y - dist
+    double	nx;
+    double	ny;
+    double	dist;
+
+    pvswinding_t	winding;
+} portal_t;
+
+bool		sightpvs;
+
+static portal_t*	portals;
+static int		numportals;
+static int*		sectorportals;	// [numsectors+1] first portal
+static byte*		onpath;		// lines crossed so far
+static bool*		leaky;
+
+// The portals that might be seen through each portal,
+//  portalbytes apiece, and those reached so far.
+static byte*		portalflood;
+static byte*		portalseen;
+static int		portalbytes;
+
+// What the path to each depth might still reach.
+static byte**		mightstack;
+
+static byte*		pvs;
+static int		pvswork;
+static bool		pvsfull;
+
+#define PORTALBIT(set, p)	((set)[(p) >> 3] & (1 << ((p) & 7)))
+
+
+static void P_SetPVSBit (int s1, int s2)
+{
+    int		pnum;
+
+    pnum = s1 * numsectors + s2;
+    pvs[pnum >> 3] |= 1 << (pnum & 7);
+}
+
+static bool P_PVSBit (int s1, int s2)
+{
+    int		pnum;
+
+    pnum = s1 * numsectors + s2;
+    return (pvs[pnum >> 3] & (1 << (pnum & 7))) != 0;
+}
+
+static void P_ClearPVSRow (int s1)
+{
+    int		pnum;
+
+    for (pnum = s1 * numsectors ; pnum < (s1 + 1) * numsectors ; pnum++)
+	pvs[pnum >> 3] &= ~(1 << (pnum & 7));
+}
+
+
+//
+// P_ClipWinding
+// Keeps the part of w at least -PVSEPSILON from the line,
+//  returns false if nothing is left.
+//
+static bool
+P_ClipWinding
+( pvswinding_t*	w,
+  double	nx,
+  double	ny,
+  double	dist )
+{
+    double	d1;
+    double	d2;
+    double	frac;
+    double	x;
+    double	y;
+
+    d1 = nx * w->x1 + ny * w->y1 - dist + PVSEPSILON;
+    d2 = nx * w->x2 + ny * w->y2 - dist + PVSEPSILON;
+
+    if (d1 < 0 && d2 < 0)
+	return false;
+    if (d1 >= 0 && d2 >= 0)
+	return true;
+
+    frac = d1 / (d1 - d2);
+    x = w->x1 + frac * (w->x2 - w->x1);
+    y = w->y1 + frac * (w->y2 - w->y1);
+
+    if (d1 < 0)
+    {
+	w->x1 = x;
+	w->y1 = y;
+    }
+    else
+    {
+	w->x2 = x;
+	w->y2 = y;
+    }
+
+    return true;
+}
+
+
+//
+// P_ClipToSeparators
+// Every line of sight through source and pass lies
+//  between the two lines that cross from an end of
+//  one to an end of the other.
+//
+static bool
+P_ClipToSeparators
+( pvswinding_t*	source,
+  pvswinding_t*	pass,
+  pvswinding_t*	w )
+{
+    double	sx[2], sy[2];
+    double	px[2], py[2];
+    double	nx, ny, len, dist;
+    double	ds, dp;
+    int		i, j;
+
+    sx[0] = source->x1; sy[0] = source->y1;
+    sx[1] = source->x2; sy[1] = source->y2;
+    px[0] = pass->x1; py[0] = pass->y1;
+    px[1] = pass->x2; py[1] = pass->y2;
+
+    for (i = 0 ; i < 2 ; i++)
+    {
+	for (j = 0 ; j < 2 ; j++)
+	{
+	    nx = sy[i] - py[j];
+	    ny = px[j] - sx[i];
+	    len = sqrt (nx * nx + ny * ny);
+	    if (len < PVSEPSILON)
+		continue;
+
+	    nx /= len;
+	    ny /= len;
+	    dist = nx * sx[i] + ny * sy[i];
+
+	    // only separates if the other ends
+	    //  are on either side of it
+	    ds = nx * sx[i ^ 1] + ny * sy[i ^ 1] - dist;
+	    dp = nx * px[j ^ 1] + ny * py[j ^ 1] - dist;
+
+	    if (ds < -PVSEPSILON && dp > PVSEPSILON)
+	    {
+		if (!P_ClipWinding (w, nx, ny, dist))
+		    return false;
+	    }
+	    else if (ds > PVSEPSILON && dp < -PVSEPSILON)
+	    {
+		if (!P_ClipWinding (w, -nx, -ny, -dist))
+		    return false;
+	    }
+	}
+    }
+
+    return true;
+}
+
+
+//
+// P_FloodPortal
+// Marks the sector beyond pass, and whatever can be
+//  seen through it from source.
+//
+static void
+P_FloodPortal
+( int		s1,
+  portal_t*	source,
+  portal_t*	pass,
+  pvswinding_t*	passwinding,
+  int		depth )
+{
+    portal_t*	p;
+    portal_t*	end;
+    pvswinding_t	w;
+    byte*	might;
+    byte*	flood;
+    bool	more;
+    int		pnum;
+    int		i;
+
+    pnum = pass - portals;
+
+    P_SetPVSBit (s1, pass->sector);
+    portalseen[pnum >> 3] |= 1 << (pnum & 7);
+
+    if (leaky[pass->sector] || ++pvswork > MAXPVSWORK)
+    {
+	pvsfull = true;
+	return;
+    }
+
+    if (!mightstack[depth])
+	mightstack[depth] = Z_Malloc (portalbytes, PU_STATIC, NULL);
+
+    // stop once everything this path might
+    //  lead to has been reached some other way
+    might = mightstack[depth];
+    flood = portalflood + pnum * portalbytes;
+    more = false;
+
+    for (i = 0 ; i < portalbytes ; i++)
+    {
+	might[i] = depth ? mightstack[depth - 1][i] & flood[i] : flood[i];
+	if (might[i] & ~portalseen[i])
+	    more = true;
+    }
+
+    if (!more)
+	return;
+
+    end = portals + sectorportals[pass->sector + 1];
+
+    for (p = portals + sectorportals[pass->sector] ; p < end ; p++)
+    {
+	if (!PORTALBIT (might, p - portals) || onpath[p->line])
+	    continue;
+
+	w = p->winding;
+
+	if (!P_ClipWinding (&w, pass->nx, pass->ny, pass->dist)
+	 || !P_ClipWinding (&w, source->nx, source->ny, source->dist))
+	    continue;
+
+	if (pass != source
+	 && !P_ClipToSeparators (&source->winding, passwinding, &w))
+	    continue;
+
+	onpath[p->line] = 1;
+	P_FloodPortal (s1, source, p, &w, depth + 1);
+	onpath[p->line] = 0;
+
+	if (pvsfull)
+	    return;
+    }
+}
+
+
+//
+// P_FloodSector
+// Everything the lines of a sector lead to, for the
+//  sectors that are too costly or can't be trusted.
+//
+static void P_FloodSector (int s1, int sector)
+{
+    int		i;
+
+    for (i = sectorportals[sector] ; i < sectorportals[sector + 1] ; i++)
+    {
+	if (P_PVSBit (s1, portals[i].sector))
+	    continue;
+
+	P_SetPVSBit (s1, portals[i].sector);
+	P_FloodSector (s1, portals[i].sector);
+    }
+}
+
+
+static void P_AddPortal (portal_t* p, line_t* line, int sector, int side)
+{
+    double	len;
+
+    p->line = line - lines;
+    p->sector = sector;
+
+    p->winding.x1 = (double) line->v1->x / FRACUNIT;
+    p->winding.y1 = (double) line->v1->y / FRACUNIT;
+    p->winding.x2 = (double) line->v2->x / FRACUNIT;
+    p->winding.y2 = (double) line->v2->y / FRACUNIT;
+
+    // the back of a line is to the left of v1 to v2
+    p->nx = p->winding.y1 - p->winding.y2;
+    p->ny = p->winding.x2 - p->winding.x1;
+    len = sqrt (p->nx * p->nx + p->ny * p->ny);
+    if (len > 0)
+    {
+	p->nx /= len;
+	p->ny /= len;
+    }
+    if (side)
+    {
+	p->nx = -p->nx;
+	p->ny = -p->ny;
+    }
+    p->dist = p->nx * p->winding.x1 + p->ny * p->winding.y1;
+}
+
+
+//
+// P_BuildPortals
+// Two portals for every line that sight can cross,
+//  grouped by the sector they are seen from.
+//
+static void P_BuildPortals (void)
+{
+    line_t*	line;
+    int*	fill;
+    int		i;
+
+    sectorportals = Z_Malloc ((numsectors + 1) * sizeof(*sectorportals),
+			      PU_STATIC, NULL);
+    memset (sectorportals, 0, (numsectors + 1) * sizeof(*sectorportals));
+
+    for (i = 0, line = lines ; i < numlines ; i++, line++)
+    {
+	if (!(line->flags & ML_TWOSIDED) || !line->backsector)
+	    continue;
+	sectorportals[line->frontsector - sectors + 1]++;
+	sectorportals[line->backsector - sectors + 1]++;
+    }
+
+    for (i = 0 ; i < numsectors ; i++)
+	sectorportals[i + 1] += sectorportals[i];
+
+    numportals = sectorportals[numsectors];
+    portals = Z_Malloc ((numportals + 1) * sizeof(*portals),
+			PU_STATIC, NULL);
+    fill = Z_Malloc (numsectors * sizeof(*fill), PU_STATIC, NULL);
+    memcpy (fill, sectorportals, numsectors * sizeof(*fill));
+
+    for (i = 0, line = lines ; i < numlines ; i++, line++)
+    {
+	if (!(line->flags & ML_TWOSIDED) || !line->backsector)
+	    continue;
+	P_AddPortal (&portals[fill[line->frontsector - sectors]++],
+		     line, line->backsector - sectors, 0);
+	P_AddPortal (&portals[fill[line->backsector - sectors]++],
+		     line, line->frontsector - sectors, 1);
+    }
+
+    Z_Free (fill);
+}
+
+
+//
+// P_PortalInFront
+// Whether a line of sight could cross q after p.
+//
+static bool P_PortalInFront (portal_t* p, portal_t* q)
+{
+    if (p->nx * q->winding.x1 + p->ny * q->winding.y1 - p->dist < -PVSEPSILON
+     && p->nx * q->winding.x2 + p->ny * q->winding.y2 - p->dist < -PVSEPSILON)
+	return false;
+
+    if (q->nx * p->winding.x1 + q->ny * p->winding.y1 - q->dist > PVSEPSILON
+     && q->nx * p->winding.x2 + q->ny * p->winding.y2 - q->dist > PVSEPSILON)
+	return false;
+
+    return true;
+}
+
+
+//
+// P_FloodPortals
+// The portals each portal leads to through
+//  portals in front of it, which is all the
+//  flood through it can ever reach.
+//
+static void P_FloodPortals (void)
+{
+    portal_t*	p;
+    portal_t*	q;
+    byte*	flood;
+    int*	stack;
+    int		sp;
+    int		i;
+    int		j;
+
+    portalbytes = (numportals + 7) / 8;
+    portalflood = Z_Malloc (numportals * portalbytes + 1, PU_STATIC, NULL);
+    memset (portalflood, 0, numportals * portalbytes);
+
+    stack = Z_Malloc ((numportals + 1) * sizeof(*stack), PU_STATIC, NULL);
+
+    for (i = 0, p = portals ; i < numportals ; i++, p++)
+    {
+	flood = portalflood + i * portalbytes;
+	stack[0] = i;
+	sp = 1;
+
+	while (sp)
+	{
+	    q = &portals[stack[--sp]];
+
+	    for (j = sectorportals[q->sector] ; j < sectorportals[q->sector + 1] ; j++)
+	    {
+		if (PORTALBIT (flood, j)
+		 || portals[j].line == p->line
+		 || !P_PortalInFront (p, &portals[j]))
+		    continue;
+
+		flood[j >> 3] |= 1 << (j & 7);
+		stack[sp++] = j;
+	    }
+	}
+    }
+
+    Z_Free (stack);
+}
+
+
+//
+// P_FindLeaks
+// Sight only stops at lines, so the sets are only
+//  right for sectors that lines close off. Those
+//  that are open somewhere, or that share a
+//  subsector with another, see everything.
+//
+static void P_FindLeaks (void)
+{
+    int*	ends;
+    sector_t*	sector;
+    line_t*	line;
+    seg_t*	seg;
+    int		i;
+    int		j;
+
+    leaky = Z_Malloc (numsectors * sizeof(*leaky), PU_STATIC, NULL);
+    memset (leaky, 0, numsectors * sizeof(*leaky));
+
+    ends = Z_Malloc (numvertexes * sizeof(*ends), PU_STATIC, NULL);
+    memset (ends, 0, numvertexes * sizeof(*ends));
+
+    for (i = 0, sector = sectors ; i < numsectors ; i++, sector++)
+    {
+	for (j = 0 ; j < sector->linecount ; j++)
+	{
+	    line = sector->lines[j];
+	    if (line->frontsector == line->backsector)
+		continue;
+	    ends[line->v1 - vertexes] ^= 1;
+	    ends[line->v2 - vertexes] ^= 1;
+	}
+
+	// every corner needs an even number of lines,
+	//  clearing them for the next sector
+	for (j = 0 ; j < sector->linecount ; j++)
+	{
+	    line = sector->lines[j];
+	    if (ends[line->v1 - vertexes] || ends[line->v2 - vertexes])
+		leaky[i] = true;
+	    ends[line->v1 - vertexes] = 0;
+	    ends[line->v2 - vertexes] = 0;
+	}
+    }
+
+    Z_Free (ends);
+
+    for (i = 0 ; i < numsubsectors ; i++)
+    {
+	seg = &segs[subsectors[i].firstline];
+	for (j = 0 ; j < subsectors[i].numlines ; j++, seg++)
+	{
+	    if (seg->frontsector != subsectors[i].sector)
+	    {
+		leaky[seg->frontsector - sectors] = true;
+		leaky[subsectors[i].sector - sectors] = true;
+	    }
+	}
+    }
+}
+
+
+//
+// P_BuildPVS
+//
+static void P_BuildPVS (int length)
+{
+    portal_t*	p;
+    int		s1;
+    int		s2;
+    int		i;
+
+    pvs = Z_Malloc (length, PU_STATIC, NULL);
+    memset (pvs, 0, length);
+
+    P_BuildPortals ();
+    P_FindLeaks ();
+
+    // too big to track which portals were
+    //  reached, so only the fallback is left
+    portalflood = NULL;
+    if (numportals <= MAXPORTALS)
+	P_FloodPortals ();
+
+    portalseen = Z_Malloc (portalbytes + 1, PU_STATIC, NULL);
+    mightstack = Z_Malloc ((numlines + 1) * sizeof(*mightstack),
+			   PU_STATIC, NULL);
+    memset (mightstack, 0, (numlines + 1) * sizeof(*mightstack));
+    onpath = Z_Malloc (numlines, PU_STATIC, NULL);
+    memset (onpath, 0, numlines);
+
+    for (s1 = 0 ; s1 < numsectors ; s1++)
+    {
+	P_SetPVSBit (s1, s1);
+
+	pvswork = 0;
+	pvsfull = leaky[s1] || !portalflood;
+	memset (portalseen, 0, portalbytes);
+
+	for (i = sectorportals[s1] ; i < sectorportals[s1 + 1] && !pvsfull ; i++)
+	{
+	    p = &portals[i];
+	    onpath[p->line] = 1;
+	    P_FloodPortal (s1, p, p, &p->winding, 0);
+	    onpath[p->line] = 0;
+	}
+
+	if (pvsfull)
+	{
+	    memset (onpath, 0, numlines);
+	    P_ClearPVSRow (s1);
+	    P_SetPVSBit (s1, s1);
+
+	    if (leaky[s1])
+	    {
+		for (s2 = 0 ; s2 < numsectors ; s2++)
+		    P_SetPVSBit (s1, s2);
+	    }
+	    else
+	    {
+		P_FloodSector (s1, s1);
+	    }
+	}
+    }
+
+    // a leak anywhere along the way lets s1 see
+    //  everything, which the other side must agree with
+    for (s1 = 0 ; s1 < numsectors ; s1++)
+    {
+	for (s2 = 0 ; s2 < numsectors ; s2++)
+	{
+	    if (leaky[s2] && P_PVSBit (s1, s2))
+	    {
+		for (i = 0 ; i < numsectors ; i++)
+		    P_SetPVSBit (s1, i);
+		break;
+	    }
+	}
+    }
+
+    for (s1 = 0 ; s1 < numsectors ; s1++)
+    {
+	for (s2 = s1 + 1 ; s2 < numsectors ; s2++)
+	{
+	    if (P_PVSBit (s1, s2) || P_PVSBit (s2, s1))
+	    {
+		P_SetPVSBit (s1, s2);
+		P_SetPVSBit (s2, s1);
+	    }
+	}
+    }
+
+    for (i = 0 ; i <= numlines ; i++)
+    {
+	if (mightstack[i])
+	    Z_Free (mightstack[i]);
+    }
+
+    Z_Free (onpath);
+    Z_Free (mightstack);
+    Z_Free (portalseen);
+    if (portalflood)
+	Z_Free (portalflood);
+    Z_Free (leaky);
+    Z_Free (portals);
+    Z_Free (sectorportals);
+}
+
+
+//
+// P_MapKey
+// A hash of the lumps that the sets are built from.
+//
+static uint64_t P_MapKey (int lumpnum)
+{
+    static const int	maplumps[] =
+    {
+	ML_VERTEXES, ML_LINEDEFS, ML_SIDEDEFS, ML_SECTORS,
+	ML_SEGS, ML_SSECTORS
+    };
+    uint64_t		key;
+    int			i;
+
+    key = 0;
+
+    for (i = 0 ; i < arrlen(maplumps) ; i++)
+	key = W_LumpHash (lumpnum + maplumps[i], key);
+
+    return key;
+}
+
+
+//
+// P_PVSFileName
+// Next to the WAD the map was loaded from.
+//
+static char* P_PVSFileName (int lumpnum)
+{
+    char	name[9];
+
+    M_StringCopy (name, lumpinfo[lumpnum].name, sizeof(name));
+    M_ForceUppercase (name);
+
+    return M_StringJoin (lumpinfo[lumpnum].wad_file->path, ".", name,
+			 ".pvs", NULL);
+}
+
+
+//
+// P_ReadPVS
+// Returns false if the file is missing or stale.
+//
+static bool
+P_ReadPVS
+( char*		filename,
+  uint64_t	mapkey,
+  int		length )
+{
+    pvsheader_t	header;
+    FILE*	file;
+    bool	read;
+
+    file = fopen (filename, "rb");
+    if (file == NULL)
+	return false;
+
+    read = fread (&header, sizeof(header), 1, file) == 1
+	&& !memcmp (header.magic, PVSMAGIC, sizeof(header.magic))
+	&& header.mapkey == mapkey
+	&& header.numsectors == (unsigned int) numsectors;
+
+    if (read)
+    {
+	pvs = Z_Malloc (length, PU_STATIC, NULL);
+	read = fread (pvs, 1, length, file) == (size_t) length;
+	if (!read)
+	    Z_Free (pvs);
+    }
+
+    fclose (file);
+
+    return read;
+}
+
+
+//
+// P_WritePVS
+// Written next to the file and renamed over it,
+//  like R_WriteSharedCache.
+//
+static void
+P_WritePVS
+( char*		filename,
+  uint64_t	mapkey,
+  int		length )
+{
+    pvsheader_t	header;
+    char*	temp;
+    FILE*	file;
+    bool	written;
+
+    memset (&header, 0, sizeof(header));
+    memcpy (header.magic, PVSMAGIC, sizeof(header.magic));
+    header.mapkey = mapkey;
+    header.numsectors = numsectors;
+
+    temp = M_StringJoin (filename, ".tmp", NULL);
+
+    file = fopen (temp, "wb");
+    written = file != NULL
+	   && fwrite (&header, sizeof(header), 1, file) == 1
+	   && fwrite (pvs, 1, length, file) == (size_t) length;
+    if (file != NULL && fclose (file) != 0)
+	written = false;
+
+    if (!written || rename (temp, filename) != 0)
+    {
+	printf ("P_WritePVS: failed to write %s\n", filename);
+	remove (temp);
+    }
+
+    free (temp);
+}
+
+
+//
+// P_InitPVS
+//
+void P_InitPVS (void)
+{
+    //!
+    // Work out which sectors can never see each other when a
+    // level is loaded, to skip their sight checks. The
+    // result is kept in a file next to the WAD. Not used
+    // while a demo is recorded or played, or in netgames.
+    //
+
+    sightpvs = M_CheckParm ("-sightpvs") > 0;
+}
+
+
+//
+// P_LoadPVS
+// Adds the sectors that can't see each other
+//  to rejectmatrix. The PVS is traced with exact math,
+//  and P_CheckSight with the fixed point of vanilla, so
+//  it can reject a sight line vanilla lets through. Demos
+//  and netgames keep to the REJECT lump for sync.
+//
+void P_LoadPVS (int lumpnum)
+{
+    uint64_t		mapkey;
+    char*		filename;
+    byte*		reject;
+    int			length;
+    int			i;
+
+    if (!sightpvs || demorecording || demoplayback || netgame)
+	return;
+
+    length = (numsectors * numsectors + 7) / 8;
+
+    mapkey = P_MapKey (lumpnum);
+    filename = P_PVSFileName (lumpnum);
+
+    if (!P_ReadPVS (filename, mapkey, length))
+    {
+	P_BuildPVS (length);
+	P_WritePVS (filename, mapkey, length);
+    }
+
+    free (filename);
+
+    // rejectmatrix may be the lump itself
+    reject = Z_LevelMalloc (length);
+    for (i = 0 ; i < length ; i++)
+	reject[i] = rejectmatrix[i] | ~pvs[i];
+    rejectmatrix = reject;
+
+    Z_Free (pvs);
+    pvs = NULL;
+}
@@ -36,10 +36,18 @@
 #define SAVEGAME_EOF 0x1d
 #define VERSIONSIZE 16 
 
-FILE *save_stream;
-int savegamelength;
+// The game is archived into, and unarchived from, this buffer.
+// Files are read and written in one go, so the fields can be
+// stored without a call per byte.
+
+byte *save_buffer;
+byte *save_p;
+byte *save_end;
 bool savegame_error;
 
+static byte *save_start;
+static int save_size;
+
 // Get the filename of a temporary file to write the savegame to.  After
 // the file has been successfully saved, it will be renamed to the 
 // real file.
@@ -76,13 +84,61 @@ char *P_SaveGameFile(int slot)
     return filename;
 }
 
+//
+// P_StartSaveBuffer
+// Rewinds the buffer to archive a game into it.
+//
+
+void P_StartSaveBuffer(void)
+{
+    if (save_buffer == NULL)
+    {
+        save_size = 0x10000;
+        save_buffer = malloc(save_size);
+        if (save_buffer == NULL)
+            I_Error("P_StartSaveBuffer: out of memory");
+    }
+
+    save_start = save_p = save_buffer;
+    save_end = save_buffer + save_size;
+    savegame_error = false;
+}
+
+//
+// P_ReadSaveBuffer
+// Points the unarchiving functions at a game archived
+// in length bytes at buffer.
+//
+
+void P_ReadSaveBuffer(byte *buffer, int length)
+{
+    save_start = save_p = buffer;
+    save_end = buffer + length;
+    savegame_error = false;
+}
+
+// Doubles the buffer when the game doesn't fit in it.
+
+static void P_GrowSaveBuffer(void)
+{
+    int pos;
+
+    pos = save_p - save_buffer;
+    save_size *= 2;
+    save_buffer = realloc(save_buffer, save_size);
+    if (save_buffer == NULL)
+        I_Error("P_GrowSaveBuffer: out of memory");
+
+    save_start = save_buffer;
+    save_p = save_buffer + pos;
+    save_end = save_buffer + save_size;
+}
+
 // Endian-safe integer read/write functions
 
 static byte saveg_read8(void)
 {
-    byte result;
-
-    if (fread(&result, 1, 1, save_stream) < 1)
+    if (save_p >= save_end)
     {
         if (!savegame_error)
         {
@@ -91,71 +147,89 @@ static byte saveg_read8(void)
 
             savegame_error = true;
         }
+
+        return 0;
     }
 
-    return result;
+    return *save_p++;
 }
 
 static void saveg_write8(byte value)
 {
-    if (fwrite(&value, 1, 1, save_stream) < 1)
-    {
-        if (!savegame_error)
-        {
-            fprintf(stderr, "saveg_write8: Error while writing save game\n");
+    if (save_p >= save_end)
+        P_GrowSaveBuffer();
 
-            savegame_error = true;
-        }
-    }
+    *save_p++ = value;
 }
 
 static short saveg_read16(void)
 {
     int result;
 
-    result = saveg_read8();
-    result |= saveg_read8() << 8;
+    if (save_end - save_p < 2)
+    {
+        result = saveg_read8();
+        result |= saveg_read8() << 8;
+        return result;
+    }
+
+    result = save_p[0] | (save_p[1] << 8);
+    save_p += 2;
 
     return result;
 }
 
 static void saveg_write16(short value)
 {
-    saveg_write8(value & 0xff);
-    saveg_write8((value >> 8) & 0xff);
+    if (save_end - save_p < 2)
+        P_GrowSaveBuffer();
+
+    save_p[0] = value & 0xff;
+    save_p[1] = (value >> 8) & 0xff;
+    save_p += 2;
 }
 
 static int saveg_read32(void)
 {
     int result;
 
-    result = saveg_read8();
-    result |= saveg_read8() << 8;
-    result |= saveg_read8() << 16;
-    result |= saveg_read8() << 24;
+    if (save_end - save_p < 4)
+    {
+        result = saveg_read8();
+        result |= saveg_read8() << 8;
+        result |= saveg_read8() << 16;
+        result |= saveg_read8() << 24;
+        return result;
+    }
+
+    result = save_p[0] | (save_p[1] << 8)
+           | (save_p[2] << 16) | ((unsigned int) save_p[3] << 24);
+    save_p += 4;
 
     return result;
 }
 
 static void saveg_write32(int value)
 {
-    saveg_write8(value & 0xff);
-    saveg_write8((value >> 8) & 0xff);
-    saveg_write8((value >> 16) & 0xff);
-    saveg_write8((value >> 24) & 0xff);
+    if (save_end - save_p < 4)
+        P_GrowSaveBuffer();
+
+    save_p[0] = value & 0xff;
+    save_p[1] = (value >> 8) & 0xff;
+    save_p[2] = (value >> 16) & 0xff;
+    save_p[3] = (value >> 24) & 0xff;
+    save_p += 4;
 }
 
-// Pad to 4-byte boundaries
+// Pad to 4-byte boundaries. The buffers hold whole files,
+// so their offsets are the file's.
 
 static void saveg_read_pad(void)
 {
-    unsigned long pos;
     int padding;
     int i;
 
-    pos = ftell(save_stream);
-
-    padding = (4 - (pos & 3)) & 3;
+    padding = (4 - ((save_p - save_start) & 3)) & 3;
 
     for (i=0; i<padding; ++i)
     {
@@ -165,13 +239,10 @@ static void saveg_read_pad(void)
 
 static void saveg_write_pad(void)
 {
-    unsigned long pos;
     int padding;
     int i;
 
-    pos = ftell(save_stream);
-
-    padding = (4 - (pos & 3)) & 3;
+    padding = (4 - ((save_p - save_start) & 3)) & 3;
 
     for (i=0; i<padding; ++i)
     {
@@ -487,7 +558,8 @@ static void saveg_write_mobj_t(mobj_t *str)
     saveg_writep(str->info);
 
     // int tics;
-    saveg_write32(str->tics);
+    // counted down, if it sleeps
+    saveg_write32(P_MobjTics(str));
 
     // state_t* state;
     saveg_write32(str->state - states);
@@ -1633,7 +1705,7 @@ void P_UnArchiveThinkers (void)
 	if (currentthinker->function.acp1 == (actionf_p1)P_MobjThinker)
 	    P_RemoveMobj ((mobj_t *)currentthinker);
 	else
-	    Z_Free (currentthinker);
+	    Z_PoolFree (currentthinker);
 
 	currentthinker = next;
     }
@@ -1650,17 +1722,19 @@ void P_UnArchiveThinkers (void)
 			
 	  case tc_mobj:
 	    saveg_read_pad();
-	    mobj = Z_Malloc (sizeof(*mobj), PU_LEVEL, NULL);
+	    mobj = Z_PoolMalloc (sizeof(*mobj));
             saveg_read_mobj_t(mobj);
 
 	    mobj->target = NULL;
             mobj->tracer = NULL;
+	    mobj->touching = NULL;
 	    P_SetThingPosition (mobj);
 	    mobj->info = &mobjinfo[mobj->type];
 	    mobj->floorz = mobj->subsector->sector->floorheight;
 	    mobj->ceilingz = mobj->subsector->sector->ceilingheight;
 	    mobj->thinker.function.acp1 = (actionf_p1)P_MobjThinker;
 	    P_AddThinker (&mobj->thinker);
+	    P_ResetOldPosition (mobj);
 	    break;
 
 	  default:
@@ -1690,6 +1764,37 @@ enum
 
 
 
+//
+// P_ArchiveLight
+// One light of a batch, as it would have been
+//  written from the thinker list.
+//
+static void P_ArchiveLight (thinker_t* th)
+{
+    if (th->function.acp1 == (actionf_p1)T_LightFlash)
+    {
+        saveg_write8(tc_flash);
+        saveg_write_pad();
+        saveg_write_lightflash_t((lightflash_t *) th);
+    }
+    else if (th->function.acp1 == (actionf_p1)T_StrobeFlash)
+    {
+        saveg_write8(tc_strobe);
+        saveg_write_pad();
+        saveg_write_strobe_t((strobe_t *) th);
+    }
+    else if (th->function.acp1 == (actionf_p1)T_Glow)
+    {
+        saveg_write8(tc_glow);
+        saveg_write_pad();
+        saveg_write_glow_t((glow_t *) th);
+    }
+
+    // Fire flickers aren't saved, as in vanilla.
+}
+
+
+
 //
 // Things to handle:
 //
@@ -1704,6 +1809,7 @@ enum
 void P_ArchiveSpecials (void)
 {
     thinker_t*		th;
+    lightbatch_t*	batch;
     int			i;
 	
     // save off the current thinkers
@@ -1711,11 +1817,7 @@ void P_ArchiveSpecials (void)
     {
 	if (th->function.acv == (actionf_v)NULL)
 	{
-	    for (i = 0; i < MAXCEILINGS;i++)
-		if (activeceilings[i] == (ceiling_t *)th)
-		    break;
-	    
-	    if (i<MAXCEILINGS)
+	    if (P_IsActiveCeiling(th))
 	    {
                 saveg_write8(tc_ceiling);
 		saveg_write_pad();
@@ -1756,27 +1858,11 @@ void P_ArchiveSpecials (void)
 	    continue;
 	}
 			
-	if (th->function.acp1 == (actionf_p1)T_LightFlash)
-	{
-            saveg_write8(tc_flash);
-	    saveg_write_pad();
-            saveg_write_lightflash_t((lightflash_t *) th);
-	    continue;
-	}
-			
-	if (th->function.acp1 == (actionf_p1)T_StrobeFlash)
-	{
-            saveg_write8(tc_strobe);
-	    saveg_write_pad();
-            saveg_write_strobe_t((strobe_t *) th);
-	    continue;
-	}
-			
-	if (th->function.acp1 == (actionf_p1)T_Glow)
+	if (th->function.acp1 == (actionf_p1)T_RunLights)
 	{
-            saveg_write8(tc_glow);
-	    saveg_write_pad();
-            saveg_write_glow_t((glow_t *) th);
+	    batch = (lightbatch_t *) th;
+	    for (i = 0; i < batch->numlights; i++)
+		P_ArchiveLight(batch->lights[i]);
 	    continue;
 	}
     }
@@ -1814,7 +1900,7 @@ void P_UnArchiveSpecials (void)
 			
 	  case tc_ceiling:
 	    saveg_read_pad();
-	    ceiling = Z_Malloc (sizeof(*ceiling), PU_LEVEL, NULL);
+	    ceiling = Z_PoolMalloc (sizeof(*ceiling));
             saveg_read_ceiling_t(ceiling);
 	    ceiling->sector->specialdata = ceiling;
 
@@ -1827,7 +1913,7 @@ void P_UnArchiveSpecials (void)
 				
 	  case tc_door:
 	    saveg_read_pad();
-	    door = Z_Malloc (sizeof(*door), PU_LEVEL, NULL);
+	    door = Z_PoolMalloc (sizeof(*door));
             saveg_read_vldoor_t(door);
 	    door->sector->specialdata = door;
 	    door->thinker.function.acp1 = (actionf_p1)T_VerticalDoor;
@@ -1836,7 +1922,7 @@ void P_UnArchiveSpecials (void)
 				
 	  case tc_floor:
 	    saveg_read_pad();
-	    floor = Z_Malloc (sizeof(*floor), PU_LEVEL, NULL);
+	    floor = Z_PoolMalloc (sizeof(*floor));
             saveg_read_floormove_t(floor);
 	    floor->sector->specialdata = floor;
 	    floor->thinker.function.acp1 = (actionf_p1)T_MoveFloor;
@@ -1845,7 +1931,7 @@ void P_UnArchiveSpecials (void)
 				
 	  case tc_plat:
 	    saveg_read_pad();
-	    plat = Z_Malloc (sizeof(*plat), PU_LEVEL, NULL);
+	    plat = Z_PoolMalloc (sizeof(*plat));
             saveg_read_plat_t(plat);
 	    plat->sector->specialdata = plat;
 
@@ -1858,26 +1944,26 @@ void P_UnArchiveSpecials (void)
 				
 	  case tc_flash:
 	    saveg_read_pad();
-	    flash = Z_Malloc (sizeof(*flash), PU_LEVEL, NULL);
+	    flash = Z_PoolMalloc (sizeof(*flash));
             saveg_read_lightflash_t(flash);
 	    flash->thinker.function.acp1 = (actionf_p1)T_LightFlash;
-	    P_AddThinker (&flash->thinker);
+	    P_AddLight (&flash->thinker);
 	    break;
 				
 	  case tc_strobe:
 	    saveg_read_pad();
-	    strobe = Z_Malloc (sizeof(*strobe), PU_LEVEL, NULL);
+	    strobe = Z_PoolMalloc (sizeof(*strobe));
             saveg_read_strobe_t(strobe);
 	    strobe->thinker.function.acp1 = (actionf_p1)T_StrobeFlash;
-	    P_AddThinker (&strobe->thinker);
+	    P_AddLight (&strobe->thinker);
 	    break;
 				
 	  case tc_glow:
 	    saveg_read_pad();
-	    glow = Z_Malloc (sizeof(*glow), PU_LEVEL, NULL);
+	    glow = Z_PoolMalloc (sizeof(*glow));
             saveg_read_glow_t(glow);
 	    glow->thinker.function.acp1 = (actionf_p1)T_Glow;
-	    P_AddThinker (&glow->thinker);
+	    P_AddLight (&glow->thinker);
 	    break;
 				
 	  default:
@@ -1889,3 +1975,510 @@ void P_UnArchiveSpecials (void)
 
 }
 
+
+
+//
+// SYNC
+// What a savegame leaves out that a demo needs, to play on
+//  from an archived game just as it did the first time: the
+//  links between things, the order of the thinkers and of the
+//  things in the blockmap, the fire flickers, the plats in
+//  stasis, the switches, the queues and the random numbers.
+//  Appended to the archive by -seekindex.
+//
+enum
+{
+    ts_end,
+    ts_mobj,
+    ts_special,
+    ts_stasisplat,
+    ts_lights,
+    ts_light,
+    ts_flicker
+
+} syncclass_e;
+
+extern int	rndindex;
+extern int	prndindex;
+
+typedef struct
+{
+    mobj_t*	mobj;
+    int		number;
+} mobjnumber_t;
+
+// The things in thinker order, and by address to number them
+static mobj_t**		syncmobjs;
+static mobjnumber_t*	syncnumbers;
+static unsigned*	syncstamps;
+static int		numsyncmobjs;
+static int		maxsyncmobjs;
+
+
+static int P_CompareMobjNumbers (const void* a, const void* b)
+{
+    uintptr_t	x = (uintptr_t) ((const mobjnumber_t *) a)->mobj;
+    uintptr_t	y = (uintptr_t) ((const mobjnumber_t *) b)->mobj;
+
+    return x < y ? -1 : x > y;
+}
+
+//
+// P_NumberMobjs
+// Numbers the things in thinker order from 1, as they are
+//  archived, with 0 for none.
+//
+static void P_NumberMobjs (void)
+{
+    thinker_t*	th;
+    int		count;
+
+    count = 0;
+    for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+	if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+	    count++;
+
+    if (count > maxsyncmobjs)
+    {
+	maxsyncmobjs = count + count / 4;
+	syncmobjs = realloc(syncmobjs, maxsyncmobjs * sizeof(*syncmobjs));
+	syncnumbers = realloc(syncnumbers, maxsyncmobjs * sizeof(*syncnumbers));
+	syncstamps = realloc(syncstamps, maxsyncmobjs * sizeof(*syncstamps));
+	if (!syncmobjs || !syncnumbers || !syncstamps)
+	    I_Error ("P_NumberMobjs: out of memory");
+    }
+
+    numsyncmobjs = 0;
+    for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+    {
+	if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+	    continue;
+
+	syncmobjs[numsyncmobjs] = (mobj_t *) th;
+	syncnumbers[numsyncmobjs].mobj = (mobj_t *) th;
+	syncnumbers[numsyncmobjs].number = numsyncmobjs + 1;
+	numsyncmobjs++;
+    }
+
+    qsort(syncnumbers, numsyncmobjs, sizeof(*syncnumbers),
+	  P_CompareMobjNumbers);
+}
+
+// Links to things removed but not yet freed are lost.
+
+static void saveg_write_mobjnum(mobj_t* mobj)
+{
+    mobjnumber_t	key;
+    mobjnumber_t*	found;
+
+    found = NULL;
+    if (mobj != NULL)
+    {
+	key.mobj = mobj;
+	found = bsearch(&key, syncnumbers, numsyncmobjs,
+			sizeof(*syncnumbers), P_CompareMobjNumbers);
+    }
+
+    saveg_write32(found ? found->number : 0);
+}
+
+static mobj_t* saveg_read_mobjnum(void)
+{
+    int	number;
+
+    number = saveg_read32();
+
+    if (number < 0 || number > numsyncmobjs)
+	I_Error ("P_UnArchiveSync: thing %i of %i", number, numsyncmobjs);
+
+    return number ? syncmobjs[number-1] : NULL;
+}
+
+static bool P_IsStasisPlat (thinker_t* th)
+{
+    plat_t*	plat;
+    int		i;
+
+    for (i = 0;i < TAGHASHSIZE;i++)
+	for (plat = activeplats[i];plat;plat = plat->tagnext)
+	    if (&plat->thinker == th)
+		return true;
+
+    return false;
+}
+
+
+//
+// P_ArchiveSync
+//
+void P_ArchiveSync (void)
+{
+    thinker_t*		th;
+    mobj_t*		mo;
+    lightbatch_t*	batch;
+    fireflicker_t*	flick;
+    int			count;
+    int			i;
+
+    saveg_write32(rndindex);
+    saveg_write32(prndindex);
+
+    P_NumberMobjs();
+    saveg_write32(numsyncmobjs);
+
+    for (i=0 ; i<numsyncmobjs ; i++)
+    {
+	mo = syncmobjs[i];
+	saveg_write_mobjnum(mo->target);
+	saveg_write_mobjnum(mo->tracer);
+	saveg_write32(mo->floorz);
+	saveg_write32(mo->ceilingz);
+	saveg_write32(mo->linkstamp);
+    }
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+	if (playeringame[i])
+	    saveg_write_mobjnum(players[i].attacker);
+
+    for (i=0 ; i<numsectors ; i++)
+	saveg_write_mobjnum(sectors[i].soundtarget);
+
+    saveg_write32(bodyqueslot);
+    for (i=0 ; i<bodyqueslot && i<BODYQUESIZE ; i++)
+	saveg_write_mobjnum(bodyque[i]);
+
+    saveg_write32(numbraintargets);
+    saveg_write32(braintargeton);
+    for (i=0 ; i<numbraintargets ; i++)
+	saveg_write_mobjnum(braintargets[i]);
+
+    saveg_write32(iquehead);
+    saveg_write32(iquetail);
+    for (i=0 ; i<ITEMQUESIZE ; i++)
+    {
+	saveg_write16(itemrespawnque[i].x);
+	saveg_write16(itemrespawnque[i].y);
+	saveg_write16(itemrespawnque[i].angle);
+	saveg_write16(itemrespawnque[i].type);
+	saveg_write16(itemrespawnque[i].options);
+	saveg_write32(itemrespawntime[i]);
+    }
+
+    count = 0;
+    for (i=0 ; i<numbuttons ; i++)
+	if (buttonlist[i].btimer)
+	    count++;
+
+    saveg_write32(count);
+    for (i=0 ; i<numbuttons ; i++)
+    {
+	if (!buttonlist[i].btimer)
+	    continue;
+
+	saveg_write32(buttonlist[i].line - lines);
+	saveg_write32(buttonlist[i].where);
+	saveg_write32(buttonlist[i].btexture);
+	saveg_write32(buttonlist[i].btimer);
+    }
+
+    // the thinkers in the order they run, by what the
+    //  savegame has of them
+    for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+    {
+	if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+	{
+	    saveg_write8(ts_mobj);
+	}
+	else if (th->function.acp1 == (actionf_p1)T_RunLights)
+	{
+	    batch = (lightbatch_t *) th;
+	    saveg_write8(ts_lights);
+	    saveg_write32(batch->numlights);
+
+	    for (i = 0; i < batch->numlights; i++)
+	    {
+		if (batch->lights[i]->function.acp1 != (actionf_p1)T_FireFlicker)
+		{
+		    saveg_write8(ts_light);
+		    continue;
+		}
+
+		flick = (fireflicker_t *) batch->lights[i];
+		saveg_write8(ts_flicker);
+		saveg_write32(flick->sector - sectors);
+		saveg_write32(flick->count);
+		saveg_write32(flick->maxlight);
+		saveg_write32(flick->minlight);
+	    }
+	}
+	else if (th->function.acv == (actionf_v)NULL)
+	{
+	    if (P_IsActiveCeiling(th))
+	    {
+		saveg_write8(ts_special);
+	    }
+	    else if (P_IsStasisPlat(th))
+	    {
+		saveg_write8(ts_stasisplat);
+		saveg_write_pad();
+		saveg_write_plat_t((plat_t *) th);
+	    }
+	}
+	else if (th->function.acp1 == (actionf_p1)T_MoveCeiling
+	      || th->function.acp1 == (actionf_p1)T_VerticalDoor
+	      || th->function.acp1 == (actionf_p1)T_MoveFloor
+	      || th->function.acp1 == (actionf_p1)T_PlatRaise)
+	{
+	    saveg_write8(ts_special);
+	}
+    }
+
+    saveg_write8(ts_end);
+}
+
+
+static int P_CompareSyncStamps (const void* a, const void* b)
+{
+    int		x = *(const int *) a;
+    int		y = *(const int *) b;
+
+    if (syncstamps[x] != syncstamps[y])
+	return syncstamps[x] < syncstamps[y] ? -1 : 1;
+
+    return x - y;
+}
+
+//
+// P_UnArchiveSync
+// After the savegame has been unarchived.
+//
+void P_UnArchiveSync (void)
+{
+    thinker_t*		th;
+    thinker_t**		specials;
+    thinker_t**		lights;
+    lightbatch_t**	batches;
+    lightbatch_t*	batch;
+    fireflicker_t*	flick;
+    plat_t*		plat;
+    int*		order;
+    int			numspecials;
+    int			numlights;
+    int			numbatches;
+    int			s;
+    int			l;
+    int			m;
+    int			count;
+    int			line;
+    int			where;
+    int			texture;
+    int			i;
+    int			j;
+
+    rndindex = saveg_read32();
+    prndindex = saveg_read32();
+
+    P_NumberMobjs();
+
+    if (saveg_read32() != numsyncmobjs)
+	I_Error ("P_UnArchiveSync: the things don't match the savegame");
+
+    for (i=0 ; i<numsyncmobjs ; i++)
+    {
+	syncmobjs[i]->target = saveg_read_mobjnum();
+	syncmobjs[i]->tracer = saveg_read_mobjnum();
+	syncmobjs[i]->floorz = saveg_read32();
+	syncmobjs[i]->ceilingz = saveg_read32();
+	syncstamps[i] = saveg_read32();
+    }
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+	if (playeringame[i])
+	    players[i].attacker = saveg_read_mobjnum();
+
+    for (i=0 ; i<numsectors ; i++)
+	sectors[i].soundtarget = saveg_read_mobjnum();
+
+    bodyqueslot = saveg_read32();
+    for (i=0 ; i<bodyqueslot && i<BODYQUESIZE ; i++)
+	bodyque[i] = saveg_read_mobjnum();
+
+    numbraintargets = saveg_read32();
+    braintargeton = saveg_read32();
+    if (numbraintargets < 0 || numbraintargets > 32)
+	I_Error ("P_UnArchiveSync: %i brain targets", numbraintargets);
+    for (i=0 ; i<numbraintargets ; i++)
+	braintargets[i] = saveg_read_mobjnum();
+
+    iquehead = saveg_read32() & (ITEMQUESIZE-1);
+    iquetail = saveg_read32() & (ITEMQUESIZE-1);
+    for (i=0 ; i<ITEMQUESIZE ; i++)
+    {
+	itemrespawnque[i].x = saveg_read16();
+	itemrespawnque[i].y = saveg_read16();
+	itemrespawnque[i].angle = saveg_read16();
+	itemrespawnque[i].type = saveg_read16();
+	itemrespawnque[i].options = saveg_read16();
+	itemrespawntime[i] = saveg_read32();
+    }
+
+    count = saveg_read32();
+    for (i=0 ; i<count && !savegame_error ; i++)
+    {
+	line = saveg_read32();
+	if (line < 0 || line >= numlines)
+	    I_Error ("P_UnArchiveSync: switch on line %i", line);
+	where = saveg_read32();
+	texture = saveg_read32();
+	P_StartButton(&lines[line], where, texture, saveg_read32());
+    }
+
+    // what the savegame put back, to be put in order
+    numspecials = numlights = numbatches = 0;
+    for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+    {
+	if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+	    continue;
+
+	if (th->function.acp1 == (actionf_p1)T_RunLights)
+	{
+	    numlights += ((lightbatch_t *) th)->numlights;
+	    numbatches++;
+	}
+	else
+	{
+	    numspecials++;
+	}
+    }
+
+    specials = malloc((numspecials + 1) * sizeof(*specials));
+    lights = malloc((numlights + 1) * sizeof(*lights));
+    batches = malloc((numbatches + 1) * sizeof(*batches));
+    order = malloc((numsyncmobjs + 1) * sizeof(*order));
+    if (!specials || !lights || !batches || !order)
+	I_Error ("P_UnArchiveSync: out of memory");
+
+    s = l = numbatches = 0;
+    for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+    {
+	if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+	    continue;
+
+	if (th->function.acp1 == (actionf_p1)T_RunLights)
+	{
+	    batch = (lightbatch_t *) th;
+	    for (i = 0; i < batch->numlights; i++)
+		lights[l++] = batch->lights[i];
+	    batches[numbatches++] = batch;
+	}
+	else
+	{
+	    specials[s++] = th;
+	}
+    }
+
+    P_InitThinkers ();
+    s = l = m = 0;
+
+    while (!savegame_error)
+    {
+	byte	tclass;
+
+	tclass = saveg_read8();
+
+	if (tclass == ts_end)
+	    break;
+
+	switch (tclass)
+	{
+	  case ts_mobj:
+	    if (m == numsyncmobjs)
+		I_Error ("P_UnArchiveSync: too many things");
+	    P_AddThinker (&syncmobjs[m++]->thinker);
+	    break;
+
+	  case ts_special:
+	    if (s == numspecials)
+		I_Error ("P_UnArchiveSync: too many specials");
+	    P_AddThinker (specials[s++]);
+	    break;
+
+	  case ts_stasisplat:
+	    saveg_read_pad();
+	    plat = Z_PoolMalloc (sizeof(*plat));
+	    saveg_read_plat_t(plat);
+	    plat->sector->specialdata = plat;
+	    plat->thinker.function.acv = (actionf_v)NULL;
+	    P_AddThinker (&plat->thinker);
+	    P_AddActivePlat(plat);
+	    break;
+
+	  case ts_lights:
+	    count = saveg_read32();
+	    if (count < 1)
+		I_Error ("P_UnArchiveSync: %i lights in a batch", count);
+
+	    batch = Z_PoolMalloc (sizeof(*batch));
+	    P_AddThinker (&batch->thinker);
+	    batch->thinker.function.acp1 = (actionf_p1) T_RunLights;
+	    batch->lights = Z_Malloc (count * sizeof(*batch->lights),
+				      PU_LEVEL, 0);
+	    batch->numlights = 0;
+	    batch->maxlights = count;
+
+	    for (i = 0; i < count && !savegame_error; i++)
+	    {
+		if (saveg_read8() == ts_light)
+		{
+		    if (l == numlights)
+			I_Error ("P_UnArchiveSync: too many lights");
+		    batch->lights[batch->numlights++] = lights[l++];
+		    continue;
+		}
+
+		flick = Z_PoolMalloc (sizeof(*flick));
+		j = saveg_read32();
+		if (j < 0 || j >= numsectors)
+		    I_Error ("P_UnArchiveSync: flicker in sector %i", j);
+		flick->sector = &sectors[j];
+		flick->count = saveg_read32();
+		flick->maxlight = saveg_read32();
+		flick->minlight = saveg_read32();
+		flick->thinker.function.acp1 = (actionf_p1) T_FireFlicker;
+		batch->lights[batch->numlights++] = &flick->thinker;
+	    }
+	    break;
+
+	  default:
+	    I_Error ("P_UnArchiveSync: unknown tclass %i", tclass);
+	}
+    }
+
+    if (savegame_error || m != numsyncmobjs || s != numspecials
+     || l != numlights)
+	I_Error ("P_UnArchiveSync: the thinkers don't match the savegame");
+
+    for (i = 0; i < numbatches; i++)
+    {
+	Z_Free (batches[i]->lights);
+	Z_PoolFree (batches[i]);
+    }
+
+    // linked again oldest first, so each block and sector
+    //  lists its things newest first, as it did
+    for (i=0 ; i<numsyncmobjs ; i++)
+    {
+	order[i] = i;
+	P_UnsetThingPosition (syncmobjs[i]);
+    }
+
+    qsort(order, numsyncmobjs, sizeof(*order), P_CompareSyncStamps);
+
+    for (i=0 ; i<numsyncmobjs ; i++)
+	P_SetThingPosition (syncmobjs[order[i]]);
+
+    free(specials);
+    free(lights);
+    free(batches);
+    free(order);
+}
@@ -20,7 +20,7 @@
 #ifndef __P_SAVEG__
 #define __P_SAVEG__
 
-#include <stdio.h>
+#include "doomtype.h"
 
 // maximum size of a savegame description
 
@@ -34,6 +34,11 @@ char *P_TempSaveGameFile(void);
 
 char *P_SaveGameFile(int slot);
 
+// The buffer games are archived into.
+
+void P_StartSaveBuffer(void);
+void P_ReadSaveBuffer(byte *buffer, int length);
+
 // Savegame file header read/write functions
 
 bool P_ReadSaveGameHeader(void);
@@ -55,7 +60,12 @@ void P_UnArchiveThinkers (void);
 void P_ArchiveSpecials (void);
 void P_UnArchiveSpecials (void);
 
-extern FILE *save_stream;
+// What demos need besides, to play on from an archive
+void P_ArchiveSync (void);
+void P_UnArchiveSync (void);
+
+extern byte *save_buffer;
+extern byte *save_p;
 extern bool savegame_error;
 
 
@@ -20,6 +20,12 @@
 
 
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 #include "z_zone.h"
 
@@ -31,6 +37,8 @@
 #include "g_game.h"
 
 #include "i_system.h"
+#include "m_misc.h"
+#include "w_checksum.h"
 #include "w_wad.h"
 
 #include "doomdef.h"
@@ -81,14 +89,19 @@ static int      totallines;
 // Blockmap size.
 int		bmapwidth;
 int		bmapheight;	// size in mapblocks
-short*		blockmap;	// int for larger maps
+int32_t*	blockmap;	// int for larger maps
 // offsets in blockmap are from here
-short*		blockmaplump;
+int32_t*	blockmaplump;
 // origin of block map
 fixed_t		bmaporgx;
 fixed_t		bmaporgy;
 // for thing chains
 mobj_t**	blocklinks;
+mobj_t**	thingcells;
+
+static int	blockmapcount;	// of blockmaplump
+
+static bool	buildblockmap;
 
 
 // REJECT
@@ -113,25 +126,15 @@ mapthing_t	playerstarts[MAXPLAYERS];
 
 
 //
-// P_LoadVertexes
+// P_ConvertVertexes
+// Into vertexes, allocated by P_StartLoader.
 //
-void P_LoadVertexes (int lump)
+static void P_ConvertVertexes (byte* data)
 {
-    byte*		data;
     int			i;
     mapvertex_t*	ml;
     vertex_t*		li;
 
-    // Determine number of lumps:
-    //  total lump length / vertex record length.
-    numvertexes = W_LumpLength (lump) / sizeof(mapvertex_t);
-
-    // Allocate zone memory for buffer.
-    vertexes = Z_Malloc (numvertexes*sizeof(vertex_t),PU_LEVEL,0);
-
-    // Load data into cache.
-    data = W_CacheLumpNum (lump, PU_STATIC);
-
     ml = (mapvertex_t *)data;
     li = vertexes;
 
@@ -142,9 +145,6 @@ void P_LoadVertexes (int lump)
 	li->x = SHORT(ml->x)<<FRACBITS;
 	li->y = SHORT(ml->y)<<FRACBITS;
     }
-
-    // Free buffer memory.
-    W_ReleaseLumpNum(lump);
 }
 
 //
@@ -181,7 +181,7 @@ void P_LoadSegs (int lump)
     int                 sidenum;
 
     numsegs = W_LumpLength (lump) / sizeof(mapseg_t);
-    segs = Z_Malloc (numsegs*sizeof(seg_t),PU_LEVEL,0);
+    segs = Z_LevelMalloc (numsegs*sizeof(seg_t));
     memset (segs, 0, numsegs*sizeof(seg_t));
     data = W_CacheLumpNum (lump,PU_STATIC);
 
@@ -231,19 +231,14 @@ void P_LoadSegs (int lump)
 
 
 //
-// P_LoadSubsectors
+// P_ConvertSubsectors
 //
-void P_LoadSubsectors (int lump)
+static void P_ConvertSubsectors (byte* data)
 {
-    byte*		data;
     int			i;
     mapsubsector_t*	ms;
     subsector_t*	ss;
 
-    numsubsectors = W_LumpLength (lump) / sizeof(mapsubsector_t);
-    subsectors = Z_Malloc (numsubsectors*sizeof(subsector_t),PU_LEVEL,0);
-    data = W_CacheLumpNum (lump,PU_STATIC);
-
     ms = (mapsubsector_t *)data;
     memset (subsectors,0, numsubsectors*sizeof(subsector_t));
     ss = subsectors;
@@ -253,8 +248,6 @@ void P_LoadSubsectors (int lump)
 	ss->numlines = SHORT(ms->numsegs);
 	ss->firstline = SHORT(ms->firstseg);
     }
-
-    W_ReleaseLumpNum(lump);
 }
 
 
@@ -270,7 +263,7 @@ void P_LoadSectors (int lump)
     sector_t*		ss;
 
     numsectors = W_LumpLength (lump) / sizeof(mapsector_t);
-    sectors = Z_Malloc (numsectors*sizeof(sector_t),PU_LEVEL,0);
+    sectors = Z_LevelMalloc (numsectors*sizeof(sector_t));
     memset (sectors, 0, numsectors*sizeof(sector_t));
     data = W_CacheLumpNum (lump,PU_STATIC);
 
@@ -293,21 +286,16 @@ void P_LoadSectors (int lump)
 
 
 //
-// P_LoadNodes
+// P_ConvertNodes
 //
-void P_LoadNodes (int lump)
+static void P_ConvertNodes (byte* data)
 {
-    byte*	data;
     int		i;
     int		j;
     int		k;
     mapnode_t*	mn;
     node_t*	no;
 
-    numnodes = W_LumpLength (lump) / sizeof(mapnode_t);
-    nodes = Z_Malloc (numnodes*sizeof(node_t),PU_LEVEL,0);
-    data = W_CacheLumpNum (lump,PU_STATIC);
-
     mn = (mapnode_t *)data;
     no = nodes;
 
@@ -321,11 +309,83 @@ void P_LoadNodes (int lump)
 	{
 	    no->children[j] = SHORT(mn->children[j]);
 	    for (k=0 ; k<4 ; k++)
-		no->bbox[j][k] = SHORT(mn->bbox[j][k])<<FRACBITS;
+		no->bbox[j][k] = SHORT(mn->bbox[j][k]);
 	}
     }
+}
 
-    W_ReleaseLumpNum(lump);
+
+//
+// P_LayNode
+// Copies the subtree under num to the slots counting
+//  down from *next, each node before its children.
+// Returns where it went, or -1 if it was reached twice.
+//
+static int
+P_LayNode
+( node_t*	laid,
+  bool*		reached,
+  int		num,
+  int*		next )
+{
+    int		slot;
+    int		child;
+    int		i;
+
+    if (num & NF_SUBSECTOR)
+	return num;
+
+    if (num >= numnodes || reached[num] || *next < 0)
+	return -1;
+
+    reached[num] = true;
+    slot = (*next)--;
+    laid[slot] = nodes[num];
+
+    for (i=0 ; i<2 ; i++)
+    {
+	child = P_LayNode (laid, reached, nodes[num].children[i], next);
+	if (child == -1)
+	    return -1;
+	laid[slot].children[i] = child;
+    }
+
+    return slot;
+}
+
+
+//
+// P_LayNodes
+// Lays the nodes out depth first, so the front child of
+//  a node is next to it and each subtree is in one piece,
+//  for the renderer and sight to walk down. They go from
+//  the end backwards, to keep the root the last node as
+//  everything expects. Nodes that aren't a tree are left
+//  as they are.
+//
+static void P_LayNodes (void)
+{
+    node_t*	laid;
+    bool*	reached;
+    int		next;
+
+    if (numnodes < 2)
+	return;
+
+    laid = Z_Malloc (numnodes*sizeof(node_t), PU_STATIC, 0);
+    reached = Z_Malloc (numnodes*sizeof(bool), PU_STATIC, 0);
+    memset (reached, 0, numnodes*sizeof(bool));
+
+    next = numnodes - 1;
+
+    if (P_LayNode (laid, reached, numnodes - 1, &next) == numnodes - 1
+	&& next == -1)
+    {
+	memcpy (nodes, laid, numnodes*sizeof(node_t));
+    }
+
+    Z_Free (reached);
+    Z_Free (laid);
 }
 
 
@@ -399,7 +459,7 @@ void P_LoadLineDefs (int lump)
     vertex_t*		v2;
 
     numlines = W_LumpLength (lump) / sizeof(maplinedef_t);
-    lines = Z_Malloc (numlines*sizeof(line_t),PU_LEVEL,0);
+    lines = Z_LevelMalloc (numlines*sizeof(line_t));
     memset (lines, 0, numlines*sizeof(line_t));
     data = W_CacheLumpNum (lump,PU_STATIC);
 
@@ -478,7 +538,7 @@ void P_LoadSideDefs (int lump)
     side_t*		sd;
 
     numsides = W_LumpLength (lump) / sizeof(mapsidedef_t);
-    sides = Z_Malloc (numsides*sizeof(side_t),PU_LEVEL,0);
+    sides = Z_LevelMalloc (numsides*sizeof(side_t));
     memset (sides, 0, numsides*sizeof(side_t));
     data = W_CacheLumpNum (lump,PU_STATIC);
 
@@ -499,40 +559,341 @@ void P_LoadSideDefs (int lump)
 
 
 //
-// P_LoadBlockMap
+// P_ReadBlockMap
+// Widens the lump to 32 bits, reading the offsets
+//  as unsigned so they reach past 32767.
+// Returns false if the lump can't be used as is.
 //
-void P_LoadBlockMap (int lump)
+static bool P_ReadBlockMap (int lump)
 {
-    int i;
-    int count;
-    int lumplen;
+    int		i;
+    int		count;
+    int		lumplen;
+    int		offset;
+    int		blocks;
+    short*	data;
+
+    if ((unsigned) lump >= numlumps || strncasecmp (lumpinfo[lump].name, "BLOCKMAP", 8))
+	return false;
 
     lumplen = W_LumpLength(lump);
     count = lumplen / 2;
 
-    blockmaplump = Z_Malloc(lumplen, PU_LEVEL, NULL);
-    W_ReadLump(lump, blockmaplump);
+    if (count < 4)
+	return false;
+
+    data = W_CacheLumpNum(lump, PU_STATIC);
+
+    blockmaplump = Z_LevelMalloc(count * sizeof(*blockmaplump));
     blockmap = blockmaplump + 4;
+    blockmapcount = count;
 
-    // Swap all short integers to native byte ordering.
+    // Read the header
 
-    for (i=0; i<count; i++)
+    for (i=0; i<4; i++)
     {
-	blockmaplump[i] = SHORT(blockmaplump[i]);
+	blockmaplump[i] = SHORT(data[i]);
     }
 
-    // Read the header
+    // Swap the rest to native byte ordering,
+    //  keeping -1 as the end of the lists.
+
+    for (i=4; i<count; i++)
+    {
+	blockmaplump[i] = (unsigned short) SHORT(data[i]);
+	if (blockmaplump[i] == 0xffff)
+	    blockmaplump[i] = -1;
+    }
+
+    W_ReleaseLumpNum(lump);
 
     bmaporgx = blockmaplump[0]<<FRACBITS;
     bmaporgy = blockmaplump[1]<<FRACBITS;
     bmapwidth = blockmaplump[2];
     bmapheight = blockmaplump[3];
 
-    // Clear out mobj chains
+    blocks = bmapwidth * bmapheight;
+
+    if (bmapwidth <= 0 || bmapheight <= 0 || 4 + blocks > count)
+	return false;
+
+    // every list has to end in the lump,
+    //  and only name lines of the map
+    for (i=0; i<blocks; i++)
+    {
+	offset = blockmap[i];
+
+	if (offset < 4 + blocks || offset >= count)
+	    return false;
+
+	for ( ; blockmaplump[offset] != -1 ; offset++)
+	{
+	    if (blockmaplump[offset] >= numlines || offset + 1 >= count)
+		return false;
+	}
+    }
+
+    return true;
+}
+
+
+//
+// P_CreateBlockMap
+// Builds the blockmap from the lines, the way a node
+//  builder would, but with 32 bit offsets, without
+//  the line 0 every list used to start with, and
+//  with the blocks that have the same lines sharing
+//  one list.
+//
+static void P_CreateBlockMap (void)
+{
+    int		i;
+    int		j;
+    int		minx;
+    int		miny;
+    int		maxx;
+    int		maxy;
+    int		blocks;
+    int		total;
+    int		bx;
+    int		by;
+    int		bxl;
+    int		bxh;
+    int		byl;
+    int		byh;
+    int		x1;
+    int		y1;
+    int		dx;
+    int		dy;
+    int		offset;
+    int		numhash;
+    int64_t	side;
+    int64_t	sides[4];
+    int		corner;
+    int*	counts;
+    int*	starts;
+    int*	fill;
+    int32_t*	linelist;
+    int*	hash;
+    unsigned	key;
+    bool	front;
+    bool	back;
+
+    minx = miny = INT_MAX;
+    maxx = maxy = INT_MIN;
+
+    for (i=0; i<numvertexes; i++)
+    {
+	x1 = vertexes[i].x>>FRACBITS;
+	y1 = vertexes[i].y>>FRACBITS;
+
+	if (x1 < minx)
+	    minx = x1;
+	if (x1 > maxx)
+	    maxx = x1;
+	if (y1 < miny)
+	    miny = y1;
+	if (y1 > maxy)
+	    maxy = y1;
+    }
+
+    if (numvertexes == 0)
+	minx = miny = maxx = maxy = 0;
+
+    // the same margin as the node builders
+    minx -= 8;
+    miny -= 8;
+
+    bmaporgx = minx<<FRACBITS;
+    bmaporgy = miny<<FRACBITS;
+    bmapwidth = (maxx - minx) / MAPBLOCKUNITS + 1;
+    bmapheight = (maxy - miny) / MAPBLOCKUNITS + 1;
+
+    blocks = bmapwidth * bmapheight;
+
+    counts = calloc(blocks, sizeof(*counts));
+    starts = malloc(blocks * sizeof(*starts));
+    fill = malloc(blocks * sizeof(*fill));
+
+    if (counts == NULL || starts == NULL || fill == NULL)
+	I_Error("P_CreateBlockMap: out of memory for %ix%i blocks",
+		bmapwidth, bmapheight);
+
+    // Count the lines of each block first, then
+    // fill them in, both with the same walk.
+
+    linelist = NULL;
+
+    for (j=0; j<2; j++)
+    {
+	for (i=0; i<numlines; i++)
+	{
+	    x1 = (lines[i].v1->x>>FRACBITS) - minx;
+	    y1 = (lines[i].v1->y>>FRACBITS) - miny;
+	    dx = lines[i].dx>>FRACBITS;
+	    dy = lines[i].dy>>FRACBITS;
+
+	    bxl = ((lines[i].bbox[BOXLEFT]>>FRACBITS) - minx) / MAPBLOCKUNITS;
+	    bxh = ((lines[i].bbox[BOXRIGHT]>>FRACBITS) - minx) / MAPBLOCKUNITS;
+	    byl = ((lines[i].bbox[BOXBOTTOM]>>FRACBITS) - miny) / MAPBLOCKUNITS;
+	    byh = ((lines[i].bbox[BOXTOP]>>FRACBITS) - miny) / MAPBLOCKUNITS;
+
+	    for (by = byl; by <= byh; by++)
+	    {
+		for (bx = bxl; bx <= bxh; bx++)
+		{
+		    // The line crosses the block unless all
+		    // the corners are on the same side of it.
+		    // Lines on an edge are in both blocks.
+		    sides[0] = (int64_t) (bx * MAPBLOCKUNITS - x1) * dy
+			     - (int64_t) (by * MAPBLOCKUNITS - y1) * dx;
+		    sides[1] = sides[0] + (int64_t) MAPBLOCKUNITS * dy;
+		    sides[2] = sides[0] - (int64_t) MAPBLOCKUNITS * dx;
+		    sides[3] = sides[1] - (int64_t) MAPBLOCKUNITS * dx;
+
+		    front = back = false;
+		    for (corner = 0; corner < 4; corner++)
+		    {
+			side = sides[corner];
+			if (side >= 0)
+			    front = true;
+			if (side <= 0)
+			    back = true;
+		    }
+
+		    if (!front || !back)
+			continue;
+
+		    if (j == 0)
+			counts[by*bmapwidth+bx]++;
+		    else
+			linelist[fill[by*bmapwidth+bx]++] = i;
+		}
+	    }
+	}
+
+	if (j == 1)
+	    break;
+
+	total = 0;
+	for (i=0; i<blocks; i++)
+	{
+	    starts[i] = fill[i] = total;
+	    total += counts[i];
+	}
+
+	linelist = malloc((total + 1) * sizeof(*linelist));
+	if (linelist == NULL)
+	    I_Error("P_CreateBlockMap: out of memory for %i lines", total);
+    }
+
+    // Blocks with the same lines, empty ones most of all,
+    // share a list, found through a hash of the lists.
+
+    numhash = 1;
+    while (numhash < blocks * 2)
+	numhash <<= 1;
+
+    hash = malloc(numhash * sizeof(*hash));
+    if (hash == NULL)
+	I_Error("P_CreateBlockMap: out of memory for %i blocks", blocks);
+
+    for (i=0; i<numhash; i++)
+	hash[i] = -1;
+
+    // the lump is at most the header, the offsets,
+    //  and every list with its -1
+    blockmapcount = 4 + blocks + total + blocks;
+    blockmaplump = Z_LevelMalloc(blockmapcount * sizeof(*blockmaplump));
+    blockmap = blockmaplump + 4;
+
+    blockmaplump[0] = minx;
+    blockmaplump[1] = miny;
+    blockmaplump[2] = bmapwidth;
+    blockmaplump[3] = bmapheight;
+
+    offset = 4 + blocks;
+
+    for (i=0; i<blocks; i++)
+    {
+	key = 2166136261u;
+	for (j=0; j<counts[i]; j++)
+	    key = (key ^ linelist[starts[i] + j]) * 16777619u;
+	key ^= counts[i];
+	key &= numhash - 1;
+
+	for ( ; hash[key] != -1 ; key = (key + 1) & (numhash - 1))
+	{
+	    if (counts[hash[key]] == counts[i]
+		&& !memcmp(linelist + starts[hash[key]], linelist + starts[i],
+			   counts[i] * sizeof(*linelist)))
+	    {
+		break;
+	    }
+	}
+
+	if (hash[key] != -1)
+	{
+	    blockmap[i] = blockmap[hash[key]];
+	    continue;
+	}
+
+	hash[key] = i;
+	blockmap[i] = offset;
+
+	for (j=0; j<counts[i]; j++)
+	    blockmaplump[offset++] = linelist[starts[i] + j];
+	blockmaplump[offset++] = -1;
+    }
+
+    free(hash);
+    free(linelist);
+    free(fill);
+    free(starts);
+    free(counts);
+}
+
+
+//
+// P_BuildBlockMap
+// The built lists aren't in the order of the lump,
+//  which PIT_CheckLine depends on, so the lump is
+//  used for demos and netgames, unless it is broken.
+//
+static bool P_BuildBlockMap (void)
+{
+    return buildblockmap && !demoplayback && !demorecording && !netgame;
+}
+
+
+//
+// P_ClearBlockLinks
+//
+static void P_ClearBlockLinks (void)
+{
+    int count;
 
     count = sizeof(*blocklinks) * bmapwidth * bmapheight;
-    blocklinks = Z_Malloc(count, PU_LEVEL, 0);
+    blocklinks = Z_LevelMalloc(count);
     memset(blocklinks, 0, count);
+
+    count *= BLOCKCELLS * BLOCKCELLS + 1;
+    thingcells = Z_LevelMalloc(count);
+    memset(thingcells, 0, count);
+}
+
+
+//
+// P_LoadBlockMap
+// Needs the lines, when it builds the blockmap.
+//
+void P_LoadBlockMap (int lump)
+{
+    if (P_BuildBlockMap () || !P_ReadBlockMap (lump))
+	P_CreateBlockMap ();
+
+    // Clear out mobj chains
+    P_ClearBlockLinks ();
 }
 
 
@@ -578,7 +939,7 @@ void P_GroupLines (void)
     }
 
     // build line tables for each sector
-    linebuffer = Z_Malloc (totallines*sizeof(line_t *), PU_LEVEL, 0);
+    linebuffer = Z_LevelMalloc (totallines*sizeof(line_t *));
 
     for (i=0; i<numsectors; ++i)
     {
@@ -730,13 +1091,647 @@ static void P_LoadReject(int lumpnum)
     }
     else
     {
-        rejectmatrix = Z_Malloc(minlength, PU_LEVEL, &rejectmatrix);
+        rejectmatrix = Z_LevelMalloc(minlength);
         W_ReadLump(lumpnum, rejectmatrix);
 
         PadRejectArray(rejectmatrix + lumplen, minlength - lumplen);
     }
 }
 
+//
+// P_MapLumpName
+// The name of a level's marker lump, in 9 chars.
+//
+static void P_MapLumpName (int episode, int map, char *lumpname)
+{
+    if ( gamemode == commercial)
+    {
+	if (map<10)
+	    DEH_snprintf(lumpname, 9, "map0%i", map);
+	else
+	    DEH_snprintf(lumpname, 9, "map%i", map);
+    }
+    else
+    {
+	lumpname[0] = 'E';
+	lumpname[1] = '0' + episode;
+	lumpname[2] = 'M';
+	lumpname[3] = '0' + map;
+	lumpname[4] = 0;
+    }
+}
+
+
+//
+// P_PrefetchLevel
+// Started at the intermission, to have the next level's lumps
+//  read in while the stats are shown. The map's own lumps are
+//  only hinted, but finding its textures and flats means
+//  reading the sidedefs and sectors, so that is left to a
+//  thread. It reads through W_Read, not the zone.
+//
+extern int		numtextures;
+
+#ifndef _WIN32
+static pthread_t	prefetchthread;
+static bool		prefetching;
+#endif
+
+// Reads a map lump into memory from outside the zone.
+
+static byte *P_PrefetchRead (int lumpnum, int *count)
+{
+    lumpinfo_t	*lump;
+    byte	*data;
+
+    lump = &lumpinfo[lumpnum];
+    data = malloc (lump->size);
+    if (data == NULL)
+	return NULL;
+
+    *count = W_Read (lump->wad_file, lump->position, data, lump->size);
+
+    return data;
+}
+
+static void *P_PrefetchTextures (void *arg)
+{
+    int			lumpnum;
+    byte		*data;
+    byte		*seen;
+    mapsidedef_t	*msd;
+    mapsector_t		*ms;
+    char		*names[3];
+    int			count;
+    int			i;
+    int			j;
+    int			n;
+
+    lumpnum = (intptr_t) arg;
+
+    // one hint for each texture or flat
+    seen = calloc (numtextures + numlumps, 1);
+    if (seen == NULL)
+	return NULL;
+
+    data = P_PrefetchRead (lumpnum + ML_SIDEDEFS, &count);
+    if (data != NULL)
+    {
+	msd = (mapsidedef_t *) data;
+	for (i=0 ; i<count / (int) sizeof(mapsidedef_t) ; i++)
+	{
+	    names[0] = msd[i].toptexture;
+	    names[1] = msd[i].bottomtexture;
+	    names[2] = msd[i].midtexture;
+
+	    for (j=0 ; j<3 ; j++)
+	    {
+		n = R_CheckTextureNumForName (names[j]);
+		if (n > 0 && !seen[n])
+		{
+		    seen[n] = 1;
+		    R_PrefetchTexture (n);
+		}
+	    }
+	}
+	free (data);
+    }
+
+    data = P_PrefetchRead (lumpnum + ML_SECTORS, &count);
+    if (data != NULL)
+    {
+	ms = (mapsector_t *) data;
+	for (i=0 ; i<count / (int) sizeof(mapsector_t) ; i++)
+	{
+	    names[0] = ms[i].floorpic;
+	    names[1] = ms[i].ceilingpic;
+
+	    for (j=0 ; j<2 ; j++)
+	    {
+		n = W_CheckNumForName (names[j]);
+		if (n >= 0 && !seen[numtextures + n])
+		{
+		    seen[numtextures + n] = 1;
+		    W_PrefetchLump (n);
+		}
+	    }
+	}
+	free (data);
+    }
+
+    free (seen);
+
+    return NULL;
+}
+
+// Waits for the thread, before the level is loaded.
+
+static void P_FinishPrefetch (void)
+{
+#ifndef _WIN32
+    if (prefetching)
+    {
+	pthread_join (prefetchthread, NULL);
+	prefetching = false;
+    }
+#endif
+}
+
+void P_PrefetchLevel (int episode, int map)
+{
+    char	lumpname[9];
+    int		lumpnum;
+    int		i;
+
+    P_FinishPrefetch ();
+
+    P_MapLumpName (episode, map, lumpname);
+    lumpnum = W_CheckNumForName (lumpname);
+
+    if (lumpnum < 0 || lumpnum + ML_BLOCKMAP >= numlumps)
+	return;
+
+    for (i=ML_THINGS ; i<=ML_BLOCKMAP ; i++)
+	W_PrefetchLump (lumpnum + i);
+
+#ifndef _WIN32
+    prefetching = !pthread_create (&prefetchthread, NULL, P_PrefetchTextures,
+				   (void *) (intptr_t) lumpnum);
+    if (!prefetching)
+#endif
+	P_PrefetchTextures ((void *) (intptr_t) lumpnum);
+}
+
+
+//
+// LEVEL CACHE
+// With -levelcache, the level as loaded up to P_GroupLines
+//  is kept in a file next to the WAD, tied to the WADs
+//  by W_CacheKey, so that loading it again is reading it back
+//  and fixing up its pointers. Pointers are stored as one
+//  more than the index of what they point to, 0 for NULL.
+//  It is read rather than mapped, as playing changes it.
+//
+
+#define LEVELMAGIC	"DOOMLVL2"
+
+// the glass hack sector of P_LoadSegs
+#define NULLSECTOR	((void *) (intptr_t) -1)
+
+#define SWIZZLE(p, base)	((void *) ((p) ? (p) - (base) + 1 : 0))
+#define UNSWIZZLE(p, base)	((p) ? (base) + ((intptr_t) (p) - 1) : NULL)
+
+typedef struct
+{
+    char		magic[8];
+    uint64_t		wadkey;
+    unsigned int	sizes[7];	// of the structures, for other builds
+    int			builtblockmap;
+
+    int			numvertexes;
+    int			numsectors;
+    int			numsides;
+    int			numlines;
+    int			numsubsectors;
+    int			numnodes;
+    int			numsegs;
+    int			totallines;
+    int			blockmapcount;
+    int			bmapwidth;
+    int			bmapheight;
+    fixed_t		bmaporgx;
+    fixed_t		bmaporgy;
+
+    // followed by each array, then the sector line
+    //  lists and the blockmap
+} levelheader_t;
+
+static bool	levelcache;
+
+static void P_LevelHeader (levelheader_t* header)
+{
+    memset (header, 0, sizeof(*header));
+    memcpy (header->magic, LEVELMAGIC, sizeof(header->magic));
+    header->wadkey = W_CacheKey ();
+    header->sizes[0] = sizeof(vertex_t);
+    header->sizes[1] = sizeof(sector_t);
+    header->sizes[2] = sizeof(side_t);
+    header->sizes[3] = sizeof(line_t);
+    header->sizes[4] = sizeof(subsector_t);
+    header->sizes[5] = sizeof(node_t);
+    header->sizes[6] = sizeof(seg_t);
+    header->builtblockmap = P_BuildBlockMap ();
+}
+
+
+//
+// P_LevelFileName
+// Next to the WAD the map was loaded from, like the PVS.
+//
+static char* P_LevelFileName (int lumpnum)
+{
+    char	name[9];
+
+    M_StringCopy (name, lumpinfo[lumpnum].name, sizeof(name));
+    M_ForceUppercase (name);
+
+    return M_StringJoin (lumpinfo[lumpnum].wad_file->path, ".", name,
+			 ".lvl", NULL);
+}
+
+
+//
+// P_ReadLevel
+// Returns false if the file is missing or stale. What
+//  was read of a short one is left in the level arena,
+//  and goes with the level.
+//
+static bool P_ReadLevel (char* filename)
+{
+    levelheader_t	header;
+    levelheader_t	expected;
+    line_t**		linebuffer;
+    sector_t*		sector;
+    side_t*		side;
+    line_t*		line;
+    subsector_t*	ss;
+    seg_t*		seg;
+    FILE*		file;
+    bool		read;
+    int			i;
+
+    file = fopen (filename, "rb");
+    if (file == NULL)
+	return false;
+
+    P_LevelHeader (&expected);
+
+    if (fread (&header, sizeof(header), 1, file) != 1
+     || memcmp (header.magic, expected.magic, sizeof(header.magic))
+     || header.wadkey != expected.wadkey
+     || memcmp (header.sizes, expected.sizes, sizeof(header.sizes))
+     || header.builtblockmap != expected.builtblockmap
+     || header.numsectors <= 0 || header.totallines < 0
+     || header.blockmapcount < 4)
+    {
+	fclose (file);
+	return false;
+    }
+
+    numvertexes = header.numvertexes;
+    numsectors = header.numsectors;
+    numsides = header.numsides;
+    numlines = header.numlines;
+    numsubsectors = header.numsubsectors;
+    numnodes = header.numnodes;
+    numsegs = header.numsegs;
+    totallines = header.totallines;
+    blockmapcount = header.blockmapcount;
+
+    vertexes = Z_LevelMalloc (numvertexes*sizeof(vertex_t));
+    sectors = Z_LevelMalloc (numsectors*sizeof(sector_t));
+    sides = Z_LevelMalloc (numsides*sizeof(side_t));
+    lines = Z_LevelMalloc (numlines*sizeof(line_t));
+    subsectors = Z_LevelMalloc (numsubsectors*sizeof(subsector_t));
+    nodes = Z_LevelMalloc (numnodes*sizeof(node_t));
+    segs = Z_LevelMalloc (numsegs*sizeof(seg_t));
+    linebuffer = Z_LevelMalloc (totallines*sizeof(line_t *));
+    blockmaplump = Z_LevelMalloc (blockmapcount*sizeof(*blockmaplump));
+
+    read = fread (vertexes, sizeof(vertex_t), numvertexes, file) == (size_t) numvertexes
+	&& fread (sectors, sizeof(sector_t), numsectors, file) == (size_t) numsectors
+	&& fread (sides, sizeof(side_t), numsides, file) == (size_t) numsides
+	&& fread (lines, sizeof(line_t), numlines, file) == (size_t) numlines
+	&& fread (subsectors, sizeof(subsector_t), numsubsectors, file) == (size_t) numsubsectors
+	&& fread (nodes, sizeof(node_t), numnodes, file) == (size_t) numnodes
+	&& fread (segs, sizeof(seg_t), numsegs, file) == (size_t) numsegs
+	&& fread (linebuffer, sizeof(line_t *), totallines, file) == (size_t) totallines
+	&& fread (blockmaplump, sizeof(*blockmaplump), blockmapcount, file) == (size_t) blockmapcount;
+
+    fclose (file);
+
+    if (!read)
+	return false;
+
+    for (i=0, sector=sectors ; i<numsectors ; i++, sector++)
+	sector->lines = linebuffer + (intptr_t) sector->lines;
+
+    for (i=0, side=sides ; i<numsides ; i++, side++)
+	side->sector = UNSWIZZLE (side->sector, sectors);
+
+    for (i=0, line=lines ; i<numlines ; i++, line++)
+    {
+	line->v1 = UNSWIZZLE (line->v1, vertexes);
+	line->v2 = UNSWIZZLE (line->v2, vertexes);
+	line->frontsector = UNSWIZZLE (line->frontsector, sectors);
+	line->backsector = UNSWIZZLE (line->backsector, sectors);
+    }
+
+    for (i=0, ss=subsectors ; i<numsubsectors ; i++, ss++)
+	ss->sector = UNSWIZZLE (ss->sector, sectors);
+
+    for (i=0, seg=segs ; i<numsegs ; i++, seg++)
+    {
+	seg->v1 = UNSWIZZLE (seg->v1, vertexes);
+	seg->v2 = UNSWIZZLE (seg->v2, vertexes);
+	seg->sidedef = UNSWIZZLE (seg->sidedef, sides);
+	seg->linedef = UNSWIZZLE (seg->linedef, lines);
+	seg->frontsector = UNSWIZZLE (seg->frontsector, sectors);
+	if ((void *) seg->backsector == NULLSECTOR)
+	    seg->backsector = GetSectorAtNullAddress ();
+	else
+	    seg->backsector = UNSWIZZLE (seg->backsector, sectors);
+    }
+
+    for (i=0 ; i<totallines ; i++)
+	linebuffer[i] = UNSWIZZLE (linebuffer[i], lines);
+
+    blockmap = blockmaplump + 4;
+    bmapwidth = header.bmapwidth;
+    bmapheight = header.bmapheight;
+    bmaporgx = header.bmaporgx;
+    bmaporgy = header.bmaporgy;
+
+    return true;
+}
+
+
+//
+// P_WriteArray
+// Of count elements, through a copy whose pointers are
+//  swizzled by the callback.
+//
+static bool
+P_WriteArray
+( FILE*		file,
+  void*		array,
+  size_t	size,
+  int		count,
+  void		(*swizzle) (void* copy, int count) )
+{
+    void*	copy;
+    bool	written;
+
+    copy = malloc (size * count + 1);
+    if (copy == NULL)
+	return false;
+
+    memcpy (copy, array, size * count);
+    if (swizzle)
+	swizzle (copy, count);
+    written = fwrite (copy, size, count, file) == (size_t) count;
+    free (copy);
+
+    return written;
+}
+
+static void P_SwizzleSectors (void* copy, int count)
+{
+    sector_t*	sector;
+    int		i;
+
+    for (i=0, sector=copy ; i<count ; i++, sector++)
+    {
+	sector->lines = (line_t **) (intptr_t) (sector->lines - sectors[0].lines);
+	sector->neighbors = NULL;
+	sector->neighborcount = 0;
+    }
+}
+
+static void P_SwizzleSides (void* copy, int count)
+{
+    side_t*	side;
+    int		i;
+
+    for (i=0, side=copy ; i<count ; i++, side++)
+	side->sector = SWIZZLE (side->sector, sectors);
+}
+
+static void P_SwizzleLines (void* copy, int count)
+{
+    line_t*	line;
+    int		i;
+
+    for (i=0, line=copy ; i<count ; i++, line++)
+    {
+	line->v1 = SWIZZLE (line->v1, vertexes);
+	line->v2 = SWIZZLE (line->v2, vertexes);
+	line->frontsector = SWIZZLE (line->frontsector, sectors);
+	line->backsector = SWIZZLE (line->backsector, sectors);
+    }
+}
+
+static void P_SwizzleSubsectors (void* copy, int count)
+{
+    subsector_t*	ss;
+    int			i;
+
+    for (i=0, ss=copy ; i<count ; i++, ss++)
+	ss->sector = SWIZZLE (ss->sector, sectors);
+}
+
+static void P_SwizzleSegs (void* copy, int count)
+{
+    seg_t*	seg;
+    int		i;
+
+    for (i=0, seg=copy ; i<count ; i++, seg++)
+    {
+	seg->v1 = SWIZZLE (seg->v1, vertexes);
+	seg->v2 = SWIZZLE (seg->v2, vertexes);
+	seg->sidedef = SWIZZLE (seg->sidedef, sides);
+	seg->linedef = SWIZZLE (seg->linedef, lines);
+	seg->frontsector = SWIZZLE (seg->frontsector, sectors);
+	if (seg->backsector == GetSectorAtNullAddress ())
+	    seg->backsector = NULLSECTOR;
+	else
+	    seg->backsector = SWIZZLE (seg->backsector, sectors);
+    }
+}
+
+static void P_SwizzleLineLists (void* copy, int count)
+{
+    line_t**	list;
+    int		i;
+
+    for (i=0, list=copy ; i<count ; i++, list++)
+	*list = SWIZZLE (*list, lines);
+}
+
+
+//
+// P_WriteLevel
+// Written next to the file and renamed over it,
+//  like R_WriteSharedCache.
+//
+static void P_WriteLevel (char* filename)
+{
+    levelheader_t	header;
+    char*		temp;
+    FILE*		file;
+    bool		written;
+
+    P_LevelHeader (&header);
+    header.numvertexes = numvertexes;
+    header.numsectors = numsectors;
+    header.numsides = numsides;
+    header.numlines = numlines;
+    header.numsubsectors = numsubsectors;
+    header.numnodes = numnodes;
+    header.numsegs = numsegs;
+    header.totallines = totallines;
+    header.blockmapcount = blockmapcount;
+    header.bmapwidth = bmapwidth;
+    header.bmapheight = bmapheight;
+    header.bmaporgx = bmaporgx;
+    header.bmaporgy = bmaporgy;
+
+    temp = M_StringJoin (filename, ".tmp", NULL);
+
+    file = fopen (temp, "wb");
+    written = file != NULL
+	   && numsectors > 0
+	   && fwrite (&header, sizeof(header), 1, file) == 1
+	   && P_WriteArray (file, vertexes, sizeof(vertex_t), numvertexes, NULL)
+	   && P_WriteArray (file, sectors, sizeof(sector_t), numsectors, P_SwizzleSectors)
+	   && P_WriteArray (file, sides, sizeof(side_t), numsides, P_SwizzleSides)
+	   && P_WriteArray (file, lines, sizeof(line_t), numlines, P_SwizzleLines)
+	   && P_WriteArray (file, subsectors, sizeof(subsector_t), numsubsectors, P_SwizzleSubsectors)
+	   && P_WriteArray (file, nodes, sizeof(node_t), numnodes, NULL)
+	   && P_WriteArray (file, segs, sizeof(seg_t), numsegs, P_SwizzleSegs)
+	   && P_WriteArray (file, sectors[0].lines, sizeof(line_t *), totallines, P_SwizzleLineLists)
+	   && P_WriteArray (file, blockmaplump, sizeof(*blockmaplump), blockmapcount, NULL);
+    if (file != NULL && fclose (file) != 0)
+	written = false;
+
+    if (!written || rename (temp, filename) != 0)
+    {
+	printf ("P_WriteLevel: failed to write %s\n", filename);
+	remove (temp);
+    }
+
+    free (temp);
+}
+
+
+//
+// MAP LOADER
+// The vertexes, subsectors and nodes need nothing else of
+//  the level, so they are read and converted by a thread
+//  while the sectors and sidedefs look up their flats and
+//  textures. The arrays are allocated first, as the zone
+//  is only used from the main thread, and the lumps read
+//  through W_Read like the prefetch does.
+//
+
+static const int	loaderlumps[] = { ML_VERTEXES, ML_SSECTORS, ML_NODES };
+static void		(*const loaderconverts[]) (byte* data) =
+{
+    P_ConvertVertexes, P_ConvertSubsectors, P_ConvertNodes
+};
+static bool		loaderdone[arrlen(loaderlumps)];
+
+#ifndef _WIN32
+static pthread_t	loaderthread;
+static bool		loading;
+#endif
+
+static void *P_LoaderThread (void *arg)
+{
+    int		lumpnum;
+    byte	*data;
+    int		count;
+    int		i;
+
+    lumpnum = (intptr_t) arg;
+
+    for (i=0 ; i<arrlen(loaderlumps) ; i++)
+    {
+	data = P_PrefetchRead (lumpnum + loaderlumps[i], &count);
+	if (data == NULL)
+	    continue;
+
+	// what couldn't be read is left to P_FinishLoader
+	loaderdone[i] = count == lumpinfo[lumpnum + loaderlumps[i]].size;
+	if (loaderdone[i])
+	    loaderconverts[i] (data);
+	free (data);
+    }
+
+    return NULL;
+}
+
+static void P_StartLoader (int lumpnum)
+{
+    int		i;
+
+    numvertexes = W_LumpLength (lumpnum+ML_VERTEXES) / sizeof(mapvertex_t);
+    vertexes = Z_LevelMalloc (numvertexes*sizeof(vertex_t));
+
+    numsubsectors = W_LumpLength (lumpnum+ML_SSECTORS) / sizeof(mapsubsector_t);
+    subsectors = Z_LevelMalloc (numsubsectors*sizeof(subsector_t));
+
+    numnodes = W_LumpLength (lumpnum+ML_NODES) / sizeof(mapnode_t);
+    nodes = Z_LevelMalloc (numnodes*sizeof(node_t));
+
+    for (i=0 ; i<arrlen(loaderlumps) ; i++)
+	loaderdone[i] = false;
+
+#ifndef _WIN32
+    loading = !pthread_create (&loaderthread, NULL, P_LoaderThread,
+			       (void *) (intptr_t) lumpnum);
+    if (!loading)
+#endif
+	P_LoaderThread ((void *) (intptr_t) lumpnum);
+}
+
+// Waits for the thread, and converts what it couldn't
+//  from the zone.
+
+static void P_FinishLoader (int lumpnum)
+{
+    byte	*data;
+    int		i;
+
+#ifndef _WIN32
+    if (loading)
+    {
+	pthread_join (loaderthread, NULL);
+	loading = false;
+    }
+#endif
+
+    for (i=0 ; i<arrlen(loaderlumps) ; i++)
+    {
+	if (loaderdone[i])
+	    continue;
+
+	data = W_CacheLumpNum (lumpnum + loaderlumps[i], PU_STATIC);
+	loaderconverts[i] (data);
+	W_ReleaseLumpNum (lumpnum + loaderlumps[i]);
+    }
+}
+
+
+//
+// P_InitLevelData
+// Left out of P_Init, as the title screen and menus
+//  don't need it, to get the first frame out sooner.
+//
+void P_InitLevelData (void)
+{
+    static bool	initialized;
+
+    if (initialized)
+	return;
+
+    P_InitSwitchList ();
+    P_InitPicAnims ();
+    R_InitSprites (sprnames);
+    initialized = true;
+}
+
+
 //
 // P_SetupLevel
 //
@@ -750,6 +1745,10 @@ P_SetupLevel
     int		i;
     char	lumpname[9];
     int		lumpnum;
+    char*	levelfile;
+
+    P_FinishPrefetch ();
+    P_InitLevelData ();
 
     totalkills = totalitems = totalsecret = wminfo.maxfrags = 0;
     wminfo.partime = 180;
@@ -771,40 +1770,47 @@ P_SetupLevel
     // UNUSED W_Profile ();
     P_InitThinkers ();
 
+    // skipping things vanilla would check can desync
+    touchlists = fastsectors && !demoplayback && !demorecording && !netgame;
+
     // find map name
-    if ( gamemode == commercial)
+    P_MapLumpName (episode, map, lumpname);
+    lumpnum = W_GetNumForName (lumpname);
+
+    leveltime = 0;
+
+    levelfile = levelcache ? P_LevelFileName (lumpnum) : NULL;
+
+    if (levelfile != NULL && P_ReadLevel (levelfile))
     {
-	if (map<10)
-	    DEH_snprintf(lumpname, 9, "map0%i", map);
-	else
-	    DEH_snprintf(lumpname, 9, "map%i", map);
+	P_ClearBlockLinks ();
     }
     else
     {
-	lumpname[0] = 'E';
-	lumpname[1] = '0' + episode;
-	lumpname[2] = 'M';
-	lumpname[3] = '0' + map;
-	lumpname[4] = 0;
-    }
+	// note: most of this ordering is important
+	P_StartLoader (lumpnum);
+	P_LoadSectors (lumpnum+ML_SECTORS);
+	P_LoadSideDefs (lumpnum+ML_SIDEDEFS);
+	P_FinishLoader (lumpnum);
 
-    lumpnum = W_GetNumForName (lumpname);
+	P_LoadLineDefs (lumpnum+ML_LINEDEFS);
+	P_LoadBlockMap (lumpnum+ML_BLOCKMAP);
+	P_LoadSegs (lumpnum+ML_SEGS);
 
-    leveltime = 0;
+	P_GroupLines ();
+	P_LayNodes ();
 
-    // note: most of this ordering is important
-    P_LoadBlockMap (lumpnum+ML_BLOCKMAP);
-    P_LoadVertexes (lumpnum+ML_VERTEXES);
-    P_LoadSectors (lumpnum+ML_SECTORS);
-    P_LoadSideDefs (lumpnum+ML_SIDEDEFS);
+	if (levelfile != NULL)
+	    P_WriteLevel (levelfile);
+    }
 
-    P_LoadLineDefs (lumpnum+ML_LINEDEFS);
-    P_LoadSubsectors (lumpnum+ML_SSECTORS);
-    P_LoadNodes (lumpnum+ML_NODES);
-    P_LoadSegs (lumpnum+ML_SEGS);
+    free (levelfile);
 
-    P_GroupLines ();
+    P_InitLineBoxes (blockmapcount);
+    P_InitSectorLinks ();
+    P_InitSoundGraph ();
     P_LoadReject (lumpnum+ML_REJECT);
+    P_LoadPVS (lumpnum);
 
     bodyqueslot = 0;
     deathmatch_p = deathmatchstarts;
@@ -846,7 +1852,34 @@ P_SetupLevel
 //
 void P_Init (void)
 {
-    P_InitSwitchList ();
-    P_InitPicAnims ();
-    R_InitSprites (sprnames);
+    P_InitStateTable ();
+    P_InitPVS ();
+    P_InitSight ();
+
+    //!
+    // Keep the things touching each sector, so moving floors
+    // and ceilings only check those. Things near a sector that
+    // don't touch it are skipped, unlike vanilla, so this is
+    // ignored in demos and netgames.
+    //
+
+    fastsectors = M_CheckParm ("-fastsectors") > 0;
+
+    //!
+    // Build the blockmap of each level from its lines instead
+    // of reading the BLOCKMAP lump, which is only done anyway
+    // if the lump is missing or broken. Ignored in demos and
+    // netgames.
+    //
+
+    buildblockmap = M_CheckParm ("-blockmap") > 0;
+
+    //!
+    // Keep each level as loaded in a file next to the WAD,
+    // and read it back the next time instead of converting
+    // the map lumps again. A file is rebuilt when the WADs
+    // change.
+    //
+
+    levelcache = M_CheckParm ("-levelcache") > 0;
 }
@@ -31,7 +31,14 @@ P_SetupLevel
   int		playermask,
   skill_t	skill);
 
+// Has the lumps of a level read in ahead of P_SetupLevel.
+void P_PrefetchLevel (int episode, int map);
+
 // Called by startup code.
 void P_Init (void);
 
+// Sets up what only levels use, the first time it is
+//  called, as P_SetupLevel does.
+void P_InitLevelData (void);
+
 #endif
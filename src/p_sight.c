@@ -18,28 +18,115 @@
 
 
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 #include "doomdef.h"
+#include "doomstat.h"
 
 #include "i_system.h"
+#include "m_argv.h"
 #include "p_local.h"
+#include "p_bench.h"
 
 // State.
 #include "r_state.h"
 
 //
 // P_CheckSight
+// Everything a trace needs is kept in a sighttrace_t, so
+//  that the threads of -sightthreads can trace at once.
+//  Each has its own marks for the lines already crossed,
+//  rather than line->validcount.
 //
-fixed_t		sightzstart;		// eye z of looker
-fixed_t		topslope;
-fixed_t		bottomslope;		// slopes to top and bottom of target
-
-divline_t	strace;			// from t1 to t2
-fixed_t		t2x;
-fixed_t		t2y;
+typedef struct
+{
+    divline_t	strace;			// from t1 to t2
+    fixed_t	t2x;
+    fixed_t	t2y;
+    fixed_t	sightzstart;		// eye z of looker
+    fixed_t	topslope;
+    fixed_t	bottomslope;		// slopes to top and bottom of target
+    int*	linemarks;
+    int		numlinemarks;
+    int		mark;
+} sighttrace_t;
+
+static sighttrace_t	sighttrace;
 
 int		sightcounts[2];
 
 
+//
+// Sight doesn't depend on anything but where the two
+//  mobjs are and how high the sectors are, and monsters
+//  check the same targets several times a tic. Results
+//  are kept until P_FlushSightCache, which is called at
+//  the start of every tic and whenever a sector moves.
+//
+#define SIGHTCACHESIZE	256
+
+typedef struct
+{
+    fixed_t	x1;
+    fixed_t	y1;
+    fixed_t	z1;
+    fixed_t	x2;
+    fixed_t	y2;
+    fixed_t	z2;
+    fixed_t	height2;
+    unsigned	stamp;
+    bool	result;
+} sightcache_t;
+
+static sightcache_t	sightcache[SIGHTCACHESIZE];
+
+// 0 is never valid, so the cache starts out empty.
+static unsigned		sightstamp = 1;
+
+//
+// With -sightthreads, the monsters about to look or chase
+//  have their sight of their targets traced on several
+//  threads before the thinkers run. The results are kept
+//  by where both are, as in the cache, and only used while
+//  the stamp is the same, so a monster whose target has
+//  moved, or whose sectors have, traces again itself.
+//
+static sightcache_t*	predictions;
+static int		predictmask = -1;
+
+static sightcache_t**	predictwork;
+static int		numpredictwork;
+static int		maxpredictwork;
+
+// Fewer than this are left for the thinkers to trace.
+#define MINPREDICTIONS	16
+
+static int		sightthreads;
+
+
+//
+// P_FlushSightCache
+//
+void P_FlushSightCache (void)
+{
+    sightstamp++;
+
+    if (!sightstamp)
+    {
+	memset (sightcache, 0, sizeof(sightcache));
+	if (predictions)
+	    memset (predictions, 0, (predictmask + 1) * sizeof(*predictions));
+	sightstamp = 1;
+    }
+}
+
+
 //
 // P_DivlineSide
 // Returns side 0 (front), 1 (back), or 2 (on).
@@ -125,7 +212,7 @@ P_InterceptVector2
 // Returns true
 //  if strace crosses the given subsector successfully.
 //
-bool P_CrossSubsector (int num)
+static bool P_CrossSubsector (sighttrace_t* trace, int num)
 {
     seg_t*		seg;
     line_t*		line;
@@ -161,15 +248,15 @@ bool P_CrossSubsector (int num)
 	line = seg->linedef;
 
 	// allready checked other side?
-	if (line->validcount == validcount)
+	if (trace->linemarks[line - lines] == trace->mark)
 	    continue;
 	
-	line->validcount = validcount;
+	trace->linemarks[line - lines] = trace->mark;
 
 	v1 = line->v1;
 	v2 = line->v2;
-	s1 = P_DivlineSide (v1->x,v1->y, &strace);
-	s2 = P_DivlineSide (v2->x, v2->y, &strace);
+	s1 = P_DivlineSide (v1->x,v1->y, &trace->strace);
+	s2 = P_DivlineSide (v2->x, v2->y, &trace->strace);
 
 	// line isn't crossed?
 	if (s1 == s2)
@@ -179,8 +266,8 @@ bool P_CrossSubsector (int num)
 	divl.y = v1->y;
 	divl.dx = v2->x - v1->x;
 	divl.dy = v2->y - v1->y;
-	s1 = P_DivlineSide (strace.x, strace.y, &divl);
-	s2 = P_DivlineSide (t2x, t2y, &divl);
+	s1 = P_DivlineSide (trace->strace.x, trace->strace.y, &divl);
+	s2 = P_DivlineSide (trace->t2x, trace->t2y, &divl);
 
 	// line isn't crossed?
 	if (s1 == s2)
@@ -225,23 +312,23 @@ bool P_CrossSubsector (int num)
 	if (openbottom >= opentop)	
 	    return false;		// stop
 	
-	frac = P_InterceptVector2 (&strace, &divl);
+	frac = P_InterceptVector2 (&trace->strace, &divl);
 		
 	if (front->floorheight != back->floorheight)
 	{
-	    slope = FixedDiv (openbottom - sightzstart , frac);
-	    if (slope > bottomslope)
-		bottomslope = slope;
+	    slope = FixedDiv (openbottom - trace->sightzstart , frac);
+	    if (slope > trace->bottomslope)
+		trace->bottomslope = slope;
 	}
 		
 	if (front->ceilingheight != back->ceilingheight)
 	{
-	    slope = FixedDiv (opentop - sightzstart , frac);
-	    if (slope < topslope)
-		topslope = slope;
+	    slope = FixedDiv (opentop - trace->sightzstart , frac);
+	    if (slope < trace->topslope)
+		trace->topslope = slope;
 	}
 		
-	if (topslope <= bottomslope)
+	if (trace->topslope <= trace->bottomslope)
 	    return false;		// stop				
     }
     // passed the subsector ok
@@ -255,7 +342,7 @@ bool P_CrossSubsector (int num)
 // Returns true
 //  if strace crosses the given node successfully.
 //
-bool P_CrossBSPNode (int bspnum)
+static bool P_CrossBSPNode (sighttrace_t* trace, int bspnum)
 {
     node_t*	bsp;
     int		side;
@@ -263,31 +350,113 @@ bool P_CrossBSPNode (int bspnum)
     if (bspnum & NF_SUBSECTOR)
     {
 	if (bspnum == -1)
-	    return P_CrossSubsector (0);
+	    return P_CrossSubsector (trace, 0);
 	else
-	    return P_CrossSubsector (bspnum&(~NF_SUBSECTOR));
+	    return P_CrossSubsector (trace, bspnum&(~NF_SUBSECTOR));
     }
 		
     bsp = &nodes[bspnum];
     
     // decide which side the start point is on
-    side = P_DivlineSide (strace.x, strace.y, (divline_t *)bsp);
+    side = P_DivlineSide (trace->strace.x, trace->strace.y, (divline_t *)bsp);
     if (side == 2)
 	side = 0;	// an "on" should cross both sides
 
     // cross the starting side
-    if (!P_CrossBSPNode (bsp->children[side]) )
+    if (!P_CrossBSPNode (trace, bsp->children[side]) )
 	return false;
 	
     // the partition plane is crossed here
-    if (side == P_DivlineSide (t2x, t2y,(divline_t *)bsp))
+    if (side == P_DivlineSide (trace->t2x, trace->t2y,(divline_t *)bsp))
     {
 	// the line doesn't touch the other side
 	return true;
     }
     
     // cross the ending side		
-    return P_CrossBSPNode (bsp->children[side^1]);
+    return P_CrossBSPNode (trace, bsp->children[side^1]);
+}
+
+
+//
+// P_TraceSight
+// Traces from the eyes at x1,y1,z1 to any part of the
+//  target, as the cache or a prediction has it.
+//
+static bool P_TraceSight (sighttrace_t* trace, sightcache_t* key)
+{
+    if (trace->numlinemarks < numlines)
+    {
+	free (trace->linemarks);
+	trace->linemarks = calloc (numlines, sizeof(*trace->linemarks));
+	if (trace->linemarks == NULL)
+	    I_Error ("P_TraceSight: couldn't allocate line marks");
+	trace->numlinemarks = numlines;
+	trace->mark = 0;
+    }
+
+    // marks left from an earlier level are all below this one
+    if (++trace->mark <= 0)
+    {
+	memset (trace->linemarks, 0, trace->numlinemarks * sizeof(*trace->linemarks));
+	trace->mark = 1;
+    }
+
+    trace->sightzstart = key->z1;
+    trace->topslope = (key->z2+key->height2) - trace->sightzstart;
+    trace->bottomslope = (key->z2) - trace->sightzstart;
+	
+    trace->strace.x = key->x1;
+    trace->strace.y = key->y1;
+    trace->t2x = key->x2;
+    trace->t2y = key->y2;
+    trace->strace.dx = key->x2 - key->x1;
+    trace->strace.dy = key->y2 - key->y1;
+
+    // the head node is the last node output
+    return P_CrossBSPNode (trace, numnodes-1);
+}
+
+
+//
+// P_SightHash
+//
+static unsigned
+P_SightHash
+( fixed_t	x1,
+  fixed_t	y1,
+  fixed_t	z1,
+  fixed_t	x2,
+  fixed_t	y2,
+  fixed_t	z2 )
+{
+    unsigned	hash;
+
+    hash = (unsigned) (x1 ^ (y1 >> 3) ^ (x2 >> 6) ^ (y2 >> 9)
+		       ^ (z1 >> 12) ^ (z2 >> 15));
+    hash ^= hash >> 16;
+    return hash ^ (hash >> 8);
+}
+
+
+//
+// P_SameSight
+//
+static bool
+P_SameSight
+( sightcache_t*	entry,
+  mobj_t*	t1,
+  fixed_t	eyez,
+  mobj_t*	t2 )
+{
+    return entry->stamp == sightstamp
+	&& entry->x1 == t1->x
+	&& entry->y1 == t1->y
+	&& entry->z1 == eyez
+	&& entry->x2 == t2->x
+	&& entry->y2 == t2->y
+	&& entry->z2 == t2->z
+	&& entry->height2 == t2->height;
 }
 
 
@@ -297,8 +466,8 @@ bool P_CrossBSPNode (int bspnum)
 //  if a straight line between t1 and t2 is unobstructed.
 // Uses REJECT.
 //
-bool
-P_CheckSight
+static bool
+P_DoCheckSight
 ( mobj_t*	t1,
   mobj_t*	t2 )
 {
@@ -307,6 +476,10 @@ P_CheckSight
     int		pnum;
     int		bytenum;
     int		bitnum;
+    fixed_t	eyez;
+    unsigned	hash;
+    sightcache_t*	cache;
+    sightcache_t*	prediction;
     
     // First check for trivial rejection.
 
@@ -330,21 +503,354 @@ P_CheckSight
     // Now look from eyes of t1 to any part of t2.
     sightcounts[1]++;
 
-    validcount++;
-	
-    sightzstart = t1->z + t1->height - (t1->height>>2);
-    topslope = (t2->z+t2->height) - sightzstart;
-    bottomslope = (t2->z) - sightzstart;
-	
-    strace.x = t1->x;
-    strace.y = t1->y;
-    t2x = t2->x;
-    t2y = t2->y;
-    strace.dx = t2->x - t1->x;
-    strace.dy = t2->y - t1->y;
+    eyez = t1->z + t1->height - (t1->height>>2);
 
-    // the head node is the last node output
-    return P_CrossBSPNode (numnodes-1);	
+    hash = P_SightHash (t1->x, t1->y, eyez, t2->x, t2->y, t2->z);
+    cache = &sightcache[hash & (SIGHTCACHESIZE-1)];
+
+    if (P_SameSight (cache, t1, eyez, t2))
+	return cache->result;
+
+    // traced ahead for this tic, if neither has moved since
+    if (predictions)
+    {
+	for (prediction = &predictions[hash & predictmask] ;
+	     prediction->stamp == sightstamp ;
+	     prediction = &predictions[(prediction - predictions + 1) & predictmask])
+	{
+	    if (P_SameSight (prediction, t1, eyez, t2))
+	    {
+		*cache = *prediction;
+		return cache->result;
+	    }
+	}
+    }
+
+    cache->x1 = t1->x;
+    cache->y1 = t1->y;
+    cache->z1 = eyez;
+    cache->x2 = t2->x;
+    cache->y2 = t2->y;
+    cache->z2 = t2->z;
+    cache->height2 = t2->height;
+    cache->stamp = sightstamp;
+    cache->result = P_TraceSight (&sighttrace, cache);
+
+    return cache->result;
+}
+
+
+//
+// P_CheckSight
+// P_DoCheckSight, timed under -benchplaysim.
+//
+bool
+P_CheckSight
+( mobj_t*	t1,
+  mobj_t*	t2 )
+{
+    bool	result;
+
+    if (!playsimbench)
+	return P_DoCheckSight (t1, t2);
+
+    P_StartHelper (HELPER_SIGHT);
+    result = P_DoCheckSight (t1, t2);
+    P_EndHelper (HELPER_SIGHT);
+    return result;
 }
 
 
+
+
+
+//
+// Sight threads.
+// The main thread wakes the others for a round, takes its
+//  own stripe of the work, and waits for theirs.
+//
+#ifndef _WIN32
+
+static sighttrace_t*	sighttraces;
+
+static pthread_mutex_t	sightlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	sightstart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	sightdone = PTHREAD_COND_INITIALIZER;
+static unsigned		sightround;
+static int		sightbusy;
+
+// Started by the first tic that needs them, so that the
+//  sessions -server forks each have their own.
+static bool		sightstarted;
+
+
+//
+// P_TraceStripe
+//
+static void P_TraceStripe (int stripe)
+{
+    int		i;
+
+    for (i = stripe ; i < numpredictwork ; i += sightthreads + 1)
+	predictwork[i]->result = P_TraceSight (&sighttraces[stripe], predictwork[i]);
+}
+
+
+//
+// P_SightThread
+//
+static void *P_SightThread (void *arg)
+{
+    int		stripe;
+    unsigned	round;
+
+    stripe = (int) (intptr_t) arg;
+    round = 0;
+
+    while (1)
+    {
+	pthread_mutex_lock (&sightlock);
+	while (sightround == round)
+	    pthread_cond_wait (&sightstart, &sightlock);
+	round = sightround;
+	pthread_mutex_unlock (&sightlock);
+
+	P_TraceStripe (stripe);
+
+	pthread_mutex_lock (&sightlock);
+	if (--sightbusy == 0)
+	    pthread_cond_signal (&sightdone);
+	pthread_mutex_unlock (&sightlock);
+    }
+
+    return NULL;
+}
+
+
+//
+// P_StartSightThreads
+//
+static void P_StartSightThreads (void)
+{
+    int		i;
+
+    for (i = 1 ; i <= sightthreads ; i++)
+    {
+	pthread_t	thread;
+
+	if (pthread_create (&thread, NULL, P_SightThread, (void *) (intptr_t) i))
+	    I_Error ("P_StartSightThreads: couldn't start sight thread %i", i);
+	pthread_detach (thread);
+    }
+
+    sightstarted = true;
+}
+
+#endif
+
+
+//
+// P_InitSight
+//
+void P_InitSight (void)
+{
+    int		p;
+
+    //!
+    // @arg <n>
+    //
+    // Trace, on n more threads, whether the monsters about to
+    // look or chase can see their targets, before the thinkers
+    // of each tic run. A monster or target that moves first is
+    // traced again as usual, so demos play back the same. For
+    // maps with hundreds of monsters. Not on Windows.
+    //
+
+    p = M_CheckParmWithArgs ("-sightthreads", 1);
+
+    if (!p)
+	return;
+
+#ifndef _WIN32
+    sightthreads = atoi (myargv[p+1]);
+
+    if (sightthreads < 1)
+	I_Error ("P_InitSight: -sightthreads needs at least one thread");
+
+    sighttraces = calloc (sightthreads + 1, sizeof(*sighttraces));
+#endif
+}
+
+
+#ifndef _WIN32
+
+void A_Look();
+void A_Chase();
+void A_VileChase();
+
+
+//
+// P_AddPrediction
+// Queues the sight of t2 from t1 to be traced, unless
+//  REJECT rules it out or it already is.
+//
+static void P_AddPrediction (mobj_t* t1, mobj_t* t2)
+{
+    int		pnum;
+    fixed_t	eyez;
+    unsigned	hash;
+    sightcache_t*	entry;
+
+    if (t2 == NULL || numpredictwork == maxpredictwork)
+	return;
+
+    pnum = (t1->subsector->sector - sectors) * numsectors
+	 + (t2->subsector->sector - sectors);
+
+    if (rejectmatrix[pnum>>3] & (1 << (pnum&7)))
+	return;
+
+    eyez = t1->z + t1->height - (t1->height>>2);
+    hash = P_SightHash (t1->x, t1->y, eyez, t2->x, t2->y, t2->z);
+
+    for (entry = &predictions[hash & predictmask] ;
+	 entry->stamp == sightstamp ;
+	 entry = &predictions[(entry - predictions + 1) & predictmask])
+    {
+	if (P_SameSight (entry, t1, eyez, t2))
+	    return;
+    }
+
+    entry->x1 = t1->x;
+    entry->y1 = t1->y;
+    entry->z1 = eyez;
+    entry->x2 = t2->x;
+    entry->y2 = t2->y;
+    entry->z2 = t2->z;
+    entry->height2 = t2->height;
+    entry->stamp = sightstamp;
+    entry->result = false;
+
+    predictwork[numpredictwork++] = entry;
+}
+
+
+//
+// P_PredictMobj
+// A monster whose state runs out this tic, going to one
+//  that looks for or chases its target.
+//
+static void P_PredictMobj (mobj_t* mo)
+{
+    actionf_p1	action;
+    int		i;
+
+    if (mo->tics != 1)
+	return;
+
+    action = states[mo->state->nextstate].action.acp1;
+
+    if (action == (actionf_p1) A_Look)
+    {
+	if (mo->flags & MF_AMBUSH)
+	    P_AddPrediction (mo, mo->subsector->sector->soundtarget);
+    }
+    else if (action == (actionf_p1) A_Chase
+	     || action == (actionf_p1) A_VileChase)
+    {
+	if (mo->target && mo->target->health > 0
+	    && (mo->target->flags & MF_SHOOTABLE))
+	{
+	    P_AddPrediction (mo, mo->target);
+	    return;
+	}
+    }
+    else
+    {
+	return;
+    }
+
+    for (i = 0 ; i < MAXPLAYERS ; i++)
+    {
+	if (playeringame[i] && players[i].mo && players[i].health > 0)
+	    P_AddPrediction (mo, players[i].mo);
+    }
+}
+
+#endif
+
+
+//
+// P_PredictSight
+// Called before the thinkers run.
+//
+void P_PredictSight (void)
+{
+#ifndef _WIN32
+    thinker_t*	th;
+    int		count;
+    int		size;
+
+    if (!sightthreads)
+	return;
+
+    numpredictwork = 0;
+
+    count = 0;
+    for (th = thinkercap.runnext ; th != &thinkercap ; th = th->runnext)
+    {
+	if (th->function.acp1 == (actionf_p1) P_MobjThinker
+	    && ((mobj_t *) th)->tics == 1)
+	    count++;
+    }
+
+    if (count < MINPREDICTIONS)
+	return;
+
+    // each pair at most half full, so lookups end soon
+    maxpredictwork = count * (MAXPLAYERS + 1);
+    for (size = 1024 ; size < maxpredictwork * 2 ; size <<= 1)
+	;
+
+    if (size != predictmask + 1)
+    {
+	free (predictions);
+	free (predictwork);
+	predictions = calloc (size, sizeof(*predictions));
+	predictwork = malloc (size / 2 * sizeof(*predictwork));
+	if (predictions == NULL || predictwork == NULL)
+	    I_Error ("P_PredictSight: couldn't allocate %i predictions", size);
+	predictmask = size - 1;
+    }
+
+    for (th = thinkercap.runnext ; th != &thinkercap ; th = th->runnext)
+    {
+	if (th->function.acp1 == (actionf_p1) P_MobjThinker)
+	    P_PredictMobj ((mobj_t *) th);
+    }
+
+    if (numpredictwork < MINPREDICTIONS)
+    {
+	// not worth waking the threads, so traced as they are needed
+	while (numpredictwork)
+	    predictwork[--numpredictwork]->stamp = 0;
+	return;
+    }
+
+    if (!sightstarted)
+	P_StartSightThreads ();
+
+    pthread_mutex_lock (&sightlock);
+    sightbusy = sightthreads;
+    sightround++;
+    pthread_cond_broadcast (&sightstart);
+    pthread_mutex_unlock (&sightlock);
+
+    P_TraceStripe (0);
+
+    pthread_mutex_lock (&sightlock);
+    while (sightbusy)
+	pthread_cond_wait (&sightdone, &sightlock);
+    pthread_mutex_unlock (&sightlock);
+#endif
+}
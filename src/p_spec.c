@@ -75,11 +75,6 @@ typedef struct
 
 
 
-#define MAXANIMS                32
-
-extern anim_t	anims[MAXANIMS];
-extern anim_t*	lastanim;
-
 //
 // P_InitPicAnims
 //
@@ -126,17 +121,16 @@ animdef_t		animdefs[] =
     {-1,        "",             "",             0},
 };
 
-anim_t		anims[MAXANIMS];
+// One for each sequence in animdefs, at most
+anim_t		anims[arrlen(animdefs) - 1];
 anim_t*		lastanim;
 
 
 //
 //      Animating line specials
 //
-#define MAXLINEANIMS            64
-
-extern  short	numlinespecials;
-extern  line_t*	linespeciallist[MAXLINEANIMS];
+extern  int	numlinespecials;
+extern  line_t**	linespeciallist;
 
 
 
@@ -262,6 +256,59 @@ getNextSector
 
 
 
+//
+// P_InitSectorLinks
+// The neighbors of each sector, as getNextSector
+//  finds them through its lines, and the tag hash.
+//
+static int	taghash[TAGHASHSIZE];
+
+void P_InitSectorLinks (void)
+{
+    sector_t**	buffer;
+    sector_t*	sector;
+    sector_t*	other;
+    int		total;
+    int		i;
+    int		j;
+
+    total = 0;
+    for (i=0 ; i<numsectors ; i++)
+	total += sectors[i].linecount;
+
+    buffer = Z_LevelMalloc ((total + 1) * sizeof(*buffer));
+
+    for (i=0, sector=sectors ; i<numsectors ; i++, sector++)
+    {
+	validcount++;
+	sector->neighbors = buffer;
+	sector->neighborcount = 0;
+
+	for (j=0 ; j<sector->linecount ; j++)
+	{
+	    other = getNextSector (sector->lines[j], sector);
+
+	    if (!other || other->validcount == validcount)
+		continue;
+
+	    other->validcount = validcount;
+	    sector->neighbors[sector->neighborcount++] = other;
+	}
+
+	buffer += sector->neighborcount;
+    }
+
+    for (i=0 ; i<TAGHASHSIZE ; i++)
+	taghash[i] = -1;
+
+    for (i=numsectors-1 ; i>=0 ; i--)
+    {
+	sectors[i].tagnext = taghash[sectors[i].tag & (TAGHASHSIZE-1)];
+	taghash[sectors[i].tag & (TAGHASHSIZE-1)] = i;
+    }
+}
+
+
 //
 // P_FindLowestFloorSurrounding()
 // FIND LOWEST FLOOR HEIGHT IN SURROUNDING SECTORS
@@ -269,17 +316,12 @@ getNextSector
 fixed_t	P_FindLowestFloorSurrounding(sector_t* sec)
 {
     int			i;
-    line_t*		check;
     sector_t*		other;
     fixed_t		floor = sec->floorheight;
 	
-    for (i=0 ;i < sec->linecount ; i++)
+    for (i=0 ;i < sec->neighborcount ; i++)
     {
-	check = sec->lines[i];
-	other = getNextSector(check,sec);
-
-	if (!other)
-	    continue;
+	other = sec->neighbors[i];
 	
 	if (other->floorheight < floor)
 	    floor = other->floorheight;
@@ -296,17 +338,12 @@ fixed_t	P_FindLowestFloorSurrounding(sector_t* sec)
 fixed_t	P_FindHighestFloorSurrounding(sector_t *sec)
 {
     int			i;
-    line_t*		check;
     sector_t*		other;
     fixed_t		floor = -500*FRACUNIT;
 	
-    for (i=0 ;i < sec->linecount ; i++)
+    for (i=0 ;i < sec->neighborcount ; i++)
     {
-	check = sec->lines[i];
-	other = getNextSector(check,sec);
-	
-	if (!other)
-	    continue;
+	other = sec->neighbors[i];
 	
 	if (other->floorheight > floor)
 	    floor = other->floorheight;
@@ -339,6 +376,25 @@ P_FindNextHighestFloor
     fixed_t     height = currentheight;
     fixed_t     heightlist[MAX_ADJOINING_SECTORS + 2];
 
+    // Too few lines to overflow, so only the lowest
+    // of the neighbors matters.
+    if (sec->linecount <= MAX_ADJOINING_SECTORS)
+    {
+        for (i=0, h=0; i < sec->neighborcount; i++)
+        {
+            other = sec->neighbors[i];
+
+            if (other->floorheight > currentheight
+             && (!h || other->floorheight < height))
+            {
+                height = other->floorheight;
+                h = 1;
+            }
+        }
+
+        return height;
+    }
+
     for (i=0, h=0; i < sec->linecount; i++)
     {
         check = sec->lines[i];
@@ -392,17 +448,12 @@ fixed_t
 P_FindLowestCeilingSurrounding(sector_t* sec)
 {
     int			i;
-    line_t*		check;
     sector_t*		other;
     fixed_t		height = INT_MAX;
 	
-    for (i=0 ;i < sec->linecount ; i++)
+    for (i=0 ;i < sec->neighborcount ; i++)
     {
-	check = sec->lines[i];
-	other = getNextSector(check,sec);
-
-	if (!other)
-	    continue;
+	other = sec->neighbors[i];
 
 	if (other->ceilingheight < height)
 	    height = other->ceilingheight;
@@ -417,17 +468,12 @@ P_FindLowestCeilingSurrounding(sector_t* sec)
 fixed_t	P_FindHighestCeilingSurrounding(sector_t* sec)
 {
     int		i;
-    line_t*	check;
     sector_t*	other;
     fixed_t	height = 0;
 	
-    for (i=0 ;i < sec->linecount ; i++)
+    for (i=0 ;i < sec->neighborcount ; i++)
     {
-	check = sec->lines[i];
-	other = getNextSector(check,sec);
-
-	if (!other)
-	    continue;
+	other = sec->neighbors[i];
 
 	if (other->ceilingheight > height)
 	    height = other->ceilingheight;
@@ -439,6 +485,8 @@ fixed_t	P_FindHighestCeilingSurrounding(sector_t* sec)
 
 //
 // RETURN NEXT SECTOR # THAT LINE TAG REFERS TO
+// Each hash chain is in sector order, so following
+//  it from start finds the same sectors as a scan.
 //
 int
 P_FindSectorFromLineTag
@@ -446,8 +494,21 @@ P_FindSectorFromLineTag
   int		start )
 {
     int	i;
-	
-    for (i=start+1;i<numsectors;i++)
+
+    if (start < 0)
+	i = taghash[line->tag & (TAGHASHSIZE-1)];
+    else if (sectors[start].tag == line->tag)
+	i = sectors[start].tagnext;
+    else
+    {
+	for (i=start+1;i<numsectors;i++)
+	    if (sectors[i].tag == line->tag)
+		return i;
+
+	return -1;
+    }
+
+    for ( ; i >= 0 ; i = sectors[i].tagnext)
 	if (sectors[i].tag == line->tag)
 	    return i;
     
@@ -467,17 +528,12 @@ P_FindMinSurroundingLight
 {
     int		i;
     int		min;
-    line_t*	line;
     sector_t*	check;
 	
     min = max;
-    for (i=0 ; i < sector->linecount ; i++)
+    for (i=0 ; i < sector->neighborcount ; i++)
     {
-	line = sector->lines[i];
-	check = getNextSector(line,sector);
-
-	if (!check)
-	    continue;
+	check = sector->neighbors[i];
 
 	if (check->lightlevel < min)
 	    min = check->lightlevel;
@@ -1135,7 +1191,7 @@ void P_UpdateSpecials (void)
 
     
     //	DO BUTTONS
-    for (i = 0; i < MAXBUTTONS; i++)
+    for (i = 0; i < numbuttons; i++)
 	if (buttonlist[i].btimer)
 	{
 	    buttonlist[i].btimer--;
@@ -1325,7 +1381,7 @@ int EV_DoDonut(line_t*	line)
             }
 
 	    //	Spawn rising slime
-	    floor = Z_Malloc (sizeof(*floor), PU_LEVSPEC, 0);
+	    floor = Z_PoolMalloc (sizeof(*floor));
 	    P_AddThinker (&floor->thinker);
 	    s2->specialdata = floor;
 	    floor->thinker.function.acp1 = (actionf_p1) T_MoveFloor;
@@ -1339,7 +1395,7 @@ int EV_DoDonut(line_t*	line)
 	    floor->floordestheight = s3_floorheight;
 	    
 	    //	Spawn lowering donut-hole
-	    floor = Z_Malloc (sizeof(*floor), PU_LEVSPEC, 0);
+	    floor = Z_PoolMalloc (sizeof(*floor));
 	    P_AddThinker (&floor->thinker);
 	    s1->specialdata = floor;
 	    floor->thinker.function.acp1 = (actionf_p1) T_MoveFloor;
@@ -1366,8 +1422,8 @@ int EV_DoDonut(line_t*	line)
 // After the map has been loaded, scan for specials
 //  that spawn thinkers
 //
-short		numlinespecials;
-line_t*		linespeciallist[MAXLINEANIMS];
+int		numlinespecials;
+line_t**	linespeciallist;
 
 
 // Parses command line parameters.
@@ -1456,16 +1512,17 @@ void P_SpawnSpecials (void)
     
     //	Init line EFFECTs
     numlinespecials = 0;
+    for (i = 0;i < numlines; i++)
+	if (lines[i].special == 48)
+	    numlinespecials++;
+
+    linespeciallist = Z_LevelMalloc ((numlinespecials + 1) * sizeof(*linespeciallist));
+    numlinespecials = 0;
     for (i = 0;i < numlines; i++)
     {
 	switch(lines[i].special)
 	{
 	  case 48:
-            if (numlinespecials >= MAXLINEANIMS)
-            {
-                I_Error("Too many scrolling wall linedefs! "
-                        "(Vanilla limit is 64)");
-            }
 	    // EFFECT FIRSTCOL SCROLL+
 	    linespeciallist[numlinespecials] = &lines[i];
 	    numlinespecials++;
@@ -1475,13 +1532,13 @@ void P_SpawnSpecials (void)
 
     
     //	Init other misc stuff
-    for (i = 0;i < MAXCEILINGS;i++)
+    for (i = 0;i < TAGHASHSIZE;i++)
 	activeceilings[i] = NULL;
 
-    for (i = 0;i < MAXPLATS;i++)
+    for (i = 0;i < TAGHASHSIZE;i++)
 	activeplats[i] = NULL;
     
-    for (i = 0;i < MAXBUTTONS;i++)
+    for (i = 0;i < numbuttons;i++)
 	memset(&buttonlist[i],0,sizeof(button_t));
 
     // UNUSED: no horizonal sliders.
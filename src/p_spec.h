@@ -39,6 +39,7 @@ extern	int	levelTimeCount;
 void    P_InitPicAnims (void);
 
 // at map load
+void    P_InitSectorLinks (void);
 void    P_SpawnSpecials (void);
 
 // every tic
@@ -170,11 +171,26 @@ typedef struct
 } glow_t;
 
 
+
+// The lights spawned one after another, which would
+//  come one after another in the thinker list, are
+//  kept in one thinker that runs them in that order.
+typedef struct
+{
+    thinker_t	thinker;
+    thinker_t**	lights;
+    int		numlights;
+    int		maxlights;
+
+} lightbatch_t;
+
+
 #define GLOWSPEED			8
 #define STROBEBRIGHT		5
 #define FASTDARK			15
 #define SLOWDARK			35
 
+void    T_FireFlicker (fireflicker_t* flick);
 void    P_SpawnFireFlicker (sector_t* sector);
 void    T_LightFlash (lightflash_t* flash);
 void    P_SpawnLightFlash (sector_t* sector);
@@ -197,6 +213,9 @@ EV_LightTurnOn
 void    T_Glow(glow_t* g);
 void    P_SpawnGlowingLight(sector_t* sector);
 
+void    T_RunLights(lightbatch_t* batch);
+void    P_AddLight(thinker_t* light);
+
 
 
 
@@ -237,13 +256,15 @@ typedef struct
  // max # of wall switches in a level
 #define MAXSWITCHES		50
 
- // 4 players, 4 buttons each at once, max.
+ // 4 players, 4 buttons each at once, to start with;
+ //  the list grows when a map presses more.
 #define MAXBUTTONS		16
 
  // 1 second, in ticks. 
 #define BUTTONTIME      35             
 
-extern button_t	buttonlist[MAXBUTTONS]; 
+extern button_t*	buttonlist;
+extern int		numbuttons;
 
 void
 P_ChangeSwitchTexture
@@ -252,6 +273,13 @@ P_ChangeSwitchTexture
 
 void P_InitSwitchList(void);
 
+void
+P_StartButton
+( line_t*	line,
+  bwhere_e	w,
+  int		texture,
+  int		time );
+
 
 //
 // P_PLATS
@@ -279,7 +307,7 @@ typedef enum
 
 
 
-typedef struct
+typedef struct plat_s
 {
     thinker_t	thinker;
     sector_t*	sector;
@@ -293,6 +321,10 @@ typedef struct
     bool	crush;
     int		tag;
     plattype_e	type;
+
+    // The other active plats with the same tag hash
+    struct plat_s*	tagnext;
+    struct plat_s**	tagprev;
     
 } plat_t;
 
@@ -300,10 +332,12 @@ typedef struct
 
 #define PLATWAIT		3
 #define PLATSPEED		FRACUNIT
-#define MAXPLATS		30
 
+// Active plats and ceilings are chained by tag,
+//  hashed as the sectors are.
+#define TAGHASHSIZE		256
 
-extern plat_t*	activeplats[MAXPLATS];
+extern plat_t*	activeplats[TAGHASHSIZE];
 
 void    T_PlatRaise(plat_t*	plat);
 
@@ -487,7 +521,7 @@ typedef enum
 
 
 
-typedef struct
+typedef struct ceiling_s
 {
     thinker_t	thinker;
     ceiling_e	type;
@@ -503,6 +537,10 @@ typedef struct
     // ID
     int		tag;                   
     int		olddirection;
+
+    // The other active ceilings with the same tag hash
+    struct ceiling_s*	tagnext;
+    struct ceiling_s**	tagprev;
     
 } ceiling_t;
 
@@ -512,9 +550,8 @@ typedef struct
 
 #define CEILSPEED		FRACUNIT
 #define CEILWAIT		150
-#define MAXCEILINGS		30
 
-extern ceiling_t*	activeceilings[MAXCEILINGS];
+extern ceiling_t*	activeceilings[TAGHASHSIZE];
 
 int
 EV_DoCeiling
@@ -524,6 +561,7 @@ EV_DoCeiling
 void    T_MoveCeiling (ceiling_t* ceiling);
 void    P_AddActiveCeiling(ceiling_t* c);
 void    P_RemoveActiveCeiling(ceiling_t* c);
+bool    P_IsActiveCeiling(thinker_t* th);
 int	EV_CeilingCrushStop(line_t* line);
 void    P_ActivateInStasisCeiling(line_t* line);
 
@@ -18,6 +18,8 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "i_system.h"
 #include "deh_main.h"
@@ -92,7 +94,26 @@ switchlist_t alphSwitchList[] =
 
 int		switchlist[MAXSWITCHES * 2];
 int		numswitches;
-button_t        buttonlist[MAXBUTTONS];
+button_t*       buttonlist;
+int             numbuttons;
+
+//
+// P_GrowButtons
+// Doubles the button list, from MAXBUTTONS,
+//  when every slot is counting down.
+//
+static void P_GrowButtons(void)
+{
+    int		oldnum;
+
+    oldnum = numbuttons;
+    numbuttons = oldnum ? oldnum * 2 : MAXBUTTONS;
+    buttonlist = realloc(buttonlist, numbuttons * sizeof(*buttonlist));
+    if (buttonlist == NULL)
+        I_Error("P_GrowButtons: out of memory");
+
+    memset(&buttonlist[oldnum], 0, (numbuttons - oldnum) * sizeof(*buttonlist));
+}
 
 //
 // P_InitSwitchList
@@ -106,6 +127,9 @@ void P_InitSwitchList(void)
 
     episode = 1;
 
+    if (!buttonlist)
+	P_GrowButtons();
+
     if (gamemode == registered || gamemode == retail)
 	episode = 2;
     else
@@ -155,7 +179,7 @@ P_StartButton
     int		i;
 
     // See if button is already pressed
-    for (i = 0;i < MAXBUTTONS;i++)
+    for (i = 0;i < numbuttons;i++)
     {
 	if (buttonlist[i].btimer
 	    && buttonlist[i].line == line)
@@ -167,20 +191,20 @@ P_StartButton
 
 
 
-    for (i = 0;i < MAXBUTTONS;i++)
+    for (i = 0;i < numbuttons;i++)
     {
 	if (!buttonlist[i].btimer)
-	{
-	    buttonlist[i].line = line;
-	    buttonlist[i].where = w;
-	    buttonlist[i].btexture = texture;
-	    buttonlist[i].btimer = time;
-	    buttonlist[i].soundorg = &line->frontsector->soundorg;
-	    return;
-	}
+	    break;
     }
 
-    I_Error("P_StartButton: no button slots left!");
+    if (i == numbuttons)
+	P_GrowButtons();
+
+    buttonlist[i].line = line;
+    buttonlist[i].where = w;
+    buttonlist[i].btexture = texture;
+    buttonlist[i].btimer = time;
+    buttonlist[i].soundorg = &line->frontsector->soundorg;
 }
 
 
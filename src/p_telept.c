@@ -124,6 +124,7 @@ EV_Teleport
 
 		thing->angle = m->angle;
 		thing->momx = thing->momy = thing->momz = 0;
+		P_ResetOldPosition (thing);
 		return 1;
 	    }	
 	}
@@ -19,16 +19,22 @@
 
 
 #include "z_zone.h"
+#include "d_loop.h"
 #include "p_local.h"
+#include "p_tick.h"
+#include "p_bench.h"
+#include "m_trace.h"
 
 #include "doomstat.h"
 
 
 int	leveltime;
 
+extern int	prndindex;
+
 //
 // THINKERS
-// All thinkers should be allocated by Z_Malloc
+// All thinkers should be allocated by Z_PoolMalloc
 // so they can be operated on uniformly.
 // The actual structures will vary in size,
 // but the first element must be thinker_t.
@@ -39,13 +45,26 @@ int	leveltime;
 // Both the head and tail of the thinker list.
 thinker_t	thinkercap;
 
+// The sleeping thinkers, by the low bits of the
+//  leveltime they wake at, each slot the head and
+//  tail of its list.
+#define SLEEPSLOTS	64
+
+static thinker_t	sleepslots[SLEEPSLOTS];
+
 
 //
 // P_InitThinkers
 //
 void P_InitThinkers (void)
 {
+    int		i;
+
     thinkercap.prev = thinkercap.next  = &thinkercap;
+    thinkercap.runprev = thinkercap.runnext = &thinkercap;
+
+    for (i=0 ; i<SLEEPSLOTS ; i++)
+	sleepslots[i].wakeprev = sleepslots[i].wakenext = &sleepslots[i];
 }
 
 
@@ -61,6 +80,14 @@ void P_AddThinker (thinker_t* thinker)
     thinker->next = &thinkercap;
     thinker->prev = thinkercap.prev;
     thinkercap.prev = thinker;
+
+    thinkercap.runprev->runnext = thinker;
+    thinker->runnext = &thinkercap;
+    thinker->runprev = thinkercap.runprev;
+    thinkercap.runprev = thinker;
+
+    thinker->waketic = 0;
+    thinker->wakenext = NULL;
 }
 
 
@@ -74,6 +101,106 @@ void P_RemoveThinker (thinker_t* thinker)
 {
   // FIXME: NOP.
   thinker->function.acv = (actionf_v)(-1);
+
+  // it has to come up to be freed
+  P_WakeThinker (thinker);
+}
+
+
+
+//
+// P_ParkThinker
+// Called by a thinker that will do nothing on its
+//  following turns, until something changes it and
+//  calls P_WakeThinker. Only called as it returns,
+//  runnext is left for P_RunThinkers to follow.
+//
+void P_ParkThinker (thinker_t* thinker)
+{
+    if (!thinker->runprev)
+	return;
+
+    thinker->runprev->runnext = thinker->runnext;
+    thinker->runnext->runprev = thinker->runprev;
+    thinker->runprev = NULL;
+}
+
+
+
+//
+// P_SleepThinker
+// Parks a thinker that will do nothing but count down
+//  until leveltime reaches waketic, when P_RunThinkers
+//  wakes it for its turn of that tic. Anything that
+//  changes it before then wakes it as a parked one.
+//
+void P_SleepThinker (thinker_t* thinker, int waketic)
+{
+    thinker_t*	slot;
+
+    P_ParkThinker (thinker);
+
+    slot = &sleepslots[waketic & (SLEEPSLOTS-1)];
+    thinker->waketic = waketic;
+    thinker->wakeprev = slot->wakeprev;
+    thinker->wakenext = slot;
+    slot->wakeprev->wakenext = thinker;
+    slot->wakeprev = thinker;
+}
+
+
+
+//
+// P_WakeThinker
+// Puts a parked thinker back in its place, after the
+//  closest thinker before it that isn't parked.
+//
+void P_WakeThinker (thinker_t* thinker)
+{
+    thinker_t*	prev;
+
+    if (thinker->runprev)
+	return;
+
+    if (thinker->wakenext)
+    {
+	thinker->wakeprev->wakenext = thinker->wakenext;
+	thinker->wakenext->wakeprev = thinker->wakeprev;
+	thinker->wakenext = NULL;
+    }
+
+    prev = thinker->prev;
+    while (prev != &thinkercap && !prev->runprev)
+	prev = prev->prev;
+
+    thinker->runprev = prev;
+    thinker->runnext = prev->runnext;
+    prev->runnext->runprev = thinker;
+    prev->runnext = thinker;
+}
+
+
+
+//
+// P_WakeSleepers
+// Wakes the thinkers due this tic, the others in the
+//  slot being due a lap of the wheel or more later.
+//
+static void P_WakeSleepers (void)
+{
+    thinker_t*	slot;
+    thinker_t*	thinker;
+    thinker_t*	next;
+
+    slot = &sleepslots[leveltime & (SLEEPSLOTS-1)];
+
+    for (thinker = slot->wakenext ; thinker != slot ; thinker = next)
+    {
+	next = thinker->wakenext;
+
+	if (thinker->waketic == leveltime)
+	    P_WakeThinker (thinker);
+    }
 }
 
 
@@ -90,32 +217,90 @@ void P_AllocateThinker (thinker_t*	thinker)
 
 //
 // P_RunThinkers
+// Thinkers run in list order, not a kind at a time from
+//  arrays of their own: the order decides the order of
+//  the P_Random calls, which demos and netgames depend on.
 //
+int	peakthinkers;
+
 void P_RunThinkers (void)
 {
     thinker_t*	currentthinker;
+    int		count;
 
-    currentthinker = thinkercap.next;
+    P_WakeSleepers ();
+
+    count = 0;
+
+    // Parked thinkers would do nothing, and it
+    //  makes no difference when they are skipped.
+    currentthinker = thinkercap.runnext;
     while (currentthinker != &thinkercap)
     {
+	// The next one can be anywhere in the pool slabs,
+	//  which are kept by size, not kind, and reused as
+	//  thinkers are freed. Fetch it while this one thinks.
+	PREFETCH (currentthinker->runnext);
+
 	if ( currentthinker->function.acv == (actionf_v)(-1) )
 	{
 	    // time to remove it
 	    currentthinker->next->prev = currentthinker->prev;
 	    currentthinker->prev->next = currentthinker->next;
-	    Z_Free (currentthinker);
+	    currentthinker->runnext->runprev = currentthinker->runprev;
+	    currentthinker->runprev->runnext = currentthinker->runnext;
+	    Z_PoolFree (currentthinker);
 	}
 	else
 	{
-	    if (currentthinker->function.acp1)
+	    if (playsimbench && currentthinker->function.acp1)
+		P_BenchThinker (currentthinker);
+	    else if (currentthinker->function.acp1)
 		currentthinker->function.acp1 (currentthinker);
+	    count++;
 	}
-	currentthinker = currentthinker->next;
+	currentthinker = currentthinker->runnext;
     }
+
+    if (count > peakthinkers)
+	peakthinkers = count;
 }
 
 
 
+//
+// P_SaveOldPositions
+// With -uncapped, frames drawn before the next tic show
+//  things part way from where this one starts.
+//
+int	oldpositionstic = -1;
+
+static void P_SaveOldPositions (void)
+{
+    thinker_t*	th;
+    mobj_t*	mo;
+    int		i;
+
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	if (th->function.acp1 != (actionf_p1) P_MobjThinker)
+	    continue;
+
+	mo = (mobj_t *) th;
+	mo->oldx = mo->x;
+	mo->oldy = mo->y;
+	mo->oldz = mo->z;
+	mo->oldangle = mo->angle;
+    }
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+	if (playeringame[i])
+	    players[i].oldviewz = players[i].viewz;
+
+    oldpositionstic = gametic;
+}
+
+
 //
 // P_Ticker
 //
@@ -137,15 +322,114 @@ void P_Ticker (void)
 	return;
     }
     
+    if (uncapped)
+	P_SaveOldPositions ();
 		
+    P_FlushSightCache ();
+
     for (i=0 ; i<MAXPLAYERS ; i++)
 	if (playeringame[i])
 	    P_PlayerThink (&players[i]);
+
+    P_PredictSight ();
 			
+    TRACE_BEGIN ("P_RunThinkers");
     P_RunThinkers ();
+    TRACE_END ("P_RunThinkers");
     P_UpdateSpecials ();
     P_RespawnSpecials ();
 
     // for par times
     leveltime++;	
 }
+
+
+//
+// P_HashState
+// A hash of everything in the playsim that demos
+//  depend on, for telling when two runs part.
+//
+static unsigned int	statehash;
+
+static void P_HashInt (int value)
+{
+    int		i;
+
+    // FNV-1a, a byte at a time
+    for (i=0 ; i<4 ; i++)
+    {
+	statehash = (statehash ^ (value & 0xff)) * 16777619u;
+	value >>= 8;
+    }
+}
+
+unsigned int P_HashState (void)
+{
+    thinker_t*	th;
+    mobj_t*	mo;
+    player_t*	player;
+    int		i;
+    int		j;
+
+    statehash = 2166136261u;
+
+    P_HashInt (leveltime);
+    P_HashInt (prndindex);
+
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	if (th->function.acp1 != (actionf_p1) P_MobjThinker)
+	    continue;
+
+	mo = (mobj_t *) th;
+	P_HashInt (mo->type);
+	P_HashInt (mo->x);
+	P_HashInt (mo->y);
+	P_HashInt (mo->z);
+	P_HashInt (mo->momx);
+	P_HashInt (mo->momy);
+	P_HashInt (mo->momz);
+	P_HashInt (mo->angle);
+	P_HashInt (mo->state - states);
+	P_HashInt (P_MobjTics (mo));
+	P_HashInt (mo->flags);
+	P_HashInt (mo->health);
+	P_HashInt (mo->movedir);
+	P_HashInt (mo->movecount);
+	P_HashInt (mo->reactiontime);
+	P_HashInt (mo->threshold);
+    }
+
+    for (i=0 ; i<numsectors ; i++)
+    {
+	P_HashInt (sectors[i].floorheight);
+	P_HashInt (sectors[i].ceilingheight);
+	P_HashInt (sectors[i].lightlevel);
+	P_HashInt (sectors[i].special);
+    }
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+	if (!playeringame[i])
+	    continue;
+
+	player = &players[i];
+	P_HashInt (player->playerstate);
+	P_HashInt (player->viewz);
+	P_HashInt (player->health);
+	P_HashInt (player->armorpoints);
+	P_HashInt (player->readyweapon);
+	P_HashInt (player->killcount);
+	P_HashInt (player->itemcount);
+	P_HashInt (player->secretcount);
+
+	for (j=0 ; j<NUMAMMO ; j++)
+	    P_HashInt (player->ammo[j]);
+
+	for (j=0 ; j<NUMPSPRITES ; j++)
+	    P_HashInt (player->psprites[j].state
+		       ? player->psprites[j].state - states : -1);
+    }
+
+    return statehash;
+}
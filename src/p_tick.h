@@ -28,6 +28,16 @@
 // Carries out all thinking of monsters and players.
 void P_Ticker (void);
 
+// With -uncapped, the gametic of the last tic that moved things,
+// which keep where they were at its start.
+extern int oldpositionstic;
+
+// The most thinkers run in a tic.
+extern int peakthinkers;
+
+// A hash of the playsim, to compare runs by.
+unsigned int P_HashState (void);
+
 
 
 #endif
@@ -0,0 +1,253 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Per-level performance, for -perfdump.
+//	Each level played, from being loaded to being completed,
+//	or left by loading another, is a row of what it cost:
+//	the tics run, the frames drawn and dropped, each stage's
+//	mean and 99th percentile, the most drawsegs, vissprites,
+//	visplanes and thinkers it needed, the zone's peak use
+//	and the blocks purged, and the bytes sent. The rows are
+//	written at exit, tab separated, after a header.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+#include "m_timing.h"
+#include "p_tick.h"
+#include "r_local.h"
+#include "z_zone.h"
+
+#include "perfdump.h"
+
+
+typedef struct
+{
+    int			episode;
+    int			map;
+    bool		completed;
+    int			tics;
+    levelstages_t	stages;
+    int			drawsegs;
+    int			vissprites;
+    int			visplanes;
+    int			thinkers;
+    int			zonepeak;	// bytes, as sampled
+    int			purges;
+} levelperf_t;
+
+static char*		perfdumpfile;
+
+static levelperf_t*	levels;
+static int		numlevels;
+static int		maxlevels;
+
+// the level being played
+static bool		inlevel;
+static levelperf_t	level;
+static int		starttic;
+static int		startpurges;
+static int		lastsample;
+
+// the peaks from before it, for R_PrintPeaks at exit
+static int		rundrawsegs;
+static int		runvissprites;
+static int		runvisplanes;
+static int		runthinkers;
+
+
+static void PerfSampleZone (void)
+{
+    int		used;
+
+    used = Z_ZoneSize () - Z_FreeMemory ();
+
+    if (used > level.zonepeak)
+	level.zonepeak = used;
+
+    lastsample = I_GetTimeMS ();
+}
+
+
+//
+// PerfDumpTicker
+//
+void PerfDumpTicker (void)
+{
+    if (inlevel && I_GetTimeMS () - lastsample >= 1000)
+	PerfSampleZone ();
+}
+
+
+//
+// PerfLevelStart
+// The renderer's peaks are the level's from here,
+//  and the whole run's again once it ends.
+//
+void PerfLevelStart (void)
+{
+    levelstages_t	loading;
+
+    if (perfdumpfile == NULL)
+	return;
+
+    if (inlevel)
+	PerfLevelEnd ();
+
+    memset (&level, 0, sizeof(level));
+    level.episode = gameepisode;
+    level.map = gamemap;
+    starttic = gametic;
+    startpurges = Z_PurgeCount ();
+
+    rundrawsegs = peakdrawsegs;
+    runvissprites = peakvissprites;
+    runvisplanes = peakvisplanes;
+    runthinkers = peakthinkers;
+    peakdrawsegs = 0;
+    peakvissprites = 0;
+    peakvisplanes = 0;
+    peakthinkers = 0;
+
+    // the frames so far weren't the level's
+    M_FinishLevelStages (&loading);
+
+    inlevel = true;
+    PerfSampleZone ();
+}
+
+
+//
+// PerfLevelEnd
+//
+void PerfLevelEnd (void)
+{
+    if (!inlevel)
+	return;
+
+    inlevel = false;
+    level.completed = gamestate == GS_INTERMISSION;
+    level.tics = gametic - starttic;
+    level.purges = Z_PurgeCount () - startpurges;
+    level.drawsegs = peakdrawsegs;
+    level.vissprites = peakvissprites;
+    level.visplanes = peakvisplanes;
+    level.thinkers = peakthinkers;
+    M_FinishLevelStages (&level.stages);
+    PerfSampleZone ();
+
+    if (rundrawsegs > peakdrawsegs)
+	peakdrawsegs = rundrawsegs;
+    if (runvissprites > peakvissprites)
+	peakvissprites = runvissprites;
+    if (runvisplanes > peakvisplanes)
+	peakvisplanes = runvisplanes;
+    if (runthinkers > peakthinkers)
+	peakthinkers = runthinkers;
+
+    if (numlevels == maxlevels)
+    {
+	maxlevels = maxlevels ? maxlevels * 2 : 32;
+	levels = realloc (levels, maxlevels * sizeof(*levels));
+	if (levels == NULL)
+	    I_Error ("PerfLevelEnd: out of memory");
+    }
+
+    levels[numlevels++] = level;
+}
+
+
+//
+// PerfDump
+//
+static void PerfDump (void)
+{
+    levelperf_t*	l;
+    FILE*		f;
+    int			i;
+    int			j;
+
+    PerfLevelEnd ();
+
+    // "-" for stdout, as -statdump
+    f = strcmp (perfdumpfile, "-") ? fopen (perfdumpfile, "w") : stdout;
+
+    if (f == NULL)
+    {
+	fprintf (stderr, "PerfDump: couldn't write %s\n", perfdumpfile);
+	return;
+    }
+
+    fprintf (f, "level\tcompleted\ttics\tframes\tdropped");
+    for (j=0 ; j<NUMSTAGES ; j++)
+	fprintf (f, "\t%s_mean_us\t%s_p99_us", M_StageName (j), M_StageName (j));
+    fprintf (f, "\tdrawsegs\tvissprites\tvisplanes\tthinkers"
+		"\tzonepeak\tpurges\tbytes\n");
+
+    for (i=0 ; i<numlevels ; i++)
+    {
+	l = &levels[i];
+
+	if (gamemode == commercial)
+	    fprintf (f, "MAP%02i", l->map);
+	else
+	    fprintf (f, "E%iM%i", l->episode, l->map);
+
+	fprintf (f, "\t%i\t%i\t%i\t%i", l->completed, l->tics,
+		 l->stages.frames, l->stages.dropped);
+	for (j=0 ; j<NUMSTAGES ; j++)
+	    fprintf (f, "\t%.1f\t%.1f", l->stages.mean[j], l->stages.p99[j]);
+	fprintf (f, "\t%i\t%i\t%i\t%i\t%i\t%i\t%llu\n",
+		 l->drawsegs, l->vissprites, l->visplanes, l->thinkers,
+		 l->zonepeak, l->purges, (unsigned long long) l->stages.bytes);
+    }
+
+    if (f != stdout)
+	fclose (f);
+}
+
+
+//
+// PerfDumpInit
+//
+void PerfDumpInit (void)
+{
+    int		p;
+
+    //!
+    // @arg <file>
+    //
+    // Write a row for each level played to file, or - for
+    // stdout, at exit: the tics run, the frames drawn and
+    // dropped, the mean and 99th percentile time of each stage
+    // of a frame, the most drawsegs, vissprites, visplanes and
+    // thinkers, the zone's peak and purges, and the bytes sent.
+    //
+
+    p = M_CheckParmWithArgs ("-perfdump", 1);
+
+    if (!p)
+	return;
+
+    perfdumpfile = myargv[p+1];
+    M_KeepLevelStages ();
+    I_AtExit (PerfDump, true);
+}
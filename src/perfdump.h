@@ -0,0 +1,33 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Per-level performance, for -perfdump.
+//
+
+
+#ifndef __PERFDUMP__
+#define __PERFDUMP__
+
+// Called at startup, reads -perfdump.
+void	PerfDumpInit (void);
+
+// Called once a level is loaded, ending the last one
+//  if it wasn't.
+void	PerfLevelStart (void);
+
+// Called as a level is completed.
+void	PerfLevelEnd (void);
+
+// Called once a loop, samples the zone once a second.
+void	PerfDumpTicker (void);
+
+#endif
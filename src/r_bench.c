@@ -0,0 +1,228 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Drawer benchmark.
+//	With -benchdraw, each column and span drawer is run on
+//	its own over the textures, flats and colormaps of the
+//	IWAD, at a range of column heights and span lengths,
+//	into a screen of its own. The rate of each, in screen
+//	pixels written per nanosecond, is printed.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "doomdef.h"
+#include "doomgeneric.h"
+
+#include "i_system.h"
+#include "i_video.h"
+#include "w_wad.h"
+#include "z_zone.h"
+
+#include "r_local.h"
+#include "r_bench.h"
+
+
+// Differing setups the drawers go through in turn
+#define NUMSAMPLES	256
+
+// Pixels drawn for each length timed
+#define BENCHPIXELS	(1 << 22)
+
+extern int	numtextures;
+extern int	numflats;
+
+typedef struct
+{
+    char*	name;
+    void	(*func) (void);
+    bool	span;
+    int		shift;		// 1 for the low detail drawers
+} drawer_t;
+
+static const drawer_t drawers[] =
+{
+    { "R_DrawColumn",			R_DrawColumn,		false, 0 },
+    { "R_DrawColumnLow",		R_DrawColumnLow,	false, 1 },
+    { "R_DrawFuzzColumn",		R_DrawFuzzColumn,	false, 0 },
+    { "R_DrawTranslatedColumn",		R_DrawTranslatedColumn,	false, 0 },
+    { "R_DrawSpan",			R_DrawSpan,		true,  0 },
+    { "R_DrawSpanLow",			R_DrawSpanLow,		true,  1 },
+};
+
+#define NUMDRAWERS	(sizeof(drawers) / sizeof(*drawers))
+
+static const int columnlengths[] = { 1, 4, 16, 64, 128, SCREENHEIGHT };
+static const int spanlengths[] = { 1, 4, 16, 64, 160, SCREENWIDTH };
+
+#define NUMLENGTHS	(sizeof(columnlengths) / sizeof(*columnlengths))
+
+typedef struct
+{
+    byte*		source;
+    int			height;		// of the texture column
+    lighttable_t*	colormap;
+    byte*		translation;
+    byte*		flat;
+    fixed_t		xfrac;
+    fixed_t		yfrac;
+    fixed_t		step;
+} sample_t;
+
+static sample_t		samples[NUMSAMPLES];
+
+
+//
+// R_InitBenchSamples
+// Picks columns across the textures and flats,
+//  with every light level.
+//
+static void R_InitBenchSamples (void)
+{
+    sample_t*	s;
+    int		flats[NUMSAMPLES];
+    int		numfound;
+    int		tex;
+    int		i;
+
+    numfound = 0;
+
+    for (i=0 ; i<numflats && numfound<NUMSAMPLES ; i++)
+    {
+	// skip the F1_START markers and such
+	if (W_LumpLength (firstflat + i) == 64*64)
+	    flats[numfound++] = i;
+    }
+
+    if (numtextures < 2 || numfound == 0)
+	I_Error ("R_BenchDraw: no textures or flats to draw");
+
+    for (i=0 ; i<NUMSAMPLES ; i++)
+    {
+	s = &samples[i];
+
+	// texture 0 is never drawn
+	tex = 1 + (i * 7) % (numtextures - 1);
+	s->source = R_GetColumn (tex, (i * 13) & texturewidthmask[tex]);
+	s->height = textureheight[tex] >> FRACBITS;
+	s->colormap = colormaps + (i % NUMCOLORMAPS) * 256;
+	s->translation = translationtables + (i % 3) * 256;
+
+	s->flat = R_GetFlat (flats[(i * 3) % numfound]);
+	s->xfrac = i * 5 << FRACBITS;
+	s->yfrac = i * 11 << FRACBITS;
+	s->step = FRACUNIT / 4 + (i & 15) * FRACUNIT / 8;
+    }
+}
+
+
+//
+// R_TimeDrawer
+// Returns the screen pixels written per nanosecond.
+//
+static double R_TimeDrawer (const drawer_t *d, int length)
+{
+    sample_t*	s;
+    uint64_t	start;
+    uint64_t	elapsed;
+    int		width;
+    int		count;
+    int		i;
+
+    width = SCREENWIDTH >> d->shift;
+    count = BENCHPIXELS / length;
+    start = DG_GetTicksUs ();
+
+    for (i=0 ; i<count ; i++)
+    {
+	s = &samples[i & (NUMSAMPLES-1)];
+
+	if (d->span)
+	{
+	    ds_y = (i * 7) % SCREENHEIGHT;
+	    ds_x1 = (i * 13) % (width - length + 1);
+	    ds_x2 = ds_x1 + length - 1;
+	    ds_source = s->flat;
+	    ds_colormap = s->colormap;
+	    ds_xfrac = s->xfrac;
+	    ds_yfrac = s->yfrac;
+	    ds_xstep = s->step;
+	    ds_ystep = s->step / 2;
+	}
+	else
+	{
+	    // the column's texture is scaled over its height,
+	    //  as a wall seen from that far would be
+	    dc_x = (i * 13) % width;
+	    dc_yl = (i * 7) % (SCREENHEIGHT - length + 1);
+	    dc_yh = dc_yl + length - 1;
+	    dc_source = s->source;
+	    dc_colormap = s->colormap;
+	    dc_translation = s->translation;
+	    dc_iscale = (s->height << FRACBITS) / length;
+	    dc_texturemid = (centery - dc_yl) * dc_iscale;
+	}
+
+	d->func ();
+    }
+
+    elapsed = DG_GetTicksUs () - start;
+
+    if (elapsed == 0)
+	elapsed = 1;
+
+    return (double) count * (length << d->shift) / (elapsed * 1000.0);
+}
+
+
+//
+// R_BenchDraw
+//
+void R_BenchDraw (void)
+{
+    const drawer_t*	d;
+    const int*		lengths;
+    int			i;
+    int			j;
+
+    R_InitBenchSamples ();
+
+    // graphics aren't up yet, so the screen is the drawers'
+    //  own, as a full view without the status bar
+    I_VideoBuffer = Z_Malloc (SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);
+    R_InitBuffer (SCREENWIDTH, SCREENHEIGHT);
+    centery = viewheight / 2;
+
+    printf ("R_BenchDraw: %-24s %6s %10s\n", "drawer", "length", "pixels/ns");
+
+    for (i=0 ; i<NUMDRAWERS ; i++)
+    {
+	d = &drawers[i];
+	lengths = d->span ? spanlengths : columnlengths;
+
+	for (j=0 ; j<NUMLENGTHS ; j++)
+	{
+	    // the low detail spans are drawn twice as wide
+	    if (d->span && lengths[j] > SCREENWIDTH >> d->shift)
+		continue;
+
+	    printf ("R_BenchDraw: %-24s %6i %10.3f\n", d->name, lengths[j],
+		    R_TimeDrawer (d, lengths[j]));
+	}
+    }
+
+    // I_Quit only exits through ENDOOM, once the game has started
+    I_Quit ();
+    exit (0);
+}
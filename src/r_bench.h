@@ -0,0 +1,24 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Drawer benchmark.
+//
+
+
+#ifndef __R_BENCH__
+#define __R_BENCH__
+
+// Called once R_Init is done, with -benchdraw. Times the
+//  column and span drawers, prints the rates and quits.
+void	R_BenchDraw (void);
+
+#endif
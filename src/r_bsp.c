@@ -19,11 +19,14 @@
 
 
 
+#include <string.h>
+
 #include "doomdef.h"
 
 #include "m_bbox.h"
 
 #include "i_system.h"
+#include "z_zone.h"
 
 #include "r_main.h"
 #include "r_plane.h"
@@ -43,8 +46,12 @@ line_t*		linedef;
 sector_t*	frontsector;
 sector_t*	backsector;
 
-drawseg_t	drawsegs[MAXDRAWSEGS];
+// Grown by R_StoreWallRange when a frame needs more,
+//  and dropped back with the level.
+drawseg_t*	drawsegs;
 drawseg_t*	ds_p;
+static int	maxdrawsegs;
+int		peakdrawsegs;
 
 
 void
@@ -60,10 +67,44 @@ R_StoreWallRange
 //
 void R_ClearDrawSegs (void)
 {
+    if (drawsegs && ds_p - drawsegs > peakdrawsegs)
+	peakdrawsegs = ds_p - drawsegs;
+
+    if (!drawsegs)
+    {
+	maxdrawsegs = MAXDRAWSEGS;
+	drawsegs = Z_Malloc (maxdrawsegs * sizeof(*drawsegs),
+			     PU_LEVEL, &drawsegs);
+    }
+
     ds_p = drawsegs;
 }
 
 
+//
+// R_CheckDrawSegs
+// Makes room for a drawseg at ds_p.
+//
+void R_CheckDrawSegs (void)
+{
+    drawseg_t*	newsegs;
+    int		count;
+
+    if (ds_p < drawsegs + maxdrawsegs)
+	return;
+
+    count = ds_p - drawsegs;
+    maxdrawsegs *= 2;
+    newsegs = Z_Malloc (maxdrawsegs * sizeof(*newsegs), PU_LEVEL, NULL);
+    memcpy (newsegs, drawsegs, count * sizeof(*newsegs));
+    Z_Free (drawsegs);
+
+    drawsegs = newsegs;
+    Z_ChangeUser (drawsegs, (void **) &drawsegs);
+    ds_p = drawsegs + count;
+}
+
+
 
 //
 // ClipWallSegment
@@ -78,7 +119,9 @@ typedef	struct
 } cliprange_t;
 
 
-#define MAXSEGS		32
+// Solid ranges are at least a column apart,
+//  so a view can never have more than this.
+#define MAXSEGS		(SCREENWIDTH/2+4)
 
 // newend is one past the last valid seg
 cliprange_t*	newend;
@@ -232,6 +275,33 @@ R_ClipPassWallSegment
 
 
 
+//
+// The angles to vertexes and node box corners depend
+//  on where the view is, but not where it is facing.
+// They are kept for as long as the view stays put,
+//  one per vertex and two boxes per node. A stamp
+//  that doesn't match viewstamp means it is stale.
+//
+typedef struct
+{
+    angle_t	angle1;
+    angle_t	angle2;
+    unsigned	stamp;
+} bboxangles_t;
+
+typedef struct
+{
+    angle_t	angle;
+    unsigned	stamp;
+} vertexangle_t;
+
+static bboxangles_t*	bboxangles;
+static vertexangle_t*	vertexangles;
+static unsigned		viewstamp;
+static fixed_t		stampviewx;
+static fixed_t		stampviewy;
+
+
 //
 // R_ClearClipSegs
 //
@@ -242,8 +312,52 @@ void R_ClearClipSegs (void)
     solidsegs[1].first = viewwidth;
     solidsegs[1].last = 0x7fffffff;
     newend = solidsegs+2;
+
+    if (!bboxangles && numnodes)
+    {
+	Z_Malloc (numnodes * 2 * sizeof(*bboxangles), PU_LEVEL, &bboxangles);
+	memset (bboxangles, 0, numnodes * 2 * sizeof(*bboxangles));
+	viewstamp++;
+    }
+
+    if (!vertexangles)
+    {
+	Z_Malloc (numvertexes * sizeof(*vertexangles), PU_LEVEL, &vertexangles);
+	memset (vertexangles, 0, numvertexes * sizeof(*vertexangles));
+	viewstamp++;
+    }
+
+    if (viewx != stampviewx || viewy != stampviewy)
+    {
+	stampviewx = viewx;
+	stampviewy = viewy;
+	viewstamp++;
+    }
+
+    // 0 is never a valid stamp
+    if (!viewstamp)
+	viewstamp++;
 }
 
+//
+// R_VertexAngle
+//
+static angle_t R_VertexAngle (vertex_t* v)
+{
+    vertexangle_t*	cache;
+
+    cache = &vertexangles[v - vertexes];
+
+    if (cache->stamp != viewstamp)
+    {
+	cache->angle = R_PointToAngle (v->x, v->y);
+	cache->stamp = viewstamp;
+    }
+
+    return cache->angle;
+}
+
+
 //
 // R_AddLine
 // Clips the given segment
@@ -261,8 +375,8 @@ void R_AddLine (seg_t*	line)
     curline = line;
 
     // OPTIMIZE: quickly reject orthogonal back sides.
-    angle1 = R_PointToAngle (line->v1->x, line->v1->y);
-    angle2 = R_PointToAngle (line->v2->x, line->v2->y);
+    angle1 = R_VertexAngle (line->v1);
+    angle2 = R_VertexAngle (line->v2);
     
     // Clip to view edges.
     // OPTIMIZE: make constant out of 2*clipangle (FIELDOFVIEW).
@@ -371,7 +485,7 @@ int	checkcoord[12][4] =
 };
 
 
-bool R_CheckBBox (fixed_t*	bspcoord)
+bool R_CheckBBox (fixed_t* bspcoord, bboxangles_t* cache)
 {
     int			boxx;
     int			boxy;
@@ -411,15 +525,31 @@ bool R_CheckBBox (fixed_t*	bspcoord)
     boxpos = (boxy<<2)+boxx;
     if (boxpos == 5)
 	return true;
-	
-    x1 = bspcoord[checkcoord[boxpos][0]];
-    y1 = bspcoord[checkcoord[boxpos][1]];
-    x2 = bspcoord[checkcoord[boxpos][2]];
-    y2 = bspcoord[checkcoord[boxpos][3]];
+
+    // Entirely behind the view plane?
+    // The field of view is less than 180 degrees,
+    //  so the angle checks below would reject it too.
+    x1 = viewcos > 0 ? bspcoord[BOXRIGHT] : bspcoord[BOXLEFT];
+    y1 = viewsin > 0 ? bspcoord[BOXTOP] : bspcoord[BOXBOTTOM];
+    if (((int64_t) x1 - viewx) * viewcos
+      + ((int64_t) y1 - viewy) * viewsin < 0)
+	return false;
+
+    if (cache->stamp != viewstamp)
+    {
+	x1 = bspcoord[checkcoord[boxpos][0]];
+	y1 = bspcoord[checkcoord[boxpos][1]];
+	x2 = bspcoord[checkcoord[boxpos][2]];
+	y2 = bspcoord[checkcoord[boxpos][3]];
+
+	cache->angle1 = R_PointToAngle (x1, y1);
+	cache->angle2 = R_PointToAngle (x2, y2);
+	cache->stamp = viewstamp;
+    }
     
     // check clip list for an open space
-    angle1 = R_PointToAngle (x1, y1) - viewangle;
-    angle2 = R_PointToAngle (x2, y2) - viewangle;
+    angle1 = cache->angle1 - viewangle;
+    angle2 = cache->angle2 - viewangle;
 	
     span = angle1 - angle2;
 
@@ -546,6 +676,8 @@ void R_RenderBSPNode (int bspnum)
 {
     node_t*	bsp;
     int		side;
+    fixed_t	bbox[4];
+    int		i;
 
     // Found a subsector?
     if (bspnum & NF_SUBSECTOR)
@@ -566,7 +698,10 @@ void R_RenderBSPNode (int bspnum)
     R_RenderBSPNode (bsp->children[side]); 
 
     // Possibly divide back space.
-    if (R_CheckBBox (bsp->bbox[side^1]))	
+    for (i = 0 ; i < 4 ; i++)
+	bbox[i] = bsp->bbox[side^1][i] << FRACBITS;
+
+    if (R_CheckBBox (bbox, &bboxangles[bspnum*2 + (side^1)]))	
 	R_RenderBSPNode (bsp->children[side^1]);
 }
 
@@ -39,9 +39,12 @@ extern bool		markceiling;
 
 extern bool		skymap;
 
-extern drawseg_t	drawsegs[MAXDRAWSEGS];
+extern drawseg_t*	drawsegs;
 extern drawseg_t*	ds_p;
 
+// Most drawsegs used by a frame so far.
+extern int		peakdrawsegs;
+
 extern lighttable_t**	hscalelight;
 extern lighttable_t**	vscalelight;
 extern lighttable_t**	dscalelight;
@@ -54,6 +57,9 @@ typedef void (*drawfunc_t) (int start, int stop);
 void R_ClearClipSegs (void);
 void R_ClearDrawSegs (void);
 
+// Grows drawsegs when ds_p reaches the end.
+void R_CheckDrawSegs (void);
+
 
 void R_RenderBSPNode (int bspnum);
 
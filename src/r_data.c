@@ -18,17 +18,31 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "deh_main.h"
 #include "i_swap.h"
 #include "i_system.h"
+#include "m_argv.h"
+#include "m_timing.h"
 #include "z_zone.h"
+#include "z_stats.h"
 
 
 #include "w_wad.h"
 
 #include "doomdef.h"
 #include "m_misc.h"
+#include "w_checksum.h"
 #include "r_local.h"
 #include "p_local.h"
 
@@ -151,6 +165,32 @@ short**			texturecolumnlump;
 unsigned short**	texturecolumnofs;
 byte**			texturecomposite;
 
+// The level cache holds the flats and the texture columns
+//  the current level has used, in PU_LEVEL blocks that
+//  are never purged before the level ends. levelpatches
+//  holds the patch lumps that texture columns point into.
+static byte**		levelflats;
+static byte***		levelcolumns;
+static byte**		levelpatches;
+
+// -mipmaps: walls and flats drawn with two or more texels
+//  to a pixel are drawn from copies of their texture that
+//  are averaged down by two, four or eight each way, kept
+//  in the level cache as well. A mip column holds 128
+//  texels and a mip flat 64x64, the smaller texture
+//  repeated to fill them, so that the drawers read them
+//  as they are with their steps shifted down.
+int			mipmaps;
+static byte**		levelmips[MIPLEVELS];
+static byte**		levelmipflats[MIPLEVELS];
+
+// The PLAYPAL colors that texels are averaged in
+byte*			averagepalette;
+
+// The palette color closest to each 15-bit color, -1
+//  until it is first looked for
+static short*		nearestcolors;
+
 // for global animation
 int*		flattranslation;
 int*		texturetranslation;
@@ -218,68 +258,96 @@ R_DrawColumnInCache
 
 
 //
-// R_GenerateComposite
-// Using the texture definition,
-//  the composite texture is created from the patches,
-//  and each column is cached.
+// R_DrawCompositePatch
+// Draws the columns of one of a texture's patches
+//  that are covered by more than one.
 //
-void R_GenerateComposite (int texnum)
+static void
+R_DrawCompositePatch
+( int		texnum,
+  texpatch_t*	patch,
+  patch_t*	realpatch,
+  byte*		block )
 {
-    byte*		block;
     texture_t*		texture;
-    texpatch_t*		patch;
-    patch_t*		realpatch;
     int			x;
     int			x1;
     int			x2;
-    int			i;
     column_t*		patchcol;
     short*		collump;
     unsigned short*	colofs;
 
     texture = textures[texnum];
 
-    block = Z_Malloc (texturecompositesize[texnum],
-		      PU_STATIC,
-		      &texturecomposite[texnum]);
-
     collump = texturecolumnlump[texnum];
     colofs = texturecolumnofs[texnum];
 
-    // Composite the columns together.
-    patch = texture->patches;
+    x1 = patch->originx;
+    x2 = x1 + SHORT(realpatch->width);
+
+    if (x1<0)
+	x = 0;
+    else
+	x = x1;
 
+    if (x2 > texture->width)
+	x2 = texture->width;
+
+    for ( ; x<x2 ; x++)
+    {
+	// Column does not have multiple patches?
+	if (collump[x] >= 0)
+	    continue;
+
+	patchcol = (column_t *)((byte *)realpatch
+				+ LONG(realpatch->columnofs[x-x1]));
+	R_DrawColumnInCache (patchcol,
+			     block + colofs[x],
+			     patch->originy,
+			     texture->height);
+    }
+}
+
+
+//
+// R_DrawComposite
+// Using the texture definition,
+//  the composite texture is created from the patches.
+//
+static void R_DrawComposite (int texnum, byte* block)
+{
+    texture_t*		texture;
+    texpatch_t*		patch;
+    int			i;
+
+    texture = textures[texnum];
+
+    // Composite the columns together.
     for (i=0 , patch = texture->patches;
 	 i<texture->patchcount;
 	 i++, patch++)
     {
-	realpatch = W_CacheLumpNum (patch->patch, PU_CACHE);
-	x1 = patch->originx;
-	x2 = x1 + SHORT(realpatch->width);
-
-	if (x1<0)
-	    x = 0;
-	else
-	    x = x1;
+	R_DrawCompositePatch (texnum, patch,
+			      W_CacheLumpNum (patch->patch, PU_CACHE),
+			      block);
+    }
+}
 
-	if (x2 > texture->width)
-	    x2 = texture->width;
 
-	for ( ; x<x2 ; x++)
-	{
-	    // Column does not have multiple patches?
-	    if (collump[x] >= 0)
-		continue;
+//
+// R_GenerateComposite
+// Builds the composite in the zone,
+//  where each column is cached.
+//
+void R_GenerateComposite (int texnum)
+{
+    byte*		block;
 
-	    patchcol = (column_t *)((byte *)realpatch
-				    + LONG(realpatch->columnofs[x-x1]));
-	    R_DrawColumnInCache (patchcol,
-				 block + colofs[x],
-				 patch->originy,
-				 texture->height);
-	}
+    block = Z_Malloc (texturecompositesize[texnum],
+		      PU_STATIC,
+		      &texturecomposite[texnum]);
 
-    }
+    R_DrawComposite (texnum, block);
 
     // Now that the texture has been built in column cache,
     //  it is purgable from zone memory.
@@ -344,60 +412,775 @@ void R_GenerateLookup (int texnum)
 	}
     }
 
-    for (x=0 ; x<texture->width ; x++)
+    for (x=0 ; x<texture->width ; x++)
+    {
+	if (!patchcount[x])
+	{
+	    printf ("R_GenerateLookup: column without a patch (%s)\n",
+		    texture->name);
+	    return;
+	}
+	// I_Error ("R_GenerateLookup: column without a patch");
+
+	if (patchcount[x] > 1)
+	{
+	    // Use the cached block.
+	    collump[x] = -1;
+	    colofs[x] = texturecompositesize[texnum];
+
+	    if (texturecompositesize[texnum] > 0x10000-texture->height)
+	    {
+		I_Error ("R_GenerateLookup: texture %i is >64k",
+			 texnum);
+	    }
+
+	    texturecompositesize[texnum] += texture->height;
+	}
+    }
+
+    Z_Free(patchcount);
+}
+
+
+
+//
+// LOOKUP CACHE
+// With -texturecache, the column lookups of every texture
+//  are kept in a file tied to the WADs by W_CacheKey, so that
+//  later starts don't read every patch to build them.
+//
+
+#define LOOKUPMAGIC	"DOOMLUT2"
+
+typedef struct
+{
+    char		magic[8];
+    uint64_t		wadkey;
+    unsigned int	numtextures;
+    unsigned int	totalwidth;
+
+    // followed by the composite size of each texture, then
+    //  the lump and the offset of each column of each one
+} lookupheader_t;
+
+
+//
+// R_ReadLookups
+// Returns false if the file is missing or stale.
+//
+static bool R_ReadLookups (char* filename, int totalwidth)
+{
+    lookupheader_t	header;
+    FILE*		file;
+    bool		read;
+    int			i;
+
+    file = fopen (filename, "rb");
+    if (file == NULL)
+	return false;
+
+    read = fread (&header, sizeof(header), 1, file) == 1
+	&& !memcmp (header.magic, LOOKUPMAGIC, sizeof(header.magic))
+	&& header.wadkey == W_CacheKey ()
+	&& header.numtextures == (unsigned int) numtextures
+	&& header.totalwidth == (unsigned int) totalwidth
+	&& fread (texturecompositesize, sizeof(*texturecompositesize),
+		  numtextures, file) == (size_t) numtextures;
+
+    for (i=0 ; read && i<numtextures ; i++)
+    {
+	read = fread (texturecolumnlump[i], sizeof(**texturecolumnlump),
+		      textures[i]->width, file) == (size_t) textures[i]->width
+	    && fread (texturecolumnofs[i], sizeof(**texturecolumnofs),
+		      textures[i]->width, file) == (size_t) textures[i]->width;
+    }
+
+    fclose (file);
+
+    // composited textures not created yet
+    if (read)
+	memset (texturecomposite, 0, numtextures * sizeof(*texturecomposite));
+
+    return read;
+}
+
+
+//
+// R_WriteLookups
+// Written next to the file and renamed over it,
+//  like R_WriteSharedCache.
+//
+static void R_WriteLookups (char* filename, int totalwidth)
+{
+    lookupheader_t	header;
+    char*		temp;
+    FILE*		file;
+    bool		written;
+    int			i;
+
+    memset (&header, 0, sizeof(header));
+    memcpy (header.magic, LOOKUPMAGIC, sizeof(header.magic));
+    header.wadkey = W_CacheKey ();
+    header.numtextures = numtextures;
+    header.totalwidth = totalwidth;
+
+    temp = M_StringJoin (filename, ".tmp", NULL);
+
+    file = fopen (temp, "wb");
+    written = file != NULL
+	   && fwrite (&header, sizeof(header), 1, file) == 1
+	   && fwrite (texturecompositesize, sizeof(*texturecompositesize),
+		      numtextures, file) == (size_t) numtextures;
+
+    for (i=0 ; written && i<numtextures ; i++)
+    {
+	written = fwrite (texturecolumnlump[i], sizeof(**texturecolumnlump),
+			  textures[i]->width, file) == (size_t) textures[i]->width
+	       && fwrite (texturecolumnofs[i], sizeof(**texturecolumnofs),
+			  textures[i]->width, file) == (size_t) textures[i]->width;
+    }
+
+    if (file != NULL && fclose (file) != 0)
+	written = false;
+
+    if (!written || rename (temp, filename) != 0)
+    {
+	printf ("R_WriteLookups: failed to write %s\n", filename);
+	remove (temp);
+    }
+
+    free (temp);
+}
+
+
+
+
+//
+// SHARED CACHE
+// With -sharedcache, the colormaps, flats, sprites,
+//  texture patches and composites are read once
+//  into a file that every session maps read-only.
+// The file is tied to the WADs by W_CacheKey,
+//  and rebuilt when that changes.
+//
+
+#define SHAREDMAGIC	"DOOMGFX2"
+#define SHAREDALIGN	16
+
+typedef struct
+{
+    char		magic[8];
+    uint64_t		wadkey;
+    unsigned int	numlumps;
+    unsigned int	numtextures;
+    unsigned int	size;
+
+    // followed by the file offset of each lump and each
+    //  composite, 0 for the ones that aren't stored
+} sharedheader_t;
+
+static byte*		shareddata;
+static unsigned int*	sharedlumps;
+static unsigned int*	sharedcomposites;
+
+
+static byte* R_SharedLump (int lump)
+{
+    if (!shareddata || !sharedlumps[lump])
+	return NULL;
+
+    return shareddata + sharedlumps[lump];
+}
+
+
+#ifndef _WIN32
+
+//
+// R_StoreShared
+// Returns the offset of the next block of the file.
+//
+static unsigned int R_StoreShared (unsigned int* size, int length)
+{
+    unsigned int	offset;
+
+    offset = *size;
+    *size += (length + SHAREDALIGN - 1) & ~(SHAREDALIGN - 1);
+
+    return offset;
+}
+
+
+//
+// R_BuildSharedCache
+// Lays the file out once to size it, and again to fill it.
+//
+static byte* R_BuildSharedCache (unsigned int* size)
+{
+    byte*		image;
+    byte*		wanted;
+    sharedheader_t*	header;
+    unsigned int*	lumps;
+    unsigned int*	composites;
+    texture_t*		texture;
+    unsigned int	offset;
+    int			pass;
+    int			i;
+    int			j;
+
+    // every lump that gets drawn from
+    wanted = Z_Malloc (numlumps, PU_STATIC, NULL);
+    memset (wanted, 0, numlumps);
+
+    wanted[W_GetNumForName (DEH_String("COLORMAP"))] = 1;
+    for (i=0 ; i<numflats ; i++)
+	wanted[firstflat + i] = 1;
+    for (i=0 ; i<numspritelumps ; i++)
+	wanted[firstspritelump + i] = 1;
+    for (i=0 ; i<numtextures ; i++)
+    {
+	texture = textures[i];
+	for (j=0 ; j<texture->patchcount ; j++)
+	    wanted[texture->patches[j].patch] = 1;
+    }
+
+    image = NULL;
+    lumps = NULL;
+    composites = NULL;
+
+    for (pass=0 ; pass<2 ; pass++)
+    {
+	*size = 0;
+	R_StoreShared (size, sizeof(sharedheader_t)
+		       + (numlumps + numtextures) * sizeof(*lumps));
+
+	for (i=0 ; i<numlumps ; i++)
+	{
+	    if (!wanted[i])
+		continue;
+
+	    offset = R_StoreShared (size, W_LumpLength (i));
+	    if (image)
+	    {
+		lumps[i] = offset;
+		W_ReadLump (i, image + offset);
+	    }
+	}
+
+	for (i=0 ; i<numtextures ; i++)
+	{
+	    if (!texturecompositesize[i])
+		continue;
+
+	    offset = R_StoreShared (size, texturecompositesize[i]);
+	    if (image)
+	    {
+		composites[i] = offset;
+		R_DrawComposite (i, image + offset);
+	    }
+	}
+
+	if (!image)
+	{
+	    image = calloc (1, *size);
+	    if (!image)
+		I_Error ("R_BuildSharedCache: failed to allocate %u bytes", *size);
+
+	    header = (sharedheader_t *) image;
+	    lumps = (unsigned int *) (header + 1);
+	    composites = lumps + numlumps;
+	}
+    }
+
+    memcpy (header->magic, SHAREDMAGIC, sizeof(header->magic));
+    header->wadkey = W_CacheKey ();
+    header->numlumps = numlumps;
+    header->numtextures = numtextures;
+    header->size = *size;
+
+    Z_Free (wanted);
+
+    return image;
+}
+
+
+//
+// R_WriteSharedCache
+// Written next to the file and renamed over it,
+//  so that other sessions never map half of it.
+//
+static void R_WriteSharedCache (char* filename)
+{
+    byte*		image;
+    unsigned int	size;
+    char*		temp;
+    char		pid[16];
+    FILE*		file;
+    bool		written;
+
+    image = R_BuildSharedCache (&size);
+
+    M_snprintf (pid, sizeof(pid), ".%i", (int) getpid ());
+    temp = M_StringJoin (filename, pid, NULL);
+
+    file = fopen (temp, "wb");
+    written = file != NULL && fwrite (image, 1, size, file) == size;
+    if (file != NULL && fclose (file) != 0)
+	written = false;
+
+    if (!written || rename (temp, filename) != 0)
+    {
+	printf ("R_WriteSharedCache: failed to write %s\n", filename);
+	remove (temp);
+    }
+
+    free (temp);
+    free (image);
+}
+
+
+//
+// R_MapSharedCache
+// Returns false if the file is missing or stale.
+//
+static bool R_MapSharedCache (char* filename)
+{
+    sharedheader_t*	header;
+    struct stat		st;
+    void*		data;
+    int			fd;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0)
+	return false;
+
+    if (fstat (fd, &st) != 0 || st.st_size < (off_t) sizeof(*header))
+    {
+	close (fd);
+	return false;
+    }
+
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED)
+	return false;
+
+    header = data;
+
+    if (memcmp (header->magic, SHAREDMAGIC, sizeof(header->magic))
+     || header->wadkey != W_CacheKey ()
+     || header->numlumps != numlumps
+     || header->numtextures != (unsigned int) numtextures
+     || header->size != (unsigned int) st.st_size)
+    {
+	munmap (data, st.st_size);
+	return false;
+    }
+
+    shareddata = data;
+    sharedlumps = (unsigned int *) (header + 1);
+    sharedcomposites = sharedlumps + numlumps;
+
+    return true;
+}
+
+#endif
+
+
+//
+// R_InitSharedCache
+//
+static void R_InitSharedCache (void)
+{
+    int		p;
+
+    //!
+    // @arg <file>
+    //
+    // Share the decoded graphics with other sessions through
+    // file, which is created on first use, and again when
+    // the WADs change.
+    //
+
+    p = M_CheckParmWithArgs ("-sharedcache", 1);
+    if (p <= 0)
+	return;
+
+#ifdef _WIN32
+    printf ("R_InitSharedCache: -sharedcache is not supported on Windows\n");
+#else
+    if (R_MapSharedCache (myargv[p + 1]))
+	return;
+
+    R_WriteSharedCache (myargv[p + 1]);
+
+    if (!R_MapSharedCache (myargv[p + 1]))
+	printf ("R_InitSharedCache: failed to map %s\n", myargv[p + 1]);
+#endif
+}
+
+
+//
+// R_CacheLump
+// Reads a lump into a block of its own,
+//  so that its zone tag never changes.
+//
+static byte* R_CacheLump (int lump)
+{
+    byte*	data;
+
+    data = R_SharedLump (lump);
+    if (data)
+	return data;
+
+    data = Z_Malloc (W_LumpLength (lump), PU_LEVEL, NULL);
+    W_ReadLump (lump, data);
+
+    return data;
+}
+
+
+//
+// R_CacheTexture
+// Points every column of a texture into
+//  the level cache.
+//
+static byte** R_CacheTexture (int tex)
+{
+    texture_t*	texture;
+    byte**	columns;
+    int		lump;
+    int		x;
+
+    if (!levelcolumns)
+    {
+	Z_Malloc (numtextures * sizeof(*levelcolumns), PU_LEVEL, &levelcolumns);
+	memset (levelcolumns, 0, numtextures * sizeof(*levelcolumns));
+    }
+    if (!levelpatches)
+    {
+	Z_Malloc (numlumps * sizeof(*levelpatches), PU_LEVEL, &levelpatches);
+	memset (levelpatches, 0, numlumps * sizeof(*levelpatches));
+    }
+
+    if (levelcolumns[tex])
+	return levelcolumns[tex];
+
+    texture = textures[tex];
+    columns = Z_Malloc (texture->width * sizeof(*columns), PU_LEVEL, NULL);
+
+    for (x=0 ; x<texture->width ; x++)
+    {
+	lump = texturecolumnlump[tex][x];
+
+	if (lump > 0)
+	{
+	    if (!levelpatches[lump])
+		levelpatches[lump] = R_CacheLump (lump);
+
+	    columns[x] = levelpatches[lump] + texturecolumnofs[tex][x];
+	    continue;
+	}
+
+	if (shareddata && sharedcomposites[tex])
+	{
+	    columns[x] = shareddata + sharedcomposites[tex]
+		       + texturecolumnofs[tex][x];
+	    continue;
+	}
+
+	if (!texturecomposite[tex])
+	    R_GenerateComposite (tex);
+
+	// Kept for the level at once, or caching the patch of
+	//  a later column could purge it under this one.
+	Z_ChangeTag (texturecomposite[tex], PU_LEVEL);
+
+	columns[x] = texturecomposite[tex] + texturecolumnofs[tex][x];
+    }
+
+    levelcolumns[tex] = columns;
+
+    return columns;
+}
+
+
+//
+// R_InitLevelFlats
+//
+static void R_InitLevelFlats (void)
+{
+    if (!levelflats)
+    {
+	Z_Malloc (numflats * sizeof(*levelflats), PU_LEVEL, &levelflats);
+	memset (levelflats, 0, numflats * sizeof(*levelflats));
+    }
+}
+
+
+//
+// R_GetFlat
+// Flats are cached the same way as textures.
+//
+byte* R_GetFlat (int flat)
+{
+    R_InitLevelFlats ();
+
+    if (!levelflats[flat])
+	levelflats[flat] = R_CacheLump (firstflat + flat);
+
+    return levelflats[flat];
+}
+
+
+//
+// R_GetSpritePatch
+//
+patch_t* R_GetSpritePatch (int spritelump)
+{
+    patch_t*	patch;
+
+    patch = (patch_t *) R_SharedLump (firstspritelump + spritelump);
+    if (patch)
+	return patch;
+
+    return W_CacheLumpNum (firstspritelump + spritelump, PU_CACHE);
+}
+
+
+//
+// R_TextureColumns
+//
+byte** R_TextureColumns (int tex)
+{
+    if (levelcolumns && levelcolumns[tex])
+	return levelcolumns[tex];
+
+    return R_CacheTexture (tex);
+}
+
+
+//
+// R_GetColumn
+//
+byte*
+R_GetColumn
+( int		tex,
+  int		col )
+{
+    col &= texturewidthmask[tex];
+
+    if (levelcolumns && levelcolumns[tex])
+	return levelcolumns[tex][col];
+
+    return R_CacheTexture (tex)[col];
+}
+
+
+//
+// R_NearestColor
+//
+int R_NearestColor (int r, int g, int b)
+{
+    int		key;
+    int		best;
+    int		bestdist;
+    int		dist;
+    int		i;
+    byte*	c;
+
+    if (!nearestcolors)
+    {
+	nearestcolors = Z_Malloc (32768 * sizeof(*nearestcolors), PU_STATIC, 0);
+	memset (nearestcolors, 0xff, 32768 * sizeof(*nearestcolors));
+    }
+
+    key = (r >> 3) << 10 | (g >> 3) << 5 | (b >> 3);
+    if (nearestcolors[key] >= 0)
+	return nearestcolors[key];
+
+    best = 0;
+    bestdist = 0x7fffffff;
+    for (i=0, c=averagepalette ; i<256 ; i++, c+=3)
     {
-	if (!patchcount[x])
+	dist = (c[0]-r)*(c[0]-r) + (c[1]-g)*(c[1]-g) + (c[2]-b)*(c[2]-b);
+	if (dist < bestdist)
 	{
-	    printf ("R_GenerateLookup: column without a patch (%s)\n",
-		    texture->name);
-	    return;
+	    best = i;
+	    bestdist = dist;
 	}
-	// I_Error ("R_GenerateLookup: column without a patch");
+    }
 
-	if (patchcount[x] > 1)
-	{
-	    // Use the cached block.
-	    collump[x] = -1;
-	    colofs[x] = texturecompositesize[texnum];
+    nearestcolors[key] = best;
+    return best;
+}
 
-	    if (texturecompositesize[texnum] > 0x10000-texture->height)
+
+//
+// R_MipLevel
+//
+int R_MipLevel (unsigned step)
+{
+    int		level;
+
+    level = 0;
+    while (level < MIPLEVELS-1 && step >= (2u*FRACUNIT) << level)
+	level++;
+
+    return level;
+}
+
+
+//
+// R_GenerateMipColumns
+// Each texel is the average of a square of the
+//  texture, wrapped at its height as it tiles.
+//
+static byte* R_GenerateMipColumns (int tex, int level)
+{
+    byte*	block;
+    byte*	sources[1 << (MIPLEVELS-1)];
+    byte*	c;
+    int		size;
+    int		width;
+    int		height;
+    int		rows;
+    int		x;
+    int		y;
+    int		dx;
+    int		dy;
+    int		row;
+    int		r, g, b;
+    int		color;
+
+    size = 1 << level;
+    width = (texturewidthmask[tex] + 1) >> level;
+    if (!width)
+	width = 1;
+    height = textures[tex]->height;
+    rows = 128 >> level;
+
+    block = Z_Malloc (width * 128, PU_LEVEL, NULL);
+
+    for (x=0 ; x<width ; x++)
+    {
+	for (dx=0 ; dx<size ; dx++)
+	    sources[dx] = R_GetColumn (tex, (x << level) + dx);
+
+	for (y=0 ; y<rows ; y++)
+	{
+	    r = g = b = 0;
+	    for (dx=0 ; dx<size ; dx++)
 	    {
-		I_Error ("R_GenerateLookup: texture %i is >64k",
-			 texnum);
+		for (dy=0 ; dy<size ; dy++)
+		{
+		    row = (y << level) + dy;
+		    if (row >= height)
+			row %= height;
+
+		    c = averagepalette + sources[dx][row] * 3;
+		    r += c[0];
+		    g += c[1];
+		    b += c[2];
+		}
 	    }
 
-	    texturecompositesize[texnum] += texture->height;
+	    color = R_NearestColor (r / (size*size), g / (size*size), b / (size*size));
+	    for (row=y ; row<128 ; row+=rows)
+		block[x*128 + row] = color;
 	}
     }
 
-    Z_Free(patchcount);
+    return block;
 }
 
 
-
-
 //
-// R_GetColumn
+// R_GetMipColumn
 //
 byte*
-R_GetColumn
+R_GetMipColumn
 ( int		tex,
-  int		col )
+  int		col,
+  int		level )
 {
-    int		lump;
-    int		ofs;
+    if (!level)
+	return R_GetColumn (tex, col);
 
-    col &= texturewidthmask[tex];
-    lump = texturecolumnlump[tex][col];
-    ofs = texturecolumnofs[tex][col];
+    if (!levelmips[level])
+    {
+	Z_Malloc (numtextures * sizeof(**levelmips), PU_LEVEL, &levelmips[level]);
+	memset (levelmips[level], 0, numtextures * sizeof(**levelmips));
+    }
+
+    if (!levelmips[level][tex])
+	levelmips[level][tex] = R_GenerateMipColumns (tex, level);
+
+    return levelmips[level][tex] + (((col & texturewidthmask[tex]) >> level) << 7);
+}
+
+
+//
+// R_GetMipFlat
+//
+byte* R_GetMipFlat (int flat, int level)
+{
+    byte*	block;
+    byte*	source;
+    byte*	c;
+    int		size;
+    int		texels;
+    int		x;
+    int		y;
+    int		dx;
+    int		dy;
+    int		i;
+    int		j;
+    int		r, g, b;
+    int		color;
+
+    if (!level)
+	return R_GetFlat (flat);
+
+    if (!levelmipflats[level])
+    {
+	Z_Malloc (numflats * sizeof(**levelmipflats), PU_LEVEL, &levelmipflats[level]);
+	memset (levelmipflats[level], 0, numflats * sizeof(**levelmipflats));
+    }
+
+    if (levelmipflats[level][flat])
+	return levelmipflats[level][flat];
+
+    source = R_GetFlat (flat);
+    size = 1 << level;
+    texels = 64 >> level;
+    block = Z_Malloc (64*64, PU_LEVEL, NULL);
+
+    for (y=0 ; y<texels ; y++)
+    {
+	for (x=0 ; x<texels ; x++)
+	{
+	    r = g = b = 0;
+	    for (dy=0 ; dy<size ; dy++)
+	    {
+		for (dx=0 ; dx<size ; dx++)
+		{
+		    c = averagepalette + source[((y << level) + dy)*64 + (x << level) + dx] * 3;
+		    r += c[0];
+		    g += c[1];
+		    b += c[2];
+		}
+	    }
 
-    if (lump > 0)
-	return (byte *)W_CacheLumpNum(lump,PU_CACHE)+ofs;
+	    color = R_NearestColor (r / (size*size), g / (size*size), b / (size*size));
+	    for (i=y ; i<64 ; i+=texels)
+		for (j=x ; j<64 ; j+=texels)
+		    block[i*64 + j] = color;
+	}
+    }
 
-    if (!texturecomposite[tex])
-	R_GenerateComposite (tex);
+    levelmipflats[level][flat] = block;
 
-    return texturecomposite[tex] + ofs;
+    return block;
 }
 
 
@@ -481,6 +1264,7 @@ void R_InitTextures (void)
     int			temp1;
     int			temp2;
     int			temp3;
+    int			p;
 
 
     // Load the patch names from pnames.lmp.
@@ -613,8 +1397,24 @@ void R_InitTextures (void)
 
     // Precalculate whatever possible.
 
-    for (i=0 ; i<numtextures ; i++)
-	R_GenerateLookup (i);
+    //!
+    // @arg <file>
+    //
+    // Keep the column lookups of the textures in file, built
+    // on first use, so that later starts don't read every
+    // patch of the WADs to build them again.
+    //
+
+    p = M_CheckParmWithArgs ("-texturecache", 1);
+
+    if (p <= 0 || !R_ReadLookups (myargv[p + 1], totalwidth))
+    {
+	for (i=0 ; i<numtextures ; i++)
+	    R_GenerateLookup (i);
+
+	if (p > 0)
+	    R_WriteLookups (myargv[p + 1], totalwidth);
+    }
 
     // Create translation table for global animation.
     texturetranslation = Z_Malloc ((numtextures+1)*sizeof(*texturetranslation), PU_STATIC, 0);
@@ -689,7 +1489,254 @@ void R_InitColormaps (void)
     // Load in the light tables,
     //  256 byte align tables.
     lump = W_GetNumForName(DEH_String("COLORMAP"));
-    colormaps = W_CacheLumpNum(lump, PU_STATIC);
+    colormaps = (lighttable_t *) R_SharedLump (lump);
+    if (!colormaps)
+	colormaps = W_CacheLumpNum(lump, PU_STATIC);
+}
+
+
+
+//
+// PRECACHE WORKERS
+// R_PrecacheLevel reads the level's flats and builds its
+//  composites on threads. Nothing but the main thread may
+//  touch the zone, so the blocks they go into are set
+//  aside beforehand, and the patches the composites are
+//  built from are held in the cache until they are done.
+//  The main thread precaches the sprites meanwhile, then
+//  takes jobs as well.
+//
+#define MAXPRECACHETHREADS	8
+
+typedef struct
+{
+    // -1 for a flat
+    int		tex;
+    int		lump;
+    byte*	block;
+
+    // of a texture, its patches in order
+    patch_t**	patches;
+
+    // of a flat, what was read of it
+    int		count;
+} precachejob_t;
+
+static int		precachethreads;
+
+static precachejob_t*	precachejobs;
+static int		numprecachejobs;
+static patch_t**	precachepatches;
+static int		numprecachepatches;
+
+#ifndef _WIN32
+static pthread_t	precachethread[MAXPRECACHETHREADS];
+static pthread_mutex_t	precachelock = PTHREAD_MUTEX_INITIALIZER;
+static int		startedthreads;
+#endif
+static int		nextprecachejob;
+
+
+//
+// R_InitPrecacheThreads
+//
+static void R_InitPrecacheThreads (void)
+{
+    int		p;
+
+    //!
+    // @arg <n>
+    //
+    // Build the textures and read the flats of each level with
+    // n threads. Defaults to one for every core, up to 8.
+    //
+
+    p = M_CheckParmWithArgs ("-precachethreads", 1);
+
+#ifdef _WIN32
+    precachethreads = 1;
+#else
+    precachethreads = p ? atoi (myargv[p + 1]) : sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+    if (precachethreads < 1)
+	precachethreads = 1;
+    if (precachethreads > MAXPRECACHETHREADS)
+	precachethreads = MAXPRECACHETHREADS;
+}
+
+
+static void R_RunPrecacheJob (precachejob_t* job)
+{
+    lumpinfo_t*	lump;
+    texture_t*	texture;
+    int		i;
+
+    if (job->tex < 0)
+    {
+	lump = &lumpinfo[job->lump];
+	job->count = W_Read (lump->wad_file, lump->position,
+			     job->block, lump->size);
+	return;
+    }
+
+    texture = textures[job->tex];
+
+    for (i=0 ; i<texture->patchcount ; i++)
+	R_DrawCompositePatch (job->tex, &texture->patches[i],
+			      job->patches[i], job->block);
+}
+
+
+static void* R_PrecacheThread (void* arg)
+{
+    int		job;
+
+    (void) arg;
+
+    for (;;)
+    {
+#ifndef _WIN32
+	pthread_mutex_lock (&precachelock);
+#endif
+	job = nextprecachejob++;
+#ifndef _WIN32
+	pthread_mutex_unlock (&precachelock);
+#endif
+
+	if (job >= numprecachejobs)
+	    break;
+
+	R_RunPrecacheJob (&precachejobs[job]);
+    }
+
+    return NULL;
+}
+
+
+//
+// R_QueueFlat
+// Sets a block aside for a flat not in the level cache.
+//
+static void R_QueueFlat (int flat)
+{
+    precachejob_t*	job;
+    int			lump;
+
+    R_InitLevelFlats ();
+
+    if (levelflats[flat])
+	return;
+
+    lump = firstflat + flat;
+
+    levelflats[flat] = R_SharedLump (lump);
+    if (levelflats[flat])
+	return;
+
+    job = &precachejobs[numprecachejobs++];
+    job->tex = -1;
+    job->lump = lump;
+    job->block = Z_Malloc (lumpinfo[lump].size, PU_LEVEL, NULL);
+}
+
+
+//
+// R_QueueComposite
+// Sets a block aside for the composite of a texture,
+//  and holds its patches in the cache.
+//
+static void R_QueueComposite (int tex)
+{
+    precachejob_t*	job;
+    texture_t*		texture;
+    int			i;
+
+    if (texturecomposite[tex] || !texturecompositesize[tex]
+     || (shareddata && sharedcomposites[tex]))
+	return;
+
+    texture = textures[tex];
+
+    job = &precachejobs[numprecachejobs++];
+    job->tex = tex;
+    job->patches = precachepatches + numprecachepatches;
+
+    for (i=0 ; i<texture->patchcount ; i++)
+    {
+	job->patches[i] = W_CacheLumpNum (texture->patches[i].patch,
+					  PU_STATIC);
+    }
+    numprecachepatches += texture->patchcount;
+
+    job->block = Z_Malloc (texturecompositesize[tex], PU_STATIC,
+			   &texturecomposite[tex]);
+}
+
+
+//
+// R_StartPrecacheJobs
+//
+static void R_StartPrecacheJobs (void)
+{
+    nextprecachejob = 0;
+
+#ifndef _WIN32
+    // the main thread is one of them
+    for (startedthreads = 0 ;
+	 startedthreads < precachethreads - 1
+	  && startedthreads < numprecachejobs - 1 ;
+	 startedthreads++)
+    {
+	if (pthread_create (&precachethread[startedthreads], NULL,
+			    R_PrecacheThread, NULL))
+	    break;
+    }
+#endif
+}
+
+
+//
+// R_FinishPrecacheJobs
+// Takes the jobs that are left, and waits
+//  for the threads to finish theirs.
+//
+static void R_FinishPrecacheJobs (void)
+{
+    precachejob_t*	job;
+    texture_t*		texture;
+    int			i;
+    int			j;
+
+    R_PrecacheThread (NULL);
+
+#ifndef _WIN32
+    for (i=0 ; i<startedthreads ; i++)
+	pthread_join (precachethread[i], NULL);
+    startedthreads = 0;
+#endif
+
+    for (i=0, job=precachejobs ; i<numprecachejobs ; i++, job++)
+    {
+	if (job->tex >= 0)
+	{
+	    texture = textures[job->tex];
+	    for (j=0 ; j<texture->patchcount ; j++)
+		W_ReleaseLumpNum (texture->patches[j].patch);
+	    continue;
+	}
+
+	if (job->count < lumpinfo[job->lump].size)
+	{
+	    I_Error ("R_FinishPrecacheJobs: only read %i of %i on lump %i",
+		     job->count, lumpinfo[job->lump].size, job->lump);
+	}
+
+	levelflats[job->lump - firstflat] = job->block;
+    }
+
+    numprecachejobs = 0;
+    numprecachepatches = 0;
 }
 
 
@@ -702,13 +1749,29 @@ void R_InitColormaps (void)
 //
 void R_InitData (void)
 {
+    M_StartupStep ("R_InitTextures");
     R_InitTextures ();
     printf (".");
+    M_StartupStep ("R_InitFlats");
     R_InitFlats ();
     printf (".");
+    M_StartupStep ("R_InitSpriteLumps");
     R_InitSpriteLumps ();
     printf (".");
+    M_StartupStep ("R_InitSharedCache");
+    R_InitSharedCache ();
     R_InitColormaps ();
+
+    //!
+    // Draw distant walls, floors and ceilings from copies of
+    // their textures averaged down to about a texel a pixel.
+    //
+
+    mipmaps = M_CheckParm ("-mipmaps") > 0;
+
+    R_InitPrecacheThreads ();
+
+    averagepalette = W_CacheLumpName (DEH_String("PLAYPAL"), PU_STATIC);
 }
 
 
@@ -736,6 +1799,23 @@ int R_FlatNumForName (char* name)
 
 
 
+//
+// R_PrefetchTexture
+// Hints the patches of a texture, before a level that uses it.
+//
+void R_PrefetchTexture (int texnum)
+{
+    texture_t	*texture;
+    int		i;
+
+    texture = textures[texnum];
+
+    for (i=0 ; i<texture->patchcount ; i++)
+	W_PrefetchLump (texture->patches[i].patch);
+}
+
+
+
 //
 // R_CheckTextureNumForName
 // Check whether texture is available.
@@ -790,9 +1870,30 @@ int	R_TextureNumForName (char* name)
 
 
 
+//
+// R_MarkStateSprites
+// Marks the sprites a state and those after it show.
+//
+static void R_MarkStateSprites (char *present, int state)
+{
+    int		i;
+
+    // the chains loop, a few turns will do
+    for (i=0 ; i<32 && state != S_NULL ; i++)
+    {
+	present[states[state].sprite] = 1;
+	state = states[state].nextstate;
+    }
+}
+
+
 //
 // R_PrecacheLevel
 // Preloads all relevant graphics for the level.
+// Flats and textures go into the level cache,
+//  anything missed is added on first use.
+// The flats are read and the composites built by
+//  the precache workers while the sprites are loaded.
 //
 int		flatmemory;
 int		texturememory;
@@ -808,12 +1909,14 @@ void R_PrecacheLevel (void)
     int			j;
     int			k;
     int			lump;
+    int			patches;
 
     texture_t*		texture;
     thinker_t*		th;
     spriteframe_t*	sf;
 
-    if (demoplayback)
+    // -checkallocs wants demos to load nothing once warmed up
+    if (demoplayback && !checkallocs)
 	return;
 
     // Precache flats.
@@ -826,20 +1929,6 @@ void R_PrecacheLevel (void)
 	flatpresent[sectors[i].ceilingpic] = 1;
     }
 
-    flatmemory = 0;
-
-    for (i=0 ; i<numflats ; i++)
-    {
-	if (flatpresent[i])
-	{
-	    lump = firstflat + i;
-	    flatmemory += lumpinfo[lump].size;
-	    W_CacheLumpNum(lump, PU_CACHE);
-	}
-    }
-
-    Z_Free(flatpresent);
-
     // Precache textures.
     texturepresent = Z_Malloc(numtextures, PU_STATIC, NULL);
     memset (texturepresent,0, numtextures);
@@ -859,6 +1948,27 @@ void R_PrecacheLevel (void)
     //  name.
     texturepresent[skytexture] = 1;
 
+    patches = 0;
+    for (i=0 ; i<numtextures ; i++)
+	if (texturepresent[i])
+	    patches += textures[i]->patchcount;
+
+    precachejobs = Z_Malloc ((numflats + numtextures) * sizeof(*precachejobs),
+			     PU_STATIC, NULL);
+    precachepatches = Z_Malloc (patches * sizeof(*precachepatches),
+				PU_STATIC, NULL);
+
+    flatmemory = 0;
+    for (i=0 ; i<numflats ; i++)
+    {
+	if (flatpresent[i])
+	{
+	    lump = firstflat + i;
+	    flatmemory += lumpinfo[lump].size;
+	    R_QueueFlat (i);
+	}
+    }
+
     texturememory = 0;
     for (i=0 ; i<numtextures ; i++)
     {
@@ -871,11 +1981,12 @@ void R_PrecacheLevel (void)
 	{
 	    lump = texture->patches[j].patch;
 	    texturememory += lumpinfo[lump].size;
-	    W_CacheLumpNum(lump , PU_CACHE);
 	}
+
+	R_QueueComposite (i);
     }
 
-    Z_Free(texturepresent);
+    R_StartPrecacheJobs ();
 
     // Precache sprites.
     spritepresent = Z_Malloc(numsprites, PU_STATIC, NULL);
@@ -887,6 +1998,29 @@ void R_PrecacheLevel (void)
 	    spritepresent[((mobj_t *)th)->sprite] = 1;
     }
 
+    // and what comes up as the level is played, which would
+    //  otherwise be loaded in the middle of a frame: the
+    //  weapons, missiles, puffs, blood and teleport fog
+    for (i=0 ; i<NUMWEAPONS ; i++)
+    {
+	R_MarkStateSprites (spritepresent, weaponinfo[i].atkstate);
+	R_MarkStateSprites (spritepresent, weaponinfo[i].flashstate);
+    }
+
+    for (i=0 ; i<NUMMOBJTYPES ; i++)
+    {
+	if (mobjinfo[i].flags & MF_MISSILE)
+	{
+	    R_MarkStateSprites (spritepresent, mobjinfo[i].spawnstate);
+	    R_MarkStateSprites (spritepresent, mobjinfo[i].deathstate);
+	}
+    }
+
+    R_MarkStateSprites (spritepresent, mobjinfo[MT_PUFF].spawnstate);
+    R_MarkStateSprites (spritepresent, mobjinfo[MT_BLOOD].spawnstate);
+    R_MarkStateSprites (spritepresent, mobjinfo[MT_TFOG].spawnstate);
+    R_MarkStateSprites (spritepresent, mobjinfo[MT_IFOG].spawnstate);
+
     spritememory = 0;
     for (i=0 ; i<numsprites ; i++)
     {
@@ -906,4 +2040,34 @@ void R_PrecacheLevel (void)
     }
 
     Z_Free(spritepresent);
+
+    R_FinishPrecacheJobs ();
+
+    Z_Free(precachejobs);
+    Z_Free(precachepatches);
+
+    for (i=0 ; mipmaps && i<numflats ; i++)
+    {
+	if (flatpresent[i])
+	{
+	    for (j=1 ; j<MIPLEVELS ; j++)
+		R_GetMipFlat (i, j);
+	}
+    }
+
+    Z_Free(flatpresent);
+
+    for (i=0 ; i<numtextures ; i++)
+    {
+	if (!texturepresent[i])
+	    continue;
+
+	R_CacheTexture (i);
+
+	// the sky is drawn as it is
+	for (j=1 ; mipmaps && i != skytexture && j<MIPLEVELS ; j++)
+	    R_GetMipColumn (i, 0, j);
+    }
+
+    Z_Free(texturepresent);
 }
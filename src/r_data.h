@@ -32,6 +32,42 @@ R_GetColumn
   int		col );
 
 
+// Every column of a texture, to look columns up in
+//  straight, masked with texturewidthmask. Stays put
+//  for the level.
+byte**	R_TextureColumns (int tex);
+
+
+// Retrieve a sprite frame, by sprite lump number.
+patch_t* R_GetSpritePatch (int spritelump);
+
+// Columns of each texture minus one,
+//  R_GetColumn wraps the column with it.
+extern int*	texturewidthmask;
+
+// Retrieve a flat, by flat number.
+byte*	R_GetFlat (int flat);
+
+// The PLAYPAL colors that texels are averaged in,
+//  and the palette color closest to an average.
+extern byte*	averagepalette;
+int	R_NearestColor (int r, int g, int b);
+
+// Levels of -mipmaps, the texture itself being the first
+#define MIPLEVELS	4
+
+// Set by -mipmaps
+extern int	mipmaps;
+
+// The level to draw a texture from at step texels a pixel
+int	R_MipLevel (unsigned step);
+
+// Retrieve a column or flat of a level, 128 and 64x64
+//  texels as the drawers read them, wrapping within.
+byte*	R_GetMipColumn (int tex, int col, int level);
+byte*	R_GetMipFlat (int flat, int level);
+
+
 // I/O, setting up the stuff.
 void R_InitData (void);
 void R_PrecacheLevel (void);
@@ -48,4 +84,7 @@ int R_FlatNumForName (char* name);
 int R_TextureNumForName (char *name);
 int R_CheckTextureNumForName (char *name);
 
+// Hints the patches of a texture, to be read in ahead of the level
+void R_PrefetchTexture (int texnum);
+
 #endif
@@ -94,7 +94,7 @@ typedef struct
 // The SECTORS record, at runtime.
 // Stores things/mobjs.
 //
-typedef	struct
+typedef	struct sector_s
 {
     fixed_t	floorheight;
     fixed_t	ceilingheight;
@@ -122,11 +122,21 @@ typedef	struct
     // list of mobjs in sector
     mobj_t*	thinglist;
 
+    // mobjs whose box touches the sector, with -fastsectors
+    struct touchnode_s*	touchlist;
+
     // thinker_t for reversable actions
     void*	specialdata;
 
     int			linecount;
     struct line_s**	lines;	// [linecount] size
+
+    // sectors across the two sided lines, once each
+    int			neighborcount;
+    struct sector_s**	neighbors;
+
+    // next sector with a tag in the same hash chain, or -1
+    int			tagnext;
     
 } sector_t;
 
@@ -266,8 +276,9 @@ typedef struct
     fixed_t	dx;
     fixed_t	dy;
 
-    // Bounding box for each child.
-    fixed_t	bbox[2][4];
+    // Bounding box for each child, in map units,
+    //  as the lump has it.
+    short	bbox[2][4];
 
     // If NF_SUBSECTOR its a subsector.
     unsigned short children[2];
@@ -337,10 +348,6 @@ typedef struct drawseg_s
 // I.e. a sprite object that is partly visible.
 typedef struct vissprite_s
 {
-    // Doubly linked list.
-    struct vissprite_s*	prev;
-    struct vissprite_s*	next;
-    
     int			x1;
     int			x2;
 
@@ -420,7 +427,7 @@ typedef struct
 //
 // Now what is a visplane, anyway?
 // 
-typedef struct
+typedef struct visplane_s
 {
   fixed_t		height;
   int			picnum;
@@ -429,16 +436,12 @@ typedef struct
   int			maxx;
   
   // leave pads for [minx-1]/[maxx+1]
-  
-  byte		pad1;
-  // Here lies the rub for all
-  //  dynamic resize/change of resolution.
-  byte		top[SCREENWIDTH];
-  byte		pad2;
-  byte		pad3;
-  // See above.
-  byte		bottom[SCREENWIDTH];
-  byte		pad4;
+  // Sized for the view by R_InitPlaneBuffers.
+  byte*		top;
+  byte*		bottom;
+
+  // next plane in the same R_FindPlane hash chain
+  struct visplane_s*	next;
 
 } visplane_t;
 
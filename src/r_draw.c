@@ -36,6 +36,12 @@
 // State.
 #include "doomstat.h"
 
+#include "i_simd.h"
+
+#ifdef HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
 
 // ?
 #define MAXWIDTH			1120
@@ -58,11 +64,40 @@ byte*		viewimage;
 int		viewwidth;
 int		scaledviewwidth;
 int		viewheight;
+int		scaledviewheight;
 int		viewwindowx;
 int		viewwindowy; 
 byte*		ylookup[MAXHEIGHT]; 
 int		columnofs[MAXWIDTH]; 
 
+// Screen pixels per rendered pixel, in both directions.
+// Backends that only sample every renderscale'th pixel
+//  have the view drawn straight onto those pixels.
+int		renderscale = 1;
+
+// The smallest renderscale the view buffers are sized for,
+//  as it may change once graphics are up.
+int		minrenderscale = 1;
+
+// Distance between vertically adjacent view pixels.
+int		viewpitch = SCREENWIDTH;
+
+// Distance between horizontally adjacent view pixels.
+int		spanpitch = 1;
+
+// Draw the view column by column into viewbuffer,
+//  so that each column is contiguous in memory.
+// R_TransposeView copies it to the screen.
+bool		transposeview;
+
+static byte	viewbuffer[SCREENWIDTH*SCREENHEIGHT];
+
+// Where each rendered row and column is on the screen,
+//  which is where ylookup and columnofs point unless
+//  the view is transposed.
+static byte*	screenrows[MAXHEIGHT];
+static int	screencolumns[MAXWIDTH];
+
 // Color tables for different players,
 //  translate a limited part to another
 //  (color ramps used for  suit colors).
@@ -74,20 +109,24 @@ byte		translations[3][256];
 
 static byte *background_buffer = NULL;
 
+// The border on the screen is the background buffer's, drawn
+//  since R_FillBackScreen last changed it.
+bool		borderdrawn;
+
 
 //
 // R_DrawColumn
 // Source is the top of the column to scale.
 //
-lighttable_t*		dc_colormap; 
-int			dc_x; 
-int			dc_yl; 
-int			dc_yh; 
-fixed_t			dc_iscale; 
-fixed_t			dc_texturemid;
+DRAWSTATE lighttable_t*		dc_colormap; 
+DRAWSTATE int			dc_x; 
+DRAWSTATE int			dc_yl; 
+DRAWSTATE int			dc_yh; 
+DRAWSTATE fixed_t			dc_iscale; 
+DRAWSTATE fixed_t			dc_texturemid;
 
 // first pixel in a column (possibly virtual) 
-byte*			dc_source;		
+DRAWSTATE byte*			dc_source;		
 
 // just for profiling 
 int			dccount;
@@ -138,7 +177,7 @@ void R_DrawColumn (void)
 	//  using a lighting/special effects LUT.
 	*dest = dc_colormap[dc_source[(frac>>FRACBITS)&127]];
 	
-	dest += SCREENWIDTH; 
+	dest += viewpitch; 
 	frac += fracstep;
 	
     } while (count--); 
@@ -243,8 +282,8 @@ void R_DrawColumnLow (void)
     {
 	// Hack. Does not work corretly.
 	*dest2 = *dest = dc_colormap[dc_source[(frac>>FRACBITS)&127]];
-	dest += SCREENWIDTH;
-	dest2 += SCREENWIDTH;
+	dest += viewpitch;
+	dest2 += viewpitch;
 	frac += fracstep; 
 
     } while (count--);
@@ -255,7 +294,7 @@ void R_DrawColumnLow (void)
 // Spectre/Invisibility.
 //
 #define FUZZTABLE		50 
-#define FUZZOFF	(SCREENWIDTH)
+#define FUZZOFF	(1)	// in rows of viewpitch
 
 
 int	fuzzoffset[FUZZTABLE] =
@@ -325,13 +364,13 @@ void R_DrawFuzzColumn (void)
 	//  a pixel that is either one column
 	//  left or right of the current one.
 	// Add index from colormap to index.
-	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]]]; 
+	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]*viewpitch]]; 
 
 	// Clamp table lookup index.
 	if (++fuzzpos == FUZZTABLE) 
 	    fuzzpos = 0;
 	
-	dest += SCREENWIDTH;
+	dest += viewpitch;
 
 	frac += fracstep; 
     } while (count--); 
@@ -391,19 +430,190 @@ void R_DrawFuzzColumnLow (void)
 	//  a pixel that is either one column
 	//  left or right of the current one.
 	// Add index from colormap to index.
-	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]]]; 
-	*dest2 = colormaps[6*256+dest2[fuzzoffset[fuzzpos]]]; 
+	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]*viewpitch]]; 
+	*dest2 = colormaps[6*256+dest2[fuzzoffset[fuzzpos]*viewpitch]]; 
 
 	// Clamp table lookup index.
 	if (++fuzzpos == FUZZTABLE) 
 	    fuzzpos = 0;
 	
-	dest += SCREENWIDTH;
-	dest2 += SCREENWIDTH;
+	dest += viewpitch;
+	dest2 += viewpitch;
 
 	frac += fracstep; 
     } while (count--); 
 } 
+
+
+//
+// R_DrawSkyColumn
+// The sky is scaled and lit in advance, dc_source
+//  holds the pixel of every row of the view.
+//
+void R_DrawSkyColumn (void) 
+{ 
+    int			count; 
+    byte*		source;
+    byte*		dest; 
+    byte*		dest2; 
+    int			x;
+
+    count = dc_yh - dc_yl; 
+
+    // Zero length.
+    if (count < 0) 
+	return; 
+
+    x = dc_x << detailshift;
+
+#ifdef RANGECHECK 
+    if ((unsigned)x >= SCREENWIDTH
+	|| dc_yl < 0 || dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ("R_DrawSkyColumn: %i to %i at %i",
+		 dc_yl, dc_yh, dc_x);
+    }
+#endif
+
+    source = dc_source + dc_yl;
+    dest = ylookup[dc_yl] + columnofs[x];
+
+    if (!detailshift)
+    {
+	do 
+	{
+	    *dest = *source++;
+	    dest += viewpitch;
+	} while (count--); 
+	return;
+    }
+
+    // low detail mode, both columns get the pixel
+    dest2 = ylookup[dc_yl] + columnofs[x+1];
+
+    do 
+    {
+	*dest2 = *dest = *source++;
+	dest += viewpitch;
+	dest2 += viewpitch;
+    } while (count--); 
+} 
+
+
+//
+// R_DrawShadowColumn
+// A cheaper stand in for the fuzz, selected with
+//  -shadowfuzz. Only the pixels being drawn over
+//  are read, and they alternate between two shades
+//  in a fixed checkerboard, so a spectre that holds
+//  still draws the same pixels every frame.
+// The two colormaps are two gradient steps of the
+//  ascii output apart, so the dither stays visible.
+//
+#define SHADOWLIGHT		6
+#define SHADOWDARK		14
+
+bool		shadowfuzz;
+
+void R_DrawShadowColumn (void) 
+{ 
+    int			count; 
+    byte*		dest; 
+    lighttable_t*	shade;
+    lighttable_t*	othershade;
+    lighttable_t*	swap;
+
+    count = dc_yh - dc_yl; 
+
+    // Zero length.
+    if (count < 0) 
+	return; 
+
+#ifdef RANGECHECK 
+    if ((unsigned)dc_x >= SCREENWIDTH
+	|| dc_yl < 0 || dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ("R_DrawShadowColumn: %i to %i at %i",
+		 dc_yl, dc_yh, dc_x);
+    }
+#endif
+
+    dest = ylookup[dc_yl] + columnofs[dc_x];
+
+    shade = colormaps + SHADOWLIGHT*256;
+    othershade = colormaps + SHADOWDARK*256;
+    if ((dc_x + dc_yl) & 1)
+    {
+	swap = shade;
+	shade = othershade;
+	othershade = swap;
+    }
+
+    do 
+    {
+	*dest = shade[*dest];
+	dest += viewpitch;
+
+	swap = shade;
+	shade = othershade;
+	othershade = swap;
+    } while (count--); 
+} 
+
+// low detail mode version
+
+void R_DrawShadowColumnLow (void) 
+{ 
+    int			count; 
+    byte*		dest; 
+    byte*		dest2; 
+    lighttable_t*	shade;
+    lighttable_t*	othershade;
+    lighttable_t*	swap;
+    int			x;
+
+    count = dc_yh - dc_yl; 
+
+    // Zero length.
+    if (count < 0) 
+	return; 
+
+    // low detail mode, need to multiply by 2
+    x = dc_x << 1;
+
+#ifdef RANGECHECK 
+    if ((unsigned)x >= SCREENWIDTH
+	|| dc_yl < 0 || dc_yh >= SCREENHEIGHT)
+    {
+	I_Error ("R_DrawShadowColumn: %i to %i at %i",
+		 dc_yl, dc_yh, dc_x);
+    }
+#endif
+
+    dest = ylookup[dc_yl] + columnofs[x];
+    dest2 = ylookup[dc_yl] + columnofs[x+1];
+
+    shade = colormaps + SHADOWLIGHT*256;
+    othershade = colormaps + SHADOWDARK*256;
+    if ((dc_x + dc_yl) & 1)
+    {
+	swap = shade;
+	shade = othershade;
+	othershade = swap;
+    }
+
+    do 
+    {
+	*dest = shade[*dest];
+	*dest2 = shade[*dest2];
+	dest += viewpitch;
+	dest2 += viewpitch;
+
+	swap = shade;
+	shade = othershade;
+	othershade = swap;
+    } while (count--); 
+} 
  
   
   
@@ -418,7 +628,7 @@ void R_DrawFuzzColumnLow (void)
 //  of the BaronOfHell, the HellKnight, uses
 //  identical sprites, kinda brightened up.
 //
-byte*	dc_translation;
+DRAWSTATE byte*	dc_translation;
 byte*	translationtables;
 
 void R_DrawTranslatedColumn (void) 
@@ -459,7 +669,7 @@ void R_DrawTranslatedColumn (void)
 	// Thus the "green" ramp of the player 0 sprite
 	//  is mapped to gray, red, black/indigo. 
 	*dest = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
-	dest += SCREENWIDTH;
+	dest += viewpitch;
 	
 	frac += fracstep; 
     } while (count--); 
@@ -510,8 +720,8 @@ void R_DrawTranslatedColumnLow (void)
 	//  is mapped to gray, red, black/indigo. 
 	*dest = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
 	*dest2 = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
-	dest += SCREENWIDTH;
-	dest2 += SCREENWIDTH;
+	dest += viewpitch;
+	dest2 += viewpitch;
 	
 	frac += fracstep; 
     } while (count--); 
@@ -567,24 +777,78 @@ void R_InitTranslationTables (void)
 // In consequence, flats are not stored by column (like walls),
 //  and the inner loop has to step in texture space u and v.
 //
-int			ds_y; 
-int			ds_x1; 
-int			ds_x2;
+DRAWSTATE int			ds_y; 
+DRAWSTATE int			ds_x1; 
+DRAWSTATE int			ds_x2;
 
-lighttable_t*		ds_colormap; 
+DRAWSTATE lighttable_t*		ds_colormap; 
 
-fixed_t			ds_xfrac; 
-fixed_t			ds_yfrac; 
-fixed_t			ds_xstep; 
-fixed_t			ds_ystep;
+DRAWSTATE fixed_t			ds_xfrac; 
+DRAWSTATE fixed_t			ds_yfrac; 
+DRAWSTATE fixed_t			ds_xstep; 
+DRAWSTATE fixed_t			ds_ystep;
 
 // start of a 64*64 tile image 
-byte*			ds_source;	
+DRAWSTATE byte*			ds_source;	
 
 // just for profiling
 int			dscount;
 
 
+#ifdef HAVE_AVX2_KERNELS
+//
+// R_DrawSpanAVX2
+// Draws the span eight pixels at a time while there are eight
+//  left, with both lookups done as gathers, and returns where
+//  it got to. A byte can't be gathered, so each one is read as
+//  the top byte of the 32-bit word ending at it. The flat and
+//  the colormaps both live in zone blocks, so the three bytes
+//  before them are always the block header.
+//
+static AVX2_KERNEL byte*
+R_DrawSpanAVX2
+( byte*		dest,
+  unsigned int*	position,
+  unsigned int	step,
+  int*		count )
+{
+    __m256i	pos = _mm256_add_epi32 (_mm256_set1_epi32 (*position),
+		    _mm256_mullo_epi32 (_mm256_set1_epi32 (step),
+			_mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7)));
+    __m256i	step8 = _mm256_set1_epi32 (step * 8);
+    __m256i	ymask = _mm256_set1_epi32 (0x0fc0);
+    const int*	source = (const int *) (ds_source - 3);
+    const int*	colormap = (const int *) (ds_colormap - 3);
+    int		pixels[8];
+    int		i;
+
+    do
+    {
+	__m256i	spots = _mm256_or_si256 (
+			_mm256_and_si256 (_mm256_srli_epi32 (pos, 4), ymask),
+			_mm256_srli_epi32 (pos, 26));
+	__m256i	texels = _mm256_srli_epi32 (
+			_mm256_i32gather_epi32 (source, spots, 1), 24);
+
+	_mm256_storeu_si256 ((__m256i *) pixels, _mm256_srli_epi32 (
+			_mm256_i32gather_epi32 (colormap, texels, 1), 24));
+
+	for (i = 0 ; i < 8 ; i++)
+	{
+	    *dest = pixels[i];
+	    dest += spanpitch;
+	}
+
+	pos = _mm256_add_epi32 (pos, step8);
+	*position += step * 8;
+	*count -= 8;
+    } while (*count >= 7);
+
+    return dest;
+}
+#endif
+
+
 //
 // Draws the actual span.
 void R_DrawSpan (void) 
@@ -622,6 +886,16 @@ void R_DrawSpan (void)
     // We do not check for zero spans here?
     count = ds_x2 - ds_x1;
 
+#ifdef HAVE_AVX2_KERNELS
+    if (count >= 7 && simdkernel == KERNEL_AVX2)
+    {
+	dest = R_DrawSpanAVX2 (dest, &position, step, &count);
+
+	if (count < 0)
+	    return;
+    }
+#endif
+
     do
     {
 	// Calculate current texture index in u,v.
@@ -631,7 +905,8 @@ void R_DrawSpan (void)
 
 	// Lookup pixel from flat texture tile,
 	//  re-index using light/colormap.
-	*dest++ = ds_colormap[ds_source[spot]];
+	*dest = ds_colormap[ds_source[spot]];
+	dest += spanpitch;
 
         position += step;
 
@@ -758,8 +1033,10 @@ void R_DrawSpanLow (void)
 
 	// Lowres/blocky mode does it twice,
 	//  while scale is adjusted appropriately.
-	*dest++ = ds_colormap[ds_source[spot]];
-	*dest++ = ds_colormap[ds_source[spot]];
+	*dest = ds_colormap[ds_source[spot]];
+	dest += spanpitch;
+	*dest = ds_colormap[ds_source[spot]];
+	dest += spanpitch;
 
 	position += step;
 
@@ -772,6 +1049,8 @@ void R_DrawSpanLow (void)
 //  multiplies and other hazzles
 //  for getting the framebuffer address
 //  of a pixel to draw.
+// Sets viewwidth and viewheight to the
+//  size of the window in rendered pixels.
 //
 void
 R_InitBuffer
@@ -779,6 +1058,8 @@ R_InitBuffer
   int		height ) 
 { 
     int		i; 
+    int		first;
+    int		count;
 
     // Handle resize,
     //  e.g. smaller view windows
@@ -786,8 +1067,12 @@ R_InitBuffer
     viewwindowx = (SCREENWIDTH-width) >> 1; 
 
     // Column offset. For windows.
-    for (i=0 ; i<width ; i++) 
-	columnofs[i] = viewwindowx + i;
+    // Only the sampled columns inside the window are rendered.
+    first = (viewwindowx + renderscale - 1) / renderscale;
+    count = (viewwindowx + width + renderscale - 1) / renderscale - first;
+    for (i=0 ; i<count ; i++) 
+	screencolumns[i] = (first + i) * renderscale;
+    viewwidth = count >> detailshift;
 
     // Samw with base row offset.
     if (width == SCREENWIDTH) 
@@ -796,13 +1081,127 @@ R_InitBuffer
 	viewwindowy = (SCREENHEIGHT-SBARHEIGHT-height) >> 1; 
 
     // Preclaculate all row offsets.
-    for (i=0 ; i<height ; i++) 
-	ylookup[i] = I_VideoBuffer + (i+viewwindowy)*SCREENWIDTH; 
+    first = (viewwindowy + renderscale - 1) / renderscale;
+    count = (viewwindowy + height + renderscale - 1) / renderscale - first;
+    for (i=0 ; i<count ; i++) 
+	screenrows[i] = I_VideoBuffer + (first + i) * renderscale * SCREENWIDTH; 
+    viewheight = count;
+
+    if (transposeview)
+    {
+	for (i=0 ; i<viewwidth<<detailshift ; i++)
+	    columnofs[i] = i * viewheight;
+	for (i=0 ; i<viewheight ; i++)
+	    ylookup[i] = viewbuffer + i;
+
+	viewpitch = 1;
+	spanpitch = viewheight;
+    }
+    else
+    {
+	memcpy(columnofs, screencolumns, sizeof(columnofs));
+	memcpy(ylookup, screenrows, sizeof(ylookup));
+
+	viewpitch = SCREENWIDTH * renderscale;
+	spanpitch = renderscale;
+    }
 } 
+
+
+//
+// R_TransposeView
+// Copies viewbuffer to the screen, in tiles
+//  so that both sides stay in the cache.
+//
+#define TRANSPOSETILE	16
+
+void R_TransposeView (void)
+{
+    int		x;
+    int		y;
+    int		tx;
+    int		ty;
+    int		xend;
+    int		yend;
+    int		width;
+    byte*	src;
+
+    if (!transposeview)
+	return;
+
+    width = viewwidth << detailshift;
+
+    for (ty=0 ; ty<viewheight ; ty+=TRANSPOSETILE)
+    {
+	yend = ty + TRANSPOSETILE;
+	if (yend > viewheight)
+	    yend = viewheight;
+
+	for (tx=0 ; tx<width ; tx+=TRANSPOSETILE)
+	{
+	    xend = tx + TRANSPOSETILE;
+	    if (xend > width)
+		xend = width;
+
+	    for (x=tx ; x<xend ; x++)
+	    {
+		src = viewbuffer + x * viewheight;
+
+		for (y=ty ; y<yend ; y++)
+		    screenrows[y][screencolumns[x]] = src[y];
+	    }
+	}
+    }
+}
  
  
 
 
+//
+// R_ExpandView
+// Copies each rendered pixel over the block
+//  of screen pixels it stands for, so that
+//  screen wipes don't pull stale pixels in.
+//
+void R_ExpandView (void)
+{
+    int		x;
+    int		y;
+    int		i;
+    int		w;
+    int		h;
+    int		right;
+    int		bottom;
+    byte*	src;
+    byte*	dest;
+
+    if (renderscale == 1)
+	return;
+
+    right = viewwindowx + scaledviewwidth;
+    bottom = viewwindowy + scaledviewheight;
+
+    for (y=0 ; y<viewheight ; y++)
+    {
+	src = screenrows[y];
+	h = bottom - (src - I_VideoBuffer) / SCREENWIDTH;
+	if (h > renderscale)
+	    h = renderscale;
+
+	for (x=0 ; x<viewwidth<<detailshift ; x++)
+	{
+	    w = right - screencolumns[x];
+	    if (w > renderscale)
+		w = renderscale;
+
+	    dest = src + screencolumns[x];
+	    for (i=0 ; i<h ; i++, dest += SCREENWIDTH)
+		memset(dest, src[screencolumns[x]], w);
+	}
+    }
+}
+
+
 //
 // R_FillBackScreen
 // Fills the back screen with a pattern
@@ -825,6 +1224,8 @@ void R_FillBackScreen (void)
 
     char *name;
 
+    borderdrawn = false;
+
     // If we are running full screen, there is no need to do any of this,
     // and the background buffer can be freed if it was previously in use.
 
@@ -881,14 +1282,14 @@ void R_FillBackScreen (void)
     patch = W_CacheLumpName(DEH_String("brdr_b"),PU_CACHE);
 
     for (x=0 ; x<scaledviewwidth ; x+=8)
-	V_DrawPatch(viewwindowx+x, viewwindowy+viewheight, patch);
+	V_DrawPatch(viewwindowx+x, viewwindowy+scaledviewheight, patch);
     patch = W_CacheLumpName(DEH_String("brdr_l"),PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
+    for (y=0 ; y<scaledviewheight ; y+=8)
 	V_DrawPatch(viewwindowx-8, viewwindowy+y, patch);
     patch = W_CacheLumpName(DEH_String("brdr_r"),PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
+    for (y=0 ; y<scaledviewheight ; y+=8)
 	V_DrawPatch(viewwindowx+scaledviewwidth, viewwindowy+y, patch);
 
     // Draw beveled edge. 
@@ -901,11 +1302,11 @@ void R_FillBackScreen (void)
                 W_CacheLumpName(DEH_String("brdr_tr"),PU_CACHE));
     
     V_DrawPatch(viewwindowx-8,
-                viewwindowy+viewheight,
+                viewwindowy+scaledviewheight,
                 W_CacheLumpName(DEH_String("brdr_bl"),PU_CACHE));
     
     V_DrawPatch(viewwindowx+scaledviewwidth,
-                viewwindowy+viewheight,
+                viewwindowy+scaledviewheight,
                 W_CacheLumpName(DEH_String("brdr_br"),PU_CACHE));
 
     V_RestoreBuffer();
@@ -929,6 +1330,11 @@ R_VideoErase
     if (background_buffer != NULL)
     {
         memcpy(I_VideoBuffer + ofs, background_buffer + ofs, count); 
+        if (ofs % SCREENWIDTH + count <= SCREENWIDTH)
+            V_MarkRect (ofs % SCREENWIDTH, ofs / SCREENWIDTH, count, 1);
+        else
+            V_MarkRect (0, ofs / SCREENWIDTH, SCREENWIDTH,
+                        (ofs + count - 1) / SCREENWIDTH - ofs / SCREENWIDTH + 1);
     }
 } 
 
@@ -948,28 +1354,62 @@ void R_DrawViewBorder (void)
     if (scaledviewwidth == SCREENWIDTH) 
 	return; 
   
-    top = ((SCREENHEIGHT-SBARHEIGHT)-viewheight)/2; 
+    top = ((SCREENHEIGHT-SBARHEIGHT)-scaledviewheight)/2; 
     side = (SCREENWIDTH-scaledviewwidth)/2; 
  
     // copy top and one line of left side 
     R_VideoErase (0, top*SCREENWIDTH+side); 
  
     // copy one line of right side and bottom 
-    ofs = (viewheight+top)*SCREENWIDTH-side; 
+    ofs = (scaledviewheight+top)*SCREENWIDTH-side; 
     R_VideoErase (ofs, top*SCREENWIDTH+side); 
  
-    // copy sides using wraparound 
-    ofs = top*SCREENWIDTH + SCREENWIDTH-side; 
-    side <<= 1;
+    // copy sides, each its own strip so only they are marked
+    ofs = (top+1)*SCREENWIDTH;
     
-    for (i=1 ; i<viewheight ; i++) 
+    for (i=1 ; i<scaledviewheight ; i++) 
     { 
 	R_VideoErase (ofs, side); 
+	R_VideoErase (ofs - side, side); 
 	ofs += SCREENWIDTH; 
     } 
 
-    // ? 
-    V_MarkRect (0,0,SCREENWIDTH, SCREENHEIGHT-SBARHEIGHT); 
+    borderdrawn = true;
 } 
+
+//
+// R_EraseViewBorder
+// Copies the border back within a rect drawn over it,
+//  leaving the view alone.
+//
+void R_EraseViewBorder (int x1, int y1, int x2, int y2)
+{
+    int		y;
+    int		left;
+    int		right;
+
+    if (scaledviewwidth == SCREENWIDTH || background_buffer == NULL)
+	return;
+
+    if (y2 > SCREENHEIGHT-SBARHEIGHT)
+	y2 = SCREENHEIGHT-SBARHEIGHT;
+
+    left = viewwindowx;
+    right = viewwindowx + scaledviewwidth;
+
+    for (y = y1 ; y < y2 ; y++)
+    {
+	if (y < viewwindowy || y >= viewwindowy+scaledviewheight)
+	{
+	    R_VideoErase (y*SCREENWIDTH+x1, x2-x1);
+	    continue;
+	}
+	if (x1 < left)
+	    R_VideoErase (y*SCREENWIDTH+x1, (x2 < left ? x2 : left)-x1);
+	if (x2 > right)
+	    R_VideoErase (y*SCREENWIDTH+(x1 > right ? x1 : right),
+			  x2-(x1 > right ? x1 : right));
+    }
+}
  
  
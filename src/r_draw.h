@@ -21,17 +21,24 @@
 #define __R_DRAW__
 
 
+// The column and span parameters are per thread,
+//  so that queued draws (r_queue.c) can run
+//  on several threads at once.
+#ifdef _WIN32
+#define DRAWSTATE
+#else
+#define DRAWSTATE __thread
+#endif
 
-
-extern lighttable_t*	dc_colormap;
-extern int		dc_x;
-extern int		dc_yl;
-extern int		dc_yh;
-extern fixed_t		dc_iscale;
-extern fixed_t		dc_texturemid;
+extern DRAWSTATE lighttable_t*	dc_colormap;
+extern DRAWSTATE int		dc_x;
+extern DRAWSTATE int		dc_yl;
+extern DRAWSTATE int		dc_yh;
+extern DRAWSTATE fixed_t		dc_iscale;
+extern DRAWSTATE fixed_t		dc_texturemid;
 
 // first pixel in a column
-extern byte*		dc_source;		
+extern DRAWSTATE byte*		dc_source;		
 
 
 // The span blitting interface.
@@ -44,6 +51,17 @@ void 	R_DrawColumnLow (void);
 void 	R_DrawFuzzColumn (void);
 void 	R_DrawFuzzColumnLow (void);
 
+// Set by -shadowfuzz, to draw the fuzz with these instead.
+extern bool		shadowfuzz;
+
+void	R_DrawShadowColumn (void);
+void	R_DrawShadowColumnLow (void);
+
+// Copies rows dc_yl to dc_yh of a sky column
+//  from R_GetSkyColumn. Not queued, as nothing
+//  else draws over the sky before it is flushed.
+void	R_DrawSkyColumn (void);
+
 // Draw with color translation tables,
 //  for player sprite rendering,
 //  Green/Red/Blue/Indigo shirts.
@@ -55,22 +73,22 @@ R_VideoErase
 ( unsigned	ofs,
   int		count );
 
-extern int		ds_y;
-extern int		ds_x1;
-extern int		ds_x2;
+extern DRAWSTATE int		ds_y;
+extern DRAWSTATE int		ds_x1;
+extern DRAWSTATE int		ds_x2;
 
-extern lighttable_t*	ds_colormap;
+extern DRAWSTATE lighttable_t*	ds_colormap;
 
-extern fixed_t		ds_xfrac;
-extern fixed_t		ds_yfrac;
-extern fixed_t		ds_xstep;
-extern fixed_t		ds_ystep;
+extern DRAWSTATE fixed_t		ds_xfrac;
+extern DRAWSTATE fixed_t		ds_yfrac;
+extern DRAWSTATE fixed_t		ds_xstep;
+extern DRAWSTATE fixed_t		ds_ystep;
 
 // start of a 64*64 tile image
-extern byte*		ds_source;		
+extern DRAWSTATE byte*		ds_source;		
 
 extern byte*		translationtables;
-extern byte*		dc_translation;
+extern DRAWSTATE byte*		dc_translation;
 
 
 // Span blitting for rows, floor/ceiling.
@@ -81,11 +99,26 @@ void 	R_DrawSpan (void);
 void 	R_DrawSpanLow (void);
 
 
+// Screen pixels per rendered pixel of the view.
+extern int		renderscale;
+extern int		minrenderscale;
+
+// Set by -transposeview, see R_TransposeView.
+extern bool		transposeview;
+
 void
 R_InitBuffer
 ( int		width,
   int		height );
 
+// Fills in the pixels of the view that
+//  renderscale skips, for whole-screen reads.
+void	R_ExpandView (void);
+
+// Copies the view to the screen when
+//  it was drawn column by column.
+void	R_TransposeView (void);
+
 
 // Initialize color translation tables,
 //  for player rendering etc.
@@ -99,6 +132,11 @@ void R_FillBackScreen (void);
 // If the view size is not full screen, draws a border around it.
 void R_DrawViewBorder (void);
 
+// Puts the border back within a rect drawn over it.
+void R_EraseViewBorder (int x1, int y1, int x2, int y2);
+
+extern bool	borderdrawn;
+
 
 
 #endif
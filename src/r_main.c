@@ -27,12 +27,22 @@
 
 
 #include "doomdef.h"
+#include "doomgeneric.h"
 #include "d_loop.h"
+#include "i_system.h"
+#include "i_timer.h"
 
+#include "m_argv.h"
 #include "m_bbox.h"
 #include "m_menu.h"
+#include "m_timing.h"
+#include "m_trace.h"
+#include "p_tick.h"
+#include "z_zone.h"
 
 #include "r_local.h"
+#include "r_queue.h"
+#include "r_stats.h"
 #include "r_sky.h"
 
 
@@ -63,6 +73,9 @@ fixed_t			projection;
 // just for profiling purposes
 int			framecount;	
 
+// Includes calls from the playsim.
+uint64_t		pointtoanglecalls;
+
 int			sscount;
 int			linecount;
 int			loopcount;
@@ -70,6 +83,7 @@ int			loopcount;
 fixed_t			viewx;
 fixed_t			viewy;
 fixed_t			viewz;
+fixed_t			viewfrac = FRACUNIT;
 
 angle_t			viewangle;
 
@@ -95,7 +109,7 @@ int			viewangletox[FINEANGLES/2];
 // The xtoviewangleangle[] table maps a screen pixel
 // to the lowest viewangle that maps back to x ranges
 // from clipangle to -clipangle.
-angle_t			xtoviewangle[SCREENWIDTH+1];
+angle_t*		xtoviewangle;
 
 lighttable_t*		scalelight[LIGHTLEVELS][MAXLIGHTSCALE];
 lighttable_t*		scalelightfixed[MAXLIGHTSCALE];
@@ -104,6 +118,11 @@ lighttable_t*		zlight[LIGHTLEVELS][MAXLIGHTZ];
 // bumped light from gun blasts
 int			extralight;			
 
+// scalelight rows for each sector light level,
+//  with extralight and fake contrast already applied
+static lighttable_t**	lightrows[3][LIGHTLEVELS];
+static int		lightrowsextra = -1;
+
 
 
 void (*colfunc) (void);
@@ -277,6 +296,8 @@ R_PointToAngle
 ( fixed_t	x,
   fixed_t	y )
 {	
+    pointtoanglecalls++;
+
     x -= viewx;
     y -= viewy;
     
@@ -372,6 +393,24 @@ R_PointToAngle2
 }
 
 
+//
+// R_FixedDiv
+// FixedDiv for the renderer, in doubles rather than with a
+//  64-bit integer divide, which is slower on most CPUs. The
+//  dividend is under 2^48, so rounding the quotient to a
+//  double never takes it up to the next whole number, and
+//  truncating it gives FixedDiv's result exactly. The
+//  playsim keeps FixedDiv itself.
+//
+fixed_t R_FixedDiv (fixed_t a, fixed_t b)
+{
+    if ((abs(a) >> 14) >= abs(b))
+	return (a^b) < 0 ? INT_MIN : INT_MAX;
+
+    return (fixed_t) ((double) a * FRACUNIT / b);
+}
+
+
 fixed_t
 R_PointToDist
 ( fixed_t	x,
@@ -398,7 +437,7 @@ R_PointToDist
 
     if (dx != 0)
     {
-        frac = FixedDiv(dy, dx);
+        frac = R_FixedDiv(dy, dx);
     }
     else
     {
@@ -408,7 +447,7 @@ R_PointToDist
     angle = (tantoangle[frac>>DBITS]+ANG90) >> ANGLETOFINESHIFT;
 
     // use as cosine
-    dist = FixedDiv (dx, finesine[angle] );	
+    dist = R_FixedDiv (dx, finesine[angle] );	
 	
     return dist;
 }
@@ -484,7 +523,7 @@ fixed_t R_ScaleFromGlobalAngle (angle_t visangle)
 
     if (den > num>>16)
     {
-	scale = FixedDiv (num, den);
+	scale = R_FixedDiv (num, den);
 
 	if (scale > 64*FRACUNIT)
 	    scale = 64*FRACUNIT;
@@ -649,6 +688,26 @@ bool		setsizeneeded;
 int		setblocks;
 int		setdetail;
 
+// Frames of render time averaged before -autodetail steps
+#define AUTODETAIL_FRAMES	8
+
+// Of those runs of frames under half the budget, before it steps up
+#define AUTODETAIL_CALM		4
+
+// Blocks the view may be shrunk by, and the smallest it gets
+#define AUTODETAIL_SHRINK	3
+#define AUTODETAIL_MINBLOCKS	6
+
+// -autodetail: the render time budget in microseconds, 0 for none
+static int	autodetailbudget;
+
+// 0 for the view as set, 1 for low detail, and the view
+//  a block smaller for each level above that
+static int	autodetail;
+static int	autodetailtime;
+static int	autodetailframes;
+static int	autodetailcalm;
+
 
 void
 R_SetViewSize
@@ -661,6 +720,27 @@ R_SetViewSize
 }
 
 
+//
+// R_InitViewBuffers
+// Allocates the tables indexed by view
+//  column or row, for the full screen
+//  at the smallest renderscale.
+//
+static void R_InitViewBuffers (void)
+{
+    int		width;
+    int		height;
+
+    width = (SCREENWIDTH + minrenderscale - 1) / minrenderscale;
+    height = (SCREENHEIGHT + minrenderscale - 1) / minrenderscale;
+
+    xtoviewangle = Z_Malloc ((width+1) * sizeof(*xtoviewangle), PU_STATIC, NULL);
+    R_InitPlaneBuffers (width, height);
+    R_InitSegBuffers (width);
+    R_InitSpriteBuffers (width);
+}
+
+
 //
 // R_ExecuteSetViewSize
 //
@@ -672,22 +752,46 @@ void R_ExecuteSetViewSize (void)
     int		j;
     int		level;
     int		startmap; 	
+    int		blocks;
 
     setsizeneeded = false;
 
-    if (setblocks == 11)
+    blocks = setblocks;
+    detailshift = setdetail;
+
+    // -autodetail lowers the detail, then shrinks the view
+    //  while it has the status bar
+    if (autodetail)
+    {
+	detailshift = 1;
+
+	if (blocks <= 10)
+	    blocks -= autodetail-1;
+
+	// never below the smallest, unless set smaller
+	if (blocks < AUTODETAIL_MINBLOCKS)
+	    blocks = setblocks < AUTODETAIL_MINBLOCKS ? setblocks : AUTODETAIL_MINBLOCKS;
+    }
+
+    if (blocks == 11)
     {
 	scaledviewwidth = SCREENWIDTH;
-	viewheight = SCREENHEIGHT;
+	scaledviewheight = SCREENHEIGHT;
     }
     else
     {
-	scaledviewwidth = setblocks*32;
-	viewheight = (setblocks*168/10)&~7;
+	scaledviewwidth = blocks*32;
+	scaledviewheight = (blocks*168/10)&~7;
     }
-    
-    detailshift = setdetail;
-    viewwidth = scaledviewwidth>>detailshift;
+
+    // Sized for any renderscale the backend
+    //  may switch to, so this only happens once.
+    if (!xtoviewangle)
+	R_InitViewBuffers ();
+
+    // Sets viewwidth and viewheight,
+    //  scaled down by renderscale.
+    R_InitBuffer (scaledviewwidth, scaledviewheight);
 	
     centery = viewheight/2;
     centerx = viewwidth/2;
@@ -698,20 +802,21 @@ void R_ExecuteSetViewSize (void)
     if (!detailshift)
     {
 	colfunc = basecolfunc = R_DrawColumn;
-	fuzzcolfunc = R_DrawFuzzColumn;
+	fuzzcolfunc = shadowfuzz ? R_DrawShadowColumn : R_DrawFuzzColumn;
 	transcolfunc = R_DrawTranslatedColumn;
 	spanfunc = R_DrawSpan;
     }
     else
     {
 	colfunc = basecolfunc = R_DrawColumnLow;
-	fuzzcolfunc = R_DrawFuzzColumnLow;
+	fuzzcolfunc = shadowfuzz ? R_DrawShadowColumnLow : R_DrawFuzzColumnLow;
 	transcolfunc = R_DrawTranslatedColumnLow;
 	spanfunc = R_DrawSpanLow;
     }
 
-    R_InitBuffer (scaledviewwidth, viewheight);
-	
+    R_QueueDrawers ();
+    R_CountDrawers ();
+
     R_InitTextureMapping ();
     
     // psprite scales
@@ -758,6 +863,24 @@ void R_ExecuteSetViewSize (void)
 
 
 
+//
+// R_PrintPeaks
+// Reports how much of the per-frame buffers
+//  the busiest frame needed.
+//
+static void R_PrintPeaks (void)
+{
+    printf ("R_RenderPlayerView: peak of %i drawsegs, %i vissprites, "
+	    "%i visplanes, %i openings\n",
+	    peakdrawsegs, peakvissprites, peakvisplanes, peakopenings);
+
+    if (framecount)
+	printf ("R_PointToAngle: %llu calls, %llu per frame\n",
+		(unsigned long long) pointtoanglecalls,
+		(unsigned long long) pointtoanglecalls / framecount);
+}
+
+
 //
 // R_Init
 //
@@ -766,8 +889,39 @@ void R_ExecuteSetViewSize (void)
 
 void R_Init (void)
 {
+    int		p;
+
+    //!
+    // Draw the 3D view column by column into a separate
+    // buffer, copied to the screen when it is done.
+    //
+
+    transposeview = M_CheckParm ("-transposeview") > 0;
+
+    //!
+    // Draw spectres and invisible players as a fixed
+    // dithered shadow instead of the fuzz effect. It is
+    // cheaper, and doesn't change from frame to frame.
+    //
+
+    shadowfuzz = M_CheckParm ("-shadowfuzz") > 0;
+
+    //!
+    // @arg <ms>
+    //
+    // When drawing the 3D view takes longer than ms on average,
+    // switch to low detail, then make the view smaller, and go
+    // back once it takes less than half that again.
+    //
+
+    p = M_CheckParmWithArgs ("-autodetail", 1);
+
+    if (p)
+	autodetailbudget = atof (myargv[p+1]) * 1000;
+
     R_InitData ();
     printf (".");
+    M_StartupStep ("R_InitTables");
     R_InitPointToAngle ();
     printf (".");
     R_InitTables ();
@@ -781,7 +935,11 @@ void R_Init (void)
     printf (".");
     R_InitSkyMap ();
     R_InitTranslationTables ();
+    R_InitDrawQueue ();
+    R_InitRenderStats ();
     printf (".");
+
+    I_AtExit (R_PrintPeaks, true);
 	
     framecount = 0;
 }
@@ -817,6 +975,57 @@ R_PointInSubsector
 
 
 
+//
+// R_ClampLightRow
+//
+static lighttable_t** R_ClampLightRow (int lightnum)
+{
+    if (lightnum < 0)
+	return scalelight[0];
+    if (lightnum >= LIGHTLEVELS)
+	return scalelight[LIGHTLEVELS-1];
+    return scalelight[lightnum];
+}
+
+
+//
+// R_InitLightRows
+// Only extralight moves the rows around,
+//  light level changes just index another one.
+//
+static void R_InitLightRows (void)
+{
+    int		contrast;
+    int		i;
+
+    for (contrast = -1 ; contrast <= 1 ; contrast++)
+	for (i = 0 ; i < LIGHTLEVELS ; i++)
+	    lightrows[contrast+1][i] =
+		R_ClampLightRow (i + extralight + contrast);
+
+    lightrowsextra = extralight;
+}
+
+
+//
+// R_LightRow
+// The scalelight row for a sector light level.
+// Contrast is -1 or 1 for the fake contrast of
+//  axis aligned walls, 0 for anything else.
+//
+lighttable_t** R_LightRow (int lightlevel, int contrast)
+{
+    int		lightnum;
+
+    lightnum = lightlevel >> LIGHTSEGSHIFT;
+
+    if (lightnum >= 0 && lightnum < LIGHTLEVELS)
+	return lightrows[contrast+1][lightnum];
+
+    return R_ClampLightRow (lightnum + extralight + contrast);
+}
+
+
 //
 // R_SetupFrame
 //
@@ -825,12 +1034,37 @@ void R_SetupFrame (player_t* player)
     int		i;
     
     viewplayer = player;
-    viewx = player->mo->x;
-    viewy = player->mo->y;
-    viewangle = player->mo->angle + viewangleoffset;
+
+    // between tics, part way from where the last one started,
+    //  unless nothing moved in it, as when paused
+    if (uncapped && oldpositionstic == gametic - 1)
+	viewfrac = I_GetFracTime ();
+    else
+	viewfrac = FRACUNIT;
+
+    if (viewfrac < FRACUNIT)
+    {
+	mobj_t*	mo = player->mo;
+
+	viewx = mo->oldx + FixedMul (mo->x - mo->oldx, viewfrac);
+	viewy = mo->oldy + FixedMul (mo->y - mo->oldy, viewfrac);
+	viewangle = mo->oldangle
+		  + FixedMul (mo->angle - mo->oldangle, viewfrac)
+		  + viewangleoffset;
+	viewz = player->oldviewz
+	      + FixedMul (player->viewz - player->oldviewz, viewfrac);
+    }
+    else
+    {
+	viewx = player->mo->x;
+	viewy = player->mo->y;
+	viewangle = player->mo->angle + viewangleoffset;
+	viewz = player->viewz;
+    }
     extralight = player->extralight;
 
-    viewz = player->viewz;
+    if (extralight != lightrowsextra)
+	R_InitLightRows ();
     
     viewsin = finesine[viewangle>>ANGLETOFINESHIFT];
     viewcos = finecosine[viewangle>>ANGLETOFINESHIFT];
@@ -857,11 +1091,68 @@ void R_SetupFrame (player_t* player)
 
 
 
+//
+// R_AutoDetail
+// Steps the -autodetail level by the average time the
+//  view took to draw over the last few frames.
+//
+static void R_AutoDetail (int elapsed)
+{
+    int		average;
+    int		maxlevel;
+
+    autodetailtime += elapsed;
+
+    if (++autodetailframes < AUTODETAIL_FRAMES)
+	return;
+
+    average = autodetailtime / autodetailframes;
+    autodetailtime = 0;
+    autodetailframes = 0;
+
+    // no smaller than the smallest view, nor with a full screen one
+    maxlevel = 1;
+
+    if (setblocks <= 10 && setblocks > AUTODETAIL_MINBLOCKS)
+	maxlevel += setblocks - AUTODETAIL_MINBLOCKS;
+
+    if (maxlevel > 1 + AUTODETAIL_SHRINK)
+	maxlevel = 1 + AUTODETAIL_SHRINK;
+
+    if (average > autodetailbudget)
+    {
+	autodetailcalm = 0;
+
+	if (autodetail < maxlevel)
+	{
+	    autodetail++;
+	    setsizeneeded = true;
+	}
+    }
+    else if (autodetail > 0 && average < autodetailbudget / 2)
+    {
+	if (++autodetailcalm >= AUTODETAIL_CALM)
+	{
+	    autodetailcalm = 0;
+	    autodetail--;
+	    setsizeneeded = true;
+	}
+    }
+    else
+	autodetailcalm = 0;
+}
+
+
 //
 // R_RenderView
 //
 void R_RenderPlayerView (player_t* player)
 {	
+    uint64_t	start;
+
+    TRACE_BEGIN ("R_RenderPlayerView");
+    start = autodetailbudget ? DG_GetTicksUs () : 0;
+
     R_SetupFrame (player);
 
     // Clear buffers.
@@ -869,23 +1160,44 @@ void R_RenderPlayerView (player_t* player)
     R_ClearDrawSegs ();
     R_ClearPlanes ();
     R_ClearSprites ();
+    R_StartStatsFrame ();
     
     // check for new console commands.
     NetUpdate ();
 
     // The head node is the last node output.
+    M_StartStage (STAGE_BSP);
     R_RenderBSPNode (numnodes-1);
+    M_EndStage (STAGE_BSP);
     
     // Check for new console commands.
     NetUpdate ();
     
+    pixelkind = PIXELS_PLANES;
+    M_StartStage (STAGE_PLANES);
     R_DrawPlanes ();
+    M_EndStage (STAGE_PLANES);
     
     // Check for new console commands.
     NetUpdate ();
     
+    // Walls and flats are done, sprites and
+    //  masked textures draw over them in order.
+    M_StartStage (STAGE_QUEUE);
+    R_SortDrawQueue ();
+    M_StartStage (STAGE_MASKED);
     R_DrawMasked ();
+    M_EndStage (STAGE_MASKED);
+    R_FlushDrawQueue ();
+    R_TransposeView ();
+    M_EndStage (STAGE_QUEUE);
+    R_FinishStatsFrame ();
 
     // Check for new console commands.
     NetUpdate ();				
+
+    if (autodetailbudget)
+	R_AutoDetail (DG_GetTicksUs () - start);
+
+    TRACE_END ("R_RenderPlayerView");
 }
@@ -123,6 +123,10 @@ R_PointToAngle2
   fixed_t	x2,
   fixed_t	y2 );
 
+lighttable_t** R_LightRow (int lightlevel, int contrast);
+
+fixed_t R_FixedDiv (fixed_t a, fixed_t b);
+
 fixed_t
 R_PointToDist
 ( fixed_t	x,
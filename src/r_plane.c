@@ -31,6 +31,7 @@
 
 #include "r_local.h"
 #include "r_sky.h"
+#include "r_stats.h"
 
 
 
@@ -42,16 +43,40 @@ planefunction_t		ceilingfunc;
 //
 
 // Here comes the obnoxious "visplane".
+// The pool grows whenever a frame needs more,
+//  and planes never move once allocated.
 #define MAXVISPLANES	128
-visplane_t		visplanes[MAXVISPLANES];
-visplane_t*		lastvisplane;
+static visplane_t**	visplanes;
+int			numvisplanes;
+static int		maxvisplanes;
+static int		planewidth;
+
+// R_FindPlane looks planes up by height,
+//  picnum and lightlevel.
+#define VISPLANEHASH	128
+#define R_VisplaneHash(height, picnum, lightlevel) \
+    (((unsigned) (picnum) * 3 + (unsigned) (lightlevel) \
+      + (unsigned) (height) * 7) & (VISPLANEHASH - 1))
+static visplane_t*	visplanehash[VISPLANEHASH];
+
 visplane_t*		floorplane;
 visplane_t*		ceilingplane;
 
-// ?
-#define MAXOPENINGS	SCREENWIDTH*64
-short			openings[MAXOPENINGS];
-short*			lastopening;
+// Handed out by R_NewOpenings from chunks of
+//  maxopenings each. The first one is kept,
+//  the others are dropped with the level.
+#define MAXOPENINGCHUNKS	64
+static short*		openingchunks[MAXOPENINGCHUNKS];
+static int		openingchunk;
+static short*		lastopening;
+static int		maxopenings;
+static int		numopenings;
+
+int			peakopenings;
+int			peakvisplanes;
+
+// The flat R_MapPlane draws, for -mipmaps
+static int		planeflat;
 
 
 //
@@ -59,15 +84,15 @@ short*			lastopening;
 //  floorclip starts out SCREENHEIGHT
 //  ceilingclip starts out -1
 //
-short			floorclip[SCREENWIDTH];
-short			ceilingclip[SCREENWIDTH];
+short*			floorclip;
+short*			ceilingclip;
 
 //
 // spanstart holds the start of a plane span
 // initialized to 0 at start
 //
-int			spanstart[SCREENHEIGHT];
-int			spanstop[SCREENHEIGHT];
+int*			spanstart;
+int*			spanstop;
 
 //
 // texture mapping
@@ -75,15 +100,15 @@ int			spanstop[SCREENHEIGHT];
 lighttable_t**		planezlight;
 fixed_t			planeheight;
 
-fixed_t			yslope[SCREENHEIGHT];
-fixed_t			distscale[SCREENWIDTH];
+fixed_t*		yslope;
+fixed_t*		distscale;
 fixed_t			basexscale;
 fixed_t			baseyscale;
 
-fixed_t			cachedheight[SCREENHEIGHT];
-fixed_t			cacheddistance[SCREENHEIGHT];
-fixed_t			cachedxstep[SCREENHEIGHT];
-fixed_t			cachedystep[SCREENHEIGHT];
+fixed_t*		cachedheight;
+fixed_t*		cacheddistance;
+fixed_t*		cachedxstep;
+fixed_t*		cachedystep;
 
 
 
@@ -97,6 +122,77 @@ void R_InitPlanes (void)
 }
 
 
+//
+// R_GrowPlanes
+// Adds planes to the pool until it holds count.
+//
+static void R_GrowPlanes (int count)
+{
+    visplane_t**	newplanes;
+    visplane_t*		pl;
+    byte*		buffer;
+
+    newplanes = Z_Malloc (count * sizeof(*newplanes), PU_STATIC, NULL);
+    if (visplanes)
+    {
+	memcpy (newplanes, visplanes, maxvisplanes * sizeof(*newplanes));
+	Z_Free (visplanes);
+    }
+    visplanes = newplanes;
+
+    for ( ; maxvisplanes<count ; maxvisplanes++)
+    {
+	// top and bottom each get a pad at either end
+	pl = Z_Malloc (sizeof(*pl) + 2*(planewidth+2), PU_STATIC, NULL);
+	buffer = (byte *) (pl + 1);
+	pl->top = buffer + 1;
+	pl->bottom = buffer + planewidth + 3;
+	visplanes[maxvisplanes] = pl;
+    }
+}
+
+
+//
+// R_NewPlane
+//
+static visplane_t* R_NewPlane (void)
+{
+    if (numvisplanes == maxvisplanes)
+	R_GrowPlanes (maxvisplanes * 2);
+
+    return visplanes[numvisplanes++];
+}
+
+
+//
+// R_InitPlaneBuffers
+// Allocates everything indexed by view
+//  column or row, for views of up to
+//  width x height rendered pixels.
+//
+void R_InitPlaneBuffers (int width, int height)
+{
+    maxopenings = width*64;
+    openingchunks[0] = Z_Malloc (maxopenings * sizeof(**openingchunks),
+				 PU_STATIC, NULL);
+
+    floorclip = Z_Malloc (width * sizeof(*floorclip), PU_STATIC, NULL);
+    ceilingclip = Z_Malloc (width * sizeof(*ceilingclip), PU_STATIC, NULL);
+    distscale = Z_Malloc (width * sizeof(*distscale), PU_STATIC, NULL);
+
+    spanstart = Z_Malloc (height * sizeof(*spanstart), PU_STATIC, NULL);
+    spanstop = Z_Malloc (height * sizeof(*spanstop), PU_STATIC, NULL);
+    yslope = Z_Malloc (height * sizeof(*yslope), PU_STATIC, NULL);
+    cachedheight = Z_Malloc (height * sizeof(*cachedheight), PU_STATIC, NULL);
+    cacheddistance = Z_Malloc (height * sizeof(*cacheddistance), PU_STATIC, NULL);
+    cachedxstep = Z_Malloc (height * sizeof(*cachedxstep), PU_STATIC, NULL);
+    cachedystep = Z_Malloc (height * sizeof(*cachedystep), PU_STATIC, NULL);
+
+    planewidth = width;
+    R_GrowPlanes (MAXVISPLANES);
+}
+
+
 //
 // R_MapPlane
 //
@@ -120,6 +216,7 @@ R_MapPlane
     fixed_t	distance;
     fixed_t	length;
     unsigned	index;
+    int		level;
 	
 #ifdef RANGECHECK
     if (x2 < x1
@@ -150,6 +247,17 @@ R_MapPlane
     ds_xfrac = viewx + FixedMul(finecosine[angle], length);
     ds_yfrac = -viewy - FixedMul(finesine[angle], length);
 
+    if (mipmaps)
+    {
+	level = R_MipLevel (abs(ds_xstep) > abs(ds_ystep)
+			    ? abs(ds_xstep) : abs(ds_ystep));
+	ds_source = R_GetMipFlat (planeflat, level);
+	ds_xfrac >>= level;
+	ds_yfrac >>= level;
+	ds_xstep >>= level;
+	ds_ystep >>= level;
+    }
+
     if (fixedcolormap)
 	ds_colormap = fixedcolormap;
     else
@@ -187,11 +295,20 @@ void R_ClearPlanes (void)
 	ceilingclip[i] = -1;
     }
 
-    lastvisplane = visplanes;
-    lastopening = openings;
+    if (numvisplanes > peakvisplanes)
+	peakvisplanes = numvisplanes;
+    if (numopenings > peakopenings)
+	peakopenings = numopenings;
+
+    numvisplanes = 0;
+    memset (visplanehash, 0, sizeof(visplanehash));
+
+    openingchunk = 0;
+    lastopening = openingchunks[0];
+    numopenings = 0;
     
     // texture calculation
-    memset (cachedheight, 0, sizeof(cachedheight));
+    memset (cachedheight, 0, viewheight * sizeof(*cachedheight));
 
     // left to right mapping
     angle = (viewangle-ANG90)>>ANGLETOFINESHIFT;
@@ -204,6 +321,36 @@ void R_ClearPlanes (void)
 
 
 
+//
+// R_NewOpenings
+// Returns room for count openings, which
+//  stays put until the next frame.
+//
+short* R_NewOpenings (int count)
+{
+    short*	result;
+
+    if (lastopening + count > openingchunks[openingchunk] + maxopenings)
+    {
+	if (++openingchunk == MAXOPENINGCHUNKS)
+	    I_Error ("R_NewOpenings: more than %i openings",
+		     MAXOPENINGCHUNKS * maxopenings);
+
+	if (!openingchunks[openingchunk])
+	    Z_Malloc (maxopenings * sizeof(**openingchunks), PU_LEVEL,
+		      &openingchunks[openingchunk]);
+
+	lastopening = openingchunks[openingchunk];
+    }
+
+    result = lastopening;
+    lastopening += count;
+    numopenings += count;
+
+    return result;
+}
+
+
 //
 // R_FindPlane
 //
@@ -214,31 +361,32 @@ R_FindPlane
   int		lightlevel )
 {
     visplane_t*	check;
+    unsigned	hash;
 	
     if (picnum == skyflatnum)
     {
 	height = 0;			// all skys map together
 	lightlevel = 0;
     }
-	
-    for (check=visplanes; check<lastvisplane; check++)
+
+    // Planes split off by R_CheckPlane are never
+    //  chained, the first one with a key always
+    //  comes first, as it did in the linear scan.
+    hash = R_VisplaneHash (height, picnum, lightlevel);
+
+    for (check=visplanehash[hash]; check; check=check->next)
     {
 	if (height == check->height
 	    && picnum == check->picnum
 	    && lightlevel == check->lightlevel)
 	{
-	    break;
+	    return check;
 	}
     }
-    
-			
-    if (check < lastvisplane)
-	return check;
-		
-    if (lastvisplane - visplanes == MAXVISPLANES)
-	I_Error ("R_FindPlane: no more visplanes");
-		
-    lastvisplane++;
+
+    check = R_NewPlane ();
+    check->next = visplanehash[hash];
+    visplanehash[hash] = check;
 
     check->height = height;
     check->picnum = picnum;
@@ -246,7 +394,7 @@ R_FindPlane
     check->minx = SCREENWIDTH;
     check->maxx = -1;
     
-    memset (check->top,0xff,sizeof(check->top));
+    memset (check->top,0xff,viewwidth);
 		
     return check;
 }
@@ -266,6 +414,7 @@ R_CheckPlane
     int		unionl;
     int		unionh;
     int		x;
+    visplane_t*	newpl;
 	
     if (start < pl->minx)
     {
@@ -303,15 +452,16 @@ R_CheckPlane
     }
 	
     // make a new visplane
-    lastvisplane->height = pl->height;
-    lastvisplane->picnum = pl->picnum;
-    lastvisplane->lightlevel = pl->lightlevel;
+    newpl = R_NewPlane ();
+    newpl->height = pl->height;
+    newpl->picnum = pl->picnum;
+    newpl->lightlevel = pl->lightlevel;
     
-    pl = lastvisplane++;
+    pl = newpl;
     pl->minx = start;
     pl->maxx = stop;
 
-    memset (pl->top,0xff,sizeof(pl->top));
+    memset (pl->top,0xff,viewwidth);
 		
     return pl;
 }
@@ -364,24 +514,12 @@ void R_DrawPlanes (void)
     int			x;
     int			stop;
     int			angle;
-    int                 lumpnum;
+    int			i;
 				
-#ifdef RANGECHECK
-    if (ds_p - drawsegs > MAXDRAWSEGS)
-	I_Error ("R_DrawPlanes: drawsegs overflow (%i)",
-		 ds_p - drawsegs);
-    
-    if (lastvisplane - visplanes > MAXVISPLANES)
-	I_Error ("R_DrawPlanes: visplane overflow (%i)",
-		 lastvisplane - visplanes);
-    
-    if (lastopening - openings > MAXOPENINGS)
-	I_Error ("R_DrawPlanes: opening overflow (%i)",
-		 lastopening - openings);
-#endif
-
-    for (pl = visplanes ; pl < lastvisplane ; pl++)
+    for (i = 0 ; i < numvisplanes ; i++)
     {
+	pl = visplanes[i];
+
 	if (pl->minx > pl->maxx)
 	    continue;
 
@@ -397,6 +535,7 @@ void R_DrawPlanes (void)
 	    //  by INVUL inverse mapping.
 	    dc_colormap = colormaps;
 	    dc_texturemid = skytexturemid;
+	    pixelkind = PIXELS_SKY;
 	    for (x=pl->minx ; x <= pl->maxx ; x++)
 	    {
 		dc_yl = pl->top[x];
@@ -406,16 +545,20 @@ void R_DrawPlanes (void)
 		{
 		    angle = (viewangle + xtoviewangle[x])>>ANGLETOSKYSHIFT;
 		    dc_x = x;
-		    dc_source = R_GetColumn(skytexture, angle);
-		    colfunc ();
+		    dc_source = R_GetSkyColumn (angle, dc_iscale);
+		    R_DrawSkyColumn ();
+
+		    if (renderstats)
+			pixelcounts[PIXELS_SKY] += (dc_yh - dc_yl + 1) << detailshift;
 		}
 	    }
+	    pixelkind = PIXELS_PLANES;
 	    continue;
 	}
 	
 	// regular flat
-        lumpnum = firstflat + flattranslation[pl->picnum];
-	ds_source = W_CacheLumpNum(lumpnum, PU_STATIC);
+	planeflat = flattranslation[pl->picnum];
+	ds_source = R_GetFlat (planeflat);
 	
 	planeheight = abs(pl->height-viewz);
 	light = (pl->lightlevel >> LIGHTSEGSHIFT)+extralight;
@@ -440,7 +583,5 @@ void R_DrawPlanes (void)
 			pl->top[x],
 			pl->bottom[x]);
 	}
-	
-        W_ReleaseLumpNum(lumpnum);
     }
 }
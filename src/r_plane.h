@@ -25,8 +25,12 @@
 
 
 
-// Visplane related.
-extern  short*		lastopening;
+// Most openings and visplanes used by a frame so far.
+extern int		peakopenings;
+extern int		peakvisplanes;
+
+// Visplanes used by the frame being drawn.
+extern int		numvisplanes;
 
 
 typedef void (*planefunction_t) (int top, int bottom);
@@ -34,15 +38,18 @@ typedef void (*planefunction_t) (int top, int bottom);
 extern planefunction_t	floorfunc;
 extern planefunction_t	ceilingfunc_t;
 
-extern short		floorclip[SCREENWIDTH];
-extern short		ceilingclip[SCREENWIDTH];
+extern short*		floorclip;
+extern short*		ceilingclip;
 
-extern fixed_t		yslope[SCREENHEIGHT];
-extern fixed_t		distscale[SCREENWIDTH];
+extern fixed_t*		yslope;
+extern fixed_t*		distscale;
 
 void R_InitPlanes (void);
+void R_InitPlaneBuffers (int width, int height);
 void R_ClearPlanes (void);
 
+short* R_NewOpenings (int count);
+
 void
 R_MapPlane
 ( int		y,
@@ -0,0 +1,432 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Deferred column and span drawing.
+//	With -renderthreads, the drawers only record their
+//	parameters while the view is walked. The records are
+//	then replayed by worker threads, each one owning a
+//	horizontal band of the view, so that every pixel is
+//	still drawn in the original order.
+//	Walls and flats never overlap, so those are sorted by
+//	texture before they are drawn, to keep each texture
+//	in the cache while it is used.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "doomdef.h"
+
+#include "i_system.h"
+#include "m_argv.h"
+#include "m_trace.h"
+#include "z_zone.h"
+
+#include "r_local.h"
+#include "r_queue.h"
+
+
+#define MAXRENDERTHREADS	16
+
+enum
+{
+    DRAW_COLUMN,
+    DRAW_TRANSLATED,
+    DRAW_SHADOW,
+    DRAW_SPAN
+};
+
+typedef struct
+{
+    int			kind;
+    lighttable_t*	colormap;
+    byte*		source;
+
+    union
+    {
+	struct
+	{
+	    int		x;
+	    int		yl;
+	    int		yh;
+	    fixed_t	iscale;
+	    fixed_t	texturemid;
+	    byte*	translation;
+	} col;
+
+	struct
+	{
+	    int		y;
+	    int		x1;
+	    int		x2;
+	    fixed_t	xfrac;
+	    fixed_t	yfrac;
+	    fixed_t	xstep;
+	    fixed_t	ystep;
+	} span;
+    } u;
+} drawcmd_t;
+
+int		renderthreads;
+bool		queuedraws;
+
+static drawcmd_t*	drawcmds;
+static int		numdrawcmds;
+static int		maxdrawcmds;
+
+// The drawers picked by R_ExecuteSetViewSize,
+//  which the queued records are replayed with.
+static void		(*drawcolfunc) (void);
+static void		(*drawtranscolfunc) (void);
+static void		(*drawfuzzcolfunc) (void);
+static void		(*drawspanfunc) (void);
+
+
+//
+// R_DrawBand
+// Replays the queue, clipped to rows [top,bottom).
+//
+static void R_DrawBand (int top, int bottom)
+{
+    drawcmd_t*	cmd;
+    drawcmd_t*	end;
+
+    end = drawcmds + numdrawcmds;
+
+    for (cmd = drawcmds ; cmd < end ; cmd++)
+    {
+	if (cmd->kind == DRAW_SPAN)
+	{
+	    if (cmd->u.span.y < top || cmd->u.span.y >= bottom)
+		continue;
+
+	    ds_y = cmd->u.span.y;
+	    ds_x1 = cmd->u.span.x1;
+	    ds_x2 = cmd->u.span.x2;
+	    ds_colormap = cmd->colormap;
+	    ds_source = cmd->source;
+	    ds_xfrac = cmd->u.span.xfrac;
+	    ds_yfrac = cmd->u.span.yfrac;
+	    ds_xstep = cmd->u.span.xstep;
+	    ds_ystep = cmd->u.span.ystep;
+	    drawspanfunc ();
+	    continue;
+	}
+
+	// columns only need their part of the band
+	dc_yl = cmd->u.col.yl < top ? top : cmd->u.col.yl;
+	dc_yh = cmd->u.col.yh >= bottom ? bottom - 1 : cmd->u.col.yh;
+	if (dc_yl > dc_yh)
+	    continue;
+
+	dc_x = cmd->u.col.x;
+	dc_colormap = cmd->colormap;
+	dc_source = cmd->source;
+	dc_iscale = cmd->u.col.iscale;
+	dc_texturemid = cmd->u.col.texturemid;
+
+	if (cmd->kind == DRAW_TRANSLATED)
+	{
+	    dc_translation = cmd->u.col.translation;
+	    drawtranscolfunc ();
+	}
+	else if (cmd->kind == DRAW_SHADOW)
+	{
+	    drawfuzzcolfunc ();
+	}
+	else
+	{
+	    drawcolfunc ();
+	}
+    }
+}
+
+
+#ifndef _WIN32
+
+static pthread_t	threads[MAXRENDERTHREADS];
+static pthread_mutex_t	queuelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	queuestart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	queuedone = PTHREAD_COND_INITIALIZER;
+
+// Bumped for every flush, each worker runs once per generation.
+static unsigned		queuegeneration;
+static int		busythreads;
+
+// Started on the first flush, so that the sessions -server
+//  forks each have their own.
+static bool		threadsstarted;
+
+static void *R_DrawThread (void *arg)
+{
+    int		band;
+    unsigned	generation;
+
+    band = (int) (intptr_t) arg;
+    generation = 0;
+
+    for (;;)
+    {
+	pthread_mutex_lock (&queuelock);
+	while (queuegeneration == generation)
+	    pthread_cond_wait (&queuestart, &queuelock);
+	generation = queuegeneration;
+	pthread_mutex_unlock (&queuelock);
+
+	TRACE_BEGIN ("R_DrawBand");
+	R_DrawBand (band * viewheight / renderthreads,
+		    (band + 1) * viewheight / renderthreads);
+	TRACE_END ("R_DrawBand");
+
+	pthread_mutex_lock (&queuelock);
+	if (--busythreads == 0)
+	    pthread_cond_signal (&queuedone);
+	pthread_mutex_unlock (&queuelock);
+    }
+
+    return NULL;
+}
+
+static void R_StartDrawThreads (void)
+{
+    int		i;
+
+    for (i = 0 ; i < renderthreads ; i++)
+    {
+	if (pthread_create (&threads[i], NULL, R_DrawThread, (void *) (intptr_t) i))
+	    I_Error ("R_StartDrawThreads: failed to start render thread %i", i);
+    }
+
+    threadsstarted = true;
+}
+
+#endif
+
+
+//
+// R_FlushDrawQueue
+// Also called by the zone allocator before
+//  it purges anything a record may point into.
+//
+void R_FlushDrawQueue (void)
+{
+    if (!numdrawcmds)
+	return;
+
+#ifndef _WIN32
+    if (renderthreads)
+    {
+	if (!threadsstarted)
+	    R_StartDrawThreads ();
+
+	pthread_mutex_lock (&queuelock);
+	busythreads = renderthreads;
+	queuegeneration++;
+	pthread_cond_broadcast (&queuestart);
+	while (busythreads)
+	    pthread_cond_wait (&queuedone, &queuelock);
+	pthread_mutex_unlock (&queuelock);
+    }
+    else
+#endif
+    {
+	R_DrawBand (0, viewheight);
+    }
+
+    numdrawcmds = 0;
+}
+
+
+static int R_CompareDrawCmds (const void *a, const void *b)
+{
+    const drawcmd_t*	ca = a;
+    const drawcmd_t*	cb = b;
+
+    if (ca->kind != cb->kind)
+	return ca->kind - cb->kind;
+    if (ca->source != cb->source)
+	return ca->source < cb->source ? -1 : 1;
+    if (ca->colormap != cb->colormap)
+	return ca->colormap < cb->colormap ? -1 : 1;
+
+    // keeps the order independent of qsort
+    if (ca->kind == DRAW_SPAN)
+    {
+	if (ca->u.span.y != cb->u.span.y)
+	    return ca->u.span.y - cb->u.span.y;
+	return ca->u.span.x1 - cb->u.span.x1;
+    }
+
+    if (ca->u.col.x != cb->u.col.x)
+	return ca->u.col.x - cb->u.col.x;
+    return ca->u.col.yl - cb->u.col.yl;
+}
+
+
+//
+// R_SortDrawQueue
+// Only valid for draws that don't overlap,
+//  anything queued later is drawn after them.
+//
+void R_SortDrawQueue (void)
+{
+    if (numdrawcmds > 1)
+	qsort (drawcmds, numdrawcmds, sizeof(*drawcmds), R_CompareDrawCmds);
+}
+
+
+static drawcmd_t *R_NewDrawCmd (int kind)
+{
+    if (numdrawcmds == maxdrawcmds)
+    {
+	maxdrawcmds = maxdrawcmds ? maxdrawcmds * 2 : 4096;
+	drawcmds = realloc (drawcmds, maxdrawcmds * sizeof(*drawcmds));
+	if (drawcmds == NULL)
+	    I_Error ("R_NewDrawCmd: out of memory for %i draws", maxdrawcmds);
+    }
+
+    drawcmds[numdrawcmds].kind = kind;
+    return &drawcmds[numdrawcmds++];
+}
+
+static void R_QueueColumnKind (int kind)
+{
+    drawcmd_t*	cmd;
+
+    if (dc_yl > dc_yh)
+	return;
+
+    cmd = R_NewDrawCmd (kind);
+    cmd->colormap = dc_colormap;
+    cmd->source = dc_source;
+    cmd->u.col.x = dc_x;
+    cmd->u.col.yl = dc_yl;
+    cmd->u.col.yh = dc_yh;
+    cmd->u.col.iscale = dc_iscale;
+    cmd->u.col.texturemid = dc_texturemid;
+    cmd->u.col.translation = dc_translation;
+}
+
+static void R_QueueColumn (void)
+{
+    R_QueueColumnKind (DRAW_COLUMN);
+}
+
+static void R_QueueTranslatedColumn (void)
+{
+    R_QueueColumnKind (DRAW_TRANSLATED);
+}
+
+// Fuzz reads the pixels above and below,
+//  which may belong to another band.
+// It is rare enough to draw in place.
+// The -shadowfuzz shadow only reads the pixels
+//  it draws over, so that one is queued.
+static void R_QueueFuzzColumn (void)
+{
+    if (shadowfuzz)
+    {
+	R_QueueColumnKind (DRAW_SHADOW);
+	return;
+    }
+
+    R_FlushDrawQueue ();
+    drawfuzzcolfunc ();
+}
+
+static void R_QueueSpan (void)
+{
+    drawcmd_t*	cmd;
+
+    cmd = R_NewDrawCmd (DRAW_SPAN);
+    cmd->colormap = ds_colormap;
+    cmd->source = ds_source;
+    cmd->u.span.y = ds_y;
+    cmd->u.span.x1 = ds_x1;
+    cmd->u.span.x2 = ds_x2;
+    cmd->u.span.xfrac = ds_xfrac;
+    cmd->u.span.yfrac = ds_yfrac;
+    cmd->u.span.xstep = ds_xstep;
+    cmd->u.span.ystep = ds_ystep;
+}
+
+
+//
+// R_QueueDrawers
+//
+void R_QueueDrawers (void)
+{
+    if (!queuedraws)
+	return;
+
+    drawcolfunc = basecolfunc;
+    drawtranscolfunc = transcolfunc;
+    drawfuzzcolfunc = fuzzcolfunc;
+    drawspanfunc = spanfunc;
+
+    colfunc = basecolfunc = R_QueueColumn;
+    transcolfunc = R_QueueTranslatedColumn;
+    fuzzcolfunc = R_QueueFuzzColumn;
+    spanfunc = R_QueueSpan;
+}
+
+
+//
+// R_InitDrawQueue
+//
+void R_InitDrawQueue (void)
+{
+    int		i;
+
+    //!
+    // Queue the 3D view's columns and spans, and draw
+    // them sorted by texture.
+    //
+
+    queuedraws = M_CheckParm ("-drawqueue") > 0;
+
+    //!
+    // @arg <n>
+    //
+    // Draw the 3D view with n threads, each one
+    // drawing a horizontal band of it. Implies -drawqueue.
+    //
+
+    i = M_CheckParmWithArgs ("-renderthreads", 1);
+    if (i > 0)
+    {
+	renderthreads = atoi (myargv[i + 1]);
+	if (renderthreads < 2)
+	    renderthreads = 0;
+	if (renderthreads > MAXRENDERTHREADS)
+	    renderthreads = MAXRENDERTHREADS;
+    }
+
+#ifdef _WIN32
+    if (renderthreads)
+    {
+	printf ("R_InitDrawQueue: -renderthreads is not supported on Windows\n");
+	renderthreads = 0;
+    }
+#endif
+
+    if (renderthreads)
+	queuedraws = true;
+
+    if (queuedraws)
+	Z_SetPurgeCallback (R_FlushDrawQueue);
+}
@@ -0,0 +1,43 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Deferred column and span drawing.
+//
+
+
+#ifndef __R_QUEUE__
+#define __R_QUEUE__
+
+#include "doomtype.h"
+
+// Threads drawing the queued columns and spans,
+//  0 when they are drawn immediately.
+extern int		renderthreads;
+
+// Set by -drawqueue or -renderthreads.
+extern bool		queuedraws;
+
+// Called at startup, reads -renderthreads.
+void	R_InitDrawQueue (void);
+
+// Called once R_ExecuteSetViewSize has picked the
+//  drawers, to queue calls to them instead.
+void	R_QueueDrawers (void);
+
+// Sorts what has been queued so far by texture.
+// Only for draws that don't overlap.
+void	R_SortDrawQueue (void);
+
+// Draws everything queued so far.
+void	R_FlushDrawQueue (void);
+
+#endif
@@ -25,12 +25,20 @@
 #include <stdlib.h>
 
 #include "i_system.h"
+#include "z_zone.h"
 
 #include "doomdef.h"
 #include "doomstat.h"
 
 #include "r_local.h"
 #include "r_sky.h"
+#include "r_stats.h"
+
+#include "i_simd.h"
+
+#ifdef HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
 
 
 // OPTIMIZE: closed two sided lines as single sided
@@ -47,6 +55,12 @@ int		toptexture;
 int		bottomtexture;
 int		midtexture;
 
+// The columns of each tier's texture, looked up
+//  once a seg instead of once a column.
+static byte**	topcolumns;
+static byte**	bottomcolumns;
+static byte**	midcolumns;
+
 
 angle_t		rw_normalangle;
 // angle to line origin
@@ -87,6 +101,46 @@ lighttable_t**	walllights;
 
 short*		maskedtexturecol;
 
+// What R_RenderSegLoop works out for each column of
+//  a seg before it draws any, indexed by view column.
+static int*	segyl;		// clipped to the openings
+static int*	segyh;
+static int*	segtexcol;
+static unsigned* seglight;	// index into walllights
+static fixed_t*	segiscale;
+static int*	segtop;		// bottom of the top tier
+static int*	segbottom;	// top of the bottom tier
+
+
+//
+// R_InitSegBuffers
+// For views of up to width columns.
+//
+void R_InitSegBuffers (int width)
+{
+    segyl = Z_Malloc (width * sizeof(*segyl), PU_STATIC, NULL);
+    segyh = Z_Malloc (width * sizeof(*segyh), PU_STATIC, NULL);
+    segtexcol = Z_Malloc (width * sizeof(*segtexcol), PU_STATIC, NULL);
+    seglight = Z_Malloc (width * sizeof(*seglight), PU_STATIC, NULL);
+    segiscale = Z_Malloc (width * sizeof(*segiscale), PU_STATIC, NULL);
+    segtop = Z_Malloc (width * sizeof(*segtop), PU_STATIC, NULL);
+    segbottom = Z_Malloc (width * sizeof(*segbottom), PU_STATIC, NULL);
+}
+
+
+
+//
+// R_SegContrast
+// Fake contrast for walls along the axes.
+//
+static int R_SegContrast (seg_t* seg)
+{
+    if (seg->v1->y == seg->v2->y)
+	return -1;
+    if (seg->v1->x == seg->v2->x)
+	return 1;
+    return 0;
+}
 
 
 //
@@ -100,8 +154,9 @@ R_RenderMaskedSegRange
 {
     unsigned	index;
     column_t*	col;
-    int		lightnum;
     int		texnum;
+    byte**	columns;
+    int		mask;
     
     // Calculate light table.
     // Use different light tables
@@ -112,21 +167,10 @@ R_RenderMaskedSegRange
     backsector = curline->backsector;
     texnum = texturetranslation[curline->sidedef->midtexture];
 	
-    lightnum = (frontsector->lightlevel >> LIGHTSEGSHIFT)+extralight;
-
-    if (curline->v1->y == curline->v2->y)
-	lightnum--;
-    else if (curline->v1->x == curline->v2->x)
-	lightnum++;
-
-    if (lightnum < 0)		
-	walllights = scalelight[0];
-    else if (lightnum >= LIGHTLEVELS)
-	walllights = scalelight[LIGHTLEVELS-1];
-    else
-	walllights = scalelight[lightnum];
+    walllights = R_LightRow (frontsector->lightlevel, R_SegContrast (curline));
 
     maskedtexturecol = ds->maskedtexturecol;
+    pixelkind = PIXELS_MASKED;
 
     rw_scalestep = ds->scalestep;		
     spryscale = ds->scale1 + (x1 - ds->x1)*rw_scalestep;
@@ -150,6 +194,9 @@ R_RenderMaskedSegRange
 			
     if (fixedcolormap)
 	dc_colormap = fixedcolormap;
+
+    columns = R_TextureColumns (texnum);
+    mask = texturewidthmask[texnum];
     
     // draw the columns
     for (dc_x = x1 ; dc_x <= x2 ; dc_x++)
@@ -172,7 +219,7 @@ R_RenderMaskedSegRange
 	    
 	    // draw the texture
 	    col = (column_t *)( 
-		(byte *)R_GetColumn(texnum,maskedtexturecol[dc_x]) -3);
+		columns[maskedtexturecol[dc_x] & mask] -3);
 			
 	    R_DrawMaskedColumn (col);
 	    maskedtexturecol[dc_x] = SHRT_MAX;
@@ -196,25 +243,237 @@ R_RenderMaskedSegRange
 #define HEIGHTBITS		12
 #define HEIGHTUNIT		(1<<HEIGHTBITS)
 
-void R_RenderSegLoop (void)
+// A column of a tier: straight from its texture's
+//  columns, or a mip level's.
+static inline byte*
+R_WallColumn
+( int		tex,
+  byte**	columns,
+  int		col,
+  int		level )
+{
+    if (level)
+	return R_GetMipColumn (tex, col, level);
+
+    return columns[col & texturewidthmask[tex]];
+}
+
+#ifdef HAVE_AVX2_KERNELS
+//
+// R_FixedMulAVX2
+// FixedMul in each lane. Only the low 32 bits of the shifted
+//  products are kept, and those are the same whichever way
+//  they are shifted.
+//
+static AVX2_KERNEL inline __m256i R_FixedMulAVX2 (__m256i a, __m256i b)
+{
+    __m256i	even = _mm256_mul_epi32 (a, b);
+    __m256i	odd = _mm256_mul_epi32 (_mm256_srli_epi64 (a, 32),
+					_mm256_srli_epi64 (b, 32));
+
+    return _mm256_blend_epi32 (_mm256_srli_epi64 (even, FRACBITS),
+			       _mm256_slli_epi64 (odd, 32 - FRACBITS), 0xaa);
+}
+
+
+//
+// R_ScaleColumnsAVX2
+// R_ScaleColumns for eight columns at a time from x, and
+//  returns where it got to. The scales are between 256 and
+//  64*FRACUNIT, so 0xffffffff over them fits an int, and
+//  the quotient of two 32-bit numbers is exact in a double.
+//
+static AVX2_KERNEL int R_ScaleColumnsAVX2 (int x)
+{
+    __m256i	lane = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i	step8;
+    __m256i	top;
+    __m256i	bottom;
+    __m256i	high;
+    __m256i	low;
+    __m256i	scale;
+    __m256i	one = _mm256_set1_epi32 (1);
+    __m256i	roundup = _mm256_set1_epi32 (HEIGHTUNIT-1);
+    __m256i	centerangle = _mm256_set1_epi32 (rw_centerangle);
+    __m256i	offset = _mm256_set1_epi32 (rw_offset);
+    __m256i	distance = _mm256_set1_epi32 (rw_distance);
+    __m256i	maxlight = _mm256_set1_epi32 (MAXLIGHTSCALE-1);
+    __m256d	dividend = _mm256_set1_pd (4294967295.0);
+    __m256i	ceiling;
+    __m256i	floor;
+    __m256i	yl;
+    __m256i	yh;
+    __m256i	angle;
+    __m256i	tangent;
+
+    top = _mm256_add_epi32 (_mm256_set1_epi32 (topfrac),
+		_mm256_mullo_epi32 (_mm256_set1_epi32 (topstep), lane));
+    bottom = _mm256_add_epi32 (_mm256_set1_epi32 (bottomfrac),
+		_mm256_mullo_epi32 (_mm256_set1_epi32 (bottomstep), lane));
+    high = _mm256_add_epi32 (_mm256_set1_epi32 (pixhigh),
+		_mm256_mullo_epi32 (_mm256_set1_epi32 (pixhighstep), lane));
+    low = _mm256_add_epi32 (_mm256_set1_epi32 (pixlow),
+		_mm256_mullo_epi32 (_mm256_set1_epi32 (pixlowstep), lane));
+    scale = _mm256_add_epi32 (_mm256_set1_epi32 (rw_scale),
+		_mm256_mullo_epi32 (_mm256_set1_epi32 (rw_scalestep), lane));
+
+    for ( ; x + 8 <= rw_stopx ; x += 8)
+    {
+	ceiling = _mm256_cvtepi16_epi32 (
+		_mm_loadu_si128 ((__m128i *) &ceilingclip[x]));
+	floor = _mm256_cvtepi16_epi32 (
+		_mm_loadu_si128 ((__m128i *) &floorclip[x]));
+
+	yl = _mm256_max_epi32 (_mm256_srai_epi32 (
+		_mm256_add_epi32 (top, roundup), HEIGHTBITS),
+		_mm256_add_epi32 (ceiling, one));
+	yh = _mm256_min_epi32 (_mm256_srai_epi32 (bottom, HEIGHTBITS),
+		_mm256_sub_epi32 (floor, one));
+	_mm256_storeu_si256 ((__m256i *) &segyl[x], yl);
+	_mm256_storeu_si256 ((__m256i *) &segyh[x], yh);
+	_mm256_storeu_si256 ((__m256i *) &segtop[x],
+		_mm256_srai_epi32 (high, HEIGHTBITS));
+	_mm256_storeu_si256 ((__m256i *) &segbottom[x],
+		_mm256_srai_epi32 (_mm256_add_epi32 (low, roundup), HEIGHTBITS));
+
+	angle = _mm256_srli_epi32 (_mm256_add_epi32 (centerangle,
+		_mm256_loadu_si256 ((__m256i *) &xtoviewangle[x])),
+		ANGLETOFINESHIFT);
+	tangent = _mm256_i32gather_epi32 (finetangent, angle, 4);
+	_mm256_storeu_si256 ((__m256i *) &segtexcol[x], _mm256_srai_epi32 (
+		_mm256_sub_epi32 (offset, R_FixedMulAVX2 (tangent, distance)),
+		FRACBITS));
+
+	_mm256_storeu_si256 ((__m256i *) &seglight[x], _mm256_min_epu32 (
+		_mm256_srli_epi32 (scale, LIGHTSCALESHIFT), maxlight));
+	_mm_storeu_si128 ((__m128i *) &segiscale[x], _mm256_cvttpd_epi32 (
+		_mm256_div_pd (dividend, _mm256_cvtepi32_pd (
+		    _mm256_castsi256_si128 (scale)))));
+	_mm_storeu_si128 ((__m128i *) &segiscale[x+4], _mm256_cvttpd_epi32 (
+		_mm256_div_pd (dividend, _mm256_cvtepi32_pd (
+		    _mm256_extracti128_si256 (scale, 1)))));
+
+	step8 = _mm256_set1_epi32 (topstep * 8);
+	top = _mm256_add_epi32 (top, step8);
+	step8 = _mm256_set1_epi32 (bottomstep * 8);
+	bottom = _mm256_add_epi32 (bottom, step8);
+	step8 = _mm256_set1_epi32 (pixhighstep * 8);
+	high = _mm256_add_epi32 (high, step8);
+	step8 = _mm256_set1_epi32 (pixlowstep * 8);
+	low = _mm256_add_epi32 (low, step8);
+	step8 = _mm256_set1_epi32 (rw_scalestep * 8);
+	scale = _mm256_add_epi32 (scale, step8);
+
+	topfrac += topstep * 8;
+	bottomfrac += bottomstep * 8;
+	rw_scale += rw_scalestep * 8;
+
+	if (toptexture)
+	    pixhigh += pixhighstep * 8;
+	if (bottomtexture)
+	    pixlow += pixlowstep * 8;
+    }
+
+    return x;
+}
+#endif
+
+
+//
+// R_ScaleColumns
+// The first phase of R_RenderSegLoop: where each column of
+//  the seg starts and ends, and which texture column, light
+//  and scale it has, before any are drawn. Only a column's
+//  own draw changes its clips, so they are read here as
+//  they will be then. Leaves the steps at the end of the seg.
+//
+static void R_ScaleColumns (void)
 {
     angle_t		angle;
     unsigned		index;
+    int			x;
+    int			yl;
+    int			yh;
+
+    x = rw_x;
+
+#ifdef HAVE_AVX2_KERNELS
+    if (simdkernel == KERNEL_AVX2 && segtextured)
+	x = R_ScaleColumnsAVX2 (x);
+#endif
+
+    for ( ; x < rw_stopx ; x++)
+    {
+	yl = (topfrac+HEIGHTUNIT-1)>>HEIGHTBITS;
+
+	// no space above wall?
+	if (yl < ceilingclip[x]+1)
+	    yl = ceilingclip[x]+1;
+
+	yh = bottomfrac>>HEIGHTBITS;
+
+	if (yh >= floorclip[x])
+	    yh = floorclip[x]-1;
+
+	segyl[x] = yl;
+	segyh[x] = yh;
+
+	// texturecolumn and lighting are independent of wall tiers
+	if (segtextured)
+	{
+	    // calculate texture offset
+	    angle = (rw_centerangle + xtoviewangle[x])>>ANGLETOFINESHIFT;
+	    segtexcol[x] = (rw_offset-FixedMul(finetangent[angle],rw_distance))
+			   >> FRACBITS;
+	    // calculate lighting
+	    index = rw_scale>>LIGHTSCALESHIFT;
+
+	    if (index >=  MAXLIGHTSCALE )
+		index = MAXLIGHTSCALE-1;
+
+	    seglight[x] = index;
+	    segiscale[x] = 0xffffffffu / (unsigned)rw_scale;
+	}
+
+	// only set up for the tiers there are
+	if (toptexture)
+	{
+	    segtop[x] = pixhigh>>HEIGHTBITS;
+	    pixhigh += pixhighstep;
+	}
+
+	if (bottomtexture)
+	{
+	    segbottom[x] = (pixlow+HEIGHTUNIT-1)>>HEIGHTBITS;
+	    pixlow += pixlowstep;
+	}
+
+	rw_scale += rw_scalestep;
+	topfrac += topstep;
+	bottomfrac += bottomstep;
+    }
+}
+
+
+void R_RenderSegLoop (void)
+{
     int			yl;
     int			yh;
     int			mid;
     fixed_t		texturecolumn;
     int			top;
     int			bottom;
+    int			miplevel;
+
+    miplevel = 0;
+
+    R_ScaleColumns ();
 
+    // draw them
     for ( ; rw_x < rw_stopx ; rw_x++)
     {
 	// mark floor / ceiling areas
-	yl = (topfrac+HEIGHTUNIT-1)>>HEIGHTBITS;
-
-	// no space above wall?
-	if (yl < ceilingclip[rw_x]+1)
-	    yl = ceilingclip[rw_x]+1;
+	yl = segyl[rw_x];
 	
 	if (markceiling)
 	{
@@ -231,10 +490,7 @@ void R_RenderSegLoop (void)
 	    }
 	}
 		
-	yh = bottomfrac>>HEIGHTBITS;
-
-	if (yh >= floorclip[rw_x])
-	    yh = floorclip[rw_x]-1;
+	yh = segyh[rw_x];
 
 	if (markfloor)
 	{
@@ -252,19 +508,16 @@ void R_RenderSegLoop (void)
 	// texturecolumn and lighting are independent of wall tiers
 	if (segtextured)
 	{
-	    // calculate texture offset
-	    angle = (rw_centerangle + xtoviewangle[rw_x])>>ANGLETOFINESHIFT;
-	    texturecolumn = rw_offset-FixedMul(finetangent[angle],rw_distance);
-	    texturecolumn >>= FRACBITS;
-	    // calculate lighting
-	    index = rw_scale>>LIGHTSCALESHIFT;
-
-	    if (index >=  MAXLIGHTSCALE )
-		index = MAXLIGHTSCALE-1;
-
-	    dc_colormap = walllights[index];
+	    texturecolumn = segtexcol[rw_x];
+	    dc_colormap = walllights[seglight[rw_x]];
 	    dc_x = rw_x;
-	    dc_iscale = 0xffffffffu / (unsigned)rw_scale;
+	    dc_iscale = segiscale[rw_x];
+
+	    if (mipmaps)
+	    {
+		miplevel = R_MipLevel (dc_iscale);
+		dc_iscale = (unsigned)dc_iscale >> miplevel;
+	    }
 	}
         else
         {
@@ -279,8 +532,8 @@ void R_RenderSegLoop (void)
 	    // single sided line
 	    dc_yl = yl;
 	    dc_yh = yh;
-	    dc_texturemid = rw_midtexturemid;
-	    dc_source = R_GetColumn(midtexture,texturecolumn);
+	    dc_texturemid = rw_midtexturemid >> miplevel;
+	    dc_source = R_WallColumn(midtexture,midcolumns,texturecolumn,miplevel);
 	    colfunc ();
 	    ceilingclip[rw_x] = viewheight;
 	    floorclip[rw_x] = -1;
@@ -291,8 +544,7 @@ void R_RenderSegLoop (void)
 	    if (toptexture)
 	    {
 		// top wall
-		mid = pixhigh>>HEIGHTBITS;
-		pixhigh += pixhighstep;
+		mid = segtop[rw_x];
 
 		if (mid >= floorclip[rw_x])
 		    mid = floorclip[rw_x]-1;
@@ -301,8 +553,8 @@ void R_RenderSegLoop (void)
 		{
 		    dc_yl = yl;
 		    dc_yh = mid;
-		    dc_texturemid = rw_toptexturemid;
-		    dc_source = R_GetColumn(toptexture,texturecolumn);
+		    dc_texturemid = rw_toptexturemid >> miplevel;
+		    dc_source = R_WallColumn(toptexture,topcolumns,texturecolumn,miplevel);
 		    colfunc ();
 		    ceilingclip[rw_x] = mid;
 		}
@@ -319,8 +571,7 @@ void R_RenderSegLoop (void)
 	    if (bottomtexture)
 	    {
 		// bottom wall
-		mid = (pixlow+HEIGHTUNIT-1)>>HEIGHTBITS;
-		pixlow += pixlowstep;
+		mid = segbottom[rw_x];
 
 		// no space above wall?
 		if (mid <= ceilingclip[rw_x])
@@ -330,9 +581,9 @@ void R_RenderSegLoop (void)
 		{
 		    dc_yl = mid;
 		    dc_yh = yh;
-		    dc_texturemid = rw_bottomtexturemid;
-		    dc_source = R_GetColumn(bottomtexture,
-					    texturecolumn);
+		    dc_texturemid = rw_bottomtexturemid >> miplevel;
+		    dc_source = R_WallColumn(bottomtexture,bottomcolumns,
+					     texturecolumn,miplevel);
 		    colfunc ();
 		    floorclip[rw_x] = mid;
 		}
@@ -353,10 +604,6 @@ void R_RenderSegLoop (void)
 		maskedtexturecol[rw_x] = texturecolumn;
 	    }
 	}
-		
-	rw_scale += rw_scalestep;
-	topfrac += topstep;
-	bottomfrac += bottomstep;
     }
 }
 
@@ -377,11 +624,8 @@ R_StoreWallRange
     fixed_t		sineval;
     angle_t		distangle, offsetangle;
     fixed_t		vtop;
-    int			lightnum;
 
-    // don't overflow and crash
-    if (ds_p == &drawsegs[MAXDRAWSEGS])
-	return;		
+    R_CheckDrawSegs ();
 		
 #ifdef RANGECHECK
     if (start >=viewwidth || start > stop)
@@ -436,7 +680,7 @@ R_StoreWallRange
 			
 	    gxt = FixedMul(trx,viewcos); 
 	    gyt = -FixedMul(try,viewsin); 
-	    ds_p->scale1 = FixedDiv(projection, gxt-gyt)<<detailshift;
+	    ds_p->scale1 = R_FixedDiv(projection, gxt-gyt)<<detailshift;
 	}
 #endif
 	ds_p->scale2 = ds_p->scale1;
@@ -605,8 +849,8 @@ R_StoreWallRange
 	{
 	    // masked midtexture
 	    maskedtexture = true;
-	    ds_p->maskedtexturecol = maskedtexturecol = lastopening - rw_x;
-	    lastopening += rw_stopx - rw_x;
+	    ds_p->maskedtexturecol = maskedtexturecol =
+		R_NewOpenings (rw_stopx - rw_x) - rw_x;
 	}
     }
     
@@ -632,25 +876,21 @@ R_StoreWallRange
 	rw_offset += sidedef->textureoffset + curline->offset;
 	rw_centerangle = ANG90 + viewangle - rw_normalangle;
 	
+	if (midtexture)
+	    midcolumns = R_TextureColumns (midtexture);
+	if (toptexture)
+	    topcolumns = R_TextureColumns (toptexture);
+	if (bottomtexture)
+	    bottomcolumns = R_TextureColumns (bottomtexture);
+
 	// calculate light table
 	//  use different light tables
 	//  for horizontal / vertical / diagonal
 	// OPTIMIZE: get rid of LIGHTSEGSHIFT globally
 	if (!fixedcolormap)
 	{
-	    lightnum = (frontsector->lightlevel >> LIGHTSEGSHIFT)+extralight;
-
-	    if (curline->v1->y == curline->v2->y)
-		lightnum--;
-	    else if (curline->v1->x == curline->v2->x)
-		lightnum++;
-
-	    if (lightnum < 0)		
-		walllights = scalelight[0];
-	    else if (lightnum >= LIGHTLEVELS)
-		walllights = scalelight[LIGHTLEVELS-1];
-	    else
-		walllights = scalelight[lightnum];
+	    walllights = R_LightRow (frontsector->lightlevel,
+				     R_SegContrast (curline));
 	}
     }
     
@@ -715,17 +955,15 @@ R_StoreWallRange
     if ( ((ds_p->silhouette & SIL_TOP) || maskedtexture)
 	 && !ds_p->sprtopclip)
     {
-	memcpy (lastopening, ceilingclip+start, 2*(rw_stopx-start));
-	ds_p->sprtopclip = lastopening - start;
-	lastopening += rw_stopx - start;
+	ds_p->sprtopclip = R_NewOpenings (rw_stopx - start) - start;
+	memcpy (ds_p->sprtopclip + start, ceilingclip+start, 2*(rw_stopx-start));
     }
     
     if ( ((ds_p->silhouette & SIL_BOTTOM) || maskedtexture)
 	 && !ds_p->sprbottomclip)
     {
-	memcpy (lastopening, floorclip+start, 2*(rw_stopx-start));
-	ds_p->sprbottomclip = lastopening - start;
-	lastopening += rw_stopx - start;	
+	ds_p->sprbottomclip = R_NewOpenings (rw_stopx - start) - start;
+	memcpy (ds_p->sprbottomclip + start, floorclip+start, 2*(rw_stopx-start));
     }
 
     if (maskedtexture && !(ds_p->silhouette&SIL_TOP))
@@ -23,6 +23,8 @@
 
 
 
+void	R_InitSegBuffers (int width);
+
 void
 R_RenderMaskedSegRange
 ( drawseg_t*	ds,
@@ -25,9 +25,14 @@
 // Needed for FRACUNIT.
 #include "m_fixed.h"
 
+#include <string.h>
+
+#include "z_zone.h"
+
 // Needed for Flat retrieval.
 #include "r_data.h"
 
+#include "r_local.h"
 
 #include "r_sky.h"
 
@@ -50,3 +55,79 @@ void R_InitSkyMap (void)
     skytexturemid = 100*FRACUNIT;
 }
 
+
+
+//
+// The sky doesn't depend on where the view is,
+//  only on the view size, so each column of the
+//  sky texture is scaled and colormapped once and
+//  kept as a whole column of the view.
+//
+static byte*		skycache;
+static byte*		skycachedone;
+static int		skycachetexture;
+static int		skycacheheight;
+static int		skycachecentery;
+static fixed_t		skycacheiscale;
+static fixed_t		skycachemid;
+
+
+//
+// R_GetSkyColumn
+// Returns viewheight rows, ready to be copied
+//  to the screen.
+//
+byte* R_GetSkyColumn (int col, fixed_t iscale)
+{
+    byte*	source;
+    byte*	dest;
+    fixed_t	frac;
+    int		width;
+    int		y;
+
+    col &= texturewidthmask[skytexture];
+
+    if (!skycache
+	|| skycachetexture != skytexture
+	|| skycacheheight != viewheight
+	|| skycachecentery != centery
+	|| skycacheiscale != iscale
+	|| skycachemid != skytexturemid)
+    {
+	width = texturewidthmask[skytexture] + 1;
+
+	if (skycache)
+	    Z_Free (skycache);
+
+	// a flag for each column follows the columns
+	Z_Malloc (width * viewheight + width, PU_STATIC, &skycache);
+	skycachedone = skycache + width * viewheight;
+	memset (skycachedone, 0, width);
+
+	skycachetexture = skytexture;
+	skycacheheight = viewheight;
+	skycachecentery = centery;
+	skycacheiscale = iscale;
+	skycachemid = skytexturemid;
+    }
+
+    dest = skycache + col * skycacheheight;
+
+    if (!skycachedone[col])
+    {
+	// the same steps as R_DrawColumn takes
+	source = R_GetColumn (skytexture, col);
+	frac = skytexturemid - centery * iscale;
+
+	for (y = 0 ; y < viewheight ; y++)
+	{
+	    dest[y] = colormaps[source[(frac>>FRACBITS)&127]];
+	    frac += iscale;
+	}
+
+	skycachedone[col] = 1;
+    }
+
+    return dest;
+}
+
@@ -34,4 +34,8 @@ extern int		skytexturemid;
 // Called whenever the view size changes.
 void R_InitSkyMap (void);
 
+// A column of the sky texture, drawn at
+//  iscale for every row of the view.
+byte* R_GetSkyColumn (int col, fixed_t iscale);
+
 #endif
@@ -48,6 +48,7 @@ extern lighttable_t*	colormaps;
 extern int		viewwidth;
 extern int		scaledviewwidth;
 extern int		viewheight;
+extern int		scaledviewheight;
 
 extern int		firstflat;
 
@@ -99,6 +100,10 @@ extern fixed_t		viewy;
 extern fixed_t		viewz;
 
 extern angle_t		viewangle;
+
+// How far things are drawn from where the tic started to
+//  where it left them: FRACUNIT, unless -uncapped.
+extern fixed_t		viewfrac;
 extern player_t*	viewplayer;
 
 
@@ -106,7 +111,7 @@ extern player_t*	viewplayer;
 extern angle_t		clipangle;
 
 extern int		viewangletox[FINEANGLES/2];
-extern angle_t		xtoviewangle[SCREENWIDTH+1];
+extern angle_t*		xtoviewangle;
 //extern fixed_t		finetangent[FINEANGLES/2];
 
 extern fixed_t		rw_distance;
@@ -0,0 +1,191 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Renderer statistics.
+//	With -renderstats, the drawers are wrapped to count
+//	the pixels of the 3D view by what drew them. The
+//	counts of each frame are shown on the status line,
+//	and the averages are printed on exit.
+//
+
+
+#include <stdio.h>
+
+#include "doomdef.h"
+
+#include "i_system.h"
+#include "i_video.h"
+#include "m_argv.h"
+#include "m_misc.h"
+
+#include "r_local.h"
+#include "r_stats.h"
+
+
+bool		renderstats;
+
+int		pixelcounts[NUMPIXELKINDS];
+pixelkind_t	pixelkind;
+
+static uint64_t	pixeltotals[NUMPIXELKINDS];
+static uint64_t	viewtotal;
+static uint64_t	statsframes;
+
+static const char *pixelkindnames[NUMPIXELKINDS] =
+{
+    "walls", "planes", "sky", "sprites", "masked", "fuzz"
+};
+
+// The drawers being counted.
+static void		(*countcolfunc) (void);
+static void		(*counttranscolfunc) (void);
+static void		(*countfuzzcolfunc) (void);
+static void		(*countspanfunc) (void);
+
+
+static void R_CountColumn (void)
+{
+    if (dc_yh >= dc_yl)
+	pixelcounts[pixelkind] += (dc_yh - dc_yl + 1) << detailshift;
+    countcolfunc ();
+}
+
+static void R_CountTranslatedColumn (void)
+{
+    if (dc_yh >= dc_yl)
+	pixelcounts[pixelkind] += (dc_yh - dc_yl + 1) << detailshift;
+    counttranscolfunc ();
+}
+
+static void R_CountFuzzColumn (void)
+{
+    if (dc_yh >= dc_yl)
+	pixelcounts[PIXELS_FUZZ] += (dc_yh - dc_yl + 1) << detailshift;
+    countfuzzcolfunc ();
+}
+
+static void R_CountSpan (void)
+{
+    pixelcounts[pixelkind] += (ds_x2 - ds_x1 + 1) << detailshift;
+    countspanfunc ();
+}
+
+
+//
+// R_CountDrawers
+// Wraps whatever R_QueueDrawers left, so the
+//  counts are taken before anything is queued.
+//
+void R_CountDrawers (void)
+{
+    if (!renderstats)
+	return;
+
+    countcolfunc = basecolfunc;
+    counttranscolfunc = transcolfunc;
+    countfuzzcolfunc = fuzzcolfunc;
+    countspanfunc = spanfunc;
+
+    colfunc = basecolfunc = R_CountColumn;
+    transcolfunc = R_CountTranslatedColumn;
+    fuzzcolfunc = R_CountFuzzColumn;
+    spanfunc = R_CountSpan;
+}
+
+
+//
+// R_StartStatsFrame
+//
+void R_StartStatsFrame (void)
+{
+    int		i;
+
+    for (i = 0 ; i < NUMPIXELKINDS ; i++)
+	pixelcounts[i] = 0;
+
+    pixelkind = PIXELS_WALLS;
+}
+
+
+//
+// R_FinishStatsFrame
+// Adds the frame to the totals and shows it.
+//
+void R_FinishStatsFrame (void)
+{
+    char	text[128];
+    int		total;
+    int		i;
+
+    if (!renderstats)
+	return;
+
+    total = 0;
+    for (i = 0 ; i < NUMPIXELKINDS ; i++)
+    {
+	pixeltotals[i] += pixelcounts[i];
+	total += pixelcounts[i];
+    }
+
+    viewtotal += viewwidth * viewheight;
+    statsframes++;
+
+    M_snprintf (text, sizeof(text),
+		"walls %i planes %i sky %i sprites %i masked %i fuzz %i, "
+		"overdraw %.2f",
+		pixelcounts[PIXELS_WALLS], pixelcounts[PIXELS_PLANES],
+		pixelcounts[PIXELS_SKY], pixelcounts[PIXELS_SPRITES],
+		pixelcounts[PIXELS_MASKED], pixelcounts[PIXELS_FUZZ],
+		(double) total / (viewwidth * viewheight));
+    I_SetStatusText (text);
+}
+
+
+//
+// R_PrintRenderStats
+//
+static void R_PrintRenderStats (void)
+{
+    uint64_t	total;
+    int		i;
+
+    if (!statsframes)
+	return;
+
+    total = 0;
+    printf ("R_RenderPlayerView: pixels per frame:");
+    for (i = 0 ; i < NUMPIXELKINDS ; i++)
+    {
+	printf (" %s %llu", pixelkindnames[i],
+		(unsigned long long) (pixeltotals[i] / statsframes));
+	total += pixeltotals[i];
+    }
+    printf (", overdraw %.2f\n", (double) total / viewtotal);
+}
+
+
+//
+// R_InitRenderStats
+//
+void R_InitRenderStats (void)
+{
+    //!
+    // Count the pixels of the 3D view by what drew them,
+    // show each frame's counts below the screen and
+    // print the averages on exit.
+    //
+
+    renderstats = M_CheckParm ("-renderstats") > 0;
+
+    if (renderstats)
+	I_AtExit (R_PrintRenderStats, true);
+}
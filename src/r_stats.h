@@ -0,0 +1,55 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Renderer statistics.
+//
+
+
+#ifndef __R_STATS__
+#define __R_STATS__
+
+#include "doomtype.h"
+
+// What the pixels of the 3D view were drawn by.
+typedef enum
+{
+    PIXELS_WALLS,
+    PIXELS_PLANES,
+    PIXELS_SKY,
+    PIXELS_SPRITES,
+    PIXELS_MASKED,
+    PIXELS_FUZZ,
+    NUMPIXELKINDS
+} pixelkind_t;
+
+// Set by -renderstats.
+extern bool		renderstats;
+
+// Pixels drawn in the last frame, by kind.
+extern int		pixelcounts[NUMPIXELKINDS];
+
+// Kind of the columns and spans drawn next,
+//  fuzz is counted as such whatever this is.
+extern pixelkind_t	pixelkind;
+
+// Called at startup, reads -renderstats.
+void	R_InitRenderStats (void);
+
+// Called once the drawers are picked, to count
+//  what they draw when -renderstats is given.
+void	R_CountDrawers (void);
+
+// Called before and after the 3D view is drawn.
+void	R_StartStatsFrame (void);
+void	R_FinishStatsFrame (void);
+
+#endif
@@ -19,8 +19,10 @@
 
 
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 #include "deh_main.h"
@@ -28,10 +30,12 @@
 
 #include "i_swap.h"
 #include "i_system.h"
+#include "m_argv.h"
 #include "z_zone.h"
 #include "w_wad.h"
 
 #include "r_local.h"
+#include "r_stats.h"
 
 #include "doomstat.h"
 
@@ -57,6 +61,28 @@ typedef struct
 } maskdraw_t;
 
 
+// -spritelod: the size in rendered pixels up to which a
+//  sprite is drawn as a block of its average color, which
+//  is all that shows of it, without reading its posts
+typedef struct
+{
+    // -1 until worked out, -2 if nothing is opaque
+    short	color;
+
+    // the opaque rows
+    short	top;
+    short	bottom;
+
+} spritelod_t;
+
+static int		spritelod;
+static spritelod_t*	spritelods;
+
+// A column of each palette color, for R_DrawColumn
+//  to read the block from
+static byte		solidcolumns[256][128];
+
+
 
 //
 // Sprite rotation 0 is facing the viewer,
@@ -72,8 +98,8 @@ lighttable_t**	spritelights;
 
 // constant arrays
 //  used for psprite clipping and initializing clipping
-short		negonearray[SCREENWIDTH];
-short		screenheightarray[SCREENWIDTH];
+short*		negonearray;
+short*		screenheightarray;
 
 
 //
@@ -153,6 +179,23 @@ R_InstallSpriteLump
 
 
 
+//
+// R_SpriteNameHash
+// Of the first 4 characters, which name the sprite.
+//
+static unsigned int R_SpriteNameHash (const char* name)
+{
+    unsigned int	hash;
+    int			i;
+
+    hash = 0;
+    for (i=0 ; i<4 && name[i] ; i++)
+	hash = hash * 31 + toupper (name[i]);
+
+    return hash;
+}
+
+
 //
 // R_InitSpriteDefs
 // Pass a null terminated list of sprite names
@@ -178,6 +221,8 @@ void R_InitSpriteDefs (char** namelist)
     int		start;
     int		end;
     int		patched;
+    int*	buckets;
+    int*	chain;
 
     // count the number of sprite names
     check = namelist;
@@ -194,9 +239,24 @@ void R_InitSpriteDefs (char** namelist)
     start = firstspritelump-1;
     end = lastspritelump+1;
 
-    // scan all the lump names for each of the names,
+    // chain the lumps by the hash of their sprite names,
+    //  in lump order, so that each name only looks at
+    //  its own lumps
+    buckets = Z_Malloc (numsprites * sizeof(*buckets), PU_STATIC, NULL);
+    chain = Z_Malloc ((end - start) * sizeof(*chain), PU_STATIC, NULL);
+
+    for (i=0 ; i<numsprites ; i++)
+	buckets[i] = -1;
+
+    for (l=end-1 ; l>start ; l--)
+    {
+	i = R_SpriteNameHash (lumpinfo[l].name) % numsprites;
+	chain[l - start] = buckets[i];
+	buckets[i] = l;
+    }
+
+    // look up the lumps of each of the names,
     //  noting the highest frame letter.
-    // Just compare 4 characters as ints
     for (i=0 ; i<numsprites ; i++)
     {
 	spritename = DEH_String(namelist[i]);
@@ -204,9 +264,10 @@ void R_InitSpriteDefs (char** namelist)
 
 	maxframe = -1;
 
-	// scan the lumps,
-	//  filling in the frames for whatever is found
-	for (l=start+1 ; l<end ; l++)
+	// filling in the frames for whatever is found
+	for (l = buckets[R_SpriteNameHash (spritename) % numsprites] ;
+	     l != -1 ;
+	     l = chain[l - start])
 	{
 	    if (!STRNCASECMP(lumpinfo[l].name, spritename, 4))
 	    {
@@ -270,6 +331,8 @@ void R_InitSpriteDefs (char** namelist)
 	memcpy (sprites[i].spriteframes, sprtemp, maxframe*sizeof(spriteframe_t));
     }
 
+    Z_Free (chain);
+    Z_Free (buckets);
 }
 
 
@@ -278,8 +341,12 @@ void R_InitSpriteDefs (char** namelist)
 //
 // GAME FUNCTIONS
 //
-vissprite_t	vissprites[MAXVISSPRITES];
+// Grown by R_NewVisSprite when a frame needs more,
+//  and dropped back with the level.
+vissprite_t*	vissprites;
 vissprite_t*	vissprite_p;
+static int	maxvissprites;
+int		peakvissprites;
 int		newvissprite;
 
 
@@ -290,14 +357,31 @@ int		newvissprite;
 //
 void R_InitSprites (char** namelist)
 {
+    int		p;
     int		i;
 
-    for (i=0 ; i<SCREENWIDTH ; i++)
+    R_InitSpriteDefs (namelist);
+
+    //!
+    // @arg <pixels>
+    //
+    // Draw sprites no bigger than pixels each way in the
+    // rendered view as a block of their average color.
+    //
+
+    p = M_CheckParmWithArgs ("-spritelod", 1);
+    if (p > 0)
     {
-	negonearray[i] = -1;
-    }
+	spritelod = atoi (myargv[p+1]);
+	if (spritelod < 1)
+	    I_Error ("R_InitSprites: invalid -spritelod '%s'", myargv[p+1]);
 
-    R_InitSpriteDefs (namelist);
+	spritelods = Z_Malloc (numspritelumps * sizeof(*spritelods), PU_STATIC, 0);
+	memset (spritelods, 0xff, numspritelumps * sizeof(*spritelods));
+
+	for (i=0 ; i<256 ; i++)
+	    memset (solidcolumns[i], i, sizeof(solidcolumns[i]));
+    }
 }
 
 
@@ -308,6 +392,16 @@ void R_InitSprites (char** namelist)
 //
 void R_ClearSprites (void)
 {
+    if (vissprites && vissprite_p - vissprites > peakvissprites)
+	peakvissprites = vissprite_p - vissprites;
+
+    if (!vissprites)
+    {
+	maxvissprites = MAXVISSPRITES;
+	vissprites = Z_Malloc (maxvissprites * sizeof(*vissprites),
+			       PU_LEVEL, &vissprites);
+    }
+
     vissprite_p = vissprites;
 }
 
@@ -315,12 +409,24 @@ void R_ClearSprites (void)
 //
 // R_NewVisSprite
 //
-vissprite_t	overflowsprite;
-
 vissprite_t* R_NewVisSprite (void)
 {
-    if (vissprite_p == &vissprites[MAXVISSPRITES])
-	return &overflowsprite;
+    vissprite_t*	newsprites;
+    int			count;
+
+    if (vissprite_p == vissprites + maxvissprites)
+    {
+	count = vissprite_p - vissprites;
+	maxvissprites *= 2;
+	newsprites = Z_Malloc (maxvissprites * sizeof(*newsprites),
+			       PU_LEVEL, NULL);
+	memcpy (newsprites, vissprites, count * sizeof(*newsprites));
+	Z_Free (vissprites);
+
+	vissprites = newsprites;
+	Z_ChangeUser (vissprites, (void **) &vissprites);
+	vissprite_p = vissprites + count;
+    }
 
     vissprite_p++;
     return vissprite_p-1;
@@ -381,6 +487,102 @@ void R_DrawMaskedColumn (column_t* column)
 
 
 
+//
+// R_SpriteLod
+// Averages the opaque texels of a sprite lump,
+//  the first time it is drawn small enough.
+//
+static spritelod_t* R_SpriteLod (int lump, patch_t* patch)
+{
+    spritelod_t*	lod;
+    column_t*		column;
+    byte*		source;
+    byte*		c;
+    int			width;
+    int			x;
+    int			i;
+    int			r, g, b;
+    int			count;
+
+    lod = &spritelods[lump];
+    if (lod->color != -1)
+	return lod;
+
+    r = g = b = count = 0;
+    lod->top = 0x7fff;
+    lod->bottom = 0;
+    width = SHORT(patch->width);
+
+    for (x=0 ; x<width ; x++)
+    {
+	column = (column_t *) ((byte *)patch + LONG(patch->columnofs[x]));
+
+	for ( ; column->topdelta != 0xff ; )
+	{
+	    source = (byte *)column + 3;
+	    for (i=0 ; i<column->length ; i++)
+	    {
+		c = averagepalette + source[i] * 3;
+		r += c[0];
+		g += c[1];
+		b += c[2];
+	    }
+	    count += column->length;
+
+	    if (column->topdelta < lod->top)
+		lod->top = column->topdelta;
+	    if (column->topdelta + column->length > lod->bottom)
+		lod->bottom = column->topdelta + column->length;
+
+	    column = (column_t *)(  (byte *)column + column->length + 4);
+	}
+    }
+
+    if (count)
+	lod->color = R_NearestColor (r / count, g / count, b / count);
+    else
+	lod->color = -2;
+
+    return lod;
+}
+
+
+//
+// R_DrawSpriteLod
+// As R_DrawMaskedColumn would draw the sprite if it
+//  were a single post of its average color.
+//
+static void R_DrawSpriteLod (vissprite_t* vis, spritelod_t* lod)
+{
+    int		topscreen;
+    int		bottomscreen;
+
+    if (lod->color < 0)
+	return;
+
+    topscreen = sprtopscreen + spryscale*lod->top;
+    bottomscreen = sprtopscreen + spryscale*lod->bottom;
+
+    dc_source = solidcolumns[lod->color];
+    dc_texturemid = 0;
+    dc_iscale = 0;
+
+    for (dc_x=vis->x1 ; dc_x<=vis->x2 ; dc_x++)
+    {
+	dc_yl = (topscreen+FRACUNIT-1)>>FRACBITS;
+	dc_yh = (bottomscreen-1)>>FRACBITS;
+
+	if (dc_yh >= mfloorclip[dc_x])
+	    dc_yh = mfloorclip[dc_x]-1;
+	if (dc_yl <= mceilingclip[dc_x])
+	    dc_yl = mceilingclip[dc_x]+1;
+
+	if (dc_yl <= dc_yh)
+	    colfunc ();
+    }
+}
+
+
 //
 // R_DrawVisSprite
 //  mfloorclip and mceilingclip should also be set.
@@ -397,8 +599,9 @@ R_DrawVisSprite
     patch_t*		patch;
 
 
-    patch = W_CacheLumpNum (vis->patch+firstspritelump, PU_CACHE);
+    patch = R_GetSpritePatch (vis->patch);
 
+    pixelkind = PIXELS_SPRITES;
     dc_colormap = vis->colormap;
 
     if (!dc_colormap)
@@ -419,6 +622,16 @@ R_DrawVisSprite
     spryscale = vis->scale;
     sprtopscreen = centeryfrac - FixedMul(dc_texturemid,spryscale);
 
+    // shadows and translated sprites are drawn as they are
+    if (spritelod
+	&& colfunc == basecolfunc
+	&& vis->x2 - vis->x1 < spritelod
+	&& FixedMul (SHORT(patch->height) << FRACBITS, spryscale) <= spritelod << FRACBITS)
+    {
+	R_DrawSpriteLod (vis, R_SpriteLod (vis->patch, patch));
+	return;
+    }
+
     for (dc_x=vis->x1 ; dc_x<=vis->x2 ; dc_x++, frac += vis->xiscale)
     {
 	texturecolumn = frac>>FRACBITS;
@@ -470,10 +683,27 @@ void R_ProjectSprite (mobj_t* thing)
 
     angle_t		ang;
     fixed_t		iscale;
+    fixed_t		thingx;
+    fixed_t		thingy;
+    fixed_t		thingz;
+
+    // with -uncapped, part way along its move in the tic
+    if (viewfrac < FRACUNIT)
+    {
+	thingx = thing->oldx + FixedMul (thing->x - thing->oldx, viewfrac);
+	thingy = thing->oldy + FixedMul (thing->y - thing->oldy, viewfrac);
+	thingz = thing->oldz + FixedMul (thing->z - thing->oldz, viewfrac);
+    }
+    else
+    {
+	thingx = thing->x;
+	thingy = thing->y;
+	thingz = thing->z;
+    }
 
     // transform the origin point
-    tr_x = thing->x - viewx;
-    tr_y = thing->y - viewy;
+    tr_x = thingx - viewx;
+    tr_y = thingy - viewy;
 
     gxt = FixedMul(tr_x,viewcos);
     gyt = -FixedMul(tr_y,viewsin);
@@ -484,7 +714,7 @@ void R_ProjectSprite (mobj_t* thing)
     if (tz < MINZ)
 	return;
 
-    xscale = FixedDiv(projection, tz);
+    xscale = R_FixedDiv(projection, tz);
 
     gxt = -FixedMul(tr_x,viewsin);
     gyt = FixedMul(tr_y,viewcos);
@@ -511,7 +741,7 @@ void R_ProjectSprite (mobj_t* thing)
     if (sprframe->rotate)
     {
 	// choose a different rotation based on player view
-	ang = R_PointToAngle (thing->x, thing->y);
+	ang = R_PointToAngle (thingx, thingy);
 	rot = (ang-thing->angle+(unsigned)(ANG45/2)*9)>>29;
 	lump = sprframe->lump[rot];
 	flip = (bool)sprframe->flip[rot];
@@ -542,14 +772,14 @@ void R_ProjectSprite (mobj_t* thing)
     vis = R_NewVisSprite ();
     vis->mobjflags = thing->flags;
     vis->scale = xscale<<detailshift;
-    vis->gx = thing->x;
-    vis->gy = thing->y;
-    vis->gz = thing->z;
-    vis->gzt = thing->z + spritetopoffset[lump];
+    vis->gx = thingx;
+    vis->gy = thingy;
+    vis->gz = thingz;
+    vis->gzt = thingz + spritetopoffset[lump];
     vis->texturemid = vis->gzt - viewz;
     vis->x1 = x1 < 0 ? 0 : x1;
     vis->x2 = x2 >= viewwidth ? viewwidth-1 : x2;
-    iscale = FixedDiv (FRACUNIT, xscale);
+    iscale = R_FixedDiv (FRACUNIT, xscale);
 
     if (flip)
     {
@@ -605,7 +835,6 @@ void R_ProjectSprite (mobj_t* thing)
 void R_AddSprites (sector_t* sec)
 {
     mobj_t*		thing;
-    int			lightnum;
 
     // BSP is traversed by subsector.
     // A sector might have been split into several
@@ -617,14 +846,7 @@ void R_AddSprites (sector_t* sec)
     // Well, now it will be done.
     sec->validcount = validcount;
 
-    lightnum = (sec->lightlevel >> LIGHTSEGSHIFT)+extralight;
-
-    if (lightnum < 0)
-	spritelights = scalelight[0];
-    else if (lightnum >= LIGHTLEVELS)
-	spritelights = scalelight[LIGHTLEVELS-1];
-    else
-	spritelights = scalelight[lightnum];
+    spritelights = R_LightRow (sec->lightlevel, 0);
 
     // Handle all things in sector.
     for (thing = sec->thinglist ; thing ; thing = thing->snext)
@@ -738,20 +960,10 @@ void R_DrawPSprite (pspdef_t* psp)
 void R_DrawPlayerSprites (void)
 {
     int		i;
-    int		lightnum;
     pspdef_t*	psp;
 
     // get light level
-    lightnum =
-	(viewplayer->mo->subsector->sector->lightlevel >> LIGHTSEGSHIFT)
-	+extralight;
-
-    if (lightnum < 0)
-	spritelights = scalelight[0];
-    else if (lightnum >= LIGHTLEVELS)
-	spritelights = scalelight[LIGHTLEVELS-1];
-    else
-	spritelights = scalelight[lightnum];
+    spritelights = R_LightRow (viewplayer->mo->subsector->sector->lightlevel, 0);
 
     // clip to screen bounds
     mfloorclip = screenheightarray;
@@ -772,59 +984,77 @@ void R_DrawPlayerSprites (void)
 
 //
 // R_SortVisSprites
+// A stable merge sort by scale, so that sprites
+//  of the same scale keep the order they were found in.
 //
-vissprite_t	vsprsortedhead;
+static vissprite_t**	vsprsortblock;
+static vissprite_t**	vsprsorted;
+static int		maxvsprsorted;
 
 
 void R_SortVisSprites (void)
 {
     int			i;
     int			count;
-    vissprite_t*	ds;
-    vissprite_t*	best;
-    vissprite_t		unsorted;
-    fixed_t		bestscale;
+    int			width;
+    int			a;
+    int			b;
+    int			k;
+    int			mid;
+    int			end;
+    vissprite_t**	src;
+    vissprite_t**	dest;
+    vissprite_t**	swap;
 
     count = vissprite_p - vissprites;
 
-    unsorted.next = unsorted.prev = &unsorted;
-
-    if (!count)
-	return;
-
-    for (ds=vissprites ; ds<vissprite_p ; ds++)
+    // room for the order and a merge buffer
+    if (!vsprsortblock || count > maxvsprsorted)
     {
-	ds->next = ds+1;
-	ds->prev = ds-1;
-    }
+	if (vsprsortblock)
+	    Z_Free (vsprsortblock);
 
-    vissprites[0].prev = &unsorted;
-    unsorted.next = &vissprites[0];
-    (vissprite_p-1)->next = &unsorted;
-    unsorted.prev = vissprite_p-1;
+	maxvsprsorted = maxvissprites;
+	Z_Malloc (2 * maxvsprsorted * sizeof(*vsprsortblock),
+		  PU_LEVEL, &vsprsortblock);
+    }
 
-    // pull the vissprites out by scale
+    src = vsprsortblock;
+    dest = vsprsortblock + maxvsprsorted;
 
-    vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
     for (i=0 ; i<count ; i++)
+	src[i] = &vissprites[i];
+
+    for (width=1 ; width<count ; width*=2)
     {
-	bestscale = INT_MAX;
-        best = unsorted.next;
-	for (ds=unsorted.next ; ds!= &unsorted ; ds=ds->next)
+	for (i=0 ; i<count ; i+=2*width)
 	{
-	    if (ds->scale < bestscale)
+	    mid = i + width < count ? i + width : count;
+	    end = i + 2*width < count ? i + 2*width : count;
+
+	    a = i;
+	    b = mid;
+	    k = i;
+
+	    while (a < mid && b < end)
 	    {
-		bestscale = ds->scale;
-		best = ds;
+		if (src[b]->scale < src[a]->scale)
+		    dest[k++] = src[b++];
+		else
+		    dest[k++] = src[a++];
 	    }
+	    while (a < mid)
+		dest[k++] = src[a++];
+	    while (b < end)
+		dest[k++] = src[b++];
 	}
-	best->next->prev = best->prev;
-	best->prev->next = best->next;
-	best->next = &vsprsortedhead;
-	best->prev = vsprsortedhead.prev;
-	vsprsortedhead.prev->next = best;
-	vsprsortedhead.prev = best;
+
+	swap = src;
+	src = dest;
+	dest = swap;
     }
+
+    vsprsorted = src;
 }
 
 
@@ -832,11 +1062,104 @@ void R_SortVisSprites (void)
 //
 // R_DrawSprite
 //
-static short		clipbot[SCREENWIDTH];
-static short		cliptop[SCREENWIDTH];
-void R_DrawSprite (vissprite_t* spr)
+static short*		clipbot;
+static short*		cliptop;
+
+// The drawsegs that can clip sprites, listed for
+//  each block of screen columns they cross, from
+//  the last drawn to the first like R_DrawSprite
+//  scans them. Block b's run of clipsegs starts
+//  at clipblocks[b] and ends at clipblocks[b+1].
+#define CLIPBLOCKSHIFT		4
+
+static int*		clipblocks;
+static int*		clipcursors;
+static int		numclipblocks;
+static drawseg_t**	clipsegs;
+static int		maxclipsegs;
+
+
+//
+// R_InitSpriteBuffers
+// Allocates the clip arrays for views
+//  of up to width rendered columns.
+//
+void R_InitSpriteBuffers (int width)
+{
+    int		i;
+
+    negonearray = Z_Malloc (width * sizeof(*negonearray), PU_STATIC, NULL);
+    screenheightarray = Z_Malloc (width * sizeof(*screenheightarray), PU_STATIC, NULL);
+    clipbot = Z_Malloc (width * sizeof(*clipbot), PU_STATIC, NULL);
+    cliptop = Z_Malloc (width * sizeof(*cliptop), PU_STATIC, NULL);
+
+    numclipblocks = (width + (1<<CLIPBLOCKSHIFT) - 1) >> CLIPBLOCKSHIFT;
+    clipblocks = Z_Malloc ((numclipblocks + 1) * sizeof(*clipblocks), PU_STATIC, NULL);
+    clipcursors = Z_Malloc (numclipblocks * sizeof(*clipcursors), PU_STATIC, NULL);
+
+    for (i=0 ; i<width ; i++)
+    {
+	negonearray[i] = -1;
+    }
+}
+
+
+//
+// R_IndexClipSegs
+// Called once the drawsegs are final,
+//  before any sprite is drawn.
+//
+static void R_IndexClipSegs (void)
 {
     drawseg_t*		ds;
+    int			count;
+    int			b;
+
+    for (b=0 ; b<=numclipblocks ; b++)
+	clipblocks[b] = 0;
+
+    count = 0;
+    for (ds=drawsegs ; ds<ds_p ; ds++)
+    {
+	if (!ds->silhouette && !ds->maskedtexturecol)
+	    continue;
+
+	for (b=ds->x1>>CLIPBLOCKSHIFT ; b<=ds->x2>>CLIPBLOCKSHIFT ; b++)
+	    clipblocks[b+1]++;
+	count += (ds->x2>>CLIPBLOCKSHIFT) - (ds->x1>>CLIPBLOCKSHIFT) + 1;
+    }
+
+    for (b=0 ; b<numclipblocks ; b++)
+	clipblocks[b+1] += clipblocks[b];
+
+    if (!clipsegs || count > maxclipsegs)
+    {
+	if (clipsegs)
+	    Z_Free (clipsegs);
+
+	maxclipsegs = count > 256 ? count : 256;
+	Z_Malloc (maxclipsegs * sizeof(*clipsegs), PU_LEVEL, &clipsegs);
+    }
+
+    for (b=0 ; b<numclipblocks ; b++)
+	clipcursors[b] = clipblocks[b];
+
+    for (ds=ds_p-1 ; ds >= drawsegs ; ds--)
+    {
+	if (!ds->silhouette && !ds->maskedtexturecol)
+	    continue;
+
+	for (b=ds->x1>>CLIPBLOCKSHIFT ; b<=ds->x2>>CLIPBLOCKSHIFT ; b++)
+	    clipsegs[clipcursors[b]++] = ds;
+    }
+}
+
+
+//
+// R_ClipSpriteToSeg
+//
+static void R_ClipSpriteToSeg (vissprite_t* spr, drawseg_t* ds)
+{
     int			x;
     int			r1;
     int			r2;
@@ -844,85 +1167,124 @@ void R_DrawSprite (vissprite_t* spr)
     fixed_t		lowscale;
     int			silhouette;
 
-    for (x = spr->x1 ; x<=spr->x2 ; x++)
-	clipbot[x] = cliptop[x] = -2;
+    // determine if the drawseg obscures the sprite
+    if (ds->x1 > spr->x2
+	|| ds->x2 < spr->x1)
+    {
+	// does not cover sprite
+	return;
+    }
 
-    // Scan drawsegs from end to start for obscuring segs.
-    // The first drawseg that has a greater scale
-    //  is the clip seg.
-    for (ds=ds_p-1 ; ds >= drawsegs ; ds--)
+    r1 = ds->x1 < spr->x1 ? spr->x1 : ds->x1;
+    r2 = ds->x2 > spr->x2 ? spr->x2 : ds->x2;
+
+    if (ds->scale1 > ds->scale2)
     {
-	// determine if the drawseg obscures the sprite
-	if (ds->x1 > spr->x2
-	    || ds->x2 < spr->x1
-	    || (!ds->silhouette
-		&& !ds->maskedtexturecol) )
-	{
-	    // does not cover sprite
-	    continue;
-	}
+	lowscale = ds->scale2;
+	scale = ds->scale1;
+    }
+    else
+    {
+	lowscale = ds->scale1;
+	scale = ds->scale2;
+    }
 
-	r1 = ds->x1 < spr->x1 ? spr->x1 : ds->x1;
-	r2 = ds->x2 > spr->x2 ? spr->x2 : ds->x2;
+    if (scale < spr->scale
+	|| ( lowscale < spr->scale
+	     && !R_PointOnSegSide (spr->gx, spr->gy, ds->curline) ) )
+    {
+	// masked mid texture?
+	if (ds->maskedtexturecol)
+	    R_RenderMaskedSegRange (ds, r1, r2);
+	// seg is behind sprite
+	return;
+    }
 
-	if (ds->scale1 > ds->scale2)
-	{
-	    lowscale = ds->scale2;
-	    scale = ds->scale1;
-	}
-	else
-	{
-	    lowscale = ds->scale1;
-	    scale = ds->scale2;
-	}
 
-	if (scale < spr->scale
-	    || ( lowscale < spr->scale
-		 && !R_PointOnSegSide (spr->gx, spr->gy, ds->curline) ) )
+    // clip this piece of the sprite
+    silhouette = ds->silhouette;
+
+    if (spr->gz >= ds->bsilheight)
+	silhouette &= ~SIL_BOTTOM;
+
+    if (spr->gzt <= ds->tsilheight)
+	silhouette &= ~SIL_TOP;
+
+    if (silhouette == 1)
+    {
+	// bottom sil
+	for (x=r1 ; x<=r2 ; x++)
+	    if (clipbot[x] == -2)
+		clipbot[x] = ds->sprbottomclip[x];
+    }
+    else if (silhouette == 2)
+    {
+	// top sil
+	for (x=r1 ; x<=r2 ; x++)
+	    if (cliptop[x] == -2)
+		cliptop[x] = ds->sprtopclip[x];
+    }
+    else if (silhouette == 3)
+    {
+	// both
+	for (x=r1 ; x<=r2 ; x++)
 	{
-	    // masked mid texture?
-	    if (ds->maskedtexturecol)
-		R_RenderMaskedSegRange (ds, r1, r2);
-	    // seg is behind sprite
-	    continue;
+	    if (clipbot[x] == -2)
+		clipbot[x] = ds->sprbottomclip[x];
+	    if (cliptop[x] == -2)
+		cliptop[x] = ds->sprtopclip[x];
 	}
+    }
+}
 
 
-	// clip this piece of the sprite
-	silhouette = ds->silhouette;
+void R_DrawSprite (vissprite_t* spr)
+{
+    drawseg_t*		ds;
+    drawseg_t*		next;
+    int			x;
+    int			b;
+    int			b1;
+    int			b2;
 
-	if (spr->gz >= ds->bsilheight)
-	    silhouette &= ~SIL_BOTTOM;
+    for (x = spr->x1 ; x<=spr->x2 ; x++)
+	clipbot[x] = cliptop[x] = -2;
 
-	if (spr->gzt <= ds->tsilheight)
-	    silhouette &= ~SIL_TOP;
+    // Scan drawsegs from end to start for obscuring segs.
+    // The first drawseg that has a greater scale
+    //  is the clip seg.
+    // Only the blocks the sprite covers are looked at,
+    //  merging their lists back into drawseg order.
+    b1 = spr->x1 >> CLIPBLOCKSHIFT;
+    b2 = spr->x2 >> CLIPBLOCKSHIFT;
 
-	if (silhouette == 1)
+    for (b=b1 ; b<=b2 ; b++)
+	clipcursors[b] = clipblocks[b];
+
+    for (;;)
+    {
+	ds = NULL;
+	for (b=b1 ; b<=b2 ; b++)
 	{
-	    // bottom sil
-	    for (x=r1 ; x<=r2 ; x++)
-		if (clipbot[x] == -2)
-		    clipbot[x] = ds->sprbottomclip[x];
+	    if (clipcursors[b] == clipblocks[b+1])
+		continue;
+	    next = clipsegs[clipcursors[b]];
+	    if (!ds || next > ds)
+		ds = next;
 	}
-	else if (silhouette == 2)
+
+	if (!ds)
+	    break;
+
+	// a seg across several blocks is in each of them
+	for (b=b1 ; b<=b2 ; b++)
 	{
-	    // top sil
-	    for (x=r1 ; x<=r2 ; x++)
-		if (cliptop[x] == -2)
-		    cliptop[x] = ds->sprtopclip[x];
-	}
-	else if (silhouette == 3)
-	{
-	    // both
-	    for (x=r1 ; x<=r2 ; x++)
-	    {
-		if (clipbot[x] == -2)
-		    clipbot[x] = ds->sprbottomclip[x];
-		if (cliptop[x] == -2)
-		    cliptop[x] = ds->sprtopclip[x];
-	    }
+	    if (clipcursors[b] != clipblocks[b+1]
+		&& clipsegs[clipcursors[b]] == ds)
+		clipcursors[b]++;
 	}
 
+	R_ClipSpriteToSeg (spr, ds);
     }
 
     // all clipping has been performed, so draw the sprite
@@ -950,21 +1312,18 @@ void R_DrawSprite (vissprite_t* spr)
 //
 void R_DrawMasked (void)
 {
-    vissprite_t*	spr;
     drawseg_t*		ds;
+    int			i;
 
     R_SortVisSprites ();
 
     if (vissprite_p > vissprites)
     {
-	// draw all vissprites back to front
-	for (spr = vsprsortedhead.next ;
-	     spr != &vsprsortedhead ;
-	     spr=spr->next)
-	{
+	R_IndexClipSegs ();
 
-	    R_DrawSprite (spr);
-	}
+	// draw all vissprites back to front
+	for (i=0 ; i<vissprite_p-vissprites ; i++)
+	    R_DrawSprite (vsprsorted[i]);
     }
 
     // render any remaining masked mid textures
@@ -24,14 +24,16 @@
 
 #define MAXVISSPRITES  	128
 
-extern vissprite_t	vissprites[MAXVISSPRITES];
+extern vissprite_t*	vissprites;
 extern vissprite_t*	vissprite_p;
-extern vissprite_t	vsprsortedhead;
+
+// Most vissprites used by a frame so far.
+extern int		peakvissprites;
 
 // Constant arrays used for psprite clipping
 //  and initializing clipping.
-extern short		negonearray[SCREENWIDTH];
-extern short		screenheightarray[SCREENWIDTH];
+extern short*		negonearray;
+extern short*		screenheightarray;
 
 // vars for R_DrawMaskedColumn
 extern short*		mfloorclip;
@@ -52,6 +54,7 @@ void R_AddSprites (sector_t* sec);
 void R_AddPSprites (void);
 void R_DrawSprites (void);
 void R_InitSprites (char** namelist);
+void R_InitSpriteBuffers (int width);
 void R_ClearSprites (void);
 void R_DrawMasked (void);
 
@@ -25,6 +25,7 @@
 #include "i_system.h"
 #include "i_video.h"
 #include "z_zone.h"
+#include "m_argv.h"
 #include "m_misc.h"
 #include "m_random.h"
 #include "w_wad.h"
@@ -382,6 +383,9 @@ static int	st_faceindex = 0;
 // holds key-type for each key box on bar
 static int	keyboxes[3]; 
 
+// -textstatus: the bar is sent as a line of text instead
+static bool	st_textstatus;
+
 // a random number per tick
 static int	st_randomnumber;  
 
@@ -857,6 +861,68 @@ void ST_updateFaceWidget(void)
 
 }
 
+//
+// ST_updateText
+// Sends the bar's numbers as the status line, when any changed.
+//
+static void ST_updateText(void)
+{
+    static char	oldtext[128];
+    static const char *ammonames[NUMAMMO] = { "BULL", "SHEL", "CELL", "RCKT" };
+    static const char *keynames = "BYR";
+    char	text[128];
+    char	ready[16];
+    char	arms[16];
+    char	keys[4];
+    char	*p;
+    int		i;
+    int		len;
+
+    if (weaponinfo[plyr->readyweapon].ammo == am_noammo)
+	M_StringCopy(ready, "--", sizeof(ready));
+    else
+	M_snprintf(ready, sizeof(ready), "%i",
+		   plyr->ammo[weaponinfo[plyr->readyweapon].ammo]);
+
+    // the weapon numbers, as the arms panel, or the frags
+    if (deathmatch)
+	M_snprintf(arms, sizeof(arms), "FRAGS %i", st_fragscount);
+    else
+    {
+	p = arms + M_snprintf(arms, sizeof(arms), "ARMS ");
+	for (i=0;i<6;i++)
+	    *p++ = plyr->weaponowned[i+1] ? '2'+i : '-';
+	*p = 0;
+    }
+
+    // cards in capitals, skulls in small letters
+    for (i=0;i<3;i++)
+    {
+	if (keyboxes[i] == -1)
+	    keys[i] = '-';
+	else if (keyboxes[i] < 3)
+	    keys[i] = keynames[i];
+	else
+	    keys[i] = keynames[i] - 'A' + 'a';
+    }
+    keys[3] = 0;
+
+    len = M_snprintf(text, sizeof(text), "HEALTH %i%%  ARMOR %i%%  AMMO %s ",
+		     plyr->health, plyr->armorpoints, ready);
+    for (i=0;i<NUMAMMO;i++)
+    {
+	len += M_snprintf(text + len, sizeof(text) - len, " %s %i/%i",
+			  ammonames[i], plyr->ammo[i], plyr->maxammo[i]);
+    }
+    M_snprintf(text + len, sizeof(text) - len, "  %s  KEYS %s", arms, keys);
+
+    if (strcmp(text, oldtext))
+    {
+	M_StringCopy(oldtext, text, sizeof(oldtext));
+	I_SetStatusText(text);
+    }
+}
+
 void ST_updateWidgets(void)
 {
     static int	largeammo = 1994; // means "n/a"
@@ -919,6 +985,9 @@ void ST_updateWidgets(void)
     if (!--st_msgcounter)
 	st_chat = st_oldchat;
 
+    if (st_textstatus)
+	ST_updateText();
+
 }
 
 void ST_Ticker (void)
@@ -1061,6 +1130,15 @@ void ST_Drawer (bool fullscreen, bool refresh)
     // Do red-/gold-shifts from damage/items
     ST_doPaletteStuff();
 
+    // The bar is text; its place is only blanked
+    if (st_textstatus)
+    {
+	if (st_firsttime && st_statusbaron)
+	    V_DrawFilledBox(ST_X, ST_Y, ST_WIDTH, ST_HEIGHT, 0);
+	st_firsttime = false;
+	return;
+    }
+
     // If just after ST_Start(), refresh all
     if (st_firsttime) ST_doRefresh();
     // Otherwise, update as little as possible
@@ -1410,6 +1488,15 @@ void ST_Stop (void)
 
 void ST_Init (void)
 {
+    //!
+    // @category video
+    //
+    // Send the status bar as a line of text under the screen,
+    // instead of drawing it.
+    //
+
+    st_textstatus = M_CheckParm("-textstatus") > 0;
+
     ST_loadData();
     st_backing_screen = (byte *) Z_Malloc(ST_WIDTH * ST_HEIGHT, PU_STATIC, 0);
 }
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 
 #include "i_system.h"
 
@@ -59,6 +60,20 @@ static byte *dest_screen = NULL;
 
 int dirtybox[4]; 
 
+// The parts of I_VideoBuffer drawn since I_FinishUpdate last sent it
+dirtyrect_t dirtyrects[MAXDIRTYRECTS];
+int numdirtyrects;
+
+// What was marked before V_BeginMarks, set aside
+static dirtyrect_t keptrects[MAXDIRTYRECTS];
+static int numkeptrects;
+
+// For V_DrawBackground: the background on the screen, and what
+//  was drawn over it last frame.
+static byte *background = NULL;
+static dirtyrect_t drawnrects[MAXDIRTYRECTS];
+static int numdrawnrects;
+
 // haleyjd 08/28/10: clipping callback function for patches.
 // This is needed for Chocolate Strife, which clips patches to the screen.
 static vpatchclipfunc_t patchclip_callback = NULL;
@@ -75,10 +90,175 @@ void V_MarkRect(int x, int y, int width, int height)
     {
         M_AddToBox (dirtybox, x, y); 
         M_AddToBox (dirtybox, x + width-1, y + height-1); 
+        V_AddDirtyRect (x, y, x + width, y + height);
     }
 } 
+
+//
+// V_GrowDirtyRect
+//
+static void V_GrowDirtyRect (dirtyrect_t *r, int x1, int y1, int x2, int y2)
+{
+    if (x1 < r->x1)
+        r->x1 = x1;
+    if (y1 < r->y1)
+        r->y1 = y1;
+    if (x2 > r->x2)
+        r->x2 = x2;
+    if (y2 > r->y2)
+        r->y2 = y2;
+}
+
+//
+// V_AddDirtyRect
+// Rectangles that touch are merged, and once all are used
+//  a new one goes into the one it grows least.
+//
+void V_AddDirtyRect (int x1, int y1, int x2, int y2)
+{
+    dirtyrect_t *r, *best;
+    dirtyrect_t grown;
+    int i, grow, bestgrow;
+
+    if (x1 < 0)
+        x1 = 0;
+    if (y1 < 0)
+        y1 = 0;
+    if (x2 > SCREENWIDTH)
+        x2 = SCREENWIDTH;
+    if (y2 > SCREENHEIGHT)
+        y2 = SCREENHEIGHT;
+
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
+    for (i = 0; i < numdirtyrects; )
+    {
+        r = &dirtyrects[i];
+
+        if (x1 <= r->x2 && r->x1 <= x2 && y1 <= r->y2 && r->y1 <= y2)
+        {
+            grown = *r;
+            V_GrowDirtyRect (&grown, x1, y1, x2, y2);
+            x1 = grown.x1;
+            y1 = grown.y1;
+            x2 = grown.x2;
+            y2 = grown.y2;
+            *r = dirtyrects[--numdirtyrects];
+
+            // grown, it may touch those already passed
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+
+    if (numdirtyrects == MAXDIRTYRECTS)
+    {
+        best = &dirtyrects[0];
+        bestgrow = INT_MAX;
+
+        for (i = 0; i < numdirtyrects; i++)
+        {
+            r = &dirtyrects[i];
+            grown = *r;
+            V_GrowDirtyRect (&grown, x1, y1, x2, y2);
+            grow = (grown.x2 - grown.x1) * (grown.y2 - grown.y1)
+                 - (r->x2 - r->x1) * (r->y2 - r->y1);
+
+            if (grow < bestgrow)
+            {
+                best = r;
+                bestgrow = grow;
+            }
+        }
+
+        V_GrowDirtyRect (best, x1, y1, x2, y2);
+        return;
+    }
+
+    r = &dirtyrects[numdirtyrects++];
+    r->x1 = x1;
+    r->y1 = y1;
+    r->x2 = x2;
+    r->y2 = y2;
+}
+
+//
+// V_ClearDirtyRects
+//
+void V_ClearDirtyRects (void)
+{
+    M_ClearBox (dirtybox);
+    numdirtyrects = 0;
+}
  
 
+//
+// V_BeginMarks
+// Sets aside what is marked so far, so that V_EndMarks has
+//  only what is drawn in between.
+//
+void V_BeginMarks (void)
+{
+    memcpy(keptrects, dirtyrects, numdirtyrects * sizeof(*dirtyrects));
+    numkeptrects = numdirtyrects;
+    numdirtyrects = 0;
+}
+
+//
+// V_EndMarks
+// Copies out what was marked since V_BeginMarks, returning how
+//  many rects, and marks again what was set aside.
+//
+int V_EndMarks (dirtyrect_t *rects)
+{
+    int i, count;
+
+    memcpy(rects, dirtyrects, numdirtyrects * sizeof(*dirtyrects));
+    count = numdirtyrects;
+
+    for (i = 0; i < numkeptrects; i++)
+        V_AddDirtyRect(keptrects[i].x1, keptrects[i].y1, keptrects[i].x2, keptrects[i].y2);
+
+    return count;
+}
+
+//
+// V_DrawBackground
+// Puts a full screen background back on the screen for the frame's
+//  widgets, copying back only what they covered last frame, unless
+//  refresh is set or it is a different background. The widgets
+//  are then drawn and V_EndBackground called, so the frame marks
+//  only what changed.
+//
+void V_DrawBackground (byte *src, bool refresh)
+{
+    dirtyrect_t *r;
+    int i;
+
+    if (refresh || src != background)
+    {
+        background = src;
+        V_DrawBlock(0, 0, SCREENWIDTH, SCREENHEIGHT, src);
+    }
+    else
+    {
+        for (i = 0, r = drawnrects; i < numdrawnrects; i++, r++)
+            V_CopyRect(r->x1, r->y1, src, r->x2 - r->x1, r->y2 - r->y1, r->x1, r->y1);
+    }
+
+    V_BeginMarks();
+}
+
+//
+// V_EndBackground
+//
+void V_EndBackground (void)
+{
+    numdrawnrects = V_EndMarks(drawnrects);
+}
+
 //
 // V_CopyRect 
 // 
@@ -131,6 +311,167 @@ void V_SetPatchClipCallback(vpatchclipfunc_t func)
     patchclip_callback = func;
 }
 
+//
+// Patch cache. V_DrawPatch decodes each patch once into rows of
+// opaque runs, native endian, so drawing it again is a memcpy a run
+// rather than a walk down its posts. A row is a count of runs, then
+// each run's x, length and pixels, padded to an even length.
+// The whole cache is dropped when it fills, or when the zone has
+// purged, as a purged patch's address can come back as another.
+//
+
+#define PATCHCACHESIZE	(256 * 1024)
+#define PATCHCACHESLOTS	512
+
+typedef struct
+{
+    patch_t	*patch;
+    byte	*runs;
+} cachedpatch_t;
+
+static cachedpatch_t patchcache[PATCHCACHESLOTS];
+static byte *patchcachedata = NULL;
+static int patchcacheused;
+static int patchcachepurges;
+
+// A patch spread out, for V_CachePatch to find its runs in.
+static byte patchpixels[SCREENWIDTH * SCREENHEIGHT];
+static byte patchopaque[SCREENWIDTH * SCREENHEIGHT];
+
+static void V_ClearPatchCache (void)
+{
+    memset(patchcache, 0, sizeof(patchcache));
+    patchcacheused = 0;
+}
+
+//
+// V_CachePatch
+// Returns the patch's runs, decoding them if they aren't cached,
+//  or NULL if it doesn't fit.
+//
+static byte *V_CachePatch (patch_t *patch)
+{
+    cachedpatch_t *slot;
+    column_t *column;
+    unsigned short *out;
+    byte *opaque;
+    int w, h, x, y, start, size, runs, top, count;
+
+    if (Z_PurgeCount() != patchcachepurges)
+    {
+        patchcachepurges = Z_PurgeCount();
+        V_ClearPatchCache();
+    }
+
+    if (patchcachedata == NULL)
+        return NULL;
+
+    slot = &patchcache[((uintptr_t) patch >> 3) % PATCHCACHESLOTS];
+    if (slot->patch == patch)
+        return slot->runs;
+
+    w = SHORT(patch->width);
+    h = SHORT(patch->height);
+    if (w <= 0 || w > SCREENWIDTH || h <= 0 || h > SCREENHEIGHT)
+        return NULL;
+
+    // spread the posts out, as the screen would have them
+    memset(patchopaque, 0, w * h);
+    for (x = 0; x < w; x++)
+    {
+        column = (column_t *)((byte *)patch + LONG(patch->columnofs[x]));
+
+        while (column->topdelta != 0xff)
+        {
+            top = column->topdelta;
+            count = column->length;
+            if (top + count > h)
+                count = h - top;
+            for (y = 0; y < count; y++)
+            {
+                patchpixels[(top + y) * w + x] = ((byte *)column)[3 + y];
+                patchopaque[(top + y) * w + x] = 1;
+            }
+            column = (column_t *)((byte *)column + column->length + 4);
+        }
+    }
+
+    // the runs' size, to see that they fit
+    size = 0;
+    for (y = 0, opaque = patchopaque; y < h; y++, opaque += w)
+    {
+        size += 2;
+        for (x = 0; x < w; )
+        {
+            if (!opaque[x])
+            {
+                x++;
+                continue;
+            }
+            for (start = x; x < w && opaque[x]; x++)
+                ;
+            size += 4 + ((x - start + 1) & ~1);
+        }
+    }
+
+    if (patchcacheused + size > PATCHCACHESIZE)
+    {
+        if (size > PATCHCACHESIZE)
+            return NULL;
+        V_ClearPatchCache();
+    }
+
+    slot->patch = patch;
+    slot->runs = patchcachedata + patchcacheused;
+    patchcacheused += size;
+
+    out = (unsigned short *) slot->runs;
+    for (y = 0, opaque = patchopaque; y < h; y++, opaque += w)
+    {
+        unsigned short *count_out = out++;
+
+        runs = 0;
+        for (x = 0; x < w; )
+        {
+            if (!opaque[x])
+            {
+                x++;
+                continue;
+            }
+            for (start = x; x < w && opaque[x]; x++)
+                ;
+            *out++ = start;
+            *out++ = x - start;
+            memcpy(out, patchpixels + y * w + start, x - start);
+            out += (x - start + 1) / 2;
+            runs++;
+        }
+        *count_out = runs;
+    }
+
+    return slot->runs;
+}
+
+//
+// V_DrawPatchRuns
+//
+static void V_DrawPatchRuns (byte *desttop, byte *runs, int height)
+{
+    unsigned short *in = (unsigned short *) runs;
+    int count, x, length;
+
+    for ( ; height > 0; height--, desttop += SCREENWIDTH)
+    {
+        for (count = *in++; count > 0; count--)
+        {
+            x = *in++;
+            length = *in++;
+            memcpy(desttop + x, in, length);
+            in += (length + 1) / 2;
+        }
+    }
+}
+
 //
 // V_DrawPatch
 // Masks a column based masked pic to the screen. 
@@ -144,6 +485,7 @@ void V_DrawPatch(int x, int y, patch_t *patch)
     byte *desttop;
     byte *dest;
     byte *source;
+    byte *runs;
     int w;
 
     y -= SHORT(patch->topoffset);
@@ -171,6 +513,13 @@ void V_DrawPatch(int x, int y, patch_t *patch)
     col = 0;
     desttop = dest_screen + y * SCREENWIDTH + x;
 
+    runs = V_CachePatch(patch);
+    if (runs != NULL)
+    {
+        V_DrawPatchRuns(desttop, runs, SHORT(patch->height));
+        return;
+    }
+
     w = SHORT(patch->width);
 
     for ( ; col<w ; x++, col++, desttop++)
@@ -531,6 +880,7 @@ void V_DrawFilledBox(int x, int y, int w, int h, int c)
     uint8_t *buf, *buf1;
     int x1, y1;
 
+    V_MarkRect(x, y, w, h);
     buf = I_VideoBuffer + SCREENWIDTH * y + x;
 
     for (y1 = 0; y1 < h; ++y1)
@@ -551,6 +901,7 @@ void V_DrawHorizLine(int x, int y, int w, int c)
     uint8_t *buf;
     int x1;
 
+    V_MarkRect(x, y, w, 1);
     buf = I_VideoBuffer + SCREENWIDTH * y + x;
 
     for (x1 = 0; x1 < w; ++x1)
@@ -564,6 +915,7 @@ void V_DrawVertLine(int x, int y, int h, int c)
     uint8_t *buf;
     int y1;
 
+    V_MarkRect(x, y, 1, h);
     buf = I_VideoBuffer + SCREENWIDTH * y + x;
 
     for (y1 = 0; y1 < h; ++y1)
@@ -588,6 +940,7 @@ void V_DrawBox(int x, int y, int w, int h, int c)
  
 void V_DrawRawScreen(byte *raw)
 {
+    V_MarkRect(0, 0, SCREENWIDTH, SCREENHEIGHT);
     memcpy(dest_screen, raw, SCREENWIDTH * SCREENHEIGHT);
 }
 
@@ -596,9 +949,11 @@ void V_DrawRawScreen(byte *raw)
 // 
 void V_Init (void) 
 { 
-    // no-op!
     // There used to be separate screens that could be drawn to; these are
     // now handled in the upper layers.
+
+    patchcachedata = Z_Malloc(PATCHCACHESIZE, PU_STATIC, NULL);
+    patchcachepurges = Z_PurgeCount();
 }
 
 // Set the buffer that the code draws to.
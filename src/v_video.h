@@ -36,6 +36,20 @@
 
 extern int dirtybox[4];
 
+// Rectangles of I_VideoBuffer, from x1,y1 up to x2,y2
+#define MAXDIRTYRECTS	16
+
+typedef struct
+{
+    int x1, y1;
+    int x2, y2;
+} dirtyrect_t;
+
+// What has been drawn since the last frame was sent,
+//  cleared by I_FinishUpdate once it has.
+extern dirtyrect_t dirtyrects[MAXDIRTYRECTS];
+extern int numdirtyrects;
+
 extern byte *tinttable;
 
 // haleyjd 08/28/10: implemented for Strife support
@@ -67,6 +81,20 @@ void V_DrawPatchDirect(int x, int y, patch_t *patch);
 void V_DrawBlock(int x, int y, int width, int height, byte *src);
 
 void V_MarkRect(int x, int y, int width, int height);
+void V_AddDirtyRect(int x1, int y1, int x2, int y2);
+void V_ClearDirtyRects(void);
+
+// Set aside what is marked so far, then return only what was marked
+// since, which is up to MAXDIRTYRECTS rects, and mark both.
+
+void V_BeginMarks(void);
+int V_EndMarks(dirtyrect_t *rects);
+
+// Draw a full screen background for widgets, which are drawn before
+// V_EndBackground. Later frames only put back what the widgets covered.
+
+void V_DrawBackground(byte *src, bool refresh);
+void V_EndBackground(void);
 
 void V_DrawFilledBox(int x, int y, int w, int h, int c);
 void V_DrawHorizLine(int x, int y, int w, int c);
@@ -19,11 +19,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include "m_hash.h"
 #include "m_misc.h"
 #include "sha1.h"
 #include "w_checksum.h"
 #include "w_wad.h"
+#include "z_zone.h"
 
 static wad_file_t **open_wadfiles = NULL;
 static int num_open_wadfiles = 0;
@@ -85,3 +88,87 @@ void W_Checksum(sha1_digest_t digest)
     SHA1_Final(digest, &sha1_context);
 }
 
+// The key of the caches on disk: a fast hash of the same entries as
+// W_Checksum, and of the size and time of each file, so that a WAD
+// edited in place gets a new key too. SHA-1 is kept for netgames,
+// where every machine must agree; this is only ever compared with
+// what the same build wrote. It is worked out once until lumps are
+// added.
+
+static uint64_t cachekey;
+static unsigned int cachekeylumps;
+static lumpinfo_t *cachekeyinfo;
+
+static uint64_t CacheKeyAddFile(uint64_t hash, wad_file_t *handle)
+{
+    struct stat st;
+
+    hash = M_HashInt(hash, handle->length);
+    if (stat(handle->path, &st) == 0)
+    {
+        hash = M_HashInt(hash, (uint64_t) st.st_size);
+        hash = M_HashInt(hash, (uint64_t) st.st_mtime);
+    }
+
+    return hash;
+}
+
+uint64_t W_CacheKey(void)
+{
+    struct
+    {
+        char name[8];
+        int file;
+        int position;
+        int size;
+    } entry;
+    uint64_t hash;
+    unsigned int i;
+    int files;
+
+    if (cachekeyinfo == lumpinfo && cachekeylumps == numlumps)
+    {
+        return cachekey;
+    }
+
+    num_open_wadfiles = 0;
+    files = 0;
+    hash = 0;
+
+    for (i=0; i<numlumps; ++i)
+    {
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.name, lumpinfo[i].name, sizeof(entry.name));
+        entry.file = GetFileNumber(lumpinfo[i].wad_file);
+        entry.position = lumpinfo[i].position;
+        entry.size = lumpinfo[i].size;
+
+        // each file once, when its first lump is seen
+        if (entry.file == files)
+        {
+            hash = CacheKeyAddFile(hash, lumpinfo[i].wad_file);
+            ++files;
+        }
+
+        hash = M_Hash64(&entry, sizeof(entry), hash);
+    }
+
+    cachekey = hash;
+    cachekeylumps = numlumps;
+    cachekeyinfo = lumpinfo;
+
+    return cachekey;
+}
+
+uint64_t W_LumpHash(int lumpnum, uint64_t seed)
+{
+    uint64_t hash;
+
+    hash = M_HashInt(seed, W_LumpLength(lumpnum));
+    hash = M_Hash64(W_CacheLumpNum(lumpnum, PU_STATIC),
+                    W_LumpLength(lumpnum), hash);
+    W_ReleaseLumpNum(lumpnum);
+
+    return hash;
+}
+
@@ -20,8 +20,15 @@
 #define W_CHECKSUM_H
 
 #include "doomtype.h"
+#include "sha1.h"
 
 extern void W_Checksum(sha1_digest_t digest);
 
+// Fast key of the WAD directory and files, for the caches on disk.
+extern uint64_t W_CacheKey(void);
+
+// Fast hash of a lump's length and data, going on from seed.
+extern uint64_t W_LumpHash(int lumpnum, uint64_t seed);
+
 #endif /* #ifndef W_CHECKSUM_H */
 
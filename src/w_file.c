@@ -17,21 +17,21 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "config.h"
 
 #include "doomtype.h"
 #include "m_argv.h"
+#include "m_misc.h"
 
 #include "w_file.h"
 
 extern wad_file_class_t stdc_wad_file;
 
-/*
 #ifdef _WIN32
 extern wad_file_class_t win32_wad_file;
 #endif
-*/
 
 #ifdef HAVE_MMAP
 extern wad_file_class_t posix_wad_file;
@@ -39,11 +39,9 @@ extern wad_file_class_t posix_wad_file;
 
 static wad_file_class_t *wad_file_classes[] = 
 {
-/*
 #ifdef _WIN32
     &win32_wad_file,
 #endif
-*/
 #ifdef HAVE_MMAP
     &posix_wad_file,
 #endif
@@ -56,34 +54,43 @@ wad_file_t *W_OpenFile(char *path)
     int i;
 
     //!
-    // Use the OS's virtual memory subsystem to map WAD files
-    // directly into memory.
+    // Read WAD files into memory a lump at a time instead of
+    // mapping them, which is done by default. Mapped lumps are
+    // shared with other processes using the same files.
     //
 
-    if (!M_CheckParm("-mmap"))
+    if (M_CheckParm("-nommap"))
     {
-        return stdc_wad_file.OpenFile(path);
+        result = stdc_wad_file.OpenFile(path);
     }
-
-    // Try all classes in order until we find one that works
-
-    result = NULL;
-
-    for (i = 0; i < arrlen(wad_file_classes); ++i)
+    else
     {
-        result = wad_file_classes[i]->OpenFile(path);
+        // Try all classes in order until we find one that works
+
+        result = NULL;
 
-        if (result != NULL)
+        for (i = 0; i < arrlen(wad_file_classes); ++i)
         {
-            break;
+            result = wad_file_classes[i]->OpenFile(path);
+
+            if (result != NULL)
+            {
+                break;
+            }
         }
     }
 
+    if (result != NULL)
+    {
+        result->path = M_StringDuplicate(path);
+    }
+
     return result;
 }
 
 void W_CloseFile(wad_file_t *wad)
 {
+    free(wad->path);
     wad->file_class->CloseFile(wad);
 }
 
@@ -93,3 +100,11 @@ size_t W_Read(wad_file_t *wad, unsigned int offset,
     return wad->file_class->Read(wad, offset, buffer, buffer_len);
 }
 
+void W_Prefetch(wad_file_t *wad, unsigned int offset, size_t len)
+{
+    if (wad->file_class->Prefetch != NULL)
+    {
+        wad->file_class->Prefetch(wad, offset, len);
+    }
+}
+
@@ -41,6 +41,11 @@ typedef struct
     size_t (*Read)(wad_file_t *file, unsigned int offset,
                    void *buffer, size_t buffer_len);
 
+    // Ask for data to be read in ahead of being needed, without
+    // waiting for it. NULL if the class can't.
+
+    void (*Prefetch)(wad_file_t *file, unsigned int offset, size_t len);
+
 } wad_file_class_t;
 
 struct _wad_file_s
@@ -57,6 +62,10 @@ struct _wad_file_s
     // Length of the file, in bytes.
 
     unsigned int length;
+
+    // Path the file was opened with.
+
+    char *path;
 };
 
 // Open the specified file. Returns a pointer to a new wad_file_t 
@@ -75,4 +84,8 @@ void W_CloseFile(wad_file_t *wad);
 size_t W_Read(wad_file_t *wad, unsigned int offset,
               void *buffer, size_t buffer_len);
 
+// Hint that data will be read from the file soon.
+
+void W_Prefetch(wad_file_t *wad, unsigned int offset, size_t len);
+
 #endif /* #ifndef __W_FILE__ */
@@ -0,0 +1,134 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	WAD I/O functions, with the file mapped into memory.
+//
+
+#include "config.h"
+
+#ifdef HAVE_MMAP
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "w_file.h"
+#include "z_zone.h"
+
+extern wad_file_class_t posix_wad_file;
+
+static wad_file_t *W_POSIX_OpenFile(char *path)
+{
+    wad_file_t *result;
+    struct stat st;
+    void *mapped;
+    int handle;
+
+    handle = open(path, O_RDONLY);
+
+    if (handle < 0)
+    {
+        return NULL;
+    }
+
+    if (fstat(handle, &st) < 0 || st.st_size == 0)
+    {
+        close(handle);
+        return NULL;
+    }
+
+    // The pages are shared with every other process mapping the
+    // file, and with the page cache. A lump the game writes to
+    // gets a copy of its pages, and the file is left alone.
+
+    mapped = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE, handle, 0);
+
+    // The mapping keeps the file open.
+
+    close(handle);
+
+    if (mapped == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    result = Z_Malloc(sizeof(wad_file_t), PU_STATIC, 0);
+    result->file_class = &posix_wad_file;
+    result->mapped = mapped;
+    result->length = st.st_size;
+
+    return result;
+}
+
+static void W_POSIX_CloseFile(wad_file_t *wad)
+{
+    munmap(wad->mapped, wad->length);
+    Z_Free(wad);
+}
+
+// Read data from the specified position in the file into the 
+// provided buffer.  Returns the number of bytes read.
+
+static size_t W_POSIX_Read(wad_file_t *wad, unsigned int offset,
+                           void *buffer, size_t buffer_len)
+{
+    if (offset >= wad->length)
+    {
+        return 0;
+    }
+
+    if (buffer_len > wad->length - offset)
+    {
+        buffer_len = wad->length - offset;
+    }
+
+    memcpy(buffer, wad->mapped + offset, buffer_len);
+
+    return buffer_len;
+}
+
+// Have the pages read in by the kernel, without waiting.
+
+static void W_POSIX_Prefetch(wad_file_t *wad, unsigned int offset,
+                             size_t len)
+{
+    size_t start;
+
+    if (offset >= wad->length || len == 0)
+    {
+        return;
+    }
+
+    // madvise wants the start of a page
+
+    start = offset & ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+
+    madvise(wad->mapped + start, len + offset - start, MADV_WILLNEED);
+}
+
+
+wad_file_class_t posix_wad_file = 
+{
+    W_POSIX_OpenFile,
+    W_POSIX_CloseFile,
+    W_POSIX_Read,
+    W_POSIX_Prefetch,
+};
+
+#endif /* #ifdef HAVE_MMAP */
+
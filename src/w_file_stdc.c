@@ -16,16 +16,32 @@
 //	WAD I/O functions.
 //
 
-#include <stdio.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <string.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-#include "m_misc.h"
 #include "w_file.h"
 #include "z_zone.h"
 
+// Lumps are read with positioned reads straight into the caller's
+// buffer. There is no file position or stdio buffer shared between
+// reads, so they can come from more than one thread.
+
 typedef struct
 {
     wad_file_t wad;
-    FILE *fstream;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int handle;
+#endif
 } stdc_wad_file_t;
 
 extern wad_file_class_t stdc_wad_file;
@@ -33,22 +49,45 @@ extern wad_file_class_t stdc_wad_file;
 static wad_file_t *W_StdC_OpenFile(char *path)
 {
     stdc_wad_file_t *result;
-    FILE *fstream;
+#ifdef _WIN32
+    HANDLE handle;
+
+    handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+#else
+    struct stat st;
+    int handle;
 
-    fstream = fopen(path, "rb");
+    handle = open(path, O_RDONLY);
 
-    if (fstream == NULL)
+    if (handle < 0)
     {
         return NULL;
     }
 
+    if (fstat(handle, &st) < 0)
+    {
+        close(handle);
+        return NULL;
+    }
+#endif
+
     // Create a new stdc_wad_file_t to hold the file handle.
 
     result = Z_Malloc(sizeof(stdc_wad_file_t), PU_STATIC, 0);
     result->wad.file_class = &stdc_wad_file;
     result->wad.mapped = NULL;
-    result->wad.length = M_FileLength(fstream);
-    result->fstream = fstream;
+#ifdef _WIN32
+    result->wad.length = GetFileSize(handle, NULL);
+#else
+    result->wad.length = st.st_size;
+#endif
+    result->handle = handle;
 
     return &result->wad;
 }
@@ -59,7 +98,11 @@ static void W_StdC_CloseFile(wad_file_t *wad)
 
     stdc_wad = (stdc_wad_file_t *) wad;
 
-    fclose(stdc_wad->fstream);
+#ifdef _WIN32
+    CloseHandle(stdc_wad->handle);
+#else
+    close(stdc_wad->handle);
+#endif
     Z_Free(stdc_wad);
 }
 
@@ -74,23 +117,77 @@ size_t W_StdC_Read(wad_file_t *wad, unsigned int offset,
 
     stdc_wad = (stdc_wad_file_t *) wad;
 
-    // Jump to the specified position in the file.
+    result = 0;
+
+    while (result < buffer_len)
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped;
+        DWORD count;
+
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = offset + result;
+
+        if (!ReadFile(stdc_wad->handle, (byte *) buffer + result,
+                      buffer_len - result, &count, &overlapped))
+        {
+            break;
+        }
+#else
+        ssize_t count;
+
+        count = pread(stdc_wad->handle, (byte *) buffer + result,
+                      buffer_len - result, offset + result);
+
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count < 0)
+        {
+            break;
+        }
+#endif
+
+        // end of file
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        result += count;
+    }
 
-    fseek(stdc_wad->fstream, offset, SEEK_SET);
+    return result;
+}
 
-    // Read into the buffer.
+#ifdef POSIX_FADV_WILLNEED
 
-    result = fread(buffer, 1, buffer_len, stdc_wad->fstream);
+// Have the kernel read the data into the page cache, without waiting.
 
-    return result;
+static void W_StdC_Prefetch(wad_file_t *wad, unsigned int offset,
+                            size_t len)
+{
+    stdc_wad_file_t *stdc_wad;
+
+    stdc_wad = (stdc_wad_file_t *) wad;
+
+    posix_fadvise(stdc_wad->handle, offset, len, POSIX_FADV_WILLNEED);
 }
 
+#else
+#define W_StdC_Prefetch NULL
+#endif
+
 
 wad_file_class_t stdc_wad_file = 
 {
     W_StdC_OpenFile,
     W_StdC_CloseFile,
     W_StdC_Read,
+    W_StdC_Prefetch,
 };
 
 
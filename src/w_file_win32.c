@@ -0,0 +1,129 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	WAD I/O functions, with the file mapped into memory on Windows.
+//
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <string.h>
+
+#include "w_file.h"
+#include "z_zone.h"
+
+typedef struct
+{
+    wad_file_t wad;
+    HANDLE handle;
+    HANDLE handle_map;
+} win32_wad_file_t;
+
+extern wad_file_class_t win32_wad_file;
+
+static wad_file_t *W_Win32_OpenFile(char *path)
+{
+    win32_wad_file_t *result;
+    HANDLE handle;
+    HANDLE handle_map;
+    DWORD length;
+    void *mapped;
+
+    handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+
+    length = GetFileSize(handle, NULL);
+
+    // Copy on write, like MAP_PRIVATE: the pages are shared
+    // until the game writes to a lump.
+
+    handle_map = length == 0 ? NULL
+               : CreateFileMapping(handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+    if (handle_map == NULL)
+    {
+        CloseHandle(handle);
+        return NULL;
+    }
+
+    mapped = MapViewOfFile(handle_map, FILE_MAP_COPY, 0, 0, 0);
+
+    if (mapped == NULL)
+    {
+        CloseHandle(handle_map);
+        CloseHandle(handle);
+        return NULL;
+    }
+
+    result = Z_Malloc(sizeof(win32_wad_file_t), PU_STATIC, 0);
+    result->wad.file_class = &win32_wad_file;
+    result->wad.mapped = mapped;
+    result->wad.length = length;
+    result->handle = handle;
+    result->handle_map = handle_map;
+
+    return &result->wad;
+}
+
+static void W_Win32_CloseFile(wad_file_t *wad)
+{
+    win32_wad_file_t *win32_wad;
+
+    win32_wad = (win32_wad_file_t *) wad;
+
+    UnmapViewOfFile(wad->mapped);
+    CloseHandle(win32_wad->handle_map);
+    CloseHandle(win32_wad->handle);
+    Z_Free(win32_wad);
+}
+
+// Read data from the specified position in the file into the 
+// provided buffer.  Returns the number of bytes read.
+
+static size_t W_Win32_Read(wad_file_t *wad, unsigned int offset,
+                           void *buffer, size_t buffer_len)
+{
+    if (offset >= wad->length)
+    {
+        return 0;
+    }
+
+    if (buffer_len > wad->length - offset)
+    {
+        buffer_len = wad->length - offset;
+    }
+
+    memcpy(buffer, wad->mapped + offset, buffer_len);
+
+    return buffer_len;
+}
+
+
+wad_file_class_t win32_wad_file = 
+{
+    W_Win32_OpenFile,
+    W_Win32_CloseFile,
+    W_Win32_Read,
+    NULL,
+};
+
+#endif /* #ifdef _WIN32 */
+
@@ -0,0 +1,956 @@
+//
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+// Handles merging of PWADs, similar to deutex's -merge option
+//
+// Ideally this should work exactly the same as in deutex, but trying to
+// read the deutex source code made my brain hurt.
+//
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "doomtype.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "m_misc.h"
+#include "w_merge.h"
+#include "w_wad.h"
+#include "z_zone.h"
+
+typedef enum
+{
+    SECTION_NORMAL,
+    SECTION_FLATS,
+    SECTION_SPRITES,
+} section_t;
+
+typedef struct
+{
+    lumpinfo_t *lumps;
+    int numlumps;
+} searchlist_t;
+
+typedef struct
+{
+    char sprname[4];
+    char frame;
+    lumpinfo_t *angle_lumps[8];
+} sprite_frame_t;
+
+static searchlist_t iwad;
+static searchlist_t iwad_sprites;
+static searchlist_t pwad;
+static searchlist_t iwad_flats;
+static searchlist_t pwad_sprites;
+static searchlist_t pwad_flats;
+
+// lumps with these sprites must be replaced in the IWAD
+static sprite_frame_t *sprite_frames;
+static int num_sprite_frames;
+static int sprite_frames_alloced;
+
+// The merged directory, as the lumps of the IWAD and PWAD to keep,
+// in order. A lump whose name is blanked out is stored as -1 - lump.
+
+#define MERGE_BLANK(lump) (-1 - (lump))
+
+static int *merged;
+static int num_merged;
+
+//
+// MERGE CACHE
+//
+// With -wadindex, the merged directory is kept in a file next to
+// the PWAD, as its directory is, and read back instead of merging
+// again while the PWAD and the directory it is merged into match.
+//
+#define MERGECACHEMAGIC "DOOMMRG1"
+
+typedef struct
+{
+    char magic[8];
+    int kind;                   // 0 for -merge, else NWT flags
+    unsigned int length;
+    int64_t mtime;
+    unsigned int numlumps;      // of the directory merged into
+    uint64_t dirsum;
+    unsigned int num_merged;
+} mergecacheheader_t;
+
+#define MERGE_DEUTEX   0
+#define MERGE_NWTDASH  0x100
+
+static int mergecache = -1;
+
+// Search in a list to find a lump with a particular name.
+// The names are compared by their keys.
+//
+// Returns -1 if not found
+
+static int FindInList(searchlist_t *list, char *name)
+{
+    uint64_t key;
+    int i;
+
+    key = W_LumpNameKey(name);
+
+    for (i=0; i<list->numlumps; ++i)
+    {
+        if (list->lumps[i].key == key)
+            return i;
+    }
+
+    return -1;
+}
+
+static bool SetupList(searchlist_t *list, searchlist_t *src_list,
+                      char *startname, char *endname,
+                      char *startname2, char *endname2)
+{
+    int startlump, endlump;
+
+    list->numlumps = 0;
+    startlump = FindInList(src_list, startname);
+
+    if (startname2 != NULL && startlump < 0)
+    {
+        startlump = FindInList(src_list, startname2);
+    }
+
+    if (startlump >= 0)
+    {
+        endlump = FindInList(src_list, endname);
+
+        if (endname2 != NULL && endlump < 0)
+        {
+            endlump = FindInList(src_list, endname2);
+        }
+
+        if (endlump > startlump)
+        {
+            list->lumps = src_list->lumps + startlump + 1;
+            list->numlumps = endlump - startlump - 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Sets up the sprite/flat search lists
+
+static void SetupLists(void)
+{
+    // IWAD
+
+    if (!SetupList(&iwad_flats, &iwad, "F_START", "F_END", NULL, NULL))
+    {
+        I_Error("Flats section not found in IWAD");
+    }
+
+    if (!SetupList(&iwad_sprites, &iwad, "S_START", "S_END", NULL, NULL))
+
+    {
+        I_Error("Sprites section not found in IWAD");
+    }
+
+    // PWAD
+
+    SetupList(&pwad_flats, &pwad, "F_START", "F_END", "FF_START", "FF_END");
+    SetupList(&pwad_sprites, &pwad, "S_START", "S_END", "SS_START", "SS_END");
+}
+
+// Initialize the replace list
+
+static void InitSpriteList(void)
+{
+    if (sprite_frames == NULL)
+    {
+        sprite_frames_alloced = 128;
+        sprite_frames = Z_Malloc(sizeof(*sprite_frames) * sprite_frames_alloced,
+                                 PU_STATIC, NULL);
+    }
+
+    num_sprite_frames = 0;
+}
+
+static bool ValidSpriteLumpName(char *name)
+{
+    if (name[0] == '\0' || name[1] == '\0'
+     || name[2] == '\0' || name[3] == '\0')
+    {
+        return false;
+    }
+
+    // First frame:
+
+    if (name[4] == '\0' || !isdigit(name[5]))
+    {
+        return false;
+    }
+
+    // Second frame (optional):
+
+    if (name[6] != '\0' && !isdigit(name[7]))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// Find a sprite frame
+
+static sprite_frame_t *FindSpriteFrame(char *name, int frame)
+{
+    sprite_frame_t *result;
+    int i;
+
+    // Search the list and try to find the frame
+
+    for (i=0; i<num_sprite_frames; ++i)
+    {
+        sprite_frame_t *cur = &sprite_frames[i];
+
+        if (!strncasecmp(cur->sprname, name, 4) && cur->frame == frame)
+        {
+            return cur;
+        }
+    }
+
+    // Not found in list; Need to add to the list
+
+    // Grow list?
+
+    if (num_sprite_frames >= sprite_frames_alloced)
+    {
+        sprite_frame_t *newframes;
+
+        newframes = Z_Malloc(sprite_frames_alloced * 2 * sizeof(*sprite_frames),
+                             PU_STATIC, NULL);
+        memcpy(newframes, sprite_frames,
+               sprite_frames_alloced * sizeof(*sprite_frames));
+        Z_Free(sprite_frames);
+        sprite_frames_alloced *= 2;
+        sprite_frames = newframes;
+    }
+
+    // Add to end of list
+
+    result = &sprite_frames[num_sprite_frames];
+    strncpy(result->sprname, name, 4);
+    result->frame = frame;
+
+    for (i=0; i<8; ++i)
+        result->angle_lumps[i] = NULL;
+
+    ++num_sprite_frames;
+
+    return result;
+}
+
+// Check if sprite lump is needed in the new wad
+
+static bool SpriteLumpNeeded(lumpinfo_t *lump)
+{
+    sprite_frame_t *sprite;
+    int angle_num;
+    int i;
+
+    if (!ValidSpriteLumpName(lump->name))
+    {
+        return true;
+    }
+
+    // check the first frame
+
+    sprite = FindSpriteFrame(lump->name, lump->name[4]);
+    angle_num = lump->name[5] - '0';
+
+    if (angle_num == 0)
+    {
+        // must check all frames
+
+        for (i=0; i<8; ++i)
+        {
+            if (sprite->angle_lumps[i] == lump)
+                return true;
+        }
+    }
+    else
+    {
+        // check if this lump is being used for this frame
+
+        if (sprite->angle_lumps[angle_num - 1] == lump)
+            return true;
+    }
+
+    // second frame if any
+
+    // no second frame?
+    if (lump->name[6] == '\0')
+        return false;
+
+    sprite = FindSpriteFrame(lump->name, lump->name[6]);
+    angle_num = lump->name[7] - '0';
+
+    if (angle_num == 0)
+    {
+        // must check all frames
+
+        for (i=0; i<8; ++i)
+        {
+            if (sprite->angle_lumps[i] == lump)
+                return true;
+        }
+    }
+    else
+    {
+        // check if this lump is being used for this frame
+
+        if (sprite->angle_lumps[angle_num - 1] == lump)
+            return true;
+    }
+
+    return false;
+}
+
+static void AddSpriteLump(lumpinfo_t *lump)
+{
+    sprite_frame_t *sprite;
+    int angle_num;
+    int i;
+
+    if (!ValidSpriteLumpName(lump->name))
+    {
+        return;
+    }
+
+    // first angle
+
+    sprite = FindSpriteFrame(lump->name, lump->name[4]);
+    angle_num = lump->name[5] - '0';
+
+    if (angle_num == 0)
+    {
+        for (i=0; i<8; ++i)
+            sprite->angle_lumps[i] = lump;
+    }
+    else
+    {
+        sprite->angle_lumps[angle_num - 1] = lump;
+    }
+
+    // second angle
+
+    // no second angle?
+
+    if (lump->name[6] == '\0')
+        return;
+
+    sprite = FindSpriteFrame(lump->name, lump->name[6]);
+    angle_num = lump->name[7] - '0';
+
+    if (angle_num == 0)
+    {
+        for (i=0; i<8; ++i)
+            sprite->angle_lumps[i] = lump;
+    }
+    else
+    {
+        sprite->angle_lumps[angle_num - 1] = lump;
+    }
+}
+
+// Generate the list.  Run at the start, before merging
+
+static void GenerateSpriteList(void)
+{
+    int i;
+
+    InitSpriteList();
+
+    // Add all sprites from the IWAD
+
+    for (i=0; i<iwad_sprites.numlumps; ++i)
+    {
+        AddSpriteLump(&iwad_sprites.lumps[i]);
+    }
+
+    // Add all sprites from the PWAD
+    // (replaces IWAD sprites)
+
+    for (i=0; i<pwad_sprites.numlumps; ++i)
+    {
+        AddSpriteLump(&pwad_sprites.lumps[i]);
+    }
+}
+
+// Adds a lump to the merged directory.
+
+static void AddMerged(lumpinfo_t *lump)
+{
+    merged[num_merged++] = lump - lumpinfo;
+}
+
+// Perform the merge.
+//
+// The merge code creates a new lumpinfo list, adding entries from the
+// IWAD first followed by the PWAD.
+//
+// For the IWAD:
+//  * Flats are added.  If a flat with the same name is in the PWAD,
+//    it is ignored(deleted).  At the end of the section, all flats in the
+//    PWAD are inserted.  This is consistent with the behavior of
+//    deutex/deusf.
+//  * Sprites are added.  The "replace list" is generated before the merge
+//    from the list of sprites in the PWAD.  Any sprites in the IWAD found
+//    to match the replace list are removed.  At the end of the section,
+//    the sprites from the PWAD are inserted.
+//
+// For the PWAD:
+//  * All Sprites and Flats are ignored, with the assumption they have
+//    already been merged into the IWAD's sections.
+
+static void DoMerge(void)
+{
+    section_t current_section;
+    int lumpindex;
+    int i, n;
+
+    // Add IWAD lumps
+    current_section = SECTION_NORMAL;
+
+    for (i=0; i<iwad.numlumps; ++i)
+    {
+        lumpinfo_t *lump = &iwad.lumps[i];
+
+        switch (current_section)
+        {
+            case SECTION_NORMAL:
+                if (!strncasecmp(lump->name, "F_START", 8))
+                {
+                    current_section = SECTION_FLATS;
+                }
+                else if (!strncasecmp(lump->name, "S_START", 8))
+                {
+                    current_section = SECTION_SPRITES;
+                }
+
+                AddMerged(lump);
+
+                break;
+
+            case SECTION_FLATS:
+
+                // Have we reached the end of the section?
+
+                if (!strncasecmp(lump->name, "F_END", 8))
+                {
+                    // Add all new flats from the PWAD to the end
+                    // of the section
+
+                    for (n=0; n<pwad_flats.numlumps; ++n)
+                    {
+                        AddMerged(&pwad_flats.lumps[n]);
+                    }
+
+                    AddMerged(lump);
+
+                    // back to normal reading
+                    current_section = SECTION_NORMAL;
+                }
+                else
+                {
+                    // If there is a flat in the PWAD with the same name,
+                    // do not add it now.  All PWAD flats are added to the
+                    // end of the section. Otherwise, if it is only in the
+                    // IWAD, add it now
+
+                    lumpindex = FindInList(&pwad_flats, lump->name);
+
+                    if (lumpindex < 0)
+                    {
+                        AddMerged(lump);
+                    }
+                }
+
+                break;
+
+            case SECTION_SPRITES:
+
+                // Have we reached the end of the section?
+
+                if (!strncasecmp(lump->name, "S_END", 8))
+                {
+                    // add all the PWAD sprites
+
+                    for (n=0; n<pwad_sprites.numlumps; ++n)
+                    {
+                        if (SpriteLumpNeeded(&pwad_sprites.lumps[n]))
+                        {
+                            AddMerged(&pwad_sprites.lumps[n]);
+                        }
+                    }
+
+                    // copy the ending
+                    AddMerged(lump);
+
+                    // back to normal reading
+                    current_section = SECTION_NORMAL;
+                }
+                else
+                {
+                    // Is this lump holding a sprite to be replaced in the
+                    // PWAD? If so, wait until the end to add it.
+
+                    if (SpriteLumpNeeded(lump))
+                    {
+                        AddMerged(lump);
+                    }
+                }
+
+                break;
+        }
+    }
+
+    // Add PWAD lumps
+    current_section = SECTION_NORMAL;
+
+    for (i=0; i<pwad.numlumps; ++i)
+    {
+        lumpinfo_t *lump = &pwad.lumps[i];
+
+        switch (current_section)
+        {
+            case SECTION_NORMAL:
+                if (!strncasecmp(lump->name, "F_START", 8)
+                 || !strncasecmp(lump->name, "FF_START", 8))
+                {
+                    current_section = SECTION_FLATS;
+                }
+                else if (!strncasecmp(lump->name, "S_START", 8)
+                      || !strncasecmp(lump->name, "SS_START", 8))
+                {
+                    current_section = SECTION_SPRITES;
+                }
+                else
+                {
+                    // Don't include the headers of sections
+
+                    AddMerged(lump);
+                }
+                break;
+
+            case SECTION_FLATS:
+
+                // PWAD flats are ignored (already merged)
+
+                if (!strncasecmp(lump->name, "FF_END", 8)
+                 || !strncasecmp(lump->name, "F_END", 8))
+                {
+                    // end of section
+                    current_section = SECTION_NORMAL;
+                }
+                break;
+
+            case SECTION_SPRITES:
+
+                // PWAD sprites are ignored (already merged)
+
+                if (!strncasecmp(lump->name, "SS_END", 8)
+                 || !strncasecmp(lump->name, "S_END", 8))
+                {
+                    // end of section
+                    current_section = SECTION_NORMAL;
+                }
+                break;
+        }
+    }
+}
+
+// The IWAD list given, with lumps replaced by lumps of the same name
+// from the PWAD, the way NWT does with its -af and -as options.
+
+static void DoNWTAddLumps(searchlist_t *list)
+{
+    int i;
+
+    for (i=0; i<list->numlumps; ++i)
+    {
+        int index;
+
+        index = FindInList(&pwad, list->lumps[i].name);
+
+        if (index > 0)
+        {
+            merged[&list->lumps[i] - lumpinfo] = &pwad.lumps[index] - lumpinfo;
+        }
+    }
+}
+
+static void DoNWTMerge(int flags)
+{
+    int i;
+
+    // The IWAD, as it is
+
+    for (i=0; i<iwad.numlumps; ++i)
+    {
+        merged[num_merged++] = i;
+    }
+
+    // Merge in flats?
+
+    if (flags & W_NWT_MERGE_FLATS)
+    {
+        DoNWTAddLumps(&iwad_flats);
+    }
+
+    // Sprites?
+
+    if (flags & W_NWT_MERGE_SPRITES)
+    {
+        DoNWTAddLumps(&iwad_sprites);
+    }
+}
+
+// Search through the IWAD sprites list, blanking out the name of
+// any sprite lumps that also exist in the PWAD.  This is what
+// nwt -merge does.
+
+static void DoNWTDashMerge(void)
+{
+    int i;
+
+    for (i=0; i<iwad.numlumps; ++i)
+    {
+        merged[num_merged++] = i;
+    }
+
+    for (i=0; i<iwad_sprites.numlumps; ++i)
+    {
+        if (FindInList(&pwad, iwad_sprites.lumps[i].name) >= 0)
+        {
+            int lump = &iwad_sprites.lumps[i] - lumpinfo;
+
+            merged[lump] = MERGE_BLANK(lump);
+        }
+    }
+}
+
+//
+// MergeCacheName
+// Next to the PWAD, like its index.
+//
+static char *MergeCacheName(char *filename)
+{
+    return M_StringJoin(filename, ".mrg", NULL);
+}
+
+//
+// DirectorySum
+// Of the directory being merged into, which may itself be the
+// result of earlier merges.
+//
+static uint64_t DirectorySum(void)
+{
+    uint64_t sum = 0xcbf29ce484222325ull;
+    int i;
+
+    for (i=0; i<iwad.numlumps; ++i)
+    {
+        sum = (sum ^ iwad.lumps[i].key) * 0x100000001b3ull;
+        sum = (sum ^ (unsigned int) iwad.lumps[i].position) * 0x100000001b3ull;
+        sum = (sum ^ (unsigned int) iwad.lumps[i].size) * 0x100000001b3ull;
+    }
+
+    return sum;
+}
+
+//
+// ReadMergeCache
+// Fills in the merged directory from the cache file, and returns
+// false if it is missing or stale.
+//
+static bool ReadMergeCache(char *filename, mergecacheheader_t *key)
+{
+    mergecacheheader_t header;
+    char *cachename;
+    FILE *file;
+    bool result;
+    int total;
+    unsigned int i;
+
+    cachename = MergeCacheName(filename);
+    file = fopen(cachename, "rb");
+    free(cachename);
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    result = false;
+    total = iwad.numlumps + pwad.numlumps;
+
+    if (fread(&header, sizeof(header), 1, file) == 1
+     && !memcmp(&header, key, offsetof(mergecacheheader_t, num_merged))
+     && header.num_merged <= (unsigned int) total
+     && fread(merged, sizeof(*merged), header.num_merged, file)
+            == header.num_merged)
+    {
+        result = true;
+
+        for (i=0; i<header.num_merged; ++i)
+        {
+            if (merged[i] >= total || MERGE_BLANK(merged[i]) >= total)
+            {
+                result = false;
+            }
+        }
+
+        num_merged = header.num_merged;
+    }
+
+    fclose(file);
+
+    return result;
+}
+
+//
+// WriteMergeCache
+// Written next to the file and renamed over it, like W_WriteIndex.
+//
+static void WriteMergeCache(char *filename, mergecacheheader_t *key)
+{
+    char *cachename;
+    char *temp;
+    FILE *file;
+    bool written;
+
+    cachename = MergeCacheName(filename);
+    temp = M_StringJoin(cachename, ".tmp", NULL);
+
+    key->num_merged = num_merged;
+
+    file = fopen(temp, "wb");
+    written = file != NULL
+           && fwrite(key, sizeof(*key), 1, file) == 1
+           && fwrite(merged, sizeof(*merged), num_merged, file)
+                  == (size_t) num_merged;
+
+    if (file != NULL && fclose(file) != 0)
+    {
+        written = false;
+    }
+
+    if (!written || rename(temp, cachename) != 0)
+    {
+        printf("W_MergeFile: failed to write %s\n", cachename);
+        remove(temp);
+    }
+
+    free(temp);
+    free(cachename);
+}
+
+//
+// ApplyMerge
+// Switch to the merged directory, and free the old one.
+//
+static void ApplyMerge(void)
+{
+    lumpinfo_t *newlumps;
+    unsigned int i;
+
+    newlumps = calloc(num_merged, sizeof(lumpinfo_t));
+
+    if (newlumps == NULL)
+    {
+        I_Error("Couldn't realloc lumpinfo");
+    }
+
+    // Nothing should be cached this early, but anything that is
+    // would be left pointing into the old directory.
+
+    for (i=0; i<numlumps; ++i)
+    {
+        if (lumpinfo[i].cache != NULL)
+        {
+            Z_Free(lumpinfo[i].cache);
+        }
+    }
+
+    for (i=0; i<(unsigned int) num_merged; ++i)
+    {
+        if (merged[i] >= 0)
+        {
+            newlumps[i] = lumpinfo[merged[i]];
+        }
+        else
+        {
+            newlumps[i] = lumpinfo[MERGE_BLANK(merged[i])];
+            memset(newlumps[i].name, 0, sizeof(newlumps[i].name));
+            newlumps[i].key = 0;
+        }
+    }
+
+    free(lumpinfo);
+    lumpinfo = newlumps;
+    numlumps = num_merged;
+
+    W_GenerateHashTable();
+}
+
+//
+// MergeFile
+// Adds the PWAD to the end of the directory, then merges it into
+// what was there before, or reads back the merge from the cache.
+//
+static wad_file_t *MergeFile(char *filename, int kind)
+{
+    mergecacheheader_t key;
+    wad_file_t *wad_file;
+    struct stat st;
+    int old_numlumps;
+
+    if (mergecache < 0)
+    {
+        mergecache = M_CheckParm("-wadindex") > 0;
+    }
+
+    old_numlumps = numlumps;
+
+    // Load PWAD
+
+    wad_file = W_AddFile(filename);
+
+    if (wad_file == NULL)
+    {
+        return NULL;
+    }
+
+    // IWAD is at the start, PWAD was appended to the end
+
+    iwad.lumps = lumpinfo;
+    iwad.numlumps = old_numlumps;
+
+    pwad.lumps = lumpinfo + old_numlumps;
+    pwad.numlumps = numlumps - old_numlumps;
+
+    merged = Z_Malloc(numlumps * sizeof(*merged), PU_STATIC, NULL);
+    num_merged = 0;
+
+    memset(&key, 0, sizeof(key));
+
+    if (mergecache && stat(filename, &st) == 0)
+    {
+        memcpy(key.magic, MERGECACHEMAGIC, sizeof(key.magic));
+        key.kind = kind;
+        key.length = wad_file->length;
+        key.mtime = st.st_mtime;
+        key.numlumps = old_numlumps;
+        key.dirsum = DirectorySum();
+    }
+
+    if (key.length == 0 || !ReadMergeCache(filename, &key))
+    {
+        num_merged = 0;
+
+        // Setup sprite/flat lists
+
+        SetupLists();
+
+        if (kind == MERGE_DEUTEX)
+        {
+            // Generate list of sprites to be replaced by the PWAD
+
+            GenerateSpriteList();
+
+            DoMerge();
+        }
+        else if (kind == MERGE_NWTDASH)
+        {
+            DoNWTDashMerge();
+        }
+        else
+        {
+            DoNWTMerge(kind);
+        }
+
+        if (key.length != 0)
+        {
+            WriteMergeCache(filename, &key);
+        }
+    }
+
+    ApplyMerge();
+
+    Z_Free(merged);
+    merged = NULL;
+
+    return wad_file;
+}
+
+void W_PrintDirectory(void)
+{
+    unsigned int i, n;
+
+    // debug
+    for (i=0; i<numlumps; ++i)
+    {
+        for (n=0; n<8 && lumpinfo[i].name[n] != '\0'; ++n)
+            putchar(lumpinfo[i].name[n]);
+        putchar('\n');
+    }
+}
+
+// Merge in a file by name
+
+void W_MergeFile(char *filename)
+{
+    MergeFile(filename, MERGE_DEUTEX);
+}
+
+// Merge sprites and flats in the way NWT does with its -af and -as
+// command-line options.
+
+void W_NWTMergeFile(char *filename, int flags)
+{
+    MergeFile(filename, flags);
+}
+
+// Simulates the NWT -merge command line parameter.  What this does is load
+// a PWAD, then search the IWAD sprites, removing any sprite lumps that also
+// exist in the PWAD.
+
+void W_NWTDashMerge(char *filename)
+{
+    wad_file_t *wad_file;
+
+    wad_file = MergeFile(filename, MERGE_NWTDASH);
+
+    // The PWAD is discarded, and must now be added in again with -file.
+
+    if (wad_file != NULL)
+    {
+        W_CloseFile(wad_file);
+    }
+}
@@ -23,15 +23,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "doomtype.h"
 
 #include "config.h"
 #include "d_iwad.h"
+#include "d_sched.h"
 #include "i_swap.h"
 #include "i_system.h"
 #include "i_video.h"
+#include "m_argv.h"
 #include "m_misc.h"
+#include "m_trace.h"
 #include "z_zone.h"
 
 #include "w_wad.h"
@@ -52,6 +56,31 @@ typedef struct
     char		name[8];
 } PACKEDATTR filelump_t;
 
+//
+// WAD INDEX
+//
+// With -wadindex, the directory of each WAD is kept in a file
+//  next to it, with the key of each name worked out, and
+//  read back instead while the WAD's size and time match.
+//
+#define WADINDEXMAGIC	"DOOMIDX2"
+
+typedef struct
+{
+    char		magic[8];
+    unsigned int	length;
+    unsigned int	numlumps;
+    int64_t		mtime;
+} wadindexheader_t;
+
+typedef struct
+{
+    char		name[8];
+    int			position;
+    int			size;
+    uint64_t		key;
+} wadindexentry_t;
+
 //
 // GLOBALS
 //
@@ -61,9 +90,17 @@ typedef struct
 lumpinfo_t *lumpinfo;
 unsigned int numlumps = 0;
 
-// Hash table for fast lookups
+// Hash table for fast lookups, kept up to date as files are
+// added. It is open addressed, with a power of two slots, at
+// least twice the lumps. Each holds the last lump of a name,
+// or -1.
+
+static int *lumphash;
+static unsigned int lumphashbits;
+
+// Set by -wadindex, -1 until read.
 
-static lumpinfo_t **lumphash;
+static int wadindex = -1;
 
 // Hash function used for lump names.
 
@@ -83,6 +120,22 @@ unsigned int W_LumpNameHash(const char *s)
     return result;
 }
 
+// The name as a number, in upper case and padded with zeroes,
+// so that names can be compared in one go.
+
+uint64_t W_LumpNameKey(const char *s)
+{
+    uint64_t result = 0;
+    unsigned int i;
+
+    for (i=0; i < 8 && s[i] != '\0'; ++i)
+    {
+        result |= (uint64_t) (byte) toupper((int)s[i]) << (i * 8);
+    }
+
+    return result;
+}
+
 // Increase the size of the lumpinfo[] array to the specified size.
 static void ExtendLumpInfo(int newnumlumps)
 {
@@ -107,14 +160,6 @@ static void ExtendLumpInfo(int newnumlumps)
         {
             Z_ChangeUser(newlumpinfo[i].cache, &newlumpinfo[i].cache);
         }
-
-        // We shouldn't be generating a hash table until after all WADs have
-        // been loaded, but just in case...
-        if (lumpinfo[i].next != NULL)
-        {
-            int nextlumpnum = lumpinfo[i].next - lumpinfo;
-            newlumpinfo[i].next = &newlumpinfo[nextlumpnum];
-        }
     }
 
     // All done.
@@ -123,6 +168,174 @@ static void ExtendLumpInfo(int newnumlumps)
     numlumps = newnumlumps;
 }
 
+//
+// W_HashSlot
+// The first slot to look in for a name.
+//
+static unsigned int W_HashSlot(uint64_t key)
+{
+    return (unsigned int) ((key * 0x9e3779b97f4a7c15ull) >> (64 - lumphashbits));
+}
+
+//
+// W_HashLumps
+// Puts the lumps from start on into the hash table,
+//  growing it to keep it at most half full. From 0,
+//  the table is emptied first, so nothing stale is left.
+//
+static void W_HashLumps(unsigned int start)
+{
+    unsigned int i;
+    unsigned int mask;
+    unsigned int slot;
+
+    if (numlumps * 2 > (1u << lumphashbits) || lumphash == NULL)
+    {
+        if (lumphash != NULL)
+        {
+            Z_Free(lumphash);
+        }
+
+        while (numlumps * 2 > (1u << lumphashbits) || lumphashbits < 4)
+        {
+            ++lumphashbits;
+        }
+
+        lumphash = Z_Malloc(sizeof(*lumphash) << lumphashbits, PU_STATIC, NULL);
+
+        start = 0;
+    }
+
+    if (start == 0)
+    {
+        memset(lumphash, 0xff, sizeof(*lumphash) << lumphashbits);
+    }
+
+    mask = (1u << lumphashbits) - 1;
+
+    // Later lumps replace earlier ones of the same name,
+    // so patch lump files take precedence.
+
+    for (i = start; i < numlumps; ++i)
+    {
+        slot = W_HashSlot(lumpinfo[i].key);
+
+        while (lumphash[slot] >= 0
+            && lumpinfo[lumphash[slot]].key != lumpinfo[i].key)
+        {
+            slot = (slot + 1) & mask;
+        }
+
+        lumphash[slot] = i;
+    }
+}
+
+//
+// W_IndexFileName
+// Next to the WAD, like the -sightpvs files.
+//
+static char *W_IndexFileName(char *filename)
+{
+    return M_StringJoin(filename, ".idx", NULL);
+}
+
+//
+// W_ReadIndex
+// Returns the WAD's directory from its index file, or NULL if
+// the file is missing or stale.
+//
+static wadindexentry_t *W_ReadIndex(char *filename, wadindexheader_t *key)
+{
+    wadindexheader_t header;
+    wadindexentry_t *entries;
+    char *indexname;
+    FILE *file;
+    size_t length;
+
+    indexname = W_IndexFileName(filename);
+    file = fopen(indexname, "rb");
+    free(indexname);
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    entries = NULL;
+
+    if (fread(&header, sizeof(header), 1, file) == 1
+     && !memcmp(header.magic, WADINDEXMAGIC, sizeof(header.magic))
+     && header.length == key->length
+     && header.mtime == key->mtime
+     && header.numlumps > 0 && header.numlumps < 0x1000000)
+    {
+        length = header.numlumps * sizeof(*entries);
+        entries = Z_Malloc(length, PU_STATIC, NULL);
+
+        if (fread(entries, 1, length, file) != length)
+        {
+            Z_Free(entries);
+            entries = NULL;
+        }
+        else
+        {
+            key->numlumps = header.numlumps;
+        }
+    }
+
+    fclose(file);
+
+    return entries;
+}
+
+//
+// W_WriteIndex
+// Written next to the file and renamed over it, like P_WritePVS.
+//
+static void W_WriteIndex(char *filename, wadindexheader_t *key,
+                         unsigned int startlump)
+{
+    wadindexentry_t entry;
+    char *indexname;
+    char *temp;
+    FILE *file;
+    unsigned int i;
+    bool written;
+
+    indexname = W_IndexFileName(filename);
+    temp = M_StringJoin(indexname, ".tmp", NULL);
+
+    file = fopen(temp, "wb");
+    written = file != NULL
+           && fwrite(key, sizeof(*key), 1, file) == 1;
+
+    for (i = 0; written && i < key->numlumps; ++i)
+    {
+        lumpinfo_t *lump = &lumpinfo[startlump + i];
+
+        memcpy(entry.name, lump->name, sizeof(entry.name));
+        entry.position = lump->position;
+        entry.size = lump->size;
+        entry.key = lump->key;
+
+        written = fwrite(&entry, sizeof(entry), 1, file) == 1;
+    }
+
+    if (file != NULL && fclose(file) != 0)
+    {
+        written = false;
+    }
+
+    if (!written || rename(temp, indexname) != 0)
+    {
+        printf("W_WriteIndex: failed to write %s\n", indexname);
+        remove(temp);
+    }
+
+    free(temp);
+    free(indexname);
+}
+
 //
 // LUMP BASED ROUTINES.
 //
@@ -139,6 +352,9 @@ static void ExtendLumpInfo(int newnumlumps)
 wad_file_t *W_AddFile (char *filename)
 {
     wadinfo_t header;
+    wadindexheader_t key;
+    wadindexentry_t *index;
+    struct stat st;
     lumpinfo_t *lump_p;
     unsigned int i;
     wad_file_t *wad_file;
@@ -148,6 +364,16 @@ wad_file_t *W_AddFile (char *filename)
     filelump_t *filerover;
     int newnumlumps;
 
+    if (wadindex < 0)
+    {
+        //!
+        // Keep the directory of each WAD in a file next to it,
+        // so that it needn't be read and hashed at startup.
+        //
+
+        wadindex = M_CheckParm("-wadindex") > 0;
+    }
+
     // open the file and add to directory
 
     wad_file = W_OpenFile(filename);
@@ -159,6 +385,18 @@ wad_file_t *W_AddFile (char *filename)
     }
 
     newnumlumps = numlumps;
+    startlump = numlumps;
+    index = NULL;
+    fileinfo = NULL;
+
+    memset(&key, 0, sizeof(key));
+
+    if (wadindex && stat(filename, &st) == 0)
+    {
+        memcpy(key.magic, WADINDEXMAGIC, sizeof(key.magic));
+        key.length = wad_file->length;
+        key.mtime = st.st_mtime;
+    }
 
     if (strcasecmp(filename+strlen(filename)-3 , "wad" ) )
     {
@@ -179,6 +417,12 @@ wad_file_t *W_AddFile (char *filename)
 		M_ExtractFileBase (filename, fileinfo->name);
 		newnumlumps++;
     }
+    else if (key.length != 0
+          && (index = W_ReadIndex(filename, &key)) != NULL)
+    {
+        // WAD file, with an index
+        newnumlumps += key.numlumps;
+    }
     else
     {
     	// WAD file
@@ -203,36 +447,57 @@ wad_file_t *W_AddFile (char *filename)
 
         W_Read(wad_file, header.infotableofs, fileinfo, length);
         newnumlumps += header.numlumps;
+        key.numlumps = header.numlumps;
     }
 
     // Increase size of numlumps array to accomodate the new file.
-    startlump = numlumps;
     ExtendLumpInfo(newnumlumps);
 
     lump_p = &lumpinfo[startlump];
 
-    filerover = fileinfo;
+    if (index != NULL)
+    {
+        for (i=0; i<key.numlumps; ++i)
+        {
+            lump_p->wad_file = wad_file;
+            lump_p->position = index[i].position;
+            lump_p->size = index[i].size;
+            lump_p->cache = NULL;
+            lump_p->key = index[i].key;
+            memcpy(lump_p->name, index[i].name, 8);
+
+            ++lump_p;
+        }
 
-    for (i=startlump; i<numlumps; ++i)
+        Z_Free(index);
+    }
+    else
     {
+        filerover = fileinfo;
+
+        for (i=startlump; i<numlumps; ++i)
+        {
 		lump_p->wad_file = wad_file;
 		lump_p->position = LONG(filerover->filepos);
 		lump_p->size = LONG(filerover->size);
 			lump_p->cache = NULL;
 		strncpy(lump_p->name, filerover->name, 8);
+		lump_p->key = W_LumpNameKey(lump_p->name);
 
 			++lump_p;
 			++filerover;
-    }
+        }
 
-    Z_Free(fileinfo);
+        Z_Free(fileinfo);
 
-    if (lumphash != NULL)
-    {
-        Z_Free(lumphash);
-        lumphash = NULL;
+        if (key.length != 0 && key.numlumps != 0)
+        {
+            W_WriteIndex(filename, &key, startlump);
+        }
     }
 
+    W_HashLumps(startlump);
+
     return wad_file;
 }
 
@@ -255,39 +520,23 @@ int W_NumLumps (void)
 
 int W_CheckNumForName (char* name)
 {
-    lumpinfo_t *lump_p;
-    int i;
-
-    // Do we have a hash table yet?
+    uint64_t key;
+    unsigned int mask;
+    unsigned int slot;
 
-    if (lumphash != NULL)
+    if (lumphash == NULL)
     {
-        int hash;
-
-        // We do! Excellent.
+        return -1;
+    }
 
-        hash = W_LumpNameHash(name) % numlumps;
+    key = W_LumpNameKey(name);
+    mask = (1u << lumphashbits) - 1;
 
-        for (lump_p = lumphash[hash]; lump_p != NULL; lump_p = lump_p->next)
-        {
-            if (!STRNCASECMP(lump_p->name, name, 8))
-            {
-                return lump_p - lumpinfo;
-            }
-        }
-    }
-    else
+    for (slot = W_HashSlot(key); lumphash[slot] >= 0; slot = (slot + 1) & mask)
     {
-        // We don't have a hash table generate yet. Linear search :-(
-        //
-        // scan backwards so patch lump files take precedence
-
-        for (i=numlumps-1; i >= 0; --i)
+        if (lumpinfo[lumphash[slot]].key == key)
         {
-            if (!STRNCASECMP(lumpinfo[i].name, name, 8))
-            {
-                return i;
-            }
+            return lumphash[slot];
         }
     }
 
@@ -367,6 +616,27 @@ void W_ReadLump(unsigned int lump, void *dest)
 
 
 
+//
+// W_PrefetchLump
+// Asks for a lump to be read in ahead of being needed. It
+//  doesn't wait or touch the zone, so it's safe from any thread.
+//
+void W_PrefetchLump (int lumpnum)
+{
+    lumpinfo_t *lump;
+
+    if ((unsigned)lumpnum >= numlumps)
+    {
+	return;
+    }
+
+    lump = &lumpinfo[lumpnum];
+
+    W_Prefetch(lump->wad_file, lump->position, lump->size);
+}
+
+
+
 //
 // W_CacheLumpNum
 //
@@ -413,9 +683,12 @@ void *W_CacheLumpNum(int lumpnum, int tag)
     {
         // Not yet loaded, so load it now
 
+        TRACE_BEGIN ("W_CacheLumpNum miss");
+        D_SessionCount (STAT_LUMPMISSES, 1);
         lump->cache = Z_Malloc(W_LumpLength(lumpnum), tag, &lump->cache);
 	W_ReadLump (lumpnum, lump->cache);
         result = lump->cache;
+        TRACE_END ("W_CacheLumpNum miss");
     }
 
     return result;
@@ -534,39 +807,14 @@ void W_Profile (void)
 
 #endif
 
-// Generate a hash table for fast lookups
+// Generate a hash table for fast lookups. W_AddFile keeps it up
+// to date, so this only rebuilds it from scratch.
 
 void W_GenerateHashTable(void)
 {
-    unsigned int i;
-
-    // Free the old hash table, if there is one
-
-    if (lumphash != NULL)
-    {
-        Z_Free(lumphash);
-    }
-
-    // Generate hash table
-    if (numlumps > 0)
-    {
-        lumphash = Z_Malloc(sizeof(lumpinfo_t *) * numlumps, PU_STATIC, NULL);
-        memset(lumphash, 0, sizeof(lumpinfo_t *) * numlumps);
-
-        for (i=0; i<numlumps; ++i)
-        {
-            unsigned int hash;
-
-            hash = W_LumpNameHash(lumpinfo[i].name) % numlumps;
-
-            // Hook into the hash table
-
-            lumpinfo[i].next = lumphash[hash];
-            lumphash[hash] = &lumpinfo[i];
-        }
-    }
+    // The directory may have been rearranged, by merging.
 
-    // All done!
+    W_HashLumps(0);
 }
 
 // Lump names that are unique to particular game types. This lets us check
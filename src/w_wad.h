@@ -48,7 +48,7 @@ struct lumpinfo_s
 
     // Used for hash table lookups
 
-    lumpinfo_t *next;
+    uint64_t	key;	// W_LumpNameKey of the name
 };
 
 
@@ -62,6 +62,7 @@ int	W_GetNumForName (char* name);
 
 int	W_LumpLength (unsigned int lump);
 void    W_ReadLump (unsigned int lump, void *dest);
+void    W_PrefetchLump (int lump);
 
 void*	W_CacheLumpNum (int lump, int tag);
 void*	W_CacheLumpName (char* name, int tag);
@@ -69,6 +70,7 @@ void*	W_CacheLumpName (char* name, int tag);
 void    W_GenerateHashTable(void);
 
 extern unsigned int W_LumpNameHash(const char *s);
+extern uint64_t W_LumpNameKey(const char *s);
 
 void    W_ReleaseLumpNum(int lump);
 void    W_ReleaseLumpName(char *name);
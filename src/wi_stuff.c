@@ -394,6 +394,10 @@ static patch_t**	lnames;
 // Buffer storing the backdrop
 static patch_t *background;
 
+// The backdrop drawn out, which each frame is put back from
+static byte *backgroundscreen = NULL;
+static bool backgroundrefresh;
+
 //
 // CODE
 //
@@ -401,7 +405,8 @@ static patch_t *background;
 // slam background
 void WI_slamBackground(void)
 {
-    V_DrawPatch(0, 0, background);
+    V_DrawBackground(backgroundscreen, backgroundrefresh);
+    backgroundrefresh = false;
 }
 
 // The ticker is used to detect keys
@@ -1722,6 +1727,14 @@ void WI_loadData(void)
 
     WI_loadUnloadData(WI_loadCallback);
 
+    // draw the backdrop out once
+    if (backgroundscreen == NULL)
+	backgroundscreen = Z_Malloc(SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);
+    V_UseBuffer(backgroundscreen);
+    V_DrawPatch(0, 0, background);
+    V_RestoreBuffer();
+    backgroundrefresh = true;
+
     // These two graphics are special cased because we're sharing
     // them with the status bar code
 
@@ -1749,8 +1762,11 @@ void WI_unloadData(void)
     // W_ReleaseLumpName("STFDEAD0");
 }
 
-void WI_Drawer (void)
+void WI_Drawer (bool refresh)
 {
+    if (refresh)
+	backgroundrefresh = true;
+
     switch (state)
     {
       case StatCount:
@@ -1770,6 +1786,8 @@ void WI_Drawer (void)
 	WI_drawNoState();
 	break;
     }
+
+    V_EndBackground();
 }
 
 
@@ -36,8 +36,9 @@ typedef enum
 void WI_Ticker (void);
 
 // Called by main loop,
-// draws the intermission directly into the screen buffer.
-void WI_Drawer (void);
+// draws the intermission directly into the screen buffer,
+// all of it when refresh is set, else only what changed.
+void WI_Drawer (bool refresh);
 
 // Setup for an intermission screen.
 void WI_Start(wbstartstruct_t*	 wbstartstruct);
@@ -0,0 +1,865 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Zone Memory Allocation, with free blocks kept in
+//	 size class bins instead of found by a rover.
+//	An alternative to z_zone.c, with the same interface.
+//
+
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "d_sched.h"
+#include "z_zone.h"
+#include "z_stats.h"
+#include "i_system.h"
+#include "m_trace.h"
+#include "doomtype.h"
+
+
+//
+// ZONE MEMORY ALLOCATION
+//
+// As in z_zone.c, the zone is one list of memblocks in
+//  address order, with no space between them and never
+//  two contiguous free memblocks.
+//
+// Free blocks are also linked into a bin for their size,
+//  and a bitmap of the bins that aren't empty finds one
+//  big enough in a few steps, however fragmented the zone.
+//
+// Purgable blocks are linked into a list from the least
+//  to the most recently used, instead. When no bin has a
+//  big enough block, the zone grows by another chunk, and
+//  once it can't, they are purged from the front until
+//  one does.
+//
+// Each chunk after the first starts with a PU_STATIC block
+//  owned by the zone, so blocks of two chunks never merge.
+//
+
+#define MEM_ALIGN sizeof(void *)
+#define ZONEID	0x1d4a11
+
+typedef struct memblock_s
+{
+    int			size;	// including the header and possibly tiny fragments
+    int			site;	// Z_StatSite, if counted
+    void**		user;
+    int			tag;	// PU_FREE if this is free
+    int			id;	// should be ZONEID
+    struct memblock_s*	next;
+    struct memblock_s*	prev;
+
+    // the bin while free, the purge list while purgable
+    struct memblock_s*	listnext;
+    struct memblock_s*	listprev;
+} memblock_t;
+
+
+typedef struct
+{
+    // total bytes malloced, including header
+    int		size;
+
+    // start / end cap for linked list
+    memblock_t	blocklist;
+
+    // least recently used purgable block first
+    memblock_t	purgelist;
+
+} memzone_t;
+
+
+
+memzone_t*	mainzone;
+
+// Called before a purgable block is thrown out.
+static void	(*purgecallback) (void);
+
+static int	purgecount;
+static int	chunkcount;
+
+
+//
+// SIZE CLASSES
+//
+// A bin for each power of two, split into BINSPLIT
+//  bins of the same width. A block of a bin is at least
+//  as big as the bin's lower bound, so asking for the
+//  bin above the size's own needs no search of the list.
+//
+#define BINSHIFT	2
+#define BINSPLIT	(1 << BINSHIFT)
+#define BINPOWERS	32
+
+static memblock_t*	bins[BINPOWERS][BINSPLIT];
+static unsigned int	binpowers;
+static unsigned int	binsplits[BINPOWERS];
+
+
+static int Z_LowestBit (unsigned int bits)
+{
+#ifdef __GNUC__
+    return __builtin_ctz (bits);
+#else
+    int		i;
+
+    for (i=0 ; !(bits & (1u << i)) ; i++)
+	;
+
+    return i;
+#endif
+}
+
+static int Z_HighestBit (unsigned int bits)
+{
+#ifdef __GNUC__
+    return 31 - __builtin_clz (bits);
+#else
+    int		i;
+
+    for (i=31 ; !(bits & (1u << i)) ; i--)
+	;
+
+    return i;
+#endif
+}
+
+
+// The bin a block of this size goes into.
+
+static void Z_BinForSize (unsigned int size, int *power, int *split)
+{
+    *power = Z_HighestBit (size);
+    *split = (size >> (*power - BINSHIFT)) & (BINSPLIT - 1);
+}
+
+
+static void Z_InsertFree (memblock_t* block)
+{
+    int		power;
+    int		split;
+
+    Z_BinForSize (block->size, &power, &split);
+
+    block->listprev = NULL;
+    block->listnext = bins[power][split];
+
+    if (block->listnext)
+	block->listnext->listprev = block;
+
+    bins[power][split] = block;
+    binpowers |= 1u << power;
+    binsplits[power] |= 1u << split;
+}
+
+
+static void Z_RemoveFree (memblock_t* block)
+{
+    int		power;
+    int		split;
+
+    Z_BinForSize (block->size, &power, &split);
+
+    if (block->listprev)
+	block->listprev->listnext = block->listnext;
+    else
+	bins[power][split] = block->listnext;
+
+    if (block->listnext)
+	block->listnext->listprev = block->listprev;
+
+    if (bins[power][split] == NULL)
+    {
+	binsplits[power] &= ~(1u << split);
+
+	if (!binsplits[power])
+	    binpowers &= ~(1u << power);
+    }
+}
+
+
+//
+// Z_FindFree
+// A free block of at least size bytes, or NULL.
+//
+static memblock_t* Z_FindFree (int size)
+{
+    unsigned int	bits;
+    unsigned int	round;
+    int			power;
+    int			split;
+
+    // round up to the next bin, all of whose blocks fit
+    power = Z_HighestBit (size);
+    round = (1u << (power - BINSHIFT)) - 1;
+
+    if ((unsigned int) size + round > (unsigned int) size)
+    {
+	Z_BinForSize (size + round, &power, &split);
+
+	bits = binsplits[power] & (~0u << split);
+
+	if (!bits && power < BINPOWERS - 1)
+	{
+	    bits = binpowers & (~0u << (power + 1));
+
+	    if (bits)
+	    {
+		power = Z_LowestBit (bits);
+		bits = binsplits[power];
+	    }
+	}
+
+	if (bits)
+	    return bins[power][Z_LowestBit (bits)];
+    }
+
+    // Only the size's own bin can still have one,
+    // this is left for when nothing can be purged.
+    return NULL;
+}
+
+
+static memblock_t* Z_SearchBin (int size)
+{
+    memblock_t*		block;
+    int			power;
+    int			split;
+
+    Z_BinForSize (size, &power, &split);
+
+    for (block = bins[power][split] ; block ; block = block->listnext)
+    {
+	if (block->size >= size)
+	    return block;
+    }
+
+    return NULL;
+}
+
+
+//
+// Z_Grow
+// Adds a chunk to the zone, returning its free block.
+//
+static memblock_t* Z_Grow (int size)
+{
+    memblock_t*		header;
+    memblock_t*		block;
+    byte*		chunk;
+    int			chunksize;
+
+    chunk = I_ZoneGrow (size + sizeof(memblock_t), &chunksize);
+
+    if (chunk == NULL)
+	return NULL;
+
+    header = (memblock_t *) chunk;
+    header->size = sizeof(memblock_t);
+    header->user = (void *)mainzone;
+    header->tag = PU_STATIC;
+    header->id = 0;
+    header->site = 0;
+
+    block = header + 1;
+    block->size = chunksize - sizeof(memblock_t);
+    block->user = NULL;
+    block->tag = PU_FREE;
+    block->id = 0;
+
+    // link in at the end
+    header->prev = mainzone->blocklist.prev;
+    header->prev->next = header;
+    header->next = block;
+    block->prev = header;
+    block->next = &mainzone->blocklist;
+    mainzone->blocklist.prev = block;
+
+    mainzone->size += chunksize;
+    chunkcount++;
+
+    Z_InsertFree (block);
+
+    return block;
+}
+
+
+static void Z_LinkPurgable (memblock_t* block)
+{
+    memblock_t*		list;
+
+    list = &mainzone->purgelist;
+
+    block->listnext = list;
+    block->listprev = list->listprev;
+    list->listprev->listnext = block;
+    list->listprev = block;
+}
+
+
+static void Z_UnlinkPurgable (memblock_t* block)
+{
+    block->listprev->listnext = block->listnext;
+    block->listnext->listprev = block->listprev;
+}
+
+
+
+static void Z_PrintStats (void)
+{
+    printf ("zone: %i KiB in %i chunks, %i blocks purged\n",
+	    mainzone->size / 1024, chunkcount, purgecount);
+}
+
+
+//
+// Z_Init
+//
+void Z_Init (void)
+{
+    memblock_t*	block;
+    int		size;
+
+    mainzone = (memzone_t *)I_ZoneBase (&size);
+    mainzone->size = size;
+
+    // set the entire zone to one free block
+    mainzone->blocklist.next =
+	mainzone->blocklist.prev =
+	block = (memblock_t *)( (byte *)mainzone + sizeof(memzone_t) );
+
+    mainzone->blocklist.user = (void *)mainzone;
+    mainzone->blocklist.tag = PU_STATIC;
+
+    mainzone->purgelist.listnext =
+	mainzone->purgelist.listprev = &mainzone->purgelist;
+
+    block->prev = block->next = &mainzone->blocklist;
+
+    // free block
+    block->tag = PU_FREE;
+    block->user = NULL;
+    block->id = 0;
+
+    block->size = mainzone->size - sizeof(memzone_t);
+
+    memset (bins, 0, sizeof(bins));
+    memset (binsplits, 0, sizeof(binsplits));
+    binpowers = 0;
+
+    Z_InsertFree (block);
+
+    chunkcount = 1;
+    purgecount = 0;
+
+    I_AtExit (Z_PrintStats, false);
+}
+
+
+//
+// Z_Free
+//
+void Z_Free (void* ptr)
+{
+    memblock_t*		block;
+    memblock_t*		other;
+
+    block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
+
+    if (block->id != ZONEID)
+	I_Error ("Z_Free: freed a pointer without ZONEID");
+
+    if (block->site)
+	Z_StatFree (block->site, block->tag, block->size);
+
+    if (block->tag != PU_FREE && block->user != NULL)
+    {
+	// clear the user's mark
+	*block->user = 0;
+    }
+
+    if (block->tag >= PU_PURGELEVEL)
+	Z_UnlinkPurgable (block);
+
+    // mark as free
+    block->tag = PU_FREE;
+    block->user = NULL;
+    block->id = 0;
+
+    other = block->prev;
+
+    if (other->tag == PU_FREE)
+    {
+	// merge with previous free block
+	Z_RemoveFree (other);
+	other->size += block->size;
+	other->next = block->next;
+	other->next->prev = other;
+
+	block = other;
+    }
+
+    other = block->next;
+    if (other->tag == PU_FREE)
+    {
+	// merge the next free block onto the end
+	Z_RemoveFree (other);
+	block->size += other->size;
+	block->next = other->next;
+	block->next->prev = block;
+    }
+
+    Z_InsertFree (block);
+}
+
+
+
+//
+// Z_Malloc
+// You can pass a NULL user if the tag is < PU_PURGELEVEL.
+// Z_Malloc is a macro passing where it was called from.
+//
+#define MINFRAGMENT		64
+
+
+void*
+Z_Malloc2
+( int		size,
+  int		tag,
+  void*		user,
+  char*		file,
+  int		line )
+{
+    int		extra;
+    bool	purged;
+    memblock_t*	base;
+    memblock_t* newblock;
+    memblock_t*	oldest;
+    void *result;
+
+    if (user == NULL && tag >= PU_PURGELEVEL)
+	I_Error ("Z_Malloc: an owner is required for purgable blocks");
+
+    if (checkallocs)
+	Z_CheckAlloc (file, line);
+
+    size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
+
+    // account for size of block header
+    size += sizeof(memblock_t);
+
+    purged = false;
+
+    // grow the zone, or else throw out purgable blocks,
+    // least recently used first, until a bin has one big enough
+    while ((base = Z_FindFree (size)) == NULL)
+    {
+	base = Z_Grow (size);
+
+	if (base != NULL)
+	    break;
+
+	oldest = mainzone->purgelist.listnext;
+
+	if (oldest == &mainzone->purgelist)
+	{
+	    base = Z_SearchBin (size);
+
+	    if (base == NULL)
+		I_Error ("Z_Malloc: failed on allocation of %i bytes", size);
+
+	    break;
+	}
+
+	// anything still reading from it must finish first
+	if (!purged && purgecallback)
+	{
+	    purgecallback ();
+	}
+	purged = true;
+	purgecount++;
+	TRACE_INSTANT ("Z_Malloc purge");
+	D_SessionCount (STAT_PURGES, 1);
+
+	if (oldest->site)
+	    Z_StatPurge (oldest->site, oldest->tag, oldest->size);
+
+	Z_Free ((byte *)oldest+sizeof(memblock_t));
+    }
+
+    Z_RemoveFree (base);
+
+    // found a block big enough
+    extra = base->size - size;
+
+    if (extra >  MINFRAGMENT)
+    {
+	// there will be a free fragment after the allocated block
+	newblock = (memblock_t *) ((byte *)base + size );
+	newblock->size = extra;
+
+	newblock->tag = PU_FREE;
+	newblock->user = NULL;
+	newblock->id = 0;
+	newblock->prev = base;
+	newblock->next = base->next;
+	newblock->next->prev = newblock;
+
+	base->next = newblock;
+	base->size = size;
+
+	Z_InsertFree (newblock);
+    }
+
+    base->user = user;
+    base->tag = tag;
+    base->site = zonestats ? Z_StatSite (file, line) : 0;
+
+    if (base->site)
+	Z_StatAlloc (base->site, tag, base->size);
+
+    if (tag >= PU_PURGELEVEL)
+	Z_LinkPurgable (base);
+
+    result  = (void *) ((byte *)base + sizeof(memblock_t));
+
+    if (base->user)
+    {
+	*base->user = result;
+    }
+
+    base->id = ZONEID;
+
+    return result;
+}
+
+
+
+//
+// Z_FreeTags
+//
+void
+Z_FreeTags
+( int		lowtag,
+  int		hightag )
+{
+    memblock_t*	block;
+    memblock_t*	next;
+
+    for (block = mainzone->blocklist.next ;
+	 block != &mainzone->blocklist ;
+	 block = next)
+    {
+	// get link before freeing
+	next = block->next;
+
+	// free block, or the start of a chunk?
+	if (block->tag == PU_FREE || block->user == (void *)mainzone)
+	    continue;
+
+	if (block->tag >= lowtag && block->tag <= hightag)
+	    Z_Free ( (byte *)block+sizeof(memblock_t));
+    }
+
+    Z_ClearPools (lowtag, hightag);
+}
+
+
+
+//
+// Z_DumpHeap
+// Note: TFileDumpHeap( stdout ) ?
+//
+void
+Z_DumpHeap
+( int		lowtag,
+  int		hightag )
+{
+    memblock_t*	block;
+
+    printf ("zone size: %i  location: %p\n",
+	    mainzone->size,mainzone);
+
+    printf ("tag range: %i to %i\n",
+	    lowtag, hightag);
+
+    for (block = mainzone->blocklist.next ; ; block = block->next)
+    {
+	if (block->tag >= lowtag && block->tag <= hightag)
+	    printf ("block:%p    size:%7i    user:%p    tag:%3i\n",
+		    block, block->size, block->user, block->tag);
+
+	if (block->next == &mainzone->blocklist)
+	{
+	    // all blocks have been hit
+	    break;
+	}
+
+	if ( (byte *)block + block->size != (byte *)block->next
+	  && block->next->user != (void *)mainzone)
+	    printf ("ERROR: block size does not touch the next block\n");
+
+	if ( block->next->prev != block)
+	    printf ("ERROR: next block doesn't have proper back link\n");
+
+	if (block->tag == PU_FREE && block->next->tag == PU_FREE)
+	    printf ("ERROR: two consecutive free blocks\n");
+    }
+}
+
+
+//
+// Z_FileDumpHeap
+//
+void Z_FileDumpHeap (FILE* f)
+{
+    memblock_t*	block;
+
+    fprintf (f,"zone size: %i  location: %p\n",mainzone->size,mainzone);
+
+    for (block = mainzone->blocklist.next ; ; block = block->next)
+    {
+	fprintf (f,"block:%p    size:%7i    user:%p    tag:%3i\n",
+		 block, block->size, block->user, block->tag);
+
+	if (block->next == &mainzone->blocklist)
+	{
+	    // all blocks have been hit
+	    break;
+	}
+
+	if ( (byte *)block + block->size != (byte *)block->next
+	  && block->next->user != (void *)mainzone)
+	    fprintf (f,"ERROR: block size does not touch the next block\n");
+
+	if ( block->next->prev != block)
+	    fprintf (f,"ERROR: next block doesn't have proper back link\n");
+
+	if (block->tag == PU_FREE && block->next->tag == PU_FREE)
+	    fprintf (f,"ERROR: two consecutive free blocks\n");
+    }
+}
+
+
+
+//
+// Z_CheckHeap
+//
+void Z_CheckHeap (void)
+{
+    memblock_t*	block;
+    memblock_t*	other;
+    int		power;
+    int		split;
+
+    for (block = mainzone->blocklist.next ; ; block = block->next)
+    {
+	if (block->tag == PU_FREE)
+	{
+	    Z_BinForSize (block->size, &power, &split);
+
+	    for (other = bins[power][split] ; other ; other = other->listnext)
+	    {
+		if (other == block)
+		    break;
+	    }
+
+	    if (other == NULL)
+		I_Error ("Z_CheckHeap: free block not in its bin\n");
+	}
+
+	if (block->next == &mainzone->blocklist)
+	{
+	    // all blocks have been hit
+	    break;
+	}
+
+	if ( (byte *)block + block->size != (byte *)block->next
+	  && block->next->user != (void *)mainzone)
+	    I_Error ("Z_CheckHeap: block size does not touch the next block\n");
+
+	if ( block->next->prev != block)
+	    I_Error ("Z_CheckHeap: next block doesn't have proper back link\n");
+
+	if (block->tag == PU_FREE && block->next->tag == PU_FREE)
+	    I_Error ("Z_CheckHeap: two consecutive free blocks\n");
+    }
+
+    for (block = mainzone->purgelist.listnext ;
+	 block != &mainzone->purgelist ;
+	 block = block->listnext)
+    {
+	if (block->tag < PU_PURGELEVEL)
+	    I_Error ("Z_CheckHeap: unpurgable block in the purge list\n");
+
+	if (block->listnext->listprev != block)
+	    I_Error ("Z_CheckHeap: purge list doesn't have proper back link\n");
+    }
+}
+
+
+
+
+//
+// Z_ChangeTag
+// Tagging a block purgable again marks it as
+//  the most recently used.
+//
+void Z_ChangeTag2(void *ptr, int tag, char *file, int line)
+{
+    memblock_t*	block;
+
+    block = (memblock_t *) ((byte *)ptr - sizeof(memblock_t));
+
+    if (block->id != ZONEID)
+        I_Error("%s:%i: Z_ChangeTag: block without a ZONEID!",
+                file, line);
+
+    if (tag >= PU_PURGELEVEL && block->user == NULL)
+        I_Error("%s:%i: Z_ChangeTag: an owner is required "
+                "for purgable blocks", file, line);
+
+    if (block->site)
+        Z_StatRetag (block->site, block->tag, tag, block->size);
+
+    if (block->tag >= PU_PURGELEVEL)
+        Z_UnlinkPurgable (block);
+
+    block->tag = tag;
+
+    if (block->tag >= PU_PURGELEVEL)
+        Z_LinkPurgable (block);
+}
+
+void Z_ChangeUser(void *ptr, void **user)
+{
+    memblock_t*	block;
+
+    block = (memblock_t *) ((byte *)ptr - sizeof(memblock_t));
+
+    if (block->id != ZONEID)
+    {
+        I_Error("Z_ChangeUser: Tried to change user for invalid block!");
+    }
+
+    block->user = user;
+    *user = ptr;
+}
+
+
+
+//
+// Z_FreeMemory
+//
+int Z_FreeMemory (void)
+{
+    memblock_t*		block;
+    int			free;
+
+    free = 0;
+
+    for (block = mainzone->blocklist.next ;
+         block != &mainzone->blocklist;
+         block = block->next)
+    {
+        if (block->tag == PU_FREE || block->tag >= PU_PURGELEVEL)
+            free += block->size;
+    }
+
+    return free;
+}
+
+//
+// Z_ReleaseFree
+// Hands the whole pages of free blocks back to the system,
+//  which gives them back zeroed once they're written again.
+//
+void Z_ReleaseFree (void)
+{
+#ifndef _WIN32
+    memblock_t*		block;
+    uintptr_t		page;
+    uintptr_t		start;
+    uintptr_t		end;
+
+    page = sysconf (_SC_PAGESIZE);
+
+    for (block = mainzone->blocklist.next ;
+         block != &mainzone->blocklist;
+         block = block->next)
+    {
+        if (block->tag != PU_FREE)
+            continue;
+
+        // the header stays
+        start = ((uintptr_t) (block + 1) + page - 1) & ~(page - 1);
+        end = ((uintptr_t) block + block->size) & ~(page - 1);
+
+        if (start < end)
+            madvise ((void *) start, end - start, MADV_DONTNEED);
+    }
+#endif
+
+    Z_ReleasePools ();
+}
+
+//
+// Z_FreeBlocks
+//
+void Z_FreeBlocks (int *free, int *largest, int *count)
+{
+    memblock_t*		block;
+
+    *free = 0;
+    *largest = 0;
+    *count = 0;
+
+    for (block = mainzone->blocklist.next ;
+         block != &mainzone->blocklist;
+         block = block->next)
+    {
+        if (block->tag == PU_FREE)
+        {
+            *free += block->size;
+            *count += 1;
+
+            if (block->size > *largest)
+                *largest = block->size;
+        }
+    }
+}
+
+unsigned int Z_ZoneSize(void)
+{
+    return mainzone->size;
+}
+
+int Z_PurgeCount(void)
+{
+    return purgecount;
+}
+
+
+void Z_SetPurgeCallback (void (*callback)(void))
+{
+    purgecallback = callback;
+}
@@ -0,0 +1,257 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Pooled level memory, carved out of the zone.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "z_zone.h"
+#include "doomtype.h"
+#include "i_system.h"
+
+
+//
+// POOLED LEVEL MEMORY
+//
+// Mobjs and thinkers come and go all through a level.
+// They are carved out of slabs of the level arena by
+//  size class instead, and freed blocks are kept for
+//  the next one of their class. Z_FreeTags drops the
+//  slabs with the rest of the level, which empties the
+//  pools.
+//
+#define POOLGRAIN	16
+#define POOLCLASSES	19
+#define POOLSLABSIZE	16384
+
+// Blocks bigger than the last class come from the zone.
+#define POOL_ZONE	-1
+
+typedef struct poolblock_s
+{
+    // next free block of the class, while free
+    struct poolblock_s*	next;
+    int			poolclass;
+    int			pad;
+} poolblock_t;
+
+static poolblock_t*	poolfree[POOLCLASSES];
+static byte*		poolslab[POOLCLASSES];
+static int		poolslableft[POOLCLASSES];
+
+
+//
+// LEVEL ARENA
+//
+// What P_SetupLevel loads is kept until the next level,
+//  so it is laid out one after the other in big chunks
+//  outside the zone, and all let go at once with the
+//  level. The chunks are kept for the next one, or made
+//  into one chunk of their total size if the level took
+//  more than one, so that a level of the same size or
+//  smaller never has to ask the system again.
+//
+#define ARENAGRAIN	16
+#define ARENACHUNKSIZE	(1024*1024)
+
+typedef struct arenachunk_s
+{
+    struct arenachunk_s*	next;
+    int				size;
+    int				used;
+    int				pad;
+} arenachunk_t;
+
+// the one being filled, at the head of the others
+static arenachunk_t*	arena;
+
+
+static arenachunk_t* Z_NewChunk (int size, arenachunk_t* next)
+{
+    arenachunk_t*	chunk;
+
+    chunk = malloc (sizeof(*chunk) + size);
+
+    if (chunk == NULL)
+	I_Error ("Z_LevelMalloc: failed on allocation of %i bytes", size);
+
+    chunk->next = next;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+
+//
+// Z_ClearArena
+//
+static void Z_ClearArena (void)
+{
+    arenachunk_t*	chunk;
+    arenachunk_t*	next;
+    int			total;
+
+    if (arena == NULL || arena->next == NULL)
+    {
+	if (arena)
+	    arena->used = 0;
+	return;
+    }
+
+    total = 0;
+    for (chunk = arena ; chunk ; chunk = next)
+    {
+	next = chunk->next;
+	total += chunk->size;
+	free (chunk);
+    }
+
+    arena = Z_NewChunk (total, NULL);
+}
+
+
+//
+// Z_LevelMalloc
+// Level memory that is never freed before the level is,
+//  by Z_FreeTags with PU_LEVEL.
+//
+void* Z_LevelMalloc (int size)
+{
+    void*	ptr;
+
+    size = (size + ARENAGRAIN - 1) & ~(ARENAGRAIN - 1);
+
+    if (arena == NULL || arena->size - arena->used < size)
+	arena = Z_NewChunk (size > ARENACHUNKSIZE ? size : ARENACHUNKSIZE,
+			    arena);
+
+    ptr = (byte *) (arena + 1) + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+
+//
+// Z_ReleasePools
+// Called by Z_ReleaseFree, for the arena
+//  to go back to the system as well.
+//
+void Z_ReleasePools (void)
+{
+    arenachunk_t*	next;
+
+    // only between levels, as Z_ClearArena leaves it
+    if (arena == NULL || arena->used != 0)
+	return;
+
+    for ( ; arena ; arena = next)
+    {
+	next = arena->next;
+	free (arena);
+    }
+}
+
+
+
+//
+// Z_ClearPools
+// Called by Z_FreeTags, for the slabs and the arena.
+//
+void Z_ClearPools (int lowtag, int hightag)
+{
+    // the slabs of the pools went with the level
+    if (lowtag <= PU_LEVEL && hightag >= PU_LEVEL)
+    {
+	memset (poolfree, 0, sizeof(poolfree));
+	memset (poolslab, 0, sizeof(poolslab));
+	memset (poolslableft, 0, sizeof(poolslableft));
+	Z_ClearArena ();
+    }
+}
+
+
+
+//
+// Z_PoolMalloc
+// Level memory for mobjs and thinkers,
+//  to be freed with Z_PoolFree.
+//
+void* Z_PoolMalloc (int size)
+{
+    poolblock_t*	block;
+    int			poolclass;
+    int			blocksize;
+
+    poolclass = (size + POOLGRAIN - 1) / POOLGRAIN - 1;
+
+    if (poolclass < 0)
+	poolclass = 0;
+
+    if (poolclass >= POOLCLASSES)
+    {
+	block = Z_Malloc (sizeof(*block) + size, PU_LEVEL, NULL);
+	block->poolclass = POOL_ZONE;
+	return block + 1;
+    }
+
+    block = poolfree[poolclass];
+
+    if (block)
+    {
+	poolfree[poolclass] = block->next;
+	return block + 1;
+    }
+
+    blocksize = sizeof(*block) + (poolclass + 1) * POOLGRAIN;
+
+    if (poolslableft[poolclass] < blocksize)
+    {
+	poolslab[poolclass] = Z_LevelMalloc (POOLSLABSIZE);
+	poolslableft[poolclass] = POOLSLABSIZE;
+    }
+
+    block = (poolblock_t *) poolslab[poolclass];
+    poolslab[poolclass] += blocksize;
+    poolslableft[poolclass] -= blocksize;
+
+    block->poolclass = poolclass;
+    return block + 1;
+}
+
+
+
+//
+// Z_PoolFree
+// The block itself is left alone, the thinker
+//  code still follows the links of a freed one.
+//
+void Z_PoolFree (void* ptr)
+{
+    poolblock_t*	block;
+
+    block = (poolblock_t *) ptr - 1;
+
+    if (block->poolclass == POOL_ZONE)
+    {
+	Z_Free (block);
+	return;
+    }
+
+    block->next = poolfree[block->poolclass];
+    poolfree[block->poolclass] = block;
+}
@@ -0,0 +1,460 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Zone memory statistics.
+//	With -zonestats <file>, the zone counts the live and
+//	peak bytes, allocations and purges of each tag and of
+//	each place Z_Malloc is called from. Once a second a
+//	line of JSON with the counts is added to the file.
+//	With -checkallocs <tics>, once a level has run on for
+//	that many tics, the game fails at the first pass of the
+//	loop that allocates any zone memory or, with glibc, any
+//	memory through malloc, calloc or realloc.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+
+#include "d_loop.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+
+#include "z_zone.h"
+#include "z_stats.h"
+
+
+bool		zonestats;
+bool		checkallocs;
+
+// Set by -lowmem, to print the breakdown once started.
+static bool	lowmem;
+
+typedef struct
+{
+    int		live;		// bytes allocated now
+    int		peak;		// most bytes allocated at once
+    int		allocs;		// allocations since the last line
+    int		purges;		// purges since the last line
+} zonecount_t;
+
+typedef struct
+{
+    char*	file;
+    int		line;
+    zonecount_t	count;
+} zonesite_t;
+
+// Sites are found by hashing the file and line;
+//  site 0 is the empty slot and means not counted.
+#define MAXSITES	1024
+
+static zonesite_t	sites[MAXSITES];
+static int		numsites;
+
+static zonecount_t	tagcounts[PU_NUM_TAGS];
+
+static const char *tagnames[PU_NUM_TAGS] =
+{
+    NULL, "static", "sound", "music", "free",
+    "level", "levspec", "purgelevel", "cache"
+};
+
+static FILE*	statsfile;
+static int	laststatstime;
+static int	totalpurges;
+
+// -checkallocs, since the last pass of the loop
+static int	zoneallocs;
+static char*	firstallocfile;
+static int	firstallocline;
+static int	libcallocs;
+static void*	firstlibccaller;
+
+static int	checkwarmup;
+static int	steadytics;
+static int	checkedframes;
+static int	lastchecktic;
+static int	lastleveltime;
+
+
+#ifdef __GLIBC__
+
+// The program's own malloc and friends stand in for
+//  glibc's everywhere, and count the calls.
+extern void*	__libc_malloc (size_t size);
+extern void*	__libc_calloc (size_t count, size_t size);
+extern void*	__libc_realloc (void *ptr, size_t size);
+
+static void Z_CheckLibcAlloc (void *caller)
+{
+    // the render threads may get here at once,
+    //  any count but 0 will do
+    if (libcallocs++ == 0)
+	firstlibccaller = caller;
+}
+
+void *malloc (size_t size)
+{
+    if (checkallocs)
+	Z_CheckLibcAlloc (__builtin_return_address (0));
+
+    return __libc_malloc (size);
+}
+
+void *calloc (size_t count, size_t size)
+{
+    if (checkallocs)
+	Z_CheckLibcAlloc (__builtin_return_address (0));
+
+    return __libc_calloc (count, size);
+}
+
+void *realloc (void *ptr, size_t size)
+{
+    if (checkallocs)
+	Z_CheckLibcAlloc (__builtin_return_address (0));
+
+    return __libc_realloc (ptr, size);
+}
+
+#endif
+
+
+static void Z_PrintCheckedFrames (void)
+{
+    printf ("Z_CheckAllocs: %i steady frames allocated nothing\n",
+	    checkedframes);
+}
+
+
+//
+// Z_InitStats
+//
+void Z_InitStats (void)
+{
+    int		p;
+
+    //!
+    // @arg <file>
+    //
+    // Add a line of JSON to file once a second, with the live and
+    // peak bytes, allocations and purges of each zone tag and of
+    // each place zone memory is allocated from, and the zone's
+    // free memory and fragmentation.
+    //
+
+    //!
+    // @arg <tics>
+    //
+    // Once a level has been played for that many tics, fail as
+    // soon as a frame, or the tics run before it, allocates any
+    // zone memory, or with glibc any memory at all, and tell where
+    // it was allocated from. Loading a level or a game, pausing
+    // and the menu start the count again.
+    //
+
+    p = M_CheckParmWithArgs ("-checkallocs", 1);
+
+    if (p)
+    {
+	checkwarmup = atoi (myargv[p+1]);
+	checkallocs = true;
+	I_AtExit (Z_PrintCheckedFrames, false);
+    }
+
+    // counted from here to Z_StartupStats
+    lowmem = M_CheckParm ("-lowmem") > 0;
+    zonestats = lowmem;
+
+    p = M_CheckParmWithArgs ("-zonestats", 1);
+
+    if (p == 0)
+	return;
+
+    statsfile = fopen (myargv[p+1], "w");
+
+    if (statsfile == NULL)
+	I_Error ("Z_InitStats: couldn't open %s", myargv[p+1]);
+
+    zonestats = true;
+    laststatstime = I_GetTime ();
+}
+
+
+//
+// Z_StatSite
+//
+int Z_StatSite (char *file, int line)
+{
+    unsigned int	hash;
+    int			i;
+
+    hash = (unsigned int) (uintptr_t) file * 31 + line;
+
+    for (i=0 ; i<MAXSITES ; i++)
+    {
+	hash = (hash + 1) % MAXSITES;
+
+	// slot 0 is never used
+	if (hash == 0)
+	    continue;
+
+	if (sites[hash].file == file && sites[hash].line == line)
+	    return hash;
+
+	if (sites[hash].file == NULL)
+	{
+	    if (numsites == MAXSITES - 2)
+		break;
+
+	    sites[hash].file = file;
+	    sites[hash].line = line;
+	    numsites++;
+	    return hash;
+	}
+    }
+
+    // out of sites, don't count it
+    return 0;
+}
+
+
+static void Z_AddLive (zonecount_t *count, int size)
+{
+    count->live += size;
+
+    if (count->live > count->peak)
+	count->peak = count->live;
+}
+
+
+void Z_StatAlloc (int site, int tag, int size)
+{
+    Z_AddLive (&sites[site].count, size);
+    sites[site].count.allocs++;
+
+    Z_AddLive (&tagcounts[tag], size);
+    tagcounts[tag].allocs++;
+}
+
+
+void Z_StatFree (int site, int tag, int size)
+{
+    sites[site].count.live -= size;
+    tagcounts[tag].live -= size;
+}
+
+
+void Z_StatRetag (int site, int oldtag, int tag, int size)
+{
+    tagcounts[oldtag].live -= size;
+    Z_AddLive (&tagcounts[tag], size);
+}
+
+
+void Z_CheckAlloc (char *file, int line)
+{
+    if (zoneallocs++ == 0)
+    {
+	firstallocfile = file;
+	firstallocline = line;
+    }
+}
+
+
+//
+// Z_CheckFrame
+// The level's time running on with the game's
+//  means nothing was loaded or paused.
+//
+static void Z_CheckFrame (void)
+{
+    bool	steady;
+    int		tics;
+
+    tics = gametic - lastchecktic;
+    steady = gamestate == GS_LEVEL && leveltime - lastleveltime == tics;
+
+    if (steady && steadytics >= checkwarmup)
+    {
+	if (zoneallocs)
+	    I_Error ("Z_CheckAllocs: %i zone allocations at gametic %i,"
+		     " the first from %s:%i", zoneallocs, gametic,
+		     firstallocfile, firstallocline);
+	if (libcallocs)
+	    I_Error ("Z_CheckAllocs: %i libc allocations at gametic %i,"
+		     " the first called from %p", libcallocs, gametic,
+		     firstlibccaller);
+	checkedframes++;
+    }
+
+    steadytics = steady ? steadytics + tics : 0;
+    lastchecktic = gametic;
+    lastleveltime = leveltime;
+
+    zoneallocs = 0;
+    libcallocs = 0;
+}
+
+
+void Z_StatPurge (int site, int tag, int size)
+{
+    sites[site].count.purges++;
+    tagcounts[tag].purges++;
+    totalpurges++;
+}
+
+
+//
+// Z_StartupStats
+// To stderr, which a session server keeps as its log.
+//
+#define STARTUPSITES	8
+
+void Z_StartupStats (void)
+{
+    int		top[STARTUPSITES];
+    int		numtop;
+    int		i;
+    int		j;
+
+    if (!lowmem)
+	return;
+
+    fprintf (stderr, "Z_StartupStats: zone %u KiB", Z_ZoneSize () / 1024);
+
+    for (i=PU_STATIC ; i<PU_NUM_TAGS ; i++)
+    {
+	if (i != PU_FREE && tagcounts[i].live)
+	    fprintf (stderr, ", %s %i KiB", tagnames[i],
+		     tagcounts[i].live / 1024);
+    }
+
+    fprintf (stderr, "\n");
+
+    // the sites holding the most, largest first
+    numtop = 0;
+
+    for (i=1 ; i<MAXSITES ; i++)
+    {
+	if (sites[i].file == NULL || sites[i].count.live <= 0)
+	    continue;
+
+	if (numtop < STARTUPSITES)
+	    j = numtop++;
+	else if (sites[top[STARTUPSITES-1]].count.live < sites[i].count.live)
+	    j = STARTUPSITES - 1;
+	else
+	    continue;
+
+	for ( ; j > 0 && sites[top[j-1]].count.live < sites[i].count.live ; j--)
+	    top[j] = top[j-1];
+
+	top[j] = i;
+    }
+
+    for (i=0 ; i<numtop ; i++)
+    {
+	fprintf (stderr, "Z_StartupStats: %6i KiB %s:%i\n",
+		 sites[top[i]].count.live / 1024,
+		 sites[top[i]].file, sites[top[i]].line);
+    }
+
+    if (statsfile == NULL)
+	zonestats = false;
+}
+
+
+static void Z_WriteCount (zonecount_t *count)
+{
+    fprintf (statsfile, "{\"live\":%i,\"peak\":%i,\"allocs\":%i,\"purges\":%i}",
+	     count->live, count->peak, count->allocs, count->purges);
+
+    count->allocs = 0;
+    count->purges = 0;
+}
+
+
+//
+// Z_StatsTicker
+//
+void Z_StatsTicker (void)
+{
+    char	*sep;
+    int		now;
+    int		free;
+    int		largest;
+    int		blocks;
+    int		i;
+
+    if (checkallocs)
+	Z_CheckFrame ();
+
+    if (statsfile == NULL)
+	return;
+
+    now = I_GetTime ();
+
+    if (now - laststatstime < TICRATE)
+	return;
+
+    laststatstime = now;
+
+    Z_FreeBlocks (&free, &largest, &blocks);
+
+    // fragmentation is the share of free memory
+    //  outside the largest free block
+    fprintf (statsfile,
+	     "{\"time\":%i,\"gametic\":%i,\"zone\":%u,\"free\":%i,"
+	     "\"largest\":%i,\"freeblocks\":%i,\"frag\":%.3f,\"purges\":%i,"
+	     "\"tags\":{",
+	     now, gametic, Z_ZoneSize (), free, largest, blocks,
+	     free > 0 ? 1.0 - (double) largest / free : 0.0, totalpurges);
+
+    totalpurges = 0;
+    sep = "";
+
+    for (i=PU_STATIC ; i<PU_NUM_TAGS ; i++)
+    {
+	if (i == PU_FREE)
+	    continue;
+
+	fprintf (statsfile, "%s\"%s\":", sep, tagnames[i]);
+	Z_WriteCount (&tagcounts[i]);
+	sep = ",";
+    }
+
+    fprintf (statsfile, "},\"sites\":{");
+    sep = "";
+
+    // only sites with something live or going on
+    for (i=1 ; i<MAXSITES ; i++)
+    {
+	if (sites[i].file == NULL
+	 || (!sites[i].count.live && !sites[i].count.allocs
+	  && !sites[i].count.purges))
+	    continue;
+
+	fprintf (statsfile, "%s\"%s:%i\":", sep, sites[i].file, sites[i].line);
+	Z_WriteCount (&sites[i].count);
+	sep = ",";
+    }
+
+    fprintf (statsfile, "}}\n");
+    fflush (statsfile);
+}
@@ -0,0 +1,57 @@
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Zone memory statistics.
+//
+
+
+#ifndef __Z_STATS__
+#define __Z_STATS__
+
+#include "doomtype.h"
+
+// Set by -zonestats.
+extern bool	zonestats;
+
+// Called at startup, after Z_Init, reads -zonestats
+//  and -checkallocs.
+void	Z_InitStats (void);
+
+// Called once started, prints with -lowmem what the zone
+//  holds by tag and the places that hold the most, and
+//  stops counting unless -zonestats goes on.
+void	Z_StartupStats (void);
+
+// Called every frame, writes a line once a second, and
+//  fails with -checkallocs if anything was allocated.
+void	Z_StatsTicker (void);
+
+// Called by the zone. Blocks allocated while zonestats
+//  is set have a site, where they were allocated from;
+//  those with none (0) aren't counted.
+int	Z_StatSite (char *file, int line);
+void	Z_StatAlloc (int site, int tag, int size);
+void	Z_StatFree (int site, int tag, int size);
+void	Z_StatRetag (int site, int oldtag, int tag, int size);
+void	Z_StatPurge (int site, int tag, int size);
+
+// Set by -checkallocs.
+extern bool	checkallocs;
+
+// Called by the zone for each allocation while
+//  checkallocs is set.
+void	Z_CheckAlloc (char *file, int line);
+
+// Provided by the zone, for the fragmentation.
+void	Z_FreeBlocks (int *free, int *largest, int *count);
+
+#endif
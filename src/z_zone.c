@@ -17,8 +17,18 @@
 //
 
 
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "d_sched.h"
 #include "z_zone.h"
+#include "z_stats.h"
 #include "i_system.h"
+#include "m_trace.h"
 #include "doomtype.h"
 
 
@@ -31,6 +41,11 @@
 //
 // It is of no value to free a cachable block,
 //  because it will get overwritten automatically if needed.
+//
+// When the rover has been all the way around, the zone
+//  grows by another chunk. Each chunk after the first
+//  starts with a PU_STATIC block owned by the zone, so
+//  blocks of two chunks never merge.
 // 
  
 #define MEM_ALIGN sizeof(void *)
@@ -39,6 +54,7 @@
 typedef struct memblock_s
 {
     int			size;	// including the header and possibly tiny fragments
+    int			site;	// Z_StatSite, if counted
     void**		user;
     int			tag;	// PU_FREE if this is free
     int			id;	// should be ZONEID
@@ -63,6 +79,11 @@ typedef struct
 
 memzone_t*	mainzone;
 
+// Called before a purgable block is thrown out.
+static void	(*purgecallback) (void);
+
+static int	purgecount;
+static int	chunkcount;
 
 
 //
@@ -91,6 +112,13 @@ void Z_ClearZone (memzone_t* zone)
 
 
 
+static void Z_PrintStats (void)
+{
+    printf ("zone: %i KiB in %i chunks, %i blocks purged\n",
+	    mainzone->size / 1024, chunkcount, purgecount);
+}
+
+
 //
 // Z_Init
 //
@@ -117,6 +145,55 @@ void Z_Init (void)
     block->tag = PU_FREE;
     
     block->size = mainzone->size - sizeof(memzone_t);
+
+    chunkcount = 1;
+    purgecount = 0;
+
+    I_AtExit (Z_PrintStats, false);
+}
+
+
+//
+// Z_Grow
+// Adds a chunk to the zone, returning its free block.
+//
+static memblock_t* Z_Grow (int size)
+{
+    memblock_t*		header;
+    memblock_t*		block;
+    byte*		chunk;
+    int			chunksize;
+
+    chunk = I_ZoneGrow (size + sizeof(memblock_t), &chunksize);
+
+    if (chunk == NULL)
+	return NULL;
+
+    header = (memblock_t *) chunk;
+    header->size = sizeof(memblock_t);
+    header->user = (void *)mainzone;
+    header->tag = PU_STATIC;
+    header->id = 0;
+    header->site = 0;
+
+    block = header + 1;
+    block->size = chunksize - sizeof(memblock_t);
+    block->user = NULL;
+    block->tag = PU_FREE;
+    block->id = 0;
+
+    // link in at the end
+    header->prev = mainzone->blocklist.prev;
+    header->prev->next = header;
+    header->next = block;
+    block->prev = header;
+    block->next = &mainzone->blocklist;
+    mainzone->blocklist.prev = block;
+
+    mainzone->size += chunksize;
+    chunkcount++;
+
+    return block;
 }
 
 
@@ -132,6 +209,9 @@ void Z_Free (void* ptr)
 
     if (block->id != ZONEID)
 	I_Error ("Z_Free: freed a pointer without ZONEID");
+
+    if (block->site)
+	Z_StatFree (block->site, block->tag, block->size);
 		
     if (block->tag != PU_FREE && block->user != NULL)
     {
@@ -177,15 +257,18 @@ void Z_Free (void* ptr)
 //
 // Z_Malloc
 // You can pass a NULL user if the tag is < PU_PURGELEVEL.
+// Z_Malloc is a macro passing where it was called from.
 //
 #define MINFRAGMENT		64
 
 
 void*
-Z_Malloc
+Z_Malloc2
 ( int		size,
   int		tag,
-  void*		user )
+  void*		user,
+  char*		file,
+  int		line )
 {
     int		extra;
     memblock_t*	start;
@@ -194,6 +277,9 @@ Z_Malloc
     memblock_t*	base;
     void *result;
 
+    if (checkallocs)
+	Z_CheckAlloc (file, line);
+
     size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
     
     // scan through the block list,
@@ -219,7 +305,12 @@ Z_Malloc
         if (rover == start)
         {
             // scanned all the way around the list
-            I_Error ("Z_Malloc: failed on allocation of %i bytes", size);
+            base = Z_Grow (size);
+
+            if (base == NULL)
+                I_Error ("Z_Malloc: failed on allocation of %i bytes", size);
+
+            break;
         }
 	
         if (rover->tag != PU_FREE)
@@ -232,6 +323,19 @@ Z_Malloc
             }
             else
             {
+                // anything still reading from it must finish first
+                if (purgecallback)
+                {
+                    purgecallback ();
+                }
+
+                purgecount++;
+                TRACE_INSTANT ("Z_Malloc purge");
+                D_SessionCount (STAT_PURGES, 1);
+
+                if (rover->site)
+                    Z_StatPurge (rover->site, rover->tag, rover->size);
+
                 // free the rover block (adding the size to base)
 
                 // the rover can be the base block
@@ -273,6 +377,10 @@ Z_Malloc
 
     base->user = user;
     base->tag = tag;
+    base->site = zonestats ? Z_StatSite (file, line) : 0;
+
+    if (base->site)
+	Z_StatAlloc (base->site, tag, base->size);
 
     result  = (void *) ((byte *)base + sizeof(memblock_t));
 
@@ -309,13 +417,15 @@ Z_FreeTags
 	// get link before freeing
 	next = block->next;
 
-	// free block?
-	if (block->tag == PU_FREE)
+	// free block, or the start of a chunk?
+	if (block->tag == PU_FREE || block->user == (void *)mainzone)
 	    continue;
 	
 	if (block->tag >= lowtag && block->tag <= hightag)
 	    Z_Free ( (byte *)block+sizeof(memblock_t));
     }
+
+    Z_ClearPools (lowtag, hightag);
 }
 
 
@@ -349,7 +459,8 @@ Z_DumpHeap
 	    break;
 	}
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
+	if ( (byte *)block + block->size != (byte *)block->next
+	  && block->next->user != (void *)mainzone)
 	    printf ("ERROR: block size does not touch the next block\n");
 
 	if ( block->next->prev != block)
@@ -381,7 +492,8 @@ void Z_FileDumpHeap (FILE* f)
 	    break;
 	}
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
+	if ( (byte *)block + block->size != (byte *)block->next
+	  && block->next->user != (void *)mainzone)
 	    fprintf (f,"ERROR: block size does not touch the next block\n");
 
 	if ( block->next->prev != block)
@@ -409,7 +521,8 @@ void Z_CheckHeap (void)
 	    break;
 	}
 	
-	if ( (byte *)block + block->size != (byte *)block->next)
+	if ( (byte *)block + block->size != (byte *)block->next
+	  && block->next->user != (void *)mainzone)
 	    I_Error ("Z_CheckHeap: block size does not touch the next block\n");
 
 	if ( block->next->prev != block)
@@ -440,6 +553,9 @@ void Z_ChangeTag2(void *ptr, int tag, char *file, int line)
         I_Error("%s:%i: Z_ChangeTag: an owner is required "
                 "for purgable blocks", file, line);
 
+    if (block->site)
+        Z_StatRetag (block->site, block->tag, tag, block->size);
+
     block->tag = tag;
 }
 
@@ -481,8 +597,79 @@ int Z_FreeMemory (void)
     return free;
 }
 
+//
+// Z_ReleaseFree
+// Hands the whole pages of free blocks back to the system,
+//  which gives them back zeroed once they're written again.
+//
+void Z_ReleaseFree (void)
+{
+#ifndef _WIN32
+    memblock_t*		block;
+    uintptr_t		page;
+    uintptr_t		start;
+    uintptr_t		end;
+
+    page = sysconf (_SC_PAGESIZE);
+
+    for (block = mainzone->blocklist.next ;
+         block != &mainzone->blocklist;
+         block = block->next)
+    {
+        if (block->tag != PU_FREE)
+            continue;
+
+        // the header stays
+        start = ((uintptr_t) (block + 1) + page - 1) & ~(page - 1);
+        end = ((uintptr_t) block + block->size) & ~(page - 1);
+
+        if (start < end)
+            madvise ((void *) start, end - start, MADV_DONTNEED);
+    }
+#endif
+
+    Z_ReleasePools ();
+}
+
+//
+// Z_FreeBlocks
+//
+void Z_FreeBlocks (int *free, int *largest, int *count)
+{
+    memblock_t*		block;
+
+    *free = 0;
+    *largest = 0;
+    *count = 0;
+
+    for (block = mainzone->blocklist.next ;
+         block != &mainzone->blocklist;
+         block = block->next)
+    {
+        if (block->tag == PU_FREE)
+        {
+            *free += block->size;
+            *count += 1;
+
+            if (block->size > *largest)
+                *largest = block->size;
+        }
+    }
+}
+
 unsigned int Z_ZoneSize(void)
 {
     return mainzone->size;
 }
 
+int Z_PurgeCount(void)
+{
+    return purgecount;
+}
+
+
+void Z_SetPurgeCallback (void (*callback)(void))
+{
+    purgecallback = callback;
+}
+
@@ -51,7 +51,7 @@ enum
         
 
 void	Z_Init (void);
-void*	Z_Malloc (int size, int tag, void *ptr);
+void*	Z_Malloc2 (int size, int tag, void *ptr, char *file, int line);
 void    Z_Free (void *ptr);
 void    Z_FreeTags (int lowtag, int hightag);
 void    Z_DumpHeap (int lowtag, int hightag);
@@ -61,6 +61,14 @@ void    Z_ChangeTag2 (void *ptr, int tag, char *file, int line);
 void    Z_ChangeUser(void *ptr, void **user);
 int     Z_FreeMemory (void);
 unsigned int Z_ZoneSize(void);
+int     Z_PurgeCount(void);		// blocks purged so far
+void	Z_ReleaseFree (void);
+void    Z_SetPurgeCallback (void (*callback)(void));
+void*	Z_PoolMalloc (int size);
+void	Z_PoolFree (void *ptr);
+void	Z_ClearPools (int lowtag, int hightag);
+void*	Z_LevelMalloc (int size);
+void	Z_ReleasePools (void);
 
 //
 // This is used to get the local FILE:LINE info from CPP
@@ -69,5 +77,8 @@ unsigned int Z_ZoneSize(void);
 #define Z_ChangeTag(p,t)                                       \
     Z_ChangeTag2((p), (t), __FILE__, __LINE__)
 
+#define Z_Malloc(s,t,p)                                        \
+    Z_Malloc2((s), (t), (p), __FILE__, __LINE__)
+
 
 #endif